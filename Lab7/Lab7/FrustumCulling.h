@@ -0,0 +1,48 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include "framework.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Axis aligned boxes kept as separate arrays, so the culling code can load
+// the same component of several boxes with one instruction
+struct CullingBounds
+{
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+
+    UINT GetCount() const { return static_cast<UINT>(centerX.size()); }
+
+    void Clear();
+    void Resize(UINT count);
+    void Add(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extent);
+    void Set(UINT index, const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extent);
+};
+
+enum class CullingPath
+{
+    Scalar,
+    SSE,        // 4 boxes per iteration
+    AVX2,       // 8 boxes per iteration
+    AVX512      // 16 boxes per iteration
+};
+
+// Widest path the processor supports
+CullingPath GetBestCullingPath();
+bool IsCullingPathSupported(CullingPath path);
+const char* GetCullingPathName(CullingPath path);
+
+// Tests every box against six normalized planes facing into the frustum and
+// writes the indices of the boxes that are at least partly inside, in
+// ascending order. visibleIndices must have room for bounds.GetCount()
+// entries. Returns the number of visible boxes.
+UINT CullBounds(const DirectX::XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices);
+UINT CullBounds(const DirectX::XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices, CullingPath path);
+
+#endif
@@ -300,6 +300,17 @@ HRESULT RenderClass::InitBufferShader()
 
     m_pDeviceContext->UpdateSubresource(m_pModelBufferInst, 0, nullptr, m_modelInstances.data(), 0, 0);
 
+    // The cubes only spin in place, so their bounds never change
+    float extent = m_fixedScale * 0.95f;
+    m_cubeBounds.Clear();
+    for (const InstanceData& instance : m_modelInstances)
+    {
+        XMFLOAT3 position;
+        XMStoreFloat3(&position, instance.model.r[3]);
+        m_cubeBounds.Add(position, XMFLOAT3(extent, extent, extent));
+    }
+    m_visibleIndices.resize(m_cubeBounds.GetCount());
+
     D3D11_BUFFER_DESC vpBufferDesc = {};
     vpBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
     vpBufferDesc.ByteWidth = sizeof(CameraBuffer);
@@ -752,6 +763,8 @@ void RenderClass::TerminateBufferShader()
         m_pFullScreenLayout->Release();
 
     m_modelInstances.clear();
+    m_cubeBounds.Clear();
+    m_visibleIndices.clear();
 }
 
 void RenderClass::TerminateSkybox()
@@ -938,23 +951,6 @@ void RenderClass::UpdateFrustum(const XMMATRIX& viewProjMatrix)
     }
 }
 
-bool RenderClass::IsAABBInFrustum(const XMFLOAT3& center, float size) const
-{
-    for (int i = 0; i < 6; i++) 
-    {
-        float d = XMVectorGetX(XMPlaneDotCoord(m_frustumPlanes[i], XMLoadFloat3(&center)));
-        float r = size * (fabs(XMVectorGetX(m_frustumPlanes[i])) +
-            fabs(XMVectorGetY(m_frustumPlanes[i])) +
-            fabs(XMVectorGetZ(m_frustumPlanes[i])));
-
-        if (d + r < 0) 
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
 void RenderClass::Render()
 {
     ID3D11ShaderResourceView* nullSRVs[1] = { nullptr };
@@ -1128,10 +1124,6 @@ void RenderClass::RenderCubes(XMMATRIX view, XMMATRIX proj)
     m_CubeAngle += 0.01f;
     if (m_CubeAngle > XM_2PI) m_CubeAngle -= XM_2PI;
 
-    std::vector<InstanceData> visibleInstances;
-    visibleInstances.reserve(m_modelInstances.size());
-    m_visibleCubes = 0;
-
     for (int i = 0; i < m_modelInstances.size(); i++) {
         XMFLOAT3 position;
         XMStoreFloat3(&position, m_modelInstances[i].model.r[3]);
@@ -1139,16 +1131,22 @@ void RenderClass::RenderCubes(XMMATRIX view, XMMATRIX proj)
         m_modelInstances[i].model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) *
             XMMatrixRotationY(m_CubeAngle) *
             XMMatrixTranslation(position.x, position.y, position.z);
+    }
 
-        float size = m_fixedScale * 0.95f;
-        if (IsAABBInFrustum(position, size)) 
-        {
-            InstanceData data;
-            data.model = XMMatrixTranspose(m_modelInstances[i].model);
-            data.texInd = m_modelInstances[i].texInd;
-            visibleInstances.push_back(data);
-            m_visibleCubes++;
-        }
+    XMFLOAT4 planes[6];
+    for (int i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&planes[i], m_frustumPlanes[i]);
+    }
+
+    m_visibleCubes = CullBounds(planes, m_cubeBounds, m_visibleIndices.data());
+
+    std::vector<InstanceData> visibleInstances(m_visibleCubes);
+    for (int i = 0; i < m_visibleCubes; i++)
+    {
+        UINT id = m_visibleIndices[i];
+        visibleInstances[i].model = XMMatrixTranspose(m_modelInstances[id].model);
+        visibleInstances[i].texInd = m_modelInstances[id].texInd;
     }
 
     if (!visibleInstances.empty())
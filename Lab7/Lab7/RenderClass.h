@@ -6,6 +6,8 @@
 #include <DirectXMath.h>
 #include <vector>
 
+#include "FrustumCulling.h"
+
 using namespace DirectX;
 
 class RenderClass
@@ -79,7 +81,6 @@ public:
     HRESULT CompileShader(const std::wstring& path, ID3D11VertexShader** ppVertexShader, ID3D11PixelShader** ppPixelShader, ID3DBlob** pCodeShader=nullptr);
 
     void UpdateFrustum(const XMMATRIX& viewProjMatrix);
-    bool IsAABBInFrustum(const XMFLOAT3& center, float size) const;
 
     void Render();
     void RenderSkybox(XMMATRIX proj);
@@ -206,6 +207,8 @@ private:
     ID3D11Buffer* m_pModelBufferInst;
     static const int MaxInst = 23;
     std::vector<InstanceData> m_modelInstances = {};
+    CullingBounds m_cubeBounds;
+    std::vector<UINT> m_visibleIndices;
 
     XMVECTOR m_frustumPlanes[6];
 
@@ -0,0 +1,2820 @@
+// Benchmark.cpp : headless measurements of the Lab8 renderer on the CPU backend.
+//
+// Run it from the Lab8 source folder so the shaders and textures are found:
+//   Benchmark checks [sort | bvh | post | clusters]
+//   Benchmark [raster] [-w width] [-h height] [-f frames] [-t maxThreads] [-o image.ppm]
+//   Benchmark culling [-n instances] [-f frames]
+//   Benchmark bvh [-n maxInstances] [-f frames]
+//   Benchmark instances [-n maxInstances] [-f frames] [-w width] [-h height]
+//   Benchmark store [-n instances] [-f frames]
+//   Benchmark states [-f frames]
+//   Benchmark uploads [-n instances] [-f frames]
+//   Benchmark textures [-c textures] [-t maxLoaderThreads]
+//   Benchmark dds
+//   Benchmark streaming [-c textures] [-b budgetKB] [-f frames]
+//   Benchmark shaders [-o shaders.pack]
+//   Benchmark variants [-f frames] [-w width] [-h height]
+//   Benchmark clusters [-f frames] [-w width] [-h height]
+//   Benchmark record [-n instances] [-f frames] [-t maxThreads] [-w width] [-h height]
+//   Benchmark graph [-f frames] [-w width] [-h height]
+//   Benchmark profile [-n instances] [-f frames] [-w width] [-h height] [-o trace.json]
+//   Benchmark run [-s scene] [-n instances] [-f frames] [-w width] [-h height] [-o results.json]
+//   Benchmark occlusion [-n instances] [-f frames] [-w width] [-h height]
+//   Benchmark oit [-n maxQuads] [-f frames] [-w width] [-h height]
+//   Benchmark sort [-n keys] [-f frames] [-t maxThreads]
+//   Benchmark post [-f frames] [-w width] [-h height]
+//   Benchmark shadows [-n instances] [-f frames] [-w width] [-h height]
+//   Benchmark deferred [-n instances] [-f frames] [-w width] [-h height]
+//
+// Linux: CMakeLists.txt in the Lab8 folder builds this file with the renderer
+// sources and registers each mode with ctest, see the notes there.
+
+#include "Platform.h"
+#include "RenderClass.h"
+#include "Checks.h"
+#include "CpuBackend.h"
+#include "DDSFile.h"
+#include "FrustumCulling.h"
+#include "InstanceStore.h"
+#include "LightClusters.h"
+#include "PostProcess.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "ShaderCache.h"
+#include "TextureLoader.h"
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include "D3D11Backend.h"
+#else
+#include <dirent.h>
+#endif
+
+using namespace DirectX;
+
+// Every heap allocation of the process, for the uploads and dds benchmarks
+static std::atomic<UINT64> g_heapAllocations(0);
+static std::atomic<UINT64> g_heapBytes(0);
+
+// All forms go through these two so every allocation is counted and each
+// delete frees with the function that matches its new
+static void* CountedAlloc(size_t size, size_t alignment)
+{
+    g_heapAllocations++;
+    g_heapBytes += size;
+    if (size == 0)
+        size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return malloc(size);
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+static void CountedFree(void* p, size_t alignment) noexcept
+{
+#ifdef _WIN32
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    {
+        _aligned_free(p);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    free(p);
+}
+
+static void* CountedNew(size_t size, size_t alignment)
+{
+    void* p = CountedAlloc(size, alignment);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return CountedNew(size, 0); }
+void* operator new[](size_t size) { return CountedNew(size, 0); }
+void* operator new(size_t size, std::align_val_t al) { return CountedNew(size, static_cast<size_t>(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return CountedNew(size, static_cast<size_t>(al)); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size, static_cast<size_t>(al));
+}
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return CountedAlloc(size, static_cast<size_t>(al));
+}
+
+void operator delete(void* p) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, size_t) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { CountedFree(p, 0); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { CountedFree(p, 0); }
+void operator delete(void* p, std::align_val_t al) noexcept { CountedFree(p, static_cast<size_t>(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept { CountedFree(p, static_cast<size_t>(al)); }
+void operator delete(void* p, size_t, std::align_val_t al) noexcept { CountedFree(p, static_cast<size_t>(al)); }
+void operator delete[](void* p, size_t, std::align_val_t al) noexcept { CountedFree(p, static_cast<size_t>(al)); }
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    CountedFree(p, static_cast<size_t>(al));
+}
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    CountedFree(p, static_cast<size_t>(al));
+}
+
+struct BenchmarkOptions
+{
+    UINT width = 1280;
+    UINT height = 720;
+    UINT frames = 60;
+    UINT maxThreads = 0;
+    UINT instances = 100000;
+    UINT textures = 256;
+    UINT budgetKB = 4096;
+    const char* outputPath = nullptr;
+    const char* scene = "default";
+};
+
+// The scene on a headless CPU device, where every scene benchmark starts.
+// The scene is terminated on every way out of the benchmark.
+struct HeadlessScene
+{
+    CpuRenderDevice device;
+    RenderClass render;
+
+    HeadlessScene(const BenchmarkOptions& options, UINT threadCount) :
+        device(options.width, options.height, threadCount),
+        m_width(options.width),
+        m_height(options.height)
+    {}
+    ~HeadlessScene() { render.Terminate(); }
+
+    // instances 0 keeps the count the scene starts with
+    bool Init(UINT instances = 0)
+    {
+        if (FAILED(render.Init(&device, m_width, m_height)) || (instances && FAILED(render.SetInstanceCount(instances))))
+        {
+            printf("Failed to init the scene, run the benchmark from the Lab8 folder\n");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    UINT m_width;
+    UINT m_height;
+};
+
+static bool SaveImage(CpuRenderDevice& device, const char* path)
+{
+    CpuResource* pBackBuffer = device.GetResource(device.GetBackBuffer());
+    if (!pBackBuffer)
+        return false;
+
+    FILE* pFile = fopen(path, "wb");
+    if (!pFile)
+        return false;
+
+    fprintf(pFile, "P6 %u %u 255\n", pBackBuffer->textureDesc.width, pBackBuffer->textureDesc.height);
+    for (size_t i = 0; i + 4 <= pBackBuffer->data.size(); i += 4)
+    {
+        fwrite(&pBackBuffer->data[i], 1, 3, pFile);
+    }
+    fclose(pFile);
+    return true;
+}
+
+static bool RunScene(const BenchmarkOptions& options, UINT threadCount, RasterPath path, bool saveImage,
+    std::vector<BYTE>& image)
+{
+    HeadlessScene scene(options, threadCount);
+    if (!scene.Init())
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    SoftwareRasterizer& rasterizer = device.GetCpuContext()->GetRasterizer();
+    rasterizer.SetPath(path);
+
+    // warm up caches and the thread pool
+    for (UINT i = 0; i < 3; i++)
+    {
+        render.Render();
+    }
+    rasterizer.ResetStats();
+
+    for (UINT i = 0; i < options.frames; i++)
+    {
+        render.Render();
+    }
+
+    const RasterStats& stats = rasterizer.GetStats();
+    double seconds = stats.seconds > 0.0 ? stats.seconds : 1e-9;
+    printf("%-6s %7u %10.2f %14.0f %14.0f %12.0f\n",
+        GetRasterPathName(rasterizer.GetPath()),
+        rasterizer.GetThreadCount(),
+        seconds * 1000.0 / options.frames,
+        stats.triangles / seconds,
+        stats.pixels / seconds,
+        stats.pixels / seconds / rasterizer.GetThreadCount());
+
+    if (saveImage && options.outputPath && !SaveImage(device, options.outputPath))
+        printf("Failed to write %s\n", options.outputPath);
+
+    image = device.GetResource(device.GetBackBuffer())->data;
+    return true;
+}
+
+static int RunRaster(BenchmarkOptions& options)
+{
+    if (options.maxThreads == 0)
+        options.maxThreads = std::thread::hardware_concurrency();
+    if (options.maxThreads == 0)
+        options.maxThreads = 1;
+
+    // 1, 2, 4, ... and the full thread count
+    std::vector<UINT> threadCounts;
+    for (UINT count = 1; count < options.maxThreads; count *= 2)
+    {
+        threadCounts.push_back(count);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    RasterPath best = GetBestRasterPath();
+    printf("%ux%u, %u frames, %s\n", options.width, options.height, options.frames, GetRasterPathName(best));
+    printf("%-6s %7s %10s %14s %14s %12s\n", "path", "threads", "ms/frame", "triangles/s", "pixels/s", "pixels/s/core");
+
+    std::vector<BYTE> reference;
+    for (size_t i = 0; i < threadCounts.size(); i++)
+    {
+        if (!RunScene(options, threadCounts[i], best, i + 1 == threadCounts.size(), reference))
+            return 1;
+    }
+
+    // the narrower paths at the full thread count must draw the same image
+    const RasterPath paths[] = { RasterPath::AVX2, RasterPath::SSE, RasterPath::Scalar };
+    int failures = 0;
+    for (RasterPath path : paths)
+    {
+        if (path == best || !IsRasterPathSupported(path))
+            continue;
+
+        std::vector<BYTE> image;
+        if (!RunScene(options, options.maxThreads, path, false, image))
+            return 1;
+        if (image != reference)
+        {
+            printf("%s draws a different image than %s\n", GetRasterPathName(path), GetRasterPathName(best));
+            failures++;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+// The per-object test RenderClass used before the batch culling
+static bool IsAABBInFrustum(const XMVECTOR planes[6], const XMFLOAT3& center, float size)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        float d = XMVectorGetX(XMPlaneDotCoord(planes[i], XMLoadFloat3(&center)));
+        float r = size * (fabs(XMVectorGetX(planes[i])) +
+            fabs(XMVectorGetY(planes[i])) +
+            fabs(XMVectorGetZ(planes[i])));
+
+        if (d + r < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A camera at the origin looking a little off the z axis, 100 units far
+static void GetBenchmarkFrustum(XMVECTOR planeVectors[6], XMFLOAT4 planes[6])
+{
+    XMMATRIX viewProj = XMMatrixLookAtLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.3f, 0.1f, 1.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)) *
+        XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 100.0f);
+    XMFLOAT4X4 m;
+    XMStoreFloat4x4(&m, viewProj);
+    planeVectors[0] = XMVectorSet(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+    planeVectors[1] = XMVectorSet(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+    planeVectors[2] = XMVectorSet(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+    planeVectors[3] = XMVectorSet(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+    planeVectors[4] = XMVectorSet(m._13, m._23, m._33, m._43);
+    planeVectors[5] = XMVectorSet(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+    for (int i = 0; i < 6; i++)
+    {
+        planeVectors[i] = XMPlaneNormalize(planeVectors[i]);
+        XMStoreFloat4(&planes[i], planeVectors[i]);
+    }
+}
+
+static int RunCulling(const BenchmarkOptions& options)
+{
+    // cubes scattered in a 200 unit box around a camera at the origin
+    UINT count = options.instances;
+    const float size = 0.5f;
+    CullingBounds bounds;
+    std::vector<XMFLOAT3> centers(count);
+    UINT seed = 12345;
+    for (UINT i = 0; i < count; i++)
+    {
+        float value[3];
+        for (int c = 0; c < 3; c++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            value[c] = (seed >> 8) / 16777216.0f * 200.0f - 100.0f;
+        }
+        centers[i] = XMFLOAT3(value[0], value[1], value[2]);
+        bounds.Add(centers[i], XMFLOAT3(size, size, size));
+    }
+
+    XMVECTOR planeVectors[6];
+    XMFLOAT4 planes[6];
+    GetBenchmarkFrustum(planeVectors, planes);
+
+    std::vector<UINT> visible(count);
+    std::vector<UINT> reference;
+    printf("%u instances, %u frames\n", count, options.frames);
+    printf("%-12s %10s %14s %10s\n", "path", "ms/frame", "instances/s", "visible");
+
+    auto start = std::chrono::steady_clock::now();
+    for (UINT frame = 0; frame < options.frames; frame++)
+    {
+        reference.clear();
+        for (UINT i = 0; i < count; i++)
+        {
+            if (IsAABBInFrustum(planeVectors, centers[i], size))
+                reference.push_back(i);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-12s %10.3f %14.0f %10u\n", "per-object", seconds * 1000.0 / options.frames,
+        count / (seconds / options.frames), static_cast<UINT>(reference.size()));
+
+    const CullingPath paths[] = { CullingPath::Scalar, CullingPath::SSE, CullingPath::AVX2, CullingPath::AVX512 };
+    for (CullingPath path : paths)
+    {
+        if (!IsCullingPathSupported(path))
+            continue;
+
+        UINT visibleCount = 0;
+        start = std::chrono::steady_clock::now();
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            visibleCount = CullBounds(planes, bounds, visible.data(), path);
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        bool matches = visibleCount == reference.size() &&
+            std::equal(reference.begin(), reference.end(), visible.begin());
+        printf("%-12s %10.3f %14.0f %10u%s\n", GetCullingPathName(path), seconds * 1000.0 / options.frames,
+            count / (seconds / options.frames), visibleCount, matches ? "" : "  (differs from per-object)");
+    }
+
+    return 0;
+}
+
+static float RandomFloat(UINT& seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0f;
+}
+
+// Clusters of 256 cubes spread over a box that grows with the count, so the
+// scene stays as dense and the frustum holds about as many cubes
+static void BuildClusteredScene(UINT count, UINT seed, CullingBounds& bounds)
+{
+    const UINT ClusterSize = 256;
+    const float size = 0.5f;
+    float half = 100.0f * cbrtf(count / 100000.0f);
+
+    bounds.Clear();
+    XMFLOAT3 cluster(0.0f, 0.0f, 0.0f);
+    for (UINT i = 0; i < count; i++)
+    {
+        if (i % ClusterSize == 0)
+        {
+            cluster.x = (RandomFloat(seed) * 2.0f - 1.0f) * half;
+            cluster.y = (RandomFloat(seed) * 2.0f - 1.0f) * half;
+            cluster.z = (RandomFloat(seed) * 2.0f - 1.0f) * half;
+        }
+
+        // sums of uniform numbers crowd around the middle of the cluster
+        XMFLOAT3 center = cluster;
+        center.x += (RandomFloat(seed) + RandomFloat(seed) + RandomFloat(seed) - 1.5f) * 4.0f;
+        center.y += (RandomFloat(seed) + RandomFloat(seed) + RandomFloat(seed) - 1.5f) * 4.0f;
+        center.z += (RandomFloat(seed) + RandomFloat(seed) + RandomFloat(seed) - 1.5f) * 4.0f;
+        bounds.Add(center, XMFLOAT3(size, size, size));
+    }
+}
+
+static bool SameIndices(std::vector<UINT>& a, UINT countA, std::vector<UINT>& b, UINT countB)
+{
+    if (countA != countB)
+        return false;
+    std::sort(a.begin(), a.begin() + countA);
+    std::sort(b.begin(), b.begin() + countB);
+    return std::equal(a.begin(), a.begin() + countA, b.begin());
+}
+
+// The BVH against testing every box while a clustered scene grows: the
+// linear test grows with the scene, the tree with what the frustum holds and
+// its depth. Every 16th cube then moves a little and the tree is refit over
+// just those before it culls again.
+static int RunBvh(const BenchmarkOptions& options)
+{
+    XMVECTOR planeVectors[6];
+    XMFLOAT4 planes[6];
+    GetBenchmarkFrustum(planeVectors, planes);
+
+    printf("%u frames, %s\n", options.frames, GetCullingPathName(GetBestCullingPath()));
+    printf("%10s %8s %10s %10s %8s %8s %10s %10s %10s %8s\n", "instances", "visible", "linear ms", "bvh ms",
+        "visited", "depth", "build ms", "refit ms", "full ms", "result");
+
+    int failures = 0;
+    for (UINT count = 1000; ; count *= 10)
+    {
+        if (count > options.instances)
+            count = options.instances;
+
+        CullingBounds bounds;
+        BuildClusteredScene(count, 12345, bounds);
+        BoundingVolumeHierarchy bvh;
+        bvh.Build(bounds);
+
+        std::vector<UINT> linear(count);
+        std::vector<UINT> visible(count);
+        UINT linearCount = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            linearCount = CullBounds(planes, bounds, linear.data());
+        }
+        double linearSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / options.frames;
+
+        UINT visibleCount = 0;
+        start = std::chrono::steady_clock::now();
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            visibleCount = bvh.Cull(planes, bounds, visible.data());
+        }
+        double bvhSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / options.frames;
+        BvhStats stats = bvh.GetStats();
+        bool same = SameIndices(linear, linearCount, visible, visibleCount);
+
+        // the moved cubes only, then every node for comparison
+        std::vector<UINT> moved;
+        UINT seed = 777;
+        for (UINT i = 0; i < count; i += 16)
+        {
+            XMFLOAT3 center(bounds.centerX[i] + RandomFloat(seed) - 0.5f, bounds.centerY[i] + RandomFloat(seed) - 0.5f,
+                bounds.centerZ[i] + RandomFloat(seed) - 0.5f);
+            bounds.Set(i, center, XMFLOAT3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]));
+            moved.push_back(i);
+        }
+        bvh.Refit(bounds, moved.data(), static_cast<UINT>(moved.size()));
+        double refitSeconds = bvh.GetStats().refitSeconds;
+
+        linearCount = CullBounds(planes, bounds, linear.data());
+        visibleCount = bvh.Cull(planes, bounds, visible.data());
+        same = same && SameIndices(linear, linearCount, visible, visibleCount);
+
+        bvh.Refit(bounds);
+        double fullSeconds = bvh.GetStats().refitSeconds;
+
+        if (!same)
+            failures++;
+        printf("%10u %8u %10.3f %10.3f %8u %8u %10.3f %10.3f %10.3f %8s\n", count, linearCount,
+            linearSeconds * 1000.0, bvhSeconds * 1000.0, stats.visitedNodes, stats.depth, stats.buildSeconds * 1000.0,
+            refitSeconds * 1000.0, fullSeconds * 1000.0, same ? "same" : "DIFFERS");
+
+        if (count == options.instances)
+            break;
+    }
+
+    return failures ? 1 : 0;
+}
+
+static double TimeFrames(RenderClass& render, UINT frames)
+{
+    render.Render();
+
+    auto start = std::chrono::steady_clock::now();
+    for (UINT i = 0; i < frames; i++)
+    {
+        render.Render();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+}
+
+// Whole frame time of the scene while the cube count grows, for both culling paths
+static int RunInstances(const BenchmarkOptions& options)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return 1;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    printf("%ux%u, %u frames, %u threads\n", options.width, options.height, options.frames,
+        device.GetCpuContext()->GetRasterizer().GetThreadCount());
+    printf("%10s %10s %12s %12s\n", "instances", "visible", "cpu ms", "compute ms");
+
+    for (UINT count = 23; ; count *= 10)
+    {
+        if (count > options.instances)
+            count = options.instances;
+
+        if (FAILED(render.SetInstanceCount(count)))
+        {
+            printf("Failed to allocate %u instances\n", count);
+            break;
+        }
+
+        render.SetUseComputeCulling(false);
+        double cpuSeconds = TimeFrames(render, options.frames);
+        int visible = render.GetVisibleCubes();
+
+        render.SetUseComputeCulling(true);
+        double computeSeconds = TimeFrames(render, options.frames);
+
+        printf("%10u %10d %12.3f %12.3f\n", count, visible, cpuSeconds * 1000.0, computeSeconds * 1000.0);
+
+        if (count == options.instances)
+            break;
+    }
+
+    return 0;
+}
+
+static XMFLOAT4 RandomRotation(UINT& seed)
+{
+    XMFLOAT4 rotation;
+    XMVECTOR q = XMVectorSet(RandomFloat(seed) - 0.5f, RandomFloat(seed) - 0.5f, RandomFloat(seed) - 0.5f, RandomFloat(seed) - 0.5f);
+    XMStoreFloat4(&rotation, XMQuaternionNormalize(q));
+    return rotation;
+}
+
+// Composes and uploads what changed, returns the bytes uploaded
+static UINT UploadStore(InstanceStore& store, RenderContext* pContext, RenderHandle buffer)
+{
+    store.Compose();
+    const std::vector<InstanceTransform>& transforms = store.GetTransforms();
+    for (const InstanceRange& range : store.GetDirtyRanges())
+    {
+        pContext->UpdateBufferRange(buffer, sizeof(InstanceTransform) * range.first, &transforms[range.first],
+            sizeof(InstanceTransform) * range.count);
+    }
+    store.ClearDirty();
+    return store.GetStats().rangeInstances * sizeof(InstanceTransform);
+}
+
+// The instance store while a growing share of the cubes moves every frame:
+// only those are composed and uploaded, against composing and uploading
+// every cube. The buffer is then compared with DirectXMath matrices.
+static int RunInstanceStore(const BenchmarkOptions& options)
+{
+    UINT count = options.instances;
+    InstanceStore store;
+    store.SetLocalExtent(XMFLOAT3(1.0f, 1.0f, 1.0f));
+    store.Reserve(count);
+    UINT seed = 12345;
+    for (UINT i = 0; i < count; i++)
+    {
+        XMFLOAT3 position(RandomFloat(seed) * 200.0f - 100.0f, RandomFloat(seed) * 200.0f - 100.0f, RandomFloat(seed) * 200.0f - 100.0f);
+        store.Add(position, RandomRotation(seed), 0.25f + RandomFloat(seed), i % 2);
+    }
+
+    CpuRenderDevice device(64, 64, 1);
+    CpuRenderContext* pContext = device.GetCpuContext();
+    BufferDesc desc;
+    desc.byteWidth = sizeof(InstanceTransform) * count;
+    desc.bindFlags = BIND_SHADER_RESOURCE;
+    desc.miscFlags = MISC_STRUCTURED;
+    desc.structureStride = sizeof(InstanceTransform);
+    RenderHandle buffer = NullHandle;
+    if (FAILED(device.CreateBuffer(desc, nullptr, &buffer)))
+    {
+        printf("Failed to create the instance buffer\n");
+        return 1;
+    }
+    UploadStore(store, pContext, buffer);
+    pContext->ClearCommands();
+
+    printf("%u instances, %u frames\n", count, options.frames);
+    printf("%10s %8s %12s %12s %12s %12s %12s\n", "changed", "ranges", "compose ms", "upload ms", "upload KB",
+        "full ms", "full KB");
+
+    const UINT shares[] = { 0, 1000, 100, 10, 1 };
+    for (UINT share : shares)
+    {
+        UINT changed = share ? count / share : 0;
+        double composeSeconds = 0.0;
+        double uploadSeconds = 0.0;
+        double bytes = 0.0;
+        double ranges = 0.0;
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            for (UINT i = 0; i < changed; i++)
+            {
+                UINT index = std::min(count - 1, static_cast<UINT>(RandomFloat(seed) * count));
+                XMFLOAT3 position = store.GetPosition(index);
+                position.y += RandomFloat(seed) - 0.5f;
+                store.SetPosition(index, position);
+                store.SetRotation(index, RandomRotation(seed));
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            bytes += UploadStore(store, pContext, buffer);
+            uploadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            composeSeconds += store.GetStats().composeSeconds;
+            ranges += store.GetStats().ranges;
+            pContext->ClearCommands();
+        }
+
+        // everything again, as without dirty tracking
+        double fullSeconds = 0.0;
+        double fullBytes = 0.0;
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            store.MarkAllDirty();
+            auto start = std::chrono::steady_clock::now();
+            fullBytes += UploadStore(store, pContext, buffer);
+            fullSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            pContext->ClearCommands();
+        }
+
+        double frames = options.frames;
+        printf("%10u %8.0f %12.3f %12.3f %12.1f %12.3f %12.1f\n", changed, ranges / frames,
+            composeSeconds * 1000.0 / frames, (uploadSeconds - composeSeconds) * 1000.0 / frames,
+            bytes / 1024.0 / frames, fullSeconds * 1000.0 / frames, fullBytes / 1024.0 / frames);
+    }
+
+    // after the last changes only the dirty cubes were uploaded
+    for (UINT frame = 0; frame < options.frames; frame++)
+    {
+        for (UINT i = 0; i < count / 100; i++)
+        {
+            UINT index = std::min(count - 1, static_cast<UINT>(RandomFloat(seed) * count));
+            store.SetScale(index, 0.25f + RandomFloat(seed));
+        }
+        UploadStore(store, pContext, buffer);
+        pContext->ClearCommands();
+    }
+
+    CpuResource* pBuffer = device.GetResource(buffer);
+    const InstanceTransform* uploaded = reinterpret_cast<const InstanceTransform*>(pBuffer->data.data());
+    const CullingBounds& bounds = store.GetBounds();
+    float maxError = 0.0f;
+    UINT wrong = 0;
+    for (UINT i = 0; i < count; i++)
+    {
+        XMFLOAT3 position = store.GetPosition(i);
+        XMFLOAT4 rotation = store.GetRotation(i);
+        float scale = store.GetScale(i);
+        XMMATRIX model = XMMatrixTranspose(XMMatrixScaling(scale, scale, scale) * XMMatrixRotationQuaternion(XMLoadFloat4(&rotation)) *
+            XMMatrixTranslation(position.x, position.y, position.z));
+        XMFLOAT4X4 expected;
+        XMStoreFloat4x4(&expected, model);
+
+        float error = 0.0f;
+        for (int row = 0; row < 4; row++)
+        {
+            for (int column = 0; column < 4; column++)
+            {
+                error = std::max(error, fabsf(expected.m[row][column] - uploaded[i].model.m[row][column]));
+            }
+        }
+        maxError = std::max(maxError, error);
+
+        // the box holds the rotated unit cube and is what the store culls with
+        float extent[3];
+        for (int row = 0; row < 3; row++)
+        {
+            extent[row] = fabsf(expected.m[row][0]) + fabsf(expected.m[row][1]) + fabsf(expected.m[row][2]);
+        }
+        bool boxWrong = fabsf(extent[0] - uploaded[i].extent.x) > 1e-4f || fabsf(extent[1] - uploaded[i].extent.y) > 1e-4f ||
+            fabsf(extent[2] - uploaded[i].extent.z) > 1e-4f || bounds.extentX[i] != uploaded[i].extent.x ||
+            bounds.centerX[i] != position.x || bounds.centerY[i] != position.y || bounds.centerZ[i] != position.z;
+        if (error > 1e-4f || boxWrong || uploaded[i].texInd != store.GetTexIndex(i))
+            wrong++;
+    }
+    printf("largest difference to DirectXMath %g, %u instances wrong\n", maxError, wrong);
+
+    device.Release(buffer);
+    return wrong ? 1 : 0;
+}
+
+// Frame time of the scene with every light count, with and without the
+// normal map; each run draws through the shader variants for its features
+static int RunVariants(const BenchmarkOptions& options)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return 1;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    printf("%ux%u, %u frames, %u threads\n", options.width, options.height, options.frames,
+        device.GetCpuContext()->GetRasterizer().GetThreadCount());
+    printf("%10s %10s %8s %10s %12s\n", "normal map", "clustered", "lights", "features", "ms/frame");
+
+    for (int normalMap = 1; normalMap >= 0; normalMap--)
+    {
+        render.SetUseNormalMap(normalMap != 0);
+        for (int clustered = 1; clustered >= 0; clustered--)
+        {
+            render.SetUseClusteredLighting(clustered != 0);
+            const int fewestLights = clustered ? static_cast<int>(RenderClass::LightCount) : 0;
+            for (int lights = RenderClass::LightCount; lights >= fewestLights; lights--)
+            {
+                render.SetActiveLights(static_cast<UINT>(lights));
+                double seconds = TimeFrames(render, options.frames);
+                printf("%10s %10s %8d %10u %12.3f\n", (render.GetFeatures() & RenderClass::FeatureNormalMap) ? "yes" : "no",
+                    clustered ? "yes" : "no", lights, render.GetFeatures(), seconds * 1000.0);
+            }
+        }
+    }
+    printf("%u shader variants compiled\n", render.GetCompiledVariantCount());
+
+    return 0;
+}
+
+// Lists of cluster, light index pairs that differ between two assignments
+static UINT CompareClusterLists(UINT clusterCount, const UINT* ranges, const UINT* indices,
+    const UINT* expectedRanges, const UINT* expectedIndices)
+{
+    UINT mismatches = 0;
+    for (UINT cluster = 0; cluster < clusterCount; cluster++)
+    {
+        UINT count = ranges[cluster * 2 + 1];
+        if (count != expectedRanges[cluster * 2 + 1] ||
+            memcmp(indices + ranges[cluster * 2], expectedIndices + expectedRanges[cluster * 2], sizeof(UINT) * count) != 0)
+            mismatches++;
+    }
+    return mismatches;
+}
+
+// Light assignment of the clustered shading. The CPU lists are checked
+// against testing every light with every cluster and against LightClusters.cs
+// run by the CPU backend, then the scene is timed with 256 to 4096 lights
+// for both ways of building the lists.
+static int RunClusters(const BenchmarkOptions& options)
+{
+    const UINT MaxLights = RenderClass::MaxLights;
+    const UINT MaxPerCluster = LightClusters::MaxLightsPerCluster;
+
+    // the scene camera, lights scattered over the cube rings and beyond
+    XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 2.0f, -16.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, static_cast<float>(options.width) / options.height, 0.1f, 100.0f);
+    XMFLOAT4X4 viewT;
+    XMStoreFloat4x4(&viewT, XMMatrixTranspose(view));
+
+    LightClusters clusters;
+    clusters.Configure(options.width, options.height, proj);
+    const UINT clusterCount = clusters.GetClusterCount();
+
+    struct Light
+    {
+        XMFLOAT3 position;
+        float range;
+        XMFLOAT3 color;
+        float intensity;
+    };
+    std::vector<Light> lights(MaxLights);
+    std::vector<XMFLOAT4> viewLights(MaxLights);
+    UINT seed = 12345;
+    auto placeLights = [&](float spreadX, float spreadY, float spreadZ, float centerZ)
+    {
+        for (UINT i = 0; i < MaxLights; i++)
+        {
+            float value[4];
+            for (int c = 0; c < 4; c++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                value[c] = (seed >> 8) / 16777216.0f;
+            }
+            Light& light = lights[i];
+            light.position = XMFLOAT3((value[0] - 0.5f) * spreadX, (value[1] - 0.5f) * spreadY, centerZ + (value[2] - 0.5f) * spreadZ);
+            light.range = 0.5f + 2.5f * value[3];
+            light.color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+            light.intensity = 1.0f;
+
+            // in the order of mul(float4(position, 1), view) in LightClusters.cs, so both see the same bits
+            const XMFLOAT3& p = light.position;
+            viewLights[i] = XMFLOAT4(p.x * viewT._11 + p.y * viewT._12 + p.z * viewT._13 + viewT._14,
+                p.x * viewT._21 + p.y * viewT._22 + p.z * viewT._23 + viewT._24,
+                p.x * viewT._31 + p.y * viewT._32 + p.z * viewT._33 + viewT._34, light.range);
+        }
+    };
+    placeLights(60.0f, 6.0f, 60.0f, 0.0f);
+
+    // LightClusters.cs on the CPU backend
+    CpuRenderDevice device(options.width, options.height, options.maxThreads);
+    RenderContext* pContext = device.GetImmediateContext();
+    RenderHandle shader = NullHandle;
+    RenderHandle boundsBuffer = NullHandle;
+    RenderHandle lightBuffer = NullHandle;
+    RenderHandle rangesBuffer = NullHandle;
+    RenderHandle indicesBuffer = NullHandle;
+    RenderHandle overflowBuffer = NullHandle;
+    RenderHandle constantBuffer = NullHandle;
+
+    BufferDesc desc;
+    desc.miscFlags = MISC_STRUCTURED;
+    desc.bindFlags = BIND_SHADER_RESOURCE;
+    desc.byteWidth = sizeof(XMFLOAT4) * 2 * clusterCount;
+    desc.structureStride = sizeof(XMFLOAT4);
+    HRESULT result = device.CreateBuffer(desc, clusters.GetBounds(), &boundsBuffer);
+    if (SUCCEEDED(result))
+    {
+        desc.byteWidth = sizeof(Light) * MaxLights;
+        desc.structureStride = sizeof(Light);
+        result = device.CreateBuffer(desc, lights.data(), &lightBuffer);
+    }
+    if (SUCCEEDED(result))
+    {
+        desc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+        desc.byteWidth = sizeof(UINT) * 2 * clusterCount;
+        desc.structureStride = sizeof(UINT) * 2;
+        result = device.CreateBuffer(desc, nullptr, &rangesBuffer);
+    }
+    if (SUCCEEDED(result))
+    {
+        desc.byteWidth = sizeof(UINT) * MaxPerCluster * clusterCount;
+        desc.structureStride = sizeof(UINT);
+        result = device.CreateBuffer(desc, nullptr, &indicesBuffer);
+    }
+    if (SUCCEEDED(result))
+    {
+        desc.byteWidth = sizeof(UINT);
+        result = device.CreateBuffer(desc, nullptr, &overflowBuffer);
+    }
+    if (SUCCEEDED(result))
+    {
+        BufferDesc constantDesc;
+        constantDesc.byteWidth = sizeof(ClusterConstants);
+        constantDesc.bindFlags = BIND_CONSTANT_BUFFER;
+        result = device.CreateBuffer(constantDesc, nullptr, &constantBuffer);
+    }
+    if (SUCCEEDED(result))
+    {
+        result = device.CreateShader(ShaderStage::Compute, L"LightClusters.cs", &shader);
+    }
+    if (FAILED(result))
+    {
+        printf("Failed to create the light cluster buffers\n");
+        return 1;
+    }
+
+    pContext->SetShader(ShaderStage::Compute, shader);
+    pContext->SetConstantBuffer(ShaderStage::Compute, 3, constantBuffer);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, boundsBuffer);
+    pContext->SetShaderResource(ShaderStage::Compute, 2, lightBuffer);
+    pContext->SetUnorderedAccess(0, rangesBuffer);
+    pContext->SetUnorderedAccess(1, indicesBuffer);
+    pContext->SetUnorderedAccess(2, overflowBuffer);
+
+    std::vector<UINT> ranges(clusterCount * 2);
+    std::vector<UINT> indices(clusterCount * MaxPerCluster);
+    std::vector<UINT> expectedRanges(clusterCount * 2);
+    std::vector<UINT> expectedIndices(clusterCount * MaxPerCluster);
+    std::vector<UINT> computeRanges(clusterCount * 2);
+    std::vector<UINT> computeIndices(clusterCount * MaxPerCluster);
+
+    printf("%ux%u, %u x %u x %u clusters, %u frames\n", options.width, options.height,
+        clusters.GetGridX(), clusters.GetGridY(), LightClusters::SliceCount, options.frames);
+    printf("%8s %-9s %12s %12s %12s %14s %8s %10s\n", "lights", "placed", "per cluster", "assign ms", "brute ms", "compute ms",
+        "dropped", "lists");
+
+    // the scattered lights as they grow, then every light crowded into a
+    // small box in front of the camera, so that clusters fill up and the
+    // three ways must drop the same lights and count them alike
+    struct ClusterCase
+    {
+        UINT lights;
+        bool crowded;
+    };
+    std::vector<ClusterCase> cases;
+    for (UINT lightCount = 256; lightCount <= MaxLights; lightCount *= 2)
+    {
+        cases.push_back({ lightCount, false });
+    }
+    cases.push_back({ MaxLights, true });
+
+    UINT failures = 0;
+    for (const ClusterCase& clusterCase : cases)
+    {
+        const UINT lightCount = clusterCase.lights;
+        if (clusterCase.crowded)
+        {
+            placeLights(6.0f, 3.0f, 6.0f, 10.0f);
+            pContext->UpdateBuffer(lightBuffer, lights.data(), sizeof(Light) * MaxLights);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        UINT indexCount = 0;
+        for (UINT i = 0; i < options.frames; i++)
+        {
+            indexCount = clusters.Assign(viewLights.data(), lightCount, ranges.data(), indices.data());
+        }
+        double assignSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / options.frames;
+
+        UINT dropped = clusters.GetDroppedLights();
+
+        UINT expectedDropped = 0;
+        start = std::chrono::steady_clock::now();
+        clusters.AssignBruteForce(viewLights.data(), lightCount, expectedRanges.data(), expectedIndices.data(), &expectedDropped);
+        double bruteSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        ClusterConstants constants;
+        clusters.GetConstants(view, view * proj, lightCount, constants);
+        pContext->UpdateBuffer(constantBuffer, &constants, sizeof(constants));
+        const UINT zero = 0;
+        pContext->UpdateBuffer(overflowBuffer, &zero, sizeof(zero));
+        start = std::chrono::steady_clock::now();
+        pContext->Dispatch((clusterCount + 63) / 64, 1, 1);
+        double computeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        UINT computeDropped = 0;
+        pContext->ReadBuffer(rangesBuffer, computeRanges.data(), sizeof(UINT) * 2 * clusterCount);
+        pContext->ReadBuffer(indicesBuffer, computeIndices.data(), sizeof(UINT) * MaxPerCluster * clusterCount);
+        pContext->ReadBuffer(overflowBuffer, &computeDropped, sizeof(computeDropped));
+
+        UINT mismatches = CompareClusterLists(clusterCount, ranges.data(), indices.data(), expectedRanges.data(), expectedIndices.data()) +
+            CompareClusterLists(clusterCount, computeRanges.data(), computeIndices.data(), expectedRanges.data(), expectedIndices.data());
+        bool countedAlike = dropped == expectedDropped && computeDropped == expectedDropped && (dropped > 0 || !clusterCase.crowded);
+        failures += mismatches + (countedAlike ? 0 : 1);
+
+        printf("%8u %-9s %12.2f %12.3f %12.3f %14.3f %8u %10s\n", lightCount, clusterCase.crowded ? "crowded" : "scattered",
+            static_cast<float>(indexCount) / clusterCount, assignSeconds * 1000.0, bruteSeconds * 1000.0, computeSeconds * 1000.0,
+            dropped, mismatches ? "MISMATCH" : countedAlike ? "ok" : "COUNTS");
+    }
+
+    pContext->ClearState();
+    RenderHandle handles[] = { shader, boundsBuffer, lightBuffer, rangesBuffer, indicesBuffer, overflowBuffer, constantBuffer };
+    for (RenderHandle handle : handles)
+    {
+        device.Release(handle);
+    }
+
+    // the whole frame with the scene's own lights
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return 1;
+    RenderClass& render = scene.render;
+
+    printf("%u threads\n", scene.device.GetCpuContext()->GetRasterizer().GetThreadCount());
+    // still lights, so that both paths drop the same ones
+    const UINT SettleFrames = 4;
+    render.SetAnimateLights(false);
+    printf("%8s %12s %12s %12s %10s\n", "lights", "per cluster", "cpu ms", "compute ms", "dropped");
+    for (UINT lightCount = RenderClass::LightCount; lightCount <= MaxLights; lightCount = lightCount < 256 ? 256 : lightCount * 2)
+    {
+        render.SetActiveLights(lightCount);
+
+        render.SetUseComputeClusters(false);
+        double cpuSeconds = TimeFrames(render, options.frames);
+        float perCluster = static_cast<float>(render.GetClusterLightIndices()) / render.GetLightClusters().GetClusterCount();
+
+        UINT cpuDropped = render.GetClusterDroppedLights();
+
+        render.SetUseComputeClusters(true);
+        double computeSeconds = TimeFrames(render, options.frames);
+        // the compute count is read back a few frames late
+        for (UINT i = 0; i < SettleFrames; i++)
+        {
+            render.Render();
+        }
+        if (render.GetClusterDroppedLights() != cpuDropped)
+        {
+            printf("the compute pass dropped %u lights, the cpu %u\n", render.GetClusterDroppedLights(), cpuDropped);
+            failures++;
+        }
+
+        printf("%8u %12.2f %12.3f %12.3f %10u\n", lightCount, perCluster, cpuSeconds * 1000.0, computeSeconds * 1000.0, cpuDropped);
+    }
+
+    return failures ? 1 : 0;
+}
+
+// The seconds per timed frame of a scene run and the image it ended on
+struct SceneCapture
+{
+    double frameSeconds = 0.0;
+    std::vector<BYTE> image;
+};
+
+// Draws warmup untimed frames, the timed frames, then settle untimed ones
+// for counters that are read back a few frames late, and keeps the last
+// image. beforeFrame(frame) runs before every frame with the timed frame it
+// stands for, the first while warming up and the last while settling.
+// afterFrame() runs after every timed frame.
+template <typename BeforeFrame, typename AfterFrame>
+static bool CaptureScene(CpuRenderDevice& device, RenderClass& render, UINT warmup, UINT frames, UINT settle,
+    const BeforeFrame& beforeFrame, const AfterFrame& afterFrame, SceneCapture& capture)
+{
+    for (UINT i = 0; i < warmup; i++)
+    {
+        beforeFrame(0);
+        render.Render();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (UINT i = 0; i < frames; i++)
+    {
+        beforeFrame(i);
+        render.Render();
+        afterFrame();
+    }
+    capture.frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / frames;
+
+    for (UINT i = 0; i < settle; i++)
+    {
+        beforeFrame(frames - 1);
+        render.Render();
+    }
+
+    CpuResource* pBackBuffer = device.GetResource(device.GetBackBuffer());
+    if (pBackBuffer)
+        capture.image = pBackBuffer->data;
+    return pBackBuffer != nullptr;
+}
+
+// How far apart two RGBA8 images are in their color channels
+struct ImageDifference
+{
+    bool sameSize = false;
+    int largest = 0;            // of a channel
+    double meanError = 0.0;     // of a channel, in 1/255
+    UINT pixelsOff = 0;         // pixels with a channel more than the tolerance off
+};
+
+static ImageDifference CompareImages(const std::vector<BYTE>& a, const std::vector<BYTE>& b, int tolerance = 0)
+{
+    ImageDifference difference;
+    difference.sameSize = a.size() == b.size();
+    if (!difference.sameSize)
+    {
+        difference.largest = 256;
+        return difference;
+    }
+
+    UINT64 errorSum = 0;
+    for (size_t i = 0; i + 4 <= a.size(); i += 4)
+    {
+        int largest = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            int error = abs(static_cast<int>(a[i + c]) - static_cast<int>(b[i + c]));
+            errorSum += error;
+            largest = std::max(largest, error);
+        }
+        difference.largest = std::max(difference.largest, largest);
+        if (largest > tolerance)
+            difference.pixelsOff++;
+    }
+    if (a.size() >= 4)
+        difference.meanError = static_cast<double>(errorSum) / (3.0 * (a.size() / 4));
+    return difference;
+}
+
+struct RecordRun : SceneCapture
+{
+    double recordSeconds = 0.0;
+    double executeSeconds = 0.0;
+    UINT passes = 0;
+};
+
+// The scene with CPU culling and CPU light assignment, whose passes record
+// on recordThreads threads, or serially into the immediate context
+static bool RunRecordScene(const BenchmarkOptions& options, UINT recordThreads, bool useDeferred, RecordRun& run)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    render.SetUseComputeCulling(false);
+    render.SetUseClusteredLighting(true);
+    render.SetUseComputeClusters(false);
+    render.SetActiveLights(RenderClass::MaxLights);
+    render.SetRecordThreads(recordThreads);
+    render.SetUseDeferredRecording(useDeferred);
+
+    bool captured = CaptureScene(device, render, 3, options.frames, 0, [](UINT) {}, [&]
+    {
+        const FrameRecorderStats& stats = render.GetFrameRecorder().GetStats();
+        run.recordSeconds += stats.recordSeconds / options.frames;
+        run.executeSeconds += stats.executeSeconds / options.frames;
+        run.passes = stats.passes;
+    }, run);
+
+    return captured;
+}
+
+// Recording the passes of a frame on deferred contexts with a growing
+// number of threads against recording them serially. Every run has to draw
+// the same image as the serial one.
+static int RunRecord(BenchmarkOptions& options)
+{
+    if (options.maxThreads == 0)
+        options.maxThreads = std::thread::hardware_concurrency();
+    if (options.maxThreads == 0)
+        options.maxThreads = 1;
+
+    std::vector<UINT> threadCounts;
+    for (UINT count = 1; count < options.maxThreads; count *= 2)
+    {
+        threadCounts.push_back(count);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    RecordRun serial;
+    if (!RunRecordScene(options, 1, false, serial))
+        return 1;
+
+    printf("%ux%u, %u instances, %u lights, %u frames, %u passes\n", options.width, options.height,
+        options.instances, RenderClass::MaxLights, options.frames, serial.passes);
+    printf("%-8s %8s %10s %10s %10s %8s\n", "record", "threads", "record ms", "execute ms", "frame ms", "image");
+    printf("%-8s %8u %10.3f %10.3f %10.3f %8s\n", "serial", 1, serial.recordSeconds * 1000.0, 0.0,
+        serial.frameSeconds * 1000.0, "-");
+
+    int failures = 0;
+    for (UINT threads : threadCounts)
+    {
+        RecordRun run;
+        if (!RunRecordScene(options, threads, true, run))
+            return 1;
+
+        ImageDifference difference = CompareImages(run.image, serial.image);
+        bool same = difference.sameSize && difference.largest == 0;
+        if (!same)
+            failures++;
+        printf("%-8s %8u %10.3f %10.3f %10.3f %8s\n", "deferred", threads, run.recordSeconds * 1000.0,
+            run.executeSeconds * 1000.0, run.frameSeconds * 1000.0, same ? "same" : "DIFFERS");
+    }
+
+    return failures ? 1 : 0;
+}
+
+// A post-processing chain declared out of order, with a pass nobody reads:
+// Blur, Scene, Bright, Composite, Debug and Tonemap
+static void DeclareTestGraph(RenderGraph& graph, GraphResource* pTextures)
+{
+    TextureDesc desc;
+    desc.width = 256;
+    desc.height = 256;
+    desc.bindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+
+    graph.Reset();
+    GraphResource scene = graph.CreateTexture("Scene", desc);
+    GraphResource bright = graph.CreateTexture("Bright", desc);
+    GraphResource blur = graph.CreateTexture("Blur", desc);
+    GraphResource tonemapped = graph.CreateTexture("Tonemapped", desc);
+    GraphResource debug = graph.CreateTexture("Debug", desc);
+    GraphResource output = graph.ImportResource("Output", NullHandle);
+    graph.SetOutput(output);
+
+    UINT pass = graph.AddPass("Blur", 0);
+    graph.Read(pass, bright, ShaderStage::Pixel, 0);
+    graph.Write(pass, blur);
+    pass = graph.AddPass("Scene", 1);
+    graph.Write(pass, scene);
+    pass = graph.AddPass("Bright", 2);
+    graph.Read(pass, scene);
+    graph.Write(pass, bright);
+    pass = graph.AddPass("Composite", 3);
+    graph.Read(pass, scene, ShaderStage::Pixel, 0);
+    graph.Read(pass, tonemapped, ShaderStage::Pixel, 1);
+    graph.Write(pass, output);
+    pass = graph.AddPass("Debug", 4);
+    graph.Read(pass, scene);
+    graph.Write(pass, debug);
+    pass = graph.AddPass("Tonemap", 5);
+    graph.Read(pass, blur, ShaderStage::Pixel, 0);
+    graph.Write(pass, tonemapped);
+
+    pTextures[0] = scene;
+    pTextures[1] = bright;
+    pTextures[2] = blur;
+    pTextures[3] = tonemapped;
+}
+
+// Checks of the render graph compiler on small graphs, then what the graph
+// of the scene saves with the negative effect off and on
+static int RunGraph(const BenchmarkOptions& options)
+{
+    int failures = 0;
+    RenderGraph graph;
+    GraphResource textures[4];
+    DeclareTestGraph(graph, textures);
+    Check(SUCCEEDED(graph.Compile()), "compiles", failures);
+
+    const UINT expectedOrder[] = { 1, 2, 0, 5, 3 };
+    bool ordered = graph.GetExecutedPassCount() == 5;
+    for (UINT i = 0; ordered && i < 5; i++)
+    {
+        ordered = graph.GetExecutedPass(i) == expectedOrder[i];
+    }
+    Check(ordered, "readers run after writers", failures);
+    Check(graph.IsPassCulled(4) && graph.GetStats().culledPasses == 1, "unread pass culled", failures);
+
+    // Bright is done once Blur has run, Tonemapped comes after
+    const RenderGraphStats& stats = graph.GetStats();
+    Check(stats.transientTextures == 4 && stats.physicalTextures == 3, "4 transient textures on 3", failures);
+    Check(graph.GetPhysicalIndex(textures[3]) == graph.GetPhysicalIndex(textures[1]), "texture reused", failures);
+    Check(graph.GetPhysicalIndex(textures[2]) != graph.GetPhysicalIndex(textures[1]) &&
+        graph.GetPhysicalIndex(textures[0]) != graph.GetPhysicalIndex(textures[3]), "live textures apart", failures);
+    Check(graph.GetUnbindCount(0) == 1 && graph.GetUnbindCount(2) == 0 && graph.GetUnbindCount(3) == 2 &&
+        graph.GetUnbindCount(5) == 1, "bound slots unbound", failures);
+
+    // compiling the same graph again must not allocate
+    UINT64 allocations = g_heapAllocations;
+    for (UINT i = 0; i < 1000; i++)
+    {
+        DeclareTestGraph(graph, textures);
+        graph.Compile();
+    }
+    Check(g_heapAllocations == allocations, "no allocations once settled", failures);
+
+    graph.Reset();
+    GraphResource first = graph.CreateTexture("First", TextureDesc());
+    GraphResource second = graph.CreateTexture("Second", TextureDesc());
+    graph.SetOutput(second);
+    UINT pass = graph.AddPass("A", 0);
+    graph.Read(pass, first);
+    graph.Write(pass, second);
+    pass = graph.AddPass("B", 1);
+    graph.Read(pass, second);
+    graph.Write(pass, first);
+    Check(graph.Compile() == E_FAIL, "cycle rejected", failures);
+
+    printf("\n%ux%u, %u frames\n", options.width, options.height, options.frames);
+    printf("%-10s %8s %8s %10s %12s %12s %10s\n", "negative", "passes", "culled", "textures", "transient KB", "physical KB", "frame ms");
+    for (int negative = 0; negative < 2; negative++)
+    {
+        HeadlessScene scene(options, options.maxThreads);
+        if (!scene.Init())
+            return 1;
+        RenderClass& render = scene.render;
+        render.SetUseNegative(negative != 0);
+        render.Render();
+
+        double seconds = TimeFrames(render, options.frames);
+        const RenderGraphStats& sceneStats = render.GetRenderGraph().GetStats();
+        printf("%-10s %8u %8u %10u %12.1f %12.1f %10.3f\n", negative ? "on" : "off", sceneStats.passes,
+            sceneStats.culledPasses, sceneStats.physicalTextures, sceneStats.transientBytes / 1024.0,
+            sceneStats.physicalBytes / 1024.0, seconds * 1000.0);
+    }
+
+    return failures ? 1 : 0;
+}
+
+struct ScopeTotal
+{
+    const char* name;
+    bool gpu;
+    double seconds;
+    UINT count;
+};
+
+// Where the frame time goes: every profiler scope averaged over the frames
+// whose GPU timings came back, which on the CPU backend time the commands
+// as they execute. The frames are also written as a Chrome trace.
+static int RunProfile(const BenchmarkOptions& options)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return 1;
+    RenderClass& render = scene.render;
+
+    for (UINT i = 0; i < options.frames; i++)
+    {
+        render.Render();
+    }
+
+    const Profiler& profiler = render.GetProfiler();
+    std::vector<ScopeTotal> totals;
+    UINT resolvedFrames = 0;
+    double cpuSeconds = 0.0;
+    double gpuSeconds = 0.0;
+    for (UINT i = 0; i < profiler.GetFrameCount(); i++)
+    {
+        const ProfileFrame& frame = profiler.GetFrame(i);
+        if (!frame.gpuResolved)
+            continue;
+
+        resolvedFrames++;
+        cpuSeconds += frame.cpuSeconds;
+        gpuSeconds += frame.gpuSeconds;
+        for (const ProfileEvent& event : frame.events)
+        {
+            const bool gpu = event.track == Profiler::GpuTrack;
+            auto found = std::find_if(totals.begin(), totals.end(), [&](const ScopeTotal& total)
+            {
+                return total.gpu == gpu && strcmp(total.name, event.name) == 0;
+            });
+            if (found == totals.end())
+                found = totals.insert(totals.end(), { event.name, gpu, 0.0, 0 });
+            found->seconds += event.duration;
+            found->count++;
+        }
+    }
+
+    if (resolvedFrames == 0)
+    {
+        printf("No frame has GPU timings\n");
+        return 1;
+    }
+
+    std::stable_sort(totals.begin(), totals.end(), [](const ScopeTotal& a, const ScopeTotal& b)
+    {
+        return a.gpu != b.gpu ? a.gpu : a.seconds > b.seconds;
+    });
+
+    printf("%ux%u, %u instances, %u frames with GPU timings\n", options.width, options.height,
+        render.GetInstanceCount(), resolvedFrames);
+    printf("%-16s %5s %10s %10s\n", "scope", "", "ms/frame", "per frame");
+    printf("%-16s %5s %10.3f\n", "Frame", "GPU", gpuSeconds * 1000.0 / resolvedFrames);
+    for (const ScopeTotal& total : totals)
+    {
+        if (total.gpu)
+            printf("%-16s %5s %10.3f %10.2f\n", total.name, "GPU", total.seconds * 1000.0 / resolvedFrames, double(total.count) / resolvedFrames);
+    }
+    printf("%-16s %5s %10.3f\n", "Frame", "CPU", cpuSeconds * 1000.0 / resolvedFrames);
+    for (const ScopeTotal& total : totals)
+    {
+        if (!total.gpu)
+            printf("%-16s %5s %10.3f %10.2f\n", total.name, "CPU", total.seconds * 1000.0 / resolvedFrames, double(total.count) / resolvedFrames);
+    }
+    if (profiler.GetDroppedScopes() > 0)
+        printf("%u scopes dropped\n", profiler.GetDroppedScopes());
+
+    const char* tracePath = options.outputPath ? options.outputPath : "profile.json";
+    HRESULT result = profiler.WriteChromeTrace(std::wstring(tracePath, tracePath + strlen(tracePath)));
+    if (FAILED(result))
+        printf("Failed to write %s\n", tracePath);
+    else
+        printf("%u frames written to %s\n", profiler.GetFrameCount(), tracePath);
+
+    return FAILED(result) ? 1 : 0;
+}
+
+// Configurations of the Lab8 scene the scripted run can load
+struct ScenePreset
+{
+    const char* name;
+    UINT instances;         // 0 takes -n
+    UINT lights;
+    bool computeCulling;
+    bool clustered;
+    bool computeClusters;
+    bool negative;
+    bool shadows;
+    bool deferred;
+};
+
+static const ScenePreset ScenePresets[] =
+{
+    { "default", 23, RenderClass::LightCount, true, true, true, false, false, false },
+    { "instances", 0, RenderClass::LightCount, true, true, true, false, false, false },
+    { "lights", 23, RenderClass::MaxLights, true, true, true, false, false, false },
+    { "cpu", 0, 256, false, true, false, false, false, false },
+    { "negative", 23, RenderClass::LightCount, true, true, true, true, false, false },
+    { "shadows", 0, 64, true, true, true, false, true, false },
+    { "deferred", 0, 256, false, true, false, false, false, true },
+};
+
+// One orbit around the scene over the run, starting from the camera of the
+// app, dollying in halfway and bobbing up and down while it looks at the middle
+static void PlaceScriptedCamera(RenderClass& render, UINT frame, UINT frames)
+{
+    float t = static_cast<float>(frame) / frames;
+    float angle = XM_2PI * t;
+    float radius = 16.0f - 8.0f * sinf(XM_PI * t);
+    float height = 4.0f * sinf(XM_2PI * t);
+
+    XMFLOAT3 position(-radius * sinf(angle), height, -radius * cosf(angle));
+    render.SetCamera(position, angle, atan2f(height, radius));
+}
+
+// Nearest rank of the sorted samples
+static double Percentile(const std::vector<double>& sorted, double percent)
+{
+    size_t rank = static_cast<size_t>(ceil(percent / 100.0 * sorted.size()));
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static UINT64 HashImage(const std::vector<BYTE>& data)
+{
+    UINT64 hash = 14695981039346656037ull;
+    for (BYTE byte : data)
+    {
+        hash = (hash ^ byte) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// A scene preset rendered along a scripted camera path without vsync. Every
+// frame advances the animations by the same step and the textures are
+// loaded before the first one, so two runs draw the same frames and differ
+// only in how long they took. The results go out as JSON for CI to compare;
+// imageHash changes when the last frame does.
+static int RunScripted(const BenchmarkOptions& options)
+{
+    const ScenePreset* pPreset = nullptr;
+    for (const ScenePreset& preset : ScenePresets)
+    {
+        if (strcmp(preset.name, options.scene) == 0)
+            pPreset = &preset;
+    }
+    if (!pPreset)
+    {
+        printf("Unknown scene '%s', one of:", options.scene);
+        for (const ScenePreset& preset : ScenePresets)
+        {
+            printf(" %s", preset.name);
+        }
+        printf("\n");
+        return 1;
+    }
+
+    UINT instances = pPreset->instances ? pPreset->instances : options.instances;
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(instances))
+        return 1;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    render.SetSyncInterval(0);
+    render.SetActiveLights(pPreset->lights);
+    render.SetUseComputeCulling(pPreset->computeCulling);
+    render.SetUseClusteredLighting(pPreset->clustered);
+    render.SetUseComputeClusters(pPreset->computeClusters);
+    render.SetUseNegative(pPreset->negative);
+    render.SetUseShadows(pPreset->shadows);
+    render.SetUseDeferredShading(pPreset->deferred);
+
+    const UINT warmupFrames = 3;
+    for (UINT i = 0; i < warmupFrames; i++)
+    {
+        PlaceScriptedCamera(render, 0, options.frames);
+        render.Render();
+    }
+
+    RenderContext* pContext = device.GetImmediateContext();
+    std::vector<double> frameSeconds(options.frames);
+    RenderStats totals;
+    UINT maxDrawCalls = 0;
+    UINT64 allocations = 0;
+    UINT64 allocatedBytes = 0;
+    UINT64 maxAllocations = 0;
+    for (UINT i = 0; i < options.frames; i++)
+    {
+        PlaceScriptedCamera(render, i, options.frames);
+        pContext->ResetStats();
+        UINT64 allocationsBefore = g_heapAllocations;
+        UINT64 bytesBefore = g_heapBytes;
+
+        auto start = std::chrono::steady_clock::now();
+        render.Render();
+        frameSeconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        UINT64 frameAllocations = g_heapAllocations - allocationsBefore;
+        allocations += frameAllocations;
+        allocatedBytes += g_heapBytes - bytesBefore;
+        maxAllocations = std::max(maxAllocations, frameAllocations);
+        totals += pContext->GetStats();
+        maxDrawCalls = std::max(maxDrawCalls, pContext->GetStats().drawCalls);
+    }
+
+    CpuResource* pBackBuffer = device.GetResource(device.GetBackBuffer());
+    UINT64 imageHash = pBackBuffer ? HashImage(pBackBuffer->data) : 0;
+    UINT threads = device.GetCpuContext()->GetRasterizer().GetThreadCount();
+    double totalSeconds = 0.0;
+    for (double seconds : frameSeconds)
+    {
+        totalSeconds += seconds;
+    }
+    std::vector<double> sorted = frameSeconds;
+    std::sort(sorted.begin(), sorted.end());
+
+    FILE* pFile = options.outputPath ? fopen(options.outputPath, "w") : stdout;
+    if (!pFile)
+    {
+        printf("Failed to write %s\n", options.outputPath);
+        return 1;
+    }
+
+    const double frames = options.frames;
+    fprintf(pFile, "{\n");
+    fprintf(pFile, "  \"scene\": \"%s\",\n", pPreset->name);
+    fprintf(pFile, "  \"width\": %u,\n  \"height\": %u,\n", options.width, options.height);
+    fprintf(pFile, "  \"threads\": %u,\n", threads);
+    fprintf(pFile, "  \"instances\": %u,\n  \"lights\": %u,\n", instances, pPreset->lights);
+    fprintf(pFile, "  \"frames\": %u,\n  \"warmupFrames\": %u,\n", options.frames, warmupFrames);
+    fprintf(pFile, "  \"frameMs\": { \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+        totalSeconds * 1000.0 / frames, sorted.front() * 1000.0, Percentile(sorted, 50.0) * 1000.0,
+        Percentile(sorted, 95.0) * 1000.0, Percentile(sorted, 99.0) * 1000.0, sorted.back() * 1000.0);
+    fprintf(pFile, "  \"drawCalls\": { \"mean\": %.2f, \"max\": %u },\n", totals.drawCalls / frames, maxDrawCalls);
+    fprintf(pFile, "  \"dispatches\": %.2f,\n", totals.dispatches / frames);
+    fprintf(pFile, "  \"triangles\": %.0f,\n", totals.triangles / frames);
+    fprintf(pFile, "  \"allocations\": { \"mean\": %.2f, \"max\": %llu, \"bytes\": %.0f },\n",
+        allocations / frames, (unsigned long long)maxAllocations, allocatedBytes / frames);
+    fprintf(pFile, "  \"imageHash\": \"%016llx\"\n", (unsigned long long)imageHash);
+    fprintf(pFile, "}\n");
+
+    if (pFile != stdout)
+    {
+        fclose(pFile);
+        printf("%s: p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, written to %s\n", pPreset->name,
+            Percentile(sorted, 50.0) * 1000.0, Percentile(sorted, 95.0) * 1000.0,
+            Percentile(sorted, 99.0) * 1000.0, options.outputPath);
+    }
+    return 0;
+}
+
+// A slow walk around the scene at the height of the cubes, where the near
+// ones hide most of the rest
+static void PlaceOcclusionCamera(RenderClass& render, UINT frame, UINT frames)
+{
+    float angle = XM_PIDIV2 * frame / frames;
+    const float radius = 16.0f;
+    render.SetCamera(XMFLOAT3(-radius * sinf(angle), 0.25f, -radius * cosf(angle)), angle, 0.0f);
+}
+
+struct OcclusionRun : SceneCapture
+{
+    double occlusionSeconds = 0.0;      // software occlusion only
+    int visible = 0;
+};
+
+// The walk, or the still camera of the app at (0, 0, -16), with one culling
+// path; the last frame's image and visible count are kept
+static bool RunOcclusionScene(const BenchmarkOptions& options, bool walk, bool computeCulling, bool occlusion, OcclusionRun& run)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    render.SetSyncInterval(0);
+    render.SetUseComputeCulling(computeCulling);
+    render.SetUseOcclusionCulling(occlusion);
+
+    // the compute path reads its count back a few frames late, settling draws the last frame again
+    bool captured = CaptureScene(device, render, 3, options.frames, computeCulling ? 4 : 0, [&](UINT frame)
+    {
+        if (walk)
+            PlaceOcclusionCamera(render, frame, options.frames);
+    }, [&]
+    {
+        run.occlusionSeconds += render.GetSoftwareOcclusion().GetStats().seconds / options.frames;
+    }, run);
+    run.visible = render.GetVisibleCubes();
+
+    return captured;
+}
+
+// Both culling paths with and without occlusion culling, along the walk and
+// from the camera of the app, which the rings of a few hundred cubes reach.
+// Only hidden cubes may be dropped, so the image has to stay the same; the
+// pixel count shows how far it is off if not.
+static int RunOcclusion(const BenchmarkOptions& options)
+{
+    printf("%ux%u, %u instances, %u frames\n", options.width, options.height, options.instances, options.frames);
+    printf("%-8s %-8s %-10s %10s %10s %12s %10s\n", "camera", "culling", "occlusion", "visible", "frame ms", "occlusion ms", "pixels off");
+
+    int failures = 0;
+    for (int row = 0; row < 4; row++)
+    {
+        const bool walk = row < 2;
+        const bool compute = (row & 1) != 0;
+        OcclusionRun frustum;
+        OcclusionRun occluded;
+        if (!RunOcclusionScene(options, walk, compute, false, frustum) || !RunOcclusionScene(options, walk, compute, true, occluded))
+            return 1;
+
+        ImageDifference difference = CompareImages(frustum.image, occluded.image);
+        if (!difference.sameSize || difference.pixelsOff > 0)
+            failures++;
+
+        const char* camera = walk ? "walk" : "default";
+        const char* path = compute ? "compute" : "cpu";
+        printf("%-8s %-8s %-10s %10d %10.3f %12s %10s\n", camera, path, "off", frustum.visible, frustum.frameSeconds * 1000.0, "-", "-");
+        printf("%-8s %-8s %-10s %10d %10.3f %12.3f %10u\n", camera, path, compute ? "hi-z" : "software", occluded.visible,
+            occluded.frameSeconds * 1000.0, occluded.occlusionSeconds * 1000.0, difference.pixelsOff);
+    }
+
+    return failures ? 1 : 0;
+}
+
+struct TransparencyRun : SceneCapture
+{
+    double sortSeconds = 0.0;
+    UINT fragments = 0;     // linked lists only
+};
+
+static bool RunTransparencyScene(const BenchmarkOptions& options, UINT quads, RenderClass::TransparencyMode mode, TransparencyRun& run)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+    if (FAILED(render.SetTranslucentCount(quads)))
+    {
+        printf("Failed to create %u translucent quads\n", quads);
+        return false;
+    }
+
+    render.SetSyncInterval(0);
+    render.SetTransparencyMode(mode);
+
+    // the warmup compiles the variants of the mode, and lets the node pool
+    // of the linked lists grow to the scene once the counter comes back
+    bool captured = CaptureScene(device, render, 5, options.frames, 0, [](UINT) {}, [&]
+    {
+        run.sortSeconds += render.GetTransparencyStats().sortSeconds / options.frames;
+    }, run);
+    run.fragments = render.GetTransparencyStats().oitNodes;
+
+    return captured;
+}
+
+// The transparency modes over a growing number of translucent quads. The
+// linked lists keep the nearest 32 fragments of a pixel, so while the lists
+// are short they are the reference the other two are compared with: the
+// mean error of a channel in 1/255 and the pixels where a channel is more
+// than 2/255 off. Sorted has to stay within 1/255 in every pixel, which
+// quads that cross each other break along the crossing once the image is
+// large enough to show it. Weighted blended has to stay within a mean
+// error of MaxWeightedError; its weights only approximate the order, 0.08
+// to 0.27 at 1k and 10k quads. Rows where the lists average more than a
+// quarter of the 32 fragments may have dropped some, they are printed but
+// not checked.
+static int RunTransparency(const BenchmarkOptions& options)
+{
+    static const UINT QuadCounts[] = { 1000, 10000, 100000 };
+    static const char* const ModeNames[] = { "sorted", "weighted", "lists" };
+    const double MaxWeightedError = 1.0;
+    const UINT MaxCheckedListLength = 8;
+
+    printf("%ux%u, %u frames\n", options.width, options.height, options.frames);
+    printf("%8s %-10s %10s %10s %12s %12s %10s %8s\n", "quads", "mode", "frame ms", "sort ms", "mean error", "pixels off",
+        "fragments", "result");
+
+    int failures = 0;
+    for (UINT quads : QuadCounts)
+    {
+        quads = std::min(quads, options.instances);
+
+        TransparencyRun runs[3];
+        for (int mode = 0; mode < 3; mode++)
+        {
+            if (!RunTransparencyScene(options, quads, static_cast<RenderClass::TransparencyMode>(mode), runs[mode]))
+                return 1;
+        }
+
+        const TransparencyRun& reference = runs[static_cast<int>(RenderClass::TransparencyMode::LinkedList)];
+        const bool checked = reference.fragments <= static_cast<UINT64>(options.width) * options.height * MaxCheckedListLength;
+        for (int mode = 0; mode < 3; mode++)
+        {
+            const TransparencyRun& run = runs[mode];
+            ImageDifference difference = CompareImages(run.image, reference.image, 2);
+
+            bool passed = difference.sameSize;
+            if (mode == static_cast<int>(RenderClass::TransparencyMode::Sorted))
+                passed = passed && (!checked || difference.largest <= 1);
+            else if (mode == static_cast<int>(RenderClass::TransparencyMode::WeightedBlended))
+                passed = passed && (!checked || difference.meanError <= MaxWeightedError);
+            if (!passed)
+                failures++;
+
+            printf("%8u %-10s %10.3f %10.3f %12.3f %12u %10u %8s\n", quads, ModeNames[mode], run.frameSeconds * 1000.0,
+                run.sortSeconds * 1000.0, difference.meanError, difference.pixelsOff, run.fragments,
+                !passed ? "FAILED" : checked ? "ok" : "-");
+        }
+
+        if (quads == options.instances)
+            break;
+    }
+    return failures ? 1 : 0;
+}
+
+// Render queue keys of a made up frame: a few passes and shaders, many
+// textures and every depth, opaque and transparent mixed
+static void BuildSortKeys(UINT count, std::vector<UINT64>& keys)
+{
+    keys.resize(count);
+    UINT state = 12345;
+    auto next = [&state]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT pass = next() % 6;
+        UINT shader = next() % 48;
+        UINT texture = next() % 1024;
+        float depth = (next() & 0xFFFF) / 65535.0f;
+        UINT64 key = (pass == 4) ? RenderQueue::MakeTransparentKey(pass, shader, texture, depth) :
+            RenderQueue::MakeOpaqueKey(pass, shader, texture, depth);
+        keys[i] = key | i;
+    }
+}
+
+// The radix sort of the render queues against std::stable_sort, on 1, 2,
+// 4, ... threads
+static int RunSort(BenchmarkOptions& options)
+{
+    if (options.maxThreads == 0)
+        options.maxThreads = std::thread::hardware_concurrency();
+    if (options.maxThreads == 0)
+        options.maxThreads = 1;
+
+    std::vector<UINT64> source;
+    BuildSortKeys(options.instances, source);
+
+    // ties between equal keys stay in the order they were added
+    std::vector<UINT64> expected = source;
+    double stdSeconds = 0.0;
+    for (UINT frame = 0; frame < options.frames; frame++)
+    {
+        expected = source;
+        auto start = std::chrono::steady_clock::now();
+        std::stable_sort(expected.begin(), expected.end(), [](UINT64 a, UINT64 b)
+        {
+            return (a >> RenderQueue::ItemBits) < (b >> RenderQueue::ItemBits);
+        });
+        stdSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    printf("%u keys, %u frames\n", options.instances, options.frames);
+    printf("%-12s %7s %7s %10s %10s %12s %8s\n", "sort", "threads", "passes", "ms", "best ms", "Mkeys/s", "correct");
+    printf("%-12s %7u %7s %10.3f %10s %12.1f %8s\n", "stable_sort", 1u, "-", stdSeconds * 1000.0 / options.frames, "-",
+        options.instances * options.frames / stdSeconds / 1e6, "yes");
+
+    std::vector<UINT> threadCounts;
+    for (UINT count = 1; count < options.maxThreads; count *= 2)
+    {
+        threadCounts.push_back(count);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    bool allCorrect = true;
+    for (UINT threads : threadCounts)
+    {
+        ThreadPool pool(threads);
+        RenderQueue queue;
+        queue.Reserve(options.instances);
+
+        double seconds = 0.0;
+        double bestSeconds = 0.0;
+        bool correct = true;
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            queue.Clear();
+            for (UINT i = 0; i < options.instances; i++)
+            {
+                queue.Add(source[i], i);
+            }
+
+            queue.Sort(&pool);
+            double sortSeconds = queue.GetStats().sortSeconds;
+            seconds += sortSeconds;
+            bestSeconds = frame == 0 ? sortSeconds : std::min(bestSeconds, sortSeconds);
+
+            for (UINT i = 0; i < queue.GetCount() && correct; i++)
+            {
+                correct = queue.GetItem(i) == static_cast<UINT>(expected[i] & (RenderQueue::MaxItems - 1));
+            }
+        }
+        allCorrect = allCorrect && correct;
+
+        printf("%-12s %7u %7u %10.3f %10.3f %12.1f %8s\n", "radix", threads, queue.GetStats().passes,
+            seconds * 1000.0 / options.frames, bestSeconds * 1000.0, options.instances * options.frames / seconds / 1e6,
+            correct ? "yes" : "NO");
+    }
+    return allCorrect ? 0 : 1;
+}
+
+// The largest difference of a channel between two RGBA8 images, alpha too
+static int LargestDifference(const std::vector<BYTE>& a, const std::vector<BYTE>& b)
+{
+    if (a.size() != b.size())
+        return 256;
+    int largest = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        largest = std::max(largest, abs(static_cast<int>(a[i]) - static_cast<int>(b[i])));
+    }
+    return largest;
+}
+
+static bool RenderPostProcessScene(const BenchmarkOptions& options, const PostProcessChain* pChain, std::vector<BYTE>& image)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+    if (pChain)
+        render.GetPostProcess() = *pChain;
+
+    render.Render();
+    CpuResource* pBackBuffer = device.GetResource(device.GetBackBuffer());
+    if (pBackBuffer)
+        image = pBackBuffer->data;
+
+    return pBackBuffer != nullptr;
+}
+
+// The post-processing effects on the CPU: the scalar and SSE paths must give
+// the same bytes, fusing may only round differently, and the compute shader
+// of the CPU backend must match the chain applied to the plain scene. Then
+// the throughput of the paths with and without fusing.
+static int RunPostProcess(const BenchmarkOptions& options)
+{
+    const UINT width = options.width;
+    const UINT height = options.height;
+
+    // bright enough for the tone map to matter, with edges for the kernels
+    std::vector<BYTE> source(width * height * 4);
+    UINT seed = 777;
+    for (UINT y = 0; y < height; y++)
+    {
+        for (UINT x = 0; x < width; x++)
+        {
+            BYTE* pPixel = &source[(y * width + x) * 4];
+            bool stripe = ((x / 7) + (y / 5)) % 2 == 0;
+            pPixel[0] = static_cast<BYTE>(x * 255 / std::max(width - 1, 1u));
+            pPixel[1] = static_cast<BYTE>(stripe ? 230 : 40);
+            pPixel[2] = static_cast<BYTE>(RandomFloat(seed) * 255.0f);
+            pPixel[3] = static_cast<BYTE>(y * 255 / std::max(height - 1, 1u));
+        }
+    }
+
+    struct ChainCase
+    {
+        const char* name;
+        UINT count;
+        PostEffect effects[PostMaxEffects];
+    };
+    static const ChainCase Chains[] =
+    {
+        { "tonemap", 1, { PostEffect::ToneMap } },
+        { "grade", 1, { PostEffect::ColorGrade } },
+        { "negative", 1, { PostEffect::Negative } },
+        { "blur", 1, { PostEffect::Blur } },
+        { "sharpen", 1, { PostEffect::Sharpen } },
+        { "grading", 3, { PostEffect::ToneMap, PostEffect::ColorGrade, PostEffect::Negative } },
+        { "full", 5, { PostEffect::ToneMap, PostEffect::Sharpen, PostEffect::ColorGrade, PostEffect::Blur, PostEffect::Negative } },
+    };
+
+    int failures = 0;
+    printf("%ux%u, %u frames\n", width, height, options.frames);
+    printf("%-10s %7s %7s %10s %12s %12s %12s %10s\n", "chain", "effects", "stages", "fused", "scalar Mpx/s", "sse Mpx/s",
+        "sse split", "sse = ref");
+
+    std::vector<BYTE> scalar(source.size());
+    std::vector<BYTE> sse(source.size());
+    std::vector<BYTE> split(source.size());
+    for (const ChainCase& chainCase : Chains)
+    {
+        PostProcessChain chain;
+        chain.SetEffects(chainCase.effects, chainCase.count);
+        PostProcessChain unfused = chain;
+        unfused.SetFuse(false);
+
+        chain.Apply(source.data(), scalar.data(), width, height, PostProcessPath::Scalar);
+        chain.Apply(source.data(), sse.data(), width, height, PostProcessPath::SSE);
+        unfused.Apply(source.data(), split.data(), width, height, PostProcessPath::SSE);
+
+        // the same arithmetic in the same order, so not even rounding differs
+        bool same = scalar == sse;
+        if (!same)
+            failures++;
+        // fusing only skips the rounding to 8 bits between the effects
+        int fusedDifference = LargestDifference(sse, split);
+        if (fusedDifference > 8)
+            failures++;
+
+        double seconds[3] = {};
+        for (UINT frame = 0; frame < options.frames; frame++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            chain.Apply(source.data(), scalar.data(), width, height, PostProcessPath::Scalar);
+            auto scalarEnd = std::chrono::steady_clock::now();
+            chain.Apply(source.data(), sse.data(), width, height, PostProcessPath::SSE);
+            auto sseEnd = std::chrono::steady_clock::now();
+            unfused.Apply(source.data(), split.data(), width, height, PostProcessPath::SSE);
+            auto splitEnd = std::chrono::steady_clock::now();
+            seconds[0] += std::chrono::duration<double>(scalarEnd - start).count();
+            seconds[1] += std::chrono::duration<double>(sseEnd - scalarEnd).count();
+            seconds[2] += std::chrono::duration<double>(splitEnd - sseEnd).count();
+        }
+
+        const double pixels = static_cast<double>(width) * height * options.frames;
+        printf("%-10s %7u %7u %10d %12.1f %12.1f %12.1f %10s\n", chainCase.name, chain.GetEffectCount(), chain.GetStageCount(),
+            fusedDifference, pixels / seconds[0] / 1e6, pixels / seconds[1] / 1e6, pixels / seconds[2] / 1e6, same ? "yes" : "NO");
+    }
+
+    // the compute shader path through the render graph, up to the back buffer
+    const ChainCase& full = Chains[sizeof(Chains) / sizeof(Chains[0]) - 1];
+    for (int fuse = 1; fuse >= 0; fuse--)
+    {
+        PostProcessChain chain;
+        chain.SetEffects(full.effects, full.count);
+        chain.SetFuse(fuse != 0);
+
+        std::vector<BYTE> plain;
+        std::vector<BYTE> processed;
+        if (!RenderPostProcessScene(options, nullptr, plain) || !RenderPostProcessScene(options, &chain, processed))
+            return 1;
+
+        std::vector<BYTE> expected(plain.size());
+        chain.Apply(plain.data(), expected.data(), width, height, PostProcessPath::Scalar);
+        int difference = LargestDifference(processed, expected);
+        if (difference != 0)
+            failures++;
+        printf("scene %-8s %u dispatches, largest difference %d\n", fuse ? "fused" : "unfused", chain.GetStageCount(), difference);
+    }
+
+    return failures ? 1 : 0;
+}
+
+struct ShadowRun : SceneCapture
+{
+    ShadowStats stats;          // summed over the timed frames
+    UINT64 casterDraws = 0;
+};
+
+// The scene from above the rings with lights lights. A few frames first so
+// every shadowed light has its faces.
+static bool RunShadowScene(const BenchmarkOptions& options, UINT lights, bool shadows, UINT maxShadowed, UINT updatesPerFrame,
+    bool spinCubes, bool animateLights, ShadowRun& run)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    render.SetSyncInterval(0);
+    render.SetCamera(XMFLOAT3(0.0f, 2.0f, -14.0f), 0.0f, 0.3f);
+    render.SetActiveLights(lights);
+    render.SetUseShadows(shadows);
+    render.SetShadowLimits(maxShadowed, updatesPerFrame);
+    render.SetSpinCubes(spinCubes);
+    render.SetAnimateLights(animateLights);
+
+    bool captured = CaptureScene(device, render, MaxShadowSlots, options.frames, 0, [](UINT) {}, [&]
+    {
+        const ShadowStats& stats = render.GetShadowAtlas().GetStats();
+        run.stats.candidates += stats.candidates;
+        run.stats.shadowed += stats.shadowed;
+        run.stats.updates += stats.updates;
+        run.stats.staticUpdates += stats.staticUpdates;
+        run.stats.staleSlots += stats.staleSlots;
+        run.casterDraws += render.GetShadowCasterDraws();
+    }, run);
+
+    return captured;
+}
+
+// Point light shadows as the lights grow: without shadows, with the
+// default cap and time slicing, and with every shadowed light drawn every
+// frame. Then the cache: with still lights only the spinning cubes are
+// drawn again, with still cubes too nothing is, and the image must match
+// the one drawn with every slot updated.
+static int RunShadows(const BenchmarkOptions& options)
+{
+    static const UINT LightCounts[] = { 3, 64, 512, RenderClass::MaxLights };
+    struct ShadowCase
+    {
+        const char* name;
+        bool shadows;
+        UINT maxShadowed;
+        UINT updatesPerFrame;
+    };
+    static const ShadowCase Cases[] =
+    {
+        { "off", false, 1, 1 },
+        { "sliced", true, 4, 2 },
+        { "every", true, MaxShadowSlots, MaxShadowSlots },
+    };
+
+    printf("%ux%u, %u instances, %u frames\n", options.width, options.height, options.instances, options.frames);
+    printf("%6s %-8s %10s %10s %10s %10s %10s %10s %12s\n", "lights", "shadows", "frame ms", "in view", "shadowed", "updates",
+        "static", "stale", "caster draws");
+
+    const double frames = options.frames;
+    for (UINT lights : LightCounts)
+    {
+        for (const ShadowCase& shadowCase : Cases)
+        {
+            ShadowRun run;
+            if (!RunShadowScene(options, lights, shadowCase.shadows, shadowCase.maxShadowed, shadowCase.updatesPerFrame, true, true, run))
+                return 1;
+
+            printf("%6u %-8s %10.3f %10.1f %10.1f %10.1f %10.1f %10.1f %12.1f\n", lights, shadowCase.name, run.frameSeconds * 1000.0,
+                run.stats.candidates / frames, run.stats.shadowed / frames, run.stats.updates / frames,
+                run.stats.staticUpdates / frames, run.stats.staleSlots / frames, run.casterDraws / frames);
+        }
+    }
+
+    ShadowRun spinning;
+    ShadowRun cached;
+    ShadowRun redrawn;
+    if (!RunShadowScene(options, 64, true, MaxShadowSlots, 2, true, false, spinning) ||
+        !RunShadowScene(options, 64, true, MaxShadowSlots, 1, false, false, cached) ||
+        !RunShadowScene(options, 64, true, MaxShadowSlots, MaxShadowSlots, false, false, redrawn))
+        return 1;
+    printf("still lights: %.1f updates, %.1f static per frame, %.3f ms\n", spinning.stats.updates / frames,
+        spinning.stats.staticUpdates / frames, spinning.frameSeconds * 1000.0);
+
+    ImageDifference difference = CompareImages(cached.image, redrawn.image);
+    bool correct = difference.sameSize && difference.pixelsOff == 0 && cached.stats.updates == 0 && spinning.stats.staticUpdates == 0;
+    printf("still scene: %.1f shadowed, %.1f updates per frame, %.3f ms, %u pixels off the redrawn atlas %s\n",
+        cached.stats.shadowed / frames, cached.stats.updates / frames, cached.frameSeconds * 1000.0, difference.pixelsOff,
+        correct ? "ok" : "FAILED");
+    return correct ? 0 : 1;
+}
+
+struct DeferredRun : SceneCapture
+{
+    UINT droppedLights = 0;
+};
+
+// Low over the rings looking across them, so most pixels are covered by
+// several cubes, with shadows. Compute culling draws the cubes in instance
+// order and the CPU one is left unsorted, so the near ones do not hide the
+// rest early.
+static bool RunDeferredScene(const BenchmarkOptions& options, UINT lights, bool computeCulling, bool deferred, DeferredRun& run)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return false;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    render.SetSyncInterval(0);
+    render.SetCamera(XMFLOAT3(0.0f, 1.0f, -18.0f), 0.0f, 0.05f);
+    render.SetActiveLights(lights);
+    render.SetUseClusteredLighting(lights > RenderClass::LightCount);
+    render.SetUseComputeCulling(computeCulling);
+    render.SetSortOpaqueDraws(false);
+    render.SetAnimateLights(false);
+    render.SetUseShadows(true);
+    render.SetUseDeferredShading(deferred);
+
+    // the shadow slots fill over the warmup frames
+    bool captured = CaptureScene(device, render, MaxShadowSlots, options.frames, 0, [](UINT) {}, [] {}, run);
+    run.droppedLights = render.GetClusterDroppedLights();
+
+    return captured;
+}
+
+// Forward against deferred shading on a scene with heavy overdraw, as the
+// lights grow. Both shade the same lights, the images only differ by the
+// precision of the G-buffer: 8 bit albedo, 16 bit octahedral normals and
+// the positions rebuilt from depth. With many lights the clusters of
+// forward shading may fill up and drop some, deferred has no such limit,
+// so a forward run that dropped lights is not held to it.
+static int RunDeferred(const BenchmarkOptions& options)
+{
+    static const UINT LightCounts[] = { RenderClass::LightCount, 64, 512, RenderClass::MaxLights };
+    const int Tolerance = 8;
+
+    printf("%ux%u, %u instances, %u frames\n", options.width, options.height, options.instances, options.frames);
+    printf("%6s %-8s %12s %12s %8s %10s %10s %8s\n", "lights", "culling", "forward ms", "deferred ms", "speedup", "largest", "pixels off",
+        "dropped");
+
+    bool correct = true;
+    for (UINT lights : LightCounts)
+    {
+        for (int computeCulling = 1; computeCulling >= 0; computeCulling--)
+        {
+            DeferredRun forward;
+            DeferredRun deferred;
+            if (!RunDeferredScene(options, lights, computeCulling != 0, false, forward) ||
+                !RunDeferredScene(options, lights, computeCulling != 0, true, deferred))
+                return 1;
+
+            ImageDifference difference = CompareImages(forward.image, deferred.image, Tolerance);
+
+            // a few pixels on the edges of the shadows may flip
+            const UINT pixels = options.width * options.height;
+            const bool close = difference.sameSize && difference.pixelsOff * 1000 <= pixels;
+            const bool checked = forward.droppedLights == 0;
+            correct = correct && (close || !checked);
+            printf("%6u %-8s %12.3f %12.3f %7.2fx %10d %10u %8u %s\n", lights, computeCulling ? "compute" : "cpu",
+                forward.frameSeconds * 1000.0, deferred.frameSeconds * 1000.0, forward.frameSeconds / deferred.frameSeconds,
+                difference.largest, difference.pixelsOff, forward.droppedLights, close ? "ok" : checked ? "FAILED" : "clusters full");
+        }
+    }
+    return correct ? 0 : 1;
+}
+
+// State cache and redundant state change counters over a run of frames
+static int RunStates(const BenchmarkOptions& options)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init())
+        return 1;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    const StateCache& cache = render.GetStateCache();
+    StateCacheStats initStats = cache.GetStats();
+    RenderContext* pContext = device.GetImmediateContext();
+    pContext->ResetStats();
+
+    for (UINT i = 0; i < options.frames; i++)
+    {
+        render.Render();
+    }
+
+    const StateCacheStats& stats = cache.GetStats();
+    const RenderStats& contextStats = pContext->GetStats();
+    printf("%u frames, %u cached state objects\n", options.frames, cache.GetObjectCount());
+    printf("%-22s %10s %12s\n", "", "total", "per frame");
+    printf("%-22s %10u\n", "misses during init", initStats.misses);
+    printf("%-22s %10u %12.2f\n", "cache hits", stats.hits - initStats.hits, double(stats.hits - initStats.hits) / options.frames);
+    printf("%-22s %10u %12.2f\n", "cache misses", stats.misses - initStats.misses, double(stats.misses - initStats.misses) / options.frames);
+    printf("%-22s %10u %12.2f\n", "state changes", contextStats.stateChanges, double(contextStats.stateChanges) / options.frames);
+    printf("%-22s %10u %12.2f\n", "elided state changes", contextStats.elidedStateChanges, double(contextStats.elidedStateChanges) / options.frames);
+
+    return 0;
+}
+
+// Maps, buffer updates and heap allocations per frame once the scene has
+// settled, for both culling paths
+static int RunUploads(const BenchmarkOptions& options)
+{
+    HeadlessScene scene(options, options.maxThreads);
+    if (!scene.Init(options.instances))
+        return 1;
+    CpuRenderDevice& device = scene.device;
+    RenderClass& render = scene.render;
+
+    CpuRenderContext* pContext = device.GetCpuContext();
+    printf("%u instances, %u frames\n", render.GetInstanceCount(), options.frames);
+    printf("%-8s %10s %10s %10s %12s %12s\n", "culling", "maps", "updates", "heap", "ring bytes", "ring discards");
+
+    const bool computeModes[] = { false, true };
+    for (bool compute : computeModes)
+    {
+        render.SetUseComputeCulling(compute);
+
+        // let the ring, the arena and the backend reach their working set
+        for (UINT i = 0; i < 3; i++)
+        {
+            render.Render();
+            pContext->ClearCommands();
+        }
+
+        pContext->ResetStats();
+        UploadRingStats ringStart = render.GetUploadRing().GetStats();
+        UINT64 heapStart = g_heapAllocations;
+        for (UINT i = 0; i < options.frames; i++)
+        {
+            render.Render();
+            pContext->ClearCommands();
+        }
+        UINT64 heap = g_heapAllocations - heapStart;
+
+        const RenderStats& stats = pContext->GetStats();
+        const UploadRingStats& ring = render.GetUploadRing().GetStats();
+        double frames = options.frames;
+        printf("%-8s %10.2f %10.2f %10.2f %12.0f %12u\n", compute ? "compute" : "cpu",
+            stats.maps / frames, stats.bufferUpdates / frames, heap / frames,
+            (ring.bytes - ringStart.bytes) / frames, ring.discards - ringStart.discards);
+    }
+
+    return 0;
+}
+
+// A 256x256 RGBA normal map with a full mip chain, written next to the tracked
+// textures for the loader benchmarks and removed again when they finish, so
+// they also cover an uncompressed file with mips without shipping one
+class GeneratedNormalMap
+{
+public:
+    static constexpr const wchar_t* Path = L"benchmark_normal.dds";
+
+    GeneratedNormalMap() : m_written(Write()) {}
+    ~GeneratedNormalMap() { remove(NarrowPath().c_str()); }
+
+    bool IsWritten() const { return m_written; }
+
+private:
+    static std::string NarrowPath()
+    {
+        std::wstring path(Path);
+        return std::string(path.begin(), path.end());
+    }
+
+    static bool Write()
+    {
+        const UINT size = 256;
+        const UINT mipLevels = 9;
+
+        // legacy header: magic, DDS_HEADER with 32-bit RGBA masks
+        UINT header[32] = {};
+        header[0] = 0x20534444;
+        header[1] = 124;
+        header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000;     // caps, height, width, pixel format, mip count
+        header[3] = size;
+        header[4] = size;
+        header[5] = size * 4;
+        header[7] = mipLevels;
+        header[19] = 32;
+        header[20] = 0x40 | 0x1;                            // RGB with alpha
+        header[22] = 32;
+        header[23] = 0xFF;
+        header[24] = 0xFF00;
+        header[25] = 0xFF0000;
+        header[26] = 0xFF000000;
+        header[27] = 0x1000 | 0x400000 | 0x8;               // texture, mipmap, complex
+
+        std::vector<BYTE> data(reinterpret_cast<const BYTE*>(header), reinterpret_cast<const BYTE*>(header) + sizeof(header));
+        for (UINT mip = 0, width = size; mip < mipLevels; mip++, width /= 2)
+        {
+            for (UINT y = 0; y < width; y++)
+            {
+                for (UINT x = 0; x < width; x++)
+                {
+                    // rounded bumps, four per side on every mip
+                    float u = sinf(6.2831853f * 4.0f * (x + 0.5f) / width) * 0.5f;
+                    float v = sinf(6.2831853f * 4.0f * (y + 0.5f) / width) * 0.5f;
+                    float w = sqrtf(std::max(0.0f, 1.0f - u * u - v * v));
+                    data.push_back(static_cast<BYTE>((u * 0.5f + 0.5f) * 255.0f + 0.5f));
+                    data.push_back(static_cast<BYTE>((v * 0.5f + 0.5f) * 255.0f + 0.5f));
+                    data.push_back(static_cast<BYTE>((w * 0.5f + 0.5f) * 255.0f + 0.5f));
+                    data.push_back(255);
+                }
+            }
+        }
+
+        FILE* pFile = fopen(NarrowPath().c_str(), "wb");
+        if (!pFile)
+            return false;
+        bool written = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+        fclose(pFile);
+        return written;
+    }
+
+    bool m_written;
+};
+
+// Time to load a set of textures one after another through the device and
+// through the TextureLoader with a growing number of workers. The files are
+// in the page cache after the first pass, so this is the latency of the
+// serial path rather than of the disk.
+static int RunTextures(const BenchmarkOptions& options)
+{
+    GeneratedNormalMap normalMap;
+    if (!normalMap.IsWritten())
+    {
+        printf("Failed to write %ls\n", GeneratedNormalMap::Path);
+        return 1;
+    }
+
+    const std::wstring files[] = { L"cat.dds", L"textile.dds", L"skybox.dds", GeneratedNormalMap::Path };
+    std::vector<std::wstring> paths;
+    for (UINT i = 0; i < options.textures; i++)
+    {
+        paths.push_back(files[i % ARRAYSIZE(files)]);
+    }
+
+    CpuRenderDevice device(16, 16, 1);
+    std::vector<RenderHandle> textures(paths.size(), NullHandle);
+    auto releaseAll = [&]()
+    {
+        for (RenderHandle& texture : textures)
+        {
+            if (texture)
+                device.Release(texture);
+            texture = NullHandle;
+        }
+    };
+
+    printf("%u textures\n", options.textures);
+    printf("%-8s %8s %10s %10s\n", "loader", "threads", "ms", "MB/s");
+
+    // first pass only warms the page cache
+    for (int pass = 0; pass < 2; pass++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            if (FAILED(device.CreateTextureFromFile(paths[i], &textures[i])))
+            {
+                printf("Failed to load %ls, run the benchmark from the Lab8 folder\n", paths[i].c_str());
+                return 1;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        releaseAll();
+        if (pass == 1)
+            printf("%-8s %8u %10.2f %10s\n", "serial", 1u, seconds * 1000.0, "");
+    }
+
+    UINT maxThreads = options.maxThreads ? options.maxThreads : 16;
+    for (UINT threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        TextureLoader loader;
+        loader.Init(&device, threads);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < paths.size(); i++)
+        {
+            loader.Load(paths[i], &textures[i]);
+        }
+        HRESULT result = loader.Flush();
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        if (FAILED(result))
+        {
+            printf("%u of the loads failed\n", loader.GetStats().failed);
+            return 1;
+        }
+        printf("%-8s %8u %10.2f %10.1f\n", "async", threads, seconds * 1000.0,
+            loader.GetStats().bytes / seconds / (1024.0 * 1024.0));
+
+        loader.Terminate();
+        releaseAll();
+    }
+    return 0;
+}
+
+// Checks the mapped DDS path against a plain copy of each file: the same
+// subresources at the same offsets with the same bytes, and how much heap
+// either path needs before the texture is created
+static int RunDDS()
+{
+    GeneratedNormalMap normalMap;
+    if (!normalMap.IsWritten())
+    {
+        printf("Failed to write %ls\n", GeneratedNormalMap::Path);
+        return 1;
+    }
+
+    const wchar_t* files[] = { L"cat.dds", L"textile.dds", L"skybox.dds", GeneratedNormalMap::Path };
+    printf("%-20s %8s %12s %12s %12s  %s\n", "file", "subres", "file bytes", "copy heap", "mapped heap", "layout");
+
+    UINT checked = 0;
+    UINT mismatches = 0;
+    for (const wchar_t* path : files)
+    {
+        UINT64 heapStart = g_heapBytes;
+        std::ifstream stream(std::string(path, path + wcslen(path)), std::ios::binary | std::ios::ate);
+        if (!stream)
+        {
+            printf("%-20ls missing\n", path);
+            continue;
+        }
+        std::vector<BYTE> copy(static_cast<size_t>(stream.tellg()));
+        stream.seekg(0);
+        stream.read(reinterpret_cast<char*>(copy.data()), copy.size());
+        DDSLayout copyLayout;
+        HRESULT copyResult = GetDDSLayout(copy.data(), copy.size(), copyLayout);
+        UINT64 copyHeap = g_heapBytes - heapStart;
+
+        heapStart = g_heapBytes;
+        MappedFile mapped;
+        HRESULT mappedResult = mapped.Open(path);
+        DDSLayout mappedLayout;
+        if (SUCCEEDED(mappedResult))
+            mappedResult = GetDDSLayout(mapped.GetData(), mapped.GetSize(), mappedLayout);
+        UINT64 mappedHeap = g_heapBytes - heapStart;
+
+        bool match = SUCCEEDED(copyResult) && SUCCEEDED(mappedResult) && mapped.GetSize() == copy.size() &&
+            mappedLayout.subresources.size() == copyLayout.subresources.size() &&
+            mappedLayout.arraySize == copyLayout.arraySize && mappedLayout.mipLevels == copyLayout.mipLevels;
+        for (size_t i = 0; match && i < copyLayout.subresources.size(); i++)
+        {
+            const DDSSubresource& a = copyLayout.subresources[i];
+            const DDSSubresource& b = mappedLayout.subresources[i];
+            match = a.width == b.width && a.height == b.height &&
+                a.rowPitch == b.rowPitch && a.slicePitch == b.slicePitch &&
+                a.pData - copy.data() == b.pData - mapped.GetData() &&
+                b.pData + b.slicePitch <= mapped.GetData() + mapped.GetSize() &&
+                memcmp(a.pData, b.pData, a.slicePitch) == 0;
+        }
+
+        checked++;
+        mismatches += match ? 0 : 1;
+        printf("%-20ls %8zu %12zu %12llu %12llu  %s\n", path, copyLayout.subresources.size(), copy.size(),
+            (unsigned long long)copyHeap, (unsigned long long)mappedHeap, match ? "match" : "MISMATCH");
+    }
+
+    if (checked == 0)
+    {
+        printf("No DDS files found, run the benchmark from the Lab8 folder\n");
+        return 1;
+    }
+    return mismatches ? 1 : 0;
+}
+
+// Loads a set of textures in full and through the TextureStreamer, then
+// moves a window of "visible" textures across the set for a number of
+// frames and tracks how much stays resident against the budget
+static int RunStreaming(const BenchmarkOptions& options)
+{
+    const std::wstring files[] = { L"cat.dds", L"textile.dds" };
+    CpuRenderDevice device(16, 16, 1);
+    std::vector<RenderHandle> textures(options.textures, NullHandle);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (UINT i = 0; i < options.textures; i++)
+    {
+        if (FAILED(device.CreateTextureFromFile(files[i % 2], &textures[i])))
+        {
+            printf("Failed to load %ls, run the benchmark from the Lab8 folder\n", files[i % 2].c_str());
+            return 1;
+        }
+    }
+    double fullSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    for (RenderHandle texture : textures)
+    {
+        device.Release(texture);
+    }
+
+    TextureStreamer streamer;
+    streamer.Init(&device, static_cast<UINT64>(options.budgetKB) * 1024);
+    start = std::chrono::high_resolution_clock::now();
+    for (UINT i = 0; i < options.textures; i++)
+    {
+        if (FAILED(streamer.Add(files[i % 2], &textures[i])))
+        {
+            printf("Failed to stream %ls\n", files[i % 2].c_str());
+            return 1;
+        }
+    }
+    double tailSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    UINT64 tailBytes = streamer.GetStats().residentBytes;
+
+    // eight textures close to the camera at a time, the window moves by one
+    // texture every four frames
+    const UINT window = 8;
+    UINT64 fullChainBytes = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (UINT frame = 0; frame < options.frames; frame++)
+    {
+        UINT first = (frame / 4) % options.textures;
+        for (UINT i = 0; i < window && i < options.textures; i++)
+        {
+            streamer.Request(textures[(first + i) % options.textures], 640.0f / (1 + i));
+        }
+        streamer.Update();
+    }
+    double streamSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    for (UINT i = 0; i < 2; i++)
+    {
+        MappedFile file;
+        if (SUCCEEDED(file.Open(files[i])))
+            fullChainBytes += file.GetSize() * ((options.textures + 1 - i) / 2);
+    }
+
+    const TextureStreamerStats& stats = streamer.GetStats();
+    printf("%u textures, %u frames, budget %u KB\n", options.textures, options.frames, options.budgetKB);
+    printf("%-28s %10.2f ms, %10.0f KB\n", "full load", fullSeconds * 1000.0, fullChainBytes / 1024.0);
+    printf("%-28s %10.2f ms, %10.0f KB\n", "streamed load (tail mips)", tailSeconds * 1000.0, tailBytes / 1024.0);
+    printf("%-28s %10.2f ms/frame\n", "streaming updates", streamSeconds * 1000.0 / options.frames);
+    printf("%-28s %10.0f KB\n", "resident at the end", stats.residentBytes / 1024.0);
+    printf("%-28s %10.0f KB\n", "peak resident", stats.peakResidentBytes / 1024.0);
+    printf("%-28s %10u\n", "mip uploads", stats.uploads);
+    printf("%-28s %10u\n", "mip evictions", stats.evictions);
+
+    streamer.Terminate();
+    return 0;
+}
+
+struct ShaderFile
+{
+    ShaderStage stage;
+    std::wstring path;
+    const ShaderVariantDesc* pVariants;     // nullptr for a file without permutations
+};
+
+// Every .vs, .ps and .cs file of the working folder, by name
+static std::vector<ShaderFile> ListShaderFiles()
+{
+    std::vector<std::wstring> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAW data;
+    HANDLE find = FindFirstFileW(L"*.?s", &data);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            names.push_back(data.cFileName);
+        } while (FindNextFileW(find, &data));
+        FindClose(find);
+    }
+#else
+    if (DIR* pDir = opendir("."))
+    {
+        while (dirent* pEntry = readdir(pDir))
+        {
+            std::string name = pEntry->d_name;
+            names.push_back(std::wstring(name.begin(), name.end()));
+        }
+        closedir(pDir);
+    }
+#endif
+    std::sort(names.begin(), names.end());
+
+    const ShaderVariantDesc* descs = nullptr;
+    UINT descCount = RenderClass::GetShaderVariantDescs(&descs);
+
+    std::vector<ShaderFile> files;
+    for (const std::wstring& name : names)
+    {
+        std::wstring extension = name.size() > 3 ? name.substr(name.size() - 3) : L"";
+        ShaderFile file = { ShaderStage::Vertex, name, nullptr };
+        if (extension == L".ps")
+            file.stage = ShaderStage::Pixel;
+        else if (extension == L".cs")
+            file.stage = ShaderStage::Compute;
+        else if (extension != L".vs")
+            continue;
+
+        for (UINT i = 0; i < descCount; i++)
+        {
+            if (name == descs[i].path && file.stage == descs[i].stage)
+                file.pVariants = &descs[i];
+        }
+        files.push_back(file);
+    }
+    return files;
+}
+
+// Goes through the cache the way D3D11RenderDevice::CreateShader does. There
+// is no d3dcompiler outside Windows, there the source stands in for the
+// bytecode, which still measures the hashing and the pack round trip.
+static HRESULT CompileShaderFile(const ShaderFile& file, const ShaderDefine* defines, UINT defineCount,
+    ShaderCache& cache, std::vector<BYTE>& code)
+{
+#ifdef _WIN32
+    ID3DBlob* pCode = nullptr;
+    HRESULT result = CompileD3D11Shader(file.stage, file.path, defines, defineCount, &cache, &pCode);
+    if (SUCCEEDED(result))
+    {
+        const BYTE* pBytes = static_cast<const BYTE*>(pCode->GetBufferPointer());
+        code.assign(pBytes, pBytes + pCode->GetBufferSize());
+        pCode->Release();
+    }
+    return result;
+#else
+    auto start = std::chrono::steady_clock::now();
+    const char* profile = file.stage == ShaderStage::Vertex ? "vs_5_0" : file.stage == ShaderStage::Pixel ? "ps_5_0" : "cs_5_0";
+
+    UINT64 key = 0;
+    HRESULT result = ShaderCache::ComputeKey(file.path, defines, defineCount, "main", profile, 0, &key);
+    const BYTE* pData = nullptr;
+    size_t size = 0;
+    bool hit = SUCCEEDED(result) && cache.Find(key, &pData, &size);
+    if (hit)
+    {
+        code.assign(pData, pData + size);
+    }
+    else if (SUCCEEDED(result))
+    {
+        MappedFile source;
+        result = source.Open(file.path);
+        if (SUCCEEDED(result))
+        {
+            code.assign(source.GetData(), source.GetData() + source.GetSize());
+            cache.Store(key, code.data(), code.size());
+        }
+    }
+
+    cache.AddTime(hit, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return result;
+#endif
+}
+
+struct ShaderVariant
+{
+    const ShaderFile* pFile;
+    ShaderDefine defines[ShaderVariants::MaxOptions];
+    UINT defineCount;
+};
+
+// Every permutation of every file
+static std::vector<ShaderVariant> ListShaderVariants(const std::vector<ShaderFile>& files)
+{
+    std::vector<ShaderVariant> variants;
+    for (const ShaderFile& file : files)
+    {
+        UINT count = file.pVariants ? ShaderVariants::GetVariantCount(*file.pVariants) : 1;
+        for (UINT i = 0; i < count; i++)
+        {
+            ShaderVariant variant = { &file, {}, 0 };
+            if (file.pVariants)
+            {
+                UINT key = ShaderVariants::GetVariantKey(*file.pVariants, i);
+                variant.defineCount = ShaderVariants::GetDefines(*file.pVariants, key, variant.defines);
+            }
+            variants.push_back(variant);
+        }
+    }
+    return variants;
+}
+
+// The offline shader step, run after every build of the Benchmark project:
+// brings the pack up to date with every permutation (only changed shaders
+// are compiled), then compares a cold start, which compiles every shader,
+// with a warm one that loads them all from the pack
+static int RunShaders(const BenchmarkOptions& options)
+{
+    std::vector<ShaderFile> files = ListShaderFiles();
+    if (files.empty())
+    {
+        printf("No shaders found, run the benchmark from the Lab8 folder\n");
+        return 1;
+    }
+    std::vector<ShaderVariant> variants = ListShaderVariants(files);
+
+    const char* outputPath = options.outputPath ? options.outputPath : "shaders.pack";
+    const std::wstring packPath(outputPath, outputPath + strlen(outputPath));
+
+    ShaderCache pack;
+    pack.Open(packPath);
+    std::vector<BYTE> code;
+    for (const ShaderVariant& variant : variants)
+    {
+        if (FAILED(CompileShaderFile(*variant.pFile, variant.defines, variant.defineCount, pack, code)))
+        {
+            printf("Failed to compile %ls\n", variant.pFile->path.c_str());
+            return 1;
+        }
+    }
+    if (FAILED(pack.Save()))
+    {
+        printf("Failed to write %s\n", outputPath);
+        return 1;
+    }
+    printf("%s: %u entries, %u compiled now\n", outputPath, pack.GetEntryCount(), pack.GetStats().misses);
+
+    // the cold cache is never opened, so every lookup misses
+    ShaderCache cold;
+    ShaderCache warm;
+    warm.Open(packPath);
+
+    printf("%-24s %-28s %10s %10s %8s\n", "shader", "defines", "cold ms", "warm ms", "bytes");
+    UINT mismatches = 0;
+    for (const ShaderVariant& variant : variants)
+    {
+        std::vector<BYTE> coldCode;
+        std::vector<BYTE> warmCode;
+        double coldStart = cold.GetStats().compileSeconds;
+        double warmStart = warm.GetStats().loadSeconds + warm.GetStats().compileSeconds;
+        HRESULT coldResult = CompileShaderFile(*variant.pFile, variant.defines, variant.defineCount, cold, coldCode);
+        HRESULT warmResult = CompileShaderFile(*variant.pFile, variant.defines, variant.defineCount, warm, warmCode);
+
+        std::string defines;
+        for (UINT i = 0; i < variant.defineCount; i++)
+        {
+            defines += std::string(i ? " " : "") + variant.defines[i].name + "=" + variant.defines[i].value;
+        }
+
+        // compiling is deterministic, a hit must return exactly what a
+        // compile produces
+        bool match = SUCCEEDED(coldResult) && SUCCEEDED(warmResult) && coldCode == warmCode;
+        mismatches += match ? 0 : 1;
+        printf("%-24ls %-28s %10.3f %10.3f %8zu%s\n", variant.pFile->path.c_str(), defines.c_str(),
+            (cold.GetStats().compileSeconds - coldStart) * 1000.0,
+            (warm.GetStats().loadSeconds + warm.GetStats().compileSeconds - warmStart) * 1000.0,
+            warmCode.size(), match ? "" : "  MISMATCH");
+    }
+
+    const ShaderCacheStats& coldStats = cold.GetStats();
+    const ShaderCacheStats& warmStats = warm.GetStats();
+    double coldMs = coldStats.compileSeconds * 1000.0;
+    double warmMs = (warmStats.loadSeconds + warmStats.compileSeconds) * 1000.0;
+    printf("cold: %u compiled, %.3f ms\n", coldStats.misses, coldMs);
+    printf("warm: %u cached, %u compiled, %.3f ms (%.1fx)\n", warmStats.hits, warmStats.misses, warmMs,
+        warmMs > 0.0 ? coldMs / warmMs : 0.0);
+
+    return mismatches || warmStats.misses ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    const char* mode = "raster";
+    int first = 1;
+    if (argc > 1 && argv[1][0] != '-')
+    {
+        mode = argv[1];
+        first = 2;
+    }
+
+    for (int i = first; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-w") == 0)
+            options.width = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-h") == 0)
+            options.height = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-f") == 0)
+            options.frames = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-t") == 0)
+            options.maxThreads = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0)
+            options.instances = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0)
+            options.textures = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-b") == 0)
+            options.budgetKB = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-o") == 0)
+            options.outputPath = argv[i + 1];
+        else if (strcmp(argv[i], "-s") == 0)
+            options.scene = argv[i + 1];
+    }
+
+    if (options.frames == 0)
+        options.frames = 1;
+
+    if (strcmp(mode, "checks") == 0)
+        return RunChecks(first < argc && argv[first][0] != '-' ? argv[first] : nullptr);
+    if (strcmp(mode, "raster") == 0)
+        return RunRaster(options);
+    if (strcmp(mode, "culling") == 0)
+        return RunCulling(options);
+    if (strcmp(mode, "bvh") == 0)
+        return RunBvh(options);
+    if (strcmp(mode, "instances") == 0)
+        return RunInstances(options);
+    if (strcmp(mode, "store") == 0)
+        return RunInstanceStore(options);
+    if (strcmp(mode, "states") == 0)
+        return RunStates(options);
+    if (strcmp(mode, "uploads") == 0)
+        return RunUploads(options);
+    if (strcmp(mode, "textures") == 0)
+        return RunTextures(options);
+    if (strcmp(mode, "dds") == 0)
+        return RunDDS();
+    if (strcmp(mode, "streaming") == 0)
+        return RunStreaming(options);
+    if (strcmp(mode, "shaders") == 0)
+        return RunShaders(options);
+    if (strcmp(mode, "variants") == 0)
+        return RunVariants(options);
+    if (strcmp(mode, "clusters") == 0)
+        return RunClusters(options);
+    if (strcmp(mode, "record") == 0)
+        return RunRecord(options);
+    if (strcmp(mode, "graph") == 0)
+        return RunGraph(options);
+    if (strcmp(mode, "profile") == 0)
+        return RunProfile(options);
+    if (strcmp(mode, "run") == 0)
+        return RunScripted(options);
+    if (strcmp(mode, "occlusion") == 0)
+        return RunOcclusion(options);
+    if (strcmp(mode, "oit") == 0)
+        return RunTransparency(options);
+    if (strcmp(mode, "sort") == 0)
+        return RunSort(options);
+    if (strcmp(mode, "post") == 0)
+        return RunPostProcess(options);
+    if (strcmp(mode, "shadows") == 0)
+        return RunShadows(options);
+    if (strcmp(mode, "deferred") == 0)
+        return RunDeferred(options);
+
+    printf("Unknown benchmark '%s'\n", mode);
+    return 1;
+}
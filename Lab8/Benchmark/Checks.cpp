@@ -0,0 +1,415 @@
+// Checks.cpp : correctness checks of the renderer parts that run without a device.
+
+#include "Platform.h"
+#include "Checks.h"
+#include "BoundingVolumeHierarchy.h"
+#include "FrustumCulling.h"
+#include "LightClusters.h"
+#include "PostProcess.h"
+#include "RadixSort.h"
+#include "RenderQueue.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+bool Check(bool condition, const char* what, int& failures)
+{
+    printf("%-40s %s\n", what, condition ? "ok" : "FAILED");
+    if (!condition)
+        failures++;
+    return condition;
+}
+
+static UINT NextRandom(UINT& seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return seed >> 8;
+}
+
+static float RandomUnit(UINT& seed)
+{
+    return NextRandom(seed) / 16777216.0f;
+}
+
+// Frustum planes facing inwards, normalized, in the order CullBounds expects
+static void GetFrustumPlanes(FXMMATRIX viewProj, XMFLOAT4 planes[6])
+{
+    XMFLOAT4X4 m;
+    XMStoreFloat4x4(&m, viewProj);
+    XMVECTOR vectors[6] =
+    {
+        XMVectorSet(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41),
+        XMVectorSet(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41),
+        XMVectorSet(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42),
+        XMVectorSet(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42),
+        XMVectorSet(m._13, m._23, m._33, m._43),
+        XMVectorSet(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43),
+    };
+    for (int i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&planes[i], XMPlaneNormalize(vectors[i]));
+    }
+}
+
+static bool SameSet(std::vector<UINT> a, UINT countA, std::vector<UINT> b, UINT countB)
+{
+    if (countA != countB)
+        return false;
+    std::sort(a.begin(), a.begin() + countA);
+    std::sort(b.begin(), b.begin() + countB);
+    return std::equal(a.begin(), a.begin() + countA, b.begin());
+}
+
+// The radix sort against std::sort around its thresholds, with and without
+// a pool, ties kept in order below firstBit, and the order of queue keys
+static int CheckSort()
+{
+    int failures = 0;
+    ThreadPool pool(4);
+    RadixSorter sorter;
+
+    const UINT Counts[] = { 0, 1, 2, RadixSorter::MinRadixKeys - 1, RadixSorter::MinRadixKeys, 5000,
+        RadixSorter::MinChunkKeys * 4 + 3 };
+    bool sorted = true;
+    bool stable = true;
+    UINT seed = 12345;
+    for (UINT count : Counts)
+    {
+        for (int threaded = 0; threaded < 2; threaded++)
+        {
+            std::vector<UINT64> keys(count);
+            for (UINT64& key : keys)
+            {
+                key = static_cast<UINT64>(NextRandom(seed)) << 40 ^ static_cast<UINT64>(NextRandom(seed)) << 16 ^ NextRandom(seed);
+            }
+            std::vector<UINT64> expected = keys;
+            std::sort(expected.begin(), expected.end());
+            sorter.Sort(keys, threaded ? &pool : nullptr);
+            sorted = sorted && keys == expected;
+
+            // few distinct keys above the item bits, the item is the position
+            for (UINT i = 0; i < count; i++)
+            {
+                keys[i] = static_cast<UINT64>(NextRandom(seed) % 7) << RenderQueue::ItemBits | i;
+            }
+            expected = keys;
+            std::stable_sort(expected.begin(), expected.end(), [](UINT64 a, UINT64 b)
+            {
+                return (a >> RenderQueue::ItemBits) < (b >> RenderQueue::ItemBits);
+            });
+            sorter.Sort(keys, threaded ? &pool : nullptr, RenderQueue::ItemBits);
+            stable = stable && keys == expected;
+        }
+    }
+    Check(sorted, "radix sort matches std::sort", failures);
+    Check(stable, "equal keys keep their order", failures);
+
+    // only the lowest digit differs, the other digits are skipped
+    std::vector<UINT64> keys(5000);
+    for (UINT i = 0; i < 5000; i++)
+    {
+        keys[i] = 0xABCDEF0000000000ull | (NextRandom(seed) & (RadixSorter::DigitCount - 1));
+    }
+    sorter.Sort(keys, nullptr);
+    Check(sorter.GetStats().passes == 1 && std::is_sorted(keys.begin(), keys.end()), "constant digits skipped", failures);
+
+    // opaque front to back within a state, transparent back to front
+    Check(RenderQueue::MakeOpaqueKey(1, 2, 3, 0.25f) < RenderQueue::MakeOpaqueKey(1, 2, 3, 0.75f), "opaque near first", failures);
+    Check(RenderQueue::MakeOpaqueKey(1, 2, 3, 0.75f) < RenderQueue::MakeOpaqueKey(1, 3, 0, 0.0f), "opaque state before depth", failures);
+    Check(RenderQueue::MakeTransparentKey(4, 2, 3, 0.75f) < RenderQueue::MakeTransparentKey(4, 2, 3, 0.25f), "transparent far first",
+        failures);
+    Check(RenderQueue::MakeOpaqueKey(5, 0, 0, 0.0f) > RenderQueue::MakeTransparentKey(4, 63, 63, 0.0f), "pass before everything",
+        failures);
+
+    RenderQueue queue;
+    queue.Add(RenderQueue::MakeOpaqueKey(0, 1, 0, 0.5f), 7);
+    queue.Add(RenderQueue::MakeOpaqueKey(0, 0, 0, 0.5f), 8);
+    queue.Add(RenderQueue::MakeOpaqueKey(0, 1, 0, 0.5f), 9);
+    queue.Sort(nullptr);
+    Check(queue.GetCount() == 3 && queue.GetItem(0) == 8 && queue.GetItem(1) == 7 && queue.GetItem(2) == 9, "queue items in key order",
+        failures);
+    return failures;
+}
+
+// The BVH against testing every box: no boxes, one box, a clustered scene
+// under several cameras, and after moving some boxes and refitting
+static int CheckBvh()
+{
+    int failures = 0;
+    XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 100.0f);
+    XMFLOAT4 planes[6];
+    GetFrustumPlanes(XMMatrixLookToLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), up) * proj, planes);
+
+    CullingBounds bounds;
+    BoundingVolumeHierarchy bvh;
+    std::vector<UINT> visible(1);
+    bvh.Build(bounds);
+    Check(bvh.Cull(planes, bounds, visible.data()) == 0, "no boxes", failures);
+
+    bounds.Add(XMFLOAT3(0.0f, 0.0f, 10.0f), XMFLOAT3(1.0f, 1.0f, 1.0f));
+    bvh.Build(bounds);
+    Check(bvh.Cull(planes, bounds, visible.data()) == 1 && visible[0] == 0, "one box inside", failures);
+    bounds.Set(0, XMFLOAT3(0.0f, 0.0f, -10.0f), XMFLOAT3(1.0f, 1.0f, 1.0f));
+    bvh.Refit(bounds);
+    Check(bvh.Cull(planes, bounds, visible.data()) == 0, "one box behind after refit", failures);
+
+    // clumps of boxes around the origin, some of them straddling the planes
+    const UINT Count = 5000;
+    UINT seed = 777;
+    bounds.Clear();
+    XMFLOAT3 clump(0.0f, 0.0f, 0.0f);
+    for (UINT i = 0; i < Count; i++)
+    {
+        if (i % 100 == 0)
+            clump = XMFLOAT3(RandomUnit(seed) * 80.0f - 40.0f, RandomUnit(seed) * 80.0f - 40.0f, RandomUnit(seed) * 80.0f - 40.0f);
+        float size = 0.1f + RandomUnit(seed) * 2.0f;
+        bounds.Add(XMFLOAT3(clump.x + RandomUnit(seed) * 8.0f - 4.0f, clump.y + RandomUnit(seed) * 8.0f - 4.0f,
+            clump.z + RandomUnit(seed) * 8.0f - 4.0f), XMFLOAT3(size, size * 0.5f, size));
+    }
+    bvh.Build(bounds);
+
+    std::vector<UINT> linear(Count);
+    visible.resize(Count);
+    bool same = true;
+    bool refitSame = true;
+    for (int camera = 0; camera < 8; camera++)
+    {
+        float angle = camera * XM_2PI / 8.0f;
+        GetFrustumPlanes(XMMatrixLookToLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f),
+            XMVectorSet(sinf(angle), 0.3f * (camera % 3) - 0.3f, cosf(angle), 0.0f), up) * proj, planes);
+        UINT linearCount = CullBounds(planes, bounds, linear.data(), CullingPath::Scalar);
+        same = same && SameSet(linear, linearCount, visible, bvh.Cull(planes, bounds, visible.data()));
+    }
+    Check(same, "bvh matches every box tested", failures);
+
+    // every 7th box moves, then the partial and the full refit
+    std::vector<UINT> moved;
+    for (UINT i = 0; i < Count; i += 7)
+    {
+        bounds.Set(i, XMFLOAT3(bounds.centerX[i] + RandomUnit(seed) * 6.0f - 3.0f, bounds.centerY[i], bounds.centerZ[i] + 2.0f),
+            XMFLOAT3(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]));
+        moved.push_back(i);
+    }
+    bvh.Refit(bounds, moved.data(), static_cast<UINT>(moved.size()));
+    UINT linearCount = CullBounds(planes, bounds, linear.data(), CullingPath::Scalar);
+    refitSame = SameSet(linear, linearCount, visible, bvh.Cull(planes, bounds, visible.data()));
+    bvh.Refit(bounds);
+    refitSame = refitSame && SameSet(linear, linearCount, visible, bvh.Cull(planes, bounds, visible.data()));
+    Check(refitSame, "bvh matches after moves and refit", failures);
+
+    // the vector paths give the scalar result
+    bool paths = true;
+    const CullingPath Paths[] = { CullingPath::SSE, CullingPath::AVX2, CullingPath::AVX512 };
+    for (CullingPath path : Paths)
+    {
+        if (IsCullingPathSupported(path))
+            paths = paths && CullBounds(planes, bounds, visible.data(), path) == linearCount &&
+                std::equal(linear.begin(), linear.begin() + linearCount, visible.begin());
+    }
+    Check(paths, "culling paths match scalar", failures);
+    return failures;
+}
+
+// The post effects on the CPU at sizes that leave a partial group of four
+// pixels: both paths the same bytes, fusing only rounding apart, alpha kept
+static int CheckPostProcess()
+{
+    int failures = 0;
+
+    PostProcessChain chain;
+    bool added = true;
+    for (UINT i = 0; i < PostMaxEffects; i++)
+    {
+        added = added && chain.Add(PostEffect::Negative);
+    }
+    Check(added && !chain.Add(PostEffect::Negative), "full chain refuses an effect", failures);
+
+    const PostEffect Full[] = { PostEffect::ToneMap, PostEffect::Sharpen, PostEffect::ColorGrade, PostEffect::Blur, PostEffect::Negative };
+    chain.SetEffects(Full, ARRAYSIZE(Full));
+    Check(chain.GetStageCount() == 2, "one kernel per fused stage", failures);
+    chain.SetFuse(false);
+    Check(chain.GetStageCount() == ARRAYSIZE(Full), "a stage per effect unfused", failures);
+    const PostEffect PerPixel[] = { PostEffect::ToneMap, PostEffect::ColorGrade, PostEffect::Negative };
+    chain.SetFuse(true);
+    chain.SetEffects(PerPixel, ARRAYSIZE(PerPixel));
+    Check(chain.GetStageCount() == 1, "per pixel effects in one stage", failures);
+
+    const UINT Sizes[][2] = { { 1, 1 }, { 3, 2 }, { 17, 9 }, { 64, 33 } };
+    bool pathsSame = true;
+    bool fusedClose = true;
+    bool alphaKept = true;
+    bool negative = true;
+    bool flatKept = true;
+    UINT seed = 99;
+    for (const UINT* size : Sizes)
+    {
+        const UINT width = size[0];
+        const UINT height = size[1];
+        std::vector<BYTE> source(width * height * 4);
+        for (BYTE& value : source)
+        {
+            value = static_cast<BYTE>(NextRandom(seed));
+        }
+        std::vector<BYTE> scalar(source.size());
+        std::vector<BYTE> sse(source.size());
+        std::vector<BYTE> split(source.size());
+
+        for (UINT effect = 0; effect <= static_cast<UINT>(PostEffect::Count); effect++)
+        {
+            // every effect alone, then the full chain
+            if (effect < static_cast<UINT>(PostEffect::Count))
+            {
+                PostEffect single = static_cast<PostEffect>(effect);
+                chain.SetEffects(&single, 1);
+            }
+            else
+            {
+                chain.SetEffects(Full, ARRAYSIZE(Full));
+            }
+            PostProcessChain unfused = chain;
+            unfused.SetFuse(false);
+
+            chain.Apply(source.data(), scalar.data(), width, height, PostProcessPath::Scalar);
+            chain.Apply(source.data(), sse.data(), width, height, PostProcessPath::SSE);
+            unfused.Apply(source.data(), split.data(), width, height, PostProcessPath::SSE);
+            pathsSame = pathsSame && scalar == sse;
+            for (size_t i = 0; i < source.size(); i++)
+            {
+                fusedClose = fusedClose && abs(static_cast<int>(sse[i]) - static_cast<int>(split[i])) <= 8;
+                if (i % 4 == 3)
+                    alphaKept = alphaKept && scalar[i] == source[i];
+                else if (effect == static_cast<UINT>(PostEffect::Negative))
+                    negative = negative && scalar[i] == 255 - source[i];
+            }
+        }
+
+        // the kernels weigh to one, so a flat image stays flat
+        std::vector<BYTE> flat(source.size(), 128);
+        const PostEffect Kernels[] = { PostEffect::Blur, PostEffect::Sharpen };
+        for (PostEffect kernel : Kernels)
+        {
+            chain.SetEffects(&kernel, 1);
+            chain.Apply(flat.data(), scalar.data(), width, height, PostProcessPath::Scalar);
+            flatKept = flatKept && scalar == flat;
+        }
+    }
+    Check(pathsSame, "scalar and sse paths the same bytes", failures);
+    Check(fusedClose, "fused within rounding of unfused", failures);
+    Check(alphaKept, "alpha copied", failures);
+    Check(negative, "negative inverts color", failures);
+    Check(flatKept, "kernels keep a flat image", failures);
+    return failures;
+}
+
+// Assign against testing every light against every cluster, with no lights,
+// lights out of view and the scattered lights of the scene
+static int CheckClusters()
+{
+    int failures = 0;
+    const UINT Width = 320;
+    const UINT Height = 180;
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, static_cast<float>(Width) / Height, 0.1f, 100.0f);
+
+    LightClusters clusters;
+    Check(clusters.Configure(Width, Height, proj), "first configure changes the grid", failures);
+    Check(!clusters.Configure(Width, Height, proj), "same grid again unchanged", failures);
+    const UINT clusterCount = clusters.GetClusterCount();
+    Check(clusterCount == 5 * 3 * LightClusters::SliceCount, "grid rounds up partial tiles", failures);
+
+    std::vector<UINT> ranges(clusterCount * 2);
+    std::vector<UINT> indices(clusterCount * LightClusters::MaxLightsPerCluster);
+    std::vector<UINT> expectedRanges(clusterCount * 2);
+    std::vector<UINT> expectedIndices(clusterCount * LightClusters::MaxLightsPerCluster);
+
+    // view space centers and ranges
+    std::vector<XMFLOAT4> lights;
+    Check(clusters.Assign(lights.data(), 0, ranges.data(), indices.data()) == 0, "no lights", failures);
+
+    lights.push_back(XMFLOAT4(0.0f, 0.0f, -5.0f, 2.0f));        // behind the camera
+    lights.push_back(XMFLOAT4(0.0f, 0.0f, 150.0f, 10.0f));      // beyond the far plane
+    lights.push_back(XMFLOAT4(200.0f, 0.0f, 20.0f, 5.0f));      // off to the side
+    Check(clusters.Assign(lights.data(), static_cast<UINT>(lights.size()), ranges.data(), indices.data()) == 0, "lights out of view",
+        failures);
+
+    lights.clear();
+    lights.push_back(XMFLOAT4(0.0f, 0.0f, 10.0f, 0.01f));
+    UINT count = clusters.Assign(lights.data(), 1, ranges.data(), indices.data());
+    Check(count >= 1 && count <= 8, "small light in a few clusters", failures);
+
+    bool same = true;
+    UINT seed = 4242;
+    const UINT LightCounts[] = { 1, 64, 1024 };
+    for (UINT lightCount : LightCounts)
+    {
+        lights.resize(lightCount);
+        for (XMFLOAT4& light : lights)
+        {
+            light = XMFLOAT4(RandomUnit(seed) * 40.0f - 20.0f, RandomUnit(seed) * 6.0f - 3.0f, RandomUnit(seed) * 50.0f,
+                0.5f + RandomUnit(seed) * 2.5f);
+        }
+        UINT assigned = clusters.Assign(lights.data(), lightCount, ranges.data(), indices.data());
+        UINT expected = clusters.AssignBruteForce(lights.data(), lightCount, expectedRanges.data(), expectedIndices.data());
+        same = same && assigned == expected;
+        for (UINT cluster = 0; same && cluster < clusterCount; cluster++)
+        {
+            UINT lightsInCluster = ranges[cluster * 2 + 1];
+            same = lightsInCluster == expectedRanges[cluster * 2 + 1] &&
+                std::equal(&indices[ranges[cluster * 2]], &indices[ranges[cluster * 2]] + lightsInCluster,
+                    &expectedIndices[expectedRanges[cluster * 2]]);
+        }
+    }
+    Check(same, "assign matches brute force", failures);
+
+    // more lights on one spot than a cluster holds
+    lights.assign(LightClusters::MaxLightsPerCluster + 40, XMFLOAT4(0.5f, 0.0f, 10.0f, 3.0f));
+    const UINT crowdCount = static_cast<UINT>(lights.size());
+    clusters.Assign(lights.data(), crowdCount, ranges.data(), indices.data());
+    UINT expectedDropped = 0;
+    clusters.AssignBruteForce(lights.data(), crowdCount, expectedRanges.data(), expectedIndices.data(), &expectedDropped);
+    Check(expectedDropped > 0 && clusters.GetDroppedLights() == expectedDropped, "full clusters count the lights they drop", failures);
+    Check(clusters.Assign(lights.data(), 1, ranges.data(), indices.data()) > 0 && clusters.GetDroppedLights() == 0,
+        "the count starts over on every assign", failures);
+    return failures;
+}
+
+int RunChecks(const char* name)
+{
+    struct NamedCheck
+    {
+        const char* name;
+        int (*run)();
+    };
+    static const NamedCheck Checks[] =
+    {
+        { "sort", CheckSort },
+        { "bvh", CheckBvh },
+        { "post", CheckPostProcess },
+        { "clusters", CheckClusters },
+    };
+
+    int failures = 0;
+    bool found = false;
+    for (const NamedCheck& check : Checks)
+    {
+        if (name && strcmp(name, check.name) != 0)
+            continue;
+        found = true;
+        printf("%s\n", check.name);
+        failures += check.run();
+    }
+
+    if (!found)
+    {
+        printf("Unknown check %s\n", name);
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef CHECKS_H
+#define CHECKS_H
+
+// Focused checks of the parts of the renderer that need no device: the
+// radix sort and render queue keys, the BVH, the post-processing chain on
+// the CPU and the light cluster assignment. Small fixed inputs and edge
+// cases, no timing, so they run in a moment on every build.
+
+// Prints the check and its result, counts the failures
+bool Check(bool condition, const char* what, int& failures);
+
+// name is one of sort, bvh, post, clusters, or null for all of them.
+// Returns the exit code, 1 when a check failed or the name is unknown.
+int RunChecks(const char* name);
+
+#endif
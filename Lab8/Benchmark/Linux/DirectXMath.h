@@ -0,0 +1,453 @@
+// DirectXMath.h : the part of DirectXMath the renderer uses, in plain scalar
+// C++ for the headless build where the real headers are not installed.
+//
+// Same names, layouts and row-vector conventions as the library, so the
+// renderer code compiles unchanged. It is slower than the SSE version and
+// its results can differ from it in the last bits; image hashes taken with
+// one are not comparable with the other. Point DIRECTXMATH_INCLUDE_DIR at a
+// checkout of github.com/microsoft/DirectXMath (Inc, plus a sal.h) to build
+// against the real library instead.
+#ifndef DIRECTXMATH_LINUX_H
+#define DIRECTXMATH_LINUX_H
+
+#include <cmath>
+#include <cstdint>
+
+namespace DirectX
+{
+    const float XM_PI = 3.141592654f;
+    const float XM_2PI = 6.283185307f;
+    const float XM_1DIVPI = 0.318309886f;
+    const float XM_PIDIV2 = 1.570796327f;
+    const float XM_PIDIV4 = 0.785398163f;
+
+    struct alignas(16) XMVECTOR
+    {
+        float v[4];
+    };
+    typedef const XMVECTOR& FXMVECTOR;
+    typedef const XMVECTOR& GXMVECTOR;
+    typedef const XMVECTOR& HXMVECTOR;
+    typedef const XMVECTOR& CXMVECTOR;
+
+    struct alignas(16) XMMATRIX
+    {
+        XMVECTOR r[4];
+    };
+    typedef const XMMATRIX& FXMMATRIX;
+    typedef const XMMATRIX& CXMMATRIX;
+
+    struct XMFLOAT2
+    {
+        float x, y;
+        XMFLOAT2() = default;
+        constexpr XMFLOAT2(float _x, float _y) : x(_x), y(_y) {}
+    };
+
+    struct XMFLOAT3
+    {
+        float x, y, z;
+        XMFLOAT3() = default;
+        constexpr XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+    };
+    typedef XMFLOAT3 XMFLOAT3A;
+
+    struct XMFLOAT4
+    {
+        float x, y, z, w;
+        XMFLOAT4() = default;
+        constexpr XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+    };
+    typedef XMFLOAT4 XMFLOAT4A;
+
+    struct XMUINT4
+    {
+        uint32_t x, y, z, w;
+    };
+
+    struct XMFLOAT3X4
+    {
+        float m[3][4];
+    };
+
+    struct XMFLOAT4X4
+    {
+        union
+        {
+            struct
+            {
+                float _11, _12, _13, _14;
+                float _21, _22, _23, _24;
+                float _31, _32, _33, _34;
+                float _41, _42, _43, _44;
+            };
+            float m[4][4];
+        };
+    };
+    typedef XMFLOAT4X4 XMFLOAT4X4A;
+
+    inline float XMConvertToRadians(float degrees) { return degrees * (XM_PI / 180.0f); }
+
+    // Vectors
+
+    inline XMVECTOR XMVectorSet(float x, float y, float z, float w) { return { { x, y, z, w } }; }
+    inline XMVECTOR XMVectorZero() { return { { 0.0f, 0.0f, 0.0f, 0.0f } }; }
+    inline XMVECTOR XMVectorReplicate(float f) { return { { f, f, f, f } }; }
+
+    inline float XMVectorGetX(FXMVECTOR v) { return v.v[0]; }
+    inline float XMVectorGetY(FXMVECTOR v) { return v.v[1]; }
+    inline float XMVectorGetZ(FXMVECTOR v) { return v.v[2]; }
+    inline float XMVectorGetW(FXMVECTOR v) { return v.v[3]; }
+
+    inline XMVECTOR XMVectorSetW(FXMVECTOR v, float w)
+    {
+        XMVECTOR result = v;
+        result.v[3] = w;
+        return result;
+    }
+
+    inline XMVECTOR XMVectorSplatX(FXMVECTOR v) { return XMVectorReplicate(v.v[0]); }
+    inline XMVECTOR XMVectorSplatY(FXMVECTOR v) { return XMVectorReplicate(v.v[1]); }
+    inline XMVECTOR XMVectorSplatZ(FXMVECTOR v) { return XMVectorReplicate(v.v[2]); }
+    inline XMVECTOR XMVectorSplatW(FXMVECTOR v) { return XMVectorReplicate(v.v[3]); }
+
+    inline XMVECTOR XMVectorAdd(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]);
+    }
+
+    inline XMVECTOR XMVectorSubtract(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]);
+    }
+
+    inline XMVECTOR XMVectorMultiply(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]);
+    }
+
+    inline XMVECTOR XMVectorDivide(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]);
+    }
+
+    inline XMVECTOR XMVectorMultiplyAdd(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c)
+    {
+        return XMVectorAdd(XMVectorMultiply(a, b), c);
+    }
+
+    inline XMVECTOR XMVectorMin(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(fminf(a.v[0], b.v[0]), fminf(a.v[1], b.v[1]), fminf(a.v[2], b.v[2]), fminf(a.v[3], b.v[3]));
+    }
+
+    inline XMVECTOR XMVectorMax(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(fmaxf(a.v[0], b.v[0]), fmaxf(a.v[1], b.v[1]), fmaxf(a.v[2], b.v[2]), fmaxf(a.v[3], b.v[3]));
+    }
+
+    inline XMVECTOR XMVectorScale(FXMVECTOR v, float s)
+    {
+        return XMVectorSet(v.v[0] * s, v.v[1] * s, v.v[2] * s, v.v[3] * s);
+    }
+
+    inline XMVECTOR XMVectorNegate(FXMVECTOR v) { return XMVectorScale(v, -1.0f); }
+
+    inline XMVECTOR XMVectorAbs(FXMVECTOR v)
+    {
+        return XMVectorSet(fabsf(v.v[0]), fabsf(v.v[1]), fabsf(v.v[2]), fabsf(v.v[3]));
+    }
+
+    inline XMVECTOR XMVectorLerp(FXMVECTOR a, FXMVECTOR b, float t)
+    {
+        return XMVectorAdd(a, XMVectorScale(XMVectorSubtract(b, a), t));
+    }
+
+    inline XMVECTOR operator+(FXMVECTOR a, FXMVECTOR b) { return XMVectorAdd(a, b); }
+    inline XMVECTOR operator-(FXMVECTOR a, FXMVECTOR b) { return XMVectorSubtract(a, b); }
+    inline XMVECTOR operator*(FXMVECTOR a, FXMVECTOR b) { return XMVectorMultiply(a, b); }
+    inline XMVECTOR operator*(FXMVECTOR v, float s) { return XMVectorScale(v, s); }
+
+    inline float XMVector3DotScalar(FXMVECTOR a, FXMVECTOR b)
+    {
+        return a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2];
+    }
+
+    inline XMVECTOR XMVector3Dot(FXMVECTOR a, FXMVECTOR b) { return XMVectorReplicate(XMVector3DotScalar(a, b)); }
+
+    inline XMVECTOR XMVector4Dot(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorReplicate(XMVector3DotScalar(a, b) + a.v[3] * b.v[3]);
+    }
+
+    inline XMVECTOR XMVector3Cross(FXMVECTOR a, FXMVECTOR b)
+    {
+        return XMVectorSet(a.v[1] * b.v[2] - a.v[2] * b.v[1], a.v[2] * b.v[0] - a.v[0] * b.v[2],
+            a.v[0] * b.v[1] - a.v[1] * b.v[0], 0.0f);
+    }
+
+    inline XMVECTOR XMVector3LengthSq(FXMVECTOR v) { return XMVector3Dot(v, v); }
+    inline XMVECTOR XMVector3Length(FXMVECTOR v) { return XMVectorReplicate(sqrtf(XMVector3DotScalar(v, v))); }
+
+    inline XMVECTOR XMVector3Normalize(FXMVECTOR v)
+    {
+        float length = sqrtf(XMVector3DotScalar(v, v));
+        return length > 0.0f ? XMVectorScale(v, 1.0f / length) : v;
+    }
+
+    inline XMVECTOR XMVector4Normalize(FXMVECTOR v)
+    {
+        float length = sqrtf(XMVector3DotScalar(v, v) + v.v[3] * v.v[3]);
+        return length > 0.0f ? XMVectorScale(v, 1.0f / length) : v;
+    }
+
+    // Planes are (normal, d) with normal . p + d = 0
+
+    inline XMVECTOR XMPlaneNormalize(FXMVECTOR plane)
+    {
+        float length = sqrtf(XMVector3DotScalar(plane, plane));
+        return length > 0.0f ? XMVectorScale(plane, 1.0f / length) : plane;
+    }
+
+    inline XMVECTOR XMPlaneDotCoord(FXMVECTOR plane, FXMVECTOR point)
+    {
+        return XMVectorReplicate(XMVector3DotScalar(plane, point) + plane.v[3]);
+    }
+
+    // Row vectors times matrices, as in the library
+
+    inline XMVECTOR XMVector4Transform(FXMVECTOR v, FXMMATRIX m)
+    {
+        XMVECTOR result;
+        for (int j = 0; j < 4; j++)
+        {
+            result.v[j] = v.v[0] * m.r[0].v[j] + v.v[1] * m.r[1].v[j] + v.v[2] * m.r[2].v[j] + v.v[3] * m.r[3].v[j];
+        }
+        return result;
+    }
+
+    inline XMVECTOR XMVector3Transform(FXMVECTOR v, FXMMATRIX m)
+    {
+        return XMVector4Transform(XMVectorSet(v.v[0], v.v[1], v.v[2], 1.0f), m);
+    }
+
+    inline XMVECTOR XMVector3TransformCoord(FXMVECTOR v, FXMMATRIX m)
+    {
+        XMVECTOR result = XMVector3Transform(v, m);
+        return XMVectorScale(result, 1.0f / result.v[3]);
+    }
+
+    inline XMVECTOR XMVector3TransformNormal(FXMVECTOR v, FXMMATRIX m)
+    {
+        return XMVector4Transform(XMVectorSet(v.v[0], v.v[1], v.v[2], 0.0f), m);
+    }
+
+    // Matrices
+
+    inline XMMATRIX XMMatrixSet(float m00, float m01, float m02, float m03, float m10, float m11, float m12, float m13,
+        float m20, float m21, float m22, float m23, float m30, float m31, float m32, float m33)
+    {
+        return { { XMVectorSet(m00, m01, m02, m03), XMVectorSet(m10, m11, m12, m13), XMVectorSet(m20, m21, m22, m23),
+            XMVectorSet(m30, m31, m32, m33) } };
+    }
+
+    inline XMMATRIX XMMatrixIdentity()
+    {
+        return XMMatrixSet(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixMultiply(FXMMATRIX a, CXMMATRIX b)
+    {
+        XMMATRIX result;
+        for (int i = 0; i < 4; i++)
+        {
+            result.r[i] = XMVector4Transform(a.r[i], b);
+        }
+        return result;
+    }
+
+    inline XMMATRIX operator*(FXMMATRIX a, CXMMATRIX b) { return XMMatrixMultiply(a, b); }
+
+    inline XMMATRIX XMMatrixTranspose(FXMMATRIX m)
+    {
+        XMMATRIX result;
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                result.r[i].v[j] = m.r[j].v[i];
+            }
+        }
+        return result;
+    }
+
+    // Cofactors over the determinant; det receives the determinant
+    inline XMMATRIX XMMatrixInverse(XMVECTOR* det, FXMMATRIX matrix)
+    {
+        float m[16];
+        for (int i = 0; i < 16; i++)
+        {
+            m[i] = matrix.r[i / 4].v[i % 4];
+        }
+
+        float inv[16];
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+        float determinant = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        if (det)
+            *det = XMVectorReplicate(determinant);
+
+        XMMATRIX result;
+        for (int i = 0; i < 16; i++)
+        {
+            result.r[i / 4].v[i % 4] = inv[i] / determinant;
+        }
+        return result;
+    }
+
+    inline XMMATRIX XMMatrixScaling(float x, float y, float z)
+    {
+        return XMMatrixSet(x, 0.0f, 0.0f, 0.0f, 0.0f, y, 0.0f, 0.0f, 0.0f, 0.0f, z, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixTranslation(float x, float y, float z)
+    {
+        return XMMatrixSet(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, x, y, z, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixTranslationFromVector(FXMVECTOR v) { return XMMatrixTranslation(v.v[0], v.v[1], v.v[2]); }
+
+    inline XMMATRIX XMMatrixRotationX(float angle)
+    {
+        float c = cosf(angle);
+        float s = sinf(angle);
+        return XMMatrixSet(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, c, s, 0.0f, 0.0f, -s, c, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixRotationY(float angle)
+    {
+        float c = cosf(angle);
+        float s = sinf(angle);
+        return XMMatrixSet(c, 0.0f, -s, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, s, 0.0f, c, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixRotationZ(float angle)
+    {
+        float c = cosf(angle);
+        float s = sinf(angle);
+        return XMMatrixSet(c, s, 0.0f, 0.0f, -s, c, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMVECTOR XMQuaternionNormalize(FXMVECTOR q) { return XMVector4Normalize(q); }
+
+    inline XMMATRIX XMMatrixRotationQuaternion(FXMVECTOR q)
+    {
+        float x = q.v[0];
+        float y = q.v[1];
+        float z = q.v[2];
+        float w = q.v[3];
+        return XMMatrixSet(
+            1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + z * w), 2.0f * (x * z - y * w), 0.0f,
+            2.0f * (x * y - z * w), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + x * w), 0.0f,
+            2.0f * (x * z + y * w), 2.0f * (y * z - x * w), 1.0f - 2.0f * (x * x + y * y), 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixLookToLH(FXMVECTOR eye, FXMVECTOR direction, FXMVECTOR up)
+    {
+        XMVECTOR z = XMVector3Normalize(direction);
+        XMVECTOR x = XMVector3Normalize(XMVector3Cross(up, z));
+        XMVECTOR y = XMVector3Cross(z, x);
+        return XMMatrixSet(x.v[0], y.v[0], z.v[0], 0.0f, x.v[1], y.v[1], z.v[1], 0.0f, x.v[2], y.v[2], z.v[2], 0.0f,
+            -XMVector3DotScalar(x, eye), -XMVector3DotScalar(y, eye), -XMVector3DotScalar(z, eye), 1.0f);
+    }
+
+    inline XMMATRIX XMMatrixLookAtLH(FXMVECTOR eye, FXMVECTOR focus, FXMVECTOR up)
+    {
+        return XMMatrixLookToLH(eye, XMVectorSubtract(focus, eye), up);
+    }
+
+    inline XMMATRIX XMMatrixPerspectiveFovLH(float fovY, float aspect, float nearZ, float farZ)
+    {
+        float height = 1.0f / tanf(fovY * 0.5f);
+        float width = height / aspect;
+        float range = farZ / (farZ - nearZ);
+        return XMMatrixSet(width, 0.0f, 0.0f, 0.0f, 0.0f, height, 0.0f, 0.0f, 0.0f, 0.0f, range, 1.0f,
+            0.0f, 0.0f, -range * nearZ, 0.0f);
+    }
+
+    inline XMMATRIX XMMatrixOrthographicLH(float width, float height, float nearZ, float farZ)
+    {
+        float range = 1.0f / (farZ - nearZ);
+        return XMMatrixSet(2.0f / width, 0.0f, 0.0f, 0.0f, 0.0f, 2.0f / height, 0.0f, 0.0f, 0.0f, 0.0f, range, 0.0f,
+            0.0f, 0.0f, -range * nearZ, 1.0f);
+    }
+
+    // Loads and stores
+
+    inline XMVECTOR XMLoadFloat2(const XMFLOAT2* p) { return XMVectorSet(p->x, p->y, 0.0f, 0.0f); }
+    inline XMVECTOR XMLoadFloat3(const XMFLOAT3* p) { return XMVectorSet(p->x, p->y, p->z, 0.0f); }
+    inline XMVECTOR XMLoadFloat4(const XMFLOAT4* p) { return XMVectorSet(p->x, p->y, p->z, p->w); }
+
+    inline void XMStoreFloat2(XMFLOAT2* p, FXMVECTOR v)
+    {
+        p->x = v.v[0];
+        p->y = v.v[1];
+    }
+
+    inline void XMStoreFloat3(XMFLOAT3* p, FXMVECTOR v)
+    {
+        p->x = v.v[0];
+        p->y = v.v[1];
+        p->z = v.v[2];
+    }
+
+    inline void XMStoreFloat4(XMFLOAT4* p, FXMVECTOR v)
+    {
+        p->x = v.v[0];
+        p->y = v.v[1];
+        p->z = v.v[2];
+        p->w = v.v[3];
+    }
+
+    inline XMMATRIX XMLoadFloat4x4(const XMFLOAT4X4* p)
+    {
+        XMMATRIX result;
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                result.r[i].v[j] = p->m[i][j];
+            }
+        }
+        return result;
+    }
+
+    inline void XMStoreFloat4x4(XMFLOAT4X4* p, FXMMATRIX m)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                p->m[i][j] = m.r[i].v[j];
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,401 @@
+#include "BoundingVolumeHierarchy.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+    const UINT NoParent = ~0u;
+
+    struct Bin
+    {
+        float boundsMin[3];
+        float boundsMax[3];
+        UINT count;
+    };
+
+    void ResetBounds(float* boundsMin, float* boundsMax)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            boundsMin[c] = FLT_MAX;
+            boundsMax[c] = -FLT_MAX;
+        }
+    }
+
+    void GrowBounds(float* boundsMin, float* boundsMax, const float* otherMin, const float* otherMax)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            boundsMin[c] = std::min(boundsMin[c], otherMin[c]);
+            boundsMax[c] = std::max(boundsMax[c], otherMax[c]);
+        }
+    }
+
+    float HalfArea(const float* boundsMin, const float* boundsMax)
+    {
+        float x = boundsMax[0] - boundsMin[0];
+        float y = boundsMax[1] - boundsMin[1];
+        float z = boundsMax[2] - boundsMin[2];
+        return x * y + y * z + z * x;
+    }
+
+    void GetBox(const CullingBounds& bounds, UINT id, float* boxMin, float* boxMax)
+    {
+        boxMin[0] = bounds.centerX[id] - bounds.extentX[id];
+        boxMin[1] = bounds.centerY[id] - bounds.extentY[id];
+        boxMin[2] = bounds.centerZ[id] - bounds.extentZ[id];
+        boxMax[0] = bounds.centerX[id] + bounds.extentX[id];
+        boxMax[1] = bounds.centerY[id] + bounds.extentY[id];
+        boxMax[2] = bounds.centerZ[id] + bounds.extentZ[id];
+    }
+
+    UINT GetBin(float centroid, float centroidMin, float scale)
+    {
+        return std::min(BoundingVolumeHierarchy::BinCount - 1, static_cast<UINT>((centroid - centroidMin) * scale));
+    }
+}
+
+void BoundingVolumeHierarchy::Clear()
+{
+    m_nodes.clear();
+    m_indices.clear();
+    m_boxLeaves.clear();
+    m_stats = BvhStats();
+}
+
+void BoundingVolumeHierarchy::Build(const CullingBounds& bounds)
+{
+    auto start = std::chrono::steady_clock::now();
+    Clear();
+
+    const UINT count = bounds.GetCount();
+    if (count == 0)
+        return;
+
+    m_indices.resize(count);
+    for (UINT i = 0; i < count; i++)
+    {
+        m_indices[i] = i;
+    }
+    m_boxLeaves.resize(count);
+
+    // at most one leaf per box, so at most 2 * count - 1 nodes
+    m_nodes.reserve(2 * count);
+    BvhNode root = {};
+    root.count = count;
+    root.parent = NoParent;
+    m_nodes.push_back(root);
+    Subdivide(0, bounds, 1);
+
+    // a node is popped before its two children are pushed
+    m_stack.resize(2 * (m_stats.depth + 1));
+    m_stats.nodes = static_cast<UINT>(m_nodes.size());
+    m_stats.buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BoundingVolumeHierarchy::Subdivide(UINT nodeIndex, const CullingBounds& bounds, UINT depth)
+{
+    m_stats.depth = std::max(m_stats.depth, depth);
+    ComputeRangeBounds(m_nodes[nodeIndex], bounds);
+    const BvhNode node = m_nodes[nodeIndex];
+
+    const float* centers[3] = { bounds.centerX.data(), bounds.centerY.data(), bounds.centerZ.data() };
+    UINT* first = m_indices.data() + node.first;
+    UINT* last = first + node.count;
+
+    int bestAxis = -1;
+    UINT bestSplit = 0;
+    float bestCost = FLT_MAX;
+    float centroidMin[3];
+    float centroidMax[3];
+    if (node.count > LeafSize)
+    {
+        ResetBounds(centroidMin, centroidMax);
+        for (UINT* p = first; p != last; p++)
+        {
+            const float centroid[3] = { centers[0][*p], centers[1][*p], centers[2][*p] };
+            GrowBounds(centroidMin, centroidMax, centroid, centroid);
+        }
+
+        // the cheapest plane between two bins of any axis, a side costs its
+        // area times its boxes
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Bin bins[BinCount];
+            for (Bin& bin : bins)
+            {
+                ResetBounds(bin.boundsMin, bin.boundsMax);
+                bin.count = 0;
+            }
+
+            float scale = BinCount / extent;
+            for (UINT* p = first; p != last; p++)
+            {
+                Bin& bin = bins[GetBin(centers[axis][*p], centroidMin[axis], scale)];
+                float boxMin[3];
+                float boxMax[3];
+                GetBox(bounds, *p, boxMin, boxMax);
+                GrowBounds(bin.boundsMin, bin.boundsMax, boxMin, boxMax);
+                bin.count++;
+            }
+
+            float leftCost[BinCount - 1];
+            float boundsMin[3];
+            float boundsMax[3];
+            ResetBounds(boundsMin, boundsMax);
+            UINT leftCount = 0;
+            for (UINT i = 0; i < BinCount - 1; i++)
+            {
+                GrowBounds(boundsMin, boundsMax, bins[i].boundsMin, bins[i].boundsMax);
+                leftCount += bins[i].count;
+                leftCost[i] = leftCount ? HalfArea(boundsMin, boundsMax) * leftCount : 0.0f;
+            }
+
+            ResetBounds(boundsMin, boundsMax);
+            UINT rightCount = 0;
+            for (UINT i = BinCount - 1; i > 0; i--)
+            {
+                GrowBounds(boundsMin, boundsMax, bins[i].boundsMin, bins[i].boundsMax);
+                rightCount += bins[i].count;
+                if (rightCount == 0 || rightCount == node.count)
+                    continue;
+
+                float cost = leftCost[i - 1] + HalfArea(boundsMin, boundsMax) * rightCount;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+    }
+
+    // visiting the node costs about as much as testing one box
+    float area = HalfArea(node.boundsMin, node.boundsMax);
+    bool split = node.count > MaxLeafSize || (node.count > LeafSize && bestAxis >= 0 && area + bestCost < area * node.count);
+    if (!split)
+    {
+        for (UINT* p = first; p != last; p++)
+        {
+            m_boxLeaves[*p] = nodeIndex;
+        }
+        m_stats.leaves++;
+        return;
+    }
+
+    UINT leftCount = node.count / 2;
+    if (bestAxis >= 0)
+    {
+        float scale = BinCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        const float* axisCenters = centers[bestAxis];
+        const float axisMin = centroidMin[bestAxis];
+        UINT* middle = std::partition(first, last, [&](UINT id)
+        {
+            return GetBin(axisCenters[id], axisMin, scale) < bestSplit;
+        });
+        leftCount = static_cast<UINT>(middle - first);
+    }
+
+    // every centroid in the same place, halves of the range
+    if (leftCount == 0 || leftCount == node.count)
+        leftCount = node.count / 2;
+
+    UINT left = static_cast<UINT>(m_nodes.size());
+    BvhNode child = {};
+    child.parent = nodeIndex;
+    child.first = node.first;
+    child.count = leftCount;
+    m_nodes.push_back(child);
+    child.first = node.first + leftCount;
+    child.count = node.count - leftCount;
+    m_nodes.push_back(child);
+    m_nodes[nodeIndex].left = left;
+
+    Subdivide(left, bounds, depth + 1);
+    Subdivide(left + 1, bounds, depth + 1);
+}
+
+bool BoundingVolumeHierarchy::ComputeRangeBounds(BvhNode& node, const CullingBounds& bounds) const
+{
+    float boundsMin[3];
+    float boundsMax[3];
+    ResetBounds(boundsMin, boundsMax);
+    for (UINT i = node.first; i < node.first + node.count; i++)
+    {
+        float boxMin[3];
+        float boxMax[3];
+        GetBox(bounds, m_indices[i], boxMin, boxMax);
+        GrowBounds(boundsMin, boundsMax, boxMin, boxMax);
+    }
+
+    bool changed = memcmp(boundsMin, node.boundsMin, sizeof(boundsMin)) != 0 ||
+        memcmp(boundsMax, node.boundsMax, sizeof(boundsMax)) != 0;
+    memcpy(node.boundsMin, boundsMin, sizeof(boundsMin));
+    memcpy(node.boundsMax, boundsMax, sizeof(boundsMax));
+    return changed;
+}
+
+bool BoundingVolumeHierarchy::ComputeInnerBounds(BvhNode& node) const
+{
+    const BvhNode& left = m_nodes[node.left];
+    const BvhNode& right = m_nodes[node.left + 1];
+    float boundsMin[3];
+    float boundsMax[3];
+    for (int c = 0; c < 3; c++)
+    {
+        boundsMin[c] = std::min(left.boundsMin[c], right.boundsMin[c]);
+        boundsMax[c] = std::max(left.boundsMax[c], right.boundsMax[c]);
+    }
+
+    bool changed = memcmp(boundsMin, node.boundsMin, sizeof(boundsMin)) != 0 ||
+        memcmp(boundsMax, node.boundsMax, sizeof(boundsMax)) != 0;
+    memcpy(node.boundsMin, boundsMin, sizeof(boundsMin));
+    memcpy(node.boundsMax, boundsMax, sizeof(boundsMax));
+    return changed;
+}
+
+void BoundingVolumeHierarchy::Refit(const CullingBounds& bounds)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // children come after their parent, so going backwards finishes them first
+    for (size_t i = m_nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = m_nodes[i];
+        if (node.left == 0)
+            ComputeRangeBounds(node, bounds);
+        else
+            ComputeInnerBounds(node);
+    }
+
+    m_stats.refitNodes = static_cast<UINT>(m_nodes.size());
+    m_stats.refitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BoundingVolumeHierarchy::Refit(const CullingBounds& bounds, const UINT* movedIndices, UINT count)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    UINT touched = 0;
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT nodeIndex = m_boxLeaves[movedIndices[i]];
+        touched++;
+        if (!ComputeRangeBounds(m_nodes[nodeIndex], bounds))
+            continue;
+
+        for (nodeIndex = m_nodes[nodeIndex].parent; nodeIndex != NoParent; nodeIndex = m_nodes[nodeIndex].parent)
+        {
+            touched++;
+            if (!ComputeInnerBounds(m_nodes[nodeIndex]))
+                break;
+        }
+    }
+
+    m_stats.refitNodes = touched;
+    m_stats.refitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+UINT BoundingVolumeHierarchy::Cull(const XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices)
+{
+    m_stats.visitedNodes = 0;
+    m_stats.acceptedNodes = 0;
+    m_stats.testedBoxes = 0;
+    if (m_nodes.empty())
+        return 0;
+
+    float absNormals[6][3];
+    for (int p = 0; p < 6; p++)
+    {
+        absNormals[p][0] = fabsf(planes[p].x);
+        absNormals[p][1] = fabsf(planes[p].y);
+        absNormals[p][2] = fabsf(planes[p].z);
+    }
+
+    UINT visible = 0;
+    UINT stackSize = 0;
+    m_stack[stackSize++] = 0;
+    m_stack[stackSize++] = 0x3F;
+    while (stackSize > 0)
+    {
+        UINT mask = m_stack[--stackSize];
+        const BvhNode& node = m_nodes[m_stack[--stackSize]];
+        m_stats.visitedNodes++;
+
+        float center[3];
+        float extent[3];
+        for (int c = 0; c < 3; c++)
+        {
+            center[c] = (node.boundsMin[c] + node.boundsMax[c]) * 0.5f;
+            extent[c] = (node.boundsMax[c] - node.boundsMin[c]) * 0.5f;
+        }
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; p++)
+        {
+            if (!(mask & (1u << p)))
+                continue;
+
+            const XMFLOAT4& plane = planes[p];
+            float dist = (center[0] * plane.x + center[1] * plane.y) + (center[2] * plane.z + plane.w);
+            float radius = (extent[0] * absNormals[p][0] + extent[1] * absNormals[p][1]) + extent[2] * absNormals[p][2];
+            outside = dist + radius < 0.0f;
+            if (dist - radius >= 0.0f)
+                mask &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+
+        if (mask == 0)
+        {
+            memcpy(visibleIndices + visible, m_indices.data() + node.first, sizeof(UINT) * node.count);
+            visible += node.count;
+            m_stats.acceptedNodes++;
+            continue;
+        }
+
+        if (node.left != 0)
+        {
+            m_stack[stackSize++] = node.left + 1;
+            m_stack[stackSize++] = mask;
+            m_stack[stackSize++] = node.left;
+            m_stack[stackSize++] = mask;
+            continue;
+        }
+
+        // the test of CullBounds, against the planes the leaf crosses
+        for (UINT i = node.first; i < node.first + node.count; i++)
+        {
+            UINT id = m_indices[i];
+            UINT inside = 1;
+            for (int p = 0; p < 6; p++)
+            {
+                if (!(mask & (1u << p)))
+                    continue;
+
+                const XMFLOAT4& plane = planes[p];
+                float dist = (bounds.centerX[id] * plane.x + bounds.centerY[id] * plane.y) +
+                    (bounds.centerZ[id] * plane.z + plane.w);
+                float radius = (bounds.extentX[id] * absNormals[p][0] + bounds.extentY[id] * absNormals[p][1]) +
+                    bounds.extentZ[id] * absNormals[p][2];
+                inside &= (dist + radius >= 0.0f) ? 1 : 0;
+            }
+            visibleIndices[visible] = id;
+            visible += inside;
+        }
+        m_stats.testedBoxes += node.count;
+    }
+
+    return visible;
+}
@@ -0,0 +1,76 @@
+#ifndef BOUNDING_VOLUME_HIERARCHY_H
+#define BOUNDING_VOLUME_HIERARCHY_H
+
+#include "FrustumCulling.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// A node covers one contiguous range of the box order, so a subtree that is
+// inside the frustum is copied out without visiting it
+struct BvhNode
+{
+    float boundsMin[3];
+    UINT first;         // into the box order
+    float boundsMax[3];
+    UINT count;
+    UINT left;          // 0 for a leaf, otherwise the children are left and left + 1
+    UINT parent;        // ~0u for the root
+};
+
+struct BvhStats
+{
+    UINT nodes = 0;
+    UINT leaves = 0;
+    UINT depth = 0;
+    double buildSeconds = 0.0;
+    double refitSeconds = 0.0;      // of the last Refit
+    UINT refitNodes = 0;            // nodes the last Refit touched
+    UINT visitedNodes = 0;          // by the last Cull
+    UINT acceptedNodes = 0;         // whole subtrees inside the frustum
+    UINT testedBoxes = 0;           // boxes of leaves crossing a plane
+};
+
+// Bounding volume hierarchy over CullingBounds, built with the surface area
+// heuristic over binned centroids. Boxes that move keep their place in the
+// tree and only the bounds up to the root are refit; a tree refit many
+// times over large moves gets worse and should be built again.
+class BoundingVolumeHierarchy
+{
+public:
+    static const UINT LeafSize = 4;         // a range this small is never split
+    static const UINT MaxLeafSize = 16;     // a range this large always is
+    static const UINT BinCount = 16;
+
+    void Build(const CullingBounds& bounds);
+    void Clear();
+
+    // Every box may have moved
+    void Refit(const CullingBounds& bounds);
+    // Only the given boxes moved; stops going up where the bounds stay the same
+    void Refit(const CullingBounds& bounds, const UINT* movedIndices, UINT count);
+
+    // Like CullBounds but in the order of the tree. A plane a node is wholly
+    // in front of is not tested again below it, and a node in front of all
+    // six adds its boxes without going further. visibleIndices must have room
+    // for every box.
+    UINT Cull(const DirectX::XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices);
+
+    UINT GetBoxCount() const { return static_cast<UINT>(m_indices.size()); }
+    const std::vector<BvhNode>& GetNodes() const { return m_nodes; }
+    const BvhStats& GetStats() const { return m_stats; }
+
+private:
+    void Subdivide(UINT nodeIndex, const CullingBounds& bounds, UINT depth);
+    // Both are true when the bounds changed
+    bool ComputeRangeBounds(BvhNode& node, const CullingBounds& bounds) const;
+    bool ComputeInnerBounds(BvhNode& node) const;
+
+    std::vector<BvhNode> m_nodes;       // children always after their parent
+    std::vector<UINT> m_indices;        // the box order, ranges of it per node
+    std::vector<UINT> m_boxLeaves;      // the leaf of every box
+    std::vector<UINT> m_stack;          // traversal, node and plane mask
+    BvhStats m_stats;
+};
+
+#endif
@@ -1,17 +1,32 @@
-static const uint MAX_INSTANCES = 23;
+// 0 leaves out the tangent frame, for cubes drawn without a normal map
+#ifndef NORMAL_MAP
+#define NORMAL_MAP 1
+#endif
+
+// 1 reads the instances from constants, for the shadow casters that go
+// into the upload ring with the other constants of the frame
+#ifndef CONSTANT_INSTANCES
+#define CONSTANT_INSTANCES 0
+#endif
+
+// RenderClass::ShadowCastersPerDraw
+#define MAX_CONSTANT_INSTANCES 512
 
 struct InstanceData
 {
     float4x4 model;
     uint texInd;
-    uint countInstance;
-    float2 padding;
+    float3 extent;
 };
 
-cbuffer ModelBufferInst : register(b0)
+#if CONSTANT_INSTANCES
+cbuffer InstanceBuffer : register(b2)
 {
-    InstanceData modelBuffer[MAX_INSTANCES];
+    InstanceData modelBuffer[MAX_CONSTANT_INSTANCES];
 };
+#else
+StructuredBuffer<InstanceData> modelBuffer : register(t0);
+#endif
 
 cbuffer CameraBuffer : register(b1)
 {
@@ -32,8 +47,10 @@ struct PS_INPUT
     float3 WorldPos : TEXCOORD0;
     float3 Normal : TEXCOORD1;
     float2 TexCoord : TEXCOORD2;
+#if NORMAL_MAP
     float3 Tangent : TEXCOORD3;
     float3 Bitangent : TEXCOORD4;
+#endif
     float3 CameraPos : TEXCOORD5;
     uint TexInd : TEXCOORD6;
 };
@@ -49,6 +66,7 @@ PS_INPUT main(VS_INPUT input, uint instanceID : SV_InstanceID)
     output.TexCoord = input.TexCoord;
     output.CameraPos = CameraPos;
 
+#if NORMAL_MAP
     float3 tangent;
     if (abs(input.Normal.z) > 0.999f)
     {
@@ -62,6 +80,7 @@ PS_INPUT main(VS_INPUT input, uint instanceID : SV_InstanceID)
     float3 bitangent = cross(input.Normal, tangent);
     output.Tangent = mul(tangent, (float3x3)modelBuffer[instanceID].model);
     output.Bitangent = mul(bitangent, (float3x3)modelBuffer[instanceID].model);
+#endif
     output.TexInd = modelBuffer[instanceID].texInd;
     return output;
 }
\ No newline at end of file
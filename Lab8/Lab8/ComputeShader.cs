@@ -1,26 +1,40 @@
+#define MAX_HIZ_LEVELS 16
+
 cbuffer FrustumPlanes : register(b0)
 {
     float4 planes[6];
+    uint instanceCount;
+    uint phase;             // 0 frustum only, 1 and 2 the passes of occlusion culling
+    uint hiZLevelCount;     // 0 without a pyramid to test against
+    uint hiZWidth;
+    float4x4 spin;
+    float4x4 occlusionViewProj;     // of the frame the pyramid was built in
+    float3 occlusionExtent;
+    float occlusionPadding;
+    float2 depthSize;
+    float2 depthPadding;
+    uint4 hiZLevels[MAX_HIZ_LEVELS];    // x, y, width, height in the pyramid texture, see HiZ.cs
 };
 
 struct InstanceData
 {
     float4x4 model;
     uint texInd;
-    uint countInstance;
-    float2 padding;
+    float3 extent;      // of the world box
 };
 
 StructuredBuffer<InstanceData> instanceData : register(t0);
+Texture2D<float> hiZ : register(t1);
 RWByteAddressBuffer indirectArgs : register(u0);
-RWStructuredBuffer<uint> objectIds : register(u1);
+RWStructuredBuffer<InstanceData> visibleInstances : register(u1);
+RWByteAddressBuffer occludedInstances : register(u2);     // phase 1 flags what phase 2 tests again
 
-bool IsAABBInFrustum(in float3 center, in float size)
+bool IsAABBInFrustum(in float3 center, in float3 extent)
 {
     for (int i = 0; i < 6; i++)
     {
         float d = dot(planes[i].xyz, center) + planes[i].w;
-        float r = size * (abs(planes[i].x) + abs(planes[i].y) + abs(planes[i].z));
+        float r = dot(extent, abs(planes[i].xyz));
 
         if (d + r < 0)
         {
@@ -30,20 +44,84 @@ bool IsAABBInFrustum(in float3 center, in float size)
     return true;
 }
 
+// The box is hidden if its nearest depth is behind the farthest depth of
+// the pyramid over every pixel it covers. The level is the first where
+// those pixels fit in 2x2 texels.
+bool IsOccluded(in float3 center)
+{
+    if (hiZLevelCount == 0)
+        return false;
+
+    float3 ndcMin = 1.0f;
+    float3 ndcMax = -1.0f;
+    for (uint i = 0; i < 8; i++)
+    {
+        float3 corner = center + occlusionExtent * float3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        float4 clip = mul(float4(corner, 1.0f), occlusionViewProj);
+        if (clip.w <= 0.0f)
+            return false;
+
+        float3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    uint2 size = (uint2)depthSize;
+    uint2 first = min((uint2)(saturate(float2(ndcMin.x, -ndcMax.y) * 0.5f + 0.5f) * depthSize), size - 1);
+    uint2 last = min((uint2)(saturate(float2(ndcMax.x, -ndcMin.y) * 0.5f + 0.5f) * depthSize), size - 1);
+
+    uint level = 0;
+    while (level + 1 < hiZLevelCount && any((last >> (level + 1)) - (first >> (level + 1)) > 1))
+    {
+        level++;
+    }
+
+    uint4 rect = hiZLevels[level];
+    uint2 p0 = min(first >> (level + 1), rect.zw - 1);
+    uint2 p1 = min(last >> (level + 1), rect.zw - 1);
+    float farthest = max(max(hiZ[rect.xy + p0], hiZ[rect.xy + uint2(p1.x, p0.y)]),
+        max(hiZ[rect.xy + uint2(p0.x, p1.y)], hiZ[rect.xy + p1]));
+
+    return ndcMin.z > farthest;
+}
+
 [numthreads(64, 1, 1)]
 void main(uint3 threadID : SV_DispatchThreadID)
 {
-    if (threadID.x >= instanceData[0].countInstance)
+    if (threadID.x >= instanceCount)
         return;
 
-    float3 pos = instanceData[threadID.x].model._m03_m13_m23;
+    InstanceData instance = instanceData[threadID.x];
+    float3 pos = instance.model._m30_m31_m32;
 
-    float size = 0.5f * 0.95f;
+    // Phase 1 tests against the pyramid of the last frame and draws the
+    // rest into the first arguments; phase 2 tests what it hid against the
+    // pyramid of those draws and adds the second arguments.
+    bool draw;
+    if (phase == 2)
+    {
+        draw = occludedInstances.Load(threadID.x * 4) != 0 && !IsOccluded(pos);
+    }
+    else
+    {
+        draw = IsAABBInFrustum(pos, instance.extent);
+        if (phase == 1)
+        {
+            bool occluded = draw && IsOccluded(pos);
+            occludedInstances.Store(threadID.x * 4, occluded ? 1 : 0);
+            draw = draw && !occluded;
+        }
+    }
 
-    if (IsAABBInFrustum(pos, size)) 
+    if (draw)
     {
         uint index;
-        indirectArgs.InterlockedAdd(4, 1, index);
-        objectIds[index] = threadID.x;
+        indirectArgs.InterlockedAdd(phase == 2 ? 24 : 4, 1, index);
+
+        InstanceData visible;
+        visible.model = mul(spin, instance.model);
+        visible.texInd = instance.texInd;
+        visible.extent = instance.extent;
+        visibleInstances[index] = visible;
     }
 }
\ No newline at end of file
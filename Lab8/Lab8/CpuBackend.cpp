@@ -0,0 +1,1496 @@
+#include "CpuBackend.h"
+#include "DDSFile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+static UINT FormatSize(Format format)
+{
+    switch (format)
+    {
+    case Format::R32G32B32A32_FLOAT: return 16;
+    case Format::R32G32B32_FLOAT:    return 12;
+    case Format::R32G32_FLOAT:       return 8;
+    case Format::R16G16B16A16_UNORM: return 8;
+    case Format::R16_UINT:           return 2;
+    default:                         return 4;
+    }
+}
+
+CpuRenderDevice::CpuRenderDevice(UINT width, UINT height, UINT threadCount) :
+    m_pImmediateContext(nullptr),
+    m_backBuffer(NullHandle),
+    m_frameCount(0)
+{
+    m_pImmediateContext = new CpuRenderContext(this, threadCount);
+
+    TextureDesc desc;
+    desc.width = width;
+    desc.height = height;
+    desc.format = Format::R8G8B8A8_UNORM;
+    desc.bindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+    CreateTexture(desc, nullptr, &m_backBuffer);
+}
+
+CpuRenderDevice::~CpuRenderDevice()
+{
+    delete m_pImmediateContext;
+}
+
+RenderHandle CpuRenderDevice::AddResource(CpuResource&& resource)
+{
+    if (!m_freeHandles.empty())
+    {
+        RenderHandle handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+        m_resources[handle - 1] = std::move(resource);
+        return handle;
+    }
+
+    m_resources.push_back(std::move(resource));
+    return static_cast<RenderHandle>(m_resources.size());
+}
+
+CpuResource* CpuRenderDevice::GetResource(RenderHandle handle)
+{
+    if (handle == NullHandle || handle > m_resources.size())
+        return nullptr;
+
+    CpuResource* pResource = &m_resources[handle - 1];
+    return pResource->type == CpuResourceType::Free ? nullptr : pResource;
+}
+
+UINT CpuRenderDevice::GetLiveResourceCount() const
+{
+    return static_cast<UINT>(m_resources.size() - m_freeHandles.size());
+}
+
+void CpuRenderDevice::Release(RenderHandle handle)
+{
+    CpuResource* pResource = GetResource(handle);
+    if (!pResource || handle == m_backBuffer)
+        return;
+
+    *pResource = CpuResource();
+    m_freeHandles.push_back(handle);
+}
+
+void CpuRenderDevice::ReplaceResource(RenderHandle target, RenderHandle source)
+{
+    CpuResource* pTarget = GetResource(target);
+    CpuResource* pSource = GetResource(source);
+    if (!pTarget || !pSource || target == source || target == m_backBuffer)
+        return;
+
+    *pTarget = std::move(*pSource);
+    Release(source);
+}
+
+HRESULT CpuRenderDevice::CreateBuffer(const BufferDesc& desc, const void* pInitData, RenderHandle* pBuffer)
+{
+    if (desc.byteWidth == 0)
+        return E_INVALIDARG;
+
+    CpuResource buffer;
+    buffer.type = CpuResourceType::Buffer;
+    buffer.bufferDesc = desc;
+    buffer.data.resize(desc.byteWidth, 0);
+    if (pInitData)
+        memcpy(buffer.data.data(), pInitData, desc.byteWidth);
+
+    *pBuffer = AddResource(std::move(buffer));
+    return S_OK;
+}
+
+static void DecodeColor565(WORD color, BYTE* rgba)
+{
+    rgba[0] = static_cast<BYTE>(((color >> 11) & 0x1F) * 255 / 31);
+    rgba[1] = static_cast<BYTE>(((color >> 5) & 0x3F) * 255 / 63);
+    rgba[2] = static_cast<BYTE>((color & 0x1F) * 255 / 31);
+    rgba[3] = 255;
+}
+
+// BC1 blocks: two RGB565 endpoints and 2-bit indices for the 4x4 texels
+static void DecodeBC1(const BYTE* blocks, UINT width, UINT height, BYTE* texels)
+{
+    for (UINT by = 0; by < (height + 3) / 4; by++)
+    {
+        for (UINT bx = 0; bx < (width + 3) / 4; bx++, blocks += 8)
+        {
+            WORD c0 = static_cast<WORD>(blocks[0] | (blocks[1] << 8));
+            WORD c1 = static_cast<WORD>(blocks[2] | (blocks[3] << 8));
+            UINT bits = blocks[4] | (blocks[5] << 8) | (blocks[6] << 16) | ((UINT)blocks[7] << 24);
+
+            BYTE palette[4][4];
+            DecodeColor565(c0, palette[0]);
+            DecodeColor565(c1, palette[1]);
+            for (int c = 0; c < 3; c++)
+            {
+                if (c0 > c1)
+                {
+                    palette[2][c] = static_cast<BYTE>((2 * palette[0][c] + palette[1][c]) / 3);
+                    palette[3][c] = static_cast<BYTE>((palette[0][c] + 2 * palette[1][c]) / 3);
+                }
+                else
+                {
+                    palette[2][c] = static_cast<BYTE>((palette[0][c] + palette[1][c]) / 2);
+                    palette[3][c] = 0;
+                }
+            }
+            palette[2][3] = 255;
+            palette[3][3] = c0 > c1 ? 255 : 0;
+
+            for (UINT i = 0; i < 16; i++)
+            {
+                UINT x = bx * 4 + i % 4;
+                UINT y = by * 4 + i / 4;
+                if (x < width && y < height)
+                    memcpy(texels + ((size_t)y * width + x) * 4, palette[(bits >> (i * 2)) & 3], 4);
+            }
+        }
+    }
+}
+
+HRESULT CpuRenderDevice::LoadDDS(const BYTE* pData, size_t byteSize, CpuResource& texture)
+{
+    // magic + DDS_HEADER, see DDSTextureLoader11.cpp
+    UINT header[32] = {};
+    if (byteSize < sizeof(header))
+        return E_FAIL;
+    memcpy(header, pData, sizeof(header));
+    if (header[0] != 0x20534444 || header[1] != 124)
+        return E_FAIL;
+
+    texture.type = CpuResourceType::Texture;
+    texture.textureDesc.height = header[3];
+    texture.textureDesc.width = header[4];
+    texture.textureDesc.format = Format::R8G8B8A8_UNORM;
+    texture.textureDesc.bindFlags = BIND_SHADER_RESOURCE;
+    texture.mipLevels = header[7] ? header[7] : 1;
+
+    const UINT pixelFormatFlags = header[20];
+    const UINT fourCC = header[21];
+    const UINT bitCount = header[22];
+    const bool cubeMap = (header[28] & 0x200) != 0;
+    texture.arraySize = cubeMap ? 6 : 1;
+
+    // only mip 0 is decoded, the rasterizer does not filter between mips
+    const bool bc1 = (pixelFormatFlags & 0x4) && fourCC == 0x31545844;
+    const bool rgba32 = (pixelFormatFlags & 0x40) && bitCount == 32;
+    if (!bc1 && !rgba32)
+        return S_OK;
+
+    DDSLayout layout;
+    HRESULT result = GetDDSLayout(pData, byteSize, layout);
+    if (FAILED(result))
+        return result;
+    if (layout.arraySize != texture.arraySize)
+        return E_FAIL;
+
+    UINT width = texture.textureDesc.width;
+    UINT height = texture.textureDesc.height;
+    texture.data.resize((size_t)width * height * 4 * texture.arraySize);
+    for (UINT slice = 0; slice < texture.arraySize; slice++)
+    {
+        const BYTE* chain = layout.subresources[slice * layout.mipLevels].pData;
+        BYTE* texels = texture.data.data() + (size_t)width * height * 4 * slice;
+        if (bc1)
+        {
+            DecodeBC1(chain, width, height, texels);
+            continue;
+        }
+
+        // uncompressed, move the channels to RGBA order using the bit masks
+        const UINT* masks = header + 23;
+        for (size_t i = 0; i < (size_t)width * height; i++)
+        {
+            UINT value;
+            memcpy(&value, chain + i * 4, sizeof(UINT));
+            for (int c = 0; c < 4; c++)
+            {
+                UINT mask = masks[c];
+                if (!mask)
+                {
+                    texels[i * 4 + c] = c == 3 ? 255 : 0;
+                    continue;
+                }
+                UINT shift = 0;
+                while (!((mask >> shift) & 1))
+                    shift++;
+                texels[i * 4 + c] = static_cast<BYTE>((value & mask) >> shift);
+            }
+        }
+    }
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateTexture(const TextureDesc& desc, const SubresourceData* pInitData, RenderHandle* pTexture)
+{
+    if (desc.width == 0 || desc.height == 0 || desc.mipLevels == 0 || desc.arraySize == 0)
+        return E_INVALIDARG;
+
+    CpuResource texture;
+    texture.type = CpuResourceType::Texture;
+    texture.textureDesc = desc;
+    if (!pInitData)
+    {
+        texture.data.resize((size_t)desc.width * desc.height * FormatSize(desc.format), 0);
+        *pTexture = AddResource(std::move(texture));
+        return S_OK;
+    }
+
+    // sampled textures are kept as RGBA8 mip 0 of every slice, like LoadDDS
+    texture.textureDesc.format = Format::R8G8B8A8_UNORM;
+    texture.mipLevels = desc.mipLevels;
+    texture.arraySize = desc.arraySize;
+    const size_t sliceSize = (size_t)desc.width * desc.height * 4;
+    if (desc.format != Format::BC1_UNORM && desc.format != Format::R8G8B8A8_UNORM && desc.format != Format::B8G8R8A8_UNORM)
+    {
+        // other formats sample as white
+        *pTexture = AddResource(std::move(texture));
+        return S_OK;
+    }
+
+    texture.data.resize(sliceSize * desc.arraySize);
+    for (UINT slice = 0; slice < desc.arraySize; slice++)
+    {
+        const SubresourceData& source = pInitData[slice * desc.mipLevels];
+        const BYTE* pSource = static_cast<const BYTE*>(source.pData);
+        BYTE* texels = texture.data.data() + sliceSize * slice;
+        if (desc.format == Format::BC1_UNORM)
+        {
+            DecodeBC1(pSource, desc.width, desc.height, texels);
+            continue;
+        }
+
+        for (UINT y = 0; y < desc.height; y++)
+        {
+            BYTE* row = texels + (size_t)y * desc.width * 4;
+            memcpy(row, pSource + (size_t)y * source.rowPitch, (size_t)desc.width * 4);
+            if (desc.format == Format::B8G8R8A8_UNORM)
+            {
+                for (UINT x = 0; x < desc.width; x++)
+                    std::swap(row[x * 4], row[x * 4 + 2]);
+            }
+        }
+    }
+
+    *pTexture = AddResource(std::move(texture));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateTextureFromFile(const std::wstring& path, RenderHandle* pTexture)
+{
+    MappedFile file;
+    HRESULT result = file.Open(path);
+    if (FAILED(result))
+        return result;
+
+    return CreateTextureFromMemory(file.GetData(), file.GetSize(), pTexture);
+}
+
+HRESULT CpuRenderDevice::CreateTextureArrayFromFiles(const std::wstring* paths, UINT count, RenderHandle* pTexture)
+{
+    std::vector<MappedFile> files(count);
+    std::vector<const BYTE*> data(count);
+    std::vector<size_t> sizes(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        HRESULT result = files[i].Open(paths[i]);
+        if (FAILED(result))
+            return result;
+        data[i] = files[i].GetData();
+        sizes[i] = files[i].GetSize();
+    }
+
+    return CreateTextureArrayFromMemory(data.data(), sizes.data(), count, pTexture);
+}
+
+HRESULT CpuRenderDevice::CreateTextureFromMemory(const BYTE* pData, size_t byteSize, RenderHandle* pTexture)
+{
+    CpuResource texture;
+    HRESULT result = LoadDDS(pData, byteSize, texture);
+    if (FAILED(result))
+        return result;
+
+    *pTexture = AddResource(std::move(texture));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateTextureArrayFromMemory(const BYTE* const* ppData, const size_t* byteSizes, UINT count, RenderHandle* pTexture)
+{
+    if (count == 0)
+        return E_INVALIDARG;
+
+    CpuResource texture;
+    for (UINT i = 0; i < count; ++i)
+    {
+        CpuResource slice;
+        HRESULT result = LoadDDS(ppData[i], byteSizes[i], slice);
+        if (FAILED(result))
+            return result;
+
+        if (i == 0)
+        {
+            texture = std::move(slice);
+        }
+        else if (slice.textureDesc.width != texture.textureDesc.width ||
+            slice.textureDesc.height != texture.textureDesc.height)
+        {
+            return E_INVALIDARG;
+        }
+        else
+        {
+            texture.data.insert(texture.data.end(), slice.data.begin(), slice.data.end());
+        }
+    }
+    texture.arraySize = count;
+
+    // sample as white rather than out of bounds if one of the files was not decoded
+    if (texture.data.size() != (size_t)texture.textureDesc.width * texture.textureDesc.height * 4 * count)
+        texture.data.clear();
+
+    *pTexture = AddResource(std::move(texture));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount, RenderHandle* pShader)
+{
+    const CpuShaderProgram* pProgram = FindCpuShader(stage, path, defines, defineCount);
+    if (!pProgram)
+        return E_FAIL;
+
+    CpuResource shader;
+    shader.type = CpuResourceType::Shader;
+    shader.pProgram = pProgram;
+
+    *pShader = AddResource(std::move(shader));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateInputLayout(const InputElement* elements, UINT count, RenderHandle vertexShader, RenderHandle* pLayout)
+{
+    CpuResource* pShader = GetResource(vertexShader);
+    if (!pShader || pShader->type != CpuResourceType::Shader || pShader->pProgram->stage != ShaderStage::Vertex)
+        return E_INVALIDARG;
+
+    CpuResource layout;
+    layout.type = CpuResourceType::InputLayout;
+    layout.layout.assign(elements, elements + count);
+
+    *pLayout = AddResource(std::move(layout));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateRasterizerState(const RasterizerDesc& desc, RenderHandle* pState)
+{
+    CpuResource state;
+    state.type = CpuResourceType::RasterizerState;
+    state.rasterizer = desc;
+
+    *pState = AddResource(std::move(state));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState)
+{
+    CpuResource state;
+    state.type = CpuResourceType::DepthStencilState;
+    state.depthStencil = desc;
+
+    *pState = AddResource(std::move(state));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateBlendState(const BlendDesc& desc, RenderHandle* pState)
+{
+    CpuResource state;
+    state.type = CpuResourceType::BlendState;
+    state.blend = desc;
+
+    *pState = AddResource(std::move(state));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateSamplerState(const SamplerDesc& desc, RenderHandle* pSampler)
+{
+    CpuResource state;
+    state.type = CpuResourceType::Sampler;
+    state.sampler = desc;
+
+    *pSampler = AddResource(std::move(state));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::CreateQuery(QueryType type, RenderHandle* pQuery)
+{
+    CpuResource query;
+    query.type = CpuResourceType::Query;
+    query.queryType = type;
+
+    *pQuery = AddResource(std::move(query));
+    return S_OK;
+}
+
+HRESULT CpuRenderDevice::ResizeBackBuffer(UINT width, UINT height)
+{
+    CpuResource* pBackBuffer = GetResource(m_backBuffer);
+    if (!pBackBuffer || width == 0 || height == 0)
+        return E_INVALIDARG;
+
+    pBackBuffer->textureDesc.width = width;
+    pBackBuffer->textureDesc.height = height;
+    pBackBuffer->data.assign((size_t)width * height * FormatSize(pBackBuffer->textureDesc.format), 0);
+    return S_OK;
+}
+
+// The log of the immediate context only holds the frame being drawn, its
+// capacity is kept so later frames record without allocating
+void CpuRenderDevice::Present(UINT)
+{
+    m_frameCount++;
+    m_pImmediateContext->ClearCommands();
+}
+
+HRESULT CpuRenderDevice::CreateDeferredContext(RenderContext** ppContext)
+{
+    *ppContext = new CpuDeferredContext(this);
+    return S_OK;
+}
+
+CpuCommand& CpuRenderContext::Record(CpuCommandType type)
+{
+    CpuCommand command = {};
+    command.type = type;
+    m_commands.push_back(command);
+    return m_commands.back();
+}
+
+HRESULT CpuRenderContext::Map(RenderHandle buffer, MapMode mode, void** ppData)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(buffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer || pBuffer->bufferDesc.usage != ResourceUsage::Dynamic)
+        return E_INVALIDARG;
+
+    CpuCommand& command = Record(CpuCommandType::Map);
+    command.handle = buffer;
+    command.args[0] = static_cast<UINT>(mode);
+    m_stats.maps++;
+
+    *ppData = pBuffer->data.data();
+    return S_OK;
+}
+
+void CpuRenderContext::Unmap(RenderHandle)
+{
+}
+
+void CpuRenderContext::UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize)
+{
+    UpdateBufferRange(buffer, 0, pData, byteSize);
+}
+
+void CpuRenderContext::UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(buffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer || byteOffset >= pBuffer->data.size())
+        return;
+
+    CpuCommand& command = Record(CpuCommandType::UpdateBuffer);
+    command.handle = buffer;
+    command.args[0] = byteSize;
+    command.args[2] = byteOffset;
+    m_stats.bufferUpdates++;
+
+    UINT size = byteSize;
+    if (size > pBuffer->data.size() - byteOffset)
+        size = static_cast<UINT>(pBuffer->data.size() - byteOffset);
+    memcpy(pBuffer->data.data() + byteOffset, pData, size);
+}
+
+HRESULT CpuRenderContext::ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(buffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer || byteSize > pBuffer->data.size())
+        return E_INVALIDARG;
+
+    Record(CpuCommandType::ReadBuffer).handle = buffer;
+    m_stats.readbacks++;
+
+    memcpy(pData, pBuffer->data.data(), byteSize);
+    return S_OK;
+}
+
+HRESULT CpuRenderContext::TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(stagingBuffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer || byteSize > pBuffer->data.size())
+        return E_INVALIDARG;
+
+    // everything has already executed by the time the call returns
+    Record(CpuCommandType::TryReadBuffer).handle = stagingBuffer;
+
+    memcpy(pData, pBuffer->data.data(), byteSize);
+    return S_OK;
+}
+
+void CpuRenderContext::CopyResource(RenderHandle dst, RenderHandle src)
+{
+    CpuCommand& command = Record(CpuCommandType::CopyResource);
+    command.handle = dst;
+    command.handle2 = src;
+
+    CpuResource* pDst = m_pOwner->GetResource(dst);
+    CpuResource* pSrc = m_pOwner->GetResource(src);
+    if (pDst && pSrc && pDst != pSrc && pDst->data.size() == pSrc->data.size())
+    {
+        memcpy(pDst->data.data(), pSrc->data.data(), pSrc->data.size());
+    }
+}
+
+void CpuRenderContext::ClearRenderTarget(RenderHandle target, const float color[4])
+{
+    Record(CpuCommandType::ClearRenderTarget).handle = target;
+
+    CpuResource* pTarget = m_pOwner->GetResource(target);
+    if (!pTarget || pTarget->type != CpuResourceType::Texture)
+        return;
+
+    // float targets keep the color as it is, R32_FLOAT only its red
+    BYTE texel[16];
+    UINT texelSize = FormatSize(pTarget->textureDesc.format);
+    if (pTarget->textureDesc.format == Format::R32G32B32A32_FLOAT || pTarget->textureDesc.format == Format::R32_FLOAT)
+    {
+        memcpy(texel, color, texelSize);
+    }
+    else if (pTarget->textureDesc.format == Format::R16G16B16A16_UNORM)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            float c = color[i] < 0.0f ? 0.0f : (color[i] > 1.0f ? 1.0f : color[i]);
+            WORD value = static_cast<WORD>(c * 65535.0f + 0.5f);
+            memcpy(texel + i * 2, &value, sizeof(value));
+        }
+    }
+    else
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            float c = color[i] < 0.0f ? 0.0f : (color[i] > 1.0f ? 1.0f : color[i]);
+            texel[i] = static_cast<BYTE>(c * 255.0f + 0.5f);
+        }
+    }
+    for (size_t i = 0; i + texelSize <= pTarget->data.size(); i += texelSize)
+    {
+        memcpy(&pTarget->data[i], texel, texelSize);
+    }
+}
+
+void CpuRenderContext::ClearDepth(RenderHandle depth, float value)
+{
+    Record(CpuCommandType::ClearDepth).handle = depth;
+
+    CpuResource* pDepth = m_pOwner->GetResource(depth);
+    if (!pDepth || pDepth->type != CpuResourceType::Texture)
+        return;
+
+    float* pData = reinterpret_cast<float*>(pDepth->data.data());
+    size_t count = pDepth->data.size() / sizeof(float);
+    for (size_t i = 0; i < count; i++)
+    {
+        pData[i] = value;
+    }
+}
+
+void CpuRenderContext::ClearUnorderedAccess(RenderHandle resource, const UINT values[4])
+{
+    CpuCommand& command = Record(CpuCommandType::ClearUnorderedAccess);
+    command.handle = resource;
+    memcpy(command.args, values, sizeof(UINT) * 4);
+
+    CpuResource* pResource = m_pOwner->GetResource(resource);
+    if (!pResource || (pResource->type != CpuResourceType::Buffer && pResource->type != CpuResourceType::Texture))
+        return;
+
+    UINT channels = 1;
+    if (pResource->type == CpuResourceType::Texture)
+        channels = FormatSize(pResource->textureDesc.format) / sizeof(UINT);
+    if (channels == 0)
+        channels = 1;
+
+    UINT* pData = reinterpret_cast<UINT*>(pResource->data.data());
+    size_t count = pResource->data.size() / sizeof(UINT);
+    for (size_t i = 0; i < count; i++)
+    {
+        pData[i] = values[i % channels];
+    }
+}
+
+void CpuRenderContext::SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth)
+{
+    // the first target goes with the depth, the others into the arguments
+    CpuCommand& command = Record(CpuCommandType::SetRenderTargets);
+    targetCount = targetCount < MaxRenderTargets ? targetCount : MaxRenderTargets;
+    command.handle = targetCount > 0 ? targets[0] : NullHandle;
+    command.handle2 = depth;
+    command.args[0] = targetCount;
+    for (UINT i = 1; i < targetCount; i++)
+    {
+        command.args[i] = targets[i];
+    }
+
+    for (UINT i = 0; i < MaxRenderTargets; i++)
+    {
+        m_state.renderTargets[i] = i < targetCount ? targets[i] : NullHandle;
+    }
+    m_state.renderTargetCount = targetCount;
+    m_state.depth = depth;
+}
+
+void CpuRenderContext::SetViewport(const Viewport& viewport)
+{
+    Record(CpuCommandType::SetViewport);
+    m_state.viewport = viewport;
+}
+
+void CpuRenderContext::SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset)
+{
+    CpuCommand& command = Record(CpuCommandType::SetVertexBuffer);
+    command.handle = buffer;
+    command.args[0] = stride;
+    command.args[1] = offset;
+
+    m_state.vertexBuffer = buffer;
+    m_state.vertexStride = stride;
+    m_state.vertexOffset = offset;
+}
+
+void CpuRenderContext::SetIndexBuffer(RenderHandle buffer, Format format)
+{
+    Record(CpuCommandType::SetIndexBuffer).handle = buffer;
+
+    m_state.indexBuffer = buffer;
+    m_state.indexFormat = format;
+}
+
+void CpuRenderContext::SetInputLayout(RenderHandle layout)
+{
+    Record(CpuCommandType::SetInputLayout).handle = layout;
+    m_state.inputLayout = layout;
+}
+
+void CpuRenderContext::SetPrimitiveTopology(PrimitiveTopology)
+{
+    Record(CpuCommandType::SetPrimitiveTopology);
+}
+
+void CpuRenderContext::SetShader(ShaderStage stage, RenderHandle shader)
+{
+    CpuCommand& command = Record(CpuCommandType::SetShader);
+    command.stage = stage;
+    command.handle = shader;
+
+    m_state.shaders[static_cast<int>(stage)] = shader;
+}
+
+void CpuRenderContext::SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer)
+{
+    CpuCommand& command = Record(CpuCommandType::SetConstantBuffer);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = buffer;
+
+    if (slot < CpuMaxSlots)
+    {
+        m_state.constantBuffers[static_cast<int>(stage)][slot] = buffer;
+        m_state.constantOffsets[static_cast<int>(stage)][slot] = 0;
+    }
+}
+
+void CpuRenderContext::SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize)
+{
+    CpuCommand& command = Record(CpuCommandType::SetConstantBuffer);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = buffer;
+    command.args[0] = byteOffset;
+    command.args[1] = byteSize;
+
+    if (slot < CpuMaxSlots)
+    {
+        m_state.constantBuffers[static_cast<int>(stage)][slot] = buffer;
+        m_state.constantOffsets[static_cast<int>(stage)][slot] = byteOffset;
+    }
+}
+
+void CpuRenderContext::SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetShaderResource);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = resource;
+
+    if (slot < CpuMaxSlots)
+        m_state.resources[static_cast<int>(stage)][slot] = resource;
+}
+
+void CpuRenderContext::SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler)
+{
+    CpuCommand& command = Record(CpuCommandType::SetSampler);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = sampler;
+
+    if (slot < CpuMaxSlots)
+        m_state.samplers[static_cast<int>(stage)][slot] = sampler;
+}
+
+void CpuRenderContext::SetUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetUnorderedAccess);
+    command.slot = slot;
+    command.handle = resource;
+
+    if (slot < CpuMaxSlots)
+        m_state.uavs[slot] = resource;
+}
+
+void CpuRenderContext::SetPixelUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetPixelUnorderedAccess);
+    command.slot = slot;
+    command.handle = resource;
+
+    if (slot < CpuMaxSlots)
+        m_state.pixelUavs[slot] = resource;
+}
+
+bool CpuRenderContext::SetState(CpuCommandType type, RenderHandle& current, RenderHandle state)
+{
+    if (current == state)
+    {
+        m_stats.elidedStateChanges++;
+        return false;
+    }
+
+    Record(type).handle = state;
+    current = state;
+    m_stats.stateChanges++;
+    return true;
+}
+
+void CpuRenderContext::SetRasterizerState(RenderHandle state)
+{
+    SetState(CpuCommandType::SetRasterizerState, m_state.rasterizerState, state);
+}
+
+void CpuRenderContext::SetDepthStencilState(RenderHandle state)
+{
+    SetState(CpuCommandType::SetDepthStencilState, m_state.depthStencilState, state);
+}
+
+void CpuRenderContext::SetBlendState(RenderHandle state)
+{
+    SetState(CpuCommandType::SetBlendState, m_state.blendState, state);
+}
+
+void CpuRenderContext::BindResources(ShaderStage stage, CpuShaderBindings& bindings)
+{
+    const int index = static_cast<int>(stage);
+    bindings = {};
+    for (UINT slot = 0; slot < CpuMaxSlots; slot++)
+    {
+        CpuResource* pConstants = m_pOwner->GetResource(m_state.constantBuffers[index][slot]);
+        UINT constantOffset = m_state.constantOffsets[index][slot];
+        if (pConstants && constantOffset < pConstants->data.size())
+            bindings.constantBuffers[slot] = pConstants->data.data() + constantOffset;
+
+        CpuResource* pResource = m_pOwner->GetResource(m_state.resources[index][slot]);
+        if (pResource)
+        {
+            bindings.resources[slot] = pResource->data.data();
+            bindings.resourceSizes[slot] = static_cast<UINT>(pResource->data.size());
+
+            if (pResource->type == CpuResourceType::Texture && !pResource->data.empty() &&
+                pResource->textureDesc.format == Format::R8G8B8A8_UNORM)
+            {
+                CpuTextureView& view = bindings.textures[slot];
+                view.texels = pResource->data.data();
+                view.width = pResource->textureDesc.width;
+                view.height = pResource->textureDesc.height;
+                view.arraySize = pResource->arraySize;
+            }
+        }
+
+        if (stage != ShaderStage::Vertex)
+        {
+            CpuResource* pUAV = m_pOwner->GetResource(stage == ShaderStage::Compute ? m_state.uavs[slot] : m_state.pixelUavs[slot]);
+            if (pUAV)
+            {
+                bindings.uavs[slot] = pUAV->data.data();
+                bindings.uavSizes[slot] = static_cast<UINT>(pUAV->data.size());
+            }
+        }
+    }
+}
+
+void CpuRenderContext::ExecuteDraw(bool indexed, UINT count, UINT instanceCount, UINT start, int baseVertex, UINT startInstance)
+{
+    m_stats.drawCalls++;
+    m_stats.instances += instanceCount;
+    m_stats.triangles += (UINT64)(count / 3) * instanceCount;
+
+    CpuResource* pVertexShader = m_pOwner->GetResource(m_state.shaders[static_cast<int>(ShaderStage::Vertex)]);
+    CpuResource* pPixelShader = m_pOwner->GetResource(m_state.shaders[static_cast<int>(ShaderStage::Pixel)]);
+    CpuResource* pVertices = m_pOwner->GetResource(m_state.vertexBuffer);
+    CpuResource* pDepth = m_pOwner->GetResource(m_state.depth);
+    if (!pVertexShader || !pVertices || m_state.vertexStride == 0)
+        return;
+    // without a pixel shader only depth is written, like D3D11
+    if (!pPixelShader && m_state.renderTargetCount > 0)
+        return;
+
+    // every target has the size of the first one, or of the depth buffer
+    // when the pixel shader only writes UAVs
+    CpuResource* pTargets[MaxRenderTargets] = {};
+    for (UINT i = 0; i < m_state.renderTargetCount; i++)
+    {
+        pTargets[i] = m_pOwner->GetResource(m_state.renderTargets[i]);
+        if (!pTargets[i])
+            return;
+
+        Format format = pTargets[i]->textureDesc.format;
+        if (format != Format::R8G8B8A8_UNORM && format != Format::R16G16B16A16_UNORM && format != Format::R32G32B32A32_FLOAT &&
+            format != Format::R32_FLOAT)
+            return;
+        if (i > 0 && (pTargets[i]->textureDesc.width != pTargets[0]->textureDesc.width ||
+            pTargets[i]->textureDesc.height != pTargets[0]->textureDesc.height))
+            return;
+    }
+    const CpuResource* pSize = m_state.renderTargetCount > 0 ? pTargets[0] : pDepth;
+    if (!pSize)
+        return;
+
+    RasterDrawCall draw;
+    draw.pVertexShader = pVertexShader->pProgram;
+    draw.pPixelShader = pPixelShader ? pPixelShader->pProgram : nullptr;
+    BindResources(ShaderStage::Vertex, draw.vertexBindings);
+    BindResources(ShaderStage::Pixel, draw.pixelBindings);
+
+    if (m_state.vertexOffset >= pVertices->data.size())
+        return;
+    draw.vertices = pVertices->data.data() + m_state.vertexOffset;
+    draw.vertexStride = m_state.vertexStride;
+    draw.vertexCount = static_cast<UINT>((pVertices->data.size() - m_state.vertexOffset) / m_state.vertexStride);
+
+    if (indexed)
+    {
+        CpuResource* pIndices = m_pOwner->GetResource(m_state.indexBuffer);
+        UINT indexSize = m_state.indexFormat == Format::R32_UINT ? 4 : 2;
+        if (!pIndices || (size_t)(start + count) * indexSize > pIndices->data.size())
+            return;
+
+        draw.indices = pIndices->data.data();
+        draw.indexFormat = m_state.indexFormat;
+    }
+    draw.count = count;
+    draw.start = start;
+    draw.baseVertex = baseVertex;
+    draw.instanceCount = instanceCount;
+    draw.startInstance = startInstance;
+
+    for (UINT i = 0; i < m_state.renderTargetCount; i++)
+    {
+        draw.colorTargets[i].data = pTargets[i]->data.data();
+        draw.colorTargets[i].format = pTargets[i]->textureDesc.format;
+    }
+    draw.colorTargetCount = m_state.renderTargetCount;
+    draw.targetWidth = pSize->textureDesc.width;
+    draw.targetHeight = pSize->textureDesc.height;
+
+    if (pDepth && pDepth->textureDesc.format == Format::D32_FLOAT &&
+        pDepth->textureDesc.width == draw.targetWidth && pDepth->textureDesc.height == draw.targetHeight)
+    {
+        draw.depthTarget = reinterpret_cast<float*>(pDepth->data.data());
+    }
+
+    draw.viewport = m_state.viewport;
+
+    // unbound states fall back to the D3D11 defaults
+    CpuResource* pRasterizer = m_pOwner->GetResource(m_state.rasterizerState);
+    if (pRasterizer)
+        draw.rasterizer = pRasterizer->rasterizer;
+    CpuResource* pDepthStencil = m_pOwner->GetResource(m_state.depthStencilState);
+    if (pDepthStencil)
+        draw.depthStencil = pDepthStencil->depthStencil;
+    CpuResource* pBlend = m_pOwner->GetResource(m_state.blendState);
+    if (pBlend)
+        draw.blend = pBlend->blend;
+
+    m_rasterizer.Draw(draw);
+}
+
+void CpuRenderContext::Draw(UINT vertexCount, UINT startVertex)
+{
+    CpuCommand& command = Record(CpuCommandType::Draw);
+    command.args[0] = vertexCount;
+    command.args[1] = startVertex;
+
+    ExecuteDraw(false, vertexCount, 1, startVertex, 0, 0);
+}
+
+void CpuRenderContext::DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex)
+{
+    CpuCommand& command = Record(CpuCommandType::DrawIndexed);
+    command.args[0] = indexCount;
+    command.args[1] = startIndex;
+    command.args[2] = static_cast<UINT>(baseVertex);
+
+    ExecuteDraw(true, indexCount, 1, startIndex, baseVertex, 0);
+}
+
+void CpuRenderContext::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance)
+{
+    CpuCommand& command = Record(CpuCommandType::DrawIndexedInstanced);
+    command.args[0] = indexCount;
+    command.args[1] = instanceCount;
+    command.args[2] = startIndex;
+    command.args[3] = static_cast<UINT>(baseVertex);
+    command.args[4] = startInstance;
+
+    ExecuteDraw(true, indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+void CpuRenderContext::DrawIndexedInstancedIndirect(RenderHandle args, UINT offset)
+{
+    CpuResource* pArgs = m_pOwner->GetResource(args);
+    if (!pArgs || offset + sizeof(UINT) * 5 > pArgs->data.size())
+        return;
+
+    // same layout as D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS
+    UINT drawArgs[5];
+    memcpy(drawArgs, pArgs->data.data() + offset, sizeof(drawArgs));
+
+    CpuCommand& command = Record(CpuCommandType::DrawIndexedInstancedIndirect);
+    command.handle = args;
+    memcpy(command.args, drawArgs, sizeof(drawArgs));
+
+    ExecuteDraw(true, drawArgs[0], drawArgs[1], drawArgs[2], static_cast<int>(drawArgs[3]), drawArgs[4]);
+}
+
+void CpuRenderContext::Dispatch(UINT x, UINT y, UINT z)
+{
+    CpuCommand& command = Record(CpuCommandType::Dispatch);
+    command.args[0] = x;
+    command.args[1] = y;
+    command.args[2] = z;
+    m_stats.dispatches++;
+
+    const int cs = static_cast<int>(ShaderStage::Compute);
+    CpuResource* pShader = m_pOwner->GetResource(m_state.shaders[cs]);
+    if (!pShader || !pShader->pProgram || !pShader->pProgram->compute)
+        return;
+
+    CpuShaderBindings bindings;
+    BindResources(ShaderStage::Compute, bindings);
+
+    const CpuComputeKernel kernel = pShader->pProgram->compute;
+    if (pShader->pProgram->parallelGroups && x * y * z > 1)
+    {
+        m_rasterizer.GetThreadPool().ParallelFor(x * y * z, [&](UINT group, UINT)
+        {
+            kernel(bindings, group % x, group / x % y, group / (x * y));
+        });
+        return;
+    }
+
+    for (UINT gz = 0; gz < z; gz++)
+    {
+        for (UINT gy = 0; gy < y; gy++)
+        {
+            for (UINT gx = 0; gx < x; gx++)
+            {
+                kernel(bindings, gx, gy, gz);
+            }
+        }
+    }
+}
+
+void CpuRenderContext::ClearState()
+{
+    if (!m_commands.empty())
+        Record(CpuCommandType::ClearState);
+
+    m_state = PipelineState();
+    m_state.indexFormat = Format::R16_UINT;
+}
+
+void CpuRenderContext::BeginQuery(RenderHandle query)
+{
+    Record(CpuCommandType::BeginQuery).handle = query;
+}
+
+// Commands execute as they are recorded, so the GPU clock is the CPU's
+void CpuRenderContext::EndQuery(RenderHandle query)
+{
+    Record(CpuCommandType::EndQuery).handle = query;
+
+    CpuResource* pQuery = m_pOwner->GetResource(query);
+    if (!pQuery || pQuery->type != CpuResourceType::Query)
+        return;
+
+    if (pQuery->queryType == QueryType::TimestampDisjoint)
+        pQuery->queryData = 1000000000;
+    else
+        pQuery->queryData = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+HRESULT CpuRenderContext::TryGetQueryData(RenderHandle query, UINT64* pData)
+{
+    CpuResource* pQuery = m_pOwner->GetResource(query);
+    if (!pQuery || pQuery->type != CpuResourceType::Query)
+        return E_INVALIDARG;
+
+    *pData = pQuery->queryData;
+    return S_OK;
+}
+
+void CpuRenderContext::ExecuteMap(RenderHandle buffer, MapMode mode, std::vector<BYTE>& data)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(buffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer)
+        return;
+
+    CpuCommand& command = Record(CpuCommandType::Map);
+    command.handle = buffer;
+    command.args[0] = static_cast<UINT>(mode);
+    m_stats.maps++;
+
+    // WRITE_DISCARD gives the buffer new memory, the memory the list wrote
+    // can simply become the buffer; the old one is reused by the next list
+    if (data.size() == pBuffer->data.size())
+        pBuffer->data.swap(data);
+    else
+        memcpy(pBuffer->data.data(), data.data(), std::min(data.size(), pBuffer->data.size()));
+}
+
+void CpuRenderContext::ExecuteCommandList(RenderContext* pDeferred)
+{
+    CpuDeferredContext* pList = static_cast<CpuDeferredContext*>(pDeferred);
+    if (!pList->m_finished)
+        return;
+
+    const BYTE* payload = pList->m_payload.data();
+    for (const CpuCommand& command : pList->m_commands)
+    {
+        const UINT* args = command.args;
+        switch (command.type)
+        {
+        case CpuCommandType::Map:
+            ExecuteMap(command.handle, static_cast<MapMode>(args[0]), pList->m_mapBuffers[args[1]]);
+            break;
+        case CpuCommandType::UpdateBuffer:
+            UpdateBufferRange(command.handle, args[2], payload + args[1], args[0]);
+            break;
+        case CpuCommandType::CopyResource:
+            CopyResource(command.handle, command.handle2);
+            break;
+        case CpuCommandType::ClearRenderTarget:
+        {
+            float color[4];
+            memcpy(color, args, sizeof(color));
+            ClearRenderTarget(command.handle, color);
+            break;
+        }
+        case CpuCommandType::ClearDepth:
+        {
+            float value;
+            memcpy(&value, args, sizeof(value));
+            ClearDepth(command.handle, value);
+            break;
+        }
+        case CpuCommandType::ClearUnorderedAccess:
+            ClearUnorderedAccess(command.handle, args);
+            break;
+        case CpuCommandType::SetRenderTargets:
+        {
+            RenderHandle targets[MaxRenderTargets] = { command.handle, args[1], args[2], args[3] };
+            SetRenderTargets(targets, args[0], command.handle2);
+            break;
+        }
+        case CpuCommandType::SetViewport:
+        {
+            Viewport viewport;
+            memcpy(&viewport, payload + args[0], sizeof(viewport));
+            SetViewport(viewport);
+            break;
+        }
+        case CpuCommandType::SetVertexBuffer:
+            SetVertexBuffer(command.handle, args[0], args[1]);
+            break;
+        case CpuCommandType::SetIndexBuffer:
+            SetIndexBuffer(command.handle, static_cast<Format>(args[0]));
+            break;
+        case CpuCommandType::SetInputLayout:
+            SetInputLayout(command.handle);
+            break;
+        case CpuCommandType::SetPrimitiveTopology:
+            SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+            break;
+        case CpuCommandType::SetShader:
+            SetShader(command.stage, command.handle);
+            break;
+        case CpuCommandType::SetConstantBuffer:
+            // whole buffers are recorded without a size
+            if (args[1] != 0)
+                SetConstantBufferRange(command.stage, command.slot, command.handle, args[0], args[1]);
+            else
+                SetConstantBuffer(command.stage, command.slot, command.handle);
+            break;
+        case CpuCommandType::SetShaderResource:
+            SetShaderResource(command.stage, command.slot, command.handle);
+            break;
+        case CpuCommandType::SetSampler:
+            SetSampler(command.stage, command.slot, command.handle);
+            break;
+        case CpuCommandType::SetUnorderedAccess:
+            SetUnorderedAccess(command.slot, command.handle);
+            break;
+        case CpuCommandType::SetPixelUnorderedAccess:
+            SetPixelUnorderedAccess(command.slot, command.handle);
+            break;
+        case CpuCommandType::SetRasterizerState:
+            SetRasterizerState(command.handle);
+            break;
+        case CpuCommandType::SetDepthStencilState:
+            SetDepthStencilState(command.handle);
+            break;
+        case CpuCommandType::SetBlendState:
+            SetBlendState(command.handle);
+            break;
+        case CpuCommandType::Draw:
+            Draw(args[0], args[1]);
+            break;
+        case CpuCommandType::DrawIndexed:
+            DrawIndexed(args[0], args[1], static_cast<int>(args[2]));
+            break;
+        case CpuCommandType::DrawIndexedInstanced:
+            DrawIndexedInstanced(args[0], args[1], args[2], static_cast<int>(args[3]), args[4]);
+            break;
+        case CpuCommandType::DrawIndexedInstancedIndirect:
+            DrawIndexedInstancedIndirect(command.handle, args[0]);
+            break;
+        case CpuCommandType::Dispatch:
+            Dispatch(args[0], args[1], args[2]);
+            break;
+        case CpuCommandType::ClearState:
+            ClearState();
+            break;
+        case CpuCommandType::BeginQuery:
+            BeginQuery(command.handle);
+            break;
+        case CpuCommandType::EndQuery:
+            EndQuery(command.handle);
+            break;
+        default:
+            break;
+        }
+    }
+
+    ClearState();
+    pList->ResetList();
+}
+
+CpuCommand& CpuDeferredContext::Record(CpuCommandType type)
+{
+    // recording again drops a list that was never executed
+    if (m_finished)
+        ResetList();
+
+    CpuCommand command = {};
+    command.type = type;
+    m_commands.push_back(command);
+    return m_commands.back();
+}
+
+UINT CpuDeferredContext::AddPayload(const void* pData, UINT byteSize)
+{
+    UINT offset = static_cast<UINT>(m_payload.size());
+    const BYTE* pBytes = static_cast<const BYTE*>(pData);
+    m_payload.insert(m_payload.end(), pBytes, pBytes + byteSize);
+    return offset;
+}
+
+void CpuDeferredContext::ResetList()
+{
+    m_commands.clear();
+    m_payload.clear();
+    m_mapCount = 0;
+    m_finished = false;
+}
+
+HRESULT CpuDeferredContext::FinishCommandList()
+{
+    if (m_finished)
+        ResetList();
+    m_finished = true;
+    return S_OK;
+}
+
+HRESULT CpuDeferredContext::Map(RenderHandle buffer, MapMode mode, void** ppData)
+{
+    CpuResource* pBuffer = m_pOwner->GetResource(buffer);
+    if (!pBuffer || pBuffer->type != CpuResourceType::Buffer || pBuffer->bufferDesc.usage != ResourceUsage::Dynamic ||
+        mode != MapMode::WriteDiscard)
+    {
+        return E_INVALIDARG;
+    }
+
+    CpuCommand& command = Record(CpuCommandType::Map);
+    command.handle = buffer;
+    command.args[0] = static_cast<UINT>(mode);
+    command.args[1] = m_mapCount;
+
+    // every Map of the list writes its own memory, kept from earlier lists
+    if (m_mapCount == m_mapBuffers.size())
+        m_mapBuffers.emplace_back();
+    std::vector<BYTE>& data = m_mapBuffers[m_mapCount++];
+    data.resize(pBuffer->data.size());
+
+    *ppData = data.data();
+    return S_OK;
+}
+
+void CpuDeferredContext::Unmap(RenderHandle)
+{
+}
+
+void CpuDeferredContext::UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize)
+{
+    UpdateBufferRange(buffer, 0, pData, byteSize);
+}
+
+void CpuDeferredContext::UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize)
+{
+    CpuCommand& command = Record(CpuCommandType::UpdateBuffer);
+    command.handle = buffer;
+    command.args[0] = byteSize;
+    command.args[1] = AddPayload(pData, byteSize);
+    command.args[2] = byteOffset;
+}
+
+HRESULT CpuDeferredContext::ReadBuffer(RenderHandle, void*, UINT)
+{
+    return E_NOTIMPL;
+}
+
+HRESULT CpuDeferredContext::TryReadBuffer(RenderHandle, void*, UINT)
+{
+    return E_NOTIMPL;
+}
+
+void CpuDeferredContext::CopyResource(RenderHandle dst, RenderHandle src)
+{
+    CpuCommand& command = Record(CpuCommandType::CopyResource);
+    command.handle = dst;
+    command.handle2 = src;
+}
+
+void CpuDeferredContext::ClearRenderTarget(RenderHandle target, const float color[4])
+{
+    CpuCommand& command = Record(CpuCommandType::ClearRenderTarget);
+    command.handle = target;
+    memcpy(command.args, color, sizeof(float) * 4);
+}
+
+void CpuDeferredContext::ClearDepth(RenderHandle depth, float value)
+{
+    CpuCommand& command = Record(CpuCommandType::ClearDepth);
+    command.handle = depth;
+    memcpy(command.args, &value, sizeof(value));
+}
+
+void CpuDeferredContext::ClearUnorderedAccess(RenderHandle resource, const UINT values[4])
+{
+    CpuCommand& command = Record(CpuCommandType::ClearUnorderedAccess);
+    command.handle = resource;
+    memcpy(command.args, values, sizeof(UINT) * 4);
+}
+
+void CpuDeferredContext::SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth)
+{
+    CpuCommand& command = Record(CpuCommandType::SetRenderTargets);
+    targetCount = targetCount < MaxRenderTargets ? targetCount : MaxRenderTargets;
+    command.handle = targetCount > 0 ? targets[0] : NullHandle;
+    command.handle2 = depth;
+    command.args[0] = targetCount;
+    for (UINT i = 1; i < targetCount; i++)
+    {
+        command.args[i] = targets[i];
+    }
+}
+
+void CpuDeferredContext::SetViewport(const Viewport& viewport)
+{
+    UINT offset = AddPayload(&viewport, sizeof(viewport));
+    Record(CpuCommandType::SetViewport).args[0] = offset;
+}
+
+void CpuDeferredContext::SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset)
+{
+    CpuCommand& command = Record(CpuCommandType::SetVertexBuffer);
+    command.handle = buffer;
+    command.args[0] = stride;
+    command.args[1] = offset;
+}
+
+void CpuDeferredContext::SetIndexBuffer(RenderHandle buffer, Format format)
+{
+    CpuCommand& command = Record(CpuCommandType::SetIndexBuffer);
+    command.handle = buffer;
+    command.args[0] = static_cast<UINT>(format);
+}
+
+void CpuDeferredContext::SetInputLayout(RenderHandle layout)
+{
+    Record(CpuCommandType::SetInputLayout).handle = layout;
+}
+
+void CpuDeferredContext::SetPrimitiveTopology(PrimitiveTopology)
+{
+    Record(CpuCommandType::SetPrimitiveTopology);
+}
+
+void CpuDeferredContext::SetShader(ShaderStage stage, RenderHandle shader)
+{
+    CpuCommand& command = Record(CpuCommandType::SetShader);
+    command.stage = stage;
+    command.handle = shader;
+}
+
+void CpuDeferredContext::SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer)
+{
+    CpuCommand& command = Record(CpuCommandType::SetConstantBuffer);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = buffer;
+}
+
+void CpuDeferredContext::SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize)
+{
+    CpuCommand& command = Record(CpuCommandType::SetConstantBuffer);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = buffer;
+    command.args[0] = byteOffset;
+    command.args[1] = byteSize;
+}
+
+void CpuDeferredContext::SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetShaderResource);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = resource;
+}
+
+void CpuDeferredContext::SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler)
+{
+    CpuCommand& command = Record(CpuCommandType::SetSampler);
+    command.stage = stage;
+    command.slot = slot;
+    command.handle = sampler;
+}
+
+void CpuDeferredContext::SetUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetUnorderedAccess);
+    command.slot = slot;
+    command.handle = resource;
+}
+
+void CpuDeferredContext::SetPixelUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    CpuCommand& command = Record(CpuCommandType::SetPixelUnorderedAccess);
+    command.slot = slot;
+    command.handle = resource;
+}
+
+void CpuDeferredContext::SetRasterizerState(RenderHandle state)
+{
+    Record(CpuCommandType::SetRasterizerState).handle = state;
+}
+
+void CpuDeferredContext::SetDepthStencilState(RenderHandle state)
+{
+    Record(CpuCommandType::SetDepthStencilState).handle = state;
+}
+
+void CpuDeferredContext::SetBlendState(RenderHandle state)
+{
+    Record(CpuCommandType::SetBlendState).handle = state;
+}
+
+void CpuDeferredContext::Draw(UINT vertexCount, UINT startVertex)
+{
+    CpuCommand& command = Record(CpuCommandType::Draw);
+    command.args[0] = vertexCount;
+    command.args[1] = startVertex;
+}
+
+void CpuDeferredContext::DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex)
+{
+    CpuCommand& command = Record(CpuCommandType::DrawIndexed);
+    command.args[0] = indexCount;
+    command.args[1] = startIndex;
+    command.args[2] = static_cast<UINT>(baseVertex);
+}
+
+void CpuDeferredContext::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance)
+{
+    CpuCommand& command = Record(CpuCommandType::DrawIndexedInstanced);
+    command.args[0] = indexCount;
+    command.args[1] = instanceCount;
+    command.args[2] = startIndex;
+    command.args[3] = static_cast<UINT>(baseVertex);
+    command.args[4] = startInstance;
+}
+
+void CpuDeferredContext::DrawIndexedInstancedIndirect(RenderHandle args, UINT offset)
+{
+    // the arguments are read when the list executes, after the dispatches before it
+    CpuCommand& command = Record(CpuCommandType::DrawIndexedInstancedIndirect);
+    command.handle = args;
+    command.args[0] = offset;
+}
+
+void CpuDeferredContext::Dispatch(UINT x, UINT y, UINT z)
+{
+    CpuCommand& command = Record(CpuCommandType::Dispatch);
+    command.args[0] = x;
+    command.args[1] = y;
+    command.args[2] = z;
+}
+
+void CpuDeferredContext::ClearState()
+{
+    Record(CpuCommandType::ClearState);
+}
+
+void CpuDeferredContext::BeginQuery(RenderHandle query)
+{
+    Record(CpuCommandType::BeginQuery).handle = query;
+}
+
+void CpuDeferredContext::EndQuery(RenderHandle query)
+{
+    Record(CpuCommandType::EndQuery).handle = query;
+}
+
+HRESULT CpuDeferredContext::TryGetQueryData(RenderHandle, UINT64*)
+{
+    return E_NOTIMPL;
+}
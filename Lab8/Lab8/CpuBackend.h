@@ -0,0 +1,335 @@
+#ifndef CPU_BACKEND_H
+#define CPU_BACKEND_H
+
+#include <vector>
+
+#include "RenderBackend.h"
+#include "CpuShaders.h"
+#include "SoftwareRasterizer.h"
+
+// Headless implementation of RenderDevice/RenderContext. Buffers live in
+// system memory, compute dispatches run the C++ kernels from CpuShaders,
+// draws go through the SoftwareRasterizer and every command of a frame is
+// recorded so tests and benchmarks can inspect what RenderClass submitted.
+
+enum class CpuCommandType
+{
+    Map,
+    UpdateBuffer,
+    ReadBuffer,
+    TryReadBuffer,
+    CopyResource,
+    ClearRenderTarget,
+    ClearDepth,
+    ClearUnorderedAccess,
+    SetRenderTargets,
+    SetViewport,
+    SetVertexBuffer,
+    SetIndexBuffer,
+    SetInputLayout,
+    SetPrimitiveTopology,
+    SetShader,
+    SetConstantBuffer,
+    SetShaderResource,
+    SetSampler,
+    SetUnorderedAccess,
+    SetPixelUnorderedAccess,
+    SetRasterizerState,
+    SetDepthStencilState,
+    SetBlendState,
+    Draw,
+    DrawIndexed,
+    DrawIndexedInstanced,
+    DrawIndexedInstancedIndirect,
+    Dispatch,
+    ClearState,
+    BeginQuery,
+    EndQuery
+};
+
+struct CpuCommand
+{
+    CpuCommandType type;
+    ShaderStage stage;
+    UINT slot;
+    RenderHandle handle;
+    RenderHandle handle2;
+    UINT args[5];
+};
+
+enum class CpuResourceType
+{
+    Free,
+    Buffer,
+    Texture,
+    Shader,
+    InputLayout,
+    RasterizerState,
+    DepthStencilState,
+    BlendState,
+    Sampler,
+    Query
+};
+
+struct CpuResource
+{
+    CpuResourceType type = CpuResourceType::Free;
+
+    BufferDesc bufferDesc;
+    TextureDesc textureDesc;
+    UINT arraySize = 1;
+    UINT mipLevels = 1;
+    std::vector<BYTE> data;
+
+    const CpuShaderProgram* pProgram = nullptr;
+    std::vector<InputElement> layout;
+
+    RasterizerDesc rasterizer;
+    DepthStencilDesc depthStencil;
+    BlendDesc blend;
+    SamplerDesc sampler;
+
+    QueryType queryType = QueryType::Timestamp;
+    UINT64 queryData = 0;       // nanoseconds of the steady clock, or their frequency
+};
+
+class CpuRenderDevice;
+
+// Records commands into a list without touching any resource. The list is
+// replayed through the immediate context by ExecuteCommandList, which
+// counts the commands in its stats as it executes them.
+class CpuDeferredContext : public RenderContext
+{
+public:
+    explicit CpuDeferredContext(CpuRenderDevice* pOwner) :
+        m_pOwner(pOwner),
+        m_mapCount(0),
+        m_finished(false)
+    {}
+
+    using RenderContext::Map;
+    HRESULT Map(RenderHandle buffer, MapMode mode, void** ppData) override;
+    void Unmap(RenderHandle buffer) override;
+    void UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize) override;
+    void UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize) override;
+    HRESULT ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize) override;
+    HRESULT TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize) override;
+    void CopyResource(RenderHandle dst, RenderHandle src) override;
+
+    void ClearRenderTarget(RenderHandle target, const float color[4]) override;
+    void ClearDepth(RenderHandle depth, float value) override;
+    void ClearUnorderedAccess(RenderHandle resource, const UINT values[4]) override;
+    using RenderContext::SetRenderTargets;
+    void SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth) override;
+    void SetViewport(const Viewport& viewport) override;
+
+    void SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset) override;
+    void SetIndexBuffer(RenderHandle buffer, Format format) override;
+    void SetInputLayout(RenderHandle layout) override;
+    void SetPrimitiveTopology(PrimitiveTopology topology) override;
+
+    void SetShader(ShaderStage stage, RenderHandle shader) override;
+    void SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer) override;
+    void SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize) override;
+    void SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource) override;
+    void SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler) override;
+    void SetUnorderedAccess(UINT slot, RenderHandle resource) override;
+    void SetPixelUnorderedAccess(UINT slot, RenderHandle resource) override;
+
+    void SetRasterizerState(RenderHandle state) override;
+    void SetDepthStencilState(RenderHandle state) override;
+    void SetBlendState(RenderHandle state) override;
+
+    void Draw(UINT vertexCount, UINT startVertex) override;
+    void DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex) override;
+    void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance) override;
+    void DrawIndexedInstancedIndirect(RenderHandle args, UINT offset) override;
+    void Dispatch(UINT x, UINT y, UINT z) override;
+
+    void ClearState() override;
+
+    void BeginQuery(RenderHandle query) override;
+    void EndQuery(RenderHandle query) override;
+    HRESULT TryGetQueryData(RenderHandle query, UINT64* pData) override;
+
+    HRESULT FinishCommandList() override;
+    void ExecuteCommandList(RenderContext*) override {}
+
+    // Commands of the list being recorded, or of the finished one
+    const std::vector<CpuCommand>& GetCommands() const { return m_commands; }
+
+private:
+    friend class CpuRenderContext;
+
+    CpuCommand& Record(CpuCommandType type);
+    UINT AddPayload(const void* pData, UINT byteSize);
+    void ResetList();
+
+    CpuRenderDevice* m_pOwner;
+    std::vector<CpuCommand> m_commands;
+    std::vector<BYTE> m_payload;                    // buffer updates and viewports
+    std::vector<std::vector<BYTE>> m_mapBuffers;    // written through Map, one per Map of the list
+    UINT m_mapCount;
+    bool m_finished;
+};
+
+class CpuRenderContext : public RenderContext
+{
+public:
+    CpuRenderContext(CpuRenderDevice* pOwner, UINT threadCount) :
+        m_pOwner(pOwner),
+        m_rasterizer(threadCount)
+    {
+        ClearState();
+    }
+
+    using RenderContext::Map;
+    HRESULT Map(RenderHandle buffer, MapMode mode, void** ppData) override;
+    void Unmap(RenderHandle buffer) override;
+    void UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize) override;
+    void UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize) override;
+    HRESULT ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize) override;
+    HRESULT TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize) override;
+    void CopyResource(RenderHandle dst, RenderHandle src) override;
+
+    void ClearRenderTarget(RenderHandle target, const float color[4]) override;
+    void ClearDepth(RenderHandle depth, float value) override;
+    void ClearUnorderedAccess(RenderHandle resource, const UINT values[4]) override;
+    using RenderContext::SetRenderTargets;
+    void SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth) override;
+    void SetViewport(const Viewport& viewport) override;
+
+    void SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset) override;
+    void SetIndexBuffer(RenderHandle buffer, Format format) override;
+    void SetInputLayout(RenderHandle layout) override;
+    void SetPrimitiveTopology(PrimitiveTopology topology) override;
+
+    void SetShader(ShaderStage stage, RenderHandle shader) override;
+    void SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer) override;
+    void SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize) override;
+    void SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource) override;
+    void SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler) override;
+    void SetUnorderedAccess(UINT slot, RenderHandle resource) override;
+    void SetPixelUnorderedAccess(UINT slot, RenderHandle resource) override;
+
+    void SetRasterizerState(RenderHandle state) override;
+    void SetDepthStencilState(RenderHandle state) override;
+    void SetBlendState(RenderHandle state) override;
+
+    void Draw(UINT vertexCount, UINT startVertex) override;
+    void DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex) override;
+    void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance) override;
+    void DrawIndexedInstancedIndirect(RenderHandle args, UINT offset) override;
+    void Dispatch(UINT x, UINT y, UINT z) override;
+
+    void ClearState() override;
+
+    void BeginQuery(RenderHandle query) override;
+    void EndQuery(RenderHandle query) override;
+    HRESULT TryGetQueryData(RenderHandle query, UINT64* pData) override;
+
+    HRESULT FinishCommandList() override { return E_NOTIMPL; }
+    // Replays the list through this context, then goes back to the default state
+    void ExecuteCommandList(RenderContext* pDeferred) override;
+
+    // Commands recorded since the last Present or ClearCommands()
+    const std::vector<CpuCommand>& GetCommands() const { return m_commands; }
+    void ClearCommands() { m_commands.clear(); }
+
+    SoftwareRasterizer& GetRasterizer() { return m_rasterizer; }
+
+private:
+    struct PipelineState
+    {
+        RenderHandle renderTargets[MaxRenderTargets];
+        UINT renderTargetCount;
+        RenderHandle depth;
+        Viewport viewport;
+
+        RenderHandle vertexBuffer;
+        UINT vertexStride;
+        UINT vertexOffset;
+        RenderHandle indexBuffer;
+        Format indexFormat;
+        RenderHandle inputLayout;
+
+        RenderHandle shaders[3];
+        RenderHandle constantBuffers[3][CpuMaxSlots];
+        UINT constantOffsets[3][CpuMaxSlots];
+        RenderHandle resources[3][CpuMaxSlots];
+        RenderHandle samplers[3][CpuMaxSlots];
+        RenderHandle uavs[CpuMaxSlots];
+        RenderHandle pixelUavs[CpuMaxSlots];
+
+        RenderHandle rasterizerState;
+        RenderHandle depthStencilState;
+        RenderHandle blendState;
+    };
+
+    CpuCommand& Record(CpuCommandType type);
+    // Records and binds the state unless it is already bound
+    bool SetState(CpuCommandType type, RenderHandle& current, RenderHandle state);
+    void ExecuteMap(RenderHandle buffer, MapMode mode, std::vector<BYTE>& data);
+    void ExecuteDraw(bool indexed, UINT count, UINT instanceCount, UINT start, int baseVertex, UINT startInstance);
+    void BindResources(ShaderStage stage, CpuShaderBindings& bindings);
+
+    CpuRenderDevice* m_pOwner;
+    SoftwareRasterizer m_rasterizer;
+    PipelineState m_state;
+    std::vector<CpuCommand> m_commands;
+};
+
+class CpuRenderDevice : public RenderDevice
+{
+public:
+    // threadCount is the number of rasterizer threads, 0 uses every hardware thread
+    CpuRenderDevice(UINT width, UINT height, UINT threadCount = 0);
+    ~CpuRenderDevice();
+
+    HRESULT CreateBuffer(const BufferDesc& desc, const void* pInitData, RenderHandle* pBuffer) override;
+    HRESULT CreateTexture(const TextureDesc& desc, const SubresourceData* pInitData, RenderHandle* pTexture) override;
+    HRESULT CreateTextureFromFile(const std::wstring& path, RenderHandle* pTexture) override;
+    HRESULT CreateTextureArrayFromFiles(const std::wstring* paths, UINT count, RenderHandle* pTexture) override;
+    HRESULT CreateTextureFromMemory(const BYTE* pData, size_t byteSize, RenderHandle* pTexture) override;
+    HRESULT CreateTextureArrayFromMemory(const BYTE* const* ppData, const size_t* byteSizes, UINT count, RenderHandle* pTexture) override;
+
+    using RenderDevice::CreateShader;
+    HRESULT CreateShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount, RenderHandle* pShader) override;
+    HRESULT CreateInputLayout(const InputElement* elements, UINT count, RenderHandle vertexShader, RenderHandle* pLayout) override;
+
+    HRESULT CreateRasterizerState(const RasterizerDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateBlendState(const BlendDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateSamplerState(const SamplerDesc& desc, RenderHandle* pSampler) override;
+    HRESULT CreateQuery(QueryType type, RenderHandle* pQuery) override;
+
+    void Release(RenderHandle handle) override;
+    void ReplaceResource(RenderHandle target, RenderHandle source) override;
+
+    RenderContext* GetImmediateContext() override { return m_pImmediateContext; }
+    HRESULT CreateDeferredContext(RenderContext** ppContext) override;
+
+    RenderHandle GetBackBuffer() override { return m_backBuffer; }
+    HRESULT ResizeBackBuffer(UINT width, UINT height) override;
+    void Present(UINT syncInterval) override;
+
+    CpuResource* GetResource(RenderHandle handle);
+    CpuRenderContext* GetCpuContext() const { return m_pImmediateContext; }
+
+    UINT GetFrameCount() const { return m_frameCount; }
+    // Buffers, textures, shaders and states that have not been released
+    UINT GetLiveResourceCount() const;
+
+private:
+    RenderHandle AddResource(CpuResource&& resource);
+    HRESULT LoadDDS(const BYTE* pData, size_t byteSize, CpuResource& texture);
+
+    CpuRenderContext* m_pImmediateContext;
+    RenderHandle m_backBuffer;
+    UINT m_frameCount;
+
+    std::vector<CpuResource> m_resources;
+    std::vector<RenderHandle> m_freeHandles;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "CpuFeatures.h"
+
+#ifdef CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef CPU_X86
+
+static void CpuId(int info[4], int leaf, int subleaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// XCR0, which register states the OS saves on a context switch
+static UINT64 ReadXcr0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    UINT eax = 0;
+    UINT edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<UINT64>(edx) << 32) | eax;
+#endif
+}
+
+static CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features = {};
+
+    int info[4] = {};
+    CpuId(info, 0, 0);
+    int maxLeaf = info[0];
+
+    CpuId(info, 1, 0);
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (!osxsave || !avx || maxLeaf < 7)
+        return features;
+
+    UINT64 xcr0 = ReadXcr0();
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xE6) == 0xE6;
+
+    CpuId(info, 7, 0);
+    features.avx2 = ymmState && (info[1] & (1 << 5)) != 0;
+    features.avx512 = zmmState && (info[1] & (1 << 16)) != 0;
+
+    return features;
+}
+
+#else
+
+static CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features = {};
+    return features;
+}
+
+#endif
+
+const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
@@ -0,0 +1,28 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+#include "Platform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#endif
+
+// Lets a single function use a wider instruction set than the rest of the
+// file. MSVC accepts the intrinsics anywhere, GCC and clang need the attribute.
+#if defined(CPU_X86) && !defined(_MSC_VER)
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CPU_TARGET(isa)
+#endif
+
+// Instruction sets that are both supported by the processor and enabled by the OS
+struct CpuFeatures
+{
+    bool sse41;
+    bool avx2;
+    bool avx512;    // AVX-512 F
+};
+
+const CpuFeatures& GetCpuFeatures();
+
+#endif
@@ -0,0 +1,1388 @@
+#include "CpuShaders.h"
+#include "LightClusters.h"
+#include "OcclusionCulling.h"
+#include "PostProcess.h"
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    // HLSL reads the transposed matrices RenderClass uploads as column_major,
+    // so mul(v, m) is a dot product of v with every stored row
+    void MulRowVector(const float* v, const float* m, float* out)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            out[j] = v[0] * m[j * 4] + v[1] * m[j * 4 + 1] + v[2] * m[j * 4 + 2] + v[3] * m[j * 4 + 3];
+        }
+    }
+
+    void MulRowVector3x3(const float* v, const float* m, float* out)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            out[j] = v[0] * m[j * 4] + v[1] * m[j * 4 + 1] + v[2] * m[j * 4 + 2];
+        }
+    }
+
+    float Dot3(const float* a, const float* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    void Cross3(const float* a, const float* b, float* out)
+    {
+        out[0] = a[1] * b[2] - a[2] * b[1];
+        out[1] = a[2] * b[0] - a[0] * b[2];
+        out[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    void Normalize3(float* v)
+    {
+        float length = sqrtf(Dot3(v, v));
+        if (length > 0.0f)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+    }
+
+    float Saturate(float x)
+    {
+        return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+    }
+
+    // PointLight of LightClusters.hlsli, in cbuffer LightBuffer : register(b2)
+    // or StructuredBuffer<PointLight> : register(t2)
+    struct CpuPointLight
+    {
+        float position[3];
+        float range;
+        float color[3];
+        float intensity;
+    };
+
+    // cbuffer ClusterConstants : register(b3)
+    struct CpuClusterConstants
+    {
+        float viewProj[16];
+        float view[16];
+        UINT grid[3];
+        UINT lightCount;
+        float tileScale[2];
+        float sliceScale;
+        float sliceBias;
+    };
+
+    float ClampCell(float x, UINT count)
+    {
+        return fminf(fmaxf(x, 0.0f), count - 1.0f);
+    }
+
+    // GetClusterIndex of LightClusters.hlsli
+    UINT GetClusterIndex(const CpuClusterConstants& constants, const float* worldPos)
+    {
+        float pos[4] = { worldPos[0], worldPos[1], worldPos[2], 1.0f };
+        float clip[4];
+        MulRowVector(pos, constants.viewProj, clip);
+        UINT x = static_cast<UINT>(ClampCell((clip[0] / clip[3] + 1.0f) * constants.tileScale[0], constants.grid[0]));
+        UINT y = static_cast<UINT>(ClampCell((1.0f - clip[1] / clip[3]) * constants.tileScale[1], constants.grid[1]));
+        UINT z = static_cast<UINT>(ClampCell(logf(clip[3]) * constants.sliceScale + constants.sliceBias, constants.grid[2]));
+        return (z * constants.grid[1] + y) * constants.grid[0] + x;
+    }
+
+    // The lights a pixel shades: the first LightCount of the light buffer,
+    // or with CLUSTERED the list of the pixel's cluster
+    struct CpuLightList
+    {
+        const CpuPointLight* lights;
+        UINT lightCapacity;
+        const UINT* indices;        // nullptr for lights 0 to count - 1
+        UINT count;
+
+        UINT GetIndex(UINT i) const
+        {
+            return indices ? indices[i] : i;
+        }
+
+        const CpuPointLight* Get(UINT i) const
+        {
+            UINT index = GetIndex(i);
+            return index < lightCapacity ? &lights[index] : nullptr;
+        }
+    };
+
+    template <UINT LightCount, UINT Clustered>
+    CpuLightList GetPixelLights(const CpuShaderBindings& bindings, const float* worldPos)
+    {
+        CpuLightList list = {};
+        if (!Clustered)
+        {
+            list.lights = reinterpret_cast<const CpuPointLight*>(bindings.constantBuffers[2]);
+            list.lightCapacity = LightCount;
+            list.count = list.lights ? LightCount : 0;
+            return list;
+        }
+
+        const CpuClusterConstants* constants = reinterpret_cast<const CpuClusterConstants*>(bindings.constantBuffers[3]);
+        const UINT* ranges = reinterpret_cast<const UINT*>(bindings.resources[3]);
+        const UINT* indices = reinterpret_cast<const UINT*>(bindings.resources[4]);
+        if (!constants || !bindings.resources[2] || !ranges || !indices)
+            return list;
+
+        UINT cluster = GetClusterIndex(*constants, worldPos);
+        if ((cluster + 1) * 2 * sizeof(UINT) > bindings.resourceSizes[3])
+            return list;
+        UINT offset = ranges[cluster * 2];
+        UINT count = ranges[cluster * 2 + 1];
+        if ((UINT64)offset + count > bindings.resourceSizes[4] / sizeof(UINT))
+            return list;
+
+        list.lights = reinterpret_cast<const CpuPointLight*>(bindings.resources[2]);
+        list.lightCapacity = bindings.resourceSizes[2] / sizeof(CpuPointLight);
+        list.indices = indices + offset;
+        list.count = count;
+        return list;
+    }
+
+    // ShadowConstants of Shadows.hlsli (register b4)
+    struct CpuShadowSlot
+    {
+        float position[3];
+        UINT lightIndex;
+        float depthScale;
+        float depthOffset;
+        float origin[2];
+    };
+
+    struct CpuShadowConstants
+    {
+        UINT slotCount;
+        UINT faceSize;
+        UINT atlasWidth;
+        float normalOffset;
+        float depthBias;
+        UINT padding[3];
+        CpuShadowSlot slots[MaxShadowSlots];
+    };
+
+    // SampleShadow of Shadows.hlsli, the D32_FLOAT atlases at t5 and t6
+    float SampleShadow(const CpuShaderBindings& bindings, const CpuShadowConstants& constants, const CpuShadowSlot& slot,
+        const float* worldPos, const float* normal)
+    {
+        const float* staticAtlas = reinterpret_cast<const float*>(bindings.resources[5]);
+        const float* dynamicAtlas = reinterpret_cast<const float*>(bindings.resources[6]);
+        UINT staticCount = bindings.resourceSizes[5] / sizeof(float);
+        UINT dynamicCount = bindings.resourceSizes[6] / sizeof(float);
+        if (!staticAtlas || !dynamicAtlas || constants.faceSize == 0)
+            return 1.0f;
+
+        float d[3];
+        float a[3];
+        for (int c = 0; c < 3; c++)
+        {
+            d[c] = worldPos[c] - slot.position[c];
+            a[c] = fabsf(d[c]);
+        }
+        float major = fmaxf(a[0], fmaxf(a[1], a[2]));
+
+        float offset = constants.normalOffset * 2.0f * major / constants.faceSize;
+        for (int c = 0; c < 3; c++)
+        {
+            d[c] += normal[c] * offset;
+            a[c] = fabsf(d[c]);
+        }
+
+        UINT face;
+        float u;
+        float v;
+        if (a[0] >= a[1] && a[0] >= a[2])
+        {
+            major = a[0];
+            face = d[0] > 0.0f ? 0 : 1;
+            u = d[0] > 0.0f ? -d[2] : d[2];
+            v = -d[1];
+        }
+        else if (a[1] >= a[2])
+        {
+            major = a[1];
+            face = d[1] > 0.0f ? 2 : 3;
+            u = d[0];
+            v = d[1] > 0.0f ? d[2] : -d[2];
+        }
+        else
+        {
+            major = a[2];
+            face = d[2] > 0.0f ? 4 : 5;
+            u = d[2] > 0.0f ? d[0] : -d[0];
+            v = -d[1];
+        }
+        major = fmaxf(major, 1e-4f);
+
+        float tx = (u / major * 0.5f + 0.5f) * constants.faceSize - 0.5f;
+        float ty = (v / major * 0.5f + 0.5f) * constants.faceSize - 0.5f;
+        float baseX = floorf(tx);
+        float baseY = floorf(ty);
+        float fx = tx - baseX;
+        float fy = ty - baseY;
+        float cornerX = slot.origin[0] + (face % 3) * constants.faceSize;
+        float cornerY = slot.origin[1] + (face / 3) * constants.faceSize;
+        float limit = constants.faceSize - 1.0f;
+
+        float lit[4];
+        for (UINT i = 0; i < 4; i++)
+        {
+            UINT x = static_cast<UINT>(cornerX + fminf(fmaxf(baseX + i % 2, 0.0f), limit));
+            UINT y = static_cast<UINT>(cornerY + fminf(fmaxf(baseY + i / 2, 0.0f), limit));
+            UINT texel = y * constants.atlasWidth + x;
+            if (texel >= staticCount || texel >= dynamicCount)
+                return 1.0f;
+
+            float depth = fminf(staticAtlas[texel], dynamicAtlas[texel]);
+            float distance = slot.depthOffset / (depth - slot.depthScale);
+            lit[i] = major <= distance * (1.0f + constants.depthBias) ? 1.0f : 0.0f;
+        }
+        float top = lit[0] + (lit[1] - lit[0]) * fx;
+        float bottom = lit[2] + (lit[3] - lit[2]) * fx;
+        return top + (bottom - top) * fy;
+    }
+
+    // GetShadow of Shadows.hlsli
+    float GetShadow(const CpuShaderBindings& bindings, UINT lightIndex, const float* worldPos, const float* normal)
+    {
+        const CpuShadowConstants* constants = reinterpret_cast<const CpuShadowConstants*>(bindings.constantBuffers[4]);
+        if (!constants)
+            return 1.0f;
+
+        UINT slotCount = std::min(constants->slotCount, MaxShadowSlots);
+        for (UINT s = 0; s < slotCount; s++)
+        {
+            if (constants->slots[s].lightIndex == lightIndex)
+                return SampleShadow(bindings, *constants, constants->slots[s], worldPos, normal);
+        }
+        return 1.0f;
+    }
+
+    // ColorVertex.vs, varyings: WorldPos, Normal, TexCoord, Tangent, Bitangent, CameraPos, TexInd.
+    // Without NORMAL_MAP there is no Tangent and Bitangent.
+    template <UINT NormalMap>
+    constexpr UINT ColorVaryingCount() { return NormalMap ? 18 : 12; }
+
+    template <UINT NormalMap, UINT ConstantInstances>
+    void ColorVertexKernel(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT instanceId, float* out)
+    {
+        const float* input = reinterpret_cast<const float*>(pVertex);
+        const BYTE* pInstance = ConstantInstances ? bindings.constantBuffers[2] : bindings.resources[0];
+        const float* camera = reinterpret_cast<const float*>(bindings.constantBuffers[1]);
+
+        // InstanceData, 80 bytes each: model, texInd, extent. The constant
+        // buffer holds as many as the draw has instances.
+        if (!pInstance || !camera || (!ConstantInstances && (instanceId + 1) * 80 > bindings.resourceSizes[0]))
+        {
+            memset(out, 0, sizeof(float) * 4);
+            return;
+        }
+
+        pInstance += instanceId * 80;
+        const float* model = reinterpret_cast<const float*>(pInstance);
+        UINT texInd;
+        memcpy(&texInd, pInstance + 64, sizeof(UINT));
+
+        float pos[4] = { input[0], input[1], input[2], 1.0f };
+        const float* normal = input + 3;
+        float worldPos[4];
+        MulRowVector(pos, model, worldPos);
+        MulRowVector(worldPos, camera, out);
+
+        float* varyings = out + 4;
+        memcpy(varyings, worldPos, sizeof(float) * 3);
+        MulRowVector3x3(normal, model, varyings + 3);
+        varyings[6] = input[6];
+        varyings[7] = input[7];
+
+        const UINT cameraPos = ColorVaryingCount<NormalMap>() - 4;
+        memcpy(varyings + cameraPos, camera + 16, sizeof(float) * 3);
+        varyings[cameraPos + 3] = static_cast<float>(texInd);
+        if (!NormalMap)
+            return;
+
+        float tangent[3] = { 1.0f, 0.0f, 0.0f };
+        if (fabsf(normal[2]) <= 0.999f)
+        {
+            const float forward[3] = { 0.0f, 0.0f, 1.0f };
+            Cross3(normal, forward, tangent);
+            Normalize3(tangent);
+        }
+        float bitangent[3];
+        Cross3(normal, tangent, bitangent);
+        MulRowVector3x3(tangent, model, varyings + 8);
+        MulRowVector3x3(bitangent, model, varyings + 11);
+    }
+
+    // The normal ColorPixel.ps and GBufferPixel.ps shade with, from the
+    // varyings of ColorVertex.vs and the normal map
+    template <UINT NormalMap>
+    void GetShadingNormal(const CpuShaderBindings& bindings, const float* varyings, float n[3])
+    {
+        n[0] = varyings[3];
+        n[1] = varyings[4];
+        n[2] = varyings[5];
+        if (NormalMap)
+        {
+            float tangent[3] = { varyings[8], varyings[9], varyings[10] };
+            float bitangent[3] = { varyings[11], varyings[12], varyings[13] };
+            Normalize3(tangent);
+            Normalize3(bitangent);
+
+            float mapped[4];
+            SampleTexture2D(bindings.textures[1], varyings[6], varyings[7], 0, mapped);
+            float normalFromMap[3] = { mapped[0] * 2.0f - 1.0f, mapped[1] * 2.0f - 1.0f, mapped[2] * 2.0f - 1.0f };
+            Normalize3(normalFromMap);
+            for (int i = 0; i < 3; i++)
+            {
+                n[i] = normalFromMap[0] * tangent[i] + normalFromMap[1] * bitangent[i] + normalFromMap[2] * varyings[3 + i];
+            }
+        }
+        Normalize3(n);
+    }
+
+    // The diffuse and specular of one light, as ColorPixel.ps and
+    // DeferredLighting.cs add them up
+    template <UINT Shadows>
+    void AddLight(const CpuShaderBindings& bindings, const CpuPointLight& light, UINT lightIndex, const float* worldPos,
+        const float* n, const float* surfaceNormal, const float* viewDir, float lightColor[3])
+    {
+        float lightDir[3] = { light.position[0] - worldPos[0], light.position[1] - worldPos[1], light.position[2] - worldPos[2] };
+        float distance = sqrtf(Dot3(lightDir, lightDir));
+        Normalize3(lightDir);
+        float attenuation = 1.0f - Saturate(distance / light.range);
+        if (Shadows && attenuation > 0.0f)
+            attenuation *= GetShadow(bindings, lightIndex, worldPos, surfaceNormal);
+        float diff = fmaxf(Dot3(n, lightDir), 0.0f);
+
+        float halfway[3] = { lightDir[0] + viewDir[0], lightDir[1] + viewDir[1], lightDir[2] + viewDir[2] };
+        Normalize3(halfway);
+        float spec = powf(fmaxf(Dot3(n, halfway), 0.0f), 32.0f);
+
+        for (int c = 0; c < 3; c++)
+        {
+            lightColor[c] += light.color[c] * (diff + spec) * light.intensity * attenuation;
+        }
+    }
+
+    // ColorPixel.ps with CLUSTERED, LIGHT_COUNT, NORMAL_MAP and SHADOWS
+    template <UINT Clustered, UINT LightCount, UINT NormalMap, UINT Shadows>
+    void ColorPixelKernel(const CpuShaderBindings& bindings, const float* varyings, float color[4])
+    {
+        const float* worldPos = varyings;
+        const CpuLightList lights = GetPixelLights<LightCount, Clustered>(bindings, worldPos);
+
+        const float* cameraPos = varyings + ColorVaryingCount<NormalMap>() - 4;
+        float n[3];
+        GetShadingNormal<NormalMap>(bindings, varyings, n);
+        float surfaceNormal[3] = { varyings[3], varyings[4], varyings[5] };
+        if (Shadows)
+            Normalize3(surfaceNormal);
+
+        float viewDir[3] = { cameraPos[0] - worldPos[0], cameraPos[1] - worldPos[1], cameraPos[2] - worldPos[2] };
+        Normalize3(viewDir);
+
+        float lightColor[3] = { 0.0f, 0.0f, 0.0f };
+        for (UINT i = 0; i < lights.count; i++)
+        {
+            const CpuPointLight* light = lights.Get(i);
+            if (light)
+                AddLight<Shadows>(bindings, *light, lights.GetIndex(i), worldPos, n, surfaceNormal, viewDir, lightColor);
+        }
+
+        float diffuse[4];
+        SampleTexture2D(bindings.textures[0], varyings[6], varyings[7], static_cast<UINT>(cameraPos[3] + 0.5f), diffuse);
+        for (int c = 0; c < 3; c++)
+        {
+            color[c] = diffuse[c] * lightColor[c];
+        }
+        color[3] = 1.0f;
+    }
+
+    // EncodeNormal of GBuffer.hlsli
+    void EncodeNormal(const float* n, float* e)
+    {
+        float sum = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+        float x = sum > 0.0f ? n[0] / sum : 0.0f;
+        float y = sum > 0.0f ? n[1] / sum : 0.0f;
+        if (n[2] < 0.0f)
+        {
+            float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+            float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+            x = foldedX;
+            y = foldedY;
+        }
+        e[0] = x * 0.5f + 0.5f;
+        e[1] = y * 0.5f + 0.5f;
+    }
+
+    // DecodeNormal of GBuffer.hlsli
+    void DecodeNormal(float ex, float ey, float* n)
+    {
+        n[0] = ex * 2.0f - 1.0f;
+        n[1] = ey * 2.0f - 1.0f;
+        n[2] = 1.0f - fabsf(n[0]) - fabsf(n[1]);
+        float t = Saturate(-n[2]);
+        n[0] += n[0] >= 0.0f ? -t : t;
+        n[1] += n[1] >= 0.0f ? -t : t;
+        Normalize3(n);
+    }
+
+    // GBufferPixel.ps with NORMAL_MAP: the albedo target, then the normals
+    template <UINT NormalMap>
+    void GBufferPixelKernel(const CpuShaderBindings& bindings, const float* varyings, float* color)
+    {
+        const float texInd = varyings[ColorVaryingCount<NormalMap>() - 1];
+        float n[3];
+        GetShadingNormal<NormalMap>(bindings, varyings, n);
+        float surfaceNormal[3] = { varyings[3], varyings[4], varyings[5] };
+        Normalize3(surfaceNormal);
+
+        SampleTexture2D(bindings.textures[0], varyings[6], varyings[7], static_cast<UINT>(texInd + 0.5f), color);
+        color[3] = texInd / 255.0f;
+        EncodeNormal(n, color + 4);
+        EncodeNormal(surfaceNormal, color + 6);
+    }
+
+    // LightVertex.vs, no varyings: LightPixel.ps only outputs the constant color
+    void LightVertexKernel(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT, float* out)
+    {
+        const float* input = reinterpret_cast<const float*>(pVertex);
+        const float* object = reinterpret_cast<const float*>(bindings.constantBuffers[0]);
+        const float* camera = reinterpret_cast<const float*>(bindings.constantBuffers[1]);
+        if (!object || !camera)
+        {
+            memset(out, 0, sizeof(float) * 4);
+            return;
+        }
+
+        // cbuffer LightObjectBuffer: color, model
+        const float* model = object + 4;
+        float pos[4] = { input[0], input[1], input[2], 1.0f };
+        float worldPos[4];
+        MulRowVector(pos, model, worldPos);
+        MulRowVector(worldPos, camera, out);
+    }
+
+    // LightPixel.ps
+    void LightPixelKernel(const CpuShaderBindings& bindings, const float*, float color[4])
+    {
+        const float* constantColor = reinterpret_cast<const float*>(bindings.constantBuffers[0]);
+        for (int c = 0; c < 4; c++)
+        {
+            color[c] = constantColor ? constantColor[c] : 0.0f;
+        }
+    }
+
+    // SkyboxVertex.vs, varyings: direction
+    void SkyboxVertexKernel(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT, float* out)
+    {
+        const float* input = reinterpret_cast<const float*>(pVertex);
+        const float* vp = reinterpret_cast<const float*>(bindings.constantBuffers[0]);
+        float pos[4] = { input[0], input[1], input[2], 1.0f };
+        if (vp)
+            MulRowVector(pos, vp, out);
+        else
+            memset(out, 0, sizeof(float) * 4);
+
+        // output.pos.xyww keeps the sky on the far plane
+        out[2] = out[3];
+        memcpy(out + 4, input, sizeof(float) * 3);
+    }
+
+    // SkyboxPixel.ps
+    void SkyboxPixelKernel(const CpuShaderBindings& bindings, const float* varyings, float color[4])
+    {
+        SampleTextureCube(bindings.textures[0], varyings, color);
+    }
+
+    // ParallelogramVertex.vs, varyings: WorldPos, Color
+    const UINT ParallelogramVaryingCount = 7;
+
+    void ParallelogramVertexKernel(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT instanceId, float* out)
+    {
+        // StructuredBuffer<TranslucentQuad>, 80 bytes each: model, color;
+        // StructuredBuffer<uint> quadOrder
+        const float* input = reinterpret_cast<const float*>(pVertex);
+        const UINT* order = reinterpret_cast<const UINT*>(bindings.resources[1]);
+        const float* vp = reinterpret_cast<const float*>(bindings.constantBuffers[1]);
+        if (!bindings.resources[0] || !order || !vp || (instanceId + 1) * sizeof(UINT) > bindings.resourceSizes[1] ||
+            (order[instanceId] + 1) * 80 > bindings.resourceSizes[0])
+        {
+            memset(out, 0, sizeof(float) * 4);
+            return;
+        }
+
+        const float* quad = reinterpret_cast<const float*>(bindings.resources[0] + order[instanceId] * 80);
+        float pos[4] = { input[0], input[1], input[2], 1.0f };
+        float worldPos[4];
+        MulRowVector(pos, quad, worldPos);
+        MulRowVector(worldPos, vp, out);
+        memcpy(out + 4, worldPos, sizeof(float) * 3);
+        memcpy(out + 7, quad + 16, sizeof(float) * 4);
+    }
+
+    // Transparency.hlsli
+    struct CpuOitConstants
+    {
+        UINT width;
+        UINT nodeCapacity;
+        UINT padding[2];
+    };
+
+    struct CpuOitNode
+    {
+        float depth;
+        UINT next;
+        UINT color[2];
+    };
+
+    const UINT OitMaxFragments = 32;
+
+    float OitWeight(float viewDepth)
+    {
+        float nearTerm = viewDepth / 5.0f;
+        float farTerm = viewDepth / 200.0f;
+        float far3 = farTerm * farTerm * farTerm;
+        float weight = 10.0f / (1e-5f + nearTerm * nearTerm + far3 * far3);
+        return weight < 1e-2f ? 1e-2f : (weight > 3e3f ? 3e3f : weight);
+    }
+
+    // f32tof16 and f16tof32, denormals flush to zero
+    UINT FloatToHalf(float value)
+    {
+        UINT bits;
+        memcpy(&bits, &value, sizeof(bits));
+        UINT sign = (bits >> 16) & 0x8000;
+        int exponent = static_cast<int>((bits >> 23) & 0xFF) - 127 + 15;
+        UINT mantissa = bits & 0x7FFFFF;
+        if (exponent <= 0)
+            return sign;
+        if (exponent >= 31)
+            return sign | 0x7C00;
+
+        UINT half = sign | (exponent << 10) | (mantissa >> 13);
+        // round to nearest even, a carry into the exponent is still right
+        UINT rest = mantissa & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+            half++;
+        return half;
+    }
+
+    float HalfToFloat(UINT half)
+    {
+        UINT sign = (half & 0x8000) << 16;
+        UINT exponent = (half >> 10) & 0x1F;
+        UINT mantissa = half & 0x3FF;
+        UINT bits = sign;
+        if (exponent == 31)
+            bits |= 0x7F800000 | (mantissa << 13);
+        else if (exponent != 0)
+            bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // ParallelogramPixel.ps with CLUSTERED, LIGHT_COUNT and OIT
+    template <UINT Clustered, UINT LightCount, UINT Oit>
+    void ParallelogramPixelKernel(const CpuShaderBindings& bindings, const float* varyings, float* color)
+    {
+        const float* quadColor = varyings + 3;
+        const float* position = varyings + ParallelogramVaryingCount;
+
+        float shaded[4] = {};
+        const CpuLightList lights = GetPixelLights<LightCount, Clustered>(bindings, varyings);
+        for (UINT i = 0; i < lights.count; i++)
+        {
+            const CpuPointLight* light = lights.Get(i);
+            if (!light)
+                continue;
+
+            float lightDir[3] = { light->position[0] - varyings[0], light->position[1] - varyings[1], light->position[2] - varyings[2] };
+            float distance = sqrtf(Dot3(lightDir, lightDir));
+            float attenuation = 1.0f - Saturate(distance / light->range);
+            for (int c = 0; c < 3; c++)
+            {
+                shaded[c] += quadColor[c] * light->color[c] * light->intensity * attenuation;
+            }
+        }
+        shaded[3] = quadColor[3];
+
+        if (Oit == 0)
+        {
+            memcpy(color, shaded, sizeof(shaded));
+        }
+        else if (Oit == 1)
+        {
+            float weight = shaded[3] * OitWeight(position[3]);
+            for (int c = 0; c < 3; c++)
+            {
+                color[c] = shaded[c] * weight;
+            }
+            color[3] = shaded[3];
+            color[4] = weight;
+        }
+        else
+        {
+            // nothing to write to but the lists; the depth test ran before the kernel
+            const CpuOitConstants* constants = reinterpret_cast<const CpuOitConstants*>(bindings.constantBuffers[0]);
+            UINT* counter = reinterpret_cast<UINT*>(bindings.uavs[1]);
+            UINT* heads = reinterpret_cast<UINT*>(bindings.uavs[2]);
+            CpuOitNode* nodes = reinterpret_cast<CpuOitNode*>(bindings.uavs[3]);
+            if (!constants || !counter || !heads || !nodes)
+                return;
+
+            // the tiles of a draw are shaded on several threads, but a pixel only ever on one
+            static_assert(sizeof(std::atomic<UINT>) == sizeof(UINT), "the counter is a plain UINT of the buffer");
+            UINT node = reinterpret_cast<std::atomic<UINT>*>(counter)->fetch_add(1, std::memory_order_relaxed);
+            UINT pixel = static_cast<UINT>(position[1]) * constants->width + static_cast<UINT>(position[0]);
+            if (node >= constants->nodeCapacity || (node + 1) * sizeof(CpuOitNode) > bindings.uavSizes[3] ||
+                (pixel + 1) * sizeof(UINT) > bindings.uavSizes[2])
+                return;
+
+            CpuOitNode& fragment = nodes[node];
+            fragment.depth = position[2];
+            fragment.next = heads[pixel];
+            fragment.color[0] = FloatToHalf(shaded[0]) | (FloatToHalf(shaded[1]) << 16);
+            fragment.color[1] = FloatToHalf(shaded[2]) | (FloatToHalf(shaded[3]) << 16);
+            heads[pixel] = node + 1;
+        }
+    }
+
+    // OitResolve.ps with OIT, after NegativeVertex.vs: TexCoord, then the position
+    template <UINT Oit>
+    void OitResolveKernel(const CpuShaderBindings& bindings, const float* varyings, float* color)
+    {
+        // the scene stays as it is unless there are fragments
+        color[0] = color[1] = color[2] = 0.0f;
+        color[3] = 1.0f;
+
+        const CpuOitConstants* constants = reinterpret_cast<const CpuOitConstants*>(bindings.constantBuffers[0]);
+        if (!constants || !bindings.resources[0] || !bindings.resources[1])
+            return;
+        UINT pixel = static_cast<UINT>(varyings[3]) * constants->width + static_cast<UINT>(varyings[2]);
+
+        if (Oit == 1)
+        {
+            if ((pixel + 1) * sizeof(float) * 4 > bindings.resourceSizes[0] || (pixel + 1) * sizeof(float) > bindings.resourceSizes[1])
+                return;
+
+            const float* accum = reinterpret_cast<const float*>(bindings.resources[0]) + pixel * 4;
+            float weight = reinterpret_cast<const float*>(bindings.resources[1])[pixel];
+            float revealage = accum[3];
+            if (revealage >= 1.0f)
+                return;
+
+            for (int c = 0; c < 3; c++)
+            {
+                color[c] = accum[c] / (weight > 1e-5f ? weight : 1e-5f) * (1.0f - revealage);
+            }
+            color[3] = revealage;
+            return;
+        }
+
+        const UINT* heads = reinterpret_cast<const UINT*>(bindings.resources[0]);
+        const CpuOitNode* nodes = reinterpret_cast<const CpuOitNode*>(bindings.resources[1]);
+        const UINT nodeCount = bindings.resourceSizes[1] / sizeof(CpuOitNode);
+        if ((pixel + 1) * sizeof(UINT) > bindings.resourceSizes[0])
+            return;
+
+        float depths[OitMaxFragments];
+        const UINT* colors[OitMaxFragments];
+        UINT count = 0;
+        for (UINT node = heads[pixel]; node != 0 && node <= nodeCount;)
+        {
+            const CpuOitNode& fragment = nodes[node - 1];
+            node = fragment.next;
+
+            if (count == OitMaxFragments && fragment.depth >= depths[count - 1])
+                continue;
+
+            UINT i = count < OitMaxFragments ? count++ : count - 1;
+            for (; i > 0 && depths[i - 1] > fragment.depth; i--)
+            {
+                depths[i] = depths[i - 1];
+                colors[i] = colors[i - 1];
+            }
+            depths[i] = fragment.depth;
+            colors[i] = fragment.color;
+        }
+
+        float transmittance = 1.0f;
+        for (UINT i = 0; i < count; i++)
+        {
+            float fragmentColor[4] =
+            {
+                HalfToFloat(colors[i][0] & 0xFFFF), HalfToFloat(colors[i][0] >> 16),
+                HalfToFloat(colors[i][1] & 0xFFFF), HalfToFloat(colors[i][1] >> 16)
+            };
+            for (int c = 0; c < 3; c++)
+            {
+                color[c] += transmittance * fragmentColor[3] * fragmentColor[c];
+            }
+            transmittance *= 1.0f - fragmentColor[3];
+        }
+        color[3] = transmittance;
+    }
+
+    // NegativeVertex.vs, varyings: TexCoord
+    void NegativeVertexKernel(const CpuShaderBindings&, const BYTE* pVertex, UINT, float* out)
+    {
+        memcpy(out, pVertex, sizeof(float) * 6);
+    }
+
+
+    // Layout of InstanceData in ComputeShader.cs / RenderClass.h
+    struct CpuInstanceData
+    {
+        float model[16];
+        UINT texInd;
+        float extent[3];
+    };
+
+    bool IsAABBInFrustum(const float* planes, const float* center, const float* extent)
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            const float* plane = planes + i * 4;
+            float d = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+            float r = extent[0] * fabsf(plane[0]) + extent[1] * fabsf(plane[1]) + extent[2] * fabsf(plane[2]);
+
+            if (d + r < 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // ComputeShader.cs: [numthreads(64, 1, 1)]
+    void FrustumCullingKernel(const CpuShaderBindings& bindings, UINT groupX, UINT, UINT)
+    {
+        // FrustumPlanes: float4 planes[6], uint instanceCount, phase, hiZLevelCount,
+        // hiZWidth, float4x4 spin (at float 28), occlusionViewProj (44), float3
+        // occlusionExtent (60), float2 depthSize (64), uint4 hiZLevels[16] (68)
+        const float* planes = reinterpret_cast<const float*>(bindings.constantBuffers[0]);
+        const CpuInstanceData* instanceData = reinterpret_cast<const CpuInstanceData*>(bindings.resources[0]);
+        UINT* indirectArgs = reinterpret_cast<UINT*>(bindings.uavs[0]);
+        CpuInstanceData* visibleInstances = reinterpret_cast<CpuInstanceData*>(bindings.uavs[1]);
+        if (!planes || !instanceData || !indirectArgs || !visibleInstances)
+            return;
+
+        UINT constants[4];
+        memcpy(constants, planes + 24, sizeof(constants));
+        const UINT instanceCount = constants[0];
+        const UINT phase = constants[1];
+        const float* spin = planes + 28;
+
+        // without the pyramid or the flags nothing is hidden
+        const float* hiZ = reinterpret_cast<const float*>(bindings.resources[1]);
+        UINT* occludedInstances = reinterpret_cast<UINT*>(bindings.uavs[2]);
+        UINT hiZLevelCount = constants[2];
+        if (!hiZ || !occludedInstances || phase == 0)
+            hiZLevelCount = 0;
+        const HiZLevel* hiZLevels = reinterpret_cast<const HiZLevel*>(planes + 68);
+        const UINT hiZWidth = constants[3];
+        const float* occlusionViewProj = planes + 44;
+        const float* occlusionExtent = planes + 60;
+        const float* depthSize = planes + 64;
+        UINT flagCapacity = occludedInstances ? bindings.uavSizes[2] / sizeof(UINT) : 0;
+
+        UINT instanceCapacity = bindings.resourceSizes[0] / sizeof(CpuInstanceData);
+        UINT visibleCapacity = bindings.uavSizes[1] / sizeof(CpuInstanceData);
+
+        for (UINT thread = 0; thread < 64; thread++)
+        {
+            UINT id = groupX * 64 + thread;
+            if (id >= instanceCount || id >= instanceCapacity)
+                return;
+
+            // column_major float4x4, the row 3 translation is in floats 3, 7 and 11
+            const CpuInstanceData& instance = instanceData[id];
+            float pos[3] = { instance.model[3], instance.model[7], instance.model[11] };
+
+            bool draw;
+            if (phase == 2)
+            {
+                draw = id < flagCapacity && occludedInstances[id] != 0 &&
+                    !IsBoxOccluded(hiZ, hiZWidth, hiZLevels, hiZLevelCount, depthSize[0], depthSize[1], occlusionViewProj, pos, occlusionExtent);
+            }
+            else
+            {
+                draw = IsAABBInFrustum(planes, pos, instance.extent);
+                if (phase == 1 && id < flagCapacity)
+                {
+                    bool occluded = draw &&
+                        IsBoxOccluded(hiZ, hiZWidth, hiZLevels, hiZLevelCount, depthSize[0], depthSize[1], occlusionViewProj, pos, occlusionExtent);
+                    occludedInstances[id] = occluded ? 1 : 0;
+                    draw = draw && !occluded;
+                }
+            }
+
+            if (draw)
+            {
+                UINT index = indirectArgs[phase == 2 ? 6 : 1]++;
+                if (index >= visibleCapacity)
+                    continue;
+
+                // mul(spin, model) of column_major matrices
+                CpuInstanceData& visible = visibleInstances[index];
+                for (int row = 0; row < 4; row++)
+                {
+                    for (int column = 0; column < 4; column++)
+                    {
+                        const float* model = instance.model + row * 4;
+                        visible.model[row * 4 + column] = model[0] * spin[column] + model[1] * spin[4 + column] +
+                            model[2] * spin[8 + column] + model[3] * spin[12 + column];
+                    }
+                }
+                visible.texInd = instance.texInd;
+                memcpy(visible.extent, instance.extent, sizeof(visible.extent));
+            }
+        }
+    }
+
+    // HiZ.cs: [numthreads(8, 8, 1)], one texel of a pyramid level per thread
+    void HiZKernel(const CpuShaderBindings& bindings, UINT groupX, UINT groupY, UINT)
+    {
+        // HiZConstants: uint4 source, uint4 target, uint fromDepth, uint atlasWidth
+        const UINT* constants = reinterpret_cast<const UINT*>(bindings.constantBuffers[0]);
+        float* hiZ = reinterpret_cast<float*>(bindings.uavs[0]);
+        if (!constants || !hiZ)
+            return;
+
+        const UINT* source = constants;
+        const UINT* target = constants + 4;
+        const UINT fromDepth = constants[8];
+        const UINT atlasWidth = constants[9];
+
+        // the depth buffer is read whole, a level of the pyramid from its corner
+        if (bindings.uavSizes[0] < (size_t)(target[1] + target[3]) * atlasWidth * sizeof(float))
+            return;
+
+        const float* pSource = hiZ + (size_t)source[1] * atlasWidth + source[0];
+        UINT sourcePitch = atlasWidth;
+        if (fromDepth)
+        {
+            pSource = reinterpret_cast<const float*>(bindings.resources[0]);
+            sourcePitch = source[2];
+            if (!pSource || bindings.resourceSizes[0] < source[2] * source[3] * sizeof(float))
+                return;
+        }
+
+        // the group's 8x8 texels
+        UINT x = groupX * 8;
+        UINT y = groupY * 8;
+        if (x >= target[2] || y >= target[3])
+            return;
+        UINT width = std::min(8u, target[2] - x);
+        UINT height = std::min(8u, target[3] - y);
+        BuildHiZLevel(pSource + (size_t)y * 2 * sourcePitch + x * 2, sourcePitch,
+            std::min(source[2] - x * 2, 16u), std::min(source[3] - y * 2, 16u),
+            hiZ + (size_t)(target[1] + y) * atlasWidth + target[0] + x, atlasWidth, width, height);
+    }
+
+    // PostProcess.cs: [numthreads(8, 8, 1)], one 8x8 block of a stage per group
+    void PostProcessKernel(const CpuShaderBindings& bindings, UINT groupX, UINT groupY, UINT)
+    {
+        const PostProcessConstants* pConstants = reinterpret_cast<const PostProcessConstants*>(bindings.constantBuffers[0]);
+        const CpuTextureView& source = bindings.textures[0];
+        if (!pConstants || !source.texels || !bindings.uavs[0])
+            return;
+
+        // both images have the size the constants give
+        if (source.width != pConstants->width || source.height != pConstants->height ||
+            bindings.uavSizes[0] < (size_t)pConstants->width * pConstants->height * 4)
+            return;
+
+        const UINT size = PostProcessChain::ThreadGroupSize;
+        ApplyPostProcessStage(*pConstants, source.texels, bindings.uavs[0], groupX * size, groupY * size, size, size,
+            PostProcessPath::SSE);
+    }
+
+    // SphereIntersectsBounds of LightClusters.cs
+    bool SphereIntersectsBounds(const float* light, const float* boundsMin, const float* boundsMax)
+    {
+        float distanceSq = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            float d = light[i] < boundsMin[i] ? boundsMin[i] - light[i] : (light[i] > boundsMax[i] ? light[i] - boundsMax[i] : 0.0f);
+            distanceSq += d * d;
+        }
+        return distanceSq <= light[3] * light[3];
+    }
+
+    // LightClusters.cs: [numthreads(64, 1, 1)], one thread per cluster. The
+    // groups run one after another, so the overflow counter needs no atomic.
+    void LightClustersKernel(const CpuShaderBindings& bindings, UINT groupX, UINT, UINT)
+    {
+        const UINT GroupSize = 64;
+        const UINT MaxLights = LightClusters::MaxLightsPerCluster;
+
+        const CpuClusterConstants* constants = reinterpret_cast<const CpuClusterConstants*>(bindings.constantBuffers[3]);
+        const float* clusterBounds = reinterpret_cast<const float*>(bindings.resources[0]);
+        const CpuPointLight* lights = reinterpret_cast<const CpuPointLight*>(bindings.resources[2]);
+        UINT* clusterRanges = reinterpret_cast<UINT*>(bindings.uavs[0]);
+        UINT* clusterLightIndices = reinterpret_cast<UINT*>(bindings.uavs[1]);
+        UINT* clusterOverflow = bindings.uavSizes[2] >= sizeof(UINT) ? reinterpret_cast<UINT*>(bindings.uavs[2]) : nullptr;
+        if (!constants || !clusterBounds || !lights || !clusterRanges || !clusterLightIndices)
+            return;
+
+        UINT clusterCount = constants->grid[0] * constants->grid[1] * constants->grid[2];
+        clusterCount = std::min(clusterCount, bindings.resourceSizes[0] / static_cast<UINT>(sizeof(float) * 8));
+        clusterCount = std::min(clusterCount, bindings.uavSizes[0] / static_cast<UINT>(sizeof(UINT) * 2));
+        clusterCount = std::min(clusterCount, bindings.uavSizes[1] / static_cast<UINT>(sizeof(UINT) * MaxLights));
+        UINT lightCount = std::min(constants->lightCount, bindings.resourceSizes[2] / static_cast<UINT>(sizeof(CpuPointLight)));
+
+        // groupshared float4 viewLights[64], filled a batch at a time
+        float viewLights[GroupSize][4];
+        UINT counts[GroupSize] = {};
+        for (UINT first = 0; first < lightCount; first += GroupSize)
+        {
+            UINT batch = std::min(lightCount - first, GroupSize);
+            for (UINT i = 0; i < batch; i++)
+            {
+                const CpuPointLight& light = lights[first + i];
+                float pos[4] = { light.position[0], light.position[1], light.position[2], 1.0f };
+                MulRowVector(pos, constants->view, viewLights[i]);
+                viewLights[i][3] = light.range;
+            }
+
+            for (UINT thread = 0; thread < GroupSize; thread++)
+            {
+                UINT cluster = groupX * GroupSize + thread;
+                if (cluster >= clusterCount)
+                    break;
+
+                const float* boundsMin = clusterBounds + cluster * 8;
+                for (UINT i = 0; i < batch; i++)
+                {
+                    if (!SphereIntersectsBounds(viewLights[i], boundsMin, boundsMin + 4))
+                        continue;
+                    if (counts[thread] < MaxLights)
+                        clusterLightIndices[cluster * MaxLights + counts[thread]] = first + i;
+                    counts[thread]++;
+                }
+            }
+        }
+
+        for (UINT thread = 0; thread < GroupSize; thread++)
+        {
+            UINT cluster = groupX * GroupSize + thread;
+            if (cluster >= clusterCount)
+                break;
+            clusterRanges[cluster * 2] = cluster * MaxLights;
+            clusterRanges[cluster * 2 + 1] = std::min(counts[thread], MaxLights);
+            if (clusterOverflow && counts[thread] > MaxLights)
+                *clusterOverflow += counts[thread] - MaxLights;
+        }
+    }
+
+    // cbuffer DeferredConstants : register(b0) of DeferredLighting.cs
+    struct CpuDeferredConstants
+    {
+        float invViewProj[16];
+        float view[16];
+        float cameraPos[3];
+        UINT lightCount;
+        UINT screenSize[2];
+        float projScale[2];
+        float depthParams[2];
+        float padding[2];
+    };
+
+    // DeferredLighting.cs with SHADOWS: [numthreads(16, 16, 1)], one tile per group
+    template <UINT Shadows>
+    void DeferredLightingKernel(const CpuShaderBindings& bindings, UINT groupX, UINT groupY, UINT)
+    {
+        const UINT TileSize = 16;
+        const UINT BatchSize = TileSize * TileSize;
+
+        const CpuDeferredConstants* constants = reinterpret_cast<const CpuDeferredConstants*>(bindings.constantBuffers[0]);
+        const BYTE* albedo = bindings.resources[0];
+        const WORD* normals = reinterpret_cast<const WORD*>(bindings.resources[1]);
+        const CpuPointLight* lights = reinterpret_cast<const CpuPointLight*>(bindings.resources[2]);
+        const float* depth = reinterpret_cast<const float*>(bindings.resources[3]);
+        BYTE* sceneColor = bindings.uavs[0];
+        if (!constants || !albedo || !normals || !depth || !sceneColor)
+            return;
+
+        // every image has the size the constants give
+        const UINT width = constants->screenSize[0];
+        const UINT height = constants->screenSize[1];
+        const size_t pixelCount = (size_t)width * height;
+        if (bindings.resourceSizes[0] < pixelCount * 4 || bindings.resourceSizes[1] < pixelCount * 8 ||
+            bindings.resourceSizes[3] < pixelCount * sizeof(float) || bindings.uavSizes[0] < pixelCount * 4)
+            return;
+        const UINT lightCount = lights ? std::min(constants->lightCount, bindings.resourceSizes[2] / static_cast<UINT>(sizeof(CpuPointLight))) : 0;
+
+        const UINT x0 = groupX * TileSize;
+        const UINT y0 = groupY * TileSize;
+        if (x0 >= width || y0 >= height)
+            return;
+        const UINT x1 = std::min(x0 + TileSize, width);
+        const UINT y1 = std::min(y0 + TileSize, height);
+
+        // the depth range of the tile's cubes, the sky is left out
+        float minDepth = 1.0f;
+        float maxDepth = 0.0f;
+        for (UINT y = y0; y < y1; y++)
+        {
+            for (UINT x = x0; x < x1; x++)
+            {
+                float d = depth[(size_t)y * width + x];
+                if (d < 1.0f)
+                {
+                    minDepth = fminf(minDepth, d);
+                    maxDepth = fmaxf(maxDepth, d);
+                }
+            }
+        }
+        if (minDepth >= 1.0f)
+            return;
+
+        const float nearZ = constants->depthParams[1] / (minDepth - constants->depthParams[0]);
+        const float farZ = constants->depthParams[1] / (maxDepth - constants->depthParams[0]);
+        const float slopeMin[2] =
+        {
+            (static_cast<float>(x0) / width * 2.0f - 1.0f) / constants->projScale[0],
+            (1.0f - static_cast<float>(y0 + TileSize) / height * 2.0f) / constants->projScale[1]
+        };
+        const float slopeMax[2] =
+        {
+            (static_cast<float>(x0 + TileSize) / width * 2.0f - 1.0f) / constants->projScale[0],
+            (1.0f - static_cast<float>(y0) / height * 2.0f) / constants->projScale[1]
+        };
+        const float boundsMin[3] =
+        {
+            fminf(slopeMin[0] * nearZ, slopeMin[0] * farZ), fminf(slopeMin[1] * nearZ, slopeMin[1] * farZ), nearZ
+        };
+        const float boundsMax[3] =
+        {
+            fmaxf(slopeMax[0] * nearZ, slopeMax[0] * farZ), fmaxf(slopeMax[1] * nearZ, slopeMax[1] * farZ), farZ
+        };
+
+        // what a thread of the group keeps in registers over the batches
+        struct TilePixel
+        {
+            float normal[3];
+            float surfaceNormal[3];
+            float worldPos[3];
+            float viewDir[3];
+            float lightColor[3];
+        };
+        TilePixel tilePixels[BatchSize];
+        for (UINT y = y0; y < y1; y++)
+        {
+            for (UINT x = x0; x < x1; x++)
+            {
+                const size_t pixel = (size_t)y * width + x;
+                const float d = depth[pixel];
+                if (d >= 1.0f)
+                    continue;
+
+                TilePixel& p = tilePixels[(y - y0) * TileSize + (x - x0)];
+                const WORD* encoded = normals + pixel * 4;
+                DecodeNormal(encoded[0] / 65535.0f, encoded[1] / 65535.0f, p.normal);
+                if (Shadows)
+                    DecodeNormal(encoded[2] / 65535.0f, encoded[3] / 65535.0f, p.surfaceNormal);
+
+                float ndc[4] = { (x + 0.5f) / width * 2.0f - 1.0f, 1.0f - (y + 0.5f) / height * 2.0f, d, 1.0f };
+                float position[4];
+                MulRowVector(ndc, constants->invViewProj, position);
+                for (int c = 0; c < 3; c++)
+                {
+                    p.worldPos[c] = position[c] / position[3];
+                    p.viewDir[c] = constants->cameraPos[c] - p.worldPos[c];
+                    p.lightColor[c] = 0.0f;
+                }
+                Normalize3(p.viewDir);
+            }
+        }
+
+        // groupshared uint tileLights[256], in light order here
+        UINT tileLights[BatchSize];
+        for (UINT first = 0; first < lightCount; first += BatchSize)
+        {
+            UINT tileLightCount = 0;
+            for (UINT i = first; i < std::min(first + BatchSize, lightCount); i++)
+            {
+                const CpuPointLight& light = lights[i];
+                float pos[4] = { light.position[0], light.position[1], light.position[2], 1.0f };
+                float viewLight[4];
+                MulRowVector(pos, constants->view, viewLight);
+                viewLight[3] = light.range;
+                if (SphereIntersectsBounds(viewLight, boundsMin, boundsMax))
+                    tileLights[tileLightCount++] = i;
+            }
+
+            for (UINT y = y0; y < y1 && tileLightCount > 0; y++)
+            {
+                for (UINT x = x0; x < x1; x++)
+                {
+                    if (depth[(size_t)y * width + x] >= 1.0f)
+                        continue;
+
+                    // the box of the tile is far larger than a pixel, most of its
+                    // lights end short of it and would add nothing
+                    TilePixel& p = tilePixels[(y - y0) * TileSize + (x - x0)];
+                    for (UINT i = 0; i < tileLightCount; i++)
+                    {
+                        const CpuPointLight& light = lights[tileLights[i]];
+                        float toLight[3] =
+                        {
+                            light.position[0] - p.worldPos[0], light.position[1] - p.worldPos[1], light.position[2] - p.worldPos[2]
+                        };
+                        if (Dot3(toLight, toLight) >= light.range * light.range)
+                            continue;
+                        AddLight<Shadows>(bindings, light, tileLights[i], p.worldPos, p.normal, p.surfaceNormal, p.viewDir, p.lightColor);
+                    }
+                }
+            }
+        }
+
+        for (UINT y = y0; y < y1; y++)
+        {
+            for (UINT x = x0; x < x1; x++)
+            {
+                const size_t pixel = (size_t)y * width + x;
+                if (depth[pixel] >= 1.0f)
+                    continue;
+
+                // RWTexture2D<unorm float4>
+                const TilePixel& p = tilePixels[(y - y0) * TileSize + (x - x0)];
+                const BYTE* pAlbedo = albedo + pixel * 4;
+                BYTE* pTarget = sceneColor + pixel * 4;
+                for (int c = 0; c < 3; c++)
+                {
+                    pTarget[c] = static_cast<BYTE>(Saturate(pAlbedo[c] * (1.0f / 255.0f) * p.lightColor[c]) * 255.0f + 0.5f);
+                }
+                pTarget[3] = 255;
+            }
+        }
+    }
+
+    // Permuted programs list one row per variant, the first row of a name
+    // has the defaults of its HLSL file
+#define COLOR_VERTEX(normalMap, constantInstances) \
+        { L"ColorVertex.vs", ShaderStage::Vertex, ColorVaryingCount<normalMap>(), ColorVertexKernel<normalMap, constantInstances>, \
+            nullptr, nullptr, "NORMAL_MAP=" #normalMap " CONSTANT_INSTANCES=" #constantInstances, false }
+#define COLOR_PIXEL(lights, normalMap, shadows) \
+        { L"ColorPixel.ps", ShaderStage::Pixel, 0, nullptr, ColorPixelKernel<0, lights, normalMap, shadows>, nullptr, \
+            "CLUSTERED=0 LIGHT_COUNT=" #lights " NORMAL_MAP=" #normalMap " SHADOWS=" #shadows, false }
+#define COLOR_PIXEL_CLUSTERED(normalMap, shadows) \
+        { L"ColorPixel.ps", ShaderStage::Pixel, 0, nullptr, ColorPixelKernel<1, 0, normalMap, shadows>, nullptr, \
+            "CLUSTERED=1 NORMAL_MAP=" #normalMap " SHADOWS=" #shadows, false }
+#define PARALLELOGRAM_PIXEL(lights, oit) \
+        { L"ParallelogramPixel.ps", ShaderStage::Pixel, 0, nullptr, ParallelogramPixelKernel<0, lights, oit>, nullptr, \
+            "CLUSTERED=0 LIGHT_COUNT=" #lights " OIT=" #oit, false }
+#define PARALLELOGRAM_PIXEL_CLUSTERED(oit) \
+        { L"ParallelogramPixel.ps", ShaderStage::Pixel, 0, nullptr, ParallelogramPixelKernel<1, 0, oit>, nullptr, \
+            "CLUSTERED=1 OIT=" #oit, false }
+#define OIT_RESOLVE(oit) \
+        { L"OitResolve.ps", ShaderStage::Pixel, 0, nullptr, OitResolveKernel<oit>, nullptr, "OIT=" #oit, false }
+#define GBUFFER_PIXEL(normalMap) \
+        { L"GBufferPixel.ps", ShaderStage::Pixel, 0, nullptr, GBufferPixelKernel<normalMap>, nullptr, "NORMAL_MAP=" #normalMap, false }
+#define DEFERRED_LIGHTING(shadows) \
+        { L"DeferredLighting.cs", ShaderStage::Compute, 0, nullptr, nullptr, DeferredLightingKernel<shadows>, "SHADOWS=" #shadows, true }
+
+    const CpuShaderProgram g_programs[] =
+    {
+        COLOR_VERTEX(1, 0), COLOR_VERTEX(0, 0),
+        COLOR_VERTEX(1, 1), COLOR_VERTEX(0, 1),
+        COLOR_PIXEL_CLUSTERED(1, 1), COLOR_PIXEL_CLUSTERED(0, 1),
+        COLOR_PIXEL_CLUSTERED(1, 0), COLOR_PIXEL_CLUSTERED(0, 0),
+        COLOR_PIXEL(3, 1, 1), COLOR_PIXEL(2, 1, 1), COLOR_PIXEL(1, 1, 1), COLOR_PIXEL(0, 1, 1),
+        COLOR_PIXEL(3, 0, 1), COLOR_PIXEL(2, 0, 1), COLOR_PIXEL(1, 0, 1), COLOR_PIXEL(0, 0, 1),
+        COLOR_PIXEL(3, 1, 0), COLOR_PIXEL(2, 1, 0), COLOR_PIXEL(1, 1, 0), COLOR_PIXEL(0, 1, 0),
+        COLOR_PIXEL(3, 0, 0), COLOR_PIXEL(2, 0, 0), COLOR_PIXEL(1, 0, 0), COLOR_PIXEL(0, 0, 0),
+        { L"LightVertex.vs",         ShaderStage::Vertex,  0,  LightVertexKernel,         nullptr,                  nullptr,              nullptr, false },
+        { L"LightPixel.ps",          ShaderStage::Pixel,   0,  nullptr,                   LightPixelKernel,         nullptr,              nullptr, false },
+        { L"SkyboxVertex.vs",        ShaderStage::Vertex,  3,  SkyboxVertexKernel,        nullptr,                  nullptr,              nullptr, false },
+        { L"SkyboxPixel.ps",         ShaderStage::Pixel,   0,  nullptr,                   SkyboxPixelKernel,        nullptr,              nullptr, false },
+        { L"ParallelogramVertex.vs", ShaderStage::Vertex,  ParallelogramVaryingCount, ParallelogramVertexKernel, nullptr, nullptr, nullptr, false },
+        PARALLELOGRAM_PIXEL_CLUSTERED(0), PARALLELOGRAM_PIXEL_CLUSTERED(1), PARALLELOGRAM_PIXEL_CLUSTERED(2),
+        PARALLELOGRAM_PIXEL(3, 0), PARALLELOGRAM_PIXEL(2, 0), PARALLELOGRAM_PIXEL(1, 0), PARALLELOGRAM_PIXEL(0, 0),
+        PARALLELOGRAM_PIXEL(3, 1), PARALLELOGRAM_PIXEL(2, 1), PARALLELOGRAM_PIXEL(1, 1), PARALLELOGRAM_PIXEL(0, 1),
+        PARALLELOGRAM_PIXEL(3, 2), PARALLELOGRAM_PIXEL(2, 2), PARALLELOGRAM_PIXEL(1, 2), PARALLELOGRAM_PIXEL(0, 2),
+        OIT_RESOLVE(1), OIT_RESOLVE(2),
+        GBUFFER_PIXEL(1), GBUFFER_PIXEL(0),
+        DEFERRED_LIGHTING(1), DEFERRED_LIGHTING(0),
+        { L"NegativeVertex.vs",      ShaderStage::Vertex,  2,  NegativeVertexKernel,      nullptr,                  nullptr,              nullptr, false },
+        { L"ComputeShader.cs",       ShaderStage::Compute, 0,  nullptr,                   nullptr,                  FrustumCullingKernel, nullptr, false },
+        { L"LightClusters.cs",       ShaderStage::Compute, 0,  nullptr,                   nullptr,                  LightClustersKernel,  nullptr, false },
+        { L"HiZ.cs",                 ShaderStage::Compute, 0,  nullptr,                   nullptr,                  HiZKernel,            nullptr, false },
+        { L"PostProcess.cs",         ShaderStage::Compute, 0,  nullptr,                   nullptr,                  PostProcessKernel,    nullptr, false },
+    };
+
+#undef COLOR_VERTEX
+#undef COLOR_PIXEL
+#undef COLOR_PIXEL_CLUSTERED
+#undef PARALLELOGRAM_PIXEL
+#undef PARALLELOGRAM_PIXEL_CLUSTERED
+#undef OIT_RESOLVE
+#undef GBUFFER_PIXEL
+#undef DEFERRED_LIGHTING
+
+    // Every NAME=VALUE of the row's list must be among the defines, with the
+    // same value; a define that is not given matches any value
+    bool MatchesDefines(const char* variant, const ShaderDefine* defines, UINT defineCount)
+    {
+        for (const char* p = variant; p && *p;)
+        {
+            const char* pEquals = strchr(p, '=');
+            const char* pEnd = strchr(p, ' ');
+            if (!pEnd)
+                pEnd = p + strlen(p);
+            if (!pEquals || pEquals > pEnd)
+                return false;
+
+            for (UINT i = 0; i < defineCount; i++)
+            {
+                const char* value = defines[i].value ? defines[i].value : "1";
+                if (strlen(defines[i].name) == static_cast<size_t>(pEquals - p) && strncmp(defines[i].name, p, pEquals - p) == 0 &&
+                    (strlen(value) != static_cast<size_t>(pEnd - pEquals - 1) || strncmp(value, pEquals + 1, pEnd - pEquals - 1) != 0))
+                    return false;
+            }
+            p = *pEnd ? pEnd + 1 : pEnd;
+        }
+        return true;
+    }
+}
+
+const CpuShaderProgram* FindCpuShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount)
+{
+    // match on the file name only, the device may be given a relative or absolute path
+    size_t slash = path.find_last_of(L"/\\");
+    std::wstring name = slash == std::wstring::npos ? path : path.substr(slash + 1);
+
+    for (const CpuShaderProgram& program : g_programs)
+    {
+        if (program.stage == stage && name == program.name && MatchesDefines(program.defines, defines, defineCount))
+            return &program;
+    }
+    return nullptr;
+}
+
+static void FetchTexel(const CpuTextureView& texture, int x, int y, UINT slice, float* color)
+{
+    const BYTE* texel = texture.texels + (((size_t)slice * texture.height + y) * texture.width + x) * 4;
+    for (int c = 0; c < 4; c++)
+    {
+        color[c] = texel[c] * (1.0f / 255.0f);
+    }
+}
+
+static void SampleBilinear(const CpuTextureView& texture, float u, float v, UINT slice, bool wrap, float color[4])
+{
+    float x = u * texture.width - 0.5f;
+    float y = v * texture.height - 0.5f;
+    float fx = floorf(x);
+    float fy = floorf(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    int x0 = static_cast<int>(fx);
+    int y0 = static_cast<int>(fy);
+    int w = static_cast<int>(texture.width);
+    int h = static_cast<int>(texture.height);
+
+    int xs[2];
+    int ys[2];
+    for (int i = 0; i < 2; i++)
+    {
+        if (wrap)
+        {
+            xs[i] = ((x0 + i) % w + w) % w;
+            ys[i] = ((y0 + i) % h + h) % h;
+        }
+        else
+        {
+            xs[i] = x0 + i < 0 ? 0 : (x0 + i >= w ? w - 1 : x0 + i);
+            ys[i] = y0 + i < 0 ? 0 : (y0 + i >= h ? h - 1 : y0 + i);
+        }
+    }
+
+    const float weights[4] = { (1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty };
+    color[0] = color[1] = color[2] = color[3] = 0.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        float texel[4];
+        FetchTexel(texture, xs[i & 1], ys[i >> 1], slice, texel);
+        for (int c = 0; c < 4; c++)
+        {
+            color[c] += texel[c] * weights[i];
+        }
+    }
+}
+
+void SampleTexture2D(const CpuTextureView& texture, float u, float v, UINT slice, float color[4])
+{
+    // textures the backend could not decode sample as white
+    if (!texture.texels || texture.width == 0 || texture.height == 0)
+    {
+        color[0] = color[1] = color[2] = color[3] = 1.0f;
+        return;
+    }
+
+    if (slice >= texture.arraySize)
+        slice = texture.arraySize - 1;
+    SampleBilinear(texture, u, v, slice, true, color);
+}
+
+void SampleTextureCube(const CpuTextureView& texture, const float direction[3], float color[4])
+{
+    if (!texture.texels || texture.arraySize < 6)
+    {
+        color[0] = color[1] = color[2] = color[3] = 1.0f;
+        return;
+    }
+
+    // face order and orientation as in D3D: +X, -X, +Y, -Y, +Z, -Z
+    float x = direction[0];
+    float y = direction[1];
+    float z = direction[2];
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    float az = fabsf(z);
+
+    UINT face;
+    float sc, tc, ma;
+    if (ax >= ay && ax >= az)
+    {
+        face = x >= 0.0f ? 0 : 1;
+        sc = x >= 0.0f ? -z : z;
+        tc = -y;
+        ma = ax;
+    }
+    else if (ay >= az)
+    {
+        face = y >= 0.0f ? 2 : 3;
+        sc = x;
+        tc = y >= 0.0f ? z : -z;
+        ma = ay;
+    }
+    else
+    {
+        face = z >= 0.0f ? 4 : 5;
+        sc = z >= 0.0f ? x : -x;
+        tc = -y;
+        ma = az;
+    }
+
+    if (ma == 0.0f)
+        ma = 1.0f;
+    SampleBilinear(texture, (sc / ma + 1.0f) * 0.5f, (tc / ma + 1.0f) * 0.5f, face, false, color);
+}
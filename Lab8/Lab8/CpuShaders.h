@@ -0,0 +1,64 @@
+#ifndef CPU_SHADERS_H
+#define CPU_SHADERS_H
+
+#include "RenderBackend.h"
+
+// C++ counterparts of the lab's HLSL files, used by the headless backend.
+// A program is looked up by the same file name RenderClass passes to
+// RenderDevice::CreateShader.
+
+const UINT CpuMaxSlots = 8;
+
+// SV_Position plus the interpolated outputs of a vertex program
+const UINT CpuMaxVaryings = 20;
+
+// RGBA8 texels of mip 0, slices (array elements or cube faces) stored one after another
+struct CpuTextureView
+{
+    const BYTE* texels;
+    UINT width;
+    UINT height;
+    UINT arraySize;
+};
+
+struct CpuShaderBindings
+{
+    const BYTE* constantBuffers[CpuMaxSlots];
+    const BYTE* resources[CpuMaxSlots];
+    UINT resourceSizes[CpuMaxSlots];
+    CpuTextureView textures[CpuMaxSlots];
+    BYTE* uavs[CpuMaxSlots];
+    UINT uavSizes[CpuMaxSlots];
+};
+
+// Runs one thread group of a compute shader
+typedef void (*CpuComputeKernel)(const CpuShaderBindings& bindings, UINT groupX, UINT groupY, UINT groupZ);
+
+// Transforms one vertex, out[0..3] is the clip space position and the
+// varyings follow it
+typedef void (*CpuVertexKernel)(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT instanceId, float* out);
+
+// Shades one pixel from the interpolated varyings, which are followed by
+// SV_Position (pixel center x and y, depth, w). Writes four floats for
+// every bound render target; UAVs of the pixel stage are in bindings.uavs.
+typedef void (*CpuPixelKernel)(const CpuShaderBindings& bindings, const float* varyings, float* color);
+
+struct CpuShaderProgram
+{
+    const wchar_t* name;
+    ShaderStage stage;
+    UINT varyingCount;
+    CpuVertexKernel vertex;
+    CpuPixelKernel pixel;
+    CpuComputeKernel compute;
+    const char* defines;    // "NAME=VALUE ..." the kernel was written for, nullptr without permutations
+    bool parallelGroups;    // the groups of a dispatch write nothing another reads, they may run on several threads
+};
+
+// Programs with permutations pick the row for the given defines
+const CpuShaderProgram* FindCpuShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines = nullptr, UINT defineCount = 0);
+
+void SampleTexture2D(const CpuTextureView& texture, float u, float v, UINT slice, float color[4]);
+void SampleTextureCube(const CpuTextureView& texture, const float direction[3], float color[4]);
+
+#endif
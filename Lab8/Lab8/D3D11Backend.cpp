@@ -0,0 +1,1383 @@
+#include "framework.h"
+#include "D3D11Backend.h"
+#include "DDSTextureLoader11.h"
+#include "DDSFile.h"
+
+#include <d3dcompiler.h>
+#include <chrono>
+#include <cstring>
+
+#pragma comment (lib, "d3dcompiler.lib")
+#pragma comment (lib, "d3d11.lib")
+#pragma comment (lib, "dxgi.lib")
+
+static DXGI_FORMAT ToDXGI(Format format)
+{
+    switch (format)
+    {
+    case Format::R32G32B32A32_FLOAT: return DXGI_FORMAT_R32G32B32A32_FLOAT;
+    case Format::R32G32B32_FLOAT:    return DXGI_FORMAT_R32G32B32_FLOAT;
+    case Format::R32G32_FLOAT:       return DXGI_FORMAT_R32G32_FLOAT;
+    case Format::R32_FLOAT:          return DXGI_FORMAT_R32_FLOAT;
+    case Format::R32_UINT:           return DXGI_FORMAT_R32_UINT;
+    case Format::R16_UINT:           return DXGI_FORMAT_R16_UINT;
+    case Format::R16G16B16A16_UNORM: return DXGI_FORMAT_R16G16B16A16_UNORM;
+    case Format::R8G8B8A8_UNORM:     return DXGI_FORMAT_R8G8B8A8_UNORM;
+    case Format::B8G8R8A8_UNORM:     return DXGI_FORMAT_B8G8R8A8_UNORM;
+    case Format::D32_FLOAT:          return DXGI_FORMAT_D32_FLOAT;
+    case Format::BC1_UNORM:          return DXGI_FORMAT_BC1_UNORM;
+    case Format::BC2_UNORM:          return DXGI_FORMAT_BC2_UNORM;
+    case Format::BC3_UNORM:          return DXGI_FORMAT_BC3_UNORM;
+    default:                         return DXGI_FORMAT_UNKNOWN;
+    }
+}
+
+static D3D11_COMPARISON_FUNC ToD3D(ComparisonFunc func)
+{
+    return static_cast<D3D11_COMPARISON_FUNC>(static_cast<int>(func) + D3D11_COMPARISON_NEVER);
+}
+
+static D3D11_BLEND ToD3D(Blend blend)
+{
+    switch (blend)
+    {
+    case Blend::Zero:         return D3D11_BLEND_ZERO;
+    case Blend::One:          return D3D11_BLEND_ONE;
+    case Blend::SrcAlpha:     return D3D11_BLEND_SRC_ALPHA;
+    case Blend::InvSrcAlpha:  return D3D11_BLEND_INV_SRC_ALPHA;
+    case Blend::DestAlpha:    return D3D11_BLEND_DEST_ALPHA;
+    case Blend::InvDestAlpha: return D3D11_BLEND_INV_DEST_ALPHA;
+    case Blend::SrcColor:     return D3D11_BLEND_SRC_COLOR;
+    case Blend::InvSrcColor:  return D3D11_BLEND_INV_SRC_COLOR;
+    default:                  return D3D11_BLEND_ONE;
+    }
+}
+
+static D3D11_BLEND_OP ToD3D(BlendOp op)
+{
+    return static_cast<D3D11_BLEND_OP>(static_cast<int>(op) + D3D11_BLEND_OP_ADD);
+}
+
+static UINT ToD3DBindFlags(UINT bindFlags)
+{
+    UINT result = 0;
+    if (bindFlags & BIND_VERTEX_BUFFER) result |= D3D11_BIND_VERTEX_BUFFER;
+    if (bindFlags & BIND_INDEX_BUFFER) result |= D3D11_BIND_INDEX_BUFFER;
+    if (bindFlags & BIND_CONSTANT_BUFFER) result |= D3D11_BIND_CONSTANT_BUFFER;
+    if (bindFlags & BIND_SHADER_RESOURCE) result |= D3D11_BIND_SHADER_RESOURCE;
+    if (bindFlags & BIND_UNORDERED_ACCESS) result |= D3D11_BIND_UNORDERED_ACCESS;
+    if (bindFlags & BIND_RENDER_TARGET) result |= D3D11_BIND_RENDER_TARGET;
+    if (bindFlags & BIND_DEPTH_STENCIL) result |= D3D11_BIND_DEPTH_STENCIL;
+    return result;
+}
+
+HRESULT D3D11RenderDevice::Init(HWND hWnd)
+{
+    HRESULT result;
+
+    IDXGIFactory* pFactory = nullptr;
+    result = CreateDXGIFactory(__uuidof(IDXGIFactory), (void**)&pFactory);
+
+    IDXGIAdapter* pSelectedAdapter = NULL;
+    if (SUCCEEDED(result))
+    {
+        IDXGIAdapter* pAdapter = NULL;
+        UINT adapterIdx = 0;
+        while (SUCCEEDED(pFactory->EnumAdapters(adapterIdx, &pAdapter)))
+        {
+            DXGI_ADAPTER_DESC desc;
+            pAdapter->GetDesc(&desc);
+
+            if (wcscmp(desc.Description, L"Microsoft Basic Render Driver") != 0)
+            {
+                pSelectedAdapter = pAdapter;
+                break;
+            }
+
+            pAdapter->Release();
+
+            adapterIdx++;
+        }
+    }
+
+    // Create DirectX 11 device
+    D3D_FEATURE_LEVEL level;
+    D3D_FEATURE_LEVEL levels[] = { D3D_FEATURE_LEVEL_11_0 };
+    if (SUCCEEDED(result))
+    {
+        UINT flags = 0;
+#ifdef _DEBUG
+        flags |= D3D11_CREATE_DEVICE_DEBUG;
+#endif
+        result = D3D11CreateDevice(pSelectedAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL,
+            flags, levels, 1, D3D11_SDK_VERSION, &m_pDevice, &level, &m_pDeviceContext);
+    }
+
+    // The upload ring binds constant buffer ranges and maps them NO_OVERWRITE,
+    // both need the Direct3D 11.1 runtime and driver support
+    if (SUCCEEDED(result))
+    {
+        result = m_pDeviceContext->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&m_pDeviceContext1);
+    }
+
+    if (SUCCEEDED(result))
+    {
+        D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+        result = m_pDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options));
+        if (SUCCEEDED(result) && (!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer))
+            result = DXGI_ERROR_UNSUPPORTED;
+    }
+
+    if (SUCCEEDED(result))
+    {
+        DXGI_SWAP_CHAIN_DESC swapChainDesc = { 0 };
+        swapChainDesc.BufferCount = 2;
+        swapChainDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        // the last post-processing stage writes the back buffer from a compute shader
+        swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT | DXGI_USAGE_UNORDERED_ACCESS;
+        swapChainDesc.OutputWindow = hWnd;
+        swapChainDesc.SampleDesc.Count = 1;
+        swapChainDesc.SampleDesc.Quality = 0;
+        swapChainDesc.Windowed = true;
+        swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
+        swapChainDesc.Flags = 0;
+
+        result = pFactory->CreateSwapChain(m_pDevice, &swapChainDesc, &m_pSwapChain);
+    }
+
+    if (SUCCEEDED(result))
+    {
+        m_pImmediateContext = new D3D11RenderContext(this, m_pDeviceContext, m_pDeviceContext1);
+        result = CreateBackBufferView();
+    }
+
+    if (SUCCEEDED(result))
+    {
+        // without a pack every shader is compiled and the pack written on exit
+        result = m_shaderCache.Open(ShaderCache::DefaultPath);
+    }
+
+    if (pSelectedAdapter)
+        pSelectedAdapter->Release();
+    if (pFactory)
+        pFactory->Release();
+
+    if (FAILED(result))
+    {
+        Terminate();
+    }
+
+    return result;
+}
+
+void D3D11RenderDevice::Terminate()
+{
+    m_shaderCache.Save();
+    m_shaderCache.Close();
+
+    for (Object& object : m_objects)
+    {
+        ReleaseObject(object);
+    }
+    m_objects.clear();
+    m_freeHandles.clear();
+    m_backBuffer = NullHandle;
+
+    if (m_pImmediateContext)
+    {
+        delete m_pImmediateContext;
+        m_pImmediateContext = nullptr;
+    }
+
+    if (m_pDeviceContext1)
+    {
+        m_pDeviceContext1->Release();
+        m_pDeviceContext1 = nullptr;
+    }
+
+    if (m_pDeviceContext)
+    {
+        m_pDeviceContext->ClearState();
+        m_pDeviceContext->Release();
+        m_pDeviceContext = nullptr;
+    }
+
+    if (m_pSwapChain)
+    {
+        m_pSwapChain->Release();
+        m_pSwapChain = nullptr;
+    }
+
+    if (m_pDevice)
+    {
+        m_pDevice->Release();
+        m_pDevice = nullptr;
+    }
+}
+
+RenderHandle D3D11RenderDevice::AddObject(const Object& object)
+{
+    if (!m_freeHandles.empty())
+    {
+        RenderHandle handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+        m_objects[handle - 1] = object;
+        return handle;
+    }
+
+    m_objects.push_back(object);
+    return static_cast<RenderHandle>(m_objects.size());
+}
+
+void D3D11RenderDevice::ReleaseObject(Object& object)
+{
+    if (object.pSRV) object.pSRV->Release();
+    if (object.pUAV) object.pUAV->Release();
+    if (object.pRTV) object.pRTV->Release();
+    if (object.pDSV) object.pDSV->Release();
+    if (object.pCode) object.pCode->Release();
+    if (object.pObject) object.pObject->Release();
+    object = Object();
+}
+
+D3D11RenderDevice::Object* D3D11RenderDevice::Lookup(RenderHandle handle)
+{
+    if (handle == NullHandle || handle > m_objects.size())
+        return nullptr;
+    return &m_objects[handle - 1];
+}
+
+void D3D11RenderDevice::Release(RenderHandle handle)
+{
+    Object* pObject = Lookup(handle);
+    if (!pObject || !pObject->pObject)
+        return;
+
+    ReleaseObject(*pObject);
+    m_freeHandles.push_back(handle);
+
+    if (m_pImmediateContext)
+        m_pImmediateContext->ForgetState(handle);
+}
+
+void D3D11RenderDevice::ReplaceResource(RenderHandle target, RenderHandle source)
+{
+    Object* pTarget = Lookup(target);
+    Object* pSource = Lookup(source);
+    if (!pTarget || !pSource || !pSource->pObject || target == source)
+        return;
+
+    ReleaseObject(*pTarget);
+    *pTarget = *pSource;
+    *pSource = Object();
+    m_freeHandles.push_back(source);
+
+    if (m_pImmediateContext)
+    {
+        m_pImmediateContext->ForgetState(target);
+        m_pImmediateContext->ForgetState(source);
+    }
+}
+
+HRESULT D3D11RenderDevice::CreateBuffer(const BufferDesc& desc, const void* pInitData, RenderHandle* pBuffer)
+{
+    D3D11_BUFFER_DESC bd = {};
+    bd.ByteWidth = desc.byteWidth;
+    bd.BindFlags = ToD3DBindFlags(desc.bindFlags);
+    bd.StructureByteStride = desc.structureStride;
+
+    switch (desc.usage)
+    {
+    case ResourceUsage::Dynamic:
+        bd.Usage = D3D11_USAGE_DYNAMIC;
+        bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        break;
+    case ResourceUsage::Staging:
+        bd.Usage = D3D11_USAGE_STAGING;
+        bd.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        break;
+    default:
+        bd.Usage = D3D11_USAGE_DEFAULT;
+        break;
+    }
+
+    if (desc.miscFlags & MISC_STRUCTURED)
+        bd.MiscFlags |= D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    if (desc.miscFlags & MISC_DRAW_INDIRECT_ARGS)
+        bd.MiscFlags |= D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+    if (desc.miscFlags & MISC_RAW_VIEWS)
+        bd.MiscFlags |= D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+
+    D3D11_SUBRESOURCE_DATA initData = {};
+    initData.pSysMem = pInitData;
+
+    Object object;
+    object.byteWidth = desc.byteWidth;
+
+    ID3D11Buffer* pD3DBuffer = nullptr;
+    HRESULT result = m_pDevice->CreateBuffer(&bd, pInitData ? &initData : nullptr, &pD3DBuffer);
+    if (FAILED(result))
+        return result;
+    object.pObject = pD3DBuffer;
+
+    bool raw = (desc.miscFlags & MISC_RAW_VIEWS) != 0;
+    UINT elementSize = raw ? sizeof(UINT) : desc.structureStride;
+    UINT elementCount = elementSize ? desc.byteWidth / elementSize : 0;
+
+    if (desc.bindFlags & BIND_SHADER_RESOURCE)
+    {
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+        srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        srvDesc.Buffer.FirstElement = 0;
+        srvDesc.Buffer.NumElements = elementCount;
+        result = m_pDevice->CreateShaderResourceView(pD3DBuffer, &srvDesc, &object.pSRV);
+    }
+
+    if (SUCCEEDED(result) && (desc.bindFlags & BIND_UNORDERED_ACCESS))
+    {
+        D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+        uavDesc.Format = raw ? DXGI_FORMAT_R32_TYPELESS : DXGI_FORMAT_UNKNOWN;
+        uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+        uavDesc.Buffer.FirstElement = 0;
+        uavDesc.Buffer.NumElements = elementCount;
+        uavDesc.Buffer.Flags = raw ? D3D11_BUFFER_UAV_FLAG_RAW : 0;
+        result = m_pDevice->CreateUnorderedAccessView(pD3DBuffer, &uavDesc, &object.pUAV);
+    }
+
+    if (FAILED(result))
+    {
+        ReleaseObject(object);
+        return result;
+    }
+
+    *pBuffer = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateTexture(const TextureDesc& desc, const SubresourceData* pInitData, RenderHandle* pTexture)
+{
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    texDesc.Width = desc.width;
+    texDesc.Height = desc.height;
+    texDesc.MipLevels = desc.mipLevels;
+    texDesc.ArraySize = desc.arraySize;
+    texDesc.Format = ToDXGI(desc.format);
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = ToD3DBindFlags(desc.bindFlags);
+    texDesc.MiscFlags = desc.cube ? D3D11_RESOURCE_MISC_TEXTURECUBE : 0;
+
+    // depth that shaders also read is typeless, viewed as D32 and R32
+    const bool readDepth = desc.format == Format::D32_FLOAT && (desc.bindFlags & BIND_SHADER_RESOURCE);
+    if (readDepth)
+        texDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+
+    std::vector<D3D11_SUBRESOURCE_DATA> initData;
+    if (pInitData)
+    {
+        initData.resize(desc.mipLevels * desc.arraySize);
+        for (size_t i = 0; i < initData.size(); i++)
+        {
+            initData[i].pSysMem = pInitData[i].pData;
+            initData[i].SysMemPitch = pInitData[i].rowPitch;
+            initData[i].SysMemSlicePitch = pInitData[i].slicePitch;
+        }
+    }
+
+    Object object;
+    ID3D11Texture2D* pD3DTexture = nullptr;
+    HRESULT result = m_pDevice->CreateTexture2D(&texDesc, pInitData ? initData.data() : nullptr, &pD3DTexture);
+    if (FAILED(result))
+        return result;
+    object.pObject = pD3DTexture;
+
+    if (desc.bindFlags & BIND_RENDER_TARGET)
+        result = m_pDevice->CreateRenderTargetView(pD3DTexture, nullptr, &object.pRTV);
+
+    if (SUCCEEDED(result) && (desc.bindFlags & BIND_DEPTH_STENCIL))
+    {
+        D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+        dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+        dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+        result = m_pDevice->CreateDepthStencilView(pD3DTexture, readDepth ? &dsvDesc : nullptr, &object.pDSV);
+    }
+
+    if (SUCCEEDED(result) && (desc.bindFlags & BIND_SHADER_RESOURCE))
+    {
+        // the default view of a cube texture is a 2D array
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+        srvDesc.Format = texDesc.Format;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+        srvDesc.TextureCube.MipLevels = desc.mipLevels;
+        if (readDepth)
+        {
+            srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+            srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+            srvDesc.Texture2D.MipLevels = desc.mipLevels;
+        }
+        result = m_pDevice->CreateShaderResourceView(pD3DTexture, (desc.cube || readDepth) ? &srvDesc : nullptr, &object.pSRV);
+    }
+
+    if (SUCCEEDED(result) && (desc.bindFlags & BIND_UNORDERED_ACCESS))
+        result = m_pDevice->CreateUnorderedAccessView(pD3DTexture, nullptr, &object.pUAV);
+
+    if (FAILED(result))
+    {
+        ReleaseObject(object);
+        return result;
+    }
+
+    *pTexture = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateTextureFromFile(const std::wstring& path, RenderHandle* pTexture)
+{
+    // the subresources point into the mapping, no heap copy of the file
+    MappedFile file;
+    HRESULT result = file.Open(path);
+    if (FAILED(result))
+        return result;
+
+    return CreateTextureFromMemory(file.GetData(), file.GetSize(), pTexture);
+}
+
+HRESULT D3D11RenderDevice::CreateTextureArrayFromFiles(const std::wstring* paths, UINT count, RenderHandle* pTexture)
+{
+    std::vector<ID3D11Resource*> textureResources(count, nullptr);
+
+    HRESULT result = S_OK;
+    for (UINT i = 0; i < count && SUCCEEDED(result); ++i)
+    {
+        MappedFile file;
+        result = file.Open(paths[i]);
+        if (SUCCEEDED(result))
+            result = DirectX::CreateDDSTextureFromMemory(m_pDevice, file.GetData(), file.GetSize(), &textureResources[i], nullptr);
+    }
+
+    return CreateTextureArray(textureResources, result, pTexture);
+}
+
+HRESULT D3D11RenderDevice::CreateTextureFromMemory(const BYTE* pData, size_t byteSize, RenderHandle* pTexture)
+{
+    Object object;
+    ID3D11Resource* pResource = nullptr;
+    HRESULT result = DirectX::CreateDDSTextureFromMemory(m_pDevice, pData, byteSize, &pResource, &object.pSRV);
+    if (FAILED(result))
+        return result;
+    object.pObject = pResource;
+
+    *pTexture = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateTextureArrayFromMemory(const BYTE* const* ppData, const size_t* byteSizes, UINT count, RenderHandle* pTexture)
+{
+    std::vector<ID3D11Resource*> textureResources(count, nullptr);
+
+    HRESULT result = S_OK;
+    for (UINT i = 0; i < count && SUCCEEDED(result); ++i)
+    {
+        result = DirectX::CreateDDSTextureFromMemory(m_pDevice, ppData[i], byteSizes[i], &textureResources[i], nullptr);
+    }
+
+    return CreateTextureArray(textureResources, result, pTexture);
+}
+
+// Copies the loaded slices into one Texture2DArray and releases them
+HRESULT D3D11RenderDevice::CreateTextureArray(std::vector<ID3D11Resource*>& textureResources, HRESULT result, RenderHandle* pTexture)
+{
+    const UINT count = static_cast<UINT>(textureResources.size());
+    if (count == 0)
+        return E_INVALIDARG;
+
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    if (SUCCEEDED(result))
+    {
+        ID3D11Texture2D* pTexture2D = nullptr;
+        result = textureResources[0]->QueryInterface(__uuidof(ID3D11Texture2D), (void**)&pTexture2D);
+        if (SUCCEEDED(result))
+        {
+            pTexture2D->GetDesc(&texDesc);
+            pTexture2D->Release();
+        }
+    }
+
+    ID3D11Texture2D* pTextureArray = nullptr;
+    if (SUCCEEDED(result))
+    {
+        D3D11_TEXTURE2D_DESC arrayDesc = texDesc;
+        arrayDesc.ArraySize = count;
+        result = m_pDevice->CreateTexture2D(&arrayDesc, nullptr, &pTextureArray);
+    }
+
+    if (SUCCEEDED(result))
+    {
+        for (UINT i = 0; i < count; ++i)
+        {
+            for (UINT mip = 0; mip < texDesc.MipLevels; ++mip)
+            {
+                m_pDeviceContext->CopySubresourceRegion(
+                    pTextureArray,
+                    D3D11CalcSubresource(mip, i, texDesc.MipLevels),
+                    0, 0, 0,
+                    textureResources[i],
+                    mip,
+                    nullptr
+                );
+            }
+        }
+    }
+
+    for (ID3D11Resource* pResource : textureResources)
+    {
+        if (pResource)
+            pResource->Release();
+    }
+
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pTextureArray;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = texDesc.Format;
+    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+    srvDesc.Texture2DArray.ArraySize = count;
+    srvDesc.Texture2DArray.FirstArraySlice = 0;
+    srvDesc.Texture2DArray.MipLevels = texDesc.MipLevels;
+    srvDesc.Texture2DArray.MostDetailedMip = 0;
+
+    result = m_pDevice->CreateShaderResourceView(pTextureArray, &srvDesc, &object.pSRV);
+    if (FAILED(result))
+    {
+        ReleaseObject(object);
+        return result;
+    }
+
+    *pTexture = AddObject(object);
+    return S_OK;
+}
+
+HRESULT CompileD3D11Shader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount,
+    ShaderCache* pCache, ID3DBlob** ppCode)
+{
+    const char* profile = "vs_5_0";
+    if (stage == ShaderStage::Pixel)
+        profile = "ps_5_0";
+    else if (stage == ShaderStage::Compute)
+        profile = "cs_5_0";
+
+    UINT flags = 0;
+#ifdef _DEBUG
+    flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+    auto start = std::chrono::steady_clock::now();
+
+    UINT64 key = 0;
+    bool cached = pCache && SUCCEEDED(ShaderCache::ComputeKey(path, defines, defineCount, "main", profile, flags, &key));
+
+    const BYTE* pData = nullptr;
+    size_t size = 0;
+    bool hit = cached && pCache->Find(key, &pData, &size);
+
+    HRESULT result;
+    if (hit)
+    {
+        result = D3DCreateBlob(size, ppCode);
+        if (SUCCEEDED(result))
+            memcpy((*ppCode)->GetBufferPointer(), pData, size);
+    }
+    else
+    {
+        // null terminated, like every D3D_SHADER_MACRO array
+        std::vector<D3D_SHADER_MACRO> macros(defineCount + 1, D3D_SHADER_MACRO{ nullptr, nullptr });
+        for (UINT i = 0; i < defineCount; i++)
+        {
+            macros[i] = { defines[i].name, defines[i].value };
+        }
+
+        ID3DBlob* pErr = nullptr;
+
+        result = D3DCompileFromFile(path.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", profile, flags, 0, ppCode, &pErr);
+        if (!SUCCEEDED(result) && pErr != nullptr)
+        {
+            OutputDebugStringA((const char*)pErr->GetBufferPointer());
+        }
+        if (pErr)
+            pErr->Release();
+
+        if (SUCCEEDED(result) && cached)
+            pCache->Store(key, (*ppCode)->GetBufferPointer(), (*ppCode)->GetBufferSize());
+    }
+
+    if (pCache)
+        pCache->AddTime(hit, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return result;
+}
+
+HRESULT D3D11RenderDevice::CreateShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount, RenderHandle* pShader)
+{
+    ID3DBlob* pCode = nullptr;
+    HRESULT result = CompileD3D11Shader(stage, path, defines, defineCount, &m_shaderCache, &pCode);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+    {
+        ID3D11VertexShader* pVertexShader = nullptr;
+        result = m_pDevice->CreateVertexShader(pCode->GetBufferPointer(), pCode->GetBufferSize(), nullptr, &pVertexShader);
+        object.pObject = pVertexShader;
+        // keep the bytecode, CreateInputLayout validates against it
+        object.pCode = pCode;
+        pCode = nullptr;
+        break;
+    }
+    case ShaderStage::Pixel:
+    {
+        ID3D11PixelShader* pPixelShader = nullptr;
+        result = m_pDevice->CreatePixelShader(pCode->GetBufferPointer(), pCode->GetBufferSize(), nullptr, &pPixelShader);
+        object.pObject = pPixelShader;
+        break;
+    }
+    case ShaderStage::Compute:
+    {
+        ID3D11ComputeShader* pComputeShader = nullptr;
+        result = m_pDevice->CreateComputeShader(pCode->GetBufferPointer(), pCode->GetBufferSize(), nullptr, &pComputeShader);
+        object.pObject = pComputeShader;
+        break;
+    }
+    }
+
+    if (pCode)
+        pCode->Release();
+
+    if (FAILED(result))
+    {
+        ReleaseObject(object);
+        return result;
+    }
+
+    *pShader = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateInputLayout(const InputElement* elements, UINT count, RenderHandle vertexShader, RenderHandle* pLayout)
+{
+    Object* pShaderObject = Lookup(vertexShader);
+    if (!pShaderObject || !pShaderObject->pCode)
+        return E_INVALIDARG;
+
+    std::vector<D3D11_INPUT_ELEMENT_DESC> layout(count);
+    for (UINT i = 0; i < count; ++i)
+    {
+        layout[i] = { elements[i].semanticName, elements[i].semanticIndex, ToDXGI(elements[i].format), 0,
+            elements[i].offset, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    }
+
+    ID3D11InputLayout* pInputLayout = nullptr;
+    HRESULT result = m_pDevice->CreateInputLayout(layout.data(), count, pShaderObject->pCode->GetBufferPointer(),
+        pShaderObject->pCode->GetBufferSize(), &pInputLayout);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pInputLayout;
+    *pLayout = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateRasterizerState(const RasterizerDesc& desc, RenderHandle* pState)
+{
+    D3D11_RASTERIZER_DESC rsDesc = {};
+    rsDesc.FillMode = desc.fillMode == FillMode::Wireframe ? D3D11_FILL_WIREFRAME : D3D11_FILL_SOLID;
+    rsDesc.CullMode = desc.cullMode == CullMode::None ? D3D11_CULL_NONE :
+        desc.cullMode == CullMode::Front ? D3D11_CULL_FRONT : D3D11_CULL_BACK;
+    rsDesc.FrontCounterClockwise = desc.frontCounterClockwise;
+    rsDesc.DepthClipEnable = true;
+
+    ID3D11RasterizerState* pRSState = nullptr;
+    HRESULT result = m_pDevice->CreateRasterizerState(&rsDesc, &pRSState);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pRSState;
+    *pState = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState)
+{
+    D3D11_DEPTH_STENCIL_DESC dsDesc = {};
+    dsDesc.DepthEnable = desc.depthEnable;
+    dsDesc.DepthWriteMask = desc.depthWrite ? D3D11_DEPTH_WRITE_MASK_ALL : D3D11_DEPTH_WRITE_MASK_ZERO;
+    dsDesc.DepthFunc = ToD3D(desc.depthFunc);
+
+    ID3D11DepthStencilState* pDSState = nullptr;
+    HRESULT result = m_pDevice->CreateDepthStencilState(&dsDesc, &pDSState);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pDSState;
+    *pState = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateBlendState(const BlendDesc& desc, RenderHandle* pState)
+{
+    D3D11_BLEND_DESC blendDesc = {};
+    blendDesc.RenderTarget[0].BlendEnable = desc.blendEnable;
+    blendDesc.RenderTarget[0].SrcBlend = ToD3D(desc.srcBlend);
+    blendDesc.RenderTarget[0].DestBlend = ToD3D(desc.destBlend);
+    blendDesc.RenderTarget[0].BlendOp = ToD3D(desc.blendOp);
+    blendDesc.RenderTarget[0].SrcBlendAlpha = ToD3D(desc.srcBlendAlpha);
+    blendDesc.RenderTarget[0].DestBlendAlpha = ToD3D(desc.destBlendAlpha);
+    blendDesc.RenderTarget[0].BlendOpAlpha = ToD3D(desc.blendOpAlpha);
+    blendDesc.RenderTarget[0].RenderTargetWriteMask = desc.writeMask;
+
+    ID3D11BlendState* pBlendState = nullptr;
+    HRESULT result = m_pDevice->CreateBlendState(&blendDesc, &pBlendState);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pBlendState;
+    *pState = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateSamplerState(const SamplerDesc& desc, RenderHandle* pSampler)
+{
+    D3D11_TEXTURE_ADDRESS_MODE address = desc.address == TextureAddress::Clamp ?
+        D3D11_TEXTURE_ADDRESS_CLAMP : D3D11_TEXTURE_ADDRESS_WRAP;
+
+    D3D11_SAMPLER_DESC sampDesc = {};
+    sampDesc.Filter = desc.filter == TextureFilter::Point ?
+        D3D11_FILTER_MIN_MAG_MIP_POINT : D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    sampDesc.AddressU = address;
+    sampDesc.AddressV = address;
+    sampDesc.AddressW = address;
+    sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    sampDesc.MinLOD = 0;
+    sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+    ID3D11SamplerState* pSamplerState = nullptr;
+    HRESULT result = m_pDevice->CreateSamplerState(&sampDesc, &pSamplerState);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pSamplerState;
+    *pSampler = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateQuery(QueryType type, RenderHandle* pQuery)
+{
+    D3D11_QUERY_DESC queryDesc = {};
+    queryDesc.Query = type == QueryType::TimestampDisjoint ? D3D11_QUERY_TIMESTAMP_DISJOINT : D3D11_QUERY_TIMESTAMP;
+
+    ID3D11Query* pD3DQuery = nullptr;
+    HRESULT result = m_pDevice->CreateQuery(&queryDesc, &pD3DQuery);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pD3DQuery;
+    *pQuery = AddObject(object);
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::CreateBackBufferView()
+{
+    ID3D11Texture2D* pBackBuffer = nullptr;
+    HRESULT result = m_pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
+    if (FAILED(result))
+        return result;
+
+    Object object;
+    object.pObject = pBackBuffer;
+    result = m_pDevice->CreateRenderTargetView(pBackBuffer, nullptr, &object.pRTV);
+    if (SUCCEEDED(result))
+        result = m_pDevice->CreateUnorderedAccessView(pBackBuffer, nullptr, &object.pUAV);
+    if (FAILED(result))
+    {
+        ReleaseObject(object);
+        return result;
+    }
+
+    // the handle survives resizes, only the views behind it change
+    if (m_backBuffer == NullHandle)
+        m_backBuffer = AddObject(object);
+    else
+        m_objects[m_backBuffer - 1] = object;
+
+    return S_OK;
+}
+
+HRESULT D3D11RenderDevice::ResizeBackBuffer(UINT width, UINT height)
+{
+    if (!m_pSwapChain)
+        return E_FAIL;
+
+    m_pDeviceContext->OMSetRenderTargets(0, nullptr, nullptr);
+
+    Object* pBackBuffer = Lookup(m_backBuffer);
+    if (pBackBuffer)
+        ReleaseObject(*pBackBuffer);
+
+    HRESULT result = m_pSwapChain->ResizeBuffers(0, width, height, DXGI_FORMAT_R8G8B8A8_UNORM, 0);
+    if (FAILED(result))
+        return result;
+
+    return CreateBackBufferView();
+}
+
+void D3D11RenderDevice::Present(UINT syncInterval)
+{
+    m_pSwapChain->Present(syncInterval, 0);
+}
+
+HRESULT D3D11RenderDevice::CreateDeferredContext(RenderContext** ppContext)
+{
+    ID3D11DeviceContext* pContext = nullptr;
+    HRESULT result = m_pDevice->CreateDeferredContext(0, &pContext);
+    if (FAILED(result))
+        return result;
+
+    ID3D11DeviceContext1* pContext1 = nullptr;
+    result = pContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&pContext1));
+    if (FAILED(result))
+    {
+        pContext->Release();
+        return result;
+    }
+
+    *ppContext = new D3D11RenderContext(this, pContext, pContext1, true);
+    return S_OK;
+}
+
+D3D11RenderContext::~D3D11RenderContext()
+{
+    if (m_pCommandList)
+        m_pCommandList->Release();
+
+    if (m_ownsContext)
+    {
+        m_pContext1->Release();
+        m_pContext->Release();
+    }
+}
+
+HRESULT D3D11RenderContext::Map(RenderHandle buffer, MapMode mode, void** ppData)
+{
+    D3D11_MAP mapType = mode == MapMode::WriteNoOverwrite ? D3D11_MAP_WRITE_NO_OVERWRITE : D3D11_MAP_WRITE_DISCARD;
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT result = m_pContext->Map(m_pOwner->Get<ID3D11Buffer>(buffer), 0, mapType, 0, &mapped);
+    if (SUCCEEDED(result))
+    {
+        *ppData = mapped.pData;
+        m_stats.maps++;
+    }
+    return result;
+}
+
+void D3D11RenderContext::Unmap(RenderHandle buffer)
+{
+    m_pContext->Unmap(m_pOwner->Get<ID3D11Buffer>(buffer), 0);
+}
+
+void D3D11RenderContext::UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize)
+{
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(buffer);
+
+    // constant buffers can only be updated whole
+    D3D11_BUFFER_DESC desc;
+    pBuffer->GetDesc(&desc);
+    if (desc.BindFlags & D3D11_BIND_CONSTANT_BUFFER)
+    {
+        m_pContext->UpdateSubresource(pBuffer, 0, nullptr, pData, 0, 0);
+    }
+    else
+    {
+        D3D11_BOX box = { 0, 0, 0, byteSize, 1, 1 };
+        m_pContext->UpdateSubresource(pBuffer, 0, &box, pData, 0, 0);
+    }
+    m_stats.bufferUpdates++;
+}
+
+void D3D11RenderContext::UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize)
+{
+    D3D11_BOX box = { byteOffset, 0, 0, byteOffset + byteSize, 1, 1 };
+    m_pContext->UpdateSubresource(m_pOwner->Get<ID3D11Buffer>(buffer), 0, &box, pData, 0, 0);
+    m_stats.bufferUpdates++;
+}
+
+HRESULT D3D11RenderContext::ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize)
+{
+    // only the immediate context can map for reading
+    if (m_ownsContext)
+        return DXGI_ERROR_INVALID_CALL;
+
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(buffer);
+
+    D3D11_BUFFER_DESC desc;
+    pBuffer->GetDesc(&desc);
+
+    D3D11_BUFFER_DESC stagingDesc = desc;
+    stagingDesc.Usage = D3D11_USAGE_STAGING;
+    stagingDesc.BindFlags = 0;
+    stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    stagingDesc.MiscFlags = 0;
+
+    ID3D11Buffer* pStagingBuffer = nullptr;
+    HRESULT result = m_pOwner->m_pDevice->CreateBuffer(&stagingDesc, nullptr, &pStagingBuffer);
+    if (SUCCEEDED(result))
+    {
+        m_pContext->CopyResource(pStagingBuffer, pBuffer);
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        result = m_pContext->Map(pStagingBuffer, 0, D3D11_MAP_READ, 0, &mapped);
+        if (SUCCEEDED(result))
+        {
+            memcpy(pData, mapped.pData, byteSize);
+            m_pContext->Unmap(pStagingBuffer, 0);
+        }
+        pStagingBuffer->Release();
+    }
+    m_stats.readbacks++;
+
+    return result;
+}
+
+HRESULT D3D11RenderContext::TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize)
+{
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(stagingBuffer);
+    if (!pBuffer)
+        return E_INVALIDARG;
+    if (m_ownsContext)
+        return DXGI_ERROR_INVALID_CALL;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT result = m_pContext->Map(pBuffer, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+    if (result == DXGI_ERROR_WAS_STILL_DRAWING)
+        return S_FALSE;
+    if (FAILED(result))
+        return result;
+
+    memcpy(pData, mapped.pData, byteSize);
+    m_pContext->Unmap(pBuffer, 0);
+    return S_OK;
+}
+
+void D3D11RenderContext::CopyResource(RenderHandle dst, RenderHandle src)
+{
+    ID3D11Resource* pDst = m_pOwner->Get<ID3D11Resource>(dst);
+    ID3D11Resource* pSrc = m_pOwner->Get<ID3D11Resource>(src);
+    if (pDst && pSrc)
+    {
+        m_pContext->CopyResource(pDst, pSrc);
+    }
+}
+
+void D3D11RenderContext::ClearRenderTarget(RenderHandle target, const float color[4])
+{
+    D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(target);
+    if (pObject && pObject->pRTV)
+        m_pContext->ClearRenderTargetView(pObject->pRTV, color);
+}
+
+void D3D11RenderContext::ClearDepth(RenderHandle depth, float value)
+{
+    D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(depth);
+    if (pObject && pObject->pDSV)
+        m_pContext->ClearDepthStencilView(pObject->pDSV, D3D11_CLEAR_DEPTH, value, 0);
+}
+
+void D3D11RenderContext::ClearUnorderedAccess(RenderHandle resource, const UINT values[4])
+{
+    D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(resource);
+    if (pObject && pObject->pUAV)
+        m_pContext->ClearUnorderedAccessViewUint(pObject->pUAV, values);
+}
+
+void D3D11RenderContext::SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth)
+{
+    m_renderTargetCount = targetCount < MaxRenderTargets ? targetCount : MaxRenderTargets;
+    for (UINT i = 0; i < MaxRenderTargets; i++)
+    {
+        m_renderTargets[i] = i < m_renderTargetCount ? targets[i] : NullHandle;
+    }
+    m_depthTarget = depth;
+    BindOutputs();
+}
+
+void D3D11RenderContext::BindOutputs()
+{
+    ID3D11RenderTargetView* rtvs[MaxRenderTargets] = {};
+    for (UINT i = 0; i < m_renderTargetCount; i++)
+    {
+        D3D11RenderDevice::Object* pTarget = m_pOwner->Lookup(m_renderTargets[i]);
+        rtvs[i] = pTarget ? pTarget->pRTV : nullptr;
+    }
+    D3D11RenderDevice::Object* pDepth = m_pOwner->Lookup(m_depthTarget);
+    ID3D11DepthStencilView* pDSV = pDepth ? pDepth->pDSV : nullptr;
+
+    // the UAV slots after the targets are always set, which also unbinds
+    // the ones no longer wanted
+    ID3D11UnorderedAccessView* uavs[D3D11_PS_CS_UAV_REGISTER_COUNT] = {};
+    UINT uavCount = 0;
+    for (UINT slot = m_renderTargetCount; slot < D3D11_PS_CS_UAV_REGISTER_COUNT; slot++)
+    {
+        D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(m_pixelUavs[slot]);
+        uavs[uavCount++] = pObject ? pObject->pUAV : nullptr;
+    }
+    m_pContext->OMSetRenderTargetsAndUnorderedAccessViews(m_renderTargetCount, m_renderTargetCount ? rtvs : nullptr, pDSV,
+        m_renderTargetCount, uavCount, uavs, nullptr);
+}
+
+void D3D11RenderContext::ResetOutputs()
+{
+    for (UINT i = 0; i < MaxRenderTargets; i++)
+    {
+        m_renderTargets[i] = NullHandle;
+    }
+    m_renderTargetCount = 0;
+    m_depthTarget = NullHandle;
+    for (UINT slot = 0; slot < D3D11_PS_CS_UAV_REGISTER_COUNT; slot++)
+    {
+        m_pixelUavs[slot] = NullHandle;
+    }
+}
+
+void D3D11RenderContext::SetViewport(const Viewport& viewport)
+{
+    D3D11_VIEWPORT vp;
+    vp.TopLeftX = viewport.x;
+    vp.TopLeftY = viewport.y;
+    vp.Width = viewport.width;
+    vp.Height = viewport.height;
+    vp.MinDepth = viewport.minDepth;
+    vp.MaxDepth = viewport.maxDepth;
+    m_pContext->RSSetViewports(1, &vp);
+}
+
+void D3D11RenderContext::SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset)
+{
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(buffer);
+    m_pContext->IASetVertexBuffers(0, 1, &pBuffer, &stride, &offset);
+}
+
+void D3D11RenderContext::SetIndexBuffer(RenderHandle buffer, Format format)
+{
+    m_pContext->IASetIndexBuffer(m_pOwner->Get<ID3D11Buffer>(buffer), ToDXGI(format), 0);
+}
+
+void D3D11RenderContext::SetInputLayout(RenderHandle layout)
+{
+    m_pContext->IASetInputLayout(m_pOwner->Get<ID3D11InputLayout>(layout));
+}
+
+void D3D11RenderContext::SetPrimitiveTopology(PrimitiveTopology topology)
+{
+    m_pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+
+void D3D11RenderContext::SetShader(ShaderStage stage, RenderHandle shader)
+{
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+        m_pContext->VSSetShader(m_pOwner->Get<ID3D11VertexShader>(shader), nullptr, 0);
+        break;
+    case ShaderStage::Pixel:
+        m_pContext->PSSetShader(m_pOwner->Get<ID3D11PixelShader>(shader), nullptr, 0);
+        break;
+    case ShaderStage::Compute:
+        m_pContext->CSSetShader(m_pOwner->Get<ID3D11ComputeShader>(shader), nullptr, 0);
+        break;
+    }
+}
+
+void D3D11RenderContext::SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer)
+{
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(buffer);
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+        m_pContext->VSSetConstantBuffers(slot, 1, &pBuffer);
+        break;
+    case ShaderStage::Pixel:
+        m_pContext->PSSetConstantBuffers(slot, 1, &pBuffer);
+        break;
+    case ShaderStage::Compute:
+        m_pContext->CSSetConstantBuffers(slot, 1, &pBuffer);
+        break;
+    }
+}
+
+void D3D11RenderContext::SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize)
+{
+    ID3D11Buffer* pBuffer = m_pOwner->Get<ID3D11Buffer>(buffer);
+
+    // counted in shader constants, 16 bytes each
+    UINT firstConstant = byteOffset / 16;
+    UINT constantCount = byteSize / 16;
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+        m_pContext1->VSSetConstantBuffers1(slot, 1, &pBuffer, &firstConstant, &constantCount);
+        break;
+    case ShaderStage::Pixel:
+        m_pContext1->PSSetConstantBuffers1(slot, 1, &pBuffer, &firstConstant, &constantCount);
+        break;
+    case ShaderStage::Compute:
+        m_pContext1->CSSetConstantBuffers1(slot, 1, &pBuffer, &firstConstant, &constantCount);
+        break;
+    }
+}
+
+void D3D11RenderContext::SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource)
+{
+    D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(resource);
+    ID3D11ShaderResourceView* pSRV = pObject ? pObject->pSRV : nullptr;
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+        m_pContext->VSSetShaderResources(slot, 1, &pSRV);
+        break;
+    case ShaderStage::Pixel:
+        m_pContext->PSSetShaderResources(slot, 1, &pSRV);
+        break;
+    case ShaderStage::Compute:
+        m_pContext->CSSetShaderResources(slot, 1, &pSRV);
+        break;
+    }
+}
+
+void D3D11RenderContext::SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler)
+{
+    ID3D11SamplerState* pSampler = m_pOwner->Get<ID3D11SamplerState>(sampler);
+    switch (stage)
+    {
+    case ShaderStage::Vertex:
+        m_pContext->VSSetSamplers(slot, 1, &pSampler);
+        break;
+    case ShaderStage::Pixel:
+        m_pContext->PSSetSamplers(slot, 1, &pSampler);
+        break;
+    case ShaderStage::Compute:
+        m_pContext->CSSetSamplers(slot, 1, &pSampler);
+        break;
+    }
+}
+
+void D3D11RenderContext::SetUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    D3D11RenderDevice::Object* pObject = m_pOwner->Lookup(resource);
+    ID3D11UnorderedAccessView* pUAV = pObject ? pObject->pUAV : nullptr;
+    m_pContext->CSSetUnorderedAccessViews(slot, 1, &pUAV, nullptr);
+}
+
+void D3D11RenderContext::SetPixelUnorderedAccess(UINT slot, RenderHandle resource)
+{
+    if (slot >= D3D11_PS_CS_UAV_REGISTER_COUNT)
+        return;
+
+    m_pixelUavs[slot] = resource;
+    BindOutputs();
+}
+
+// Never equal to a real handle, forces the next Set*State call through
+static const RenderHandle UnknownState = ~0u;
+
+void D3D11RenderContext::SetRasterizerState(RenderHandle state)
+{
+    if (state == m_rasterizerState)
+    {
+        m_stats.elidedStateChanges++;
+        return;
+    }
+
+    m_pContext->RSSetState(m_pOwner->Get<ID3D11RasterizerState>(state));
+    m_rasterizerState = state;
+    m_stats.stateChanges++;
+}
+
+void D3D11RenderContext::SetDepthStencilState(RenderHandle state)
+{
+    if (state == m_depthStencilState)
+    {
+        m_stats.elidedStateChanges++;
+        return;
+    }
+
+    m_pContext->OMSetDepthStencilState(m_pOwner->Get<ID3D11DepthStencilState>(state), 0);
+    m_depthStencilState = state;
+    m_stats.stateChanges++;
+}
+
+void D3D11RenderContext::SetBlendState(RenderHandle state)
+{
+    if (state == m_blendState)
+    {
+        m_stats.elidedStateChanges++;
+        return;
+    }
+
+    m_pContext->OMSetBlendState(m_pOwner->Get<ID3D11BlendState>(state), nullptr, 0xFFFFFFFF);
+    m_blendState = state;
+    m_stats.stateChanges++;
+}
+
+void D3D11RenderContext::ForgetState(RenderHandle handle)
+{
+    if (m_rasterizerState == handle)
+        m_rasterizerState = UnknownState;
+    if (m_depthStencilState == handle)
+        m_depthStencilState = UnknownState;
+    if (m_blendState == handle)
+        m_blendState = UnknownState;
+
+    for (UINT i = 0; i < MaxRenderTargets; i++)
+    {
+        if (m_renderTargets[i] == handle)
+            m_renderTargets[i] = NullHandle;
+    }
+    if (m_depthTarget == handle)
+        m_depthTarget = NullHandle;
+    for (UINT slot = 0; slot < D3D11_PS_CS_UAV_REGISTER_COUNT; slot++)
+    {
+        if (m_pixelUavs[slot] == handle)
+            m_pixelUavs[slot] = NullHandle;
+    }
+}
+
+void D3D11RenderContext::Draw(UINT vertexCount, UINT startVertex)
+{
+    m_pContext->Draw(vertexCount, startVertex);
+    m_stats.drawCalls++;
+    m_stats.instances++;
+    m_stats.triangles += vertexCount / 3;
+}
+
+void D3D11RenderContext::DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex)
+{
+    m_pContext->DrawIndexed(indexCount, startIndex, baseVertex);
+    m_stats.drawCalls++;
+    m_stats.instances++;
+    m_stats.triangles += indexCount / 3;
+}
+
+void D3D11RenderContext::DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance)
+{
+    m_pContext->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+    m_stats.drawCalls++;
+    m_stats.instances += instanceCount;
+    m_stats.triangles += (UINT64)(indexCount / 3) * instanceCount;
+}
+
+void D3D11RenderContext::DrawIndexedInstancedIndirect(RenderHandle args, UINT offset)
+{
+    m_pContext->DrawIndexedInstancedIndirect(m_pOwner->Get<ID3D11Buffer>(args), offset);
+    m_stats.drawCalls++;
+}
+
+void D3D11RenderContext::Dispatch(UINT x, UINT y, UINT z)
+{
+    m_pContext->Dispatch(x, y, z);
+    m_stats.dispatches++;
+}
+
+void D3D11RenderContext::ClearState()
+{
+    m_pContext->ClearState();
+    m_rasterizerState = NullHandle;
+    m_depthStencilState = NullHandle;
+    m_blendState = NullHandle;
+    ResetOutputs();
+}
+
+void D3D11RenderContext::BeginQuery(RenderHandle query)
+{
+    ID3D11Query* pQuery = m_pOwner->Get<ID3D11Query>(query);
+    if (pQuery)
+        m_pContext->Begin(pQuery);
+}
+
+void D3D11RenderContext::EndQuery(RenderHandle query)
+{
+    ID3D11Query* pQuery = m_pOwner->Get<ID3D11Query>(query);
+    if (pQuery)
+        m_pContext->End(pQuery);
+}
+
+HRESULT D3D11RenderContext::TryGetQueryData(RenderHandle query, UINT64* pData)
+{
+    ID3D11Query* pQuery = m_pOwner->Get<ID3D11Query>(query);
+    if (!pQuery)
+        return E_INVALIDARG;
+    if (m_ownsContext)
+        return DXGI_ERROR_INVALID_CALL;
+
+    // DONOTFLUSH: Present flushes anyway, asking must not cost a flush
+    D3D11_QUERY_DESC queryDesc;
+    pQuery->GetDesc(&queryDesc);
+    if (queryDesc.Query == D3D11_QUERY_TIMESTAMP_DISJOINT)
+    {
+        D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+        HRESULT result = m_pContext->GetData(pQuery, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+        if (result != S_OK)
+            return result;
+        *pData = disjoint.Disjoint ? 0 : disjoint.Frequency;
+        return S_OK;
+    }
+    return m_pContext->GetData(pQuery, pData, sizeof(UINT64), D3D11_ASYNC_GETDATA_DONOTFLUSH);
+}
+
+HRESULT D3D11RenderContext::FinishCommandList()
+{
+    // a list that was never executed is dropped
+    if (m_pCommandList)
+    {
+        m_pCommandList->Release();
+        m_pCommandList = nullptr;
+    }
+
+    // FALSE: the next list starts from the default state like the first one
+    HRESULT result = m_pContext->FinishCommandList(FALSE, &m_pCommandList);
+    m_rasterizerState = NullHandle;
+    m_depthStencilState = NullHandle;
+    m_blendState = NullHandle;
+    ResetOutputs();
+
+    m_listStats = m_stats;
+    m_stats = RenderStats();
+    return result;
+}
+
+void D3D11RenderContext::ExecuteCommandList(RenderContext* pDeferred)
+{
+    D3D11RenderContext* pList = static_cast<D3D11RenderContext*>(pDeferred);
+    if (!pList->m_pCommandList)
+        return;
+
+    // FALSE: the immediate context is reset instead of restored afterwards
+    m_pContext->ExecuteCommandList(pList->m_pCommandList, FALSE);
+    m_rasterizerState = NullHandle;
+    m_depthStencilState = NullHandle;
+    m_blendState = NullHandle;
+    ResetOutputs();
+
+    pList->m_pCommandList->Release();
+    pList->m_pCommandList = nullptr;
+    m_stats += pList->m_listStats;
+}
@@ -0,0 +1,203 @@
+#ifndef D3D11_BACKEND_H
+#define D3D11_BACKEND_H
+
+#include <dxgi.h>
+#include <d3d11_1.h>
+#include <vector>
+
+#include "RenderBackend.h"
+#include "ShaderCache.h"
+
+class D3D11RenderDevice;
+
+// Compiles the shader with the profile of its stage and the flags of the
+// build, or loads its bytecode from pCache when the cache has it. Misses are
+// stored in the cache. Needs no device, the offline pack step uses it too.
+HRESULT CompileD3D11Shader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount,
+    ShaderCache* pCache, ID3DBlob** ppCode);
+
+class D3D11RenderContext : public RenderContext
+{
+public:
+    // Deferred contexts are owned, the immediate context belongs to the device
+    D3D11RenderContext(D3D11RenderDevice* pOwner, ID3D11DeviceContext* pContext, ID3D11DeviceContext1* pContext1, bool ownsContext = false) :
+        m_pOwner(pOwner),
+        m_pContext(pContext),
+        m_pContext1(pContext1),
+        m_ownsContext(ownsContext),
+        m_pCommandList(nullptr),
+        m_rasterizerState(NullHandle),
+        m_depthStencilState(NullHandle),
+        m_blendState(NullHandle)
+    {}
+    ~D3D11RenderContext();
+
+    using RenderContext::Map;
+    HRESULT Map(RenderHandle buffer, MapMode mode, void** ppData) override;
+    void Unmap(RenderHandle buffer) override;
+    void UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize) override;
+    void UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize) override;
+    HRESULT ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize) override;
+    HRESULT TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize) override;
+    void CopyResource(RenderHandle dst, RenderHandle src) override;
+
+    void ClearRenderTarget(RenderHandle target, const float color[4]) override;
+    void ClearDepth(RenderHandle depth, float value) override;
+    void ClearUnorderedAccess(RenderHandle resource, const UINT values[4]) override;
+    using RenderContext::SetRenderTargets;
+    void SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth) override;
+    void SetViewport(const Viewport& viewport) override;
+
+    void SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset) override;
+    void SetIndexBuffer(RenderHandle buffer, Format format) override;
+    void SetInputLayout(RenderHandle layout) override;
+    void SetPrimitiveTopology(PrimitiveTopology topology) override;
+
+    void SetShader(ShaderStage stage, RenderHandle shader) override;
+    void SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer) override;
+    void SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize) override;
+    void SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource) override;
+    void SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler) override;
+    void SetUnorderedAccess(UINT slot, RenderHandle resource) override;
+    void SetPixelUnorderedAccess(UINT slot, RenderHandle resource) override;
+
+    void SetRasterizerState(RenderHandle state) override;
+    void SetDepthStencilState(RenderHandle state) override;
+    void SetBlendState(RenderHandle state) override;
+
+    void Draw(UINT vertexCount, UINT startVertex) override;
+    void DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex) override;
+    void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance) override;
+    void DrawIndexedInstancedIndirect(RenderHandle args, UINT offset) override;
+    void Dispatch(UINT x, UINT y, UINT z) override;
+
+    void ClearState() override;
+
+    void BeginQuery(RenderHandle query) override;
+    void EndQuery(RenderHandle query) override;
+    HRESULT TryGetQueryData(RenderHandle query, UINT64* pData) override;
+
+    HRESULT FinishCommandList() override;
+    void ExecuteCommandList(RenderContext* pDeferred) override;
+
+    ID3D11DeviceContext* GetD3DContext() const { return m_pContext; }
+
+    // Called when a handle is released, so a new object reusing it is not mistaken for the bound one
+    void ForgetState(RenderHandle handle);
+
+private:
+    // Render targets and pixel UAVs are bound together, so both are kept
+    void BindOutputs();
+    void ResetOutputs();
+
+    D3D11RenderDevice* m_pOwner;
+    ID3D11DeviceContext* m_pContext;
+    ID3D11DeviceContext1* m_pContext1;  // *SetConstantBuffers1
+    bool m_ownsContext;
+
+    ID3D11CommandList* m_pCommandList;  // finished, not yet executed
+    RenderStats m_listStats;            // of m_pCommandList
+
+    // last bound state objects, redundant RSSetState/OMSet* calls are skipped
+    RenderHandle m_rasterizerState;
+    RenderHandle m_depthStencilState;
+    RenderHandle m_blendState;
+
+    RenderHandle m_renderTargets[MaxRenderTargets] = {};
+    UINT m_renderTargetCount = 0;
+    RenderHandle m_depthTarget = NullHandle;
+    RenderHandle m_pixelUavs[D3D11_PS_CS_UAV_REGISTER_COUNT] = {};
+};
+
+class D3D11RenderDevice : public RenderDevice
+{
+public:
+    D3D11RenderDevice() :
+        m_pDevice(nullptr),
+        m_pDeviceContext(nullptr),
+        m_pDeviceContext1(nullptr),
+        m_pSwapChain(nullptr),
+        m_pImmediateContext(nullptr),
+        m_backBuffer(NullHandle)
+    {}
+
+    HRESULT Init(HWND hWnd);
+    void Terminate();
+
+    HRESULT CreateBuffer(const BufferDesc& desc, const void* pInitData, RenderHandle* pBuffer) override;
+    HRESULT CreateTexture(const TextureDesc& desc, const SubresourceData* pInitData, RenderHandle* pTexture) override;
+    HRESULT CreateTextureFromFile(const std::wstring& path, RenderHandle* pTexture) override;
+    HRESULT CreateTextureArrayFromFiles(const std::wstring* paths, UINT count, RenderHandle* pTexture) override;
+    HRESULT CreateTextureFromMemory(const BYTE* pData, size_t byteSize, RenderHandle* pTexture) override;
+    HRESULT CreateTextureArrayFromMemory(const BYTE* const* ppData, const size_t* byteSizes, UINT count, RenderHandle* pTexture) override;
+
+    using RenderDevice::CreateShader;
+    HRESULT CreateShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount, RenderHandle* pShader) override;
+    HRESULT CreateInputLayout(const InputElement* elements, UINT count, RenderHandle vertexShader, RenderHandle* pLayout) override;
+
+    HRESULT CreateRasterizerState(const RasterizerDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateBlendState(const BlendDesc& desc, RenderHandle* pState) override;
+    HRESULT CreateSamplerState(const SamplerDesc& desc, RenderHandle* pSampler) override;
+    HRESULT CreateQuery(QueryType type, RenderHandle* pQuery) override;
+
+    void Release(RenderHandle handle) override;
+    void ReplaceResource(RenderHandle target, RenderHandle source) override;
+
+    RenderContext* GetImmediateContext() override { return m_pImmediateContext; }
+    HRESULT CreateDeferredContext(RenderContext** ppContext) override;
+
+    RenderHandle GetBackBuffer() override { return m_backBuffer; }
+    HRESULT ResizeBackBuffer(UINT width, UINT height) override;
+    void Present(UINT syncInterval) override;
+
+    // Raw access for code that has no neutral equivalent (ImGui renderer)
+    ID3D11Device* GetD3DDevice() const { return m_pDevice; }
+    ID3D11DeviceContext* GetD3DContext() const { return m_pDeviceContext; }
+
+    const ShaderCacheStats& GetShaderCacheStats() const { return m_shaderCache.GetStats(); }
+
+private:
+    friend class D3D11RenderContext;
+
+    struct Object
+    {
+        ID3D11DeviceChild* pObject = nullptr;
+        ID3D11ShaderResourceView* pSRV = nullptr;
+        ID3D11UnorderedAccessView* pUAV = nullptr;
+        ID3D11RenderTargetView* pRTV = nullptr;
+        ID3D11DepthStencilView* pDSV = nullptr;
+        ID3DBlob* pCode = nullptr;
+        UINT byteWidth = 0;
+    };
+
+    HRESULT CreateTextureArray(std::vector<ID3D11Resource*>& textureResources, HRESULT result, RenderHandle* pTexture);
+
+    RenderHandle AddObject(const Object& object);
+    void ReleaseObject(Object& object);
+    Object* Lookup(RenderHandle handle);
+
+    template <typename T>
+    T* Get(RenderHandle handle)
+    {
+        Object* pObject = Lookup(handle);
+        return pObject ? static_cast<T*>(pObject->pObject) : nullptr;
+    }
+
+    HRESULT CreateBackBufferView();
+
+    ID3D11Device* m_pDevice;
+    ID3D11DeviceContext* m_pDeviceContext;
+    ID3D11DeviceContext1* m_pDeviceContext1;
+    IDXGISwapChain* m_pSwapChain;
+
+    D3D11RenderContext* m_pImmediateContext;
+    RenderHandle m_backBuffer;
+
+    std::vector<Object> m_objects;
+    std::vector<RenderHandle> m_freeHandles;
+
+    ShaderCache m_shaderCache;
+};
+
+#endif
@@ -0,0 +1,321 @@
+#include "DDSFile.h"
+
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    m_pData(other.m_pData),
+    m_size(other.m_size)
+{
+    other.m_pData = nullptr;
+    other.m_size = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(m_pData, other.m_pData);
+        std::swap(m_size, other.m_size);
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+HRESULT MappedFile::Open(const std::wstring& path)
+{
+    Close();
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return HRESULT_FROM_WIN32(GetLastError());
+
+    LARGE_INTEGER fileSize = {};
+    HRESULT result = GetFileSizeEx(file, &fileSize) ? S_OK : HRESULT_FROM_WIN32(GetLastError());
+    if (SUCCEEDED(result) && (fileSize.QuadPart == 0 || fileSize.HighPart != 0))
+        result = E_FAIL;
+
+    // the view keeps the mapping object alive, both handles can go right away
+    HANDLE mapping = nullptr;
+    if (SUCCEEDED(result))
+    {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            result = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(result))
+    {
+        m_pData = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!m_pData)
+            result = HRESULT_FROM_WIN32(GetLastError());
+        else
+            m_size = static_cast<size_t>(fileSize.QuadPart);
+    }
+
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+    return result;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    m_pData = nullptr;
+    m_size = 0;
+}
+#else
+HRESULT MappedFile::Open(const std::wstring& path)
+{
+    Close();
+
+    int file = open(std::string(path.begin(), path.end()).c_str(), O_RDONLY);
+    if (file < 0)
+        return E_FAIL;
+
+    struct stat info;
+    HRESULT result = fstat(file, &info) == 0 && info.st_size > 0 ? S_OK : E_FAIL;
+    if (SUCCEEDED(result))
+    {
+        void* pData = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        if (pData == MAP_FAILED)
+        {
+            result = E_FAIL;
+        }
+        else
+        {
+            m_pData = static_cast<const BYTE*>(pData);
+            m_size = static_cast<size_t>(info.st_size);
+        }
+    }
+
+    close(file);
+    return result;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+        munmap(const_cast<BYTE*>(m_pData), m_size);
+    m_pData = nullptr;
+    m_size = 0;
+}
+#endif
+
+void MappedFile::Prefetch(size_t offset, size_t size) const
+{
+    if (!m_pData || offset >= m_size)
+        return;
+    if (size > m_size - offset)
+        size = m_size - offset;
+
+    // the hints want page aligned addresses
+    const size_t PageSize = 4096;
+    size_t begin = offset & ~(PageSize - 1);
+    size_t end = offset + size;
+
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range = { const_cast<BYTE*>(m_pData + begin), end - begin };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise(const_cast<BYTE*>(m_pData + begin), end - begin, MADV_WILLNEED);
+#endif
+
+    // the hint is asynchronous, touching a byte of every page waits for it
+    volatile BYTE sink = 0;
+    for (size_t at = begin; at < end; at += PageSize)
+    {
+        sink += m_pData[at];
+    }
+    (void)sink;
+}
+
+namespace
+{
+    const UINT DDSMagic = 0x20534444;       // "DDS "
+    const UINT DDSHeaderSize = 4 + 124;     // magic + DDS_HEADER
+    const UINT DX10HeaderSize = 20;
+
+    UINT MakeFourCC(char a, char b, char c, char d)
+    {
+        return UINT(BYTE(a)) | UINT(BYTE(b)) << 8 | UINT(BYTE(c)) << 16 | UINT(BYTE(d)) << 24;
+    }
+
+    // DXGI_FORMAT of the legacy FourCC codes and RGB bit masks
+    UINT DXGIFormatFromLegacy(const UINT* header)
+    {
+        const UINT fourCC = header[21];
+        const UINT* masks = header + 23;
+        if (header[20] & 0x4)
+        {
+            if (fourCC == MakeFourCC('D', 'X', 'T', '1')) return 71;
+            if (fourCC == MakeFourCC('D', 'X', 'T', '2') || fourCC == MakeFourCC('D', 'X', 'T', '3')) return 74;
+            if (fourCC == MakeFourCC('D', 'X', 'T', '4') || fourCC == MakeFourCC('D', 'X', 'T', '5')) return 77;
+            if (fourCC == MakeFourCC('A', 'T', 'I', '1') || fourCC == MakeFourCC('B', 'C', '4', 'U')) return 80;
+            if (fourCC == MakeFourCC('A', 'T', 'I', '2') || fourCC == MakeFourCC('B', 'C', '5', 'U')) return 83;
+            return 0;
+        }
+        if ((header[20] & 0x40) && header[22] == 32)
+        {
+            if (masks[0] == 0xFF && masks[1] == 0xFF00 && masks[2] == 0xFF0000 && masks[3] == 0xFF000000) return 28;
+            if (masks[0] == 0xFF0000 && masks[1] == 0xFF00 && masks[2] == 0xFF && masks[3] == 0xFF000000) return 87;
+            if (masks[0] == 0xFF0000 && masks[1] == 0xFF00 && masks[2] == 0xFF && masks[3] == 0) return 88;
+        }
+        return 0;
+    }
+
+    // Bytes per 4x4 block for block compressed formats, 0 otherwise
+    UINT BlockBytesFromFourCC(UINT fourCC)
+    {
+        if (fourCC == MakeFourCC('D', 'X', 'T', '1') || fourCC == MakeFourCC('A', 'T', 'I', '1') ||
+            fourCC == MakeFourCC('B', 'C', '4', 'U') || fourCC == MakeFourCC('B', 'C', '4', 'S'))
+            return 8;
+        if (fourCC == MakeFourCC('D', 'X', 'T', '2') || fourCC == MakeFourCC('D', 'X', 'T', '3') ||
+            fourCC == MakeFourCC('D', 'X', 'T', '4') || fourCC == MakeFourCC('D', 'X', 'T', '5') ||
+            fourCC == MakeFourCC('A', 'T', 'I', '2') || fourCC == MakeFourCC('B', 'C', '5', 'U') ||
+            fourCC == MakeFourCC('B', 'C', '5', 'S'))
+            return 16;
+        return 0;
+    }
+
+    // Bits per texel (blockBytes = 0) or bytes per block of a DXGI_FORMAT
+    // value, 0 for formats the lab does not use
+    void FormatSizeFromDXGI(UINT format, UINT& bitsPerTexel, UINT& blockBytes)
+    {
+        bitsPerTexel = 0;
+        blockBytes = 0;
+        switch (format)
+        {
+        case 2:                                     // R32G32B32A32_FLOAT
+            bitsPerTexel = 128; break;
+        case 10: case 11:                           // R16G16B16A16_FLOAT, _UNORM
+            bitsPerTexel = 64; break;
+        case 24: case 26:                           // R10G10B10A2_UNORM, R11G11B10_FLOAT
+        case 27: case 28: case 29:                  // R8G8B8A8
+        case 87: case 88: case 90: case 91:         // B8G8R8A8, B8G8R8X8
+            bitsPerTexel = 32; break;
+        case 61:                                    // R8_UNORM
+            bitsPerTexel = 8; break;
+        case 70: case 71: case 72:                  // BC1
+        case 79: case 80: case 81:                  // BC4
+            blockBytes = 8; break;
+        case 73: case 74: case 75:                  // BC2
+        case 76: case 77: case 78:                  // BC3
+        case 82: case 83: case 84:                  // BC5
+        case 94: case 95: case 96:                  // BC6H
+        case 97: case 98: case 99:                  // BC7
+            blockBytes = 16; break;
+        }
+    }
+}
+
+HRESULT GetDDSLayout(const BYTE* pData, size_t byteSize, DDSLayout& layout)
+{
+    layout = DDSLayout();
+
+    UINT header[DDSHeaderSize / 4];
+    if (!pData || byteSize < DDSHeaderSize)
+        return E_FAIL;
+    memcpy(header, pData, sizeof(header));
+    if (header[0] != DDSMagic || header[1] != 124 || header[19] != 32)
+        return E_FAIL;
+
+    layout.height = header[3];
+    layout.width = header[4];
+    layout.mipLevels = header[7] ? header[7] : 1;
+    layout.arraySize = 1;
+    if (!layout.width || !layout.height || layout.mipLevels > 16)
+        return E_FAIL;
+
+    const UINT pixelFormatFlags = header[20];
+    const UINT fourCC = header[21];
+    size_t offset = DDSHeaderSize;
+
+    UINT bitsPerTexel = 0;
+    UINT blockBytes = 0;
+    if ((pixelFormatFlags & 0x4) && fourCC == MakeFourCC('D', 'X', '1', '0'))
+    {
+        UINT dx10[DX10HeaderSize / 4];
+        if (byteSize < DDSHeaderSize + DX10HeaderSize)
+            return E_FAIL;
+        memcpy(dx10, pData + DDSHeaderSize, sizeof(dx10));
+        offset += DX10HeaderSize;
+
+        // resourceDimension 3 is TEXTURE2D, 1D and 3D textures are not used here
+        if (dx10[1] != 3 || dx10[3] == 0)
+            return E_NOTIMPL;
+        FormatSizeFromDXGI(dx10[0], bitsPerTexel, blockBytes);
+        layout.dxgiFormat = dx10[0];
+        layout.cube = (dx10[2] & 0x4) != 0;
+        layout.arraySize = dx10[3] * (layout.cube ? 6 : 1);
+    }
+    else
+    {
+        if (header[28] & 0x200000)          // DDSCAPS2_VOLUME
+            return E_NOTIMPL;
+        layout.dxgiFormat = DXGIFormatFromLegacy(header);
+        if (pixelFormatFlags & 0x4)
+            blockBytes = BlockBytesFromFourCC(fourCC);
+        else if (pixelFormatFlags & (0x40 | 0x20000 | 0x2))     // RGB, LUMINANCE, ALPHA
+            bitsPerTexel = header[22];
+
+        if (header[28] & 0x200)             // DDSCAPS2_CUBEMAP
+        {
+            // partial cube maps are not supported by D3D11 either
+            if ((header[28] & 0xFE00) != 0xFE00)
+                return E_NOTIMPL;
+            layout.cube = true;
+            layout.arraySize = 6;
+        }
+    }
+
+    if (!bitsPerTexel && !blockBytes)
+        return E_NOTIMPL;
+    layout.blockCompressed = blockBytes != 0;
+
+    layout.subresources.reserve(static_cast<size_t>(layout.mipLevels) * layout.arraySize);
+    for (UINT slice = 0; slice < layout.arraySize; slice++)
+    {
+        UINT width = layout.width;
+        UINT height = layout.height;
+        for (UINT mip = 0; mip < layout.mipLevels; mip++)
+        {
+            DDSSubresource subresource;
+            subresource.width = width;
+            subresource.height = height;
+            UINT rows;
+            if (blockBytes)
+            {
+                subresource.rowPitch = ((width + 3) / 4) * blockBytes;
+                rows = (height + 3) / 4;
+            }
+            else
+            {
+                subresource.rowPitch = (width * bitsPerTexel + 7) / 8;
+                rows = height;
+            }
+            subresource.slicePitch = subresource.rowPitch * rows;
+
+            if (byteSize - offset < subresource.slicePitch)
+                return E_FAIL;
+            subresource.pData = pData + offset;
+            offset += subresource.slicePitch;
+            layout.subresources.push_back(subresource);
+
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+    }
+    return S_OK;
+}
@@ -0,0 +1,68 @@
+#ifndef DDS_FILE_H
+#define DDS_FILE_H
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+
+// Read-only view of a whole file mapped into the address space (a file
+// mapping on Windows, mmap elsewhere). Texture data handed to the device
+// points straight into the mapping instead of a heap copy of the file, and
+// the pages go back to the page cache once the mapping is closed.
+class MappedFile
+{
+public:
+    MappedFile() : m_pData(nullptr), m_size(0) {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    HRESULT Open(const std::wstring& path);
+    void Close();
+
+    // Faults every page in, so the disk reads happen on the calling thread
+    // rather than wherever the data is first used
+    void Prefetch() const { Prefetch(0, m_size); }
+    void Prefetch(size_t offset, size_t size) const;
+
+    const BYTE* GetData() const { return m_pData; }
+    size_t GetSize() const { return m_size; }
+
+private:
+    const BYTE* m_pData;
+    size_t m_size;
+};
+
+// One mip of one array slice (or cube face), in the order of
+// D3D11CalcSubresource: every mip of slice 0, then slice 1 and so on
+struct DDSSubresource
+{
+    const BYTE* pData;
+    UINT width;
+    UINT height;
+    UINT rowPitch;      // bytes per row of texels, or of 4x4 blocks
+    UINT slicePitch;
+};
+
+struct DDSLayout
+{
+    UINT width = 0;
+    UINT height = 0;
+    UINT mipLevels = 0;
+    UINT arraySize = 0;     // cube maps count six slices per cube
+    bool cube = false;
+    bool blockCompressed = false;
+    UINT dxgiFormat = 0;    // DXGI_FORMAT value, 0 when it has no DXGI equivalent
+    std::vector<DDSSubresource> subresources;
+};
+
+// Parses the header of a DDS file in memory and locates every subresource,
+// the same walk FillInitData in DDSTextureLoader11.cpp does. Fails on
+// truncated files, volume textures and formats the lab does not use.
+HRESULT GetDDSLayout(const BYTE* pData, size_t byteSize, DDSLayout& layout);
+
+#endif
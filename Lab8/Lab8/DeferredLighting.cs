@@ -0,0 +1,142 @@
+// The lights of deferred shading, over the G-buffer GBufferPixel.ps wrote.
+// A group takes a tile of the screen: it finds the depth range of the
+// tile's cubes, then takes the lights a batch at a time, one per thread,
+// lists the ones whose sphere touches the view space box around that part
+// of the frustum and every pixel shades the list the way ColorPixel.ps does. Pixels the cubes left keep the sky. With SHADOWS the
+// lights that have a slot in the shadow atlas are occluded.
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+
+#include "LightClusters.hlsli"
+#include "GBuffer.hlsli"
+#if SHADOWS
+#include "Shadows.hlsli"
+#endif
+
+#define TILE_SIZE 16
+#define BATCH_SIZE (TILE_SIZE * TILE_SIZE)
+
+cbuffer DeferredConstants : register(b0)
+{
+    float4x4 invViewProj;
+    float4x4 view;
+    float3 cameraPos;
+    uint lightCount;        // lights 0 to lightCount - 1 of the buffer may reach a tile
+    uint2 screenSize;
+    float2 projScale;       // view x and y over z at the edges of the screen
+    float2 depthParams;     // view z = y / (depth - x)
+    float2 padding;
+};
+
+Texture2D<float4> albedoBuffer : register(t0);
+Texture2D<float4> normalBuffer : register(t1);
+StructuredBuffer<PointLight> lightData : register(t2);
+Texture2D<float> depthBuffer : register(t3);
+RWTexture2D<unorm float4> sceneColor : register(u0);
+
+groupshared uint tileMinDepth;
+groupshared uint tileMaxDepth;
+groupshared uint tileLightCount;
+groupshared uint tileLights[BATCH_SIZE];
+
+bool SphereIntersectsBounds(float4 light, float3 boundsMin, float3 boundsMax)
+{
+    float3 d = max(max(boundsMin - light.xyz, 0.0f), light.xyz - boundsMax);
+    return dot(d, d) <= light.w * light.w;
+}
+
+[numthreads(TILE_SIZE, TILE_SIZE, 1)]
+void main(uint3 groupID : SV_GroupID, uint3 threadID : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    if (groupIndex == 0)
+    {
+        tileMinDepth = asuint(1.0f);
+        tileMaxDepth = 0;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    // depths are positive, so their bits order like them; the sky is left out
+    uint2 pixel = threadID.xy;
+    float depth = all(pixel < screenSize) ? depthBuffer.Load(int3(pixel, 0)) : 1.0f;
+    bool covered = depth < 1.0f;
+    if (covered)
+    {
+        InterlockedMin(tileMinDepth, asuint(depth));
+        InterlockedMax(tileMaxDepth, asuint(depth));
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (tileMaxDepth == 0)
+        return;
+
+    // a view space x over z of the tile is largest on the near or the far plane
+    float nearZ = depthParams.y / (asfloat(tileMinDepth) - depthParams.x);
+    float farZ = depthParams.y / (asfloat(tileMaxDepth) - depthParams.x);
+    float2 tileMin = float2(groupID.xy * TILE_SIZE) / screenSize;
+    float2 tileMax = float2((groupID.xy + 1) * TILE_SIZE) / screenSize;
+    float2 slopeMin = float2(tileMin.x * 2.0f - 1.0f, 1.0f - tileMax.y * 2.0f) / projScale;
+    float2 slopeMax = float2(tileMax.x * 2.0f - 1.0f, 1.0f - tileMin.y * 2.0f) / projScale;
+    float3 boundsMin = float3(min(slopeMin * nearZ, slopeMin * farZ), nearZ);
+    float3 boundsMax = float3(max(slopeMax * nearZ, slopeMax * farZ), farZ);
+
+    float4 normals = normalBuffer.Load(int3(pixel, 0));
+    float3 normal = DecodeNormal(normals.xy);
+#if SHADOWS
+    float3 surfaceNormal = DecodeNormal(normals.zw);
+#endif
+    float3 albedo = albedoBuffer.Load(int3(pixel, 0)).rgb;
+
+    float2 ndc = float2((pixel.x + 0.5f) / screenSize.x * 2.0f - 1.0f, 1.0f - (pixel.y + 0.5f) / screenSize.y * 2.0f);
+    float4 position = mul(float4(ndc, depth, 1.0f), invViewProj);
+    float3 worldPos = position.xyz / position.w;
+
+    float3 viewDir = normalize(cameraPos - worldPos);
+    float3 lightColor = float3(0.0f, 0.0f, 0.0f);
+    for (uint first = 0; first < lightCount; first += BATCH_SIZE)
+    {
+        if (groupIndex == 0)
+            tileLightCount = 0;
+        GroupMemoryBarrierWithGroupSync();
+
+        uint index = first + groupIndex;
+        if (index < lightCount)
+        {
+            PointLight light = lightData[index];
+            float4 viewLight = float4(mul(float4(light.Position, 1.0f), view).xyz, light.Range);
+            if (SphereIntersectsBounds(viewLight, boundsMin, boundsMax))
+            {
+                uint slot;
+                InterlockedAdd(tileLightCount, 1, slot);
+                tileLights[slot] = index;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        for (uint i = 0; i < tileLightCount && covered; i++)
+        {
+            uint lightIndex = tileLights[i];
+            PointLight light = lightData[lightIndex];
+            float3 lightDir = normalize(light.Position - worldPos);
+            float distance = length(light.Position - worldPos);
+            // most lights of the tile end short of the pixel
+            if (distance >= light.Range)
+                continue;
+            float attenuation = 1.0 - saturate(distance / light.Range);
+#if SHADOWS
+            if (attenuation > 0.0f)
+                attenuation *= GetShadow(lightIndex, worldPos, surfaceNormal);
+#endif
+            float diff = max(dot(normal, lightDir), 0.0f);
+            float3 diffuse = light.Color * diff * light.Intensity * attenuation;
+            float3 halfwayDir = normalize(lightDir + viewDir);
+            float spec = pow(max(dot(normal, halfwayDir), 0.0f), 32.0f);
+            float3 specular = light.Color * spec * light.Intensity * attenuation;
+            lightColor += diffuse + specular;
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (covered)
+        sceneColor[pixel] = float4(albedo * lightColor, 1.0f);
+}
\ No newline at end of file
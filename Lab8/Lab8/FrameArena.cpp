@@ -0,0 +1,69 @@
+#include "FrameArena.h"
+
+#include <cstdint>
+
+FrameArena::FrameArena(size_t initialSize) :
+    m_offset(0),
+    m_frameBytes(0),
+    m_blockAllocations(0)
+{
+    m_blocks.reserve(8);
+    AddBlock(initialSize);
+}
+
+void FrameArena::AddBlock(size_t byteSize)
+{
+    // room to align the start of the block
+    m_blocks.emplace_back(byteSize + Alignment);
+    m_offset = 0;
+    m_blockAllocations++;
+}
+
+void FrameArena::Reset()
+{
+    if (m_blocks.size() > 1)
+    {
+        size_t capacity = GetCapacity();
+        if (capacity < m_frameBytes)
+            capacity = m_frameBytes;
+
+        m_blocks.clear();
+        AddBlock(capacity);
+    }
+
+    m_offset = 0;
+    m_frameBytes = 0;
+}
+
+void* FrameArena::Allocate(size_t byteSize)
+{
+    std::vector<BYTE>* pBlock = &m_blocks.back();
+    uintptr_t base = reinterpret_cast<uintptr_t>(pBlock->data());
+    size_t start = ((base + m_offset + Alignment - 1) & ~(Alignment - 1)) - base;
+
+    if (start + byteSize > pBlock->size())
+    {
+        size_t size = pBlock->size() * 2;
+        if (size < byteSize)
+            size = byteSize;
+        AddBlock(size);
+
+        pBlock = &m_blocks.back();
+        base = reinterpret_cast<uintptr_t>(pBlock->data());
+        start = ((base + Alignment - 1) & ~(Alignment - 1)) - base;
+    }
+
+    m_frameBytes += start - m_offset + byteSize;
+    m_offset = start + byteSize;
+    return pBlock->data() + start;
+}
+
+size_t FrameArena::GetCapacity() const
+{
+    size_t capacity = 0;
+    for (const std::vector<BYTE>& block : m_blocks)
+    {
+        capacity += block.size() - Alignment;
+    }
+    return capacity;
+}
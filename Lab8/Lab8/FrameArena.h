@@ -0,0 +1,46 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <vector>
+
+#include "Platform.h"
+
+// Linear allocator for temporary CPU arrays that only live for one frame.
+// Reset() drops everything at once. A frame that outgrows the current block
+// gets extra blocks, and the next Reset() merges them into one, so once the
+// working set is known the arena no longer touches the heap.
+class FrameArena
+{
+public:
+    static const size_t Alignment = 64;
+
+    explicit FrameArena(size_t initialSize = 64 * 1024);
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void Reset();
+
+    // Uninitialized, aligned to Alignment, valid until the next Reset()
+    void* Allocate(size_t byteSize);
+
+    template <typename T>
+    T* Allocate(size_t count)
+    {
+        return static_cast<T*>(Allocate(sizeof(T) * count));
+    }
+
+    size_t GetCapacity() const;
+    // Blocks taken from the heap since construction
+    UINT GetBlockAllocations() const { return m_blockAllocations; }
+
+private:
+    void AddBlock(size_t byteSize);
+
+    std::vector<std::vector<BYTE>> m_blocks;
+    size_t m_offset;        // in the last block
+    size_t m_frameBytes;    // handed out since Reset(), including alignment
+    UINT m_blockAllocations;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "FrameRecorder.h"
+
+#include <chrono>
+
+FrameRecorder::FrameRecorder() :
+    m_pDevice(nullptr),
+    m_useDeferred(true)
+{
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    Terminate();
+}
+
+HRESULT FrameRecorder::Init(RenderDevice* pDevice, UINT threadCount)
+{
+    m_pDevice = pDevice;
+    SetThreadCount(threadCount);
+    return S_OK;
+}
+
+void FrameRecorder::Terminate()
+{
+    ReleaseContexts();
+    m_pPool.reset();
+    m_pDevice = nullptr;
+}
+
+void FrameRecorder::SetThreadCount(UINT threadCount)
+{
+    m_pPool.reset();
+    m_pPool.reset(new ThreadPool(threadCount));
+}
+
+HRESULT FrameRecorder::ReserveContexts(UINT count)
+{
+    while (m_contexts.size() < count)
+    {
+        RenderContext* pContext = nullptr;
+        HRESULT result = m_pDevice->CreateDeferredContext(&pContext);
+        if (FAILED(result))
+            return result;
+        m_contexts.push_back(pContext);
+    }
+    return S_OK;
+}
+
+void FrameRecorder::ReleaseContexts()
+{
+    for (RenderContext* pContext : m_contexts)
+    {
+        delete pContext;
+    }
+    m_contexts.clear();
+}
+
+HRESULT FrameRecorder::Run(UINT passCount, RecordFunction function, const void* pRecordPass)
+{
+    RenderContext* pImmediate = m_pDevice->GetImmediateContext();
+    m_stats = FrameRecorderStats();
+    m_stats.passes = passCount;
+
+    HRESULT result = S_OK;
+    if (m_useDeferred)
+    {
+        result = ReserveContexts(passCount);
+        if (FAILED(result))
+            m_useDeferred = false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!m_useDeferred)
+    {
+        for (UINT pass = 0; pass < passCount; pass++)
+        {
+            function(pRecordPass, pass, pImmediate);
+        }
+        m_stats.recordSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    m_pPool->ParallelFor(passCount, [&](UINT pass, UINT)
+    {
+        RenderContext* pContext = m_contexts[pass];
+        function(pRecordPass, pass, pContext);
+        pContext->FinishCommandList();
+    });
+    auto recorded = std::chrono::steady_clock::now();
+
+    for (UINT pass = 0; pass < passCount; pass++)
+    {
+        pImmediate->ExecuteCommandList(m_contexts[pass]);
+    }
+
+    auto executed = std::chrono::steady_clock::now();
+    m_stats.recordSeconds = std::chrono::duration<double>(recorded - start).count();
+    m_stats.executeSeconds = std::chrono::duration<double>(executed - recorded).count();
+    return S_OK;
+}
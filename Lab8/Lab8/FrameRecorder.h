@@ -0,0 +1,76 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <memory>
+#include <vector>
+
+#include "RenderBackend.h"
+#include "ThreadPool.h"
+
+struct FrameRecorderStats
+{
+    UINT passes = 0;
+    double recordSeconds = 0.0;     // wall clock of recording every pass of the last frame
+    double executeSeconds = 0.0;    // executing their command lists, 0 when recorded serially
+};
+
+// Records the passes of a frame in parallel. Every pass has a deferred
+// context of its own, kept from frame to frame, and records into it on a
+// worker of the recorder's thread pool; the immediate context then executes
+// the command lists in pass order on the calling thread. With deferred
+// recording turned off, or without deferred contexts, the passes record
+// one after another straight into the immediate context.
+class FrameRecorder
+{
+public:
+    FrameRecorder();
+    ~FrameRecorder();
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    // threadCount includes the calling thread, 0 uses every hardware thread
+    HRESULT Init(RenderDevice* pDevice, UINT threadCount = 0);
+    void Terminate();
+
+    // Starts a new pool, for measuring how recording scales
+    void SetThreadCount(UINT threadCount);
+    UINT GetThreadCount() const { return m_pPool ? m_pPool->GetThreadCount() : 1; }
+
+    void SetUseDeferredContexts(bool useDeferred) { m_useDeferred = useDeferred; }
+    bool GetUseDeferredContexts() const { return m_useDeferred; }
+
+    // recordPass(pass, pContext) is called once for every pass in
+    // [0, passCount), from any thread when the passes record in parallel.
+    // Fails if the deferred contexts could not be created, the frame is
+    // then recorded serially.
+    template <typename RecordPass>
+    HRESULT Record(UINT passCount, const RecordPass& recordPass)
+    {
+        return Run(passCount, &CallRecordPass<RecordPass>, &recordPass);
+    }
+
+    const FrameRecorderStats& GetStats() const { return m_stats; }
+
+private:
+    typedef void (*RecordFunction)(const void* pRecordPass, UINT pass, RenderContext* pContext);
+
+    template <typename RecordPass>
+    static void CallRecordPass(const void* pRecordPass, UINT pass, RenderContext* pContext)
+    {
+        (*static_cast<const RecordPass*>(pRecordPass))(pass, pContext);
+    }
+
+    HRESULT Run(UINT passCount, RecordFunction function, const void* pRecordPass);
+    HRESULT ReserveContexts(UINT count);
+    void ReleaseContexts();
+
+    RenderDevice* m_pDevice;
+    std::unique_ptr<ThreadPool> m_pPool;
+    std::vector<RenderContext*> m_contexts;
+    bool m_useDeferred;
+
+    FrameRecorderStats m_stats;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "FrustumCulling.h"
+#include "CpuFeatures.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+using namespace DirectX;
+
+void CullingBounds::Clear()
+{
+    Resize(0);
+}
+
+void CullingBounds::Resize(UINT count)
+{
+    centerX.resize(count);
+    centerY.resize(count);
+    centerZ.resize(count);
+    extentX.resize(count);
+    extentY.resize(count);
+    extentZ.resize(count);
+}
+
+void CullingBounds::Add(const XMFLOAT3& center, const XMFLOAT3& extent)
+{
+    UINT index = GetCount();
+    Resize(index + 1);
+    Set(index, center, extent);
+}
+
+void CullingBounds::Set(UINT index, const XMFLOAT3& center, const XMFLOAT3& extent)
+{
+    centerX[index] = center.x;
+    centerY[index] = center.y;
+    centerZ[index] = center.z;
+    extentX[index] = extent.x;
+    extentY[index] = extent.y;
+    extentZ[index] = extent.z;
+}
+
+namespace
+{
+    // Plane components split up the same way as the bounds, with the absolute
+    // values of the normal precomputed for the projected box radius
+    struct CullingPlanes
+    {
+        float nx[6];
+        float ny[6];
+        float nz[6];
+        float d[6];
+        float absX[6];
+        float absY[6];
+        float absZ[6];
+    };
+
+    // Writes an index for every lane and only advances past the visible ones,
+    // so there is no branch per box. Never writes beyond first + lanes - 1.
+    inline UINT AppendVisible(UINT* visibleIndices, UINT visible, UINT first, UINT mask, UINT lanes)
+    {
+        for (UINT lane = 0; lane < lanes; lane++)
+        {
+            visibleIndices[visible] = first + lane;
+            visible += (mask >> lane) & 1;
+        }
+        return visible;
+    }
+
+    UINT CullScalar(const CullingPlanes& planes, const CullingBounds& bounds, UINT first, UINT* visibleIndices, UINT visible)
+    {
+        UINT count = bounds.GetCount();
+        for (UINT i = first; i < count; i++)
+        {
+            UINT inside = 1;
+            for (int p = 0; p < 6; p++)
+            {
+                float dist = (bounds.centerX[i] * planes.nx[p] + bounds.centerY[i] * planes.ny[p]) +
+                    (bounds.centerZ[i] * planes.nz[p] + planes.d[p]);
+                float radius = (bounds.extentX[i] * planes.absX[p] + bounds.extentY[i] * planes.absY[p]) +
+                    bounds.extentZ[i] * planes.absZ[p];
+                inside &= (dist + radius >= 0.0f) ? 1 : 0;
+            }
+            visibleIndices[visible] = i;
+            visible += inside;
+        }
+        return visible;
+    }
+
+#ifdef CPU_X86
+
+    CPU_TARGET("sse2")
+    UINT CullSSE(const CullingPlanes& planes, const CullingBounds& bounds, UINT* visibleIndices)
+    {
+        UINT count = bounds.GetCount();
+        UINT visible = 0;
+        UINT i = 0;
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 dist = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes.nx[p])), _mm_mul_ps(cy, _mm_set1_ps(planes.ny[p]))),
+                    _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes.nz[p])), _mm_set1_ps(planes.d[p])));
+                __m128 radius = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(planes.absX[p])), _mm_mul_ps(ey, _mm_set1_ps(planes.absY[p]))),
+                    _mm_mul_ps(ez, _mm_set1_ps(planes.absZ[p])));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(dist, radius), zero));
+            }
+
+            visible = AppendVisible(visibleIndices, visible, i, static_cast<UINT>(_mm_movemask_ps(inside)), 4);
+        }
+
+        return CullScalar(planes, bounds, i, visibleIndices, visible);
+    }
+
+    CPU_TARGET("avx2")
+    UINT CullAVX2(const CullingPlanes& planes, const CullingBounds& bounds, UINT* visibleIndices)
+    {
+        UINT count = bounds.GetCount();
+        UINT visible = 0;
+        UINT i = 0;
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+            __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+            for (int p = 0; p < 6; p++)
+            {
+                __m256 dist = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes.nx[p])), _mm256_mul_ps(cy, _mm256_set1_ps(planes.ny[p]))),
+                    _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(planes.nz[p])), _mm256_set1_ps(planes.d[p])));
+                __m256 radius = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(planes.absX[p])), _mm256_mul_ps(ey, _mm256_set1_ps(planes.absY[p]))),
+                    _mm256_mul_ps(ez, _mm256_set1_ps(planes.absZ[p])));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(dist, radius), zero, _CMP_GE_OQ));
+            }
+
+            visible = AppendVisible(visibleIndices, visible, i, static_cast<UINT>(_mm256_movemask_ps(inside)), 8);
+        }
+
+        return CullScalar(planes, bounds, i, visibleIndices, visible);
+    }
+
+    CPU_TARGET("avx512f")
+    UINT CullAVX512(const CullingPlanes& planes, const CullingBounds& bounds, UINT* visibleIndices)
+    {
+        UINT count = bounds.GetCount();
+        UINT visible = 0;
+        UINT i = 0;
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+        for (; i + 16 <= count; i += 16)
+        {
+            __m512 cx = _mm512_loadu_ps(&bounds.centerX[i]);
+            __m512 cy = _mm512_loadu_ps(&bounds.centerY[i]);
+            __m512 cz = _mm512_loadu_ps(&bounds.centerZ[i]);
+            __m512 ex = _mm512_loadu_ps(&bounds.extentX[i]);
+            __m512 ey = _mm512_loadu_ps(&bounds.extentY[i]);
+            __m512 ez = _mm512_loadu_ps(&bounds.extentZ[i]);
+
+            __mmask16 inside = 0xFFFF;
+            for (int p = 0; p < 6; p++)
+            {
+                __m512 dist = _mm512_add_ps(
+                    _mm512_add_ps(_mm512_mul_ps(cx, _mm512_set1_ps(planes.nx[p])), _mm512_mul_ps(cy, _mm512_set1_ps(planes.ny[p]))),
+                    _mm512_add_ps(_mm512_mul_ps(cz, _mm512_set1_ps(planes.nz[p])), _mm512_set1_ps(planes.d[p])));
+                __m512 radius = _mm512_add_ps(
+                    _mm512_add_ps(_mm512_mul_ps(ex, _mm512_set1_ps(planes.absX[p])), _mm512_mul_ps(ey, _mm512_set1_ps(planes.absY[p]))),
+                    _mm512_mul_ps(ez, _mm512_set1_ps(planes.absZ[p])));
+                inside = _mm512_mask_cmp_ps_mask(inside, _mm512_add_ps(dist, radius), zero, _CMP_GE_OQ);
+            }
+
+            // compress store writes the visible lanes' indices next to each other
+            _mm512_mask_compressstoreu_epi32(visibleIndices + visible, inside, _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(i)), lanes));
+
+            UINT bits = static_cast<UINT>(inside);
+            bits = bits - ((bits >> 1) & 0x5555);
+            bits = (bits & 0x3333) + ((bits >> 2) & 0x3333);
+            bits = (bits + (bits >> 4)) & 0x0F0F;
+            visible += (bits + (bits >> 8)) & 0x1F;
+        }
+
+        return CullScalar(planes, bounds, i, visibleIndices, visible);
+    }
+
+#endif
+}
+
+bool IsCullingPathSupported(CullingPath path)
+{
+    switch (path)
+    {
+    case CullingPath::Scalar:
+        return true;
+#ifdef CPU_X86
+    case CullingPath::SSE:
+        return true;
+    case CullingPath::AVX2:
+        return GetCpuFeatures().avx2;
+    case CullingPath::AVX512:
+        return GetCpuFeatures().avx512;
+#endif
+    default:
+        return false;
+    }
+}
+
+CullingPath GetBestCullingPath()
+{
+    static const CullingPath best =
+        IsCullingPathSupported(CullingPath::AVX512) ? CullingPath::AVX512 :
+        IsCullingPathSupported(CullingPath::AVX2) ? CullingPath::AVX2 :
+        IsCullingPathSupported(CullingPath::SSE) ? CullingPath::SSE :
+        CullingPath::Scalar;
+    return best;
+}
+
+const char* GetCullingPathName(CullingPath path)
+{
+    switch (path)
+    {
+    case CullingPath::SSE:
+        return "SSE";
+    case CullingPath::AVX2:
+        return "AVX2";
+    case CullingPath::AVX512:
+        return "AVX-512";
+    default:
+        return "Scalar";
+    }
+}
+
+UINT CullBounds(const XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices)
+{
+    return CullBounds(planes, bounds, visibleIndices, GetBestCullingPath());
+}
+
+UINT CullBounds(const XMFLOAT4 planes[6], const CullingBounds& bounds, UINT* visibleIndices, CullingPath path)
+{
+    CullingPlanes split;
+    for (int p = 0; p < 6; p++)
+    {
+        split.nx[p] = planes[p].x;
+        split.ny[p] = planes[p].y;
+        split.nz[p] = planes[p].z;
+        split.d[p] = planes[p].w;
+        split.absX[p] = fabsf(planes[p].x);
+        split.absY[p] = fabsf(planes[p].y);
+        split.absZ[p] = fabsf(planes[p].z);
+    }
+
+    if (!IsCullingPathSupported(path))
+        path = GetBestCullingPath();
+
+    switch (path)
+    {
+#ifdef CPU_X86
+    case CullingPath::AVX512:
+        return CullAVX512(split, bounds, visibleIndices);
+    case CullingPath::AVX2:
+        return CullAVX2(split, bounds, visibleIndices);
+    case CullingPath::SSE:
+        return CullSSE(split, bounds, visibleIndices);
+#endif
+    default:
+        return CullScalar(split, bounds, 0, visibleIndices, 0);
+    }
+}
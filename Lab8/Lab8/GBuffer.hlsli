@@ -0,0 +1,44 @@
+// The G-buffer of deferred shading, written by GBufferPixel.ps and read by
+// DeferredLighting.cs. Position comes from the depth buffer.
+//  - albedo (R8G8B8A8_UNORM): the sampled diffuse color, the texture index
+//    over 255 in a
+//  - normals (R16G16B16A16_UNORM): the shading normal in xy and the surface
+//    normal, which the shadows offset along, in zw, both octahedral
+#ifndef GBUFFER_HLSLI
+#define GBUFFER_HLSLI
+
+struct GBufferOutput
+{
+    float4 albedo : SV_Target0;
+    float4 normals : SV_Target1;
+};
+
+// The unit sphere folded onto the octahedron |x| + |y| + |z| = 1 and the
+// lower half unfolded over the corners of the square, into [0, 1]
+float2 EncodeNormal(float3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    float2 e = n.xy;
+    if (n.z < 0.0f)
+        e = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+    return e * 0.5f + 0.5f;
+}
+
+float3 DecodeNormal(float2 e)
+{
+    e = e * 2.0f - 1.0f;
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+GBufferOutput PackGBuffer(float3 albedo, uint texInd, float3 normal, float3 surfaceNormal)
+{
+    GBufferOutput output;
+    output.albedo = float4(albedo, texInd / 255.0f);
+    output.normals = float4(EncodeNormal(normal), EncodeNormal(surfaceNormal));
+    return output;
+}
+
+#endif
\ No newline at end of file
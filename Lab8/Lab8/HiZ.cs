@@ -0,0 +1,32 @@
+// One level of the Hi-Z pyramid, see HiZLayout in OcclusionCulling.h: every
+// texel is the farthest depth of the 2x2 texels of the level before it, or
+// of the depth buffer for level 0. All levels live in one texture.
+cbuffer HiZConstants : register(b0)
+{
+    uint4 source;       // x, y, width, height of the level read
+    uint4 target;       // of the level written
+    uint fromDepth;
+    uint atlasWidth;    // row pitch of the CPU kernel
+    uint2 padding;
+};
+
+Texture2D<float> depth : register(t0);
+RWTexture2D<float> hiZ : register(u0);
+
+float LoadSource(uint2 p)
+{
+    p = min(p, source.zw - 1);
+    return fromDepth ? depth[p] : hiZ[source.xy + p];
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 threadID : SV_DispatchThreadID)
+{
+    if (any(threadID.xy >= target.zw))
+        return;
+
+    uint2 p = threadID.xy * 2;
+    float farthest = max(max(LoadSource(p), LoadSource(p + uint2(1, 0))),
+        max(LoadSource(p + uint2(0, 1)), LoadSource(p + uint2(1, 1))));
+    hiZ[target.xy + threadID.xy] = farthest;
+}
\ No newline at end of file
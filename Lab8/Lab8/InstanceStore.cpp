@@ -0,0 +1,325 @@
+#include "InstanceStore.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define INSTANCE_SSE 1
+#endif
+
+using namespace DirectX;
+
+InstanceStore::InstanceStore()
+    : m_localExtent(1.0f, 1.0f, 1.0f)
+{
+}
+
+void InstanceStore::Clear()
+{
+    Resize(0);
+    m_dirtyIndices.clear();
+    m_ranges.clear();
+}
+
+void InstanceStore::Reserve(UINT count)
+{
+    m_positionX.reserve(count);
+    m_positionY.reserve(count);
+    m_positionZ.reserve(count);
+    m_rotationX.reserve(count);
+    m_rotationY.reserve(count);
+    m_rotationZ.reserve(count);
+    m_rotationW.reserve(count);
+    m_scale.reserve(count);
+    m_texIndex.reserve(count);
+    m_dirty.reserve(count);
+    m_transforms.reserve(count);
+}
+
+void InstanceStore::Resize(UINT count)
+{
+    UINT oldCount = GetCount();
+
+    m_positionX.resize(count, 0.0f);
+    m_positionY.resize(count, 0.0f);
+    m_positionZ.resize(count, 0.0f);
+    m_rotationX.resize(count, 0.0f);
+    m_rotationY.resize(count, 0.0f);
+    m_rotationZ.resize(count, 0.0f);
+    m_rotationW.resize(count, 1.0f);
+    m_scale.resize(count, 1.0f);
+    m_texIndex.resize(count, 0);
+    m_dirty.resize(count, 0);
+    m_transforms.resize(count);
+    m_bounds.Resize(count);
+
+    if (count < oldCount)
+    {
+        m_dirtyIndices.erase(std::remove_if(m_dirtyIndices.begin(), m_dirtyIndices.end(),
+            [count](UINT index) { return index >= count; }), m_dirtyIndices.end());
+    }
+    for (UINT i = oldCount; i < count; i++)
+    {
+        MarkDirty(i);
+    }
+}
+
+UINT InstanceStore::Add(const XMFLOAT3& position, const XMFLOAT4& rotation, float scale, UINT texIndex)
+{
+    UINT index = GetCount();
+    Resize(index + 1);
+    SetPosition(index, position);
+    SetRotation(index, rotation);
+    SetScale(index, scale);
+    SetTexIndex(index, texIndex);
+    return index;
+}
+
+void InstanceStore::SetLocalExtent(const XMFLOAT3& extent)
+{
+    m_localExtent = extent;
+    MarkAllDirty();
+}
+
+void InstanceStore::SetPosition(UINT index, const XMFLOAT3& position)
+{
+    m_positionX[index] = position.x;
+    m_positionY[index] = position.y;
+    m_positionZ[index] = position.z;
+    MarkDirty(index);
+}
+
+void InstanceStore::SetRotation(UINT index, const XMFLOAT4& rotation)
+{
+    m_rotationX[index] = rotation.x;
+    m_rotationY[index] = rotation.y;
+    m_rotationZ[index] = rotation.z;
+    m_rotationW[index] = rotation.w;
+    MarkDirty(index);
+}
+
+void InstanceStore::SetScale(UINT index, float scale)
+{
+    m_scale[index] = scale;
+    MarkDirty(index);
+}
+
+void InstanceStore::SetTexIndex(UINT index, UINT texIndex)
+{
+    m_texIndex[index] = texIndex;
+    MarkDirty(index);
+}
+
+void InstanceStore::MarkDirty(UINT index)
+{
+    if (m_dirty[index])
+        return;
+
+    m_dirty[index] = 1;
+    m_dirtyIndices.push_back(index);
+}
+
+void InstanceStore::MarkAllDirty()
+{
+    for (UINT i = 0; i < GetCount(); i++)
+    {
+        MarkDirty(i);
+    }
+}
+
+XMFLOAT3 InstanceStore::GetPosition(UINT index) const
+{
+    return XMFLOAT3(m_positionX[index], m_positionY[index], m_positionZ[index]);
+}
+
+XMFLOAT4 InstanceStore::GetRotation(UINT index) const
+{
+    return XMFLOAT4(m_rotationX[index], m_rotationY[index], m_rotationZ[index], m_rotationW[index]);
+}
+
+UINT InstanceStore::Compose()
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // in order, so the writes walk the arrays forward and runs can be found
+    std::sort(m_dirtyIndices.begin(), m_dirtyIndices.end());
+    UINT count = GetDirtyCount();
+
+#ifdef INSTANCE_SSE
+    UINT batched = count & ~3u;
+    ComposeSSE(m_dirtyIndices.data(), batched);
+    ComposeScalar(m_dirtyIndices.data() + batched, count - batched);
+#else
+    ComposeScalar(m_dirtyIndices.data(), count);
+#endif
+
+    m_ranges.clear();
+    for (UINT index : m_dirtyIndices)
+    {
+        if (!m_ranges.empty() && index - (m_ranges.back().first + m_ranges.back().count) <= MaxRangeGap)
+        {
+            m_ranges.back().count = index - m_ranges.back().first + 1;
+            continue;
+        }
+
+        InstanceRange range = { index, 1 };
+        m_ranges.push_back(range);
+    }
+
+    m_stats.rangeInstances = 0;
+    for (const InstanceRange& range : m_ranges)
+    {
+        m_stats.rangeInstances += range.count;
+    }
+
+    m_stats.composed = count;
+    m_stats.ranges = static_cast<UINT>(m_ranges.size());
+    m_stats.composeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return count;
+}
+
+void InstanceStore::ClearDirty()
+{
+    for (UINT index : m_dirtyIndices)
+    {
+        m_dirty[index] = 0;
+    }
+    m_dirtyIndices.clear();
+    m_ranges.clear();
+}
+
+void InstanceStore::ComposeScalar(const UINT* indices, UINT count)
+{
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT index = indices[i];
+        float x = m_rotationX[index];
+        float y = m_rotationY[index];
+        float z = m_rotationZ[index];
+        float w = m_rotationW[index];
+        float s = m_scale[index];
+
+        // the rotation of XMMatrixRotationQuaternion, transposed and scaled
+        float rows[3][3] =
+        {
+            { s * (1.0f - 2.0f * (y * y + z * z)), s * 2.0f * (x * y - z * w), s * 2.0f * (x * z + y * w) },
+            { s * 2.0f * (x * y + z * w), s * (1.0f - 2.0f * (x * x + z * z)), s * 2.0f * (y * z - x * w) },
+            { s * 2.0f * (x * z - y * w), s * 2.0f * (y * z + x * w), s * (1.0f - 2.0f * (x * x + y * y)) },
+        };
+        float translation[3] = { m_positionX[index], m_positionY[index], m_positionZ[index] };
+        float extent[3];
+
+        InstanceTransform& transform = m_transforms[index];
+        for (int row = 0; row < 3; row++)
+        {
+            transform.model.m[row][0] = rows[row][0];
+            transform.model.m[row][1] = rows[row][1];
+            transform.model.m[row][2] = rows[row][2];
+            transform.model.m[row][3] = translation[row];
+            extent[row] = fabsf(rows[row][0]) * m_localExtent.x + fabsf(rows[row][1]) * m_localExtent.y +
+                fabsf(rows[row][2]) * m_localExtent.z;
+        }
+        transform.model.m[3][0] = 0.0f;
+        transform.model.m[3][1] = 0.0f;
+        transform.model.m[3][2] = 0.0f;
+        transform.model.m[3][3] = 1.0f;
+        transform.texInd = m_texIndex[index];
+        transform.extent = XMFLOAT3(extent[0], extent[1], extent[2]);
+
+        m_bounds.Set(index, XMFLOAT3(translation[0], translation[1], translation[2]), transform.extent);
+    }
+}
+
+#ifdef INSTANCE_SSE
+namespace
+{
+    inline __m128 Gather(const std::vector<float>& values, const UINT* indices)
+    {
+        return _mm_set_ps(values[indices[3]], values[indices[2]], values[indices[1]], values[indices[0]]);
+    }
+
+    inline __m128 Abs(__m128 value)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), value);
+    }
+}
+#endif
+
+void InstanceStore::ComposeSSE(const UINT* indices, UINT count)
+{
+#ifdef INSTANCE_SSE
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 localX = _mm_set1_ps(m_localExtent.x);
+    const __m128 localY = _mm_set1_ps(m_localExtent.y);
+    const __m128 localZ = _mm_set1_ps(m_localExtent.z);
+    const __m128 lastRow = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+    // Every lane is one instance: the nine rotation terms are built side by
+    // side and then transposed into the rows of four matrices
+    for (UINT i = 0; i < count; i += 4)
+    {
+        const UINT* lanes = indices + i;
+        __m128 x = Gather(m_rotationX, lanes);
+        __m128 y = Gather(m_rotationY, lanes);
+        __m128 z = Gather(m_rotationZ, lanes);
+        __m128 w = Gather(m_rotationW, lanes);
+        __m128 s = Gather(m_scale, lanes);
+        __m128 s2 = _mm_mul_ps(s, two);
+
+        __m128 xx = _mm_mul_ps(x, x);
+        __m128 yy = _mm_mul_ps(y, y);
+        __m128 zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y);
+        __m128 xz = _mm_mul_ps(x, z);
+        __m128 yz = _mm_mul_ps(y, z);
+        __m128 xw = _mm_mul_ps(x, w);
+        __m128 yw = _mm_mul_ps(y, w);
+        __m128 zw = _mm_mul_ps(z, w);
+
+        __m128 rows[3][4];
+        rows[0][0] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+        rows[0][1] = _mm_mul_ps(s2, _mm_sub_ps(xy, zw));
+        rows[0][2] = _mm_mul_ps(s2, _mm_add_ps(xz, yw));
+        rows[0][3] = Gather(m_positionX, lanes);
+        rows[1][0] = _mm_mul_ps(s2, _mm_add_ps(xy, zw));
+        rows[1][1] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+        rows[1][2] = _mm_mul_ps(s2, _mm_sub_ps(yz, xw));
+        rows[1][3] = Gather(m_positionY, lanes);
+        rows[2][0] = _mm_mul_ps(s2, _mm_sub_ps(xz, yw));
+        rows[2][1] = _mm_mul_ps(s2, _mm_add_ps(yz, xw));
+        rows[2][2] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+        rows[2][3] = Gather(m_positionZ, lanes);
+
+        alignas(16) float extent[3][4];
+        alignas(16) float center[3][4];
+        for (int row = 0; row < 3; row++)
+        {
+            __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(Abs(rows[row][0]), localX), _mm_mul_ps(Abs(rows[row][1]), localY)),
+                _mm_mul_ps(Abs(rows[row][2]), localZ));
+            _mm_store_ps(extent[row], e);
+            _mm_store_ps(center[row], rows[row][3]);
+
+            _MM_TRANSPOSE4_PS(rows[row][0], rows[row][1], rows[row][2], rows[row][3]);
+            for (int lane = 0; lane < 4; lane++)
+            {
+                _mm_storeu_ps(m_transforms[lanes[lane]].model.m[row], rows[row][lane]);
+            }
+        }
+
+        for (int lane = 0; lane < 4; lane++)
+        {
+            UINT index = lanes[lane];
+            InstanceTransform& transform = m_transforms[index];
+            _mm_storeu_ps(transform.model.m[3], lastRow);
+            transform.texInd = m_texIndex[index];
+            transform.extent = XMFLOAT3(extent[0][lane], extent[1][lane], extent[2][lane]);
+            m_bounds.Set(index, XMFLOAT3(center[0][lane], center[1][lane], center[2][lane]), transform.extent);
+        }
+    }
+#else
+    ComposeScalar(indices, count);
+#endif
+}
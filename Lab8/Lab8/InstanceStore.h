@@ -0,0 +1,112 @@
+#ifndef INSTANCE_STORE_H
+#define INSTANCE_STORE_H
+
+#include "Platform.h"
+#include "FrustumCulling.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// One instance as the shaders read it: InstanceData of RenderClass,
+// ComputeShader.cs and ColorVertex.vs. The matrix is scale, rotation and
+// translation, transposed like the constant buffers.
+struct InstanceTransform
+{
+    DirectX::XMFLOAT4X4 model;
+    UINT texInd;
+    DirectX::XMFLOAT3 extent;   // of the world box, for culling
+};
+
+// A run of instances to upload, covering every dirty one in it
+struct InstanceRange
+{
+    UINT first;
+    UINT count;
+};
+
+struct InstanceStoreStats
+{
+    UINT composed = 0;          // instances the last Compose wrote
+    UINT ranges = 0;
+    UINT rangeInstances = 0;    // instances in the ranges, clean ones between dirty ones included
+    double composeSeconds = 0.0;
+};
+
+// Instances kept as separate arrays of position, rotation, scale and
+// texture index. Every change marks the instance dirty, and Compose builds
+// the transforms and world boxes of the dirty instances only, four at a
+// time with SSE, so the work and the bytes to upload follow the number of
+// changes instead of the number of instances.
+class InstanceStore
+{
+public:
+    // Dirty instances at most this far apart share a range, one upload is
+    // cheaper than two for a few clean instances
+    static const UINT MaxRangeGap = 4;
+
+    InstanceStore();
+
+    void Clear();
+    void Reserve(UINT count);
+    // New instances are dirty, instances past count are dropped
+    void Resize(UINT count);
+    UINT Add(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT4& rotation, float scale, UINT texIndex);
+
+    // Half size of the mesh in its own space, every box is built from it
+    void SetLocalExtent(const DirectX::XMFLOAT3& extent);
+
+    // rotation is a unit quaternion
+    void SetPosition(UINT index, const DirectX::XMFLOAT3& position);
+    void SetRotation(UINT index, const DirectX::XMFLOAT4& rotation);
+    void SetScale(UINT index, float scale);
+    void SetTexIndex(UINT index, UINT texIndex);
+    void MarkDirty(UINT index);
+    void MarkAllDirty();
+
+    UINT GetCount() const { return static_cast<UINT>(m_positionX.size()); }
+    DirectX::XMFLOAT3 GetPosition(UINT index) const;
+    DirectX::XMFLOAT4 GetRotation(UINT index) const;
+    float GetScale(UINT index) const { return m_scale[index]; }
+    UINT GetTexIndex(UINT index) const { return m_texIndex[index]; }
+
+    // Composes the dirty instances and sorts them into ranges. They stay
+    // dirty until ClearDirty, so the caller can upload the ranges and refit
+    // whatever is built over the boxes first.
+    UINT Compose();
+    void ClearDirty();
+
+    UINT GetDirtyCount() const { return static_cast<UINT>(m_dirtyIndices.size()); }
+    // Ascending after Compose
+    const std::vector<UINT>& GetDirtyIndices() const { return m_dirtyIndices; }
+    const std::vector<InstanceRange>& GetDirtyRanges() const { return m_ranges; }
+
+    // Valid for the instances that are not dirty
+    const std::vector<InstanceTransform>& GetTransforms() const { return m_transforms; }
+    const CullingBounds& GetBounds() const { return m_bounds; }
+    const InstanceStoreStats& GetStats() const { return m_stats; }
+
+private:
+    void ComposeScalar(const UINT* indices, UINT count);
+    void ComposeSSE(const UINT* indices, UINT count);
+
+    std::vector<float> m_positionX;
+    std::vector<float> m_positionY;
+    std::vector<float> m_positionZ;
+    std::vector<float> m_rotationX;
+    std::vector<float> m_rotationY;
+    std::vector<float> m_rotationZ;
+    std::vector<float> m_rotationW;
+    std::vector<float> m_scale;
+    std::vector<UINT> m_texIndex;
+
+    std::vector<BYTE> m_dirty;
+    std::vector<UINT> m_dirtyIndices;
+    std::vector<InstanceRange> m_ranges;
+
+    std::vector<InstanceTransform> m_transforms;
+    CullingBounds m_bounds;
+    DirectX::XMFLOAT3 m_localExtent;
+    InstanceStoreStats m_stats;
+};
+
+#endif
@@ -87,7 +87,7 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
     }
 
     g_Render = new RenderClass();
-    if (FAILED(g_Render->Init(hWnd, szTitle, szWindowClass)))
+    if (FAILED(g_Render->Init(hWnd)))
     {
         OutputDebugString(_T("Error in Init Renderer\n"));
         delete g_Render;
@@ -111,7 +111,9 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
     case WM_SIZE:
         if (g_Render != nullptr && wParam != SIZE_MINIMIZED)
         {
-            g_Render->Resize(hWnd);
+            RECT rc;
+            GetClientRect(hWnd, &rc);
+            g_Render->Resize(rc.right - rc.left, rc.bottom - rc.top);
         }
         return 0;
     case WM_KEYDOWN:
@@ -0,0 +1,226 @@
+#include "LightClusters.h"
+
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+// Same test as SphereIntersectsBounds in LightClusters.cs
+static bool SphereIntersectsBounds(const XMFLOAT4& light, const XMFLOAT4& boundsMin, const XMFLOAT4& boundsMax)
+{
+    float dx = light.x < boundsMin.x ? boundsMin.x - light.x : (light.x > boundsMax.x ? light.x - boundsMax.x : 0.0f);
+    float dy = light.y < boundsMin.y ? boundsMin.y - light.y : (light.y > boundsMax.y ? light.y - boundsMax.y : 0.0f);
+    float dz = light.z < boundsMin.z ? boundsMin.z - light.z : (light.z > boundsMax.z ? light.z - boundsMax.z : 0.0f);
+    return dx * dx + dy * dy + dz * dz <= light.w * light.w;
+}
+
+static int ClampIndex(float value, int count)
+{
+    if (!(value > 0.0f))
+        return 0;
+    if (value >= static_cast<float>(count - 1))
+        return count - 1;
+    return static_cast<int>(value);
+}
+
+LightClusters::LightClusters() :
+    m_width(0),
+    m_height(0),
+    m_gridX(0),
+    m_gridY(0),
+    m_projX(0.0f),
+    m_projY(0.0f),
+    m_nearZ(0.0f),
+    m_farZ(0.0f),
+    m_sliceScale(0.0f),
+    m_sliceBias(0.0f),
+    m_sliceDepths{},
+    m_droppedLights(0)
+{
+}
+
+bool LightClusters::Configure(UINT width, UINT height, FXMMATRIX proj)
+{
+    XMFLOAT4X4 m;
+    XMStoreFloat4x4(&m, proj);
+
+    // XMMatrixPerspectiveFovLH: _33 = f / (f - n), _43 = -n * f / (f - n)
+    float nearZ = -m._43 / m._33;
+    float farZ = -m._43 / (m._33 - 1.0f);
+    if (width == m_width && height == m_height && m._11 == m_projX && m._22 == m_projY &&
+        nearZ == m_nearZ && farZ == m_farZ)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_projX = m._11;
+    m_projY = m._22;
+    m_nearZ = nearZ;
+    m_farZ = farZ;
+    m_gridX = (width + TileSize - 1) / TileSize;
+    m_gridY = (height + TileSize - 1) / TileSize;
+
+    m_sliceScale = SliceCount / logf(farZ / nearZ);
+    m_sliceBias = -logf(nearZ) * m_sliceScale;
+    for (UINT k = 0; k <= SliceCount; k++)
+    {
+        m_sliceDepths[k] = nearZ * powf(farZ / nearZ, static_cast<float>(k) / SliceCount);
+    }
+
+    // A cluster is bounded by the planes through the edges of its tile and
+    // by the depths of its slice; the box has to hold the cell at both depths
+    const float tileScaleX = 0.5f * width / TileSize;
+    const float tileScaleY = 0.5f * height / TileSize;
+    m_bounds.resize(GetClusterCount() * 2);
+    for (UINT k = 0; k < SliceCount; k++)
+    {
+        float z0 = m_sliceDepths[k];
+        float z1 = m_sliceDepths[k + 1];
+        for (UINT y = 0; y < m_gridY; y++)
+        {
+            float top = (1.0f - y / tileScaleY) / m_projY;
+            float bottom = (1.0f - (y + 1) / tileScaleY) / m_projY;
+            for (UINT x = 0; x < m_gridX; x++)
+            {
+                float left = (x / tileScaleX - 1.0f) / m_projX;
+                float right = ((x + 1) / tileScaleX - 1.0f) / m_projX;
+
+                UINT cluster = (k * m_gridY + y) * m_gridX + x;
+                m_bounds[cluster * 2] = XMFLOAT4(fminf(left * z0, left * z1), fminf(bottom * z0, bottom * z1), z0, 0.0f);
+                m_bounds[cluster * 2 + 1] = XMFLOAT4(fmaxf(right * z0, right * z1), fmaxf(top * z0, top * z1), z1, 0.0f);
+            }
+        }
+    }
+
+    m_counts.resize(GetClusterCount());
+    return true;
+}
+
+void LightClusters::GetConstants(FXMMATRIX view, CXMMATRIX viewProj, UINT lightCount, ClusterConstants& constants) const
+{
+    constants.viewProj = XMMatrixTranspose(viewProj);
+    constants.view = XMMatrixTranspose(view);
+    constants.gridX = m_gridX;
+    constants.gridY = m_gridY;
+    constants.gridZ = SliceCount;
+    constants.lightCount = lightCount;
+    constants.tileScaleX = 0.5f * m_width / TileSize;
+    constants.tileScaleY = 0.5f * m_height / TileSize;
+    constants.sliceScale = m_sliceScale;
+    constants.sliceBias = m_sliceBias;
+}
+
+UINT LightClusters::GetSlice(float viewZ) const
+{
+    return static_cast<UINT>(ClampIndex(logf(viewZ) * m_sliceScale + m_sliceBias, SliceCount));
+}
+
+UINT LightClusters::Assign(const XMFLOAT4* lights, UINT lightCount, UINT* ranges, UINT* indices)
+{
+    const UINT clusterCount = GetClusterCount();
+    memset(m_counts.data(), 0, sizeof(UINT) * clusterCount);
+    m_pairs.clear();
+    m_droppedLights = 0;
+
+    const float tileScaleX = 0.5f * m_width / TileSize;
+    const float tileScaleY = 0.5f * m_height / TileSize;
+    const int gridX = static_cast<int>(m_gridX);
+    const int gridY = static_cast<int>(m_gridY);
+
+    // Only the clusters near the light are tested. Within a slice the box of
+    // a column reaches x / z ratios between left and right scaled by both
+    // slice depths, so the columns whose box can overlap the sphere come from
+    // the sphere's x extent over those depths; one more column on each side
+    // covers rounding, the exact test decides.
+    for (UINT i = 0; i < lightCount; i++)
+    {
+        const XMFLOAT4& light = lights[i];
+        float minZ = light.z - light.w;
+        float maxZ = light.z + light.w;
+        if (maxZ < m_sliceDepths[0] || minZ > m_sliceDepths[SliceCount])
+            continue;
+
+        // the log may round across a slice boundary the sphere just touches
+        UINT firstSlice = GetSlice(fmaxf(minZ, m_nearZ));
+        UINT lastSlice = GetSlice(fminf(maxZ, m_farZ));
+        while (firstSlice > 0 && m_sliceDepths[firstSlice] >= minZ)
+            firstSlice--;
+        while (lastSlice + 1 < SliceCount && m_sliceDepths[lastSlice + 1] <= maxZ)
+            lastSlice++;
+        for (UINT k = firstSlice; k <= lastSlice; k++)
+        {
+            float z0 = m_sliceDepths[k];
+            float z1 = m_sliceDepths[k + 1];
+
+            float minX = fminf((light.x - light.w) / z0, (light.x - light.w) / z1) * m_projX;
+            float maxX = fmaxf((light.x + light.w) / z0, (light.x + light.w) / z1) * m_projX;
+            float minY = fminf((light.y - light.w) / z0, (light.y - light.w) / z1) * m_projY;
+            float maxY = fmaxf((light.y + light.w) / z0, (light.y + light.w) / z1) * m_projY;
+
+            int x0 = ClampIndex((minX + 1.0f) * tileScaleX - 1.0f, gridX);
+            int x1 = ClampIndex((maxX + 1.0f) * tileScaleX + 1.0f, gridX);
+            int y0 = ClampIndex((1.0f - maxY) * tileScaleY - 1.0f, gridY);
+            int y1 = ClampIndex((1.0f - minY) * tileScaleY + 1.0f, gridY);
+
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    UINT cluster = (k * m_gridY + y) * m_gridX + x;
+                    if (!SphereIntersectsBounds(light, m_bounds[cluster * 2], m_bounds[cluster * 2 + 1]))
+                        continue;
+                    if (m_counts[cluster] == MaxLightsPerCluster)
+                    {
+                        m_droppedLights++;
+                        continue;
+                    }
+                    m_counts[cluster]++;
+                    m_pairs.push_back(cluster);
+                    m_pairs.push_back(i);
+                }
+            }
+        }
+    }
+
+    UINT offset = 0;
+    for (UINT cluster = 0; cluster < clusterCount; cluster++)
+    {
+        ranges[cluster * 2] = offset;
+        ranges[cluster * 2 + 1] = 0;
+        offset += m_counts[cluster];
+    }
+
+    // the pairs are in light order, so every list comes out sorted
+    for (size_t i = 0; i < m_pairs.size(); i += 2)
+    {
+        UINT* range = ranges + m_pairs[i] * 2;
+        indices[range[0] + range[1]++] = m_pairs[i + 1];
+    }
+    return offset;
+}
+
+UINT LightClusters::AssignBruteForce(const XMFLOAT4* lights, UINT lightCount, UINT* ranges, UINT* indices,
+    UINT* pDropped) const
+{
+    UINT offset = 0;
+    UINT dropped = 0;
+    for (UINT cluster = 0; cluster < GetClusterCount(); cluster++)
+    {
+        UINT count = 0;
+        for (UINT i = 0; i < lightCount; i++)
+        {
+            if (!SphereIntersectsBounds(lights[i], m_bounds[cluster * 2], m_bounds[cluster * 2 + 1]))
+                continue;
+            if (count < MaxLightsPerCluster)
+                indices[offset + count++] = i;
+            else
+                dropped++;
+        }
+        ranges[cluster * 2] = offset;
+        ranges[cluster * 2 + 1] = count;
+        offset += count;
+    }
+    if (pDropped)
+        *pDropped = dropped;
+    return offset;
+}
@@ -0,0 +1,59 @@
+// One thread per cluster lists the lights whose sphere touches the
+// cluster's view space box, at a fixed offset of cluster * MAX_LIGHTS_PER_CLUSTER.
+// The lights a full cluster has no room for are added to clusterOverflow.
+#include "LightClusters.hlsli"
+
+#define GROUP_SIZE 64
+
+StructuredBuffer<float4> clusterBounds : register(t0);     // min, max per cluster
+StructuredBuffer<PointLight> lights : register(t2);
+RWStructuredBuffer<uint2> clusterRanges : register(u0);    // offset, count
+RWStructuredBuffer<uint> clusterLightIndices : register(u1);
+RWStructuredBuffer<uint> clusterOverflow : register(u2);   // dropped lights, cleared every frame
+
+groupshared float4 viewLights[GROUP_SIZE];
+
+bool SphereIntersectsBounds(float4 light, float3 boundsMin, float3 boundsMax)
+{
+    float3 d = max(max(boundsMin - light.xyz, 0.0f), light.xyz - boundsMax);
+    return dot(d, d) <= light.w * light.w;
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint3 threadID : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+    uint cluster = threadID.x;
+    bool valid = cluster < clusterGrid.x * clusterGrid.y * clusterGrid.z;
+    float3 boundsMin = valid ? clusterBounds[cluster * 2].xyz : 0.0f;
+    float3 boundsMax = valid ? clusterBounds[cluster * 2 + 1].xyz : 0.0f;
+    uint count = 0;
+
+    // the group moves the lights to view space a batch at a time
+    for (uint first = 0; first < clusterLightCount; first += GROUP_SIZE)
+    {
+        uint index = first + groupIndex;
+        if (index < clusterLightCount)
+        {
+            PointLight light = lights[index];
+            viewLights[groupIndex] = float4(mul(float4(light.Position, 1.0f), clusterView).xyz, light.Range);
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint batch = min(clusterLightCount - first, (uint)GROUP_SIZE);
+        for (uint i = 0; valid && i < batch; i++)
+        {
+            if (SphereIntersectsBounds(viewLights[i], boundsMin, boundsMax))
+            {
+                if (count < MAX_LIGHTS_PER_CLUSTER)
+                    clusterLightIndices[cluster * MAX_LIGHTS_PER_CLUSTER + count] = first + i;
+                count++;
+            }
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    if (valid)
+        clusterRanges[cluster] = uint2(cluster * MAX_LIGHTS_PER_CLUSTER, min(count, (uint)MAX_LIGHTS_PER_CLUSTER));
+    if (count > MAX_LIGHTS_PER_CLUSTER)
+        InterlockedAdd(clusterOverflow[0], count - MAX_LIGHTS_PER_CLUSTER);
+}
\ No newline at end of file
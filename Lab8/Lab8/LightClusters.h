@@ -0,0 +1,90 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include "Platform.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Constants of the cluster lookup in ColorPixel.ps / ParallelogramPixel.ps
+// (register b3) and of LightClusters.cs (register b0)
+struct ClusterConstants
+{
+    DirectX::XMMATRIX viewProj;     // world to clip space, transposed
+    DirectX::XMMATRIX view;         // world to view space, transposed
+    UINT gridX;
+    UINT gridY;
+    UINT gridZ;
+    UINT lightCount;
+    float tileScaleX;               // NDC x + 1 times this is the tile column
+    float tileScaleY;               // 1 - NDC y times this is the tile row
+    float sliceScale;               // log(view z) * sliceScale + sliceBias is the depth slice
+    float sliceBias;
+};
+
+// Splits the view frustum into a grid of clusters, screen tiles times depth
+// slices spaced exponentially between the near and far planes, and lists
+// for every cluster the point lights whose sphere touches its view space
+// bounding box. The lists are sorted by light index and hold at most
+// MaxLightsPerCluster lights, the lights past that are dropped and counted;
+// LightClusters.cs builds the same lists, with every cluster at a fixed
+// offset of cluster * MaxLightsPerCluster, and adds its drops to a counter.
+class LightClusters
+{
+public:
+    static const UINT TileSize = 64;            // pixels
+    static const UINT SliceCount = 16;
+    static const UINT MaxLightsPerCluster = 256;
+
+    LightClusters();
+
+    // The grid of a LH perspective projection for a width x height target.
+    // Returns true when the grid changed, i.e. the bounds need uploading.
+    bool Configure(UINT width, UINT height, DirectX::FXMMATRIX proj);
+
+    UINT GetGridX() const { return m_gridX; }
+    UINT GetGridY() const { return m_gridY; }
+    UINT GetClusterCount() const { return m_gridX * m_gridY * SliceCount; }
+
+    // View space box of every cluster as min, max pairs, x fastest then y then slice
+    const DirectX::XMFLOAT4* GetBounds() const { return m_bounds.data(); }
+
+    void GetConstants(DirectX::FXMMATRIX view, DirectX::CXMMATRIX viewProj, UINT lightCount, ClusterConstants& constants) const;
+
+    // Lights as view space center and range. Fills the offset and count of
+    // every cluster into ranges (two UINTs per cluster) and the light indices
+    // into indices; indices needs room for GetClusterCount() * MaxLightsPerCluster.
+    // Returns the number of indices written.
+    UINT Assign(const DirectX::XMFLOAT4* lights, UINT lightCount, UINT* ranges, UINT* indices);
+
+    // Lights that touched a full cluster in the last Assign(), summed over
+    // the clusters; 0 when every list holds all of its lights
+    UINT GetDroppedLights() const { return m_droppedLights; }
+
+    // Tests every light against every cluster, for checking Assign(). The
+    // dropped lights go to pDropped when it is not null.
+    UINT AssignBruteForce(const DirectX::XMFLOAT4* lights, UINT lightCount, UINT* ranges, UINT* indices,
+        UINT* pDropped = nullptr) const;
+
+private:
+    UINT GetSlice(float viewZ) const;
+
+    UINT m_width;
+    UINT m_height;
+    UINT m_gridX;
+    UINT m_gridY;
+    float m_projX;
+    float m_projY;
+    float m_nearZ;
+    float m_farZ;
+    float m_sliceScale;
+    float m_sliceBias;
+    float m_sliceDepths[SliceCount + 1];
+
+    std::vector<DirectX::XMFLOAT4> m_bounds;
+    std::vector<UINT> m_counts;
+    std::vector<UINT> m_pairs;      // cluster and light of every hit, in light order
+    UINT m_droppedLights;
+};
+
+#endif
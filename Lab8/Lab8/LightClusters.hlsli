@@ -0,0 +1,38 @@
+// Cluster grid shared by the lit pixel shaders and LightClusters.cs, see
+// LightClusters.h: screen tiles times exponential depth slices
+#ifndef LIGHT_CLUSTERS_HLSLI
+#define LIGHT_CLUSTERS_HLSLI
+
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+struct PointLight
+{
+    float3 Position;
+    float Range;
+    float3 Color;
+    float Intensity;
+};
+
+cbuffer ClusterConstants : register(b3)
+{
+    float4x4 clusterViewProj;
+    float4x4 clusterView;
+    uint3 clusterGrid;
+    uint clusterLightCount;
+    float2 clusterTileScale;
+    float clusterSliceScale;
+    float clusterSliceBias;
+};
+
+// The cluster a world position falls into, clip w is the view space depth
+uint GetClusterIndex(float3 worldPos)
+{
+    float4 clip = mul(float4(worldPos, 1.0f), clusterViewProj);
+    float2 ndc = clip.xy / clip.w;
+    uint x = (uint)clamp((ndc.x + 1.0f) * clusterTileScale.x, 0.0f, clusterGrid.x - 1.0f);
+    uint y = (uint)clamp((1.0f - ndc.y) * clusterTileScale.y, 0.0f, clusterGrid.y - 1.0f);
+    uint z = (uint)clamp(log(clip.w) * clusterSliceScale + clusterSliceBias, 0.0f, clusterGrid.z - 1.0f);
+    return (z * clusterGrid.y + y) * clusterGrid.x + x;
+}
+
+#endif
\ No newline at end of file
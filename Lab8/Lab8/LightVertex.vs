@@ -0,0 +1,43 @@
+cbuffer LightObjectBuffer : register(b0)
+{
+    float4 color;
+    matrix model;
+};
+
+cbuffer CameraBuffer : register(b1)
+{
+    matrix vp;
+    float3 CameraPos;
+};
+
+struct VS_INPUT
+{
+    float3 Pos : POSITION;
+    float3 Normal : NORMAL;
+    float2 TexCoord : TEXCOORD0;
+};
+
+struct PS_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float3 WorldPos : TEXCOORD0;
+    float3 Normal : TEXCOORD1;
+    float2 TexCoord : TEXCOORD2;
+    float3 Tangent : TEXCOORD3;
+    float3 Bitangent : TEXCOORD4;
+    float3 CameraPos : TEXCOORD5;
+    uint TexInd : TEXCOORD6;
+};
+
+PS_INPUT main(VS_INPUT input)
+{
+    PS_INPUT output = (PS_INPUT)0;
+
+    float4 worldPos = mul(float4(input.Pos, 1.0f), model);
+    output.WorldPos = worldPos.xyz;
+    output.Pos = mul(worldPos, vp);
+    output.Normal = mul(input.Normal, (float3x3)model);
+    output.TexCoord = input.TexCoord;
+    output.CameraPos = CameraPos;
+    return output;
+}
\ No newline at end of file
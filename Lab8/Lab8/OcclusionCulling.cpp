@@ -0,0 +1,368 @@
+#include "OcclusionCulling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+    float Saturate(float x)
+    {
+        return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+    }
+
+    // The corner moved by the model of its occluder, then projected; both
+    // matrices are row major
+    void OccluderVertexKernel(const CpuShaderBindings& bindings, const BYTE* pVertex, UINT instanceId, float* out)
+    {
+        const float* viewProj = reinterpret_cast<const float*>(bindings.constantBuffers[0]);
+        const float* model = reinterpret_cast<const float*>(bindings.resources[0]) + instanceId * 16;
+        float corner[3];
+        memcpy(corner, pVertex, sizeof(corner));
+
+        float world[4];
+        for (int j = 0; j < 4; j++)
+        {
+            world[j] = corner[0] * model[j] + corner[1] * model[4 + j] + corner[2] * model[8 + j] + model[12 + j];
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            out[j] = world[0] * viewProj[j] + world[1] * viewProj[4 + j] + world[2] * viewProj[8 + j] + world[3] * viewProj[12 + j];
+        }
+    }
+
+    void OccluderPixelKernel(const CpuShaderBindings&, const float*, float color[4])
+    {
+        color[0] = color[1] = color[2] = color[3] = 0.0f;
+    }
+
+    const CpuShaderProgram OccluderVertex = { L"Occluder", ShaderStage::Vertex, 0, OccluderVertexKernel, nullptr, nullptr, nullptr, false };
+    const CpuShaderProgram OccluderPixel = { L"Occluder", ShaderStage::Pixel, 0, nullptr, OccluderPixelKernel, nullptr, nullptr, false };
+
+    const float UnitCube[8][3] =
+    {
+        { -1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, -1.0f }, { -1.0f, 1.0f, -1.0f }, { 1.0f, 1.0f, -1.0f },
+        { -1.0f, -1.0f, 1.0f }, { 1.0f, -1.0f, 1.0f }, { -1.0f, 1.0f, 1.0f }, { 1.0f, 1.0f, 1.0f }
+    };
+
+    // Clipping a box that reaches the near plane leaves its far faces
+    // covering the screen, so only boxes wholly beyond it may occlude.
+    // viewProj is transposed, z of the clip space is 0 on the near plane.
+    bool IsBeyondNearPlane(const float* viewProj, const float center[3], const float extent[3])
+    {
+        const float* row = viewProj + 8;
+        for (UINT i = 0; i < 8; i++)
+        {
+            float x = center[0] + ((i & 1) ? extent[0] : -extent[0]);
+            float y = center[1] + ((i & 2) ? extent[1] : -extent[1]);
+            float z = center[2] + ((i & 4) ? extent[2] : -extent[2]);
+            if (x * row[0] + y * row[1] + z * row[2] + row[3] <= 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // two triangles per face, clockwise from outside like the cube mesh
+    const WORD UnitCubeIndices[36] =
+    {
+        0, 2, 1, 1, 2, 3,
+        4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,
+        1, 3, 5, 3, 7, 5
+    };
+}
+
+HiZLayout::HiZLayout() :
+    m_depthWidth(0),
+    m_depthHeight(0),
+    m_width(0),
+    m_height(0),
+    m_levelCount(0),
+    m_levels{}
+{
+}
+
+bool HiZLayout::Configure(UINT depthWidth, UINT depthHeight)
+{
+    if (depthWidth == m_depthWidth && depthHeight == m_depthHeight)
+        return false;
+
+    m_depthWidth = depthWidth;
+    m_depthHeight = depthHeight;
+    m_width = 0;
+    m_height = 0;
+    m_levelCount = 0;
+    if (depthWidth == 0 || depthHeight == 0)
+        return true;
+
+    UINT width = depthWidth;
+    UINT height = depthHeight;
+    UINT nextY = 0;
+    while (m_levelCount < MaxHiZLevels)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+
+        HiZLevel& level = m_levels[m_levelCount];
+        level.x = m_levelCount == 0 ? 0 : m_levels[0].width;
+        level.y = m_levelCount == 0 ? 0 : nextY;
+        level.width = width;
+        level.height = height;
+        if (m_levelCount > 0)
+            nextY += height;
+        m_levelCount++;
+
+        m_width = std::max(m_width, level.x + width);
+        m_height = std::max(m_height, level.y + height);
+        if (width == 1 && height == 1)
+            break;
+    }
+    return true;
+}
+
+void BuildHiZLevel(const float* source, UINT sourcePitch, UINT sourceWidth, UINT sourceHeight,
+    float* target, UINT targetPitch, UINT targetWidth, UINT targetHeight)
+{
+    for (UINT y = 0; y < targetHeight; y++)
+    {
+        const float* row0 = source + (size_t)std::min(y * 2, sourceHeight - 1) * sourcePitch;
+        const float* row1 = source + (size_t)std::min(y * 2 + 1, sourceHeight - 1) * sourcePitch;
+        for (UINT x = 0; x < targetWidth; x++)
+        {
+            UINT x0 = std::min(x * 2, sourceWidth - 1);
+            UINT x1 = std::min(x * 2 + 1, sourceWidth - 1);
+            target[(size_t)y * targetPitch + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+        }
+    }
+}
+
+bool IsBoxOccluded(const float* hiZ, UINT hiZWidth, const HiZLevel* levels, UINT levelCount,
+    float depthWidth, float depthHeight, const float* viewProj, const float center[3], const float extent[3])
+{
+    if (levelCount == 0)
+        return false;
+
+    float ndcMin[3] = { 1.0f, 1.0f, 1.0f };
+    float ndcMax[3] = { -1.0f, -1.0f, -1.0f };
+    for (UINT i = 0; i < 8; i++)
+    {
+        float corner[4] =
+        {
+            center[0] + ((i & 1) ? extent[0] : -extent[0]),
+            center[1] + ((i & 2) ? extent[1] : -extent[1]),
+            center[2] + ((i & 4) ? extent[2] : -extent[2]),
+            1.0f
+        };
+
+        float clip[4];
+        for (int j = 0; j < 4; j++)
+        {
+            const float* row = viewProj + j * 4;
+            clip[j] = corner[0] * row[0] + corner[1] * row[1] + corner[2] * row[2] + corner[3] * row[3];
+        }
+        if (clip[3] <= 0.0f)
+            return false;
+
+        for (int k = 0; k < 3; k++)
+        {
+            float ndc = clip[k] / clip[3];
+            ndcMin[k] = std::min(ndcMin[k], ndc);
+            ndcMax[k] = std::max(ndcMax[k], ndc);
+        }
+    }
+
+    // pixels of the depth buffer under the box, y grows downwards
+    UINT width = static_cast<UINT>(depthWidth);
+    UINT height = static_cast<UINT>(depthHeight);
+    UINT firstX = std::min(static_cast<UINT>(Saturate(ndcMin[0] * 0.5f + 0.5f) * depthWidth), width - 1);
+    UINT lastX = std::min(static_cast<UINT>(Saturate(ndcMax[0] * 0.5f + 0.5f) * depthWidth), width - 1);
+    UINT firstY = std::min(static_cast<UINT>(Saturate(0.5f - ndcMax[1] * 0.5f) * depthHeight), height - 1);
+    UINT lastY = std::min(static_cast<UINT>(Saturate(0.5f - ndcMin[1] * 0.5f) * depthHeight), height - 1);
+
+    // the first level where they fit in 2x2 texels, a texel of level L
+    // covers 2^(L+1) pixels across
+    UINT level = 0;
+    while (level + 1 < levelCount &&
+        ((lastX >> (level + 1)) - (firstX >> (level + 1)) > 1 || (lastY >> (level + 1)) - (firstY >> (level + 1)) > 1))
+    {
+        level++;
+    }
+
+    const HiZLevel& rect = levels[level];
+    UINT x0 = std::min(firstX >> (level + 1), rect.width - 1);
+    UINT x1 = std::min(lastX >> (level + 1), rect.width - 1);
+    UINT y0 = std::min(firstY >> (level + 1), rect.height - 1);
+    UINT y1 = std::min(lastY >> (level + 1), rect.height - 1);
+    const float* row0 = hiZ + (size_t)(rect.y + y0) * hiZWidth + rect.x;
+    const float* row1 = hiZ + (size_t)(rect.y + y1) * hiZWidth + rect.x;
+    float farthest = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+
+    return ndcMin[2] > farthest;
+}
+
+SoftwareOcclusion::SoftwareOcclusion() :
+    m_rasterizer(1)
+{
+}
+
+void SoftwareOcclusion::SetResolution(UINT width, UINT height)
+{
+    if (!m_layout.Configure(width, height))
+        return;
+
+    m_depth.assign((size_t)width * height, 1.0f);
+    m_filtered.assign((size_t)width * height, 1.0f);
+    m_hiZ.assign((size_t)m_layout.GetWidth() * m_layout.GetHeight(), 1.0f);
+    m_color.assign((size_t)width * height * 4, 0);
+}
+
+UINT SoftwareOcclusion::Cull(const XMMATRIX& viewProj, const XMFLOAT3& eye, const XMMATRIX& shape,
+    const XMFLOAT3& extent, const CullingBounds& bounds, const UINT* indices, UINT count, UINT* visibleIndices)
+{
+    auto start = std::chrono::steady_clock::now();
+    m_stats = SoftwareOcclusionStats();
+    if (count == 0 || m_depth.empty())
+    {
+        if (visibleIndices != indices)
+            memcpy(visibleIndices, indices, sizeof(UINT) * count);
+        return count;
+    }
+
+    XMFLOAT4X4 transposed;
+    XMStoreFloat4x4(&transposed, XMMatrixTranspose(viewProj));
+    const float boxExtent[3] = { extent.x, extent.y, extent.z };
+
+    // The nearest boxes hide the most, of those that hold neither the eye
+    // nor the near plane. Squared distances are positive floats, so their
+    // bits sort like them.
+    m_nearest.clear();
+    m_nearest.reserve(count);
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT id = indices[i];
+        float dx = bounds.centerX[id] - eye.x;
+        float dy = bounds.centerY[id] - eye.y;
+        float dz = bounds.centerZ[id] - eye.z;
+        const float center[3] = { bounds.centerX[id], bounds.centerY[id], bounds.centerZ[id] };
+        bool holdsEye = fabsf(dx) <= extent.x && fabsf(dy) <= extent.y && fabsf(dz) <= extent.z;
+        if (holdsEye || !IsBeyondNearPlane(&transposed.m[0][0], center, boxExtent))
+            continue;
+
+        float distance = dx * dx + dy * dy + dz * dz;
+        UINT bits;
+        memcpy(&bits, &distance, sizeof(bits));
+        m_nearest.push_back((static_cast<UINT64>(bits) << 32) | i);
+    }
+
+    UINT candidates = static_cast<UINT>(m_nearest.size());
+    UINT occluders = std::min(candidates, MaxOccluders);
+    if (occluders < candidates)
+        std::nth_element(m_nearest.begin(), m_nearest.begin() + occluders, m_nearest.end());
+
+    DrawOccluders(viewProj, shape, bounds, indices, occluders);
+    BuildPyramid();
+
+    const float width = static_cast<float>(m_layout.GetDepthWidth());
+    const float height = static_cast<float>(m_layout.GetDepthHeight());
+
+    UINT visibleCount = 0;
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT id = indices[i];
+        const float center[3] = { bounds.centerX[id], bounds.centerY[id], bounds.centerZ[id] };
+        if (!IsBoxOccluded(m_hiZ.data(), m_layout.GetWidth(), m_layout.GetLevels(), m_layout.GetLevelCount(),
+            width, height, &transposed.m[0][0], center, boxExtent))
+        {
+            visibleIndices[visibleCount++] = id;
+        }
+    }
+
+    m_stats.occluders = occluders;
+    m_stats.tested = count;
+    m_stats.hidden = count - visibleCount;
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return visibleCount;
+}
+
+// The occluders are the first count entries of m_nearest
+void SoftwareOcclusion::DrawOccluders(const XMMATRIX& viewProj, const XMMATRIX& shape,
+    const CullingBounds& bounds, const UINT* indices, UINT count)
+{
+    m_occluderModels.resize((size_t)count * 16);
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT id = indices[static_cast<UINT>(m_nearest[i])];
+        XMMATRIX model = shape * XMMatrixTranslation(bounds.centerX[id], bounds.centerY[id], bounds.centerZ[id]);
+        XMStoreFloat4x4(reinterpret_cast<XMFLOAT4X4*>(&m_occluderModels[(size_t)i * 16]), model);
+    }
+
+    XMFLOAT4X4 rowMajorViewProj;
+    XMStoreFloat4x4(&rowMajorViewProj, viewProj);
+    std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+
+    RasterDrawCall draw;
+    draw.pVertexShader = &OccluderVertex;
+    draw.pPixelShader = &OccluderPixel;
+    draw.vertexBindings.constantBuffers[0] = reinterpret_cast<const BYTE*>(&rowMajorViewProj);
+    draw.vertexBindings.resources[0] = reinterpret_cast<const BYTE*>(m_occluderModels.data());
+    draw.vertices = reinterpret_cast<const BYTE*>(UnitCube);
+    draw.vertexStride = sizeof(UnitCube[0]);
+    draw.vertexCount = 8;
+    draw.indices = reinterpret_cast<const BYTE*>(UnitCubeIndices);
+    draw.indexFormat = Format::R16_UINT;
+    draw.count = 36;
+    draw.instanceCount = count;
+    draw.colorTargets[0].data = m_color.data();
+    draw.colorTargets[0].format = Format::R8G8B8A8_UNORM;
+    draw.colorTargetCount = 1;
+    draw.depthTarget = m_depth.data();
+    draw.targetWidth = m_layout.GetDepthWidth();
+    draw.targetHeight = m_layout.GetDepthHeight();
+    draw.viewport.width = static_cast<float>(draw.targetWidth);
+    draw.viewport.height = static_cast<float>(draw.targetHeight);
+    // back faces culled like the cubes themselves
+    draw.rasterizer = RasterizerDesc();
+    draw.blend.writeMask = 0;
+    m_rasterizer.Draw(draw);
+}
+
+void SoftwareOcclusion::BuildPyramid()
+{
+    const UINT width = m_layout.GetDepthWidth();
+    const UINT height = m_layout.GetDepthHeight();
+    for (UINT y = 0; y < height; y++)
+    {
+        UINT y0 = y > 0 ? y - 1 : 0;
+        UINT y1 = std::min(y + 1, height - 1);
+        for (UINT x = 0; x < width; x++)
+        {
+            UINT x0 = x > 0 ? x - 1 : 0;
+            UINT x1 = std::min(x + 1, width - 1);
+            float farthest = 0.0f;
+            for (UINT sy = y0; sy <= y1; sy++)
+            {
+                for (UINT sx = x0; sx <= x1; sx++)
+                {
+                    farthest = std::max(farthest, m_depth[(size_t)sy * width + sx]);
+                }
+            }
+            m_filtered[(size_t)y * width + x] = farthest;
+        }
+    }
+
+    const UINT pitch = m_layout.GetWidth();
+    const HiZLevel* levels = m_layout.GetLevels();
+    BuildHiZLevel(m_filtered.data(), width, width, height,
+        m_hiZ.data() + (size_t)levels[0].y * pitch + levels[0].x, pitch, levels[0].width, levels[0].height);
+    for (UINT i = 1; i < m_layout.GetLevelCount(); i++)
+    {
+        const HiZLevel& source = levels[i - 1];
+        BuildHiZLevel(m_hiZ.data() + (size_t)source.y * pitch + source.x, pitch, source.width, source.height,
+            m_hiZ.data() + (size_t)levels[i].y * pitch + levels[i].x, pitch, levels[i].width, levels[i].height);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include "Platform.h"
+#include "FrustumCulling.h"
+#include "SoftwareRasterizer.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+const UINT MaxHiZLevels = 16;
+
+// A rectangle of the pyramid texture, HiZLevel of ComputeShader.cs and HiZ.cs
+struct HiZLevel
+{
+    UINT x;
+    UINT y;
+    UINT width;
+    UINT height;
+};
+
+// Where the levels of a max-depth pyramid go in one R32_FLOAT texture, so
+// that a shader can read any level without views of single mips. Level 0
+// halves the depth buffer and sits in the top left corner, every further
+// level halves the one before, rounding up, and they are stacked to its
+// right down to 1x1. A texel holds the farthest depth under it.
+class HiZLayout
+{
+public:
+    HiZLayout();
+
+    // True when the layout changed
+    bool Configure(UINT depthWidth, UINT depthHeight);
+
+    UINT GetDepthWidth() const { return m_depthWidth; }
+    UINT GetDepthHeight() const { return m_depthHeight; }
+    UINT GetWidth() const { return m_width; }
+    UINT GetHeight() const { return m_height; }
+    UINT GetLevelCount() const { return m_levelCount; }
+    const HiZLevel* GetLevels() const { return m_levels; }
+
+private:
+    UINT m_depthWidth;
+    UINT m_depthHeight;
+    UINT m_width;
+    UINT m_height;
+    UINT m_levelCount;
+    HiZLevel m_levels[MaxHiZLevels];
+};
+
+// Every target texel is the farthest of the 2x2 source texels under it,
+// with rows and columns past an odd source size clamped to its edge (HiZ.cs)
+void BuildHiZLevel(const float* source, UINT sourcePitch, UINT sourceWidth, UINT sourceHeight,
+    float* target, UINT targetPitch, UINT targetWidth, UINT targetHeight);
+
+// IsOccluded of ComputeShader.cs: the box is hidden if its nearest depth is
+// behind the farthest depth of the pyramid over every pixel it covers.
+// viewProj is transposed like the constant buffers, boxes reaching behind
+// the camera are never hidden.
+bool IsBoxOccluded(const float* hiZ, UINT hiZWidth, const HiZLevel* levels, UINT levelCount,
+    float depthWidth, float depthHeight, const float* viewProj, const float center[3], const float extent[3]);
+
+struct SoftwareOcclusionStats
+{
+    UINT occluders = 0;     // boxes drawn into the depth buffer
+    UINT tested = 0;
+    UINT hidden = 0;
+    double seconds = 0.0;
+};
+
+// Occlusion culling without a GPU. The boxes nearest to the camera, of
+// those wholly beyond the near plane, are drawn as occluders into a small
+// depth buffer by a SoftwareRasterizer of its own, a pyramid is built over
+// it and every box is tested the way ComputeShader.cs tests against the
+// Hi-Z of the GPU depth.
+//
+// An occluder only partly covers the pixels along its edges, so the pyramid
+// starts from the farthest depth of every 3x3 pixels; a box is then only
+// hidden by pixels that are covered all over.
+class SoftwareOcclusion
+{
+public:
+    static const UINT DefaultWidth = 256;
+    static const UINT MaxOccluders = 256;
+
+    SoftwareOcclusion();
+
+    SoftwareOcclusion(const SoftwareOcclusion&) = delete;
+    SoftwareOcclusion& operator=(const SoftwareOcclusion&) = delete;
+
+    void SetResolution(UINT width, UINT height);
+    UINT GetWidth() const { return m_layout.GetDepthWidth(); }
+    UINT GetHeight() const { return m_layout.GetDepthHeight(); }
+
+    // Keeps the boxes of indices that are not hidden, in the same order, and
+    // returns how many there are; visibleIndices may be indices. Occluders
+    // are the unit cube transformed by shape and moved to the box center,
+    // extent must hold every such cube.
+    UINT Cull(const DirectX::XMMATRIX& viewProj, const DirectX::XMFLOAT3& eye, const DirectX::XMMATRIX& shape,
+        const DirectX::XMFLOAT3& extent, const CullingBounds& bounds, const UINT* indices, UINT count, UINT* visibleIndices);
+
+    // The occluder depth of the last Cull, before the 3x3 filter
+    const std::vector<float>& GetDepth() const { return m_depth; }
+    const SoftwareOcclusionStats& GetStats() const { return m_stats; }
+
+private:
+    void DrawOccluders(const DirectX::XMMATRIX& viewProj, const DirectX::XMMATRIX& shape,
+        const CullingBounds& bounds, const UINT* indices, UINT count);
+    void BuildPyramid();
+
+    SoftwareRasterizer m_rasterizer;
+    HiZLayout m_layout;
+    std::vector<float> m_depth;
+    std::vector<float> m_filtered;
+    std::vector<float> m_hiZ;
+    std::vector<BYTE> m_color;              // the rasterizer needs a target, nothing is written to it
+    std::vector<float> m_occluderModels;    // row major, one matrix per occluder
+    std::vector<UINT64> m_nearest;          // distance bits and index of every box
+    SoftwareOcclusionStats m_stats;
+};
+
+#endif
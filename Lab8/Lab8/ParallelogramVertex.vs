@@ -1,8 +1,13 @@
-cbuffer MatrixBuffer : register(b0)
+// One translucent quad per instance, taken in the order of quadOrder
+struct TranslucentQuad
 {
-    matrix m;
+    float4x4 model;
+    float4 color;
 };
 
+StructuredBuffer<TranslucentQuad> quads : register(t0);
+StructuredBuffer<uint> quadOrder : register(t1);
+
 cbuffer CameraBuffer : register(b1)
 {
     matrix vp;
@@ -17,13 +22,17 @@ struct VSOutput
 {
     float4 pos : SV_Position;
     float3 WorldPos : TEXCOORD0;
+    float4 Color : COLOR0;
 };
 
-VSOutput main(VSInput vertex)
+VSOutput main(VSInput vertex, uint instanceID : SV_InstanceID)
 {
+    TranslucentQuad quad = quads[quadOrder[instanceID]];
+
     VSOutput output;
-    float4 worldPos = mul(float4(vertex.pos, 1.0f), m);
+    float4 worldPos = mul(float4(vertex.pos, 1.0f), quad.model);
     output.WorldPos = worldPos.xyz;
     output.pos = mul(worldPos, vp);
+    output.Color = quad.color;
     return output;
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Windows builds use the regular SDK headers. Everywhere else (the headless
+// build) we only need the handful of Win32 types the renderer code uses.
+#ifdef _WIN32
+
+#include "framework.h"
+
+#else
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t UINT;
+typedef uint32_t DWORD;
+typedef uint64_t UINT64;
+typedef int32_t HRESULT;
+typedef wchar_t WCHAR;
+
+#define S_OK           ((HRESULT)0)
+#define S_FALSE        ((HRESULT)1)
+#define E_FAIL         ((HRESULT)0x80004005)
+#define E_INVALIDARG   ((HRESULT)0x80070057)
+#define E_OUTOFMEMORY  ((HRESULT)0x8007000E)
+#define E_NOTIMPL      ((HRESULT)0x80004001)
+
+#define SUCCEEDED(hr)  (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)     (((HRESULT)(hr)) < 0)
+
+#ifndef ARRAYSIZE
+#define ARRAYSIZE(a)   (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#endif
+
+#endif
@@ -0,0 +1,421 @@
+#include "PostProcess.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define POST_PROCESS_SSE 1
+#endif
+
+namespace
+{
+    // Blocks a stage is run in, the texels around one are kept as floats
+    const UINT TileWidth = 64;
+    const UINT TileHeight = 8;
+    const UINT PlanePitch = TileWidth + 4;      // the neighbours on both sides, rounded up to groups of four
+
+    inline float Min(float a, float b) { return a < b ? a : b; }
+    inline float Max(float a, float b) { return a > b ? a : b; }
+
+    template <typename V>
+    inline V Load(const float* p);
+
+    template <>
+    inline float Load<float>(const float* p) { return *p; }
+
+    inline void Store(float* p, float value) { *p = value; }
+
+#ifdef POST_PROCESS_SSE
+    // Four lanes with the operators of a float, so that both paths share the
+    // effects and compute the same values
+    struct Float4
+    {
+        __m128 v;
+
+        Float4() {}
+        Float4(float f) : v(_mm_set1_ps(f)) {}
+        Float4(__m128 m) : v(m) {}
+    };
+
+    inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+    inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+    inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+    inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+    inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+    inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+
+    template <>
+    inline Float4 Load<Float4>(const float* p) { return _mm_loadu_ps(p); }
+
+    inline void Store(float* p, Float4 value) { _mm_storeu_ps(p, value.v); }
+#endif
+
+    template <typename V>
+    inline V Saturate(V x)
+    {
+        return Min(Max(x, V(0.0f)), V(1.0f));
+    }
+
+    // Narkowicz's fit of the ACES curve
+    template <typename V>
+    inline V ToneMap(V x)
+    {
+        return Saturate((x * (V(2.51f) * x + V(0.03f))) / (x * (V(2.43f) * x + V(0.59f)) + V(0.14f)));
+    }
+
+    template <typename V>
+    void ApplyEffects(const PostProcessConstants& constants, UINT first, UINT last, V& r, V& g, V& b)
+    {
+        for (UINT i = first; i < last; i++)
+        {
+            switch (static_cast<PostEffect>(constants.effects[i]))
+            {
+            case PostEffect::ToneMap:
+            {
+                V exposure(constants.exposure);
+                r = ToneMap(r * exposure);
+                g = ToneMap(g * exposure);
+                b = ToneMap(b * exposure);
+                break;
+            }
+            case PostEffect::ColorGrade:
+            {
+                V tr = r * V(constants.tint.x);
+                V tg = g * V(constants.tint.y);
+                V tb = b * V(constants.tint.z);
+                V luma = tr * V(0.2126f) + tg * V(0.7152f) + tb * V(0.0722f);
+                V saturation(constants.saturation);
+                V contrast(constants.contrast);
+                r = Saturate((luma + (tr - luma) * saturation - V(0.5f)) * contrast + V(0.5f));
+                g = Saturate((luma + (tg - luma) * saturation - V(0.5f)) * contrast + V(0.5f));
+                b = Saturate((luma + (tb - luma) * saturation - V(0.5f)) * contrast + V(0.5f));
+                break;
+            }
+            case PostEffect::Negative:
+                r = V(1.0f) - r;
+                g = V(1.0f) - g;
+                b = V(1.0f) - b;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // 1 2 1 in both directions, the rows start left of the pixel
+    template <typename V>
+    inline V Gaussian3x3(const float* above, const float* row, const float* below)
+    {
+        V top = Load<V>(above) + V(2.0f) * Load<V>(above + 1) + Load<V>(above + 2);
+        V middle = Load<V>(row) + V(2.0f) * Load<V>(row + 1) + Load<V>(row + 2);
+        V bottom = Load<V>(below) + V(2.0f) * Load<V>(below + 1) + Load<V>(below + 2);
+        return (top + V(2.0f) * middle + bottom) * V(1.0f / 16.0f);
+    }
+
+    inline UINT ClampColumn(int x, UINT width)
+    {
+        return x < 0 ? 0 : (x >= static_cast<int>(width) ? width - 1 : static_cast<UINT>(x));
+    }
+
+    inline void LoadTexels(const BYTE* row, UINT width, int x, float& r, float& g, float& b)
+    {
+        const BYTE* texel = row + ClampColumn(x, width) * 4;
+        r = texel[0] * (1.0f / 255.0f);
+        g = texel[1] * (1.0f / 255.0f);
+        b = texel[2] * (1.0f / 255.0f);
+    }
+
+    // alpha comes from the source texel
+    inline void StoreTexels(BYTE* target, const BYTE* source, UINT, float r, float g, float b)
+    {
+        target[0] = static_cast<BYTE>(Saturate(r) * 255.0f + 0.5f);
+        target[1] = static_cast<BYTE>(Saturate(g) * 255.0f + 0.5f);
+        target[2] = static_cast<BYTE>(Saturate(b) * 255.0f + 0.5f);
+        target[3] = source[3];
+    }
+
+#ifdef POST_PROCESS_SSE
+    inline int LoadTexel(const BYTE* row, UINT width, int x)
+    {
+        int texel;
+        memcpy(&texel, row + ClampColumn(x, width) * 4, sizeof(texel));
+        return texel;
+    }
+
+    inline void LoadTexels(const BYTE* row, UINT width, int x, Float4& r, Float4& g, Float4& b)
+    {
+        __m128i texels;
+        if (x >= 0 && x + 4 <= static_cast<int>(width))
+        {
+            texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4));
+        }
+        else
+        {
+            texels = _mm_set_epi32(LoadTexel(row, width, x + 3), LoadTexel(row, width, x + 2),
+                LoadTexel(row, width, x + 1), LoadTexel(row, width, x));
+        }
+
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+        r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(texels, mask)), scale);
+        g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 8), mask)), scale);
+        b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 16), mask)), scale);
+    }
+
+    inline __m128i ToUnorm(Float4 c)
+    {
+        return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(Saturate(c).v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+    }
+
+    inline void StoreTexels(BYTE* target, const BYTE* source, UINT count, Float4 r, Float4 g, Float4 b)
+    {
+        __m128i rgb = _mm_or_si128(_mm_or_si128(ToUnorm(r), _mm_slli_epi32(ToUnorm(g), 8)), _mm_slli_epi32(ToUnorm(b), 16));
+        if (count == 4)
+        {
+            __m128i alpha = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)), _mm_set1_epi32(0xFF000000));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_or_si128(rgb, alpha));
+            return;
+        }
+
+        // the right edge of the image
+        alignas(16) BYTE texels[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(texels), rgb);
+        for (UINT i = 0; i < count; i++)
+        {
+            memcpy(target + i * 4, texels + i * 4, 3);
+            target[i * 4 + 3] = source[i * 4 + 3];
+        }
+    }
+#endif
+
+    template <typename V>
+    void ApplyTile(const PostProcessConstants& constants, const BYTE* source, BYTE* target, UINT x, UINT y, UINT width, UINT height)
+    {
+        const UINT lanes = sizeof(V) / sizeof(float);
+        const UINT imageWidth = constants.width;
+
+        if (constants.kernelIndex >= constants.effectCount)
+        {
+            // every effect on the pixel alone, straight from the source
+            for (UINT row = y; row < y + height; row++)
+            {
+                const BYTE* pSourceRow = source + (size_t)row * imageWidth * 4;
+                BYTE* pTargetRow = target + (size_t)row * imageWidth * 4;
+                for (UINT column = x; column < x + width; column += lanes)
+                {
+                    V r, g, b;
+                    LoadTexels(pSourceRow, imageWidth, static_cast<int>(column), r, g, b);
+                    ApplyEffects(constants, 0, constants.effectCount, r, g, b);
+                    StoreTexels(pTargetRow + column * 4, pSourceRow + column * 4, std::min(lanes, x + width - column), r, g, b);
+                }
+            }
+            return;
+        }
+
+        // The tile and a texel around it after the effects before the
+        // kernel, like the group shared tile of PostProcess.cs. The last
+        // group of four reads two texels past the tile.
+        float planes[3][TileHeight + 2][PlanePitch];
+        const UINT loadWidth = (width + lanes - 1) / lanes * lanes + 2;
+        for (UINT row = 0; row < height + 2; row++)
+        {
+            int sourceRow = std::min(std::max(static_cast<int>(y + row) - 1, 0), static_cast<int>(constants.height) - 1);
+            const BYTE* pSourceRow = source + (size_t)sourceRow * imageWidth * 4;
+            for (UINT i = 0; i < loadWidth; i += lanes)
+            {
+                V r, g, b;
+                LoadTexels(pSourceRow, imageWidth, static_cast<int>(x + i) - 1, r, g, b);
+                ApplyEffects(constants, 0, constants.kernelIndex, r, g, b);
+                Store(&planes[0][row][i], r);
+                Store(&planes[1][row][i], g);
+                Store(&planes[2][row][i], b);
+            }
+        }
+
+        const bool blur = static_cast<PostEffect>(constants.effects[constants.kernelIndex]) == PostEffect::Blur;
+        const V sharpness(constants.sharpness);
+        for (UINT row = 0; row < height; row++)
+        {
+            const BYTE* pSourceRow = source + (size_t)(y + row) * imageWidth * 4;
+            BYTE* pTargetRow = target + (size_t)(y + row) * imageWidth * 4;
+            for (UINT i = 0; i < width; i += lanes)
+            {
+                V color[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    V blurred = Gaussian3x3<V>(&planes[c][row][i], &planes[c][row + 1][i], &planes[c][row + 2][i]);
+                    if (blur)
+                    {
+                        color[c] = blurred;
+                    }
+                    else
+                    {
+                        V center = Load<V>(&planes[c][row + 1][i + 1]);
+                        color[c] = Saturate(center + sharpness * (center - blurred));
+                    }
+                }
+                ApplyEffects(constants, constants.kernelIndex + 1, constants.effectCount, color[0], color[1], color[2]);
+
+                UINT column = x + i;
+                StoreTexels(pTargetRow + column * 4, pSourceRow + column * 4, std::min(lanes, width - i), color[0], color[1], color[2]);
+            }
+        }
+    }
+}
+
+const char* GetPostEffectName(PostEffect effect)
+{
+    switch (effect)
+    {
+    case PostEffect::ToneMap: return "Tone Map";
+    case PostEffect::ColorGrade: return "Color Grade";
+    case PostEffect::Negative: return "Negative";
+    case PostEffect::Blur: return "Blur";
+    case PostEffect::Sharpen: return "Sharpen";
+    default: return "None";
+    }
+}
+
+bool IsPostEffectPerPixel(PostEffect effect)
+{
+    return effect != PostEffect::Blur && effect != PostEffect::Sharpen;
+}
+
+void ApplyPostProcessStage(const PostProcessConstants& constants, const BYTE* source, BYTE* target,
+    UINT x, UINT y, UINT width, UINT height, PostProcessPath path)
+{
+    if (constants.effectCount == 0 || constants.effectCount > PostMaxEffects || x >= constants.width || y >= constants.height)
+        return;
+
+    width = std::min(width, constants.width - x);
+    height = std::min(height, constants.height - y);
+    for (UINT tileY = y; tileY < y + height; tileY += TileHeight)
+    {
+        for (UINT tileX = x; tileX < x + width; tileX += TileWidth)
+        {
+            UINT tileWidth = std::min(TileWidth, x + width - tileX);
+            UINT tileHeight = std::min(TileHeight, y + height - tileY);
+#ifdef POST_PROCESS_SSE
+            if (path == PostProcessPath::SSE)
+            {
+                ApplyTile<Float4>(constants, source, target, tileX, tileY, tileWidth, tileHeight);
+                continue;
+            }
+#endif
+            ApplyTile<float>(constants, source, target, tileX, tileY, tileWidth, tileHeight);
+        }
+    }
+}
+
+PostProcessChain::PostProcessChain()
+    : m_effectCount(0),
+    m_stageCount(0),
+    m_fuse(true)
+{
+    m_stageFirst[0] = 0;
+}
+
+void PostProcessChain::Clear()
+{
+    m_effectCount = 0;
+    BuildStages();
+}
+
+bool PostProcessChain::Add(PostEffect effect)
+{
+    if (m_effectCount == PostMaxEffects || effect >= PostEffect::Count)
+        return false;
+
+    m_effects[m_effectCount++] = effect;
+    BuildStages();
+    return true;
+}
+
+void PostProcessChain::SetEffects(const PostEffect* effects, UINT count)
+{
+    m_effectCount = 0;
+    for (UINT i = 0; i < count && m_effectCount < PostMaxEffects; i++)
+    {
+        if (effects[i] < PostEffect::Count)
+            m_effects[m_effectCount++] = effects[i];
+    }
+    BuildStages();
+}
+
+void PostProcessChain::SetFuse(bool fuse)
+{
+    m_fuse = fuse;
+    BuildStages();
+}
+
+// A stage ends before the second blur or sharpen, or after every effect
+// when fusing is off
+void PostProcessChain::BuildStages()
+{
+    m_stageCount = 0;
+    bool hasKernel = false;
+    for (UINT i = 0; i < m_effectCount; i++)
+    {
+        bool perPixel = IsPostEffectPerPixel(m_effects[i]);
+        if (m_stageCount == 0 || !m_fuse || (!perPixel && hasKernel))
+        {
+            m_stageFirst[m_stageCount++] = i;
+            hasKernel = false;
+        }
+        hasKernel = hasKernel || !perPixel;
+    }
+    m_stageFirst[m_stageCount] = m_effectCount;
+}
+
+void PostProcessChain::GetStageConstants(UINT stage, UINT width, UINT height, PostProcessConstants& constants) const
+{
+    memset(&constants, 0, sizeof(constants));
+    constants.width = width;
+    constants.height = height;
+    if (stage < m_stageCount)
+    {
+        constants.effectCount = m_stageFirst[stage + 1] - m_stageFirst[stage];
+        constants.kernelIndex = constants.effectCount;
+        for (UINT i = 0; i < constants.effectCount; i++)
+        {
+            PostEffect effect = m_effects[m_stageFirst[stage] + i];
+            constants.effects[i] = static_cast<UINT>(effect);
+            if (!IsPostEffectPerPixel(effect))
+                constants.kernelIndex = i;
+        }
+    }
+
+    constants.exposure = m_settings.exposure;
+    constants.contrast = m_settings.contrast;
+    constants.saturation = m_settings.saturation;
+    constants.sharpness = m_settings.sharpness;
+    constants.tint = DirectX::XMFLOAT4(m_settings.tint.x, m_settings.tint.y, m_settings.tint.z, 1.0f);
+}
+
+void PostProcessChain::Apply(const BYTE* source, BYTE* target, UINT width, UINT height, PostProcessPath path)
+{
+    const size_t byteSize = (size_t)width * height * 4;
+    if (m_stageCount == 0)
+    {
+        memcpy(target, source, byteSize);
+        return;
+    }
+
+    // the stages in between ping-pong like the transient textures of the graph
+    const BYTE* pSource = source;
+    for (UINT stage = 0; stage < m_stageCount; stage++)
+    {
+        BYTE* pTarget = target;
+        if (stage + 1 < m_stageCount)
+        {
+            m_scratch[stage & 1].resize(byteSize);
+            pTarget = m_scratch[stage & 1].data();
+        }
+
+        PostProcessConstants constants;
+        GetStageConstants(stage, width, height, constants);
+        ApplyPostProcessStage(constants, pSource, pTarget, 0, 0, width, height, path);
+        pSource = pTarget;
+    }
+}
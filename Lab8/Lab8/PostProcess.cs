@@ -0,0 +1,109 @@
+// One stage of the post-processing chain, see PostProcessChain in
+// PostProcess.h. The effects before the blur or sharpen run on every texel
+// the group loads, the ones after it on the result, so the stage reads and
+// writes every pixel once whatever the number of effects in it.
+#define EFFECT_TONE_MAP 0
+#define EFFECT_COLOR_GRADE 1
+#define EFFECT_NEGATIVE 2
+#define EFFECT_BLUR 3
+#define EFFECT_SHARPEN 4
+
+#define GROUP_SIZE 8
+#define TILE_SIZE (GROUP_SIZE + 2)
+
+cbuffer PostProcessConstants : register(b0)
+{
+    uint2 imageSize;
+    uint effectCount;
+    uint kernelIndex;       // of the blur or sharpen, effectCount without one
+    uint4 effects[2];
+    float exposure;
+    float contrast;
+    float saturation;
+    float sharpness;
+    float4 tint;
+};
+
+Texture2D<float4> source : register(t0);
+RWTexture2D<unorm float4> target : register(u0);
+
+groupshared float3 tile[TILE_SIZE][TILE_SIZE];
+
+uint GetEffect(uint index)
+{
+    return effects[index / 4][index % 4];
+}
+
+// Narkowicz's fit of the ACES curve
+float3 ToneMap(float3 x)
+{
+    return saturate((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f));
+}
+
+float3 ApplyEffects(uint first, uint last, float3 color)
+{
+    [loop]
+    for (uint i = first; i < last; i++)
+    {
+        uint effect = GetEffect(i);
+        if (effect == EFFECT_TONE_MAP)
+        {
+            color = ToneMap(color * exposure);
+        }
+        else if (effect == EFFECT_COLOR_GRADE)
+        {
+            float3 tinted = color * tint.rgb;
+            float luma = dot(tinted, float3(0.2126f, 0.7152f, 0.0722f));
+            color = saturate((luma + (tinted - luma) * saturation - 0.5f) * contrast + 0.5f);
+        }
+        else if (effect == EFFECT_NEGATIVE)
+        {
+            color = 1.0f - color;
+        }
+    }
+    return color;
+}
+
+[numthreads(GROUP_SIZE, GROUP_SIZE, 1)]
+void main(uint3 groupID : SV_GroupID, uint3 groupThreadID : SV_GroupThreadID, uint3 threadID : SV_DispatchThreadID,
+    uint groupIndex : SV_GroupIndex)
+{
+    int2 last = int2(imageSize) - 1;
+    int2 p = int2(threadID.xy);
+    float4 center = source[min(p, last)];
+    float3 color;
+
+    // the constants are the same for the whole dispatch, so is the branch
+    if (kernelIndex < effectCount)
+    {
+        // the texels of the group and one around it, clamped to the image
+        int2 origin = int2(groupID.xy * GROUP_SIZE) - 1;
+        for (uint i = groupIndex; i < TILE_SIZE * TILE_SIZE; i += GROUP_SIZE * GROUP_SIZE)
+        {
+            int2 q = clamp(origin + int2(i % TILE_SIZE, i / TILE_SIZE), 0, last);
+            tile[i / TILE_SIZE][i % TILE_SIZE] = ApplyEffects(0, kernelIndex, source[q].rgb);
+        }
+        GroupMemoryBarrierWithGroupSync();
+
+        uint2 t = groupThreadID.xy;
+        float3 top = tile[t.y][t.x] + 2.0f * tile[t.y][t.x + 1] + tile[t.y][t.x + 2];
+        float3 middle = tile[t.y + 1][t.x] + 2.0f * tile[t.y + 1][t.x + 1] + tile[t.y + 1][t.x + 2];
+        float3 bottom = tile[t.y + 2][t.x] + 2.0f * tile[t.y + 2][t.x + 1] + tile[t.y + 2][t.x + 2];
+        float3 blurred = (top + 2.0f * middle + bottom) * (1.0f / 16.0f);
+
+        color = blurred;
+        if (GetEffect(kernelIndex) == EFFECT_SHARPEN)
+        {
+            float3 sharp = tile[t.y + 1][t.x + 1];
+            color = saturate(sharp + sharpness * (sharp - blurred));
+        }
+        color = ApplyEffects(kernelIndex + 1, effectCount, color);
+    }
+    else
+    {
+        color = ApplyEffects(0, effectCount, center.rgb);
+    }
+
+    if (all(p <= last))
+        target[p] = float4(color, center.a);
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include "Platform.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+// Values match the EFFECT_ defines of PostProcess.cs
+enum class PostEffect : UINT
+{
+    ToneMap,        // filmic curve of the exposed color
+    ColorGrade,     // tint, saturation and contrast
+    Negative,
+    Blur,           // 3x3 gaussian
+    Sharpen,        // unsharp mask of the same gaussian
+    Count
+};
+
+const UINT PostMaxEffects = 8;
+
+// Constants of PostProcess.cs (register b0) for one stage of the chain
+struct PostProcessConstants
+{
+    UINT width;
+    UINT height;
+    UINT effectCount;
+    UINT kernelIndex;               // of the blur or sharpen, effectCount without one
+    UINT effects[PostMaxEffects];   // PostEffect, as two uint4
+    float exposure;
+    float contrast;
+    float saturation;
+    float sharpness;
+    DirectX::XMFLOAT4 tint;         // rgb gain of the color grade
+};
+
+struct PostProcessSettings
+{
+    float exposure = 1.0f;
+    float contrast = 1.1f;
+    float saturation = 1.2f;
+    float sharpness = 0.6f;
+    DirectX::XMFLOAT3 tint = DirectX::XMFLOAT3(1.0f, 0.97f, 0.92f);
+};
+
+enum class PostProcessPath
+{
+    Scalar,
+    SSE         // the red, green and blue of four pixels per iteration
+};
+
+const char* GetPostEffectName(PostEffect effect);
+// Blur and sharpen read the neighbours of a pixel, the others only the pixel
+bool IsPostEffectPerPixel(PostEffect effect);
+
+// What one thread group of PostProcess.cs does, for the rectangle at x, y
+// of the target: the effects before the kernel on every texel read, the
+// neighbours clamped to the image, then the kernel and the effects after
+// it. source and target are RGBA8 images of constants.width x height and
+// must not overlap. Alpha is copied.
+void ApplyPostProcessStage(const PostProcessConstants& constants, const BYTE* source, BYTE* target,
+    UINT x, UINT y, UINT width, UINT height, PostProcessPath path);
+
+// A chain of effects run by compute shaders. Adjacent effects are fused
+// into stages, one dispatch each, so that a pixel is read and written once
+// per stage whatever the number of effects in it. A stage holds at most one
+// blur or sharpen; the per-pixel effects before it run on every texel it
+// reads and the ones after it on its result. The last stage writes the
+// back buffer itself.
+class PostProcessChain
+{
+public:
+    static const UINT ThreadGroupSize = 8;      // [numthreads(8, 8, 1)]
+
+    PostProcessChain();
+
+    void Clear();
+    // false when the chain is full
+    bool Add(PostEffect effect);
+    void SetEffects(const PostEffect* effects, UINT count);
+
+    UINT GetEffectCount() const { return m_effectCount; }
+    PostEffect GetEffect(UINT index) const { return m_effects[index]; }
+
+    void SetSettings(const PostProcessSettings& settings) { m_settings = settings; }
+    const PostProcessSettings& GetSettings() const { return m_settings; }
+
+    // With fusing off every effect is a stage of its own, for measuring
+    void SetFuse(bool fuse);
+    bool GetFuse() const { return m_fuse; }
+
+    UINT GetStageCount() const { return m_stageCount; }
+    void GetStageConstants(UINT stage, UINT width, UINT height, PostProcessConstants& constants) const;
+
+    // The whole chain on the CPU, stage by stage like the GPU
+    void Apply(const BYTE* source, BYTE* target, UINT width, UINT height, PostProcessPath path);
+
+private:
+    void BuildStages();
+
+    PostEffect m_effects[PostMaxEffects];
+    UINT m_effectCount;
+    UINT m_stageFirst[PostMaxEffects + 1];      // first effect of every stage, then m_effectCount
+    UINT m_stageCount;
+    bool m_fuse;
+    PostProcessSettings m_settings;
+    std::vector<BYTE> m_scratch[2];
+};
+
+#endif
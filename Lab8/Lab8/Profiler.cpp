@@ -0,0 +1,364 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// Every thread that times a scope gets the next track, 0 is the GPU's
+static std::atomic<UINT> s_nextTrack(1);
+static thread_local UINT t_track = 0;
+static thread_local UINT t_cpuDepth = 0;
+static thread_local UINT t_gpuDepth = 0;
+
+static FILE* OpenForWrite(const std::wstring& path)
+{
+#ifdef _WIN32
+    return _wfopen(path.c_str(), L"wb");
+#else
+    return fopen(std::string(path.begin(), path.end()).c_str(), "wb");
+#endif
+}
+
+Profiler::Profiler() :
+    m_pDevice(nullptr),
+    m_enabled(true),
+    m_inFrame(false),
+    m_origin(std::chrono::steady_clock::now()),
+    m_frameIndex(0),
+    m_frameStart(0.0),
+    m_cpuCount(0),
+    m_historyCount(0),
+    m_droppedScopes(0),
+    m_droppedGpuFrames(0)
+{
+    for (GpuFrame& gpuFrame : m_gpuFrames)
+    {
+        gpuFrame.index = 0;
+        gpuFrame.pending = false;
+        gpuFrame.disjoint = NullHandle;
+        gpuFrame.frameBegin = NullHandle;
+        gpuFrame.frameEnd = NullHandle;
+        gpuFrame.scopeCount = 0;
+        for (GpuScope& scope : gpuFrame.scopes)
+        {
+            scope = GpuScope();
+        }
+    }
+}
+
+Profiler::~Profiler()
+{
+    Terminate();
+}
+
+HRESULT Profiler::Init(RenderDevice* pDevice)
+{
+    m_history.resize(HistoryFrames);
+    for (ProfileFrame& frame : m_history)
+    {
+        frame.events.reserve(MaxCpuScopes + MaxGpuScopes);
+    }
+    m_historyCount = 0;
+    m_frameIndex = 0;
+
+    m_pDevice = pDevice;
+    if (!m_pDevice)
+        return S_OK;
+
+    HRESULT result = S_OK;
+    for (GpuFrame& gpuFrame : m_gpuFrames)
+    {
+        gpuFrame.pending = false;
+        if (SUCCEEDED(result))
+            result = m_pDevice->CreateQuery(QueryType::TimestampDisjoint, &gpuFrame.disjoint);
+        if (SUCCEEDED(result))
+            result = m_pDevice->CreateQuery(QueryType::Timestamp, &gpuFrame.frameBegin);
+        if (SUCCEEDED(result))
+            result = m_pDevice->CreateQuery(QueryType::Timestamp, &gpuFrame.frameEnd);
+        for (GpuScope& scope : gpuFrame.scopes)
+        {
+            if (SUCCEEDED(result))
+                result = m_pDevice->CreateQuery(QueryType::Timestamp, &scope.begin);
+            if (SUCCEEDED(result))
+                result = m_pDevice->CreateQuery(QueryType::Timestamp, &scope.end);
+        }
+    }
+
+    // the CPU is still timed without queries
+    if (FAILED(result))
+        ReleaseQueries();
+    return result;
+}
+
+void Profiler::ReleaseQueries()
+{
+    if (!m_pDevice)
+        return;
+
+    for (GpuFrame& gpuFrame : m_gpuFrames)
+    {
+        RenderHandle* handles[] = { &gpuFrame.disjoint, &gpuFrame.frameBegin, &gpuFrame.frameEnd };
+        for (RenderHandle* pHandle : handles)
+        {
+            if (*pHandle)
+                m_pDevice->Release(*pHandle);
+            *pHandle = NullHandle;
+        }
+        for (GpuScope& scope : gpuFrame.scopes)
+        {
+            if (scope.begin)
+                m_pDevice->Release(scope.begin);
+            if (scope.end)
+                m_pDevice->Release(scope.end);
+            scope.begin = NullHandle;
+            scope.end = NullHandle;
+        }
+        gpuFrame.pending = false;
+    }
+}
+
+void Profiler::Terminate()
+{
+    ReleaseQueries();
+    m_pDevice = nullptr;
+    m_inFrame = false;
+}
+
+double Profiler::Now() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_origin).count();
+}
+
+void Profiler::BeginFrame(RenderContext* pImmediate)
+{
+    m_inFrame = m_enabled && !m_history.empty();
+    if (!m_inFrame)
+        return;
+
+    m_frameStart = Now();
+    m_cpuCount = 0;
+
+    GpuFrame& gpuFrame = m_gpuFrames[m_frameIndex % FrameLatency];
+    if (!gpuFrame.disjoint)
+        return;
+
+    // a last look at the frame whose queries are about to be reused
+    if (gpuFrame.pending && !ResolveGpuFrame(pImmediate, gpuFrame))
+        m_droppedGpuFrames++;
+    gpuFrame.pending = false;
+    gpuFrame.index = m_frameIndex;
+    gpuFrame.scopeCount = 0;
+
+    pImmediate->BeginQuery(gpuFrame.disjoint);
+    pImmediate->EndQuery(gpuFrame.frameBegin);
+}
+
+void Profiler::EndFrame(RenderContext* pImmediate)
+{
+    if (!m_inFrame)
+        return;
+    m_inFrame = false;
+
+    ProfileFrame& frame = m_history[m_frameIndex % HistoryFrames];
+    frame.index = m_frameIndex;
+    frame.start = m_frameStart;
+    frame.cpuSeconds = Now() - m_frameStart;
+    frame.gpuSeconds = 0.0;
+    frame.gpuResolved = false;
+    frame.events.clear();
+
+    UINT cpuCount = m_cpuCount.load();
+    if (cpuCount > MaxCpuScopes)
+        cpuCount = MaxCpuScopes;
+    for (UINT i = 0; i < cpuCount; i++)
+    {
+        const CpuScope& scope = m_cpuScopes[i];
+        if (scope.end >= scope.start)
+            frame.events.push_back({ scope.name, scope.start, scope.end - scope.start, scope.track, scope.depth });
+    }
+
+    GpuFrame& gpuFrame = m_gpuFrames[m_frameIndex % FrameLatency];
+    if (gpuFrame.disjoint)
+    {
+        pImmediate->EndQuery(gpuFrame.frameEnd);
+        pImmediate->EndQuery(gpuFrame.disjoint);
+        gpuFrame.pending = true;
+
+        // earlier frames whose results have come in meanwhile
+        for (GpuFrame& earlier : m_gpuFrames)
+        {
+            if (&earlier != &gpuFrame && earlier.pending && ResolveGpuFrame(pImmediate, earlier))
+                earlier.pending = false;
+        }
+    }
+
+    m_frameIndex++;
+    m_historyCount++;
+}
+
+bool Profiler::ResolveGpuFrame(RenderContext* pImmediate, GpuFrame& gpuFrame)
+{
+    UINT64 frequency = 0;
+    UINT64 frameBegin = 0;
+    UINT64 frameEnd = 0;
+    if (pImmediate->TryGetQueryData(gpuFrame.disjoint, &frequency) != S_OK ||
+        pImmediate->TryGetQueryData(gpuFrame.frameBegin, &frameBegin) != S_OK ||
+        pImmediate->TryGetQueryData(gpuFrame.frameEnd, &frameEnd) != S_OK)
+    {
+        return false;
+    }
+
+    // a disjoint clock makes the timestamps meaningless, the history may
+    // have moved past the frame already
+    ProfileFrame& frame = m_history[gpuFrame.index % HistoryFrames];
+    if (frequency == 0 || frame.index != gpuFrame.index)
+        return true;
+
+    const double secondsPerTick = 1.0 / frequency;
+    UINT scopeCount = gpuFrame.scopeCount.load();
+    if (scopeCount > MaxGpuScopes)
+        scopeCount = MaxGpuScopes;
+    for (UINT i = 0; i < scopeCount; i++)
+    {
+        const GpuScope& scope = gpuFrame.scopes[i];
+        UINT64 begin = 0;
+        UINT64 end = 0;
+        if (pImmediate->TryGetQueryData(scope.begin, &begin) != S_OK ||
+            pImmediate->TryGetQueryData(scope.end, &end) != S_OK || begin < frameBegin || end < begin)
+        {
+            continue;
+        }
+        frame.events.push_back({ scope.name, (begin - frameBegin) * secondsPerTick, (end - begin) * secondsPerTick,
+            GpuTrack, scope.depth });
+    }
+
+    frame.gpuSeconds = frameEnd > frameBegin ? (frameEnd - frameBegin) * secondsPerTick : 0.0;
+    frame.gpuResolved = true;
+    return true;
+}
+
+UINT Profiler::BeginCpu(const char* name)
+{
+    if (!m_inFrame)
+        return InvalidScope;
+
+    UINT scope = m_cpuCount++;
+    if (scope >= MaxCpuScopes)
+    {
+        m_droppedScopes++;
+        return InvalidScope;
+    }
+
+    if (t_track == 0)
+        t_track = s_nextTrack++;
+
+    CpuScope& cpuScope = m_cpuScopes[scope];
+    cpuScope.name = name;
+    cpuScope.start = Now() - m_frameStart;
+    cpuScope.end = -1.0;
+    cpuScope.track = t_track;
+    cpuScope.depth = t_cpuDepth++;
+    return scope;
+}
+
+void Profiler::EndCpu(UINT scope)
+{
+    if (scope == InvalidScope)
+        return;
+
+    t_cpuDepth--;
+    m_cpuScopes[scope].end = Now() - m_frameStart;
+}
+
+UINT Profiler::BeginGpu(RenderContext* pContext, const char* name)
+{
+    GpuFrame& gpuFrame = m_gpuFrames[m_frameIndex % FrameLatency];
+    if (!m_inFrame || !gpuFrame.disjoint)
+        return InvalidScope;
+
+    UINT scope = gpuFrame.scopeCount++;
+    if (scope >= MaxGpuScopes)
+    {
+        m_droppedScopes++;
+        return InvalidScope;
+    }
+
+    GpuScope& gpuScope = gpuFrame.scopes[scope];
+    gpuScope.name = name;
+    gpuScope.depth = t_gpuDepth++;
+    pContext->EndQuery(gpuScope.begin);
+    return scope;
+}
+
+void Profiler::EndGpu(RenderContext* pContext, UINT scope)
+{
+    if (scope == InvalidScope)
+        return;
+
+    t_gpuDepth--;
+    pContext->EndQuery(m_gpuFrames[m_frameIndex % FrameLatency].scopes[scope].end);
+}
+
+UINT Profiler::GetFrameCount() const
+{
+    return static_cast<UINT>(std::min<UINT64>(m_historyCount, m_history.size()));
+}
+
+const ProfileFrame& Profiler::GetFrame(UINT index) const
+{
+    UINT64 frameIndex = m_frameIndex - GetFrameCount() + index;
+    return m_history[frameIndex % HistoryFrames];
+}
+
+const ProfileFrame* Profiler::GetLatestFrame() const
+{
+    const UINT frameCount = GetFrameCount();
+    if (frameCount == 0)
+        return nullptr;
+
+    for (UINT age = 0; age < frameCount; age++)
+    {
+        const ProfileFrame& frame = GetFrame(frameCount - 1 - age);
+        if (frame.gpuResolved)
+            return &frame;
+    }
+    return &GetFrame(frameCount - 1);
+}
+
+// One complete ("X") event per scope, in microseconds. pid 1 is the CPU with
+// a track per thread and the frames on tid 0, pid 2 the GPU.
+HRESULT Profiler::WriteChromeTrace(const std::wstring& path) const
+{
+    FILE* pFile = OpenForWrite(path);
+    if (!pFile)
+        return E_FAIL;
+
+    fprintf(pFile, "{\"traceEvents\":[\n");
+    fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+
+    const UINT frameCount = GetFrameCount();
+    for (UINT i = 0; i < frameCount; i++)
+    {
+        const ProfileFrame& frame = GetFrame(i);
+        const double frameStart = frame.start * 1e6;
+        fprintf(pFile, ",\n{\"name\":\"Frame %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+            static_cast<unsigned long long>(frame.index), frameStart, frame.cpuSeconds * 1e6);
+        if (frame.gpuResolved)
+        {
+            fprintf(pFile, ",\n{\"name\":\"Frame %llu\",\"ph\":\"X\",\"pid\":2,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+                static_cast<unsigned long long>(frame.index), frameStart, frame.gpuSeconds * 1e6);
+        }
+
+        for (const ProfileEvent& event : frame.events)
+        {
+            const bool gpu = event.track == GpuTrack;
+            fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, gpu ? 2u : 1u, gpu ? 1u : event.track, frameStart + event.start * 1e6, event.duration * 1e6);
+        }
+    }
+
+    fprintf(pFile, "\n]}\n");
+    bool written = ferror(pFile) == 0;
+    written = fclose(pFile) == 0 && written;
+    return written ? S_OK : E_FAIL;
+}
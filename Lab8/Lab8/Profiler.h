@@ -0,0 +1,174 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "RenderBackend.h"
+
+struct ProfileEvent
+{
+    const char* name;
+    double start;           // seconds from the start of the frame
+    double duration;
+    UINT track;             // GpuTrack, or the CPU thread that ran the scope
+    UINT depth;             // scopes around it on the same track
+};
+
+struct ProfileFrame
+{
+    UINT64 index = 0;
+    double start = 0.0;         // seconds from Init
+    double cpuSeconds = 0.0;    // BeginFrame to EndFrame
+    double gpuSeconds = 0.0;    // first to last timestamp of the frame
+    bool gpuResolved = false;   // its timestamps have been read back
+    std::vector<ProfileEvent> events;
+};
+
+// Scoped CPU and GPU timings of the last HistoryFrames frames.
+//
+// CPU scopes take the steady clock and may run on any thread, every thread
+// gets a track of its own. GPU scopes put a pair of timestamp queries into
+// the context they record on, deferred ones included; a frame is bracketed
+// by a disjoint query and read back FrameLatency - 1 frames later without
+// waiting. If the GPU is still behind when the queries come around again,
+// that frame simply has no GPU timings.
+//
+// Nothing is allocated after Init: scopes beyond the per-frame limits are
+// dropped and counted.
+class Profiler
+{
+public:
+    static const UINT MaxCpuScopes = 256;       // per frame
+    static const UINT MaxGpuScopes = 64;
+    static const UINT FrameLatency = 3;         // sets of GPU queries in flight
+    static const UINT HistoryFrames = 120;
+    static const UINT GpuTrack = 0;
+    static const UINT InvalidScope = ~0u;
+
+    Profiler();
+    ~Profiler();
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // Without a device only the CPU is timed
+    HRESULT Init(RenderDevice* pDevice);
+    void Terminate();
+
+    void SetEnabled(bool enabled) { m_enabled = enabled; }
+    bool IsEnabled() const { return m_enabled; }
+
+    // On the immediate context, around everything else of the frame
+    void BeginFrame(RenderContext* pImmediate);
+    void EndFrame(RenderContext* pImmediate);
+
+    UINT BeginCpu(const char* name);
+    void EndCpu(UINT scope);
+    // name must outlive the frame's stay in the history
+    UINT BeginGpu(RenderContext* pContext, const char* name);
+    void EndGpu(RenderContext* pContext, UINT scope);
+
+    // The frames in the history, 0 is the oldest
+    UINT GetFrameCount() const;
+    const ProfileFrame& GetFrame(UINT index) const;
+    // The newest frame with its GPU timings, or the newest one when there are none
+    const ProfileFrame* GetLatestFrame() const;
+    UINT GetDroppedScopes() const { return m_droppedScopes.load(); }
+    UINT GetDroppedGpuFrames() const { return m_droppedGpuFrames; }
+
+    // The history in the Chrome trace event format (chrome://tracing,
+    // ui.perfetto.dev). GPU timings are placed at the CPU start of their frame.
+    HRESULT WriteChromeTrace(const std::wstring& path) const;
+
+private:
+    struct CpuScope
+    {
+        const char* name;
+        double start;
+        double end;
+        UINT track;
+        UINT depth;
+    };
+
+    struct GpuScope
+    {
+        const char* name;
+        RenderHandle begin;
+        RenderHandle end;
+        UINT depth;
+    };
+
+    struct GpuFrame
+    {
+        UINT64 index;
+        bool pending;
+        RenderHandle disjoint;
+        RenderHandle frameBegin;
+        RenderHandle frameEnd;
+        std::atomic<UINT> scopeCount;
+        GpuScope scopes[MaxGpuScopes];
+    };
+
+    double Now() const;
+    bool ResolveGpuFrame(RenderContext* pImmediate, GpuFrame& gpuFrame);
+    void ReleaseQueries();
+
+    RenderDevice* m_pDevice;
+    bool m_enabled;
+    bool m_inFrame;
+    std::chrono::steady_clock::time_point m_origin;
+
+    UINT64 m_frameIndex;
+    double m_frameStart;
+    std::atomic<UINT> m_cpuCount;
+    CpuScope m_cpuScopes[MaxCpuScopes];
+    GpuFrame m_gpuFrames[FrameLatency];
+
+    std::vector<ProfileFrame> m_history;
+    UINT64 m_historyCount;
+    std::atomic<UINT> m_droppedScopes;
+    UINT m_droppedGpuFrames;
+};
+
+// Times the enclosing block on the CPU
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& profiler, const char* name) :
+        m_profiler(profiler),
+        m_scope(profiler.BeginCpu(name))
+    {}
+    ~ProfileScope() { m_profiler.EndCpu(m_scope); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    Profiler& m_profiler;
+    UINT m_scope;
+};
+
+// Times the commands the enclosing block records into pContext
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(Profiler& profiler, RenderContext* pContext, const char* name) :
+        m_profiler(profiler),
+        m_pContext(pContext),
+        m_scope(profiler.BeginGpu(pContext, name))
+    {}
+    ~GpuProfileScope() { m_profiler.EndGpu(m_pContext, m_scope); }
+
+    GpuProfileScope(const GpuProfileScope&) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope&) = delete;
+
+private:
+    Profiler& m_profiler;
+    RenderContext* m_pContext;
+    UINT m_scope;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "RadixSort.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    inline UINT ChunkBegin(UINT count, UINT chunk, UINT chunkCount)
+    {
+        return static_cast<UINT>(static_cast<UINT64>(count) * chunk / chunkCount);
+    }
+}
+
+void RadixSorter::Sort(std::vector<UINT64>& keys, ThreadPool* pPool, UINT firstBit)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    const UINT count = static_cast<UINT>(keys.size());
+    firstBit = std::min(firstBit, 64u);
+    const UINT positionCount = (64 - firstBit + DigitBits - 1) / DigitBits;
+    UINT chunkCount = 1;
+    if (pPool)
+        chunkCount = std::max(1u, std::min(count / MinChunkKeys, pPool->GetThreadCount()));
+
+    m_stats.keys = count;
+    m_stats.passes = 0;
+    m_stats.chunks = chunkCount;
+    if (count < 2 || positionCount == 0)
+    {
+        m_stats.sortSeconds = 0.0;
+        return;
+    }
+
+    if (count < MinRadixKeys)
+    {
+        // The counts alone would take longer to clear. A merge sort through
+        // the kept buffer, std::stable_sort would take a new one every call.
+        auto less = [firstBit](UINT64 a, UINT64 b) { return (a >> firstBit) < (b >> firstBit); };
+        m_scratch.resize(count);
+        UINT64* pSource = keys.data();
+        UINT64* pTarget = m_scratch.data();
+        for (UINT width = 1; width < count; width *= 2)
+        {
+            for (UINT begin = 0; begin < count; begin += 2 * width)
+            {
+                UINT middle = std::min(begin + width, count);
+                UINT end = std::min(begin + 2 * width, count);
+                std::merge(pSource + begin, pSource + middle, pSource + middle, pSource + end, pTarget + begin, less);
+            }
+            std::swap(pSource, pTarget);
+        }
+        if (pSource != keys.data())
+            std::copy(pSource, pSource + count, keys.data());
+        m_stats.sortSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return;
+    }
+
+    m_scratch.resize(count);
+    m_counts.assign(static_cast<size_t>(chunkCount) * DigitPositions * DigitCount, 0);
+    m_offsets.resize(static_cast<size_t>(chunkCount) * DigitCount);
+
+    UINT64* pSource = keys.data();
+    UINT64* pTarget = m_scratch.data();
+
+    // every digit at once, both to find the ones to skip and as the counts
+    // of the first pass
+    auto countAll = [&](UINT chunk, UINT)
+    {
+        UINT* counts = GetCounts(chunk, 0);
+        UINT end = ChunkBegin(count, chunk + 1, chunkCount);
+        for (UINT i = ChunkBegin(count, chunk, chunkCount); i < end; i++)
+        {
+            UINT64 key = pSource[i];
+            for (UINT position = 0; position < positionCount; position++)
+            {
+                counts[position * DigitCount + ((key >> (firstBit + position * DigitBits)) & (DigitCount - 1))]++;
+            }
+        }
+    };
+    if (chunkCount > 1)
+        pPool->ParallelFor(chunkCount, countAll);
+    else
+        countAll(0, 0);
+
+    bool countsValid = true;
+    for (UINT position = 0; position < positionCount; position++)
+    {
+        const UINT shift = firstBit + position * DigitBits;
+
+        if (!countsValid)
+        {
+            // the keys moved since they were counted, so the chunks hold others
+            auto countDigit = [&](UINT chunk, UINT)
+            {
+                UINT* counts = GetCounts(chunk, position);
+                std::fill(counts, counts + DigitCount, 0u);
+                UINT end = ChunkBegin(count, chunk + 1, chunkCount);
+                for (UINT i = ChunkBegin(count, chunk, chunkCount); i < end; i++)
+                {
+                    counts[(pSource[i] >> shift) & (DigitCount - 1)]++;
+                }
+            };
+            if (chunkCount > 1)
+                pPool->ParallelFor(chunkCount, countDigit);
+            else
+                countDigit(0, 0);
+        }
+
+        // every chunk writes after the chunks before it in each bucket, which
+        // keeps the sort stable
+        UINT offset = 0;
+        bool skip = false;
+        for (UINT digit = 0; digit < DigitCount && !skip; digit++)
+        {
+            UINT bucketStart = offset;
+            for (UINT chunk = 0; chunk < chunkCount; chunk++)
+            {
+                m_offsets[chunk * DigitCount + digit] = offset;
+                offset += GetCounts(chunk, position)[digit];
+            }
+            skip = offset - bucketStart == count;
+        }
+        if (skip)
+            continue;
+
+        auto scatter = [&](UINT chunk, UINT)
+        {
+            UINT* offsets = &m_offsets[chunk * DigitCount];
+            UINT end = ChunkBegin(count, chunk + 1, chunkCount);
+            for (UINT i = ChunkBegin(count, chunk, chunkCount); i < end; i++)
+            {
+                UINT64 key = pSource[i];
+                pTarget[offsets[(key >> shift) & (DigitCount - 1)]++] = key;
+            }
+        };
+        if (chunkCount > 1)
+            pPool->ParallelFor(chunkCount, scatter);
+        else
+            scatter(0, 0);
+
+        std::swap(pSource, pTarget);
+        countsValid = false;
+        m_stats.passes++;
+    }
+
+    if (pSource != keys.data())
+        keys.swap(m_scratch);
+
+    m_stats.sortSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,49 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <vector>
+
+#include "Platform.h"
+#include "ThreadPool.h"
+
+struct RadixSortStats
+{
+    UINT keys = 0;
+    UINT passes = 0;        // digits that were scattered, the rest were equal in every key
+    UINT chunks = 0;        // the keys were split between this many jobs
+    double sortSeconds = 0.0;
+};
+
+// Stable least significant digit radix sort of 64 bit keys, 11 bits a pass.
+// The keys are split into fixed chunks: every chunk counts its digits, a
+// prefix sum over the counts gives every chunk its own place in every
+// bucket, and the chunks scatter on their own without touching a shared
+// counter. One first pass counts every digit at once, so a digit that is
+// the same in every key is skipped. The counts and the second buffer are
+// kept, so sorting the same number of keys again does not allocate.
+class RadixSorter
+{
+public:
+    static const UINT DigitBits = 11;       // 40 bit keys in four passes, the counts of a chunk still fit the L2
+    static const UINT DigitCount = 1 << DigitBits;
+    static const UINT DigitPositions = (64 + DigitBits - 1) / DigitBits;
+    static const UINT MinChunkKeys = 16384;     // fewer keys than this are not worth a job
+    static const UINT MinRadixKeys = 512;       // fewer are sorted by comparison
+
+    // Sorts keys ascending, keys of equal bits from firstBit up keep their
+    // order. Bits below firstBit are not looked at, a caller keeping the
+    // index of the item there needs no pass for it. pPool may be null.
+    void Sort(std::vector<UINT64>& keys, ThreadPool* pPool, UINT firstBit = 0);
+
+    const RadixSortStats& GetStats() const { return m_stats; }
+
+private:
+    UINT* GetCounts(UINT chunk, UINT position) { return &m_counts[(chunk * DigitPositions + position) * DigitCount]; }
+
+    std::vector<UINT64> m_scratch;
+    std::vector<UINT> m_counts;         // chunk, digit position, digit
+    std::vector<UINT> m_offsets;        // chunk, digit
+    RadixSortStats m_stats;
+};
+
+#endif
@@ -0,0 +1,396 @@
+#ifndef RENDER_BACKEND_H
+#define RENDER_BACKEND_H
+
+#include "Platform.h"
+#include <string>
+
+// Platform-neutral device/context interface. RenderClass creates all of its
+// resources and records all of its frames through it, so the same per-frame
+// code runs on Direct3D 11 (D3D11Backend) and on the headless CPU backend
+// (CpuBackend).
+
+// Handle of a backend object. Buffers and textures carry their views with
+// them: the backend creates SRV/UAV/RTV/DSV from the bind flags.
+typedef UINT RenderHandle;
+const RenderHandle NullHandle = 0;
+
+enum class ResourceUsage
+{
+    Default,
+    Dynamic,
+    Staging
+};
+
+enum class MapMode
+{
+    WriteDiscard,
+    WriteNoOverwrite
+};
+
+// Offsets and sizes passed to SetConstantBufferRange are multiples of this
+const UINT ConstantBufferAlignment = 256;
+
+// Color targets bound at once, pixel shader UAVs take the slots after them
+const UINT MaxRenderTargets = 4;
+
+enum BindFlags : UINT
+{
+    BIND_VERTEX_BUFFER = 0x1,
+    BIND_INDEX_BUFFER = 0x2,
+    BIND_CONSTANT_BUFFER = 0x4,
+    BIND_SHADER_RESOURCE = 0x8,
+    BIND_UNORDERED_ACCESS = 0x10,
+    BIND_RENDER_TARGET = 0x20,
+    BIND_DEPTH_STENCIL = 0x40
+};
+
+enum MiscFlags : UINT
+{
+    MISC_STRUCTURED = 0x1,
+    MISC_DRAW_INDIRECT_ARGS = 0x2,
+    MISC_RAW_VIEWS = 0x4
+};
+
+enum class Format
+{
+    Unknown,
+    R32G32B32A32_FLOAT,
+    R32G32B32_FLOAT,
+    R32G32_FLOAT,
+    R32_FLOAT,
+    R32_UINT,
+    R16_UINT,
+    R16G16B16A16_UNORM,
+    R8G8B8A8_UNORM,
+    B8G8R8A8_UNORM,
+    D32_FLOAT,
+    BC1_UNORM,
+    BC2_UNORM,
+    BC3_UNORM
+};
+
+enum class ShaderStage
+{
+    Vertex,
+    Pixel,
+    Compute
+};
+
+// A preprocessor define a shader is compiled with, permutations of one
+// file differ only in these (see ShaderVariants)
+struct ShaderDefine
+{
+    const char* name;
+    const char* value;
+};
+
+enum class PrimitiveTopology
+{
+    TriangleList
+};
+
+enum class FillMode
+{
+    Solid,
+    Wireframe
+};
+
+enum class CullMode
+{
+    None,
+    Front,
+    Back
+};
+
+enum class ComparisonFunc
+{
+    Never,
+    Less,
+    Equal,
+    LessEqual,
+    Greater,
+    NotEqual,
+    GreaterEqual,
+    Always
+};
+
+enum class Blend
+{
+    Zero,
+    One,
+    SrcAlpha,
+    InvSrcAlpha,
+    DestAlpha,
+    InvDestAlpha,
+    SrcColor,
+    InvSrcColor
+};
+
+enum class BlendOp
+{
+    Add,
+    Subtract,
+    RevSubtract,
+    Min,
+    Max
+};
+
+enum class TextureFilter
+{
+    Point,
+    Linear
+};
+
+enum class TextureAddress
+{
+    Wrap,
+    Clamp
+};
+
+struct BufferDesc
+{
+    UINT byteWidth = 0;
+    ResourceUsage usage = ResourceUsage::Default;
+    UINT bindFlags = 0;
+    UINT miscFlags = 0;
+    UINT structureStride = 0;
+};
+
+struct TextureDesc
+{
+    UINT width = 0;
+    UINT height = 0;
+    Format format = Format::R8G8B8A8_UNORM;
+    UINT bindFlags = 0;
+    UINT mipLevels = 1;
+    UINT arraySize = 1;     // six per cube for cube maps
+    bool cube = false;
+};
+
+// Initial contents of one mip of one array slice. Rows are texels, or rows
+// of 4x4 blocks for the BC formats.
+struct SubresourceData
+{
+    const void* pData = nullptr;
+    UINT rowPitch = 0;
+    UINT slicePitch = 0;
+};
+
+struct InputElement
+{
+    const char* semanticName;
+    UINT semanticIndex;
+    Format format;
+    UINT offset;
+};
+
+struct RasterizerDesc
+{
+    FillMode fillMode = FillMode::Solid;
+    CullMode cullMode = CullMode::Back;
+    bool frontCounterClockwise = false;
+};
+
+struct DepthStencilDesc
+{
+    bool depthEnable = true;
+    bool depthWrite = true;
+    ComparisonFunc depthFunc = ComparisonFunc::Less;
+};
+
+struct BlendDesc
+{
+    bool blendEnable = false;
+    Blend srcBlend = Blend::One;
+    Blend destBlend = Blend::Zero;
+    BlendOp blendOp = BlendOp::Add;
+    Blend srcBlendAlpha = Blend::One;
+    Blend destBlendAlpha = Blend::Zero;
+    BlendOp blendOpAlpha = BlendOp::Add;
+    BYTE writeMask = 0xF;
+};
+
+struct SamplerDesc
+{
+    TextureFilter filter = TextureFilter::Linear;
+    TextureAddress address = TextureAddress::Wrap;
+};
+
+enum class QueryType
+{
+    Timestamp,              // the GPU clock once the commands before End have run
+    TimestampDisjoint       // the frequency of that clock between Begin and End
+};
+
+struct Viewport
+{
+    float x = 0.0f;
+    float y = 0.0f;
+    float width = 0.0f;
+    float height = 0.0f;
+    float minDepth = 0.0f;
+    float maxDepth = 1.0f;
+};
+
+// Counters every context keeps for the commands it has recorded since the
+// last ResetStats(). Triangle and instance counts of indirect draws are only
+// known to backends that can see the argument buffer.
+struct RenderStats
+{
+    UINT drawCalls = 0;
+    UINT dispatches = 0;
+    UINT64 instances = 0;
+    UINT64 triangles = 0;
+    UINT bufferUpdates = 0;
+    UINT maps = 0;
+    UINT readbacks = 0;
+    UINT stateChanges = 0;          // rasterizer, depth-stencil and blend states actually bound
+    UINT elidedStateChanges = 0;    // Set*State calls skipped because the state was already bound
+
+    RenderStats& operator+=(const RenderStats& other)
+    {
+        drawCalls += other.drawCalls;
+        dispatches += other.dispatches;
+        instances += other.instances;
+        triangles += other.triangles;
+        bufferUpdates += other.bufferUpdates;
+        maps += other.maps;
+        readbacks += other.readbacks;
+        stateChanges += other.stateChanges;
+        elidedStateChanges += other.elidedStateChanges;
+        return *this;
+    }
+};
+
+// The immediate context executes commands in the order they are recorded.
+// A deferred context (RenderDevice::CreateDeferredContext) only records
+// them, on any one thread at a time, into a command list that the immediate
+// context executes later on its own thread. Deferred contexts start every
+// command list with the default state and the immediate context is back at
+// the default state after executing one, so a list has to bind everything
+// it draws with. Deferred contexts can only Map WRITE_DISCARD and cannot read
+// buffers back; the device must not create or release objects while they
+// record. Their counters move to the immediate context with the command list.
+
+class RenderContext
+{
+public:
+    virtual ~RenderContext() {}
+
+    // Map is WRITE_DISCARD unless the caller asks for NO_OVERWRITE, promising not to touch bytes
+    // the GPU may still read; ReadBuffer copies back whole bytes from the start of the buffer
+    // and waits for the GPU, TryReadBuffer reads a Staging buffer only if the GPU is done with it
+    // (S_FALSE otherwise). UpdateBufferRange writes byteSize bytes at byteOffset and leaves the
+    // rest of the buffer alone; constant buffers can only be updated whole.
+    virtual HRESULT Map(RenderHandle buffer, MapMode mode, void** ppData) = 0;
+    HRESULT Map(RenderHandle buffer, void** ppData) { return Map(buffer, MapMode::WriteDiscard, ppData); }
+    virtual void Unmap(RenderHandle buffer) = 0;
+    virtual void UpdateBuffer(RenderHandle buffer, const void* pData, UINT byteSize) = 0;
+    virtual void UpdateBufferRange(RenderHandle buffer, UINT byteOffset, const void* pData, UINT byteSize) = 0;
+    virtual HRESULT ReadBuffer(RenderHandle buffer, void* pData, UINT byteSize) = 0;
+    virtual HRESULT TryReadBuffer(RenderHandle stagingBuffer, void* pData, UINT byteSize) = 0;
+    virtual void CopyResource(RenderHandle dst, RenderHandle src) = 0;
+
+    virtual void ClearRenderTarget(RenderHandle target, const float color[4]) = 0;
+    virtual void ClearDepth(RenderHandle depth, float value) = 0;
+    // Every 32 bit element of a buffer is set to values[0], texels take one value per channel
+    virtual void ClearUnorderedAccess(RenderHandle resource, const UINT values[4]) = 0;
+    // Up to MaxRenderTargets, all blended with the same blend state
+    virtual void SetRenderTargets(const RenderHandle* targets, UINT targetCount, RenderHandle depth) = 0;
+    void SetRenderTargets(RenderHandle target, RenderHandle depth) { SetRenderTargets(&target, target != NullHandle ? 1 : 0, depth); }
+    virtual void SetViewport(const Viewport& viewport) = 0;
+
+    virtual void SetVertexBuffer(RenderHandle buffer, UINT stride, UINT offset) = 0;
+    virtual void SetIndexBuffer(RenderHandle buffer, Format format) = 0;
+    virtual void SetInputLayout(RenderHandle layout) = 0;
+    virtual void SetPrimitiveTopology(PrimitiveTopology topology) = 0;
+
+    virtual void SetShader(ShaderStage stage, RenderHandle shader) = 0;
+    virtual void SetConstantBuffer(ShaderStage stage, UINT slot, RenderHandle buffer) = 0;
+    // Binds byteSize bytes starting at byteOffset, both multiples of ConstantBufferAlignment
+    virtual void SetConstantBufferRange(ShaderStage stage, UINT slot, RenderHandle buffer, UINT byteOffset, UINT byteSize) = 0;
+    virtual void SetShaderResource(ShaderStage stage, UINT slot, RenderHandle resource) = 0;
+    virtual void SetSampler(ShaderStage stage, UINT slot, RenderHandle sampler) = 0;
+    virtual void SetUnorderedAccess(UINT slot, RenderHandle resource) = 0;
+    // Written by the pixel shader; the slot is at least the number of render targets
+    // bound, they stay bound until set to NullHandle or ClearState
+    virtual void SetPixelUnorderedAccess(UINT slot, RenderHandle resource) = 0;
+
+    virtual void SetRasterizerState(RenderHandle state) = 0;
+    virtual void SetDepthStencilState(RenderHandle state) = 0;
+    virtual void SetBlendState(RenderHandle state) = 0;
+
+    virtual void Draw(UINT vertexCount, UINT startVertex) = 0;
+    virtual void DrawIndexed(UINT indexCount, UINT startIndex, int baseVertex) = 0;
+    virtual void DrawIndexedInstanced(UINT indexCount, UINT instanceCount, UINT startIndex, int baseVertex, UINT startInstance) = 0;
+    virtual void DrawIndexedInstancedIndirect(RenderHandle args, UINT offset) = 0;
+    virtual void Dispatch(UINT x, UINT y, UINT z) = 0;
+
+    virtual void ClearState() = 0;
+
+    // A Timestamp query only ends, a TimestampDisjoint one begins and ends
+    // around the timestamps it covers. TryGetQueryData reads the ticks of a
+    // Timestamp, or the ticks per second of a TimestampDisjoint (0 when the
+    // clock changed meanwhile), on the immediate context only; S_FALSE while
+    // the GPU has not got that far
+    virtual void BeginQuery(RenderHandle query) = 0;
+    virtual void EndQuery(RenderHandle query) = 0;
+    virtual HRESULT TryGetQueryData(RenderHandle query, UINT64* pData) = 0;
+
+    // Deferred contexts: closes the commands recorded since the last call
+    // into a command list, which stays with the context until executed
+    virtual HRESULT FinishCommandList() = 0;
+    // Immediate context: executes the command list pDeferred has finished
+    virtual void ExecuteCommandList(RenderContext* pDeferred) = 0;
+
+    const RenderStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = RenderStats(); }
+
+protected:
+    RenderStats m_stats;
+};
+
+class RenderDevice
+{
+public:
+    virtual ~RenderDevice() {}
+
+    virtual HRESULT CreateBuffer(const BufferDesc& desc, const void* pInitData, RenderHandle* pBuffer) = 0;
+    // pInitData is nullptr or has mipLevels * arraySize entries: every mip of
+    // slice 0, then of slice 1 and so on
+    virtual HRESULT CreateTexture(const TextureDesc& desc, const SubresourceData* pInitData, RenderHandle* pTexture) = 0;
+    virtual HRESULT CreateTextureFromFile(const std::wstring& path, RenderHandle* pTexture) = 0;
+    // All files must share size, format and mip count; slice i is paths[i]
+    virtual HRESULT CreateTextureArrayFromFiles(const std::wstring* paths, UINT count, RenderHandle* pTexture) = 0;
+    // The same from DDS files that are already in memory, the data is not
+    // referenced after the call returns
+    virtual HRESULT CreateTextureFromMemory(const BYTE* pData, size_t byteSize, RenderHandle* pTexture) = 0;
+    virtual HRESULT CreateTextureArrayFromMemory(const BYTE* const* ppData, const size_t* byteSizes, UINT count, RenderHandle* pTexture) = 0;
+
+    virtual HRESULT CreateShader(ShaderStage stage, const std::wstring& path, const ShaderDefine* defines, UINT defineCount, RenderHandle* pShader) = 0;
+    HRESULT CreateShader(ShaderStage stage, const std::wstring& path, RenderHandle* pShader) { return CreateShader(stage, path, nullptr, 0, pShader); }
+    virtual HRESULT CreateInputLayout(const InputElement* elements, UINT count, RenderHandle vertexShader, RenderHandle* pLayout) = 0;
+
+    virtual HRESULT CreateRasterizerState(const RasterizerDesc& desc, RenderHandle* pState) = 0;
+    virtual HRESULT CreateDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState) = 0;
+    virtual HRESULT CreateBlendState(const BlendDesc& desc, RenderHandle* pState) = 0;
+    virtual HRESULT CreateSamplerState(const SamplerDesc& desc, RenderHandle* pSampler) = 0;
+    virtual HRESULT CreateQuery(QueryType type, RenderHandle* pQuery) = 0;
+
+    virtual void Release(RenderHandle handle) = 0;
+    // target takes over the object of source, e.g. a texture rebuilt with
+    // more mips. The old object of target is released and source is freed.
+    virtual void ReplaceResource(RenderHandle target, RenderHandle source) = 0;
+
+    virtual RenderContext* GetImmediateContext() = 0;
+    // The caller owns the context and deletes it before the device goes away
+    virtual HRESULT CreateDeferredContext(RenderContext** ppContext) = 0;
+
+    // The swap chain (or the headless color target) is exposed as a render
+    // target handle, which compute shaders can also write as a UAV
+    virtual RenderHandle GetBackBuffer() = 0;
+    virtual HRESULT ResizeBackBuffer(UINT width, UINT height) = 0;
+    virtual void Present(UINT syncInterval) = 0;
+};
+
+#endif
@@ -1,90 +1,198 @@
-#include "framework.h"
+#include "Platform.h"
 #include "RenderClass.h"
-#include "DDSTextureLoader11.h"
-#include <filesystem>
+
+#ifdef _WIN32
+#include "D3D11Backend.h"
 
 #include "imgui.h"
 #include "imgui_impl_dx11.h"
 #include "imgui_impl_win32.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+static const ShaderOption CubeVertexOptions[] =
+{
+    { "NORMAL_MAP", 0, 2 },
+    { "CONSTANT_INSTANCES", RenderClass::FeatureConstantInstancesShift, 2 },
+};
+
+static const ShaderOption CubePixelOptions[] =
+{
+    { "NORMAL_MAP", 0, 2 },
+    { "LIGHT_COUNT", RenderClass::FeatureLightShift, RenderClass::LightCount + 1 },
+    { "CLUSTERED", RenderClass::FeatureClusteredShift, 2 },
+    { "SHADOWS", RenderClass::FeatureShadowsShift, 2 },
+};
+
+static const ShaderOption ParallelogramPixelOptions[] =
+{
+    { "LIGHT_COUNT", RenderClass::FeatureLightShift, RenderClass::LightCount + 1 },
+    { "CLUSTERED", RenderClass::FeatureClusteredShift, 2 },
+    { "OIT", RenderClass::FeatureTransparencyShift, 3 },
+};
+
+// only asked for with OIT 1 and 2, Sorted has nothing to resolve
+static const ShaderOption OitResolveOptions[] =
+{
+    { "OIT", RenderClass::FeatureTransparencyShift, 3 },
+};
+
+static const ShaderOption GBufferPixelOptions[] =
+{
+    { "NORMAL_MAP", 0, 2 },
+};
+
+static const ShaderOption DeferredLightingOptions[] =
+{
+    { "SHADOWS", RenderClass::FeatureShadowsShift, 2 },
+};
+
+static const ShaderVariantDesc ShaderVariantDescs[] =
+{
+    { ShaderStage::Vertex, L"ColorVertex.vs",        CubeVertexOptions,         ARRAYSIZE(CubeVertexOptions) },
+    { ShaderStage::Pixel,  L"ColorPixel.ps",         CubePixelOptions,          ARRAYSIZE(CubePixelOptions) },
+    { ShaderStage::Pixel,  L"ParallelogramPixel.ps", ParallelogramPixelOptions, ARRAYSIZE(ParallelogramPixelOptions) },
+    { ShaderStage::Pixel,  L"OitResolve.ps",         OitResolveOptions,         ARRAYSIZE(OitResolveOptions) },
+    { ShaderStage::Pixel,  L"GBufferPixel.ps",       GBufferPixelOptions,       ARRAYSIZE(GBufferPixelOptions) },
+    { ShaderStage::Compute, L"DeferredLighting.cs",  DeferredLightingOptions,   ARRAYSIZE(DeferredLightingOptions) },
+};
+
+UINT RenderClass::GetShaderVariantDescs(const ShaderVariantDesc** ppDescs)
+{
+    *ppDescs = ShaderVariantDescs;
+    return ARRAYSIZE(ShaderVariantDescs);
+}
 
-#include <dxgi.h>
-#include <d3d11.h>
-#include <d3dcompiler.h>
+// The projection of Render(), the light clusters are cut from it
+static const float CameraFovY = XM_PIDIV4;
+static const float CameraNear = 0.1f;
+static const float CameraFar = 100.0f;
 
-#pragma comment (lib, "d3dcompiler.lib")
-#pragma comment (lib, "d3d11.lib")
-#pragma comment (lib, "dxgi.lib")
+// scattered lights lie on a disc this wide around the middle
+static const float LightFieldRadius = 24.0f;
 
+// half the size of the cube drawn at a light
+static const float LightMarkerScale = 0.1f;
 
+// Same sequence on every run, so the headless frames stay deterministic
+static float NextLightRandom(UINT& state)
+{
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
 
-HRESULT RenderClass::Init(HWND hWnd, WCHAR szTitle[], WCHAR szWindowClass[])
+#ifdef _WIN32
+HRESULT RenderClass::Init(HWND hWnd)
 {
-    m_szTitle = szTitle;
-    m_szWindowClass = szWindowClass;
+    auto start = std::chrono::steady_clock::now();
+
+    m_pD3DDevice = new D3D11RenderDevice();
+    HRESULT result = m_pD3DDevice->Init(hWnd);
+    if (FAILED(result))
+    {
+        delete m_pD3DDevice;
+        m_pD3DDevice = nullptr;
+        return result;
+    }
 
-    HRESULT result;
+    m_pDevice = m_pD3DDevice;
+    m_pContext = m_pDevice->GetImmediateContext();
+    m_ownsDevice = true;
+
+    RECT rc;
+    GetClientRect(hWnd, &rc);
+    m_width = rc.right - rc.left;
+    m_height = rc.bottom - rc.top;
 
-    IDXGIFactory* pFactory = nullptr;
-    result = CreateDXGIFactory(__uuidof(IDXGIFactory), (void**)&pFactory);
+    result = InitScene();
 
-    IDXGIAdapter* pSelectedAdapter = NULL;
     if (SUCCEEDED(result))
     {
-        IDXGIAdapter* pAdapter = NULL;
-        UINT adapterIdx = 0;
-        while (SUCCEEDED(pFactory->EnumAdapters(adapterIdx, &pAdapter)))
-        {
-            DXGI_ADAPTER_DESC desc;
-            pAdapter->GetDesc(&desc);
+        m_startupSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-            if (wcscmp(desc.Description, L"Microsoft Basic Render Driver") != 0)
-            {
-                pSelectedAdapter = pAdapter;
-                break;
-            }
+        const ShaderCacheStats& shaderStats = m_pD3DDevice->GetShaderCacheStats();
+        char report[160];
+        sprintf_s(report, "Startup %.1f ms: %u shaders cached (%.1f ms), %u compiled (%.1f ms)\n",
+            m_startupSeconds * 1000.0, shaderStats.hits, shaderStats.loadSeconds * 1000.0,
+            shaderStats.misses, shaderStats.compileSeconds * 1000.0);
+        OutputDebugStringA(report);
+
+        InitImGui(hWnd);
+    }
 
-            pAdapter->Release();
+    if (FAILED(result))
+    {
+        Terminate();
+    }
 
-            adapterIdx++;
-        }
+    return result;
+}
+#endif
+
+HRESULT RenderClass::Init(RenderDevice* pDevice, UINT width, UINT height)
+{
+    m_pDevice = pDevice;
+    m_pContext = m_pDevice->GetImmediateContext();
+    m_ownsDevice = false;
+    m_waitForTextures = true;
+    m_width = width;
+    m_height = height;
+
+    HRESULT result = InitScene();
+
+    if (SUCCEEDED(result))
+    {
+        result = m_textureLoader.Flush();
     }
 
-    // Create DirectX 11 device
-    D3D_FEATURE_LEVEL level;
-    D3D_FEATURE_LEVEL levels[] = { D3D_FEATURE_LEVEL_11_0 };
+    if (FAILED(result))
+    {
+        Terminate();
+    }
+
+    return result;
+}
+
+HRESULT RenderClass::InitScene()
+{
+    m_stateCache.Init(m_pDevice);
+
+    // Texture files are read in the background while the rest of the scene
+    // is set up, the first frames draw with placeholders
+    HRESULT result = m_textureLoader.Init(m_pDevice);
+
     if (SUCCEEDED(result))
     {
-        UINT flags = 0;
-#ifdef _DEBUG
-        flags |= D3D11_CREATE_DEVICE_DEBUG;
-#endif
-        result = D3D11CreateDevice(pSelectedAdapter, D3D_DRIVER_TYPE_UNKNOWN, NULL,
-            flags, levels, 1, D3D11_SDK_VERSION, &m_pDevice, &level, &m_pDeviceContext);
+        result = m_textureStreamer.Init(m_pDevice, DefaultTextureBudget);
+    }
+
+    if (SUCCEEDED(result))
+    {
+        result = m_uploadRing.Init(m_pDevice);
     }
 
     if (SUCCEEDED(result))
     {
-        DXGI_SWAP_CHAIN_DESC swapChainDesc = { 0 };
-        swapChainDesc.BufferCount = 2;
-        swapChainDesc.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-        swapChainDesc.OutputWindow = hWnd;
-        swapChainDesc.SampleDesc.Count = 1;
-        swapChainDesc.SampleDesc.Quality = 0;
-        swapChainDesc.Windowed = true;
-        swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_DISCARD;
-        swapChainDesc.Flags = 0;
+        result = m_frameRecorder.Init(m_pDevice);
+    }
 
-        result = pFactory->CreateSwapChain(m_pDevice, &swapChainDesc, &m_pSwapChain);
+    if (SUCCEEDED(result) && !m_pSortPool)
+    {
+        m_pSortPool.reset(new ThreadPool());
     }
 
+    // without timestamp queries the profiler still times the CPU
+    m_profiler.Init(m_pDevice);
+
     if (SUCCEEDED(result))
     {
-        RECT rc;
-        GetClientRect(hWnd, &rc);
-        UINT width = rc.right - rc.left;
-        UINT height = rc.bottom - rc.top;
-        result = ConfigureBackBuffer(width, height);
+        result = ConfigureBackBuffer(m_width, m_height);
     }
 
     if (SUCCEEDED(result))
@@ -102,11 +210,6 @@ HRESULT RenderClass::Init(HWND hWnd, WCHAR szTitle[], WCHAR szWindowClass[])
         result = InitSkybox();
     }
 
-    if (SUCCEEDED(result)) 
-    {
-        InitImGui(hWnd);
-    }
-    
     if (SUCCEEDED(result))
     {
         result = InitParallelogram();
@@ -122,13 +225,14 @@ HRESULT RenderClass::Init(HWND hWnd, WCHAR szTitle[], WCHAR szWindowClass[])
         result = InitComputeShader();
     }
 
+    if (SUCCEEDED(result))
+    {
+        result = InitLightClusters();
+    }
 
-    pSelectedAdapter->Release();
-    pFactory->Release();
-
-    if (FAILED(result))
+    if (SUCCEEDED(result))
     {
-        Terminate();
+        result = InitShadows();
     }
 
     return result;
@@ -136,37 +240,37 @@ HRESULT RenderClass::Init(HWND hWnd, WCHAR szTitle[], WCHAR szWindowClass[])
 
 HRESULT RenderClass::InitBufferShader()
 {
-    D3D11_INPUT_ELEMENT_DESC layout[] =
+    InputElement layout[] =
     {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(CubeVertex, xyz),    D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "NORMAL",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(CubeVertex, normal), D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT,    0, offsetof(CubeVertex, uv),     D3D11_INPUT_PER_VERTEX_DATA, 0 }
+        { "POSITION", 0, Format::R32G32B32_FLOAT, offsetof(CubeVertex, xyz) },
+        { "NORMAL",   0, Format::R32G32B32_FLOAT, offsetof(CubeVertex, normal) },
+        { "TEXCOORD", 0, Format::R32G32_FLOAT,    offsetof(CubeVertex, uv) }
     };
 
-    HRESULT result = S_OK;
+    m_cubeVS.Init(m_pDevice, ShaderVariantDescs[0]);
+    m_cubePS.Init(m_pDevice, ShaderVariantDescs[1]);
+    m_gBufferPS.Init(m_pDevice, ShaderVariantDescs[4]);
+    m_deferredCS.Init(m_pDevice, ShaderVariantDescs[5]);
 
-    ID3DBlob* pVertexCode = nullptr;
-    if (SUCCEEDED(result))
-    {
-        result = CompileShader(L"ColorVertex.vs", &m_pVertexShader, nullptr, &pVertexCode);
-    }
+    // every variant has the same inputs, the layout is made for the full one
+    RenderHandle vertexShader = NullHandle;
+    HRESULT result = m_cubeVS.Get(FeatureNormalMap, &vertexShader);
     if (SUCCEEDED(result))
     {
-        result = CompileShader(L"ColorPixel.ps", nullptr, &m_pPixelShader);
+        result = m_pDevice->CreateInputLayout(layout, 3, vertexShader, &m_pLayout);
     }
 
     if (SUCCEEDED(result))
     {
-        result = m_pDevice->CreateInputLayout(layout, 3, pVertexCode->GetBufferPointer(), pVertexCode->GetBufferSize(), &m_pLayout);
+        result = m_pDevice->CreateShader(ShaderStage::Vertex, L"LightVertex.vs", &m_pLightVertexShader);
     }
 
-    if (pVertexCode)
-        pVertexCode->Release();
-
     if (SUCCEEDED(result))
     {
-        result = CompileShader(L"LightPixel.ps", nullptr, &m_pLightPixelShader);
+        result = m_pDevice->CreateShader(ShaderStage::Pixel, L"LightPixel.ps", &m_pLightPixelShader);
     }
+    if (FAILED(result))
+        return result;
 
     static const CubeVertex vertices[] =
     {
@@ -222,197 +326,41 @@ HRESULT RenderClass::InitBufferShader()
         20, 23, 22
     };
 
-    D3D11_BUFFER_DESC lightBufferDesc = {};
-    lightBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    lightBufferDesc.ByteWidth = sizeof(PointLight) * 3;
-    lightBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    lightBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    result = m_pDevice->CreateBuffer(&lightBufferDesc, nullptr, &m_pLightBuffer);
-    if (FAILED(result))
-        return result;
-
-
-    D3D11_BUFFER_DESC bd = {};
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(CubeVertex) * ARRAYSIZE(vertices);
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = vertices;
-    result = m_pDevice->CreateBuffer(&bd, &initData, &m_pVertexBuffer);
-    if (FAILED(result))
-        return result;
-
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(WORD) * ARRAYSIZE(indices);
-    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-    initData.pSysMem = indices;
-    result = m_pDevice->CreateBuffer(&bd, &initData, &m_pIndexBuffer);
+    BufferDesc bd;
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(CubeVertex) * ARRAYSIZE(vertices);
+    bd.bindFlags = BIND_VERTEX_BUFFER;
+    result = m_pDevice->CreateBuffer(bd, vertices, &m_pVertexBuffer);
     if (FAILED(result))
         return result;
 
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(XMMATRIX);
-    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    bd.CPUAccessFlags = 0;
-    result = m_pDevice->CreateBuffer(&bd, nullptr, &m_pModelBuffer);
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(WORD) * ARRAYSIZE(indices);
+    bd.bindFlags = BIND_INDEX_BUFFER;
+    result = m_pDevice->CreateBuffer(bd, indices, &m_pIndexBuffer);
     if (FAILED(result))
         return result;
 
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(InstanceData) * MaxInst;
-    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    bd.CPUAccessFlags = 0;
-    result = m_pDevice->CreateBuffer(&bd, nullptr, &m_pModelBufferInst);
-    if (FAILED(result))
-        return result;
-
-    // Init instances cubes
-    const int innerCount = 10;
-    const int outerCount = 12;
-    const float innerRadius = 4.0f;
-    const float outerRadius = 9.5f;
-
-    InstanceData modelBuf;
-    modelBuf.countInstance = MaxInst;
-    modelBuf.model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale);
-    modelBuf.texInd = 0;
-    m_modelInstances.push_back(modelBuf);
-
-    for (int i = 0; i < innerCount; i++)
-    {
-        float angle = XM_2PI * i / innerCount;
-        XMFLOAT3 position = { innerRadius * cosf(angle), 0.0f, innerRadius * sinf(angle) };
-
-        InstanceData modelBuf;
-        modelBuf.countInstance = MaxInst;
-        modelBuf.model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) *
-            XMMatrixTranslation(position.x, position.y, position.z);
-        modelBuf.texInd = i % 2;
-        m_modelInstances.push_back(modelBuf);
-    }
-
-    for (int i = 0; i < outerCount; i++)
-    {
-        float angle = XM_2PI * i / outerCount;
-        XMFLOAT3 position = { outerRadius * cosf(angle), 0.0f, outerRadius * sinf(angle) };
-
-        InstanceData modelBuf;
-        modelBuf.countInstance = MaxInst;
-        modelBuf.model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) *
-            XMMatrixTranslation(position.x, position.y, position.z);
-        modelBuf.texInd = i % 2;
-        m_modelInstances.push_back(modelBuf);
-    }
-
-    m_pDeviceContext->UpdateSubresource(m_pModelBufferInst, 0, nullptr, m_modelInstances.data(), 0, 0);
-
-    D3D11_BUFFER_DESC vpBufferDesc = {};
-    vpBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    vpBufferDesc.ByteWidth = sizeof(CameraBuffer);
-    vpBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    vpBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    result = m_pDevice->CreateBuffer(&vpBufferDesc, nullptr, &m_pVPBuffer);
+    BuildInstances(m_instanceCount);
+    result = UploadInstances();
     if (FAILED(result))
         return result;
 
-    result = DirectX::CreateDDSTextureFromFile(m_pDevice, L"cube_normal.dds", nullptr, &m_pNormalMapView);
-    if (FAILED(result))
-        return result;
+    // without the map the cubes use the variants that do not sample it
+    if (FAILED(m_textureStreamer.Add(L"cube_normal.dds", &m_pNormalMapView)))
+        m_pNormalMapView = NullHandle;
 
-    D3D11_SAMPLER_DESC sampDesc = {};
-    sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-    sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-    sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-    sampDesc.MinLOD = 0;
-    sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-    result = m_pDevice->CreateSamplerState(&sampDesc, &m_pSamplerState);
+    SamplerDesc sampDesc;
+    sampDesc.filter = TextureFilter::Linear;
+    sampDesc.address = TextureAddress::Wrap;
+    result = m_pDevice->CreateSamplerState(sampDesc, &m_pSamplerState);
     return result;
 }
 
 HRESULT RenderClass::Init2DArray()
 {
-    ID3D11Resource* pTextureResources[2] = { nullptr, nullptr };
-
-    HRESULT result = DirectX::CreateDDSTextureFromFile(
-        m_pDevice,
-        L"cat.dds",
-        &pTextureResources[0],
-        nullptr
-    );
-    if (FAILED(result)) 
-        return result;
-
-    result = DirectX::CreateDDSTextureFromFile(
-        m_pDevice,
-        L"textile.dds",
-        &pTextureResources[1],
-        nullptr
-    );
-    if (FAILED(result))
-    {
-        pTextureResources[0]->Release();
-        return result;
-    }
-
-    ID3D11Texture2D* pTexture = nullptr;
-    pTextureResources[0]->QueryInterface(__uuidof(ID3D11Texture2D), (void**)&pTexture);
-
-    D3D11_TEXTURE2D_DESC texDesc;
-    pTexture->GetDesc(&texDesc);
-    pTexture->Release();
-
-    D3D11_TEXTURE2D_DESC arrayDesc = texDesc;
-    arrayDesc.ArraySize = 2;
-
-    ID3D11Texture2D* pTextureArray = nullptr;
-    result = m_pDevice->CreateTexture2D(&arrayDesc, nullptr, &pTextureArray);
-    if (FAILED(result))
-    {
-        pTextureResources[0]->Release();
-        pTextureResources[1]->Release();
-        return result;
-    }
-
-    for (UINT i = 0; i < 2; ++i)
-    {
-        for (UINT mip = 0; mip < texDesc.MipLevels; ++mip)
-        {
-            if (pTextureResources[i] != nullptr) 
-            {
-                m_pDeviceContext->CopySubresourceRegion(
-                    pTextureArray,
-                    D3D11CalcSubresource(mip, i, texDesc.MipLevels),
-                    0, 0, 0,
-                    pTextureResources[i],
-                    mip,
-                    nullptr
-                );
-            }
-            else 
-            {
-                OutputDebugString(L"Error: Null texture resource encountered\n");
-            }
-        }
-    }
-    pTextureResources[0]->Release();
-    pTextureResources[1]->Release();
-
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = texDesc.Format;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
-    srvDesc.Texture2DArray.ArraySize = 2;
-    srvDesc.Texture2DArray.FirstArraySlice = 0;
-    srvDesc.Texture2DArray.MipLevels = texDesc.MipLevels;
-    srvDesc.Texture2DArray.MostDetailedMip = 0;
-
-    result = m_pDevice->CreateShaderResourceView(pTextureArray, &srvDesc, &m_pTextureView);
-    pTextureArray->Release();
-    return result;
+    const std::wstring textures[2] = { L"cat.dds", L"textile.dds" };
+    return m_textureStreamer.Add(textures, 2, &m_pTextureView);
 }
 
 HRESULT RenderClass::InitFullScreenTriangle()
@@ -423,54 +371,50 @@ HRESULT RenderClass::InitFullScreenTriangle()
         {  3.0f, -1.0f, 0, 1,   2.0f, 1.0f }
     };
 
-    D3D11_BUFFER_DESC bd = {};
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(vertices);
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = vertices;
+    BufferDesc bd;
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(vertices);
+    bd.bindFlags = BIND_VERTEX_BUFFER;
 
-    HRESULT hr = m_pDevice->CreateBuffer(&bd, &initData, &m_pFullScreenVB);
+    HRESULT hr = m_pDevice->CreateBuffer(bd, vertices, &m_pFullScreenVB);
     if (FAILED(hr)) return hr;
 
     // Create input layout
-    D3D11_INPUT_ELEMENT_DESC layout[] = {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 16, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+    InputElement layout[] = {
+        { "POSITION", 0, Format::R32G32B32A32_FLOAT, 0 },
+        { "TEXCOORD", 0, Format::R32G32_FLOAT, 16 }
     };
 
-    ID3DBlob* pVSBlob = nullptr;
-    hr = CompileShader(L"NegativeVertex.vs", &m_pPostProcessVS, nullptr, &pVSBlob);
+    hr = m_pDevice->CreateShader(ShaderStage::Vertex, L"NegativeVertex.vs", &m_pPostProcessVS);
     if (FAILED(hr)) return hr;
 
-    hr = m_pDevice->CreateInputLayout(layout, 2, pVSBlob->GetBufferPointer(),
-        pVSBlob->GetBufferSize(), &m_pFullScreenLayout);
-    if (pVSBlob) pVSBlob->Release();
+    hr = m_pDevice->CreateInputLayout(layout, 2, m_pPostProcessVS, &m_pFullScreenLayout);
     if (FAILED(hr)) return hr;
 
-    hr = CompileShader(L"NegativePixel.ps", nullptr, &m_pPostProcessPS);
+    // the effects after the scene
+    hr = m_pDevice->CreateShader(ShaderStage::Compute, L"PostProcess.cs", &m_pPostProcessCS);
     return hr;
 }
 
 HRESULT RenderClass::InitSkybox()
 {
-    ID3DBlob* pVertexCode = nullptr;
-    HRESULT result = CompileShader(L"SkyboxVertex.vs", &m_pSkyboxVS, nullptr, &pVertexCode);
+    HRESULT result = m_pDevice->CreateShader(ShaderStage::Vertex, L"SkyboxVertex.vs", &m_pSkyboxVS);
     if (SUCCEEDED(result))
     {
-        result = CompileShader(L"SkyboxPixel.ps", nullptr, &m_pSkyboxPS);
+        result = m_pDevice->CreateShader(ShaderStage::Pixel, L"SkyboxPixel.ps", &m_pSkyboxPS);
     }
 
-    D3D11_INPUT_ELEMENT_DESC skyboxLayout[] =
+    InputElement skyboxLayout[] =
     {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "POSITION", 0, Format::R32G32B32_FLOAT, 0 },
     };
 
     if (SUCCEEDED(result))
     {
-        result = m_pDevice->CreateInputLayout(skyboxLayout, 1, pVertexCode->GetBufferPointer(), pVertexCode->GetBufferSize(), &m_pSkyboxLayout);
+        result = m_pDevice->CreateInputLayout(skyboxLayout, 1, m_pSkyboxVS, &m_pSkyboxLayout);
     }
+    if (FAILED(result))
+        return result;
 
     SkyboxVertex SkyboxVertices[] =
     {
@@ -516,52 +460,40 @@ HRESULT RenderClass::InitSkybox()
         { 1.0f, -1.0f, -1.0f },
         { 1.0f, -1.0f,  1.0f },
     };
-
-    D3D11_BUFFER_DESC bd = {};
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(SkyboxVertex) * ARRAYSIZE(SkyboxVertices);
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = SkyboxVertices;
-    result = m_pDevice->CreateBuffer(&bd, &initData, &m_pSkyboxVB);
-    if (FAILED(result))
-        return result;
-
-    D3D11_BUFFER_DESC vpBufferDesc = {};
-    vpBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    vpBufferDesc.ByteWidth = sizeof(XMMATRIX);
-    vpBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    vpBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    result = m_pDevice->CreateBuffer(&vpBufferDesc, nullptr, &m_pSkyboxVPBuffer);
+    BufferDesc bd;
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(SkyboxVertex) * ARRAYSIZE(SkyboxVertices);
+    bd.bindFlags = BIND_VERTEX_BUFFER;
+    result = m_pDevice->CreateBuffer(bd, SkyboxVertices, &m_pSkyboxVB);
     if (FAILED(result))
         return result;
 
-    result = CreateDDSTextureFromFile(m_pDevice, L"skybox.dds", nullptr, &m_pSkyboxSRV);
+    const BYTE skyColor[4] = { 122, 145, 122, 255 };
+    result = m_textureLoader.Load(L"skybox.dds", &m_pSkyboxSRV, TextureShape::TextureCube, skyColor);
     if (FAILED(result))
         return result;
 
     return S_OK;
 }
 
-HRESULT RenderClass::InitParallelogram() 
+HRESULT RenderClass::InitParallelogram()
 {
-    ID3DBlob* pVertexCode = nullptr;
-    HRESULT result = CompileShader(L"ParallelogramVertex.vs", &m_pParallelogramVS, nullptr, &pVertexCode);
-    if (SUCCEEDED(result))
-    {
-        result = CompileShader(L"ParallelogramPixel.ps", nullptr, &m_pParallelogramPS);
-    }
+    m_parallelogramPS.Init(m_pDevice, ShaderVariantDescs[2]);
+    m_oitResolvePS.Init(m_pDevice, ShaderVariantDescs[3]);
 
-    D3D11_INPUT_ELEMENT_DESC parallelogramLayout[] =
+    HRESULT result = m_pDevice->CreateShader(ShaderStage::Vertex, L"ParallelogramVertex.vs", &m_pParallelogramVS);
+
+    InputElement parallelogramLayout[] =
     {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "POSITION", 0, Format::R32G32B32_FLOAT, 0 },
     };
 
     if (SUCCEEDED(result))
     {
-        result = m_pDevice->CreateInputLayout(parallelogramLayout, 1, pVertexCode->GetBufferPointer(), pVertexCode->GetBufferSize(), &m_pParallelogramLayout);
+        result = m_pDevice->CreateInputLayout(parallelogramLayout, 1, m_pParallelogramVS, &m_pParallelogramLayout);
     }
+    if (FAILED(result))
+        return result;
 
     ParallelogramVertex ParallelogramVertices[] =
     {
@@ -577,439 +509,830 @@ HRESULT RenderClass::InitParallelogram()
         0, 2, 3
     };
 
-    D3D11_BUFFER_DESC bd = {};
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(ParallelogramVertex) * ARRAYSIZE(ParallelogramVertices);
-    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = ParallelogramVertices;
-    result = m_pDevice->CreateBuffer(&bd, &initData, &m_ParallelogramVertexBuffer);
+    BufferDesc bd;
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(ParallelogramVertex) * ARRAYSIZE(ParallelogramVertices);
+    bd.bindFlags = BIND_VERTEX_BUFFER;
+    result = m_pDevice->CreateBuffer(bd, ParallelogramVertices, &m_ParallelogramVertexBuffer);
     if (FAILED(result))
         return result;
 
-    bd.Usage = D3D11_USAGE_DEFAULT;
-    bd.ByteWidth = sizeof(WORD) * ARRAYSIZE(ParallelogramIndices);
-    bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    bd.CPUAccessFlags = 0;
-    initData.pSysMem = ParallelogramIndices;
-    result = m_pDevice->CreateBuffer(&bd, &initData, &m_pParallelogramIndexBuffer);
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(WORD) * ARRAYSIZE(ParallelogramIndices);
+    bd.bindFlags = BIND_INDEX_BUFFER;
+    result = m_pDevice->CreateBuffer(bd, ParallelogramIndices, &m_pParallelogramIndexBuffer);
     if (FAILED(result))
         return result;
 
-    D3D11_BUFFER_DESC cbDesc = {};
-    cbDesc.ByteWidth = sizeof(ColorBuffer);
-    cbDesc.Usage = D3D11_USAGE_DEFAULT;
-    cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    cbDesc.CPUAccessFlags = 0;
-    result = m_pDevice->CreateBuffer(&cbDesc, nullptr, &m_pColorBuffer);
+    BlendDesc blendDesc;
+    blendDesc.blendEnable = true;
+    blendDesc.srcBlend = Blend::SrcAlpha;
+    blendDesc.destBlend = Blend::InvSrcAlpha;
+    blendDesc.blendOp = BlendOp::Add;
+    blendDesc.srcBlendAlpha = Blend::One;
+    blendDesc.destBlendAlpha = Blend::Zero;
+    blendDesc.blendOpAlpha = BlendOp::Add;
+    blendDesc.writeMask = 0xF;
+
+    result = m_stateCache.GetBlendState(blendDesc, &m_pBlendState);
     if (FAILED(result))
         return result;
 
-    D3D11_BLEND_DESC blendDesc = {};
-    blendDesc.RenderTarget[0].BlendEnable = true;
-    blendDesc.RenderTarget[0].SrcBlend = D3D11_BLEND_SRC_ALPHA;
-    blendDesc.RenderTarget[0].DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-    blendDesc.RenderTarget[0].BlendOp = D3D11_BLEND_OP_ADD;
-    blendDesc.RenderTarget[0].SrcBlendAlpha = D3D11_BLEND_ONE;
-    blendDesc.RenderTarget[0].DestBlendAlpha = D3D11_BLEND_ZERO;
-    blendDesc.RenderTarget[0].BlendOpAlpha = D3D11_BLEND_OP_ADD;
-    blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
-
-    result = m_pDevice->CreateBlendState(&blendDesc, &m_pBlendState);
+    DepthStencilDesc dsDescTrans;
+    dsDescTrans.depthEnable = true;
+    dsDescTrans.depthWrite = false;
+    dsDescTrans.depthFunc = ComparisonFunc::Less;
+    result = m_stateCache.GetDepthStencilState(dsDescTrans, &m_pStateParallelogram);
     if (FAILED(result))
         return result;
 
-    D3D11_DEPTH_STENCIL_DESC dsDescTrans = {};
-    dsDescTrans.DepthEnable = true;
-    dsDescTrans.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
-    dsDescTrans.DepthFunc = D3D11_COMPARISON_LESS;
-    result = m_pDevice->CreateDepthStencilState(&dsDescTrans, &m_pStateParallelogram);
-    return result;
-}
-
-HRESULT RenderClass::InitComputeShader()
-{
-    HRESULT result = CompileComputeShader(L"ComputeShader.cs", &m_pComputeShader);
-    if (FAILED(result)) 
+    // Weighted blended OIT sums the weighted colors and the weights, and
+    // multiplies the revealage into the alpha of the first target
+    blendDesc.srcBlend = Blend::One;
+    blendDesc.destBlend = Blend::One;
+    blendDesc.srcBlendAlpha = Blend::Zero;
+    blendDesc.destBlendAlpha = Blend::InvSrcAlpha;
+    result = m_stateCache.GetBlendState(blendDesc, &m_pOitAccumBlend);
+    if (FAILED(result))
         return result;
 
-    D3D11_BUFFER_DESC frustumDesc = {};
-    frustumDesc.ByteWidth = sizeof(XMVECTOR) * 6;
-    frustumDesc.Usage = D3D11_USAGE_DYNAMIC;
-    frustumDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    frustumDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    result = m_pDevice->CreateBuffer(&frustumDesc, nullptr, &m_pFrustumPlanesBuffer);
-    if (FAILED(result)) return result;
-
-    D3D11_BUFFER_DESC argsDesc = {};
-    argsDesc.ByteWidth = sizeof(UINT) * 5;
-    argsDesc.Usage = D3D11_USAGE_DEFAULT;
-    argsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
-    argsDesc.CPUAccessFlags = 0;
-    argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS | D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
-    argsDesc.StructureByteStride = 0;
-
-    result = m_pDevice->CreateBuffer(&argsDesc, nullptr, &m_pIndirectArgsBuffer);
+    // the resolve returns the composited color and the transmittance
+    blendDesc.srcBlend = Blend::One;
+    blendDesc.destBlend = Blend::SrcAlpha;
+    blendDesc.srcBlendAlpha = Blend::Zero;
+    blendDesc.destBlendAlpha = Blend::One;
+    result = m_stateCache.GetBlendState(blendDesc, &m_pOitResolveBlend);
     if (FAILED(result))
         return result;
 
-    D3D11_UNORDERED_ACCESS_VIEW_DESC uavArgsDesc = {};
-    uavArgsDesc.Format = DXGI_FORMAT_R32_TYPELESS;
-    uavArgsDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-    uavArgsDesc.Buffer.FirstElement = 0;
-    uavArgsDesc.Buffer.NumElements = argsDesc.ByteWidth / sizeof(UINT);
-    uavArgsDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
-
-    result = m_pDevice->CreateUnorderedAccessView(m_pIndirectArgsBuffer, &uavArgsDesc, &m_pIndirectArgsUAV);
-    if (FAILED(result)) 
-        return result;
+    BuildTranslucentQuads(m_translucentCount);
+    return UploadTranslucentQuads();
+}
 
-    D3D11_BUFFER_DESC idsDesc = {};
-    idsDesc.ByteWidth = sizeof(UINT) * MaxInst;
-    idsDesc.Usage = D3D11_USAGE_DEFAULT;
-    idsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_SHADER_RESOURCE;
-    idsDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-    idsDesc.StructureByteStride = sizeof(UINT);
+void RenderClass::BuildTranslucentQuads(UINT count)
+{
+    m_translucentQuads.resize(count);
+    m_translucentCenters.resize(count);
+    m_translucentQueue.Reserve(count);
+    m_translucentOrder.resize(count);
+    for (UINT i = 0; i < count; i++)
+    {
+        m_translucentOrder[i] = i;
+    }
 
-    result = m_pDevice->CreateBuffer(&idsDesc, nullptr, &m_pObjectsIdsBuffer);
-    if (FAILED(result)) 
-        return result;
+    // the animated pair is placed by UpdateTranslucentQuads
+    const XMFLOAT4 pairColors[AnimatedQuadCount] = { XMFLOAT4(1.0f, 0.0f, 0.0f, 0.5f), XMFLOAT4(0.0f, 1.0f, 0.0f, 0.5f) };
+    for (UINT i = 0; i < std::min(count, AnimatedQuadCount); i++)
+    {
+        m_translucentQuads[i].model = XMMatrixIdentity();
+        m_translucentQuads[i].color = pairColors[i];
+        m_translucentCenters[i] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    }
 
-    D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-    uavDesc.Format = DXGI_FORMAT_UNKNOWN;
-    uavDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
-    uavDesc.Buffer.FirstElement = 0;
-    uavDesc.Buffer.NumElements = MaxInst;
+    // the rest stand still among the cubes and lights, turned every way
+    UINT state = 67890;
+    for (UINT i = AnimatedQuadCount; i < count; i++)
+    {
+        float radius = LightFieldRadius * sqrtf(NextLightRandom(state));
+        float angle = XM_2PI * NextLightRandom(state);
+        XMFLOAT3 center(radius * cosf(angle), 3.0f * NextLightRandom(state) - 1.0f, radius * sinf(angle));
+        float scale = 0.5f + 0.5f * NextLightRandom(state);
+        XMMATRIX model = XMMatrixScaling(scale, scale, scale) *
+            XMMatrixRotationX(XM_PI * NextLightRandom(state)) * XMMatrixRotationY(XM_2PI * NextLightRandom(state)) *
+            XMMatrixTranslation(center.x, center.y, center.z);
 
-    result = m_pDevice->CreateUnorderedAccessView(m_pObjectsIdsBuffer, &uavDesc, &m_pObjectsIdsUAV);
-    if (FAILED(result)) 
-        return result;
+        XMFLOAT3 color(NextLightRandom(state), NextLightRandom(state), NextLightRandom(state));
+        float brightest = std::max(color.x, std::max(color.y, color.z));
+        float alpha = 0.2f + 0.5f * NextLightRandom(state);
 
-    D3D11_BUFFER_DESC instanceDesc = {};
-    instanceDesc.ByteWidth = sizeof(InstanceData) * MaxInst;
-    instanceDesc.Usage = D3D11_USAGE_DEFAULT;
-    instanceDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-    instanceDesc.CPUAccessFlags = 0;
-    instanceDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
-    instanceDesc.StructureByteStride = sizeof(InstanceData);
-
-    ID3D11Buffer* pInstanceStructuredBuffer = nullptr;
-    result = m_pDevice->CreateBuffer(&instanceDesc, nullptr, &pInstanceStructuredBuffer);
-    if (FAILED(result)) 
-        return result;
+        m_translucentQuads[i].model = XMMatrixTranspose(model);
+        m_translucentQuads[i].color = XMFLOAT4(color.x / brightest, color.y / brightest, color.z / brightest, alpha);
+        m_translucentCenters[i] = center;
+    }
 
-    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-    srvDesc.Format = DXGI_FORMAT_UNKNOWN;
-    srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
-    srvDesc.Buffer.FirstElement = 0;
-    srvDesc.Buffer.NumElements = MaxInst;
+    m_translucentQuadsChanged = true;
+    m_translucentOrderChanged = true;
+    m_translucentOrderSorted = false;
+}
 
-    result = m_pDevice->CreateShaderResourceView(pInstanceStructuredBuffer, &srvDesc, &m_pInstanceDataSRV);
+HRESULT RenderClass::ReserveTranslucentQuads(UINT count)
+{
+    if (count <= m_translucentCapacity)
+        return S_OK;
+
+    UINT capacity = m_translucentCapacity * 2;
+    if (capacity < count)
+        capacity = count;
+
+    ReleaseHandle(m_pTranslucentQuads);
+    ReleaseHandle(m_pTranslucentOrder);
+    m_translucentCapacity = 0;
+
+    BufferDesc quadDesc;
+    quadDesc.byteWidth = sizeof(TranslucentQuad) * capacity;
+    quadDesc.usage = ResourceUsage::Default;
+    quadDesc.bindFlags = BIND_SHADER_RESOURCE;
+    quadDesc.miscFlags = MISC_STRUCTURED;
+    quadDesc.structureStride = sizeof(TranslucentQuad);
+    HRESULT result = m_pDevice->CreateBuffer(quadDesc, nullptr, &m_pTranslucentQuads);
     if (FAILED(result))
-    {
-        pInstanceStructuredBuffer->Release();
         return result;
-    }
 
-    m_pDeviceContext->UpdateSubresource(pInstanceStructuredBuffer, 0, nullptr, m_modelInstances.data(), 0, 0);
-    pInstanceStructuredBuffer->Release();
+    BufferDesc orderDesc = quadDesc;
+    orderDesc.byteWidth = sizeof(UINT) * capacity;
+    orderDesc.structureStride = sizeof(UINT);
+    result = m_pDevice->CreateBuffer(orderDesc, nullptr, &m_pTranslucentOrder);
+    if (FAILED(result))
+        return result;
 
+    m_translucentCapacity = capacity;
     return S_OK;
 }
 
-void RenderClass::TerminateComputeShader()
+HRESULT RenderClass::UploadTranslucentQuads()
 {
-    if (m_pComputeShader) 
-        m_pComputeShader->Release();
-
-    if (m_pFrustumPlanesBuffer) 
-        m_pFrustumPlanesBuffer->Release();
-
-    if (m_pIndirectArgsBuffer) 
-        m_pIndirectArgsBuffer->Release();
-
-    if (m_pObjectsIdsBuffer) 
-        m_pObjectsIdsBuffer->Release();
-
-    if (m_pIndirectArgsUAV) 
-        m_pIndirectArgsUAV->Release();
+    UINT count = GetTranslucentCount();
+    UINT capacity = m_translucentCapacity;
+    HRESULT result = ReserveTranslucentQuads(count);
+    if (FAILED(result) || count == 0)
+        return result;
 
-    if (m_pObjectsIdsUAV) 
-        m_pObjectsIdsUAV->Release();
+    // a new buffer holds nothing yet, otherwise only the animated pair moved
+    if (m_translucentCapacity != capacity)
+    {
+        m_translucentQuadsChanged = true;
+        m_translucentOrderChanged = true;
+    }
+    UINT uploaded = m_translucentQuadsChanged ? count : std::min(count, AnimatedQuadCount);
+    m_pContext->UpdateBufferRange(m_pTranslucentQuads, 0, m_translucentQuads.data(), sizeof(TranslucentQuad) * uploaded);
+    m_translucentQuadsChanged = false;
 
-    if (m_pInstanceDataSRV) 
-        m_pInstanceDataSRV->Release();
+    if (m_translucentOrderChanged)
+        m_pContext->UpdateBufferRange(m_pTranslucentOrder, 0, m_translucentOrder.data(), sizeof(UINT) * count);
+    m_translucentOrderChanged = false;
+    return S_OK;
 }
 
-void RenderClass::TerminateParallelogram()
+HRESULT RenderClass::SetTranslucentCount(UINT count)
 {
-    if (m_ParallelogramVertexBuffer)
-        m_ParallelogramVertexBuffer -> Release();
-
-    if (m_pParallelogramIndexBuffer)
-        m_pParallelogramIndexBuffer -> Release();
+    m_translucentCount = count;
+    if (!m_pDevice || !m_pParallelogramVS)
+        return S_OK;
 
-    if (m_pParallelogramPS)
-        m_pParallelogramPS->Release();
+    BuildTranslucentQuads(count);
+    return UploadTranslucentQuads();
+}
 
-    if (m_pParallelogramVS)
-        m_pParallelogramVS->Release();
+// The heads are as large as the back buffer, a new size makes them again;
+// the nodes are made again when the pool grows
+HRESULT RenderClass::ReserveOitLists()
+{
+    BufferDesc listDesc;
+    listDesc.usage = ResourceUsage::Default;
+    listDesc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    listDesc.miscFlags = MISC_STRUCTURED;
+    listDesc.structureStride = sizeof(UINT);
 
-    if (m_pParallelogramLayout)
-        m_pParallelogramLayout->Release();
+    HRESULT result = S_OK;
+    if (!m_pOitCounter)
+    {
+        listDesc.byteWidth = sizeof(UINT);
+        result = m_pDevice->CreateBuffer(listDesc, nullptr, &m_pOitCounter);
+        if (FAILED(result))
+            return result;
 
-    if (m_pColorBuffer)
-        m_pColorBuffer->Release();
+        BufferDesc readbackDesc;
+        readbackDesc.byteWidth = sizeof(UINT);
+        readbackDesc.usage = ResourceUsage::Staging;
+        for (UINT i = 0; i < ArgsReadbackLatency; i++)
+        {
+            result = m_pDevice->CreateBuffer(readbackDesc, nullptr, &m_pOitCountReadback[i]);
+            if (FAILED(result))
+                return result;
+        }
+    }
 
-    if (m_pBlendState) 
-        m_pBlendState->Release();
+    if (!m_pOitHeads)
+    {
+        listDesc.byteWidth = sizeof(UINT) * m_width * m_height;
+        result = m_pDevice->CreateBuffer(listDesc, nullptr, &m_pOitHeads);
+        if (FAILED(result))
+            return result;
+    }
 
-    if (m_pStateParallelogram) 
-        m_pStateParallelogram->Release();
+    if (!m_pOitNodes)
+    {
+        listDesc.byteWidth = sizeof(OitNode) * m_oitNodeCapacity;
+        listDesc.structureStride = sizeof(OitNode);
+        result = m_pDevice->CreateBuffer(listDesc, nullptr, &m_pOitNodes);
+    }
+    return result;
 }
 
-void RenderClass::Terminate()
+void RenderClass::BuildInstances(UINT count)
 {
-    TerminateBufferShader();
-    TerminateSkybox();
-    TerminateParallelogram();
-    TerminateComputeShader();
+    m_instances.Clear();
+    m_instances.Reserve(count);
+    // the cube vertices are at +-1, the boxes have always been a little smaller
+    m_instances.SetLocalExtent(XMFLOAT3(0.95f, 0.95f, 0.95f));
 
-    if (m_pDeviceContext) 
-    {
-        m_pDeviceContext->ClearState();
-        m_pDeviceContext->Release();
-        m_pDeviceContext = nullptr;
-    }
-    
-    if (m_pRenderTargetView)
-    {
-        m_pRenderTargetView->Release();
-        m_pRenderTargetView = nullptr;
-    }
+    // The original scene: a cube in the middle and two rings around it.
+    // Larger counts keep adding rings further out.
+    const int innerCount = 10;
+    const int outerCount = 12;
+    const float innerRadius = 4.0f;
+    const float outerRadius = 9.5f;
+    const float ringStep = 2.0f;
+
+    AddInstance(XMFLOAT3(0.0f, 0.0f, 0.0f), 0);
+    m_sceneRadius = count > 1 + innerCount ? outerRadius : innerRadius;
 
-    if (m_pDepthView)
+    for (int i = 0; i < innerCount; i++)
     {
-        m_pDepthView->Release();
-        m_pDepthView = nullptr;
+        float angle = XM_2PI * i / innerCount;
+        AddInstance(XMFLOAT3(innerRadius * cosf(angle), 0.0f, innerRadius * sinf(angle)), i % 2);
     }
 
-    if (m_pSwapChain) 
+    for (int i = 0; i < outerCount; i++)
     {
-        m_pSwapChain->Release();
-        m_pSwapChain = nullptr;
+        float angle = XM_2PI * i / outerCount;
+        AddInstance(XMFLOAT3(outerRadius * cosf(angle), 0.0f, outerRadius * sinf(angle)), i % 2);
     }
-    
-    if (m_pDevice) 
+
+    for (float radius = outerRadius + ringStep; m_instances.GetCount() < count; radius += ringStep)
     {
-        m_pDevice->Release();
-        m_pDevice = nullptr;
+        int ringCount = static_cast<int>(XM_2PI * radius / ringStep);
+        m_sceneRadius = radius;
+        for (int i = 0; i < ringCount; i++)
+        {
+            float angle = XM_2PI * i / ringCount;
+            AddInstance(XMFLOAT3(radius * cosf(angle), 0.0f, radius * sinf(angle)), i % 2);
+        }
     }
 
-    ImGui_ImplDX11_Shutdown();
-    ImGui_ImplWin32_Shutdown();
-    ImGui::DestroyContext();
+    m_instances.Resize(count);
+
+    // built again by the next upload
+    m_cubeBvh.Clear();
 }
 
-void RenderClass::TerminateBufferShader()
+void RenderClass::AddInstance(const XMFLOAT3& position, UINT texInd)
 {
-    if (m_pLayout)
-        m_pLayout->Release();
-
-    if (m_pPixelShader)
-        m_pPixelShader->Release();
+    m_instances.Add(position, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f), m_fixedScale, texInd);
+}
 
-    if (m_pVertexShader)
-        m_pVertexShader->Release();
+HRESULT RenderClass::ReserveInstances(UINT count)
+{
+    if (count <= m_instanceCapacity)
+        return S_OK;
+
+    // grow geometrically so adding cubes a few at a time doesn't recreate the buffers every time
+    UINT capacity = m_instanceCapacity * 2;
+    if (capacity < count)
+        capacity = count;
+
+    ReleaseHandle(m_pModelBufferInst);
+    for (RenderHandle& upload : m_instanceUploads)
+    {
+        ReleaseHandle(upload);
+    }
+    m_instanceUploads.clear();
+    ReleaseHandle(m_pInstanceDataSRV);
+    ReleaseHandle(m_pOccludedInstances);
+    ReleaseHandle(m_pDisoccludedInst);
+    m_instanceCapacity = 0;
+
+    // visible instances, written by the culling compute shader (or the CPU)
+    // and read by ColorVertex.vs through SV_InstanceID
+    BufferDesc visibleDesc;
+    visibleDesc.byteWidth = sizeof(InstanceData) * capacity;
+    visibleDesc.usage = ResourceUsage::Default;
+    visibleDesc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    visibleDesc.miscFlags = MISC_STRUCTURED;
+    visibleDesc.structureStride = sizeof(InstanceData);
+    HRESULT result = m_pDevice->CreateBuffer(visibleDesc, nullptr, &m_pModelBufferInst);
+    if (FAILED(result))
+        return result;
 
-    if (m_pLightPixelShader)
-        m_pLightPixelShader->Release();
+    // the same for CPU culling in pieces of CubesPerPass, every pass maps
+    // and writes its own
+    visibleDesc.usage = ResourceUsage::Dynamic;
+    visibleDesc.bindFlags = BIND_SHADER_RESOURCE;
+    visibleDesc.byteWidth = sizeof(InstanceData) * std::min(capacity, CubesPerPass);
+    m_instanceUploads.resize((capacity + CubesPerPass - 1) / CubesPerPass, NullHandle);
+    for (RenderHandle& upload : m_instanceUploads)
+    {
+        result = m_pDevice->CreateBuffer(visibleDesc, nullptr, &upload);
+        if (FAILED(result))
+            return result;
+    }
+
+    // every instance, input of the culling compute shader
+    BufferDesc instanceDesc;
+    instanceDesc.byteWidth = sizeof(InstanceData) * capacity;
+    instanceDesc.usage = ResourceUsage::Default;
+    instanceDesc.bindFlags = BIND_SHADER_RESOURCE;
+    instanceDesc.miscFlags = MISC_STRUCTURED;
+    instanceDesc.structureStride = sizeof(InstanceData);
+    result = m_pDevice->CreateBuffer(instanceDesc, nullptr, &m_pInstanceDataSRV);
+    if (FAILED(result))
+        return result;
 
-    if (m_pIndexBuffer)
-        m_pIndexBuffer->Release();
+    // occlusion culling: what phase 1 hid, and what phase 2 found visible
+    // after all, drawn by the second indirect draw
+    BufferDesc occludedDesc;
+    occludedDesc.byteWidth = sizeof(UINT) * capacity;
+    occludedDesc.usage = ResourceUsage::Default;
+    occludedDesc.bindFlags = BIND_UNORDERED_ACCESS;
+    occludedDesc.miscFlags = MISC_RAW_VIEWS;
+    result = m_pDevice->CreateBuffer(occludedDesc, nullptr, &m_pOccludedInstances);
+    if (FAILED(result))
+        return result;
 
-    if (m_pVertexBuffer)
-        m_pVertexBuffer->Release();
+    visibleDesc.byteWidth = sizeof(InstanceData) * capacity;
+    visibleDesc.usage = ResourceUsage::Default;
+    visibleDesc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    result = m_pDevice->CreateBuffer(visibleDesc, nullptr, &m_pDisoccludedInst);
+    if (FAILED(result))
+        return result;
 
-    if (m_pModelBuffer)
-        m_pModelBuffer->Release();
+    m_instanceCapacity = capacity;
+    return S_OK;
+}
 
-    if (m_pVPBuffer)
-        m_pVPBuffer->Release();
+HRESULT RenderClass::UploadInstances()
+{
+    static_assert(sizeof(InstanceData) == sizeof(InstanceTransform), "the store writes the instance buffer");
 
-    if (m_pTextureView) 
-        m_pTextureView->Release();
+    UINT count = m_instances.GetCount();
+    UINT capacity = m_instanceCapacity;
+    HRESULT result = ReserveInstances(count);
+    if (FAILED(result))
+        return result;
 
-    if (m_pNormalMapView)
-        m_pNormalMapView->Release();
+    // a new buffer holds nothing yet
+    if (m_instanceCapacity != capacity)
+        m_instances.MarkAllDirty();
 
-    if (m_pSamplerState) 
-        m_pSamplerState->Release();
+    // Only the changed cubes are composed and uploaded, and the tree is
+    // refit over the boxes that moved
+    m_instances.Compose();
+    const std::vector<UINT>& dirty = m_instances.GetDirtyIndices();
+    if (m_cubeBvh.GetBoxCount() != count)
+        m_cubeBvh.Build(m_instances.GetBounds());
+    else if (!dirty.empty())
+        m_cubeBvh.Refit(m_instances.GetBounds(), dirty.data(), static_cast<UINT>(dirty.size()));
 
-    if (m_pLightBuffer)
-        m_pLightBuffer->Release();
+    const std::vector<InstanceTransform>& transforms = m_instances.GetTransforms();
+    for (const InstanceRange& range : m_instances.GetDirtyRanges())
+    {
+        m_pContext->UpdateBufferRange(m_pInstanceDataSRV, sizeof(InstanceData) * range.first,
+            &transforms[range.first], sizeof(InstanceData) * range.count);
+    }
+    m_instances.ClearDirty();
+    return S_OK;
+}
 
-    if (m_pModelBufferInst)
-        m_pModelBufferInst->Release();
+HRESULT RenderClass::SetInstanceCount(UINT count)
+{
+    m_instanceCount = count;
+    if (!m_pDevice || m_instances.GetCount() == 0)
+        return S_OK;
 
-    if (m_pPostProcessTexture) 
-        m_pPostProcessTexture->Release();
+    BuildInstances(count);
+    return UploadInstances();
+}
 
-    if (m_pPostProcessRTV) 
-        m_pPostProcessRTV->Release();
+// Every cube is drawn by the same shader, grouped by texture so that neighbours
+// in the instance buffer sample the same slice, nearest first within one
+void RenderClass::SortVisibleCubes(UINT* visibleIndices, UINT visibleCount)
+{
+    const CullingBounds& bounds = m_instances.GetBounds();
+    XMFLOAT4X4 view;
+    XMStoreFloat4x4(&view, m_passData.view);
 
-    if (m_pPostProcessSRV) 
-        m_pPostProcessSRV->Release();
-
-    if (m_pPostProcessVS) 
-        m_pPostProcessVS->Release();
-
-    if (m_pPostProcessPS) 
-        m_pPostProcessPS->Release();
+    m_cubeQueue.Clear();
+    m_cubeQueue.Reserve(visibleCount);
+    for (UINT i = 0; i < visibleCount; i++)
+    {
+        UINT index = visibleIndices[i];
+        float viewZ = bounds.centerX[index] * view._13 + bounds.centerY[index] * view._23 + bounds.centerZ[index] * view._33 + view._43;
+        m_cubeQueue.Add(RenderQueue::MakeOpaqueKey(static_cast<UINT>(FramePass::Cubes), m_passData.features,
+            m_instances.GetTexIndex(index), viewZ / CameraFar), index);
+    }
 
-    if (m_pFullScreenVB) 
-        m_pFullScreenVB->Release();
+    m_cubeQueue.Sort(m_pSortPool.get());
+    for (UINT i = 0; i < visibleCount; i++)
+    {
+        visibleIndices[i] = m_cubeQueue.GetItem(i);
+    }
+}
 
-    if (m_pFullScreenLayout) 
-        m_pFullScreenLayout->Release();
+void RenderClass::WriteVisibleInstances(const UINT* ids, UINT count, InstanceData* pInstances)
+{
+    // All cubes share the same spin before their own transform. Both are
+    // transposed, so the spin is applied last.
+    XMMATRIX spin = XMMatrixTranspose(XMMatrixRotationY(m_CubeAngle));
+    const std::vector<InstanceTransform>& transforms = m_instances.GetTransforms();
 
-    m_modelInstances.clear();
+    for (UINT i = 0; i < count; i++)
+    {
+        const InstanceTransform& transform = transforms[ids[i]];
+        InstanceData& instance = pInstances[i];
+        instance.model = XMMatrixMultiply(XMLoadFloat4x4(&transform.model), spin);
+        instance.texInd = transform.texInd;
+        instance.extent = transform.extent;
+    }
 }
 
-void RenderClass::TerminateSkybox()
+HRESULT RenderClass::InitComputeShader()
 {
-    if (m_pSkyboxVB) {
-        m_pSkyboxVB->Release();
-    }
+    HRESULT result = m_pDevice->CreateShader(ShaderStage::Compute, L"ComputeShader.cs", &m_pComputeShader);
+    if (FAILED(result))
+        return result;
 
-    if (m_pSkyboxSRV) {
-        m_pSkyboxSRV->Release();
-    }
+    result = m_pDevice->CreateShader(ShaderStage::Compute, L"HiZ.cs", &m_pHiZShader);
+    if (FAILED(result))
+        return result;
 
-    if (m_pSkyboxVPBuffer) {
-        m_pSkyboxVPBuffer->Release();
-    }
+    // two draws, the second for the cubes phase 2 of occlusion culling finds
+    BufferDesc argsDesc;
+    argsDesc.byteWidth = sizeof(UINT) * 10;
+    argsDesc.usage = ResourceUsage::Default;
+    argsDesc.bindFlags = BIND_UNORDERED_ACCESS;
+    argsDesc.miscFlags = MISC_DRAW_INDIRECT_ARGS | MISC_RAW_VIEWS;
+    result = m_pDevice->CreateBuffer(argsDesc, nullptr, &m_pIndirectArgsBuffer);
+    if (FAILED(result))
+        return result;
 
-    if (m_pSkyboxLayout) {
-        m_pSkyboxLayout->Release();
-    }
+    // reset with a GPU copy instead of uploading the arguments every frame
+    static const UINT initialArgs[10] = { 36, 0, 0, 0, 0, 36, 0, 0, 0, 0 };
+    BufferDesc argsInitDesc;
+    argsInitDesc.byteWidth = sizeof(initialArgs);
+    argsInitDesc.usage = ResourceUsage::Default;
+    result = m_pDevice->CreateBuffer(argsInitDesc, initialArgs, &m_pIndirectArgsInit);
+    if (FAILED(result))
+        return result;
 
-    if (m_pSkyboxVS) {
-        m_pSkyboxVS->Release();
+    // the visible count for the UI is copied here and read a few frames later,
+    // when the GPU is long done with it
+    BufferDesc readbackDesc;
+    readbackDesc.byteWidth = sizeof(UINT) * 10;
+    readbackDesc.usage = ResourceUsage::Staging;
+    for (UINT i = 0; i < ArgsReadbackLatency; i++)
+    {
+        result = m_pDevice->CreateBuffer(readbackDesc, nullptr, &m_pArgsReadback[i]);
+        if (FAILED(result))
+            return result;
     }
 
-    if (m_pSkyboxPS) {
-        m_pSkyboxPS->Release();
-    }
+    return S_OK;
 }
 
-std::wstring Extension(const std::wstring& path)
+HRESULT RenderClass::InitLightClusters()
 {
-    size_t dotPos = path.find_last_of(L".");
-    if (dotPos == std::wstring::npos || dotPos == 0)
+    SetActiveLights(m_activeLights);
+
+    BufferDesc lightDesc;
+    lightDesc.byteWidth = sizeof(PointLight) * MaxLights;
+    lightDesc.usage = ResourceUsage::Default;
+    lightDesc.bindFlags = BIND_SHADER_RESOURCE;
+    lightDesc.miscFlags = MISC_STRUCTURED;
+    lightDesc.structureStride = sizeof(PointLight);
+    HRESULT result = m_pDevice->CreateBuffer(lightDesc, nullptr, &m_pLightData);
+    if (FAILED(result))
+        return result;
+
+    BufferDesc overflowDesc;
+    overflowDesc.byteWidth = sizeof(UINT);
+    overflowDesc.usage = ResourceUsage::Default;
+    overflowDesc.bindFlags = BIND_UNORDERED_ACCESS;
+    overflowDesc.miscFlags = MISC_STRUCTURED;
+    overflowDesc.structureStride = sizeof(UINT);
+    result = m_pDevice->CreateBuffer(overflowDesc, nullptr, &m_pClusterOverflow);
+    if (FAILED(result))
+        return result;
+
+    BufferDesc readbackDesc;
+    readbackDesc.byteWidth = sizeof(UINT);
+    readbackDesc.usage = ResourceUsage::Staging;
+    for (UINT i = 0; i < ArgsReadbackLatency; i++)
     {
-        return L"";
+        result = m_pDevice->CreateBuffer(readbackDesc, nullptr, &m_pClusterOverflowReadback[i]);
+        if (FAILED(result))
+            return result;
     }
-    return path.substr(dotPos + 1);
+
+    return m_pDevice->CreateShader(ShaderStage::Compute, L"LightClusters.cs", &m_pClusterShader);
+}
+
+HRESULT RenderClass::ReserveClusters(UINT count)
+{
+    if (count <= m_clusterCapacity)
+        return S_OK;
+
+    ReleaseHandle(m_pClusterBounds);
+    ReleaseHandle(m_pClusterRanges);
+    ReleaseHandle(m_pClusterIndices);
+    m_clusterCapacity = 0;
+
+    BufferDesc boundsDesc;
+    boundsDesc.byteWidth = sizeof(XMFLOAT4) * 2 * count;
+    boundsDesc.usage = ResourceUsage::Default;
+    boundsDesc.bindFlags = BIND_SHADER_RESOURCE;
+    boundsDesc.miscFlags = MISC_STRUCTURED;
+    boundsDesc.structureStride = sizeof(XMFLOAT4);
+    HRESULT result = m_pDevice->CreateBuffer(boundsDesc, nullptr, &m_pClusterBounds);
+    if (FAILED(result))
+        return result;
+
+    // filled by LightClusters.cs, or uploaded after the CPU assignment
+    BufferDesc rangesDesc;
+    rangesDesc.byteWidth = sizeof(UINT) * 2 * count;
+    rangesDesc.usage = ResourceUsage::Default;
+    rangesDesc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    rangesDesc.miscFlags = MISC_STRUCTURED;
+    rangesDesc.structureStride = sizeof(UINT) * 2;
+    result = m_pDevice->CreateBuffer(rangesDesc, nullptr, &m_pClusterRanges);
+    if (FAILED(result))
+        return result;
+
+    BufferDesc indicesDesc = rangesDesc;
+    indicesDesc.byteWidth = sizeof(UINT) * LightClusters::MaxLightsPerCluster * count;
+    indicesDesc.structureStride = sizeof(UINT);
+    result = m_pDevice->CreateBuffer(indicesDesc, nullptr, &m_pClusterIndices);
+    if (FAILED(result))
+        return result;
+
+    m_clusterCapacity = count;
+    return S_OK;
 }
 
-HRESULT RenderClass::CompileShader(const std::wstring& path, ID3D11VertexShader** ppVertexShader, ID3D11PixelShader** ppPixelShader, ID3DBlob** pCodeShader)
+HRESULT RenderClass::InitShadows()
 {
-    std::wstring extension = Extension(path);
+    // the tiles of a slot are cleared by drawing this over every face
+    FullScreenVertex vertices[3] = {
+        { -1.0f, -1.0f, 1, 1,   0.0f, 1.0f },
+        { -1.0f,  3.0f, 1, 1,   0.0f,-1.0f },
+        {  3.0f, -1.0f, 1, 1,   2.0f, 1.0f }
+    };
 
-    std::string platform = "";
+    BufferDesc bd;
+    bd.usage = ResourceUsage::Default;
+    bd.byteWidth = sizeof(vertices);
+    bd.bindFlags = BIND_VERTEX_BUFFER;
+    return m_pDevice->CreateBuffer(bd, vertices, &m_pShadowClearVB);
+}
 
-    if (extension == L"vs")
+// Both atlases are made again when the face size or the number of slots changes
+HRESULT RenderClass::ReserveShadowAtlas()
+{
+    if (!m_shadowAtlas.Configure(m_shadowFaceSize, m_maxShadowedLights) && m_pStaticShadowAtlas && m_pDynamicShadowAtlas)
+        return S_OK;
+
+    ReleaseHandle(m_pStaticShadowAtlas);
+    ReleaseHandle(m_pDynamicShadowAtlas);
+    m_shadowAtlas.Invalidate();
+    if (m_shadowAtlas.GetWidth() == 0 || m_shadowAtlas.GetHeight() == 0)
+        return E_INVALIDARG;
+
+    TextureDesc atlasDesc;
+    atlasDesc.width = m_shadowAtlas.GetWidth();
+    atlasDesc.height = m_shadowAtlas.GetHeight();
+    atlasDesc.format = Format::D32_FLOAT;
+    atlasDesc.bindFlags = BIND_DEPTH_STENCIL | BIND_SHADER_RESOURCE;
+    HRESULT result = m_pDevice->CreateTexture(atlasDesc, nullptr, &m_pStaticShadowAtlas);
+    if (SUCCEEDED(result))
     {
-        platform = "vs_5_0";
+        result = m_pDevice->CreateTexture(atlasDesc, nullptr, &m_pDynamicShadowAtlas);
     }
-    else if (extension == L"ps")
+
+    if (FAILED(result))
     {
-        platform = "ps_5_0";
+        ReleaseHandle(m_pStaticShadowAtlas);
+        ReleaseHandle(m_pDynamicShadowAtlas);
     }
+    return result;
+}
 
-    UINT flags = 0;
-#ifdef _DEBUG
-    flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-#endif 
+void RenderClass::SetShadowLimits(UINT maxShadowed, UINT updatesPerFrame)
+{
+    m_maxShadowedLights = std::max(1u, std::min(maxShadowed, MaxShadowSlots));
+    m_shadowUpdatesPerFrame = updatesPerFrame;
+}
 
-    ID3DBlob* pCode = nullptr;
-    ID3DBlob* pErr = nullptr;
+void RenderClass::SetSpinCubes(bool spin)
+{
+    // the cubes move between the layers
+    if (spin != m_spinCubes)
+        m_staticCasterVersion++;
+    m_spinCubes = spin;
+}
 
-    HRESULT result = D3DCompileFromFile(path.c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", platform.c_str(), 0, 0, &pCode, &pErr);
-    if (!SUCCEEDED(result) && pErr != nullptr)
-    {
-        OutputDebugStringA((const char*)pErr->GetBufferPointer());
+void RenderClass::SetActiveLights(UINT count)
+{
+    m_activeLights = count < MaxLights ? count : MaxLights;
+
+    // the first LightCount are placed by UpdateLights(), a light keeps its
+    // place when the count changes
+    UINT state = 12345;
+    m_sceneLights.resize(LightCount);
+    for (UINT i = LightCount; i < m_activeLights; i++)
+    {
+        SceneLight scene;
+        scene.orbitRadius = LightFieldRadius * sqrtf(NextLightRandom(state));
+        scene.orbitPhase = XM_2PI * NextLightRandom(state);
+        scene.orbitSpeed = NextLightRandom(state) - 0.5f;
+        scene.height = 3.0f * NextLightRandom(state) - 1.5f;
+        scene.light.Position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        scene.light.Range = 0.75f + 1.25f * NextLightRandom(state);
+
+        // saturated colors, the brightest channel at 1
+        XMFLOAT3 color(NextLightRandom(state), NextLightRandom(state), NextLightRandom(state));
+        float brightest = std::max(color.x, std::max(color.y, color.z));
+        scene.light.Color = XMFLOAT3(color.x / brightest, color.y / brightest, color.z / brightest);
+        scene.light.Intensity = 1.0f;
+        m_sceneLights.push_back(scene);
     }
-    if (pErr)
-        pErr->Release();
+}
 
-    if (SUCCEEDED(result))
-    {
-        if (extension == L"vs" && ppVertexShader)
-        {
-            result = m_pDevice->CreateVertexShader(pCode->GetBufferPointer(), pCode->GetBufferSize(), nullptr, ppVertexShader);
-            if (FAILED(result))
-            {
-                pCode->Release();
-                return result;
-            }
-        }
-        else if (extension == L"ps" && ppPixelShader)
-        {
-            result = m_pDevice->CreatePixelShader(pCode->GetBufferPointer(), pCode->GetBufferSize(), nullptr, ppPixelShader);
-            if (FAILED(result))
-            {
-                pCode->Release();
-                return result;
-            }
-        }
-    }
+UINT RenderClass::GetFeatures() const
+{
+    UINT features = m_useClusteredLighting ? FeatureClustered : std::min(m_activeLights, LightCount) << FeatureLightShift;
+    if (m_useNormalMap && m_pNormalMapView != NullHandle)
+        features |= FeatureNormalMap;
+    features |= static_cast<UINT>(m_transparencyMode) << FeatureTransparencyShift;
+    if (m_useShadows && m_pStaticShadowAtlas && m_pDynamicShadowAtlas)
+        features |= FeatureShadows;
+    return features;
+}
 
-    if (pCodeShader)
+UINT RenderClass::GetCompiledVariantCount() const
+{
+    return m_cubeVS.GetCompiledCount() + m_cubePS.GetCompiledCount() + m_parallelogramPS.GetCompiledCount() +
+        m_oitResolvePS.GetCompiledCount() + m_gBufferPS.GetCompiledCount() + m_deferredCS.GetCompiledCount();
+}
+
+void RenderClass::ReleaseHandle(RenderHandle& handle)
+{
+    if (handle != NullHandle && m_pDevice)
+        m_pDevice->Release(handle);
+    handle = NullHandle;
+}
+
+void RenderClass::TerminateComputeShader()
+{
+    ReleaseHandle(m_pComputeShader);
+    ReleaseHandle(m_pHiZShader);
+    ReleaseHandle(m_pHiZ);
+    m_hiZValid = false;
+    ReleaseHandle(m_pIndirectArgsBuffer);
+    ReleaseHandle(m_pIndirectArgsInit);
+    for (UINT i = 0; i < ArgsReadbackLatency; i++)
     {
-        *pCodeShader = pCode;
+        ReleaseHandle(m_pArgsReadback[i]);
     }
-    else
+}
+
+void RenderClass::TerminateLightClusters()
+{
+    ReleaseHandle(m_pLightData);
+    ReleaseHandle(m_pClusterShader);
+    ReleaseHandle(m_pClusterBounds);
+    ReleaseHandle(m_pClusterRanges);
+    ReleaseHandle(m_pClusterIndices);
+    ReleaseHandle(m_pClusterOverflow);
+    for (UINT i = 0; i < ArgsReadbackLatency; i++)
     {
-        pCode->Release();
+        ReleaseHandle(m_pClusterOverflowReadback[i]);
     }
-    return result;
+    m_clusterCapacity = 0;
+}
+
+void RenderClass::TerminateShadows()
+{
+    ReleaseHandle(m_pStaticShadowAtlas);
+    ReleaseHandle(m_pDynamicShadowAtlas);
+    ReleaseHandle(m_pShadowClearVB);
+    m_shadowAtlas.Configure(0, 0);
 }
 
-HRESULT RenderClass::CompileComputeShader(const std::wstring& path, ID3D11ComputeShader** ppComputeShader)
+void RenderClass::TerminateParallelogram()
+{
+    ReleaseHandle(m_ParallelogramVertexBuffer);
+    ReleaseHandle(m_pParallelogramIndexBuffer);
+    m_parallelogramPS.Terminate();
+    ReleaseHandle(m_pParallelogramVS);
+    ReleaseHandle(m_pParallelogramLayout);
+    ReleaseHandle(m_pTranslucentQuads);
+    ReleaseHandle(m_pTranslucentOrder);
+    m_translucentCapacity = 0;
+    m_oitResolvePS.Terminate();
+    ReleaseHandle(m_pOitCounter);
+    ReleaseHandle(m_pOitHeads);
+    ReleaseHandle(m_pOitNodes);
+    for (UINT i = 0; i < ArgsReadbackLatency; i++)
+    {
+        ReleaseHandle(m_pOitCountReadback[i]);
+    }
+
+    // owned by the state cache
+    m_pBlendState = NullHandle;
+    m_pStateParallelogram = NullHandle;
+    m_pOitAccumBlend = NullHandle;
+    m_pOitResolveBlend = NullHandle;
+}
+
+void RenderClass::Terminate()
 {
-    std::wstring extension = Extension(path);
+#ifdef _WIN32
+    if (m_pD3DDevice && ImGui::GetCurrentContext())
+    {
+        ImGui_ImplDX11_Shutdown();
+        ImGui_ImplWin32_Shutdown();
+        ImGui::DestroyContext();
+    }
+#endif
 
-    UINT flags = 0;
-#ifdef _DEBUG
-    flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
-#endif 
+    if (!m_pDevice)
+        return;
 
-    ID3DBlob* pCode = nullptr;
-    ID3DBlob* pErr = nullptr;
+    // before the targets are released, pending loads still point at them
+    m_textureLoader.Terminate();
+    m_textureStreamer.Terminate();
+    m_frameRecorder.Terminate();
+    m_profiler.Terminate();
 
-    HRESULT result = D3DCompileFromFile(path.c_str(), nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE,
-        "main", "cs_5_0", flags, 0, &pCode, &pErr);
-    if (!SUCCEEDED(result) && pErr != nullptr)
+    TerminateBufferShader();
+    TerminateSkybox();
+    TerminateParallelogram();
+    TerminateComputeShader();
+    TerminateLightClusters();
+    TerminateShadows();
+    m_stateCache.Clear();
+    m_uploadRing.Terminate();
+
+    m_renderGraph.ReleaseTextures();
+    m_pRenderTargetView = NullHandle;
+
+    if (m_pContext)
     {
-        OutputDebugStringA((const char*)pErr->GetBufferPointer());
+        m_pContext->ClearState();
+        m_pContext = nullptr;
     }
-    if (pErr)
-        pErr->Release();
 
-    if (SUCCEEDED(result))
+    if (m_ownsDevice)
     {
-        result = m_pDevice->CreateComputeShader(pCode->GetBufferPointer(), pCode->GetBufferSize(),
-            nullptr, ppComputeShader);
+#ifdef _WIN32
+        m_pD3DDevice->Terminate();
+        m_pD3DDevice = nullptr;
+#endif
+        delete m_pDevice;
     }
+    m_pDevice = nullptr;
+}
 
-    if (pCode)
-        pCode->Release();
+void RenderClass::TerminateBufferShader()
+{
+    ReleaseHandle(m_pLayout);
+    m_deferredCS.Terminate();
+    m_gBufferPS.Terminate();
+    m_cubePS.Terminate();
+    m_cubeVS.Terminate();
+    ReleaseHandle(m_pLightVertexShader);
+    ReleaseHandle(m_pLightPixelShader);
+    ReleaseHandle(m_pIndexBuffer);
+    ReleaseHandle(m_pVertexBuffer);
+    // owned by the texture streamer
+    m_pTextureView = NullHandle;
+    m_pNormalMapView = NullHandle;
+    ReleaseHandle(m_pSamplerState);
+    ReleaseHandle(m_pModelBufferInst);
+    for (RenderHandle& upload : m_instanceUploads)
+    {
+        ReleaseHandle(upload);
+    }
+    m_instanceUploads.clear();
+    ReleaseHandle(m_pInstanceDataSRV);
+    ReleaseHandle(m_pOccludedInstances);
+    ReleaseHandle(m_pDisoccludedInst);
+    m_instanceCapacity = 0;
+    ReleaseHandle(m_pPostProcessVS);
+    ReleaseHandle(m_pPostProcessCS);
+    ReleaseHandle(m_pFullScreenVB);
+    ReleaseHandle(m_pFullScreenLayout);
+
+    m_instances.Clear();
+    m_cubeBvh.Clear();
+}
 
-    return result;
+void RenderClass::TerminateSkybox()
+{
+    ReleaseHandle(m_pSkyboxVB);
+    ReleaseHandle(m_pSkyboxSRV);
+    ReleaseHandle(m_pSkyboxLayout);
+    ReleaseHandle(m_pSkyboxVS);
+    ReleaseHandle(m_pSkyboxPS);
 }
 
 void RenderClass::MoveCamera(float dx, float dy, float dz)
@@ -1042,6 +1365,14 @@ void RenderClass::RotateCamera(float lrAngle, float udAngle)
     if (m_UDAngle < -XM_PIDIV2) m_UDAngle = -XM_PIDIV2;
 }
 
+void RenderClass::SetCamera(const XMFLOAT3& position, float lrAngle, float udAngle)
+{
+    m_CameraPosition = position;
+    m_LRAngle = 0.0f;
+    m_UDAngle = 0.0f;
+    RotateCamera(lrAngle, -udAngle);
+}
+
 void RenderClass::UpdateFrustum(const XMMATRIX& viewProjMatrix) 
 {
     XMFLOAT4X4 matrix;
@@ -1095,35 +1426,12 @@ void RenderClass::UpdateFrustum(const XMMATRIX& viewProjMatrix)
     }
 }
 
-bool RenderClass::IsAABBInFrustum(const XMFLOAT3& center, float size) const
-{
-    for (int i = 0; i < 6; i++) 
-    {
-        float d = XMVectorGetX(XMPlaneDotCoord(m_frustumPlanes[i], XMLoadFloat3(&center)));
-        float r = size * (fabs(XMVectorGetX(m_frustumPlanes[i])) +
-            fabs(XMVectorGetY(m_frustumPlanes[i])) +
-            fabs(XMVectorGetZ(m_frustumPlanes[i])));
-
-        if (d + r < 0) 
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
 void RenderClass::Render()
 {
-    ID3D11ShaderResourceView* nullSRVs[1] = { nullptr };
-    m_pDeviceContext->PSSetShaderResources(0, 1, nullSRVs);
-    m_pDeviceContext->VSSetShaderResources(0, 1, nullSRVs);
-
-    float clearColor[4] = { 0.48f, 0.57f, 0.48f, 1.0f };
-    m_pDeviceContext->ClearRenderTargetView(m_pPostProcessRTV, clearColor);
-    m_pDeviceContext->ClearRenderTargetView(m_pRenderTargetView, clearColor);
-    m_pDeviceContext->ClearDepthStencilView(m_pDepthView, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    m_profiler.BeginFrame(m_pContext);
+    UINT updateScope = m_profiler.BeginCpu("Update");
 
-    m_pDeviceContext->OMSetRenderTargets(1, &m_pPostProcessRTV, m_pDepthView);
+    m_textureLoader.Update(TexturesPerFrame);
 
     XMMATRIX rotLR = XMMatrixRotationY(m_LRAngle);
     XMMATRIX rotUD = XMMatrixRotationX(m_UDAngle);
@@ -1141,414 +1449,1397 @@ void RenderClass::Render()
     XMVECTOR focusPoint = XMVectorAdd(eyePos, XMVector3TransformNormal(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), totalRot));
     XMMATRIX view = XMMatrixLookAtLH(eyePos, focusPoint, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
 
-    RECT rc;
-    GetClientRect(FindWindow(m_szWindowClass, m_szTitle), &rc);
-    float aspect = static_cast<float>(rc.right - rc.left) / (rc.bottom - rc.top);
-    XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, aspect, 0.1f, 100.0f);
-
-    RenderSkybox(proj);
-    RenderCubes(view, proj);
-    RenderParallelogram(eyePos);
-
-    m_pDeviceContext->PSSetShaderResources(0, 1, nullSRVs);
-    m_pDeviceContext->OMSetRenderTargets(1, &m_pRenderTargetView, nullptr);
+    float aspect = static_cast<float>(m_width) / m_height;
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(CameraFovY, aspect, CameraNear, CameraFar);
 
-    if (m_useNegative)
+    // cubes changed since the last frame, the shadow casters are read from
+    // them and go into the static layers again
+    if (m_instances.GetDirtyCount() > 0)
     {
-        m_pDeviceContext->VSSetShader(m_pPostProcessVS, nullptr, 0);
-        m_pDeviceContext->PSSetShader(m_pPostProcessPS, nullptr, 0);
-        m_pDeviceContext->IASetInputLayout(m_pFullScreenLayout);
-
-        m_pDeviceContext->PSSetShaderResources(0, 1, &m_pPostProcessSRV);
-        m_pDeviceContext->PSSetSamplers(0, 1, &m_pSamplerState);
-
-        UINT stride = sizeof(FullScreenVertex);
-        UINT offset = 0;
-        m_pDeviceContext->IASetVertexBuffers(0, 1, &m_pFullScreenVB, &stride, &offset);
-        m_pDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-        m_pDeviceContext->Draw(3, 0);
-    }
-    else
-    {
-        ID3D11Resource* srcResource = nullptr;
-        m_pPostProcessSRV->GetResource(&srcResource);
-
-        ID3D11Resource* dstResource = nullptr;
-        m_pRenderTargetView->GetResource(&dstResource);
-
-        if (srcResource && dstResource)
-        {
-            m_pDeviceContext->CopyResource(dstResource, srcResource);
-        }
-
-        if (srcResource) srcResource->Release();
-        if (dstResource) dstResource->Release();
+        m_staticCasterVersion++;
+        UploadInstances();
     }
 
-    RenderImGui();
-    m_pSwapChain->Present(1, 0);
-    m_pDeviceContext->OMSetRenderTargets(0, nullptr, nullptr);
-    m_pDeviceContext->PSSetShaderResources(0, 1, nullSRVs);
-}
+    // All constants of the frame go into the upload ring first, then one
+    // map copies them to the GPU before anything is drawn
+    m_frameArena.Reset();
+    m_uploadRing.BeginFrame();
+    UpdateSkyboxConstants(proj);
+    UpdateCubeConstants(view, proj);
+    UpdateLights(view, proj);
+    UpdateShadows();
+    if (m_useDeferredShading)
+        UpdateDeferredConstants(view, proj);
+    UpdateTranslucentQuads(eyePos);
+    UpdatePostProcessConstants();
+    m_uploadRing.Commit(m_pContext);
+    UploadTranslucentQuads();
 
-void RenderClass::RenderSkybox(XMMATRIX proj)
-{
-    XMMATRIX rotLRSky = XMMatrixRotationY(-m_LRAngle);
-    XMMATRIX rotUDSky = XMMatrixRotationX(-m_UDAngle);
-    XMMATRIX viewSkybox = rotLRSky * rotUDSky;
-    XMMATRIX vpSkybox = XMMatrixTranspose(viewSkybox * proj);
+    // the cube textures stream in the mips the nearest cube shows
+    float cubeSize = GetCubeScreenSize(proj);
+    m_textureStreamer.Request(m_pTextureView, cubeSize);
+    m_textureStreamer.Request(m_pNormalMapView, cubeSize);
+    m_textureStreamer.Update(m_waitForTextures ? 0 : TextureRebuildsPerFrame, m_waitForTextures);
+    m_profiler.EndCpu(updateScope);
 
-    D3D11_MAPPED_SUBRESOURCE mapped;
-    if (SUCCEEDED(m_pDeviceContext->Map(m_pSkyboxVPBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+    HRESULT prepared;
     {
-        memcpy(mapped.pData, &vpSkybox, sizeof(XMMATRIX));
-        m_pDeviceContext->Unmap(m_pSkyboxVPBuffer, 0);
+        ProfileScope scope(m_profiler, "PreparePasses");
+        prepared = PreparePasses(view);
     }
 
-    D3D11_DEPTH_STENCIL_DESC dsDesc = {};
-    dsDesc.DepthEnable = true;
-    dsDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
-    dsDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
-    ID3D11DepthStencilState* pDSStateSkybox = nullptr;
-    m_pDevice->CreateDepthStencilState(&dsDesc, &pDSStateSkybox);
-    m_pDeviceContext->OMSetDepthStencilState(pDSStateSkybox, 0);
-
-    D3D11_RASTERIZER_DESC rsDesc = {};
-    rsDesc.FillMode = D3D11_FILL_SOLID;
-    rsDesc.CullMode = D3D11_CULL_FRONT;
-    rsDesc.FrontCounterClockwise = false;
-    ID3D11RasterizerState* pSkyboxRS = nullptr;
-    if (SUCCEEDED(m_pDevice->CreateRasterizerState(&rsDesc, &pSkyboxRS)))
+    if (SUCCEEDED(prepared))
     {
-        m_pDeviceContext->RSSetState(pSkyboxRS);
+        ProfileScope scope(m_profiler, "RecordPasses");
+        m_frameRecorder.Record(m_renderGraph.GetExecutedPassCount(), [this](UINT index, RenderContext* pContext)
+        {
+            UINT pass = m_renderGraph.GetExecutedPass(index);
+            const char* name = m_renderGraph.GetPassName(pass);
+            ProfileScope cpuScope(m_profiler, name);
+            GpuProfileScope gpuScope(m_profiler, pContext, name);
+            RecordPass(pContext, m_renderGraph.GetPassData(pass));
+            m_renderGraph.RecordUnbinds(pass, pContext);
+        });
     }
 
-    UINT stride = sizeof(SkyboxVertex);
-    UINT offset = 0;
-    m_pDeviceContext->IASetVertexBuffers(0, 1, &m_pSkyboxVB, &stride, &offset);
-    m_pDeviceContext->IASetInputLayout(m_pSkyboxLayout);
-    m_pDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-    m_pDeviceContext->VSSetShader(m_pSkyboxVS, nullptr, 0);
-    m_pDeviceContext->VSSetConstantBuffers(0, 1, &m_pSkyboxVPBuffer);
-
-    m_pDeviceContext->PSSetShader(m_pSkyboxPS, nullptr, 0);
-    m_pDeviceContext->PSSetShaderResources(0, 1, &m_pSkyboxSRV);
-    m_pDeviceContext->PSSetSamplers(0, 1, &m_pSamplerState);
-
-    m_pDeviceContext->Draw(36, 0);
+#ifdef _WIN32
+    if (m_pD3DDevice)
+    {
+        ProfileScope cpuScope(m_profiler, "ImGui");
+        GpuProfileScope gpuScope(m_profiler, m_pContext, "ImGui");
 
-    pDSStateSkybox->Release();
-    if (pSkyboxRS)
+        // executing the passes leaves the immediate context without targets
+        m_pContext->SetRenderTargets(m_pRenderTargetView, NullHandle);
+        RenderImGui();
+    }
+#endif
     {
-        pSkyboxRS->Release();
-        m_pDeviceContext->RSSetState(nullptr);
+        ProfileScope scope(m_profiler, "Present");
+        m_pDevice->Present(m_syncInterval);
+        m_pContext->SetRenderTargets(NullHandle, NullHandle);
     }
+    m_profiler.EndFrame(m_pContext);
 }
 
-std::vector<UINT> RenderClass::ReadUintBufferData(ID3D11DeviceContext* pContext, ID3D11Buffer* pBuffer, UINT count)
+UINT RenderClass::AddFramePass(FramePass pass, UINT firstVisible, UINT visibleCount)
 {
-    std::vector<UINT> result(count);
+    static const char* const PassNames[] =
+    {
+        "Lights", "Shadows", "Skybox", "Cubes", "DeferredLighting", "LightMarkers", "Parallelogram", "TransparencyResolve",
+        "PostProcess"
+    };
 
-    D3D11_BUFFER_DESC desc;
-    pBuffer->GetDesc(&desc);
+    m_framePasses.push_back({ pass, firstVisible, visibleCount, 0 });
+    return m_renderGraph.AddPass(PassNames[static_cast<int>(pass)], static_cast<UINT>(m_framePasses.size() - 1));
+}
 
-    D3D11_BUFFER_DESC stagingDesc = desc;
-    stagingDesc.Usage = D3D11_USAGE_STAGING;
-    stagingDesc.BindFlags = 0;
-    stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-    stagingDesc.MiscFlags = 0;
+HRESULT RenderClass::PreparePasses(XMMATRIX view)
+{
+    m_framePasses.clear();
+    m_renderGraph.Reset();
+    m_passData = FramePassData();
+    m_passData.view = view;
 
-    ID3D11Buffer* pStagingBuffer = nullptr;
-    if (SUCCEEDED(m_pDevice->CreateBuffer(&stagingDesc, nullptr, &pStagingBuffer)))
+    // the leanest variants for the features of this frame
+    m_passData.features = GetFeatures();
+    if (FAILED(m_cubeVS.Get(m_passData.features, &m_passData.cubeVS)) ||
+        FAILED(m_cubePS.Get(m_passData.features, &m_passData.cubePS)))
     {
-        pContext->CopyResource(pStagingBuffer, pBuffer);
+        m_passData.cubeVS = NullHandle;
+        m_passData.cubePS = NullHandle;
+    }
 
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        if (SUCCEEDED(pContext->Map(pStagingBuffer, 0, D3D11_MAP_READ, 0, &mapped)))
+    // the cubes write the G-buffer instead, forward shading is left when
+    // a variant is missing
+    if (m_useDeferredShading && m_passData.cubePS)
+    {
+        RenderHandle gBufferPS = NullHandle;
+        if (SUCCEEDED(m_gBufferPS.Get(m_passData.features, &gBufferPS)) &&
+            SUCCEEDED(m_deferredCS.Get(m_passData.features, &m_passData.deferredCS)))
         {
-            memcpy(result.data(), mapped.pData, sizeof(UINT) * count);
-            pContext->Unmap(pStagingBuffer, 0);
+            m_passData.cubePS = gBufferPS;
+            m_passData.deferred = true;
         }
-        pStagingBuffer->Release();
     }
+    if (FAILED(m_parallelogramPS.Get(m_passData.features, &m_passData.parallelogramPS)))
+        m_passData.parallelogramPS = NullHandle;
+
+    // without their resolve or their lists the fragments have nowhere to go
+    m_passData.transparency = m_transparencyMode;
+    if (m_passData.transparency != TransparencyMode::Sorted)
+    {
+        if (FAILED(m_oitResolvePS.Get(m_passData.features, &m_passData.oitResolvePS)) ||
+            (m_passData.transparency == TransparencyMode::LinkedList && FAILED(ReserveOitLists())))
+            m_passData.parallelogramPS = NullHandle;
+    }
+    if (m_passData.parallelogramPS && m_passData.transparency == TransparencyMode::LinkedList)
+    {
+        m_passData.oitReadback = m_pOitCountReadback[m_oitReadbackIndex];
+        m_oitReadbackIndex = (m_oitReadbackIndex + 1) % ArgsReadbackLatency;
+    }
+    if (GetTranslucentCount() == 0)
+        m_passData.parallelogramPS = NullHandle;
+
+    DepthStencilDesc dsDesc;
+    dsDesc.depthEnable = true;
+    dsDesc.depthWrite = false;
+    dsDesc.depthFunc = ComparisonFunc::LessEqual;
+    m_stateCache.GetDepthStencilState(dsDesc, &m_passData.skyboxDepthState);
+
+    RasterizerDesc rsDesc;
+    rsDesc.fillMode = FillMode::Solid;
+    rsDesc.cullMode = CullMode::Front;
+    rsDesc.frontCounterClockwise = false;
+    m_stateCache.GetRasterizerState(rsDesc, &m_passData.skyboxRasterizer);
+    rsDesc.cullMode = CullMode::None;
+    m_stateCache.GetRasterizerState(rsDesc, &m_passData.parallelogramRasterizer);
+
+    // Every pass declares what it reads and writes; the graph orders them,
+    // drops the ones nothing needs and hands out the transient targets
+    GraphResource backBuffer = m_renderGraph.ImportResource("BackBuffer", m_pRenderTargetView);
+    m_renderGraph.SetOutput(backBuffer);
+
+    TextureDesc depthDesc;
+    depthDesc.width = m_width;
+    depthDesc.height = m_height;
+    depthDesc.format = Format::D32_FLOAT;
+    depthDesc.bindFlags = BIND_DEPTH_STENCIL;
+
+    // the Hi-Z pyramid is built from the depth of the cubes, it outlives the
+    // frame so it is not a transient
+    const bool computeCulling = m_pComputeShader && m_useComputeCulling;
+    m_passData.buildHiZ = false;
+    if (computeCulling && m_useOcclusionCulling && m_passData.cubeVS && m_passData.cubePS && m_hiZLayout.GetLevelCount() > 0)
+    {
+        if (!m_pHiZ)
+        {
+            TextureDesc hiZDesc;
+            hiZDesc.width = m_hiZLayout.GetWidth();
+            hiZDesc.height = m_hiZLayout.GetHeight();
+            hiZDesc.format = Format::R32_FLOAT;
+            hiZDesc.bindFlags = BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+            if (FAILED(m_pDevice->CreateTexture(hiZDesc, nullptr, &m_pHiZ)))
+                m_pHiZ = NullHandle;
+        }
+        m_passData.buildHiZ = m_pHiZ != NullHandle;
+    }
+    if (m_passData.buildHiZ || m_passData.deferred)
+        depthDesc.bindFlags |= BIND_SHADER_RESOURCE;
+    GraphResource depth = m_renderGraph.CreateTexture("Depth", depthDesc);
+
+    // the lighting pass only reads the pixels the cubes covered, so the
+    // G-buffer is never cleared
+    GraphResource gBufferAlbedo = InvalidGraphResource;
+    GraphResource gBufferNormals = InvalidGraphResource;
+    if (m_passData.deferred)
+    {
+        TextureDesc gBufferDesc;
+        gBufferDesc.width = m_width;
+        gBufferDesc.height = m_height;
+        gBufferDesc.format = Format::R8G8B8A8_UNORM;
+        gBufferDesc.bindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+        gBufferAlbedo = m_renderGraph.CreateTexture("GBufferAlbedo", gBufferDesc);
+        gBufferDesc.format = Format::R16G16B16A16_UNORM;
+        gBufferNormals = m_renderGraph.CreateTexture("GBufferNormals", gBufferDesc);
+    }
+
+    // without effects the scene is drawn straight into the back buffer
+    const UINT postStages = m_pPostProcessCS ? m_postProcess.GetStageCount() : 0;
+    TextureDesc colorDesc;
+    colorDesc.width = m_width;
+    colorDesc.height = m_height;
+    colorDesc.format = Format::R8G8B8A8_UNORM;
+    colorDesc.bindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE | BIND_UNORDERED_ACCESS;
+    GraphResource sceneColor = backBuffer;
+    if (postStages > 0)
+        sceneColor = m_renderGraph.CreateTexture("SceneColor", colorDesc);
+
+    GraphResource lightData = InvalidGraphResource;
+    GraphResource clusterRanges = InvalidGraphResource;
+    GraphResource clusterIndices = InvalidGraphResource;
+    UINT lightsPass = 0;
+    if (m_useClusteredLighting)
+    {
+        const UINT clusterCount = m_lightClusters.GetClusterCount();
+        if (!m_clusterBoundsChanged || SUCCEEDED(ReserveClusters(clusterCount)))
+        {
+            m_passData.uploadClusterBounds = m_clusterBoundsChanged;
+            if (!m_pClusterShader || !m_useComputeClusters)
+            {
+                m_passData.viewLights = m_frameArena.Allocate<XMFLOAT4>(m_activeLights);
+                m_passData.clusterRanges = m_frameArena.Allocate<UINT>(clusterCount * 2);
+                m_passData.clusterIndices = m_frameArena.Allocate<UINT>(clusterCount * LightClusters::MaxLightsPerCluster);
+            }
+            else
+            {
+                // the dropped lights of a few frames back, like the culling arguments below
+                m_passData.clusterOverflowReadback = m_pClusterOverflowReadback[m_clusterOverflowReadbackIndex];
+                UINT droppedLights = 0;
+                if (m_pContext->TryReadBuffer(m_passData.clusterOverflowReadback, &droppedLights, sizeof(droppedLights)) == S_OK)
+                    m_clusterDroppedLights = droppedLights;
+                m_clusterOverflowReadbackIndex = (m_clusterOverflowReadbackIndex + 1) % ArgsReadbackLatency;
+            }
 
-    return result;
-}
-
-void RenderClass::RenderCubes(XMMATRIX view, XMMATRIX proj)
-{
-    m_pDeviceContext->OMSetRenderTargets(1, &m_pPostProcessRTV, m_pDepthView);
-    m_pDeviceContext->OMSetDepthStencilState(nullptr, 0);
-
-    CameraBuffer cameraBuffer;
-    cameraBuffer.vp = XMMatrixTranspose(view * proj);
-    cameraBuffer.cameraPos = m_CameraPosition;
+            GraphResource clusterBounds = m_renderGraph.ImportResource("ClusterBounds", m_pClusterBounds);
+            lightData = m_renderGraph.ImportResource("LightData", m_pLightData);
+            clusterRanges = m_renderGraph.ImportResource("ClusterRanges", m_pClusterRanges);
+            clusterIndices = m_renderGraph.ImportResource("ClusterIndices", m_pClusterIndices);
 
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    HRESULT hr = m_pDeviceContext->Map(m_pVPBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (SUCCEEDED(hr))
+            lightsPass = AddFramePass(FramePass::Lights, 0, 0);
+            if (m_passData.uploadClusterBounds)
+                m_renderGraph.Write(lightsPass, clusterBounds);
+            if (!m_passData.clusterRanges)
+            {
+                m_renderGraph.Read(lightsPass, clusterBounds, ShaderStage::Compute, 0);
+                m_renderGraph.Read(lightsPass, lightData, ShaderStage::Compute, 2);
+            }
+            m_renderGraph.Write(lightsPass, lightData);
+            m_renderGraph.Write(lightsPass, clusterRanges);
+            m_renderGraph.Write(lightsPass, clusterIndices);
+        }
+    }
+    else
     {
-        memcpy(mappedResource.pData, &cameraBuffer, sizeof(CameraBuffer));
-        m_pDeviceContext->Unmap(m_pVPBuffer, 0);
+        m_clusterDroppedLights = 0;
     }
 
-    UINT stride = sizeof(CubeVertex);
-    UINT offset = 0;
-    m_pDeviceContext->IASetVertexBuffers(0, 1, &m_pVertexBuffer, &stride, &offset);
-    m_pDeviceContext->IASetIndexBuffer(m_pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
-    m_pDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    m_pDeviceContext->IASetInputLayout(m_pLayout);
-
-    m_pDeviceContext->VSSetShader(m_pVertexShader, nullptr, 0);
-    m_pDeviceContext->PSSetShader(m_pPixelShader, nullptr, 0);
-
-    m_pDeviceContext->VSSetConstantBuffers(1, 1, &m_pVPBuffer);
+    // the slots BindLights uses, the G-buffer is lit later
+    auto readLights = [&](UINT pass)
+    {
+        if (!(m_passData.features & FeatureClustered) || lightData == InvalidGraphResource || m_passData.deferred)
+            return;
+        m_renderGraph.Read(pass, lightData, ShaderStage::Pixel, 2);
+        m_renderGraph.Read(pass, clusterRanges, ShaderStage::Pixel, 3);
+        m_renderGraph.Read(pass, clusterIndices, ShaderStage::Pixel, 4);
+    };
 
-    m_pDeviceContext->PSSetShaderResources(0, 1, &m_pTextureView);
-    m_pDeviceContext->PSSetShaderResources(1, 1, &m_pNormalMapView);
-    m_pDeviceContext->PSSetSamplers(0, 1, &m_pSamplerState);
+    // The slots due this frame are drawn before the cubes read the atlases.
+    // Every update draws the cubes within the light's range.
+    GraphResource staticShadows = InvalidGraphResource;
+    GraphResource dynamicShadows = InvalidGraphResource;
+    if (m_passData.features & FeatureShadows)
+    {
+        staticShadows = m_renderGraph.ImportResource("StaticShadows", m_pStaticShadowAtlas);
+        dynamicShadows = m_renderGraph.ImportResource("DynamicShadows", m_pDynamicShadowAtlas);
 
-    UpdateFrustum(view * proj);
+        // the casters were culled and uploaded with the constants
+        const std::vector<ShadowUpdate>& updates = m_shadowAtlas.GetUpdates();
+        if (!updates.empty() && SUCCEEDED(m_cubeVS.Get(FeatureConstantInstances, &m_passData.shadowVS)))
+        {
+            DepthStencilDesc clearDesc;
+            clearDesc.depthEnable = true;
+            clearDesc.depthWrite = true;
+            clearDesc.depthFunc = ComparisonFunc::Always;
+            m_stateCache.GetDepthStencilState(clearDesc, &m_passData.shadowClearState);
+
+            UINT shadowsPass = AddFramePass(FramePass::Shadows, 0, 0);
+            m_renderGraph.Write(shadowsPass, staticShadows);
+            m_renderGraph.Write(shadowsPass, dynamicShadows);
+        }
+    }
 
-    m_CubeAngle += 0.01f;
-    if (m_CubeAngle > XM_2PI) m_CubeAngle -= XM_2PI;
+    // the slots RenderCubes binds the atlases to
+    auto readShadows = [&](UINT pass)
+    {
+        if (staticShadows == InvalidGraphResource || m_passData.deferred)
+            return;
+        m_renderGraph.Read(pass, staticShadows, ShaderStage::Pixel, 5);
+        m_renderGraph.Read(pass, dynamicShadows, ShaderStage::Pixel, 6);
+    };
 
-    if (m_pComputeShader)
+    // what the cubes draw into
+    auto writeCubes = [&](UINT pass)
     {
-        // GPU frustum culling
-        //OutputDebugString(L"Frustum Culling in GPU\n");
-        for (int i = 0; i < m_modelInstances.size(); i++) 
+        if (m_passData.deferred)
         {
-            XMFLOAT3 position;
-            XMStoreFloat3(&position, m_modelInstances[i].model.r[3]);
-
-            m_modelInstances[i].model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) *
-                XMMatrixRotationY(m_CubeAngle) *
-                XMMatrixTranslation(position.x, position.y, position.z);
+            m_renderGraph.Write(pass, gBufferAlbedo);
+            m_renderGraph.Write(pass, gBufferNormals);
         }
-
-        D3D11_MAPPED_SUBRESOURCE mapped;
-        if (SUCCEEDED(m_pDeviceContext->Map(m_pFrustumPlanesBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+        else
         {
-            memcpy(mapped.pData, m_frustumPlanes, sizeof(XMVECTOR) * 6);
-            m_pDeviceContext->Unmap(m_pFrustumPlanesBuffer, 0);
+            m_renderGraph.Write(pass, sceneColor);
         }
+        m_renderGraph.Write(pass, depth);
+    };
 
-        UINT initialArgs[5] = { 36, 0, 0, 0, 0 }; 
-        m_pDeviceContext->UpdateSubresource(m_pIndirectArgsBuffer, 0, nullptr, initialArgs, 0, 0);
-
-        m_pDeviceContext->CSSetShader(m_pComputeShader, nullptr, 0);
-        m_pDeviceContext->CSSetConstantBuffers(0, 1, &m_pFrustumPlanesBuffer);
-        m_pDeviceContext->CSSetUnorderedAccessViews(0, 1, &m_pIndirectArgsUAV, nullptr);
-        m_pDeviceContext->CSSetUnorderedAccessViews(1, 1, &m_pObjectsIdsUAV, nullptr);
-        m_pDeviceContext->CSSetShaderResources(0, 1, &m_pInstanceDataSRV);
-
-        m_pDeviceContext->Dispatch((MaxInst + 63) / 64, 1, 1);
+    // clears the targets, so it writes them first
+    UINT skyboxPass = AddFramePass(FramePass::Skybox, 0, 0);
+    m_renderGraph.Write(skyboxPass, sceneColor);
+    m_renderGraph.Write(skyboxPass, depth);
 
-        auto args = ReadUintBufferData(m_pDeviceContext, m_pIndirectArgsBuffer, 2);
-        m_visibleCubes = args[1];
+    const UINT instanceCount = GetInstanceCount();
+    if (computeCulling)
+    {
+        // The slot about to be reused was filled ArgsReadbackLatency frames
+        // ago; if the GPU is still behind the UI just shows the older count.
+        // Only the immediate context reads back, so it happens here.
+        m_passData.argsReadback = m_pArgsReadback[m_argsReadbackIndex];
+        UINT args[10] = {};
+        if (m_pContext->TryReadBuffer(m_passData.argsReadback, args, sizeof(args)) == S_OK)
+            m_visibleCubes = args[1] + args[6];
+        m_argsReadbackIndex = (m_argsReadbackIndex + 1) % ArgsReadbackLatency;
 
-        if (m_visibleCubes > 0)
+        if (m_passData.cubeVS && m_passData.cubePS)
         {
-            auto visibleIds = ReadUintBufferData(m_pDeviceContext, m_pObjectsIdsBuffer, m_visibleCubes);
-
-            std::vector<InstanceData> visibleInstances(m_visibleCubes);
-            for (UINT i = 0; i < m_visibleCubes; i++)
-            {
-                UINT id = visibleIds[i];
-                visibleInstances[i].model = XMMatrixTranspose(m_modelInstances[id].model);
-                visibleInstances[i].texInd = m_modelInstances[id].texInd;
-            }
-
-            m_pDeviceContext->UpdateSubresource(
-                m_pModelBufferInst,
-                0,
-                nullptr,
-                visibleInstances.data(),
-                0,
-                sizeof(InstanceData) * m_visibleCubes
-            );
+            UINT cubesPass = AddFramePass(FramePass::Cubes, 0, 0);
+            writeCubes(cubesPass);
+            readLights(cubesPass);
+            readShadows(cubesPass);
         }
-
-        m_pDeviceContext->VSSetConstantBuffers(0, 1, &m_pModelBufferInst);
-        m_pDeviceContext->DrawIndexedInstancedIndirect(m_pIndirectArgsBuffer, 0);
-
-        ID3D11UnorderedAccessView* nullUAVs[2] = { nullptr, nullptr };
-        m_pDeviceContext->CSSetUnorderedAccessViews(0, 2, nullUAVs, nullptr);
-        ID3D11ShaderResourceView* nullSRVs[1] = { nullptr };
-        m_pDeviceContext->CSSetShaderResources(0, 1, nullSRVs);
-        m_pDeviceContext->CSSetShader(nullptr, nullptr, 0);
     }
     else
     {
-        // CPU frustum culling
-        std::vector<InstanceData> visibleInstances;
-        visibleInstances.reserve(m_modelInstances.size());
-        m_visibleCubes = 0;
-
-        for (int i = 0; i < m_modelInstances.size(); i++) {
-            XMFLOAT3 position;
-            XMStoreFloat3(&position, m_modelInstances[i].model.r[3]);
-
-            m_modelInstances[i].model = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) *
-                XMMatrixRotationY(m_CubeAngle) *
-                XMMatrixTranslation(position.x, position.y, position.z);
+        // CPU frustum culling, the visible cubes are split between passes
+        XMFLOAT4 planes[6];
+        for (int i = 0; i < 6; i++)
+        {
+            XMStoreFloat4(&planes[i], m_frustumPlanes[i]);
+        }
 
-            float size = m_fixedScale * 0.95f;
-            if (IsAABBInFrustum(position, size))
-            {
-                InstanceData data;
-                data.model = XMMatrixTranspose(m_modelInstances[i].model);
-                data.texInd = m_modelInstances[i].texInd;
-                visibleInstances.push_back(data);
-                m_visibleCubes++;
-            }
+        UINT* visibleIndices = m_frameArena.Allocate<UINT>(instanceCount);
+        UINT visibleCount;
+        if (m_useBvhCulling)
+        {
+            ProfileScope scope(m_profiler, "CullBvh");
+            visibleCount = m_cubeBvh.Cull(planes, m_instances.GetBounds(), visibleIndices);
+        }
+        else
+        {
+            ProfileScope scope(m_profiler, "CullBounds");
+            visibleCount = CullBounds(planes, m_instances.GetBounds(), visibleIndices);
         }
+        if (m_useOcclusionCulling)
+        {
+            // the nearest cubes drawn into a small depth buffer hide the rest
+            ProfileScope scope(m_profiler, "SoftwareOcclusion");
+            m_softwareOcclusion.SetResolution(SoftwareOcclusion::DefaultWidth,
+                std::max(1u, SoftwareOcclusion::DefaultWidth * m_height / m_width));
+            XMMATRIX shape = XMMatrixScaling(m_fixedScale, m_fixedScale, m_fixedScale) * XMMatrixRotationY(m_CubeAngle);
+            const float spinExtent = m_fixedScale * sqrtf(2.0f);
+            visibleCount = m_softwareOcclusion.Cull(m_viewProj, m_CameraPosition, shape, XMFLOAT3(spinExtent, m_fixedScale, spinExtent),
+                m_instances.GetBounds(), visibleIndices, visibleCount, visibleIndices);
+        }
+        if (m_sortOpaqueDraws)
+        {
+            ProfileScope scope(m_profiler, "SortCubes");
+            SortVisibleCubes(visibleIndices, visibleCount);
+        }
+        m_visibleCubes = static_cast<int>(visibleCount);
+        m_passData.visibleIndices = visibleIndices;
 
-        if (!visibleInstances.empty())
+        for (UINT first = 0; first < visibleCount && m_passData.cubeVS && m_passData.cubePS; first += CubesPerPass)
         {
-            m_pDeviceContext->UpdateSubresource(
-                m_pModelBufferInst,
-                0,
-                nullptr,
-                visibleInstances.data(),
-                0,
-                sizeof(InstanceData) * m_visibleCubes
-            );
-
-            m_pDeviceContext->VSSetConstantBuffers(0, 1, &m_pModelBufferInst);
-            m_pDeviceContext->DrawIndexedInstanced(36, visibleInstances.size(), 0, 0, 0);
+            UINT cubesPass = AddFramePass(FramePass::Cubes, first, std::min(visibleCount - first, CubesPerPass));
+            writeCubes(cubesPass);
+            readLights(cubesPass);
+            readShadows(cubesPass);
         }
     }
 
+    if (m_passData.deferred)
+    {
+        // over the sky the skybox drew; it writes the depth too, which keeps
+        // it in the chain before the markers draw into it again
+        UINT deferredPass = AddFramePass(FramePass::DeferredLighting, 0, 0);
+        m_renderGraph.Read(deferredPass, gBufferAlbedo, ShaderStage::Compute, 0);
+        m_renderGraph.Read(deferredPass, gBufferNormals, ShaderStage::Compute, 1);
+        m_renderGraph.Read(deferredPass, depth, ShaderStage::Compute, 3);
+        m_renderGraph.Write(deferredPass, depth);
+        m_renderGraph.Write(deferredPass, sceneColor);
 
-    static float orbitLight = 0.0f;
-    orbitLight += 0.01f;
-    if (orbitLight > XM_2PI) orbitLight -= XM_2PI;
-    PointLight lights[3];
-    float radius = 2.0f;
-    lights[0].Position = XMFLOAT3(0.0f, radius * cosf(orbitLight), radius * sinf(-orbitLight));
-    lights[0].Range = 3.0f;
-    lights[0].Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
-    lights[0].Intensity = 1.0f;
-
-    lights[1].Position = XMFLOAT3(radius * cosf(orbitLight), 0.0f, radius * sinf(orbitLight));
-    lights[1].Range = 3.0f;
-    lights[1].Color = XMFLOAT3(1.0f, 1.0f, 0.13f);
-    lights[1].Intensity = 1.0f;
+        // without clustering no light pass fills the buffer, this one does
+        if (lightData == InvalidGraphResource)
+        {
+            lightData = m_renderGraph.ImportResource("LightData", m_pLightData);
+            m_renderGraph.Write(deferredPass, lightData);
+            m_passData.uploadLights = true;
+        }
+        m_renderGraph.Read(deferredPass, lightData, ShaderStage::Compute, 2);
+        if (staticShadows != InvalidGraphResource)
+        {
+            m_renderGraph.Read(deferredPass, staticShadows, ShaderStage::Compute, 5);
+            m_renderGraph.Read(deferredPass, dynamicShadows, ShaderStage::Compute, 6);
+        }
+    }
 
-    radius = 8.0f;
-    lights[2].Position = XMFLOAT3(radius * cosf(orbitLight), 0.0f, radius * sinf(-orbitLight));
-    lights[2].Range = 5.0f;
-    lights[2].Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
-    lights[2].Intensity = 1.0f;
+    UINT markersPass = AddFramePass(FramePass::LightMarkers, 0, 0);
+    m_renderGraph.Write(markersPass, sceneColor);
+    m_renderGraph.Write(markersPass, depth);
 
-    D3D11_MAPPED_SUBRESOURCE mappedResourceLight;
-    hr = m_pDeviceContext->Map(m_pLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResourceLight);
-    if (SUCCEEDED(hr))
+    GraphResource oitAccum = InvalidGraphResource;
+    GraphResource oitWeight = InvalidGraphResource;
+    if (m_passData.parallelogramPS)
     {
-        memcpy(mappedResourceLight.pData, lights, sizeof(PointLight) * 3);
-        m_pDeviceContext->Unmap(m_pLightBuffer, 0);
+        // transparent, tests against the depth of everything else
+        UINT parallelogramPass = AddFramePass(FramePass::Parallelogram, 0, 0);
+        m_renderGraph.Read(parallelogramPass, depth);
+        readLights(parallelogramPass);
+
+        if (m_passData.transparency == TransparencyMode::Sorted)
+        {
+            m_renderGraph.Write(parallelogramPass, sceneColor);
+        }
+        else
+        {
+            // the fragments go to targets or lists of their own and the
+            // resolve composites them over the scene
+            UINT resolvePass = AddFramePass(FramePass::TransparencyResolve, 0, 0);
+            m_renderGraph.Write(resolvePass, sceneColor);
+            if (m_passData.transparency == TransparencyMode::WeightedBlended)
+            {
+                TextureDesc accumDesc;
+                accumDesc.width = m_width;
+                accumDesc.height = m_height;
+                accumDesc.format = Format::R32G32B32A32_FLOAT;
+                accumDesc.bindFlags = BIND_RENDER_TARGET | BIND_SHADER_RESOURCE;
+                oitAccum = m_renderGraph.CreateTexture("OitAccum", accumDesc);
+                accumDesc.format = Format::R32_FLOAT;
+                oitWeight = m_renderGraph.CreateTexture("OitWeight", accumDesc);
+
+                m_renderGraph.Write(parallelogramPass, oitAccum);
+                m_renderGraph.Write(parallelogramPass, oitWeight);
+                m_renderGraph.Read(resolvePass, oitAccum, ShaderStage::Pixel, 0);
+                m_renderGraph.Read(resolvePass, oitWeight, ShaderStage::Pixel, 1);
+            }
+            else
+            {
+                GraphResource oitHeads = m_renderGraph.ImportResource("OitHeads", m_pOitHeads);
+                GraphResource oitNodes = m_renderGraph.ImportResource("OitNodes", m_pOitNodes);
+                m_renderGraph.Write(parallelogramPass, oitHeads);
+                m_renderGraph.Write(parallelogramPass, oitNodes);
+                m_renderGraph.Read(resolvePass, oitHeads, ShaderStage::Pixel, 0);
+                m_renderGraph.Read(resolvePass, oitNodes, ShaderStage::Pixel, 1);
+            }
+        }
     }
-    m_pDeviceContext->PSSetConstantBuffers(2, 1, &m_pLightBuffer);
 
-    m_pDeviceContext->PSSetShader(m_pLightPixelShader, nullptr, 0);
-    for (int i = 0; i < 3; i++)
+    // Every stage reads what the one before it wrote and the last one writes
+    // the back buffer. The ones in between share the description of the
+    // scene color, so the graph ping-pongs them over two textures.
+    GraphResource postSources[PostMaxEffects];
+    GraphResource postTargets[PostMaxEffects];
+    for (UINT stage = 0; stage < postStages; stage++)
     {
-        XMMATRIX lightModel = XMMatrixScaling(0.1f, 0.1f, 0.1f) * XMMatrixTranslation(lights[i].Position.x, lights[i].Position.y, lights[i].Position.z);
-        XMMATRIX lightModelT = XMMatrixTranspose(lightModel);
+        postSources[stage] = stage == 0 ? sceneColor : postTargets[stage - 1];
+        postTargets[stage] = stage + 1 == postStages ? backBuffer : m_renderGraph.CreateTexture("PostProcess", colorDesc);
 
-        XMFLOAT4X4 lightModelTStored;
-        XMStoreFloat4x4(&lightModelTStored, lightModelT);
+        UINT postProcessPass = AddFramePass(FramePass::PostProcess, 0, 0);
+        m_framePasses.back().postStage = stage;
+        m_renderGraph.Read(postProcessPass, postSources[stage], ShaderStage::Compute, 0);
+        m_renderGraph.Write(postProcessPass, postTargets[stage]);
+    }
 
-        m_pDeviceContext->UpdateSubresource(m_pModelBufferInst, 0, nullptr, &lightModelTStored, 0, 0);
-        m_pDeviceContext->VSSetConstantBuffers(0, 1, &m_pModelBufferInst);
+    HRESULT result = m_renderGraph.Compile();
+    if (SUCCEEDED(result))
+        result = m_renderGraph.Allocate(m_pDevice);
+    if (FAILED(result))
+        return result;
 
-        XMFLOAT4 lightColor = XMFLOAT4(lights[i].Color.x, lights[i].Color.y, lights[i].Color.z, 1.0f);
-        m_pDeviceContext->UpdateSubresource(m_pColorBuffer, 0, nullptr, &lightColor, 0, 0);
+    // the bounds are uploaded once a light pass runs
+    if (m_passData.uploadClusterBounds && !m_renderGraph.IsPassCulled(lightsPass))
+        m_clusterBoundsChanged = false;
 
-        m_pDeviceContext->DrawIndexed(36, 0, 0);
+    m_passData.sceneColor = m_renderGraph.GetHandle(sceneColor);
+    for (UINT stage = 0; stage < postStages; stage++)
+    {
+        m_passData.postSources[stage] = m_renderGraph.GetHandle(postSources[stage]);
+        m_passData.postTargets[stage] = m_renderGraph.GetHandle(postTargets[stage]);
     }
-}
-void RenderClass::RenderParallelogram(XMVECTOR eyePos)
+    m_passData.depth = m_renderGraph.GetHandle(depth);
+    if (m_passData.deferred)
+    {
+        m_passData.gBufferAlbedo = m_renderGraph.GetHandle(gBufferAlbedo);
+        m_passData.gBufferNormals = m_renderGraph.GetHandle(gBufferNormals);
+    }
+    if (oitAccum != InvalidGraphResource)
+    {
+        m_passData.oitAccum = m_renderGraph.GetHandle(oitAccum);
+        m_passData.oitWeight = m_renderGraph.GetHandle(oitWeight);
+    }
+
+    // next frame's phase 1 tests against the pyramid the cubes pass builds
+    m_hiZValid = m_passData.buildHiZ;
+    m_hiZViewProj = m_viewProj;
+    return S_OK;
+}
+
+void RenderClass::RecordPass(RenderContext* pContext, UINT pass)
+{
+    const FramePassDesc& desc = m_framePasses[pass];
+    switch (desc.pass)
+    {
+    case FramePass::Lights:
+        AssignLights(pContext);
+        break;
+    case FramePass::Shadows:
+        RenderShadows(pContext);
+        break;
+    case FramePass::Skybox:
+        RenderSkybox(pContext);
+        break;
+    case FramePass::Cubes:
+        RenderCubes(pContext, desc.firstVisible, desc.visibleCount);
+        break;
+    case FramePass::DeferredLighting:
+        RenderDeferredLighting(pContext);
+        break;
+    case FramePass::LightMarkers:
+        RenderLightMarkers(pContext);
+        break;
+    case FramePass::Parallelogram:
+        RenderParallelogram(pContext);
+        break;
+    case FramePass::TransparencyResolve:
+        RenderTransparencyResolve(pContext);
+        break;
+    case FramePass::PostProcess:
+        RenderPostProcess(pContext, desc.postStage);
+        break;
+    }
+}
+
+void RenderClass::BindLights(RenderContext* pContext)
+{
+    if (m_passData.features & FeatureClustered)
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Pixel, 3, m_frameUploads.clusters);
+        pContext->SetShaderResource(ShaderStage::Pixel, 2, m_pLightData);
+        pContext->SetShaderResource(ShaderStage::Pixel, 3, m_pClusterRanges);
+        pContext->SetShaderResource(ShaderStage::Pixel, 4, m_pClusterIndices);
+    }
+    else
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Pixel, 2, m_frameUploads.lights);
+    }
+}
+
+void RenderClass::UpdateSkyboxConstants(XMMATRIX proj)
+{
+    XMMATRIX rotLRSky = XMMatrixRotationY(-m_LRAngle);
+    XMMATRIX rotUDSky = XMMatrixRotationX(-m_UDAngle);
+    XMMATRIX viewSkybox = rotLRSky * rotUDSky;
+
+    XMMATRIX* pSkyboxVP = m_uploadRing.Allocate<XMMATRIX>(&m_frameUploads.skyboxCamera);
+    *pSkyboxVP = XMMatrixTranspose(viewSkybox * proj);
+}
+
+void RenderClass::UpdateCubeConstants(XMMATRIX view, XMMATRIX proj)
+{
+    CameraBuffer* pCamera = m_uploadRing.Allocate<CameraBuffer>(&m_frameUploads.camera);
+    pCamera->vp = XMMatrixTranspose(view * proj);
+    pCamera->cameraPos = m_CameraPosition;
+
+    UpdateFrustum(view * proj);
+
+    if (m_spinCubes)
+    {
+        m_CubeAngle += 0.01f;
+        if (m_CubeAngle > XM_2PI) m_CubeAngle -= XM_2PI;
+    }
+
+    CullingConstants* pCulling = m_uploadRing.Allocate<CullingConstants>(&m_frameUploads.culling);
+    for (int i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&pCulling->planes[i], m_frustumPlanes[i]);
+    }
+    pCulling->instanceCount = m_instances.GetCount();
+    pCulling->phase = 0;
+    pCulling->hiZLevelCount = 0;
+    pCulling->spin = XMMatrixTranspose(XMMatrixRotationY(m_CubeAngle));
+    m_viewProj = view * proj;
+
+    // a new size starts without a pyramid
+    if (m_hiZLayout.Configure(m_width, m_height))
+    {
+        ReleaseHandle(m_pHiZ);
+        m_hiZValid = false;
+    }
+    if (!m_useOcclusionCulling || !m_pComputeShader || !m_useComputeCulling)
+    {
+        m_hiZValid = false;
+        return;
+    }
+
+    // Phase 1 tests against the last frame's pyramid with the matrices it
+    // was drawn with, phase 2 against this frame's. The box holds the cube
+    // at any spin.
+    const HiZLevel* levels = m_hiZLayout.GetLevels();
+    pCulling->phase = 1;
+    pCulling->hiZLevelCount = m_hiZValid ? m_hiZLayout.GetLevelCount() : 0;
+    pCulling->hiZWidth = m_hiZLayout.GetWidth();
+    pCulling->occlusionViewProj = XMMatrixTranspose(m_hiZViewProj);
+    const float spinExtent = m_fixedScale * sqrtf(2.0f);
+    pCulling->occlusionExtent = XMFLOAT4(spinExtent, m_fixedScale, spinExtent, 0.0f);
+    pCulling->depthSize = XMFLOAT2(static_cast<float>(m_width), static_cast<float>(m_height));
+    std::copy(levels, levels + m_hiZLayout.GetLevelCount(), pCulling->hiZLevels);
+
+    CullingConstants* pDisoccluded = m_uploadRing.Allocate<CullingConstants>(&m_frameUploads.cullingDisoccluded);
+    *pDisoccluded = *pCulling;
+    pDisoccluded->phase = 2;
+    pDisoccluded->hiZLevelCount = m_hiZLayout.GetLevelCount();
+    pDisoccluded->occlusionViewProj = XMMatrixTranspose(m_viewProj);
+
+    for (UINT i = 0; i < m_hiZLayout.GetLevelCount(); i++)
+    {
+        HiZConstants* pHiZ = m_uploadRing.Allocate<HiZConstants>(&m_frameUploads.hiZLevels[i]);
+        pHiZ->source = i == 0 ? HiZLevel{ 0, 0, m_width, m_height } : levels[i - 1];
+        pHiZ->target = levels[i];
+        pHiZ->fromDepth = i == 0 ? 1 : 0;
+        pHiZ->atlasWidth = m_hiZLayout.GetWidth();
+    }
+}
+
+void RenderClass::UpdateLights(XMMATRIX view, XMMATRIX proj)
+{
+    if (m_animateLights)
+    {
+        m_LightAngle += 0.01f;
+        if (m_LightAngle > XM_2PI) m_LightAngle -= XM_2PI;
+    }
+    float orbitLight = m_LightAngle;
+
+    m_frameLights.resize(std::max(m_activeLights, LightCount));
+    PointLight* lights = m_frameLights.data();
+    float radius = 2.0f;
+    lights[0].Position = XMFLOAT3(0.0f, radius * cosf(orbitLight), radius * sinf(-orbitLight));
+    lights[0].Range = 3.0f;
+    lights[0].Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+    lights[0].Intensity = 1.0f;
+
+    lights[1].Position = XMFLOAT3(radius * cosf(orbitLight), 0.0f, radius * sinf(orbitLight));
+    lights[1].Range = 3.0f;
+    lights[1].Color = XMFLOAT3(1.0f, 1.0f, 0.13f);
+    lights[1].Intensity = 1.0f;
+
+    radius = 8.0f;
+    lights[2].Position = XMFLOAT3(radius * cosf(orbitLight), 0.0f, radius * sinf(-orbitLight));
+    lights[2].Range = 5.0f;
+    lights[2].Color = XMFLOAT3(1.0f, 1.0f, 1.0f);
+    lights[2].Intensity = 1.0f;
+
+    for (UINT i = LightCount; i < m_activeLights; i++)
+    {
+        const SceneLight& scene = m_sceneLights[i];
+        float angle = scene.orbitPhase + scene.orbitSpeed * orbitLight;
+        lights[i] = scene.light;
+        lights[i].Position = XMFLOAT3(scene.orbitRadius * cosf(angle), scene.height, scene.orbitRadius * sinf(angle));
+    }
+
+    // the variants without clustering read the first LightCount from a constant buffer
+    void* pLights = m_uploadRing.Allocate(sizeof(PointLight) * LightCount, &m_frameUploads.lights);
+    memcpy(pLights, lights, sizeof(PointLight) * LightCount);
+
+    for (UINT i = 0; i < LightCount; i++)
+    {
+        const PointLight& light = lights[i];
+        LightObjectBuffer* pObject = m_uploadRing.Allocate<LightObjectBuffer>(&m_frameUploads.lightObjects[i]);
+        pObject->color = XMFLOAT4(light.Color.x, light.Color.y, light.Color.z, 1.0f);
+        pObject->model = XMMatrixTranspose(XMMatrixScaling(LightMarkerScale, LightMarkerScale, LightMarkerScale) *
+            XMMatrixTranslation(light.Position.x, light.Position.y, light.Position.z));
+    }
+
+    if (m_lightClusters.Configure(m_width, m_height, proj))
+        m_clusterBoundsChanged = true;
+
+    ClusterConstants* pClusters = m_uploadRing.Allocate<ClusterConstants>(&m_frameUploads.clusters);
+    m_lightClusters.GetConstants(view, view * proj, m_activeLights, *pClusters);
+}
+
+// What DeferredLighting.cs needs to rebuild the positions and cull the
+// lights per tile. The same lights as the forward variants of the frame.
+void RenderClass::UpdateDeferredConstants(XMMATRIX view, XMMATRIX proj)
+{
+    XMFLOAT4X4 projValues;
+    XMStoreFloat4x4(&projValues, proj);
+
+    DeferredConstants* pConstants = m_uploadRing.Allocate<DeferredConstants>(&m_frameUploads.deferred);
+    pConstants->invViewProj = XMMatrixTranspose(XMMatrixInverse(nullptr, view * proj));
+    pConstants->view = XMMatrixTranspose(view);
+    pConstants->cameraPos = m_CameraPosition;
+    pConstants->lightCount = m_useClusteredLighting ? m_activeLights : std::min(m_activeLights, LightCount);
+    pConstants->width = m_width;
+    pConstants->height = m_height;
+    pConstants->projScale = XMFLOAT2(projValues._11, projValues._22);
+    pConstants->depthParams = XMFLOAT2(projValues._33, projValues._43);
+    pConstants->padding = XMFLOAT2(0.0f, 0.0f);
+}
+
+// Picks the lights to shadow and the slots to draw this frame, and uploads
+// the face cameras of those and the slots the pixel shaders read
+void RenderClass::UpdateShadows()
+{
+    m_shadowCasterDraws = 0;
+    if (!m_useShadows || FAILED(ReserveShadowAtlas()))
+        return;
+
+    // without clustering only the first LightCount are shaded
+    const UINT lightCount = m_useClusteredLighting ? m_activeLights : std::min(m_activeLights, LightCount);
+    ShadowLight* lights = m_frameArena.Allocate<ShadowLight>(std::max(lightCount, 1u));
+    for (UINT i = 0; i < lightCount; i++)
+    {
+        lights[i].position = m_frameLights[i].Position;
+        lights[i].range = m_frameLights[i].Range;
+    }
+
+    XMFLOAT4 planes[6];
+    for (int i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&planes[i], m_frustumPlanes[i]);
+    }
+    m_shadowAtlas.Schedule(lights, lightCount, planes, m_CameraPosition, m_maxShadowedLights, m_shadowUpdatesPerFrame,
+        m_staticCasterVersion, m_spinCubes);
+
+    const std::vector<ShadowUpdate>& updates = m_shadowAtlas.GetUpdates();
+    for (UINT i = 0; i < updates.size(); i++)
+    {
+        for (UINT face = 0; face < ShadowAtlas::FaceCount; face++)
+        {
+            CameraBuffer* pCamera = m_uploadRing.Allocate<CameraBuffer>(&m_frameUploads.shadowFaces[i][face]);
+            pCamera->vp = m_shadowAtlas.GetFaceViewProj(updates[i].slot, face);
+            pCamera->cameraPos = m_shadowAtlas.GetSlotPosition(updates[i].slot);
+        }
+    }
+
+    ShadowConstants* pShadows = m_uploadRing.Allocate<ShadowConstants>(&m_frameUploads.shadows);
+    m_shadowAtlas.GetConstants(*pShadows);
+
+    // Every update draws the cubes within the light's range, the static
+    // layer also the markers of the other lights. The casters go into the
+    // ring with the rest, so drawing them maps nothing.
+    ProfileScope scope(m_profiler, "CullShadowCasters");
+    UINT* casters = m_frameArena.Allocate<UINT>(std::max(GetInstanceCount(), 1u));
+    UINT* markers = m_frameArena.Allocate<UINT>(LightCount);
+    for (UINT i = 0; i < updates.size(); i++)
+    {
+        // the cubes only when they are in a layer that is drawn
+        UINT casterCount = 0;
+        if (m_spinCubes || updates[i].drawStatic)
+        {
+            // the box around the light's sphere, wider by the spin the bounds leave out
+            XMFLOAT3 p = m_shadowAtlas.GetSlotPosition(updates[i].slot);
+            float r = m_shadowAtlas.GetSlotRange(updates[i].slot) + m_fixedScale;
+            XMFLOAT4 box[6] =
+            {
+                XMFLOAT4(1.0f, 0.0f, 0.0f, r - p.x), XMFLOAT4(-1.0f, 0.0f, 0.0f, r + p.x),
+                XMFLOAT4(0.0f, 1.0f, 0.0f, r - p.y), XMFLOAT4(0.0f, -1.0f, 0.0f, r + p.y),
+                XMFLOAT4(0.0f, 0.0f, 1.0f, r - p.z), XMFLOAT4(0.0f, 0.0f, -1.0f, r + p.z),
+            };
+            casterCount = m_useBvhCulling ? m_cubeBvh.Cull(box, m_instances.GetBounds(), casters) :
+                CullBounds(box, m_instances.GetBounds(), casters);
+        }
+
+        UINT markerCount = 0;
+        for (UINT light = 0; light < std::min(m_activeLights, LightCount); light++)
+        {
+            if (light != updates[i].light)
+                markers[markerCount++] = light;
+        }
+
+        if (updates[i].drawStatic)
+            UploadShadowLayer(i, true, casters, m_spinCubes ? 0 : casterCount, markers, markerCount);
+        UploadShadowLayer(i, false, casters, m_spinCubes ? casterCount : 0, nullptr, 0);
+    }
+}
+
+// The casters of one layer as InstanceData, the cubes first, then the markers
+void RenderClass::UploadShadowLayer(UINT update, bool staticLayer, const UINT* cubes, UINT cubeCount,
+    const UINT* markers, UINT markerCount)
 {
-    D3D11_RASTERIZER_DESC rsDesc = {};
-    rsDesc.FillMode = D3D11_FILL_SOLID;
-    rsDesc.CullMode = D3D11_CULL_NONE;
-    rsDesc.FrontCounterClockwise = false;
+    const UINT layer = staticLayer ? 0 : 1;
+    const UINT casterCount = cubeCount + markerCount;
+    const UINT pieces = (casterCount + ShadowCastersPerDraw - 1) / ShadowCastersPerDraw;
+    UploadAllocation* allocations = m_frameArena.Allocate<UploadAllocation>(std::max(pieces, 1u));
+    for (UINT piece = 0; piece < pieces; piece++)
+    {
+        const UINT first = piece * ShadowCastersPerDraw;
+        const UINT count = std::min(casterCount - first, ShadowCastersPerDraw);
+        InstanceData* pInstances = static_cast<InstanceData*>(m_uploadRing.Allocate(sizeof(InstanceData) * count, &allocations[piece]));
+
+        UINT cubesInPiece = first < cubeCount ? std::min(cubeCount - first, count) : 0;
+        WriteVisibleInstances(cubes + first, cubesInPiece, pInstances);
+        for (UINT i = cubesInPiece; i < count; i++)
+        {
+            const PointLight& light = m_frameLights[markers[first + i - cubeCount]];
+            pInstances[i].model = XMMatrixTranspose(XMMatrixScaling(LightMarkerScale, LightMarkerScale, LightMarkerScale) *
+                XMMatrixTranslation(light.Position.x, light.Position.y, light.Position.z));
+            pInstances[i].texInd = 0;
+            pInstances[i].extent = XMFLOAT3(LightMarkerScale, LightMarkerScale, LightMarkerScale);
+        }
+    }
+    m_frameUploads.shadowCasters[update][layer] = allocations;
+    m_frameUploads.shadowCasterCounts[update][layer] = casterCount;
+}
 
-    ID3D11RasterizerState* pRSState = nullptr;
-    m_pDevice->CreateRasterizerState(&rsDesc, &pRSState);
-    m_pDeviceContext->RSSetState(pRSState);
+// Builds the light list of every cluster, with LightClusters.cs or on the
+// CPU. Both write the lists into the same buffers the pixel shaders read.
+void RenderClass::AssignLights(RenderContext* pContext)
+{
+    const UINT clusterCount = m_lightClusters.GetClusterCount();
+    if (m_passData.uploadClusterBounds)
+        pContext->UpdateBuffer(m_pClusterBounds, m_lightClusters.GetBounds(), sizeof(XMFLOAT4) * 2 * clusterCount);
 
-    m_pDeviceContext->OMSetDepthStencilState(m_pStateParallelogram, 0);
-    m_pDeviceContext->OMSetBlendState(m_pBlendState, nullptr, 0xFFFFFFFF);
+    if (m_activeLights > 0)
+        pContext->UpdateBuffer(m_pLightData, m_frameLights.data(), sizeof(PointLight) * m_activeLights);
 
+    if (!m_passData.clusterRanges)
+    {
+        const UINT zero = 0;
+        pContext->UpdateBuffer(m_pClusterOverflow, &zero, sizeof(zero));
+        pContext->SetShader(ShaderStage::Compute, m_pClusterShader);
+        m_uploadRing.Bind(pContext, ShaderStage::Compute, 3, m_frameUploads.clusters);
+        pContext->SetShaderResource(ShaderStage::Compute, 0, m_pClusterBounds);
+        pContext->SetShaderResource(ShaderStage::Compute, 2, m_pLightData);
+        pContext->SetUnorderedAccess(0, m_pClusterRanges);
+        pContext->SetUnorderedAccess(1, m_pClusterIndices);
+        pContext->SetUnorderedAccess(2, m_pClusterOverflow);
 
-    UINT stride = sizeof(ParallelogramVertex);
-    UINT offset = 0;
-    m_pDeviceContext->IASetVertexBuffers(0, 1, &m_ParallelogramVertexBuffer, &stride, &offset);
-    m_pDeviceContext->IASetIndexBuffer(m_pParallelogramIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
-    m_pDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    m_pDeviceContext->IASetInputLayout(m_pParallelogramLayout);
+        pContext->Dispatch((clusterCount + 63) / 64, 1, 1);
 
-    m_pDeviceContext->VSSetShader(m_pParallelogramVS, nullptr, 0);
-    m_pDeviceContext->VSSetConstantBuffers(0, 1, &m_pModelBuffer);
-    m_pDeviceContext->VSSetConstantBuffers(1, 1, &m_pVPBuffer);
+        pContext->SetUnorderedAccess(0, NullHandle);
+        pContext->SetUnorderedAccess(1, NullHandle);
+        pContext->SetUnorderedAccess(2, NullHandle);
+        pContext->SetShader(ShaderStage::Compute, NullHandle);
+        pContext->CopyResource(m_passData.clusterOverflowReadback, m_pClusterOverflow);
+        return;
+    }
 
-    m_pDeviceContext->PSSetShader(m_pParallelogramPS, nullptr, 0);
-    m_pDeviceContext->PSSetConstantBuffers(0, 1, &m_pColorBuffer);
-    m_pDeviceContext->PSSetConstantBuffers(2, 1, &m_pLightBuffer);
+    XMFLOAT4* viewLights = m_passData.viewLights;
+    for (UINT i = 0; i < m_activeLights; i++)
+    {
+        const PointLight& light = m_frameLights[i];
+        XMStoreFloat4(&viewLights[i], XMVectorSetW(XMVector3Transform(XMLoadFloat3(&light.Position), m_passData.view), light.Range));
+    }
+
+    UINT* ranges = m_passData.clusterRanges;
+    UINT* indices = m_passData.clusterIndices;
+    m_clusterIndexCount = m_lightClusters.Assign(viewLights, m_activeLights, ranges, indices);
+    m_clusterDroppedLights = m_lightClusters.GetDroppedLights();
+
+    pContext->UpdateBuffer(m_pClusterRanges, ranges, sizeof(UINT) * 2 * clusterCount);
+    if (m_clusterIndexCount > 0)
+        pContext->UpdateBuffer(m_pClusterIndices, indices, sizeof(UINT) * m_clusterIndexCount);
+}
+
+// Pixels across one face of the cube nearest to the camera. The cubes lie
+// on rings in the y = 0 plane, so the nearest one is about as far as the
+// edge of the disc they cover, or right below the camera inside it.
+float RenderClass::GetCubeScreenSize(XMMATRIX proj) const
+{
+    float ringDistance = sqrtf(m_CameraPosition.x * m_CameraPosition.x + m_CameraPosition.z * m_CameraPosition.z) - m_sceneRadius;
+    if (ringDistance < 0.0f)
+        ringDistance = 0.0f;
+
+    const float faceSize = 2.0f * m_fixedScale;
+    float distance = sqrtf(ringDistance * ringDistance + m_CameraPosition.y * m_CameraPosition.y) - 0.5f * faceSize;
+    if (distance < 0.1f)
+        distance = 0.1f;
+
+    return faceSize * XMVectorGetY(proj.r[1]) * 0.5f * m_height / distance;
+}
+
+void RenderClass::UpdateTranslucentQuads(XMVECTOR eyePos)
+{
+    m_ParallelogramAngle += 0.015f;
+    float angle = m_ParallelogramAngle;
+
+    XMMATRIX pairModels[AnimatedQuadCount] =
+    {
+        XMMatrixTranslation(sinf(angle) * 2.0f, -0.5f, -5.0f),
+        XMMatrixTranslation(-sinf(angle) * 2.0f, -0.5f, -6.0f)
+    };
+    for (UINT i = 0; i < std::min(GetTranslucentCount(), AnimatedQuadCount); i++)
+    {
+        m_translucentQuads[i].model = XMMatrixTranspose(pairModels[i]);
+        XMStoreFloat3(&m_translucentCenters[i], pairModels[i].r[3]);
+    }
 
-    static float angle = 0.0f;
-    angle += 0.015f;
+    // The slot about to be reused was copied ArgsReadbackLatency frames ago;
+    // a frame that ran out of nodes grows the pool for the next ones
+    if (m_oitNodeCapacity == 0)
+        m_oitNodeCapacity = std::min(MaxOitNodes, OitNodesPerPixel * m_width * m_height);
+    UINT nodeCount = 0;
+    if (m_transparencyMode == TransparencyMode::LinkedList && m_pOitCountReadback[m_oitReadbackIndex] &&
+        m_pContext->TryReadBuffer(m_pOitCountReadback[m_oitReadbackIndex], &nodeCount, sizeof(nodeCount)) == S_OK)
+    {
+        m_transparencyStats.oitNodes = nodeCount;
+        if (nodeCount > m_oitNodeCapacity && m_oitNodeCapacity < MaxOitNodes)
+        {
+            m_oitNodeCapacity = std::min(MaxOitNodes, nodeCount + nodeCount / 4);
+            ReleaseHandle(m_pOitNodes);
+        }
+    }
+    m_transparencyStats.oitNodeCapacity = m_oitNodeCapacity;
 
-    XMMATRIX modelParallelogramRed = XMMatrixTranslation(sinf(angle) * 2.0f, -0.5f, -5.0f);
-    XMMATRIX mTParallelogramRed = XMMatrixTranspose(modelParallelogramRed);
-    XMFLOAT4 redColor = XMFLOAT4(1.0f, 0.0f, 0.0f, 0.5f);
+    OitConstants* pOit = m_uploadRing.Allocate<OitConstants>(&m_frameUploads.oit);
+    pOit->width = m_width;
+    pOit->nodeCapacity = m_oitNodeCapacity;
 
-    XMMATRIX modelParallelogramGreen = XMMatrixTranslation(-sinf(angle) * 2.0f, -0.5f, -6.0f);
-    XMMATRIX mTParallelogramGreen = XMMatrixTranspose(modelParallelogramGreen);
-    XMFLOAT4 greenColor = XMFLOAT4(0.0f, 1.0f, 0.0f, 0.5f);
+    m_transparencyStats.quads = GetTranslucentCount();
+    m_transparencyStats.sortSeconds = 0.0;
+    if (m_transparencyMode == TransparencyMode::Sorted)
+    {
+        SortTranslucentQuads(eyePos);
+    }
+    else if (m_translucentOrderSorted)
+    {
+        // OIT takes the quads in any order
+        for (UINT i = 0; i < GetTranslucentCount(); i++)
+        {
+            m_translucentOrder[i] = i;
+        }
+        m_translucentOrderSorted = false;
+        m_translucentOrderChanged = true;
+    }
+}
 
-    XMFLOAT3 redObjectPosition;
-    XMStoreFloat3(&redObjectPosition, modelParallelogramRed.r[3]);
+// One set of constants for every stage of the chain, fused as it is now
+void RenderClass::UpdatePostProcessConstants()
+{
+    for (UINT stage = 0; stage < m_postProcess.GetStageCount(); stage++)
+    {
+        PostProcessConstants* pConstants = m_uploadRing.Allocate<PostProcessConstants>(&m_frameUploads.postProcess[stage]);
+        m_postProcess.GetStageConstants(stage, m_width, m_height, *pConstants);
+    }
+}
 
-    XMFLOAT3 greenObjectPosition;
-    XMStoreFloat3(&greenObjectPosition, modelParallelogramGreen.r[3]);
+void RenderClass::SetUseNegative(bool useNegative)
+{
+    m_postProcess.Clear();
+    if (useNegative)
+        m_postProcess.Add(PostEffect::Negative);
+}
 
-    XMVECTOR redObjPos = XMLoadFloat3(&redObjectPosition);
-    XMVECTOR greenObjPos = XMLoadFloat3(&greenObjectPosition);
+void RenderClass::SortTranslucentQuads(XMVECTOR eyePos)
+{
+    ProfileScope scope(m_profiler, "SortTranslucent");
+    auto start = std::chrono::steady_clock::now();
 
-    float redProjection = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(redObjPos, eyePos)));
-    float greenProjection = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(greenObjPos, eyePos)));
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, eyePos);
+    m_translucentQueue.Clear();
+    for (UINT i = 0; i < GetTranslucentCount(); i++)
+    {
+        const XMFLOAT3& center = m_translucentCenters[i];
+        float dx = center.x - eye.x;
+        float dy = center.y - eye.y;
+        float dz = center.z - eye.z;
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz) / CameraFar;
+        m_translucentQueue.Add(RenderQueue::MakeTransparentKey(static_cast<UINT>(FramePass::Parallelogram), 0, 0, distance), i);
+    }
 
-    if (redProjection >= greenProjection)
+    // the farthest first, equal distances in index order so every run draws the same
+    m_translucentQueue.Sort(m_pSortPool.get());
+    for (UINT i = 0; i < GetTranslucentCount(); i++)
     {
-        m_pDeviceContext->UpdateSubresource(m_pModelBuffer, 0, nullptr, &mTParallelogramRed, 0, 0);
-        m_pDeviceContext->UpdateSubresource(m_pColorBuffer, 0, nullptr, &redColor, 0, 0);
-        m_pDeviceContext->DrawIndexed(6, 0, 0);
+        m_translucentOrder[i] = m_translucentQueue.GetItem(i);
+    }
+    m_translucentOrderSorted = true;
+    m_translucentOrderChanged = true;
+
+    m_transparencyStats.sortSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void RenderClass::RenderSkybox(RenderContext* pContext)
+{
+    float clearColor[4] = { 0.48f, 0.57f, 0.48f, 1.0f };
+    pContext->ClearRenderTarget(m_passData.sceneColor, clearColor);
+    pContext->ClearDepth(m_passData.depth, 1.0f);
 
-        m_pDeviceContext->UpdateSubresource(m_pModelBuffer, 0, nullptr, &mTParallelogramGreen, 0, 0);
-        m_pDeviceContext->UpdateSubresource(m_pColorBuffer, 0, nullptr, &greenColor, 0, 0);
-        m_pDeviceContext->DrawIndexed(6, 0, 0);
+    pContext->SetRenderTargets(m_passData.sceneColor, m_passData.depth);
+    pContext->SetViewport(m_viewport);
+    pContext->SetDepthStencilState(m_passData.skyboxDepthState);
+    pContext->SetRasterizerState(m_passData.skyboxRasterizer);
+    pContext->SetBlendState(NullHandle);
+
+    pContext->SetVertexBuffer(m_pSkyboxVB, sizeof(SkyboxVertex), 0);
+    pContext->SetInputLayout(m_pSkyboxLayout);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+
+    pContext->SetShader(ShaderStage::Vertex, m_pSkyboxVS);
+    m_uploadRing.Bind(pContext, ShaderStage::Vertex, 0, m_frameUploads.skyboxCamera);
+
+    pContext->SetShader(ShaderStage::Pixel, m_pSkyboxPS);
+    pContext->SetShaderResource(ShaderStage::Pixel, 0, m_pSkyboxSRV);
+    pContext->SetSampler(ShaderStage::Pixel, 0, m_pSamplerState);
+
+    pContext->Draw(36, 0);
+}
+
+void RenderClass::RenderCubes(RenderContext* pContext, UINT firstVisible, UINT visibleCount)
+{
+    if (!m_passData.cubeVS || !m_passData.cubePS)
+        return;
+
+    SetCubeTargets(pContext);
+    pContext->SetRasterizerState(NullHandle);
+    pContext->SetDepthStencilState(NullHandle);
+    pContext->SetBlendState(NullHandle);
+
+    pContext->SetVertexBuffer(m_pVertexBuffer, sizeof(CubeVertex), 0);
+    pContext->SetIndexBuffer(m_pIndexBuffer, Format::R16_UINT);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+    pContext->SetInputLayout(m_pLayout);
+
+    pContext->SetShader(ShaderStage::Vertex, m_passData.cubeVS);
+    pContext->SetShader(ShaderStage::Pixel, m_passData.cubePS);
+
+    m_uploadRing.Bind(pContext, ShaderStage::Vertex, 1, m_frameUploads.camera);
+    if (!m_passData.deferred)
+        BindLights(pContext);
+    if ((m_passData.features & FeatureShadows) && !m_passData.deferred)
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Pixel, 4, m_frameUploads.shadows);
+        pContext->SetShaderResource(ShaderStage::Pixel, 5, m_pStaticShadowAtlas);
+        pContext->SetShaderResource(ShaderStage::Pixel, 6, m_pDynamicShadowAtlas);
+    }
+
+    pContext->SetShaderResource(ShaderStage::Pixel, 0, m_pTextureView);
+    pContext->SetShaderResource(ShaderStage::Pixel, 1, (m_passData.features & FeatureNormalMap) ? m_pNormalMapView : NullHandle);
+    pContext->SetSampler(ShaderStage::Pixel, 0, m_pSamplerState);
+
+    if (!m_passData.visibleIndices)
+    {
+        // GPU frustum culling, the compute shader writes the visible
+        // instances and the draw arguments straight into GPU buffers
+        const UINT instanceCount = GetInstanceCount();
+        {
+            GpuProfileScope scope(m_profiler, pContext, "CullDispatch");
+            pContext->CopyResource(m_pIndirectArgsBuffer, m_pIndirectArgsInit);
+            DispatchCulling(pContext, m_frameUploads.culling, m_pModelBufferInst, instanceCount);
+        }
+
+        pContext->SetShaderResource(ShaderStage::Vertex, 0, m_pModelBufferInst);
+        pContext->DrawIndexedInstancedIndirect(m_pIndirectArgsBuffer, 0);
+
+        if (m_passData.buildHiZ)
+        {
+            // the cubes phase 1 hid, against the pyramid of the ones it drew
+            pContext->SetShaderResource(ShaderStage::Vertex, 0, NullHandle);
+            {
+                GpuProfileScope scope(m_profiler, pContext, "HiZ");
+                BuildHiZ(pContext);
+            }
+            {
+                GpuProfileScope scope(m_profiler, pContext, "CullDisoccluded");
+                DispatchCulling(pContext, m_frameUploads.cullingDisoccluded, m_pDisoccludedInst, instanceCount);
+            }
+
+            SetCubeTargets(pContext);
+            pContext->SetShaderResource(ShaderStage::Vertex, 0, m_pDisoccludedInst);
+            pContext->DrawIndexedInstancedIndirect(m_pIndirectArgsBuffer, sizeof(UINT) * 5);
+        }
+
+        // read back a few frames later by PreparePasses
+        pContext->CopyResource(m_passData.argsReadback, m_pIndirectArgsBuffer);
     }
     else
     {
-        m_pDeviceContext->UpdateSubresource(m_pModelBuffer, 0, nullptr, &mTParallelogramGreen, 0, 0);
-        m_pDeviceContext->UpdateSubresource(m_pColorBuffer, 0, nullptr, &greenColor, 0, 0);
-        m_pDeviceContext->DrawIndexed(6, 0, 0);
+        // the cubes PreparePasses found visible, from firstVisible on
+        RenderHandle upload = m_instanceUploads[firstVisible / CubesPerPass];
+        void* pInstances = nullptr;
+        if (SUCCEEDED(pContext->Map(upload, &pInstances)))
+        {
+            WriteVisibleInstances(m_passData.visibleIndices + firstVisible, visibleCount, static_cast<InstanceData*>(pInstances));
+            pContext->Unmap(upload);
+
+            pContext->SetShaderResource(ShaderStage::Vertex, 0, upload);
+            pContext->DrawIndexedInstanced(36, visibleCount, 0, 0, 0);
+        }
+    }
+
+    pContext->SetShaderResource(ShaderStage::Vertex, 0, NullHandle);
+}
+
+void RenderClass::SetCubeTargets(RenderContext* pContext)
+{
+    if (m_passData.deferred)
+    {
+        RenderHandle targets[2] = { m_passData.gBufferAlbedo, m_passData.gBufferNormals };
+        pContext->SetRenderTargets(targets, 2, m_passData.depth);
+    }
+    else
+    {
+        pContext->SetRenderTargets(m_passData.sceneColor, m_passData.depth);
+    }
+    pContext->SetViewport(m_viewport);
+}
+
+// One group per 16x16 tile: the lights that reach the depth range of the
+// tile, then every covered pixel shades them
+void RenderClass::RenderDeferredLighting(RenderContext* pContext)
+{
+    pContext->SetRenderTargets(NullHandle, NullHandle);
+    if (m_passData.uploadLights && m_activeLights > 0)
+        pContext->UpdateBuffer(m_pLightData, m_frameLights.data(), sizeof(PointLight) * m_activeLights);
+
+    pContext->SetShader(ShaderStage::Compute, m_passData.deferredCS);
+    m_uploadRing.Bind(pContext, ShaderStage::Compute, 0, m_frameUploads.deferred);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, m_passData.gBufferAlbedo);
+    pContext->SetShaderResource(ShaderStage::Compute, 1, m_passData.gBufferNormals);
+    pContext->SetShaderResource(ShaderStage::Compute, 2, m_pLightData);
+    pContext->SetShaderResource(ShaderStage::Compute, 3, m_passData.depth);
+    if (m_passData.features & FeatureShadows)
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Compute, 4, m_frameUploads.shadows);
+        pContext->SetShaderResource(ShaderStage::Compute, 5, m_pStaticShadowAtlas);
+        pContext->SetShaderResource(ShaderStage::Compute, 6, m_pDynamicShadowAtlas);
+    }
+    pContext->SetUnorderedAccess(0, m_passData.sceneColor);
+
+    pContext->Dispatch((m_width + 15) / 16, (m_height + 15) / 16, 1);
+
+    pContext->SetUnorderedAccess(0, NullHandle);
+    pContext->SetShader(ShaderStage::Compute, NullHandle);
+}
+
+// The slots the atlas scheduled, depth only. The static layer of a slot is
+// only drawn again when its casters or the light moved.
+void RenderClass::RenderShadows(RenderContext* pContext)
+{
+    pContext->SetRasterizerState(NullHandle);
+    pContext->SetBlendState(NullHandle);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+    pContext->SetShader(ShaderStage::Pixel, NullHandle);
+
+    const std::vector<ShadowUpdate>& updates = m_shadowAtlas.GetUpdates();
+    for (UINT i = 0; i < updates.size(); i++)
+    {
+        if (updates[i].drawStatic)
+            DrawShadowLayer(pContext, i, true);
+        DrawShadowLayer(pContext, i, false);
+    }
+
+    pContext->SetRenderTargets(NullHandle, NullHandle);
+}
+
+// The six tiles of the slot cleared to the far plane, then the casters of
+// the layer drawn into every face. The static layer holds the markers of
+// the other lights and the cubes while they stand still, the dynamic one
+// the spinning cubes.
+void RenderClass::DrawShadowLayer(RenderContext* pContext, UINT update, bool staticLayer)
+{
+    const ShadowUpdate& shadowUpdate = m_shadowAtlas.GetUpdates()[update];
+    pContext->SetRenderTargets(NullHandle, staticLayer ? m_pStaticShadowAtlas : m_pDynamicShadowAtlas);
+
+    pContext->SetDepthStencilState(m_passData.shadowClearState);
+    pContext->SetVertexBuffer(m_pShadowClearVB, sizeof(FullScreenVertex), 0);
+    pContext->SetInputLayout(m_pFullScreenLayout);
+    pContext->SetShader(ShaderStage::Vertex, m_pPostProcessVS);
+    for (UINT face = 0; face < ShadowAtlas::FaceCount; face++)
+    {
+        pContext->SetViewport(m_shadowAtlas.GetFaceViewport(shadowUpdate.slot, face));
+        pContext->Draw(3, 0);
+    }
+
+    const UINT layer = staticLayer ? 0 : 1;
+    const UINT casterCount = m_frameUploads.shadowCasterCounts[update][layer];
+    if (casterCount == 0)
+        return;
+
+    pContext->SetDepthStencilState(NullHandle);
+    pContext->SetVertexBuffer(m_pVertexBuffer, sizeof(CubeVertex), 0);
+    pContext->SetIndexBuffer(m_pIndexBuffer, Format::R16_UINT);
+    pContext->SetInputLayout(m_pLayout);
+    pContext->SetShader(ShaderStage::Vertex, m_passData.shadowVS);
+
+    const UploadAllocation* pieces = m_frameUploads.shadowCasters[update][layer];
+    for (UINT first = 0; first < casterCount; first += ShadowCastersPerDraw)
+    {
+        UINT count = std::min(casterCount - first, ShadowCastersPerDraw);
+        m_uploadRing.Bind(pContext, ShaderStage::Vertex, 2, pieces[first / ShadowCastersPerDraw]);
+        for (UINT face = 0; face < ShadowAtlas::FaceCount; face++)
+        {
+            pContext->SetViewport(m_shadowAtlas.GetFaceViewport(shadowUpdate.slot, face));
+            m_uploadRing.Bind(pContext, ShaderStage::Vertex, 1, m_frameUploads.shadowFaces[update][face]);
+            pContext->DrawIndexedInstanced(36, count, 0, 0, 0);
+        }
+        m_shadowCasterDraws += count * ShadowAtlas::FaceCount;
+    }
+}
+
+// ComputeShader.cs with the constants of one phase, the visible instances
+// go into target and their count into the matching draw arguments
+void RenderClass::DispatchCulling(RenderContext* pContext, const UploadAllocation& constants, RenderHandle target, UINT instanceCount)
+{
+    pContext->SetShader(ShaderStage::Compute, m_pComputeShader);
+    m_uploadRing.Bind(pContext, ShaderStage::Compute, 0, constants);
+    pContext->SetUnorderedAccess(0, m_pIndirectArgsBuffer);
+    pContext->SetUnorderedAccess(1, target);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, m_pInstanceDataSRV);
+    if (m_passData.buildHiZ)
+    {
+        pContext->SetUnorderedAccess(2, m_pOccludedInstances);
+        pContext->SetShaderResource(ShaderStage::Compute, 1, m_pHiZ);
+    }
+
+    pContext->Dispatch((instanceCount + 63) / 64, 1, 1);
 
-        m_pDeviceContext->UpdateSubresource(m_pModelBuffer, 0, nullptr, &mTParallelogramRed, 0, 0);
-        m_pDeviceContext->UpdateSubresource(m_pColorBuffer, 0, nullptr, &redColor, 0, 0);
-        m_pDeviceContext->DrawIndexed(6, 0, 0);
+    pContext->SetUnorderedAccess(0, NullHandle);
+    pContext->SetUnorderedAccess(1, NullHandle);
+    pContext->SetUnorderedAccess(2, NullHandle);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, NullHandle);
+    pContext->SetShaderResource(ShaderStage::Compute, 1, NullHandle);
+    pContext->SetShader(ShaderStage::Compute, NullHandle);
+}
+
+// Every level of the pyramid from the depth the cubes drawn so far left.
+// The depth is read by a shader, so the pass lets go of its targets.
+void RenderClass::BuildHiZ(RenderContext* pContext)
+{
+    pContext->SetRenderTargets(NullHandle, NullHandle);
+    pContext->SetShader(ShaderStage::Compute, m_pHiZShader);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, m_passData.depth);
+    pContext->SetUnorderedAccess(0, m_pHiZ);
+
+    const HiZLevel* levels = m_hiZLayout.GetLevels();
+    for (UINT i = 0; i < m_hiZLayout.GetLevelCount(); i++)
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Compute, 0, m_frameUploads.hiZLevels[i]);
+        pContext->Dispatch((levels[i].width + 7) / 8, (levels[i].height + 7) / 8, 1);
     }
 
-    pRSState->Release();
+    pContext->SetUnorderedAccess(0, NullHandle);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, NullHandle);
+    pContext->SetShader(ShaderStage::Compute, NullHandle);
 }
 
-void RenderClass::InitImGui(HWND hWnd) 
+void RenderClass::RenderLightMarkers(RenderContext* pContext)
+{
+    pContext->SetRenderTargets(m_passData.sceneColor, m_passData.depth);
+    pContext->SetViewport(m_viewport);
+    pContext->SetRasterizerState(NullHandle);
+    pContext->SetDepthStencilState(NullHandle);
+    pContext->SetBlendState(NullHandle);
+
+    pContext->SetVertexBuffer(m_pVertexBuffer, sizeof(CubeVertex), 0);
+    pContext->SetIndexBuffer(m_pIndexBuffer, Format::R16_UINT);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+    pContext->SetInputLayout(m_pLayout);
+
+    pContext->SetShader(ShaderStage::Vertex, m_pLightVertexShader);
+    pContext->SetShader(ShaderStage::Pixel, m_pLightPixelShader);
+    m_uploadRing.Bind(pContext, ShaderStage::Vertex, 1, m_frameUploads.camera);
+    for (UINT i = 0; i < std::min(m_activeLights, LightCount); i++)
+    {
+        m_uploadRing.Bind(pContext, ShaderStage::Vertex, 0, m_frameUploads.lightObjects[i]);
+        m_uploadRing.Bind(pContext, ShaderStage::Pixel, 0, m_frameUploads.lightObjects[i]);
+        pContext->DrawIndexed(36, 0, 0);
+    }
+}
+
+void RenderClass::RenderParallelogram(RenderContext* pContext)
+{
+    if (!m_passData.parallelogramPS)
+        return;
+
+    const TransparencyMode mode = m_passData.transparency;
+    if (mode == TransparencyMode::Sorted)
+    {
+        pContext->SetRenderTargets(m_passData.sceneColor, m_passData.depth);
+        pContext->SetBlendState(m_pBlendState);
+    }
+    else if (mode == TransparencyMode::WeightedBlended)
+    {
+        const float accumClear[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        const float weightClear[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        pContext->ClearRenderTarget(m_passData.oitAccum, accumClear);
+        pContext->ClearRenderTarget(m_passData.oitWeight, weightClear);
+
+        RenderHandle targets[2] = { m_passData.oitAccum, m_passData.oitWeight };
+        pContext->SetRenderTargets(targets, 2, m_passData.depth);
+        pContext->SetBlendState(m_pOitAccumBlend);
+    }
+    else
+    {
+        // the counter and every list start empty
+        const UINT zero[4] = {};
+        pContext->ClearUnorderedAccess(m_pOitCounter, zero);
+        pContext->ClearUnorderedAccess(m_pOitHeads, zero);
+
+        pContext->SetRenderTargets(nullptr, 0, m_passData.depth);
+        pContext->SetPixelUnorderedAccess(1, m_pOitCounter);
+        pContext->SetPixelUnorderedAccess(2, m_pOitHeads);
+        pContext->SetPixelUnorderedAccess(3, m_pOitNodes);
+        pContext->SetBlendState(NullHandle);
+    }
+    pContext->SetViewport(m_viewport);
+    pContext->SetRasterizerState(m_passData.parallelogramRasterizer);
+    pContext->SetDepthStencilState(m_pStateParallelogram);
+
+    pContext->SetVertexBuffer(m_ParallelogramVertexBuffer, sizeof(ParallelogramVertex), 0);
+    pContext->SetIndexBuffer(m_pParallelogramIndexBuffer, Format::R16_UINT);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+    pContext->SetInputLayout(m_pParallelogramLayout);
+
+    pContext->SetShader(ShaderStage::Vertex, m_pParallelogramVS);
+    m_uploadRing.Bind(pContext, ShaderStage::Vertex, 1, m_frameUploads.camera);
+    pContext->SetShaderResource(ShaderStage::Vertex, 0, m_pTranslucentQuads);
+    pContext->SetShaderResource(ShaderStage::Vertex, 1, m_pTranslucentOrder);
+
+    pContext->SetShader(ShaderStage::Pixel, m_passData.parallelogramPS);
+    BindLights(pContext);
+    m_uploadRing.Bind(pContext, ShaderStage::Pixel, 0, m_frameUploads.oit);
+
+    // every quad in one draw, the order buffer picks which one an instance is
+    pContext->DrawIndexedInstanced(6, GetTranslucentCount(), 0, 0, 0);
+
+    if (mode == TransparencyMode::LinkedList)
+    {
+        pContext->SetPixelUnorderedAccess(1, NullHandle);
+        pContext->SetPixelUnorderedAccess(2, NullHandle);
+        pContext->SetPixelUnorderedAccess(3, NullHandle);
+        pContext->CopyResource(m_passData.oitReadback, m_pOitCounter);
+    }
+}
+
+void RenderClass::RenderTransparencyResolve(RenderContext* pContext)
+{
+    pContext->SetRenderTargets(m_passData.sceneColor, NullHandle);
+    pContext->SetViewport(m_viewport);
+    pContext->SetRasterizerState(NullHandle);
+    pContext->SetDepthStencilState(NullHandle);
+    pContext->SetBlendState(m_pOitResolveBlend);
+
+    pContext->SetShader(ShaderStage::Vertex, m_pPostProcessVS);
+    pContext->SetShader(ShaderStage::Pixel, m_passData.oitResolvePS);
+    pContext->SetInputLayout(m_pFullScreenLayout);
+    m_uploadRing.Bind(pContext, ShaderStage::Pixel, 0, m_frameUploads.oit);
+
+    if (m_passData.transparency == TransparencyMode::WeightedBlended)
+    {
+        pContext->SetShaderResource(ShaderStage::Pixel, 0, m_passData.oitAccum);
+        pContext->SetShaderResource(ShaderStage::Pixel, 1, m_passData.oitWeight);
+    }
+    else
+    {
+        pContext->SetShaderResource(ShaderStage::Pixel, 0, m_pOitHeads);
+        pContext->SetShaderResource(ShaderStage::Pixel, 1, m_pOitNodes);
+    }
+
+    pContext->SetVertexBuffer(m_pFullScreenVB, sizeof(FullScreenVertex), 0);
+    pContext->SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+    pContext->Draw(3, 0);
+}
+
+void RenderClass::RenderPostProcess(RenderContext* pContext, UINT stage)
+{
+    // the source was a render target until now, which would keep it from
+    // being bound as a shader resource
+    pContext->SetRenderTargets(NullHandle, NullHandle);
+
+    pContext->SetShader(ShaderStage::Compute, m_pPostProcessCS);
+    m_uploadRing.Bind(pContext, ShaderStage::Compute, 0, m_frameUploads.postProcess[stage]);
+    pContext->SetShaderResource(ShaderStage::Compute, 0, m_passData.postSources[stage]);
+    pContext->SetUnorderedAccess(0, m_passData.postTargets[stage]);
+
+    const UINT groupSize = PostProcessChain::ThreadGroupSize;
+    pContext->Dispatch((m_width + groupSize - 1) / groupSize, (m_height + groupSize - 1) / groupSize, 1);
+
+    pContext->SetUnorderedAccess(0, NullHandle);
+}
+
+#ifdef _WIN32
+void RenderClass::InitImGui(HWND hWnd)
 {
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -1556,145 +2847,312 @@ void RenderClass::InitImGui(HWND hWnd)
 
     ImGui::StyleColorsDark();
     ImGui_ImplWin32_Init(hWnd);
-    ImGui_ImplDX11_Init(m_pDevice, m_pDeviceContext);
+    ImGui_ImplDX11_Init(m_pD3DDevice->GetD3DDevice(), m_pD3DDevice->GetD3DContext());
 }
 
-void RenderClass::RenderImGui() 
+void RenderClass::RenderImGui()
 {
     ImGui_ImplDX11_NewFrame();
     ImGui_ImplWin32_NewFrame();
     ImGui::NewFrame();
 
     ImGui::Begin("Options");
-    ImGui::Checkbox("Negative Effect", &m_useNegative);
+    ImGui::Checkbox("Normal Mapping", &m_useNormalMap);
+    ImGui::Checkbox("Clustered Lighting", &m_useClusteredLighting);
+    ImGui::Checkbox("Assign Lights in Compute Shader", &m_useComputeClusters);
+    ImGui::Checkbox("Deferred Shading", &m_useDeferredShading);
+    int activeLights = static_cast<int>(m_activeLights);
+    if (ImGui::SliderInt("Lights", &activeLights, 0, MaxLights, "%d", ImGuiSliderFlags_Logarithmic))
+    {
+        SetActiveLights(static_cast<UINT>(activeLights));
+    }
+    if (!m_useClusteredLighting && m_activeLights > LightCount)
+        ImGui::Text("Only %u lights are shaded without clustering", LightCount);
+    ImGui::Text("Clusters: %u x %u x %u", m_lightClusters.GetGridX(), m_lightClusters.GetGridY(), LightClusters::SliceCount);
+    if (m_useClusteredLighting && !m_useComputeClusters)
+        ImGui::Text("Lights per cluster: %.2f", static_cast<float>(m_clusterIndexCount) / m_lightClusters.GetClusterCount());
+    if (m_useClusteredLighting && m_clusterDroppedLights > 0)
+        ImGui::Text("Lights dropped from full clusters: %u", m_clusterDroppedLights);
+    ImGui::Text("Shader Variants: %u compiled", GetCompiledVariantCount());
+
+    ImGui::Checkbox("Shadows", &m_useShadows);
+    int maxShadowed = static_cast<int>(m_maxShadowedLights);
+    int shadowUpdates = static_cast<int>(m_shadowUpdatesPerFrame);
+    bool limitsChanged = ImGui::SliderInt("Shadowed Lights", &maxShadowed, 1, MaxShadowSlots);
+    limitsChanged |= ImGui::SliderInt("Shadow Updates/Frame", &shadowUpdates, 1, MaxShadowSlots);
+    if (limitsChanged)
+        SetShadowLimits(static_cast<UINT>(maxShadowed), static_cast<UINT>(shadowUpdates));
+    bool spinCubes = m_spinCubes;
+    if (ImGui::Checkbox("Spin Cubes", &spinCubes))
+        SetSpinCubes(spinCubes);
+    ImGui::Checkbox("Animate Lights", &m_animateLights);
+    if (m_useShadows)
+    {
+        const ShadowStats& shadowStats = m_shadowAtlas.GetStats();
+        ImGui::Text("Shadows: %u of %u lights, %u updated (%u static), %u stale, %u caster draws", shadowStats.shadowed,
+            shadowStats.candidates, shadowStats.updates, shadowStats.staticUpdates, shadowStats.staleSlots, m_shadowCasterDraws);
+    }
+
+    static const char* const TransparencyModes[] = { "Sorted", "Weighted Blended OIT", "Linked List OIT" };
+    int transparencyMode = static_cast<int>(m_transparencyMode);
+    if (ImGui::Combo("Transparency", &transparencyMode, TransparencyModes, ARRAYSIZE(TransparencyModes)))
+        m_transparencyMode = static_cast<TransparencyMode>(transparencyMode);
+    int translucentCount = static_cast<int>(m_translucentCount);
+    if (ImGui::SliderInt("Translucent Quads", &translucentCount, 0, 100000, "%d", ImGuiSliderFlags_Logarithmic))
+    {
+        SetTranslucentCount(static_cast<UINT>(translucentCount));
+    }
+    if (m_transparencyMode == TransparencyMode::Sorted)
+        ImGui::Text("Sort: %.2f ms", m_transparencyStats.sortSeconds * 1000.0);
+    if (m_transparencyMode == TransparencyMode::LinkedList)
+        ImGui::Text("Fragments: %u, pool %u", m_transparencyStats.oitNodes, m_transparencyStats.oitNodeCapacity);
+
+    bool useDeferred = m_frameRecorder.GetUseDeferredContexts();
+    if (ImGui::Checkbox("Record Passes on Worker Threads", &useDeferred))
+        m_frameRecorder.SetUseDeferredContexts(useDeferred);
+    const FrameRecorderStats& recordStats = m_frameRecorder.GetStats();
+    ImGui::Text("Passes: %u, record %.2f ms, execute %.2f ms", recordStats.passes,
+        recordStats.recordSeconds * 1000.0, recordStats.executeSeconds * 1000.0);
+    const RenderGraphStats& graphStats = m_renderGraph.GetStats();
+    ImGui::Text("Render Graph: %u passes, %u culled, %u textures on %u (%.1f / %.1f MB)",
+        graphStats.passes, graphStats.culledPasses, graphStats.transientTextures, graphStats.physicalTextures,
+        graphStats.physicalBytes / (1024.0 * 1024.0), graphStats.transientBytes / (1024.0 * 1024.0));
     ImGui::End();
 
     ImGui::Begin("Frustum Culling Info");
-    ImGui::Text("Total Cubes: %d", MaxInst);
+    int instanceCount = static_cast<int>(m_instanceCount);
+    if (ImGui::SliderInt("Total Cubes", &instanceCount, 1, 1000000, "%d", ImGuiSliderFlags_Logarithmic))
+    {
+        SetInstanceCount(static_cast<UINT>(instanceCount));
+    }
     ImGui::Text("Visible Cubes: %d", m_visibleCubes);
-    ImGui::Text("Culled Cubes: %d", MaxInst - m_visibleCubes);
+    ImGui::Text("Culled Cubes: %d", static_cast<int>(GetInstanceCount()) - m_visibleCubes);
+    ImGui::Checkbox("Occlusion Culling", &m_useOcclusionCulling);
+    ImGui::Checkbox("BVH Culling", &m_useBvhCulling);
+    if (m_useBvhCulling && !m_useComputeCulling)
+    {
+        const BvhStats& bvhStats = m_cubeBvh.GetStats();
+        ImGui::Text("BVH: %u nodes, depth %u, visited %u, %u subtrees accepted, %u boxes tested", bvhStats.nodes,
+            bvhStats.depth, bvhStats.visitedNodes, bvhStats.acceptedNodes, bvhStats.testedBoxes);
+    }
+    ImGui::Checkbox("Sort Cubes", &m_sortOpaqueDraws);
+    if (m_sortOpaqueDraws && !m_useComputeCulling)
+    {
+        const RadixSortStats& sortStats = m_cubeQueue.GetStats();
+        ImGui::Text("Sort: %u keys, %u passes, %.3f ms", sortStats.keys, sortStats.passes, sortStats.sortSeconds * 1000.0);
+    }
+    if (m_useOcclusionCulling && !m_useComputeCulling)
+    {
+        const SoftwareOcclusionStats& occlusionStats = m_softwareOcclusion.GetStats();
+        ImGui::Text("Software Occlusion: %u occluders, %u of %u hidden, %.2f ms", occlusionStats.occluders,
+            occlusionStats.hidden, occlusionStats.tested, occlusionStats.seconds * 1000.0);
+    }
+
+    const StateCacheStats& cacheStats = m_stateCache.GetStats();
+    ImGui::Text("State Cache: %u hits, %u misses", cacheStats.hits, cacheStats.misses);
+    ImGui::Text("State Changes: %u, elided %u", m_pContext->GetStats().stateChanges, m_pContext->GetStats().elidedStateChanges);
+    ImGui::Text("Textures Loading: %u", m_textureLoader.GetPendingCount());
+
+    const ShaderCacheStats& shaderStats = m_pD3DDevice->GetShaderCacheStats();
+    ImGui::Text("Startup: %.1f ms, shaders %u cached / %u compiled", m_startupSeconds * 1000.0, shaderStats.hits, shaderStats.misses);
+
+    int budgetKB = static_cast<int>(m_textureStreamer.GetBudget() / 1024);
+    if (ImGui::SliderInt("Texture Budget (KB)", &budgetKB, 64, 65536, "%d", ImGuiSliderFlags_Logarithmic))
+    {
+        m_textureStreamer.SetBudget(static_cast<UINT64>(budgetKB) * 1024);
+    }
+    const TextureStreamerStats& streamStats = m_textureStreamer.GetStats();
+    ImGui::Text("Resident Textures: %.1f KB, cube texture mip %u",
+        streamStats.residentBytes / 1024.0, m_textureStreamer.GetResidentMip(m_pTextureView));
 
     ImGui::End();
 
+    ImGui::Begin("Post Processing");
+    // the chain ends at the first slot left at None
+    static const char* const EffectNames[] = { "None", "Tone Map", "Color Grade", "Negative", "Blur", "Sharpen" };
+    PostEffect effects[PostMaxEffects];
+    UINT effectCount = 0;
+    bool chainChanged = false;
+    for (UINT i = 0; i <= m_postProcess.GetEffectCount() && i < PostMaxEffects; i++)
+    {
+        int item = i < m_postProcess.GetEffectCount() ? static_cast<int>(m_postProcess.GetEffect(i)) + 1 : 0;
+        ImGui::PushID(static_cast<int>(i));
+        chainChanged |= ImGui::Combo("Effect", &item, EffectNames, IM_ARRAYSIZE(EffectNames));
+        ImGui::PopID();
+        if (item == 0)
+            break;
+        effects[effectCount++] = static_cast<PostEffect>(item - 1);
+    }
+    if (chainChanged)
+        m_postProcess.SetEffects(effects, effectCount);
+
+    bool fuse = m_postProcess.GetFuse();
+    if (ImGui::Checkbox("Fuse Effects", &fuse))
+        m_postProcess.SetFuse(fuse);
+    ImGui::Text("Dispatches: %u", m_postProcess.GetStageCount());
+
+    PostProcessSettings settings = m_postProcess.GetSettings();
+    ImGui::SliderFloat("Exposure", &settings.exposure, 0.25f, 4.0f);
+    ImGui::SliderFloat("Contrast", &settings.contrast, 0.5f, 2.0f);
+    ImGui::SliderFloat("Saturation", &settings.saturation, 0.0f, 2.0f);
+    ImGui::SliderFloat("Sharpness", &settings.sharpness, 0.0f, 2.0f);
+    ImGui::ColorEdit3("Tint", &settings.tint.x);
+    m_postProcess.SetSettings(settings);
+    ImGui::End();
+
+    RenderProfilerWindow();
+
     ImGui::Render();
     ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 }
 
-HRESULT RenderClass::ConfigureBackBuffer(UINT width, UINT height)
+// Frame times over the history, then the scopes of the newest frame with GPU
+// timings: a row per track and nesting level, the GPU first
+void RenderClass::RenderProfilerWindow()
 {
-    if (m_pPostProcessTexture) m_pPostProcessTexture->Release();
-    if (m_pPostProcessRTV) m_pPostProcessRTV->Release();
-    if (m_pPostProcessSRV) m_pPostProcessSRV->Release();
-    if (m_pRenderTargetView) m_pRenderTargetView->Release();
-    if (m_pDepthView) m_pDepthView->Release();
+    ImGui::Begin("Profiler");
+    bool enabled = m_profiler.IsEnabled();
+    if (ImGui::Checkbox("Enabled", &enabled))
+        m_profiler.SetEnabled(enabled);
+    ImGui::SameLine();
+    if (ImGui::Button("Save Chrome Trace"))
+        m_profiler.WriteChromeTrace(L"profile.json");
 
-    m_pPostProcessTexture = nullptr;
-    m_pPostProcessRTV = nullptr;
-    m_pPostProcessSRV = nullptr;
-    m_pRenderTargetView = nullptr;
-    m_pDepthView = nullptr;
+    float cpuTimes[Profiler::HistoryFrames] = {};
+    float gpuTimes[Profiler::HistoryFrames] = {};
+    const UINT frameCount = m_profiler.GetFrameCount();
+    for (UINT i = 0; i < frameCount; i++)
+    {
+        cpuTimes[i] = static_cast<float>(m_profiler.GetFrame(i).cpuSeconds * 1000.0);
+        gpuTimes[i] = static_cast<float>(m_profiler.GetFrame(i).gpuSeconds * 1000.0);
+    }
+    ImGui::PlotLines("CPU ms", cpuTimes, frameCount, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
+    ImGui::PlotLines("GPU ms", gpuTimes, frameCount, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
 
-    ID3D11Texture2D* pBackBuffer = nullptr;
-    HRESULT hr = m_pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*)&pBackBuffer);
-    if (FAILED(hr)) return hr;
+    const ProfileFrame* pFrame = m_profiler.GetLatestFrame();
+    if (!pFrame || pFrame->events.empty())
+    {
+        ImGui::End();
+        return;
+    }
+    ImGui::Text("Frame %llu: CPU %.2f ms, GPU %.2f ms", static_cast<unsigned long long>(pFrame->index),
+        pFrame->cpuSeconds * 1000.0, pFrame->gpuSeconds * 1000.0);
 
-    hr = m_pDevice->CreateRenderTargetView(pBackBuffer, nullptr, &m_pRenderTargetView);
-    pBackBuffer->Release();
-    if (FAILED(hr)) return hr;
+    UINT trackCount = 0;
+    for (const ProfileEvent& event : pFrame->events)
+    {
+        trackCount = std::max(trackCount, event.track + 1);
+    }
 
-    D3D11_TEXTURE2D_DESC descDepth = {};
-    descDepth.Width = width;
-    descDepth.Height = height;
-    descDepth.MipLevels = 1;
-    descDepth.ArraySize = 1;
-    descDepth.Format = DXGI_FORMAT_D32_FLOAT;
-    descDepth.SampleDesc.Count = 1;
-    descDepth.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-    ID3D11Texture2D* pDepthStencil = nullptr;
-    hr = m_pDevice->CreateTexture2D(&descDepth, nullptr, &pDepthStencil);
-    if (FAILED(hr)) return hr;
+    const double span = std::max(pFrame->cpuSeconds, pFrame->gpuSeconds);
+    const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+    const float labelWidth = 60.0f;
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    const float width = std::max(ImGui::GetContentRegionAvail().x - labelWidth, 1.0f);
+    ImDrawList* pDrawList = ImGui::GetWindowDrawList();
 
-    hr = m_pDevice->CreateDepthStencilView(pDepthStencil, nullptr, &m_pDepthView);
-    pDepthStencil->Release();
-    if (FAILED(hr)) return hr;
+    float y = origin.y;
+    for (UINT track = 0; track < trackCount; track++)
+    {
+        UINT depthCount = 0;
+        for (const ProfileEvent& event : pFrame->events)
+        {
+            if (event.track == track)
+                depthCount = std::max(depthCount, event.depth + 1);
+        }
+        if (depthCount == 0)
+            continue;
 
-    D3D11_TEXTURE2D_DESC texDesc = {};
-    texDesc.Width = width;
-    texDesc.Height = height;
-    texDesc.MipLevels = 1;
-    texDesc.ArraySize = 1;
-    texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    texDesc.SampleDesc.Count = 1;
-    texDesc.Usage = D3D11_USAGE_DEFAULT;
-    texDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-
-    hr = m_pDevice->CreateTexture2D(&texDesc, nullptr, &m_pPostProcessTexture);
-    if (FAILED(hr)) return hr;
+        char label[16];
+        if (track == Profiler::GpuTrack)
+            snprintf(label, sizeof(label), "GPU");
+        else
+            snprintf(label, sizeof(label), "CPU %u", track);
+        pDrawList->AddText(ImVec2(origin.x, y), IM_COL32_WHITE, label);
 
-    hr = m_pDevice->CreateRenderTargetView(m_pPostProcessTexture, nullptr, &m_pPostProcessRTV);
-    if (FAILED(hr)) return hr;
+        for (const ProfileEvent& event : pFrame->events)
+        {
+            if (event.track != track)
+                continue;
 
-    hr = m_pDevice->CreateShaderResourceView(m_pPostProcessTexture, nullptr, &m_pPostProcessSRV);
-    if (FAILED(hr)) return hr;
+            ImVec2 rectMin(origin.x + labelWidth + static_cast<float>(event.start / span) * width, y + event.depth * rowHeight);
+            ImVec2 rectMax(std::max(rectMin.x + static_cast<float>(event.duration / span) * width, rectMin.x + 1.0f), rectMin.y + rowHeight - 1.0f);
 
-    D3D11_VIEWPORT vp;
-    vp.Width = (FLOAT)width;
-    vp.Height = (FLOAT)height;
-    vp.MinDepth = 0.0f;
-    vp.MaxDepth = 1.0f;
-    vp.TopLeftX = 0;
-    vp.TopLeftY = 0;
-    m_pDeviceContext->RSSetViewports(1, &vp);
+            // the same scope keeps its color from frame to frame
+            UINT hash = 2166136261u;
+            for (const char* c = event.name; *c; c++)
+            {
+                hash = (hash ^ static_cast<BYTE>(*c)) * 16777619u;
+            }
+            pDrawList->AddRectFilled(rectMin, rectMax, ImColor::HSV((hash % 360) / 360.0f, 0.5f, 0.7f));
+            pDrawList->PushClipRect(rectMin, rectMax, true);
+            pDrawList->AddText(ImVec2(rectMin.x + 2.0f, rectMin.y), IM_COL32_WHITE, event.name);
+            pDrawList->PopClipRect();
 
-    return S_OK;
+            if (ImGui::IsMouseHoveringRect(rectMin, rectMax))
+                ImGui::SetTooltip("%s: %.3f ms", event.name, event.duration * 1000.0);
+        }
+        y += depthCount * rowHeight + 4.0f;
+    }
+    ImGui::Dummy(ImVec2(labelWidth + width, y - origin.y));
+
+    if (m_profiler.GetDroppedScopes() > 0 || m_profiler.GetDroppedGpuFrames() > 0)
+        ImGui::Text("Dropped: %u scopes, %u GPU frames", m_profiler.GetDroppedScopes(), m_profiler.GetDroppedGpuFrames());
+    ImGui::End();
 }
+#endif
 
-void RenderClass::Resize(HWND hWnd)
+HRESULT RenderClass::ConfigureBackBuffer(UINT width, UINT height)
 {
-    if (m_pRenderTargetView)
-    {
-        m_pRenderTargetView->Release();
-        m_pRenderTargetView = nullptr;
-    }
-
-    if (m_pDepthView) 
-    {
-        m_pDepthView->Release();
-        m_pDepthView = nullptr;
-    }
+    // depth and the scene color are transients of the render graph, made
+    // again at the new size by the next frame
+    m_pRenderTargetView = m_pDevice->GetBackBuffer();
+    if (!m_pRenderTargetView)
+        return E_FAIL;
+
+    Viewport vp;
+    vp.width = (float)width;
+    vp.height = (float)height;
+    vp.minDepth = 0.0f;
+    vp.maxDepth = 1.0f;
+    vp.x = 0;
+    vp.y = 0;
+    m_pContext->SetViewport(vp);
+    m_viewport = vp;
 
-    if (m_pSwapChain)
-    {
-        HRESULT hr;
+    return S_OK;
+}
 
-        RECT rc;
-        GetClientRect(hWnd, &rc);
-        UINT width = rc.right - rc.left;
-        UINT height = rc.bottom - rc.top;
+void RenderClass::Resize(UINT width, UINT height)
+{
+    if (!m_pDevice || width == 0 || height == 0)
+        return;
 
-        hr = m_pSwapChain->ResizeBuffers(1, width, height, DXGI_FORMAT_R8G8B8A8_UNORM, 0);
-        if (FAILED(hr))
-        {
-            MessageBox(nullptr, L"ResizeBuffers failed.", L"Error", MB_OK);
-            return;
-        }
+    m_pContext->SetRenderTargets(NullHandle, NullHandle);
 
-        HRESULT resultBack = ConfigureBackBuffer(width, height);
-        if (FAILED(resultBack))
-        {
-            MessageBox(nullptr, L"Configure back buffer failed.", L"Error", MB_OK);
-            return;
-        }
+    HRESULT hr = m_pDevice->ResizeBackBuffer(width, height);
+    if (FAILED(hr))
+    {
+#ifdef _WIN32
+        MessageBox(nullptr, L"ResizeBuffers failed.", L"Error", MB_OK);
+#endif
+        return;
+    }
 
-        m_pDeviceContext->OMSetRenderTargets(1, &m_pRenderTargetView, m_pDepthView);
+    m_width = width;
+    m_height = height;
+    ReleaseHandle(m_pOitHeads);
+    ReleaseHandle(m_pOitNodes);
+    m_oitNodeCapacity = 0;
 
-        D3D11_VIEWPORT vp;
-        vp.Width = (FLOAT)width;
-        vp.Height = (FLOAT)height;
-        vp.MinDepth = 0.0f;
-        vp.MaxDepth = 1.0f;
-        vp.TopLeftX = 0;
-        vp.TopLeftY = 0;
-        m_pDeviceContext->RSSetViewports(1, &vp);
+    HRESULT resultBack = ConfigureBackBuffer(width, height);
+    if (FAILED(resultBack))
+    {
+#ifdef _WIN32
+        MessageBox(nullptr, L"Configure back buffer failed.", L"Error", MB_OK);
+#endif
+        return;
     }
-}
\ No newline at end of file
+
+    m_pContext->SetRenderTargets(m_pRenderTargetView, NullHandle);
+}
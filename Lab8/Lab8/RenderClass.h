@@ -1,73 +1,125 @@
 #ifndef RENDER_CLASS_H
 #define RENDER_CLASS_H
 
-#include <dxgi.h>
-#include <d3d11.h>
+#include "RenderBackend.h"
+#include "FrustumCulling.h"
+#include "BoundingVolumeHierarchy.h"
+#include "InstanceStore.h"
+#include "StateCache.h"
+#include "UploadRing.h"
+#include "FrameArena.h"
+#include "TextureLoader.h"
+#include "TextureStreamer.h"
+#include "ShaderVariants.h"
+#include "LightClusters.h"
+#include "OcclusionCulling.h"
+#include "PostProcess.h"
+#include "ShadowAtlas.h"
+#include "FrameRecorder.h"
+#include "RenderGraph.h"
+#include "RenderQueue.h"
+#include "Profiler.h"
 #include <DirectXMath.h>
+#include <memory>
 #include <vector>
 
 using namespace DirectX;
 
+#ifdef _WIN32
+class D3D11RenderDevice;
+#endif
+
 class RenderClass
 {
 public:
+    static const UINT LightCount = 3;       // lights the variants without clustering can shade
+    static const UINT MaxLights = 4096;
+    static const UINT CubesPerPass = 16384;     // visible cubes one pass draws with CPU culling
+    static const UINT ShadowCastersPerDraw = 512;   // instance constants of one shadow draw, 40 KB
+
+    // Feature bits of a draw, each shader keeps the ones it has options for
+    static const UINT FeatureNormalMap = 1 << 0;
+    static const UINT FeatureLightShift = 1;        // active lights, 0 to LightCount, in bits 1-2
+    static const UINT FeatureClusteredShift = 3;
+    static const UINT FeatureClustered = 1 << FeatureClusteredShift;    // lights from the cluster lists, bits 1-2 unused
+    static const UINT FeatureTransparencyShift = 4;     // TransparencyMode of the translucent quads, bits 4-5
+    static const UINT FeatureShadowsShift = 6;
+    static const UINT FeatureShadows = 1 << FeatureShadowsShift;        // the cubes read the shadow atlas
+    static const UINT FeatureConstantInstancesShift = 7;
+    static const UINT FeatureConstantInstances = 1 << FeatureConstantInstancesShift;    // instances from constants, shadow casters
+
+    // How the translucent quads are composited
+    enum class TransparencyMode
+    {
+        Sorted,             // back to front on the CPU, blended over the scene
+        WeightedBlended,    // one pass into two accumulation targets, approximate
+        LinkedList          // every fragment kept per pixel, sorted when resolved
+    };
+
+    struct TransparencyStats
+    {
+        UINT quads = 0;
+        double sortSeconds = 0.0;       // of the last frame, Sorted only
+        UINT oitNodes = 0;              // fragments of a frame a few back, LinkedList only
+        UINT oitNodeCapacity = 0;
+    };
+
+    // The shader files that have permutations, for compiling them all ahead of time
+    static UINT GetShaderVariantDescs(const ShaderVariantDesc** ppDescs);
+
     RenderClass() :
         m_pDevice(nullptr),
-        m_pDeviceContext(nullptr),
-        m_pSwapChain(nullptr),
-        m_pRenderTargetView(nullptr),
-        m_pVertexBuffer(nullptr),
-        m_pIndexBuffer(nullptr),
-        m_pPixelShader(nullptr),
-        m_pVertexShader(nullptr),
-        m_pLayout(nullptr),
-        m_pModelBuffer(nullptr),
-        m_pVPBuffer(nullptr),
-        m_szTitle(nullptr),
-        m_szWindowClass(nullptr),
-        m_pTextureView(nullptr),
-        m_pSamplerState(nullptr),
-        m_pSkyboxSRV(nullptr),
-        m_pSkyboxVB(nullptr),
-        m_pSkyboxVPBuffer(nullptr),
-        m_pSkyboxVS(nullptr),
-        m_pSkyboxPS(nullptr),
-        m_pSkyboxLayout(nullptr),
-        m_pDepthView(nullptr),
-        m_pColorBuffer(nullptr),
-        m_ParallelogramVertexBuffer(nullptr),
-        m_pParallelogramIndexBuffer(nullptr),
-        m_pParallelogramPS(nullptr),
-        m_pParallelogramVS(nullptr),
-        m_pParallelogramLayout(nullptr),
-        m_pBlendState(nullptr),
-        m_pStateParallelogram(nullptr),
-        m_pLightBuffer(nullptr),
-        m_pLightPixelShader(nullptr),
-        m_pNormalMapView(nullptr),
-        m_pPostProcessTexture(nullptr),
-        m_pPostProcessRTV(nullptr),
-        m_pPostProcessSRV(nullptr),
-        m_pPostProcessVS(nullptr),
-        m_pPostProcessPS(nullptr),
-        m_pFullScreenVB(nullptr),
-        m_pFullScreenLayout(nullptr),
-        m_pModelBufferInst(nullptr),
-        m_pComputeShader(nullptr),
-        m_pFrustumPlanesBuffer(nullptr),
-        m_pIndirectArgsBuffer(nullptr),
-        m_pObjectsIdsBuffer(nullptr),
-        m_pIndirectArgsUAV(nullptr),
-        m_pObjectsIdsUAV(nullptr),
-        m_pInstanceDataSRV(nullptr),
-        m_CameraPosition(0.0f, 0.0f, -16.0f), 
+        m_pContext(nullptr),
+        m_ownsDevice(false),
+        m_width(0),
+        m_height(0),
+        m_pRenderTargetView(NullHandle),
+        m_pVertexBuffer(NullHandle),
+        m_pIndexBuffer(NullHandle),
+        m_pLayout(NullHandle),
+        m_pTextureView(NullHandle),
+        m_pSamplerState(NullHandle),
+        m_pNormalMapView(NullHandle),
+        m_pSkyboxSRV(NullHandle),
+        m_pSkyboxVB(NullHandle),
+        m_pSkyboxVS(NullHandle),
+        m_pSkyboxPS(NullHandle),
+        m_pSkyboxLayout(NullHandle),
+        m_ParallelogramVertexBuffer(NullHandle),
+        m_pParallelogramIndexBuffer(NullHandle),
+        m_pParallelogramVS(NullHandle),
+        m_pParallelogramLayout(NullHandle),
+        m_pBlendState(NullHandle),
+        m_pStateParallelogram(NullHandle),
+        m_pLightVertexShader(NullHandle),
+        m_pLightPixelShader(NullHandle),
+        m_pPostProcessVS(NullHandle),
+        m_pPostProcessCS(NullHandle),
+        m_pFullScreenVB(NullHandle),
+        m_pFullScreenLayout(NullHandle),
+        m_pLightData(NullHandle),
+        m_pClusterShader(NullHandle),
+        m_pClusterBounds(NullHandle),
+        m_pClusterRanges(NullHandle),
+        m_pClusterIndices(NullHandle),
+        m_pComputeShader(NullHandle),
+        m_pIndirectArgsBuffer(NullHandle),
+        m_pIndirectArgsInit(NullHandle),
+        m_pInstanceDataSRV(NullHandle),
+        m_pModelBufferInst(NullHandle),
+        m_frustumPlanes{},
+        m_CameraPosition(0.0f, 0.0f, -16.0f),
         m_CameraSpeed(0.1f),
-        m_LRAngle(0.0f), 
-        m_UDAngle(0.0f),
-        m_frustumPlanes{}
+        m_LRAngle(0.0f),
+        m_UDAngle(0.0f)
     {}
 
-    HRESULT Init(HWND hWnd, WCHAR szTitle[], WCHAR szWindowClass[]);
+#ifdef _WIN32
+    HRESULT Init(HWND hWnd);
+#endif
+    // Renders through an externally owned device, e.g. the headless CpuRenderDevice.
+    // Waits for the textures so the first frame is the same on every run.
+    HRESULT Init(RenderDevice* pDevice, UINT width, UINT height);
     void Terminate();
 
     HRESULT InitBufferShader();
@@ -86,25 +138,130 @@ public:
     HRESULT InitParallelogram();
     void TerminateParallelogram();
 
-    HRESULT CompileShader(const std::wstring& path, ID3D11VertexShader** ppVertexShader, ID3D11PixelShader** ppPixelShader, ID3DBlob** pCodeShader=nullptr);
-    HRESULT CompileComputeShader(const std::wstring& path, ID3D11ComputeShader** ppComputeShader);
+    HRESULT InitLightClusters();
+    void TerminateLightClusters();
 
-    void UpdateFrustum(const XMMATRIX& viewProjMatrix);
-    bool IsAABBInFrustum(const XMFLOAT3& center, float size) const;
+    HRESULT InitShadows();
+    void TerminateShadows();
 
-    std::vector<UINT> ReadUintBufferData(ID3D11DeviceContext* pContext, ID3D11Buffer* pBuffer, UINT count);
+    void UpdateFrustum(const XMMATRIX& viewProjMatrix);
 
     void Render();
-    void RenderSkybox(XMMATRIX proj);
-    void RenderCubes(XMMATRIX view, XMMATRIX proj);
-    void RenderParallelogram(XMVECTOR eyePos);
-
+    void UpdateSkyboxConstants(XMMATRIX proj);
+    void UpdateCubeConstants(XMMATRIX view, XMMATRIX proj);
+    float GetCubeScreenSize(XMMATRIX proj) const;
+    void UpdateTranslucentQuads(XMVECTOR eyePos);
+    void UpdatePostProcessConstants();
+    void SortTranslucentQuads(XMVECTOR eyePos);
+    void UpdateLights(XMMATRIX view, XMMATRIX proj);
+    void UpdateShadows();
+    void UpdateDeferredConstants(XMMATRIX view, XMMATRIX proj);
+
+    // The passes of a frame, declared to the render graph which orders and
+    // culls them. PreparePasses runs on the main thread and does everything
+    // that touches the device or the caches; the passes only record,
+    // possibly on several threads at once.
+    HRESULT PreparePasses(XMMATRIX view);
+    void RecordPass(RenderContext* pContext, UINT pass);
+    void AssignLights(RenderContext* pContext);
+    void RenderShadows(RenderContext* pContext);
+    void RenderSkybox(RenderContext* pContext);
+    void RenderCubes(RenderContext* pContext, UINT firstVisible, UINT visibleCount);
+    void RenderDeferredLighting(RenderContext* pContext);
+    void RenderLightMarkers(RenderContext* pContext);
+    void RenderParallelogram(RenderContext* pContext);
+    void RenderTransparencyResolve(RenderContext* pContext);
+    void RenderPostProcess(RenderContext* pContext, UINT stage);
+
+#ifdef _WIN32
     void InitImGui(HWND hWnd);
     void RenderImGui();
+    void RenderProfilerWindow();
+#endif
 
-    void Resize(HWND hWnd);
-    void MoveCamera(float dx, float dy, float dz); 
+    void Resize(UINT width, UINT height);
+    void MoveCamera(float dx, float dy, float dz);
     void RotateCamera(float yaw, float pitch);
+    // Places the camera directly, e.g. along a scripted path
+    void SetCamera(const XMFLOAT3& position, float lrAngle, float udAngle);
+    // Passed to Present, 0 renders as fast as the device allows
+    void SetSyncInterval(UINT syncInterval) { m_syncInterval = syncInterval; }
+
+    void SetUseComputeCulling(bool useCompute) { m_useComputeCulling = useCompute; }
+    // Hi-Z after the frustum test with compute culling, software occlusion without it
+    void SetUseOcclusionCulling(bool useOcclusion) { m_useOcclusionCulling = useOcclusion; }
+    const SoftwareOcclusion& GetSoftwareOcclusion() const { return m_softwareOcclusion; }
+    // CPU culling walks a BVH over the cubes instead of testing every one
+    void SetUseBvhCulling(bool useBvh) { m_useBvhCulling = useBvh; }
+    const BoundingVolumeHierarchy& GetCubeBvh() const { return m_cubeBvh; }
+    // CPU culled cubes drawn by texture and then front to back, instead of in culling order
+    void SetSortOpaqueDraws(bool sortOpaque) { m_sortOpaqueDraws = sortOpaque; }
+    const RenderQueue& GetCubeQueue() const { return m_cubeQueue; }
+    const RenderQueue& GetTranslucentQueue() const { return m_translucentQueue; }
+    // The negative alone, or no effect
+    void SetUseNegative(bool useNegative);
+    // Compute effects between the scene and the back buffer, none by default
+    PostProcessChain& GetPostProcess() { return m_postProcess; }
+    // Rings of cubes around the original scene, buffers grow as needed
+    HRESULT SetInstanceCount(UINT count);
+    UINT GetInstanceCount() const { return m_instances.GetCount(); }
+    // Cubes changed here are composed and uploaded by the next Render
+    InstanceStore& GetInstances() { return m_instances; }
+    int GetVisibleCubes() const { return m_visibleCubes; }
+    RenderDevice* GetDevice() const { return m_pDevice; }
+    const StateCache& GetStateCache() const { return m_stateCache; }
+    const UploadRing& GetUploadRing() const { return m_uploadRing; }
+    const TextureLoader& GetTextureLoader() const { return m_textureLoader; }
+    const TextureStreamer& GetTextureStreamer() const { return m_textureStreamer; }
+    const FrameRecorder& GetFrameRecorder() const { return m_frameRecorder; }
+    const RenderGraph& GetRenderGraph() const { return m_renderGraph; }
+    Profiler& GetProfiler() { return m_profiler; }
+    // Passes record on deferred contexts on this many threads, or serially on the immediate context
+    void SetRecordThreads(UINT threadCount) { m_frameRecorder.SetThreadCount(threadCount); }
+    void SetUseDeferredRecording(bool useDeferred) { m_frameRecorder.SetUseDeferredContexts(useDeferred); }
+    void SetTextureBudget(UINT64 bytes) { m_textureStreamer.SetBudget(bytes); }
+    // The first LightCount lights orbit the middle of the scene, the rest are
+    // scattered around it. Without clustering lights past LightCount are not
+    // shaded; only the first LightCount are drawn.
+    void SetActiveLights(UINT count);
+    UINT GetActiveLights() const { return m_activeLights; }
+    void SetUseClusteredLighting(bool useClustered) { m_useClusteredLighting = useClustered; }
+    void SetUseComputeClusters(bool useCompute) { m_useComputeClusters = useCompute; }
+    void SetAnimateLights(bool animate) { m_animateLights = animate; }
+    const LightClusters& GetLightClusters() const { return m_lightClusters; }
+    // Entries of the cluster lists after the last CPU assignment
+    UINT GetClusterLightIndices() const { return m_clusterIndexCount; }
+    // Lights left out of full clusters, so shaded by fewer lights than touch
+    // them: of the last CPU assignment, or of a frame a few back with the
+    // compute shader
+    UINT GetClusterDroppedLights() const { return m_clusterDroppedLights; }
+    void SetUseNormalMap(bool useNormalMap) { m_useNormalMap = useNormalMap; }
+    // The cubes write a G-buffer and a tiled compute pass lights it, so a
+    // pixel runs the light loop once however often it is overdrawn. The same
+    // lights are shaded either way.
+    void SetUseDeferredShading(bool useDeferred) { m_useDeferredShading = useDeferred; }
+    bool GetUseDeferredShading() const { return m_useDeferredShading; }
+    void SetTransparencyMode(TransparencyMode mode) { m_transparencyMode = mode; }
+    // Cube map shadows of the lights in view that matter most, at most
+    // maxShadowed of them and updatesPerFrame drawn per frame; the others
+    // keep the faces of their last update
+    void SetUseShadows(bool useShadows) { m_useShadows = useShadows; }
+    void SetShadowLimits(UINT maxShadowed, UINT updatesPerFrame);
+    void SetShadowFaceSize(UINT faceSize) { m_shadowFaceSize = faceSize; }
+    const ShadowAtlas& GetShadowAtlas() const { return m_shadowAtlas; }
+    // Cubes drawn into the atlas last frame, once per face
+    UINT GetShadowCasterDraws() const { return m_shadowCasterDraws; }
+    // Spinning cubes are dynamic shadow casters, still ones are cached with the static casters
+    void SetSpinCubes(bool spin);
+    TransparencyMode GetTransparencyMode() const { return m_transparencyMode; }
+    // The first two quads are the animated pair of the original scene, the
+    // rest are scattered around it
+    HRESULT SetTranslucentCount(UINT count);
+    UINT GetTranslucentCount() const { return static_cast<UINT>(m_translucentQuads.size()); }
+    const TransparencyStats& GetTransparencyStats() const { return m_transparencyStats; }
+    // Features of the lit draws this frame
+    UINT GetFeatures() const;
+    UINT GetCompiledVariantCount() const;
 
 private:
     struct CubeVertex
@@ -124,22 +281,49 @@ private:
         float x, y, z;
     };
 
-    struct MatrixBuffer
-    {
-        XMMATRIX m;
-    };
-
     struct CameraBuffer
     {
         XMMATRIX vp;
         XMFLOAT3 cameraPos;
     };
 
-    struct ColorBuffer
+    // TranslucentQuad of ParallelogramVertex.vs
+    struct TranslucentQuad
     {
+        XMMATRIX model;
         XMFLOAT4 color;
     };
 
+    // DeferredConstants of DeferredLighting.cs
+    struct DeferredConstants
+    {
+        XMMATRIX invViewProj;   // transposed
+        XMMATRIX view;          // transposed
+        XMFLOAT3 cameraPos;
+        UINT lightCount;
+        UINT width;
+        UINT height;
+        XMFLOAT2 projScale;
+        XMFLOAT2 depthParams;
+        XMFLOAT2 padding;
+    };
+
+    // OitConstants of Transparency.hlsli
+    struct OitConstants
+    {
+        UINT width;
+        UINT nodeCapacity;
+        UINT padding[2];
+    };
+
+    // OitNode of Transparency.hlsli
+    struct OitNode
+    {
+        float depth;
+        UINT next;
+        UINT color[2];
+    };
+
     struct PointLight
     {
         XMFLOAT3 Position;
@@ -148,7 +332,17 @@ private:
         float Intensity;
     };
 
-    struct FullScreenVertex 
+    // A scattered light circles the y axis
+    struct SceneLight
+    {
+        float orbitRadius;
+        float orbitPhase;
+        float orbitSpeed;
+        float height;
+        PointLight light;
+    };
+
+    struct FullScreenVertex
     {
         float x, y, z, w;
         float u, v;
@@ -158,87 +352,345 @@ private:
     {
         XMMATRIX model;
         UINT texInd;
-        UINT countInstance;
-        XMFLOAT2 padding;
+        XMFLOAT3 extent;
     };
 
-    HRESULT ConfigureBackBuffer(UINT width, UINT height);
-
-    ID3D11Device* m_pDevice;
-    ID3D11DeviceContext* m_pDeviceContext;
+    struct CullingConstants
+    {
+        XMFLOAT4 planes[6];
+        UINT instanceCount;
+        UINT phase;             // 0 frustum only, 1 and 2 the passes of occlusion culling
+        UINT hiZLevelCount;     // 0 without a pyramid to test against
+        UINT hiZWidth;
+        XMMATRIX spin;      // rotation shared by every cube before its own transform, transposed
+        XMMATRIX occlusionViewProj;     // of the frame the pyramid was built in, transposed
+        XMFLOAT4 occlusionExtent;
+        XMFLOAT2 depthSize;
+        XMFLOAT2 padding;
+        HiZLevel hiZLevels[MaxHiZLevels];
+    };
 
-    IDXGISwapChain* m_pSwapChain;
-    ID3D11RenderTargetView* m_pRenderTargetView;
+    struct HiZConstants
+    {
+        HiZLevel source;
+        HiZLevel target;
+        UINT fromDepth;
+        UINT atlasWidth;
+        UINT padding[2];
+    };
 
-    ID3D11Buffer* m_pModelBuffer;
-    ID3D11Buffer* m_pVPBuffer;
+    // LightVertex.vs and LightPixel.ps share it, the color comes first so
+    // the pixel shader can bind the same range
+    struct LightObjectBuffer
+    {
+        XMFLOAT4 color;
+        XMMATRIX model;
+    };
 
-    ID3D11Buffer* m_pVertexBuffer;
-    ID3D11Buffer* m_pIndexBuffer;
+    // textures swapped in per frame while the loader catches up, bounds the hitch
+    static const UINT TexturesPerFrame = 4;
 
-    ID3D11PixelShader* m_pPixelShader;
-    ID3D11VertexShader* m_pVertexShader;
-    ID3D11InputLayout* m_pLayout;
+    // streamed mips of the cube textures, and how many textures may be
+    // rebuilt per frame to get there
+    static const UINT64 DefaultTextureBudget = 64ull * 1024 * 1024;
+    static const UINT TextureRebuildsPerFrame = 2;
 
-    ID3D11ShaderResourceView* m_pTextureView;
-    ID3D11SamplerState* m_pSamplerState;
+    // quads UpdateTranslucentQuads moves every frame
+    static const UINT AnimatedQuadCount = 2;
+    // Nodes of the linked lists for every pixel to start with. Fragments past
+    // the pool are dropped, and the pool grows once the counter comes back.
+    static const UINT OitNodesPerPixel = 4;
+    static const UINT MaxOitNodes = 1 << 24;
 
-    ID3D11ShaderResourceView* m_pNormalMapView;
+    enum class FramePass
+    {
+        Lights,         // cluster light lists
+        Shadows,        // the atlas slots due this frame
+        Skybox,         // clears the targets first
+        Cubes,          // one pass per CubesPerPass visible cubes
+        DeferredLighting,       // the lights over the G-buffer the cubes wrote
+        LightMarkers,
+        Parallelogram,          // the translucent quads, or their fragments with OIT
+        TransparencyResolve,    // composites the fragments over the scene
+        PostProcess
+    };
 
-    ID3D11ShaderResourceView* m_pSkyboxSRV;
-    ID3D11Buffer* m_pSkyboxVB;
-    ID3D11Buffer* m_pSkyboxVPBuffer;
-    ID3D11VertexShader* m_pSkyboxVS;
-    ID3D11PixelShader* m_pSkyboxPS;
-    ID3D11InputLayout* m_pSkyboxLayout;
-    ID3D11DepthStencilView* m_pDepthView;
+    struct FramePassDesc
+    {
+        FramePass pass;
+        UINT firstVisible;      // the cubes of a Cubes pass
+        UINT visibleCount;
+        UINT postStage;         // of a PostProcess pass
+    };
 
-    ID3D11Buffer* m_pColorBuffer;
-    ID3D11Buffer* m_ParallelogramVertexBuffer;
-    ID3D11Buffer* m_pParallelogramIndexBuffer;
+    // the index of the pass in the render graph
+    UINT AddFramePass(FramePass pass, UINT firstVisible, UINT visibleCount);
 
-    ID3D11PixelShader* m_pParallelogramPS;
-    ID3D11VertexShader* m_pParallelogramVS;
-    ID3D11InputLayout* m_pParallelogramLayout;
+    // What the passes of this frame share, prepared before they record
+    struct FramePassData
+    {
+        UINT features = 0;
+        RenderHandle cubeVS = NullHandle;
+        RenderHandle cubePS = NullHandle;
+        RenderHandle parallelogramPS = NullHandle;
+        RenderHandle oitResolvePS = NullHandle;
+        TransparencyMode transparency = TransparencyMode::Sorted;
+        RenderHandle skyboxDepthState = NullHandle;
+        RenderHandle skyboxRasterizer = NullHandle;
+        RenderHandle parallelogramRasterizer = NullHandle;
+        bool uploadClusterBounds = false;
+        XMMATRIX view;
+        RenderHandle argsReadback = NullHandle;     // copy target of this frame's draw arguments
+        RenderHandle clusterOverflowReadback = NullHandle;  // copy target of this frame's dropped lights
+        const UINT* visibleIndices = nullptr;       // CPU culling
+        bool buildHiZ = false;                      // occlusion culling with compute
+        XMFLOAT4* viewLights = nullptr;             // CPU light assignment
+        UINT* clusterRanges = nullptr;
+        UINT* clusterIndices = nullptr;
+        RenderHandle sceneColor = NullHandle;       // the back buffer unless an effect follows
+        RenderHandle depth = NullHandle;
+        bool deferred = false;                      // the cubes go into the G-buffer, cubePS writes it
+        RenderHandle deferredCS = NullHandle;
+        RenderHandle gBufferAlbedo = NullHandle;
+        RenderHandle gBufferNormals = NullHandle;
+        bool uploadLights = false;                  // no light pass uploads them this frame
+        RenderHandle oitAccum = NullHandle;         // weighted blended targets
+        RenderHandle oitWeight = NullHandle;
+        RenderHandle oitReadback = NullHandle;      // copy target of this frame's node count
+        RenderHandle postSources[PostMaxEffects] = {};
+        RenderHandle postTargets[PostMaxEffects] = {};  // the back buffer for the last stage
+        RenderHandle shadowVS = NullHandle;
+        RenderHandle shadowClearState = NullHandle;
+    };
 
-    ID3D11BlendState* m_pBlendState;
-    ID3D11DepthStencilState* m_pStateParallelogram;
+    // Where this frame's constants landed in the upload ring
+    struct FrameUploads
+    {
+        UploadAllocation skyboxCamera;
+        UploadAllocation camera;
+        UploadAllocation lights;
+        UploadAllocation culling;
+        UploadAllocation cullingDisoccluded;    // phase 2 of occlusion culling
+        UploadAllocation hiZLevels[MaxHiZLevels];
+        UploadAllocation clusters;
+        UploadAllocation lightObjects[LightCount];
+        UploadAllocation oit;
+        UploadAllocation postProcess[PostMaxEffects];
+        UploadAllocation shadows;
+        UploadAllocation shadowFaces[MaxShadowSlots][ShadowAtlas::FaceCount];
+        // the casters of the static and the dynamic layer of every update,
+        // ShadowCastersPerDraw a piece, in the frame arena
+        const UploadAllocation* shadowCasters[MaxShadowSlots][2] = {};
+        UINT shadowCasterCounts[MaxShadowSlots][2] = {};
+        UploadAllocation deferred;
+    };
 
-    ID3D11Buffer* m_pLightBuffer;
-    ID3D11PixelShader* m_pLightPixelShader;
+    HRESULT InitScene();
+    HRESULT ConfigureBackBuffer(UINT width, UINT height);
 
-    ID3D11Texture2D* m_pPostProcessTexture;
-    ID3D11RenderTargetView* m_pPostProcessRTV;
-    ID3D11ShaderResourceView* m_pPostProcessSRV;
-    ID3D11VertexShader* m_pPostProcessVS;
-    ID3D11PixelShader* m_pPostProcessPS;
-    ID3D11Buffer* m_pFullScreenVB;
-    ID3D11InputLayout* m_pFullScreenLayout;
-    bool m_useNegative = false;
+    void ReleaseHandle(RenderHandle& handle);
+
+    void BuildInstances(UINT count);
+    void AddInstance(const XMFLOAT3& position, UINT texInd);
+    HRESULT UploadInstances();
+    HRESULT ReserveInstances(UINT count);
+    void WriteVisibleInstances(const UINT* ids, UINT count, InstanceData* pInstances);
+    void SortVisibleCubes(UINT* visibleIndices, UINT visibleCount);
+    HRESULT ReserveClusters(UINT count);
+    void BuildTranslucentQuads(UINT count);
+    HRESULT ReserveTranslucentQuads(UINT count);
+    HRESULT UploadTranslucentQuads();
+    HRESULT ReserveOitLists();
+    // The scene color, or the G-buffer with deferred shading
+    void SetCubeTargets(RenderContext* pContext);
+    void DispatchCulling(RenderContext* pContext, const UploadAllocation& constants, RenderHandle target, UINT instanceCount);
+    void BuildHiZ(RenderContext* pContext);
+    // The cube and parallelogram pixel shaders read the lights the same way
+    void BindLights(RenderContext* pContext);
+    HRESULT ReserveShadowAtlas();
+    void UploadShadowLayer(UINT update, bool staticLayer, const UINT* cubes, UINT cubeCount, const UINT* markers, UINT markerCount);
+    void DrawShadowLayer(RenderContext* pContext, UINT update, bool staticLayer);
+
+    RenderDevice* m_pDevice;
+    RenderContext* m_pContext;
+    bool m_ownsDevice;
+#ifdef _WIN32
+    D3D11RenderDevice* m_pD3DDevice = nullptr;
+    double m_startupSeconds = 0.0;      // Init(HWND) up to the first frame
+#endif
 
-    ID3D11ComputeShader* m_pComputeShader;
-    ID3D11Buffer* m_pFrustumPlanesBuffer;
-    ID3D11Buffer* m_pIndirectArgsBuffer;
-    ID3D11Buffer* m_pObjectsIdsBuffer;
-    ID3D11UnorderedAccessView* m_pIndirectArgsUAV;
-    ID3D11UnorderedAccessView* m_pObjectsIdsUAV;
-    ID3D11ShaderResourceView* m_pInstanceDataSRV;
+    UINT m_width;
+    UINT m_height;
+
+    StateCache m_stateCache;
+    UploadRing m_uploadRing;
+    FrameArena m_frameArena;
+    TextureLoader m_textureLoader;
+    TextureStreamer m_textureStreamer;
+    bool m_waitForTextures = false;     // headless runs stream synchronously to stay deterministic
+    float m_sceneRadius = 0.0f;         // of the outermost ring of cubes
+    FrameUploads m_frameUploads;
+    FrameRecorder m_frameRecorder;
+    std::unique_ptr<ThreadPool> m_pSortPool;     // for the render queues, large ones sort in parallel
+    RenderGraph m_renderGraph;
+    Profiler m_profiler;
+    std::vector<FramePassDesc> m_framePasses;
+    FramePassData m_passData;
+    Viewport m_viewport;
+
+    RenderHandle m_pRenderTargetView;
+
+    RenderHandle m_pVertexBuffer;
+    RenderHandle m_pIndexBuffer;
+
+    ShaderVariants m_cubeVS;
+    ShaderVariants m_cubePS;
+    RenderHandle m_pLayout;
+
+    // Deferred shading: the albedo and the octahedral normals, the depth
+    // buffer gives the position
+    ShaderVariants m_gBufferPS;
+    ShaderVariants m_deferredCS;
+    bool m_useDeferredShading = false;
+
+    RenderHandle m_pTextureView;
+    RenderHandle m_pSamplerState;
+
+    RenderHandle m_pNormalMapView;
+
+    RenderHandle m_pSkyboxSRV;
+    RenderHandle m_pSkyboxVB;
+    RenderHandle m_pSkyboxVS;
+    RenderHandle m_pSkyboxPS;
+    RenderHandle m_pSkyboxLayout;
+
+    RenderHandle m_ParallelogramVertexBuffer;
+    RenderHandle m_pParallelogramIndexBuffer;
+
+    ShaderVariants m_parallelogramPS;
+    RenderHandle m_pParallelogramVS;
+    RenderHandle m_pParallelogramLayout;
+
+    RenderHandle m_pBlendState;
+    RenderHandle m_pStateParallelogram;
+
+    std::vector<TranslucentQuad> m_translucentQuads;    // as uploaded, the models transposed
+    std::vector<XMFLOAT3> m_translucentCenters;
+    std::vector<UINT> m_translucentOrder;               // drawing order, back to front when sorted
+    RenderQueue m_translucentQueue;
+    RenderHandle m_pTranslucentQuads = NullHandle;
+    RenderHandle m_pTranslucentOrder = NullHandle;
+    UINT m_translucentCount = AnimatedQuadCount;
+    UINT m_translucentCapacity = 0;
+    bool m_translucentQuadsChanged = false;     // all of them, otherwise only the animated pair is uploaded
+    bool m_translucentOrderChanged = false;
+    bool m_translucentOrderSorted = false;      // not the identity
+    TransparencyMode m_transparencyMode = TransparencyMode::WeightedBlended;
+    TransparencyStats m_transparencyStats;
+
+    ShaderVariants m_oitResolvePS;
+    RenderHandle m_pOitAccumBlend = NullHandle;
+    RenderHandle m_pOitResolveBlend = NullHandle;
+
+    RenderHandle m_pLightVertexShader;
+    RenderHandle m_pLightPixelShader;
+
+    RenderHandle m_pPostProcessVS;
+    RenderHandle m_pPostProcessCS;
+    RenderHandle m_pFullScreenVB;
+    RenderHandle m_pFullScreenLayout;
+    PostProcessChain m_postProcess;
+    bool m_useNormalMap = true;     // when the map could be loaded
+    UINT m_activeLights = LightCount;
+    std::vector<SceneLight> m_sceneLights;
+    std::vector<PointLight> m_frameLights;  // every active light in world space, this frame
+
+    LightClusters m_lightClusters;
+    RenderHandle m_pLightData;              // the frame lights for the cluster lists
+    RenderHandle m_pClusterShader;
+    RenderHandle m_pClusterBounds;
+    RenderHandle m_pClusterRanges;
+    RenderHandle m_pClusterIndices;
+    UINT m_clusterCapacity = 0;
+    bool m_clusterBoundsChanged = false;
+    UINT m_clusterIndexCount = 0;
+    UINT m_clusterDroppedLights = 0;
+    bool m_useClusteredLighting = true;
+    bool m_useComputeClusters = true;
+    bool m_animateLights = true;
+
+    // Two atlases of the same layout, the static casters and the dynamic ones
+    ShadowAtlas m_shadowAtlas;
+    RenderHandle m_pStaticShadowAtlas = NullHandle;
+    RenderHandle m_pDynamicShadowAtlas = NullHandle;
+    RenderHandle m_pShadowClearVB = NullHandle;     // a full screen triangle at the far plane
+    bool m_useShadows = false;
+    UINT m_shadowFaceSize = 256;
+    UINT m_maxShadowedLights = 4;
+    UINT m_shadowUpdatesPerFrame = 2;
+    UINT m_staticCasterVersion = 0;     // changes whenever the cached casters do
+    UINT m_shadowCasterDraws = 0;
+    bool m_spinCubes = true;
+
+    RenderHandle m_pComputeShader;
+    RenderHandle m_pIndirectArgsBuffer;
+    RenderHandle m_pIndirectArgsInit;       // twice 36 indices, 0 instances: copied over the args before culling
+    static const UINT ArgsReadbackLatency = 3;
+    RenderHandle m_pArgsReadback[ArgsReadbackLatency] = {};
+    UINT m_argsReadbackIndex = 0;
+    RenderHandle m_pInstanceDataSRV;
+    bool m_useComputeCulling = true;
+
+    // lights LightClusters.cs had no room for, read back like the counts above
+    RenderHandle m_pClusterOverflow = NullHandle;
+    RenderHandle m_pClusterOverflowReadback[ArgsReadbackLatency] = {};
+    UINT m_clusterOverflowReadbackIndex = 0;
+
+    // the per pixel lists of LinkedList transparency
+    RenderHandle m_pOitCounter = NullHandle;
+    RenderHandle m_pOitHeads = NullHandle;      // the first node of every pixel
+    RenderHandle m_pOitNodes = NullHandle;
+    RenderHandle m_pOitCountReadback[ArgsReadbackLatency] = {};
+    UINT m_oitReadbackIndex = 0;
+    UINT m_oitNodeCapacity = 0;
+
+    // Two phase occlusion culling: the cubes the last frame's pyramid does
+    // not hide are drawn, a pyramid is built from their depth, and the ones
+    // it hid are tested again against it and drawn with the second half of
+    // the arguments
+    RenderHandle m_pHiZShader = NullHandle;
+    RenderHandle m_pHiZ = NullHandle;                   // every level in one R32_FLOAT texture
+    RenderHandle m_pOccludedInstances = NullHandle;     // a flag per instance from phase 1
+    RenderHandle m_pDisoccludedInst = NullHandle;       // the visible instances of phase 2
+    HiZLayout m_hiZLayout;
+    bool m_hiZValid = false;            // the pyramid holds the last frame's depth
+    XMMATRIX m_hiZViewProj;             // that frame's view and projection
+    XMMATRIX m_viewProj;
+    bool m_useOcclusionCulling = false;
+    SoftwareOcclusion m_softwareOcclusion;
 
     const float m_fixedScale = 0.5f;
-    ID3D11Buffer* m_pModelBufferInst;
-    static const int MaxInst = 23;
-    std::vector<InstanceData> m_modelInstances = {};
+    RenderHandle m_pModelBufferInst;
+    std::vector<RenderHandle> m_instanceUploads;    // Dynamic, the visible instances of every CPU culled pass
+    UINT m_instanceCount = 23;
+    UINT m_instanceCapacity = 0;
+    InstanceStore m_instances;
+    BoundingVolumeHierarchy m_cubeBvh;
+    bool m_useBvhCulling = true;
+    RenderQueue m_cubeQueue;
+    bool m_sortOpaqueDraws = true;
 
     XMVECTOR m_frustumPlanes[6];
 
     float m_CubeAngle = 0.0f;
-    WCHAR* m_szTitle;
-    WCHAR* m_szWindowClass;
+    float m_LightAngle = 0.0f;
+    float m_ParallelogramAngle = 0.0f;
 
-    XMFLOAT3 m_CameraPosition; 
+    XMFLOAT3 m_CameraPosition;
     float m_CameraSpeed;
     float m_LRAngle;    //turn left/right
     float m_UDAngle;    //turn up / down
+    UINT m_syncInterval = 1;
 
     int m_visibleCubes = 0;
 
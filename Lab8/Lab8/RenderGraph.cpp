@@ -0,0 +1,393 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+
+static bool SameDesc(const TextureDesc& a, const TextureDesc& b)
+{
+    return a.width == b.width && a.height == b.height && a.format == b.format && a.bindFlags == b.bindFlags &&
+        a.mipLevels == b.mipLevels && a.arraySize == b.arraySize && a.cube == b.cube;
+}
+
+static UINT BitsPerTexel(Format format)
+{
+    switch (format)
+    {
+    case Format::R32G32B32A32_FLOAT: return 128;
+    case Format::R32G32B32_FLOAT: return 96;
+    case Format::R32G32_FLOAT: return 64;
+    case Format::R16G16B16A16_UNORM: return 64;
+    case Format::R16_UINT: return 16;
+    case Format::BC1_UNORM: return 4;
+    case Format::BC2_UNORM:
+    case Format::BC3_UNORM: return 8;
+    default: return 32;
+    }
+}
+
+static UINT64 TextureBytes(const TextureDesc& desc)
+{
+    UINT64 texels = 0;
+    for (UINT mip = 0; mip < desc.mipLevels; mip++)
+    {
+        texels += (UINT64)std::max(desc.width >> mip, 1u) * std::max(desc.height >> mip, 1u);
+    }
+    return texels * desc.arraySize * BitsPerTexel(desc.format) / 8;
+}
+
+RenderGraph::RenderGraph() :
+    m_pDevice(nullptr)
+{
+}
+
+void RenderGraph::Reset()
+{
+    m_passes.clear();
+    m_resources.clear();
+    m_accesses.clear();
+    m_order.clear();
+    m_unbinds.clear();
+    m_physicalDescs.clear();
+}
+
+GraphResource RenderGraph::CreateTexture(const char* name, const TextureDesc& desc)
+{
+    Resource resource = {};
+    resource.name = name;
+    resource.desc = desc;
+    resource.transient = true;
+    resource.physical = InvalidGraphResource;
+    m_resources.push_back(resource);
+    return static_cast<GraphResource>(m_resources.size() - 1);
+}
+
+GraphResource RenderGraph::ImportResource(const char* name, RenderHandle handle)
+{
+    Resource resource = {};
+    resource.name = name;
+    resource.imported = handle;
+    resource.physical = InvalidGraphResource;
+    m_resources.push_back(resource);
+    return static_cast<GraphResource>(m_resources.size() - 1);
+}
+
+void RenderGraph::SetOutput(GraphResource resource)
+{
+    m_resources[resource].output = true;
+}
+
+UINT RenderGraph::AddPass(const char* name, UINT userData)
+{
+    Pass pass = {};
+    pass.name = name;
+    pass.userData = userData;
+    m_passes.push_back(pass);
+    return static_cast<UINT>(m_passes.size() - 1);
+}
+
+void RenderGraph::SetSideEffect(UINT pass)
+{
+    m_passes[pass].sideEffect = true;
+}
+
+void RenderGraph::AddAccess(UINT pass, GraphResource resource, UINT flags, ShaderStage stage, UINT slot)
+{
+    Access access;
+    access.pass = pass;
+    access.resource = resource;
+    access.flags = flags;
+    access.stage = stage;
+    access.slot = slot;
+    m_accesses.push_back(access);
+}
+
+void RenderGraph::Read(UINT pass, GraphResource resource)
+{
+    AddAccess(pass, resource, AccessRead, ShaderStage::Pixel, 0);
+}
+
+void RenderGraph::Read(UINT pass, GraphResource resource, ShaderStage stage, UINT slot)
+{
+    AddAccess(pass, resource, AccessRead | AccessBound, stage, slot);
+}
+
+void RenderGraph::Write(UINT pass, GraphResource resource)
+{
+    AddAccess(pass, resource, AccessWrite, ShaderStage::Pixel, 0);
+}
+
+HRESULT RenderGraph::Compile()
+{
+    m_order.clear();
+    m_unbinds.clear();
+    m_physicalDescs.clear();
+    for (Resource& resource : m_resources)
+    {
+        resource.needed = resource.output;
+        resource.written = false;
+        resource.firstUse = InvalidGraphResource;
+        resource.lastUse = InvalidGraphResource;
+        resource.physical = InvalidGraphResource;
+    }
+
+    CullPasses();
+    HRESULT result = SortPasses();
+    if (FAILED(result))
+        return result;
+    AliasTextures();
+    FindUnbinds();
+    return S_OK;
+}
+
+// A pass is kept if it has a side effect or writes a resource that is
+// needed; what a kept pass reads is needed in turn.
+void RenderGraph::CullPasses()
+{
+    for (Pass& pass : m_passes)
+    {
+        pass.culled = !pass.sideEffect;
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (const Access& access : m_accesses)
+        {
+            Pass& pass = m_passes[access.pass];
+            Resource& resource = m_resources[access.resource];
+            if ((access.flags & AccessWrite) && pass.culled && resource.needed)
+            {
+                pass.culled = false;
+                changed = true;
+            }
+            if ((access.flags & AccessRead) && !pass.culled && !resource.needed)
+            {
+                resource.needed = true;
+                changed = true;
+            }
+        }
+    }
+
+    m_stats = RenderGraphStats();
+    m_stats.passes = static_cast<UINT>(m_passes.size());
+    for (const Pass& pass : m_passes)
+    {
+        if (pass.culled)
+            m_stats.culledPasses++;
+    }
+}
+
+// Writers of a resource form a chain in declaration order and its readers
+// follow the last one. Among the passes that are ready the one declared
+// first runs first, so independent passes keep the order they came in.
+HRESULT RenderGraph::SortPasses()
+{
+    m_edges.clear();
+    for (GraphResource resource = 0; resource < m_resources.size(); resource++)
+    {
+        m_writers.clear();
+        for (const Access& access : m_accesses)
+        {
+            if (access.resource == resource && (access.flags & AccessWrite) && !m_passes[access.pass].culled)
+                m_writers.push_back(access.pass);
+        }
+        if (m_writers.empty())
+            continue;
+
+        m_resources[resource].written = true;
+        std::sort(m_writers.begin(), m_writers.end());
+        m_writers.erase(std::unique(m_writers.begin(), m_writers.end()), m_writers.end());
+        for (size_t i = 1; i < m_writers.size(); i++)
+        {
+            m_edges.push_back({ m_writers[i - 1], m_writers[i] });
+        }
+
+        for (const Access& access : m_accesses)
+        {
+            if (access.resource != resource || !(access.flags & AccessRead) || m_passes[access.pass].culled)
+                continue;
+            // a pass that also writes the resource is already in the chain
+            if (!std::binary_search(m_writers.begin(), m_writers.end(), access.pass))
+                m_edges.push_back({ m_writers.back(), access.pass });
+        }
+    }
+
+    const UINT passCount = static_cast<UINT>(m_passes.size());
+    m_inDegree.assign(passCount, 0);
+    for (const Edge& edge : m_edges)
+    {
+        m_inDegree[edge.after]++;
+    }
+
+    UINT keptCount = passCount - m_stats.culledPasses;
+    while (m_order.size() < keptCount)
+    {
+        UINT next = passCount;
+        for (UINT pass = 0; pass < passCount; pass++)
+        {
+            if (!m_passes[pass].culled && m_inDegree[pass] == 0)
+            {
+                next = pass;
+                break;
+            }
+        }
+        if (next == passCount)
+            return E_FAIL;
+
+        m_order.push_back(next);
+        m_inDegree[next] = InvalidGraphResource;
+        for (const Edge& edge : m_edges)
+        {
+            if (edge.before == next)
+                m_inDegree[edge.after]--;
+        }
+    }
+    return S_OK;
+}
+
+// Transient textures live from the first to the last executed pass that
+// touches them. Walking the passes in order, a texture takes a free physical
+// texture of the same description when it comes to life and gives it back
+// after its last pass.
+void RenderGraph::AliasTextures()
+{
+    for (UINT position = 0; position < m_order.size(); position++)
+    {
+        for (const Access& access : m_accesses)
+        {
+            if (access.pass != m_order[position])
+                continue;
+            Resource& resource = m_resources[access.resource];
+            if (resource.firstUse == InvalidGraphResource)
+                resource.firstUse = position;
+            resource.lastUse = position;
+        }
+    }
+
+    m_freePhysical.clear();
+    for (UINT position = 0; position < m_order.size(); position++)
+    {
+        for (Resource& resource : m_resources)
+        {
+            if (!resource.transient || resource.firstUse != position)
+                continue;
+
+            m_stats.transientTextures++;
+            m_stats.transientBytes += TextureBytes(resource.desc);
+
+            for (size_t i = 0; i < m_freePhysical.size(); i++)
+            {
+                if (SameDesc(m_physicalDescs[m_freePhysical[i]], resource.desc))
+                {
+                    resource.physical = m_freePhysical[i];
+                    m_freePhysical.erase(m_freePhysical.begin() + i);
+                    break;
+                }
+            }
+            if (resource.physical == InvalidGraphResource)
+            {
+                resource.physical = static_cast<UINT>(m_physicalDescs.size());
+                m_physicalDescs.push_back(resource.desc);
+                m_stats.physicalBytes += TextureBytes(resource.desc);
+            }
+        }
+
+        for (const Resource& resource : m_resources)
+        {
+            if (resource.transient && resource.lastUse == position)
+                m_freePhysical.push_back(resource.physical);
+        }
+    }
+    m_stats.physicalTextures = static_cast<UINT>(m_physicalDescs.size());
+}
+
+// A slot still bound to a texture would keep D3D11 from binding it as a
+// target again, whether by a later pass, the next frame, or another
+// transient placed on the same memory. Slots of resources nobody writes
+// can stay bound.
+void RenderGraph::FindUnbinds()
+{
+    for (UINT pass = 0; pass < m_passes.size(); pass++)
+    {
+        m_passes[pass].firstUnbind = static_cast<UINT>(m_unbinds.size());
+        m_passes[pass].unbindCount = 0;
+        if (m_passes[pass].culled)
+            continue;
+
+        for (const Access& access : m_accesses)
+        {
+            if (access.pass != pass || !(access.flags & AccessBound))
+                continue;
+
+            const Resource& resource = m_resources[access.resource];
+            if (resource.written || resource.transient)
+            {
+                m_unbinds.push_back({ access.stage, access.slot });
+                m_passes[pass].unbindCount++;
+            }
+        }
+    }
+}
+
+void RenderGraph::RecordUnbinds(UINT pass, RenderContext* pContext) const
+{
+    for (UINT i = 0; i < GetUnbindCount(pass); i++)
+    {
+        const Unbind& unbind = GetUnbind(pass, i);
+        pContext->SetShaderResource(unbind.stage, unbind.slot, NullHandle);
+    }
+}
+
+HRESULT RenderGraph::Allocate(RenderDevice* pDevice)
+{
+    m_pDevice = pDevice;
+
+    // textures the graph no longer asks for go first
+    while (m_physical.size() > m_physicalDescs.size())
+    {
+        if (m_physical.back().handle)
+            m_pDevice->Release(m_physical.back().handle);
+        m_physical.pop_back();
+    }
+    m_physical.resize(m_physicalDescs.size(), PhysicalTexture());
+
+    for (size_t i = 0; i < m_physicalDescs.size(); i++)
+    {
+        PhysicalTexture& texture = m_physical[i];
+        if (texture.handle && SameDesc(texture.desc, m_physicalDescs[i]))
+            continue;
+
+        if (texture.handle)
+            m_pDevice->Release(texture.handle);
+        texture.handle = NullHandle;
+        texture.desc = m_physicalDescs[i];
+
+        HRESULT result = m_pDevice->CreateTexture(texture.desc, nullptr, &texture.handle);
+        if (FAILED(result))
+        {
+            texture.handle = NullHandle;
+            return result;
+        }
+    }
+    return S_OK;
+}
+
+RenderHandle RenderGraph::GetHandle(GraphResource resource) const
+{
+    const Resource& graphResource = m_resources[resource];
+    if (!graphResource.transient)
+        return graphResource.imported;
+    if (graphResource.physical >= m_physical.size())
+        return NullHandle;
+    return m_physical[graphResource.physical].handle;
+}
+
+void RenderGraph::ReleaseTextures()
+{
+    for (PhysicalTexture& texture : m_physical)
+    {
+        if (texture.handle)
+            m_pDevice->Release(texture.handle);
+    }
+    m_physical.clear();
+}
@@ -0,0 +1,177 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "RenderBackend.h"
+
+#include <vector>
+
+// Index of a resource in the graph of one frame
+typedef UINT GraphResource;
+const GraphResource InvalidGraphResource = ~0u;
+
+struct RenderGraphStats
+{
+    UINT passes = 0;                // declared
+    UINT culledPasses = 0;          // whose writes nobody reads
+    UINT transientTextures = 0;     // created by the graph, not imported
+    UINT physicalTextures = 0;      // the textures they alias onto
+    UINT64 transientBytes = 0;      // if every transient texture had memory of its own
+    UINT64 physicalBytes = 0;
+};
+
+// Passes of a frame that declare which resources they read and write. The
+// graph is declared again every frame, Compile() then
+//  - orders the passes: a pass that reads a resource runs after every pass
+//    that writes it, writers of the same resource run in declaration order,
+//  - culls the passes whose writes reach no output nor side effect,
+//  - lists the shader resource slots to unbind after a pass, wherever the
+//    resource it read is written by a pass of the graph or is transient, and
+//  - places the transient textures that are not in use at the same time on
+//    the same physical texture, if their descriptions are the same.
+// A pass that reads a resource sees its final contents; a chain of effects
+// ping-pongs between two transient textures instead. The first pass to
+// write a transient texture must clear it or overwrite all of it.
+//
+// Declaring and compiling only touch memory, so the graph can be built and
+// checked without a device. Allocate() then creates the physical textures,
+// and keeps them from frame to frame while the graph stays the same.
+class RenderGraph
+{
+public:
+    RenderGraph();
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // Starts declaring the next frame, the physical textures stay
+    void Reset();
+
+    GraphResource CreateTexture(const char* name, const TextureDesc& desc);
+    // A resource the graph does not own, e.g. the back buffer or a buffer
+    // written with UpdateBuffer
+    GraphResource ImportResource(const char* name, RenderHandle handle);
+    // The frame is not done until the resource has been written, the passes
+    // that write it are never culled
+    void SetOutput(GraphResource resource);
+
+    // userData is handed back by GetPassData(), e.g. what to record
+    UINT AddPass(const char* name, UINT userData);
+    // The pass changes something outside the graph and is never culled
+    void SetSideEffect(UINT pass);
+    void Read(UINT pass, GraphResource resource);
+    // Read through a shader resource slot, the graph unbinds it after the pass if needed
+    void Read(UINT pass, GraphResource resource, ShaderStage stage, UINT slot);
+    void Write(UINT pass, GraphResource resource);
+
+    // E_FAIL if the passes depend on each other in a cycle
+    HRESULT Compile();
+
+    // Passes that survived culling, in execution order
+    UINT GetExecutedPassCount() const { return static_cast<UINT>(m_order.size()); }
+    UINT GetExecutedPass(UINT index) const { return m_order[index]; }
+    UINT GetPassData(UINT pass) const { return m_passes[pass].userData; }
+    const char* GetPassName(UINT pass) const { return m_passes[pass].name; }
+    bool IsPassCulled(UINT pass) const { return m_passes[pass].culled; }
+
+    struct Unbind
+    {
+        ShaderStage stage;
+        UINT slot;
+    };
+    // Slots to set to NullHandle once the pass has recorded
+    UINT GetUnbindCount(UINT pass) const { return m_passes[pass].unbindCount; }
+    const Unbind& GetUnbind(UINT pass, UINT index) const { return m_unbinds[m_passes[pass].firstUnbind + index]; }
+    void RecordUnbinds(UINT pass, RenderContext* pContext) const;
+
+    // Physical texture of a transient, InvalidGraphResource if it is imported or never used
+    UINT GetPhysicalIndex(GraphResource resource) const { return m_resources[resource].physical; }
+
+    // Creates the physical textures Compile() asked for, reusing those of
+    // the last frame that still fit. Only from the thread that owns the device.
+    HRESULT Allocate(RenderDevice* pDevice);
+    // The imported handle, or the physical texture after Allocate()
+    RenderHandle GetHandle(GraphResource resource) const;
+    void ReleaseTextures();
+
+    const RenderGraphStats& GetStats() const { return m_stats; }
+
+private:
+    enum AccessFlags : UINT
+    {
+        AccessRead = 0x1,
+        AccessWrite = 0x2,
+        AccessBound = 0x4,      // read through stage and slot
+    };
+
+    struct Pass
+    {
+        const char* name;
+        UINT userData;
+        bool sideEffect;
+        bool culled;
+        UINT firstUnbind;
+        UINT unbindCount;
+    };
+
+    struct Resource
+    {
+        const char* name;
+        TextureDesc desc;
+        RenderHandle imported;
+        bool transient;
+        bool output;
+        bool needed;            // read by a kept pass or an output, while compiling
+        bool written;           // by a kept pass
+        UINT firstUse;          // positions in m_order, while compiling
+        UINT lastUse;
+        UINT physical;
+    };
+
+    struct Access
+    {
+        UINT pass;
+        GraphResource resource;
+        UINT flags;
+        ShaderStage stage;
+        UINT slot;
+    };
+
+    struct PhysicalTexture
+    {
+        TextureDesc desc;
+        RenderHandle handle;
+    };
+
+    struct Edge
+    {
+        UINT before;
+        UINT after;
+    };
+
+    void AddAccess(UINT pass, GraphResource resource, UINT flags, ShaderStage stage, UINT slot);
+    void CullPasses();
+    HRESULT SortPasses();
+    void FindUnbinds();
+    void AliasTextures();
+
+    std::vector<Pass> m_passes;
+    std::vector<Resource> m_resources;
+    std::vector<Access> m_accesses;
+
+    // compiled
+    std::vector<UINT> m_order;
+    std::vector<Unbind> m_unbinds;
+    std::vector<TextureDesc> m_physicalDescs;   // wanted by Compile()
+    std::vector<PhysicalTexture> m_physical;    // created by Allocate(), kept between frames
+
+    // scratch of Compile(), kept so that a settled frame does not allocate
+    std::vector<Edge> m_edges;
+    std::vector<UINT> m_writers;
+    std::vector<UINT> m_inDegree;
+    std::vector<UINT> m_freePhysical;
+
+    RenderDevice* m_pDevice;
+    RenderGraphStats m_stats;
+};
+
+#endif
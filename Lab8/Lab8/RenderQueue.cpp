@@ -0,0 +1,33 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+
+namespace
+{
+    inline UINT64 Field(UINT value, UINT bits, UINT shift)
+    {
+        return (static_cast<UINT64>(value) & ((1ull << bits) - 1)) << shift;
+    }
+
+    inline UINT QuantizeDepth(float depth, UINT bits)
+    {
+        const float maxValue = static_cast<float>((1u << bits) - 1);
+        return static_cast<UINT>(std::min(std::max(depth, 0.0f), 1.0f) * maxValue + 0.5f);
+    }
+}
+
+UINT64 RenderQueue::MakeOpaqueKey(UINT pass, UINT shader, UINT texture, float depth)
+{
+    return Field(pass, 4, 60) | Field(shader, 8, 52) | Field(texture, 12, 40) | Field(QuantizeDepth(depth, 16), 16, 24);
+}
+
+UINT64 RenderQueue::MakeTransparentKey(UINT pass, UINT shader, UINT texture, float depth)
+{
+    const UINT farFirst = (1u << 24) - 1 - QuantizeDepth(depth, 24);
+    return Field(pass, 4, 60) | Field(farFirst, 24, 36) | Field(shader, 6, 30) | Field(texture, 6, 24);
+}
+
+void RenderQueue::Sort(ThreadPool* pPool)
+{
+    m_sorter.Sort(m_keys, pPool, ItemBits);
+}
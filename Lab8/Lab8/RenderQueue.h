@@ -0,0 +1,49 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+
+#include "Platform.h"
+#include "RadixSort.h"
+
+// Draws of a frame ordered by 64 bit keys. The upper 40 bits are the key,
+// the lower 24 the item the caller added, so sorting only the key bits
+// leaves draws with equal keys in the order they were added.
+//
+// Opaque keys, state first and then front to back within a state:
+//   pass 60-63, shader 52-59, texture 40-51, depth 24-39
+// Transparent keys, back to front, the state only between equal depths:
+//   pass 60-63, far depth first 36-59, shader 30-35, texture 24-29
+class RenderQueue
+{
+public:
+    static const UINT ItemBits = 24;
+    static const UINT MaxItems = 1u << ItemBits;
+
+    // depth is in [0, 1], 0 at the camera; fields wider than their bits are cut
+    static UINT64 MakeOpaqueKey(UINT pass, UINT shader, UINT texture, float depth);
+    static UINT64 MakeTransparentKey(UINT pass, UINT shader, UINT texture, float depth);
+
+    void Clear() { m_keys.clear(); }
+    void Reserve(UINT count) { m_keys.reserve(count); }
+
+    // item must be below MaxItems
+    void Add(UINT64 key, UINT item) { m_keys.push_back((key & ~ItemMask) | item); }
+
+    // pPool may be null, small queues sort on the calling thread anyway
+    void Sort(ThreadPool* pPool);
+
+    UINT GetCount() const { return static_cast<UINT>(m_keys.size()); }
+    UINT GetItem(UINT index) const { return static_cast<UINT>(m_keys[index] & ItemMask); }
+    UINT64 GetKey(UINT index) const { return m_keys[index] & ~ItemMask; }
+
+    const RadixSortStats& GetStats() const { return m_sorter.GetStats(); }
+
+private:
+    static const UINT64 ItemMask = (1ull << ItemBits) - 1;
+
+    std::vector<UINT64> m_keys;
+    RadixSorter m_sorter;
+};
+
+#endif
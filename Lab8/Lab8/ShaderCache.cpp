@@ -0,0 +1,237 @@
+#include "ShaderCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+const WCHAR ShaderCache::DefaultPath[] = L"shaders.pack";
+
+static const UINT PackMagic = 0x4B504853;      // "SHPK"
+static const UINT PackVersion = 1;
+static const UINT MaxIncludeDepth = 16;
+
+struct PackHeader
+{
+    UINT magic;
+    UINT version;
+    UINT count;
+    UINT reserved;
+};
+
+struct PackEntry
+{
+    UINT64 key;
+    UINT offset;
+    UINT size;
+};
+
+// 64-bit FNV-1a
+static const UINT64 HashSeed = 14695981039346656037ull;
+
+static UINT64 Hash(UINT64 hash, const void* pData, size_t size)
+{
+    const BYTE* pBytes = static_cast<const BYTE*>(pData);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ pBytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Strings are hashed with their terminator, so "a" "bc" and "ab" "c" differ
+static UINT64 HashString(UINT64 hash, const char* text)
+{
+    return Hash(hash, text ? text : "", text ? strlen(text) + 1 : 1);
+}
+
+// Hashes the file and, depth first, every file it includes. Includes are
+// looked up next to the including file, like D3D_COMPILE_STANDARD_FILE_INCLUDE
+// does; one that is not found only contributes its name.
+static HRESULT HashSourceFile(UINT64& hash, const std::wstring& path, UINT depth)
+{
+    MappedFile file;
+    HRESULT result = file.Open(path);
+    if (FAILED(result))
+        return result;
+
+    const char* pText = reinterpret_cast<const char*>(file.GetData());
+    const char* pEnd = pText + file.GetSize();
+    hash = Hash(hash, pText, file.GetSize());
+    if (depth >= MaxIncludeDepth)
+        return S_OK;
+
+    std::wstring folder = path.substr(0, path.find_last_of(L"/\\") + 1);
+    for (const char* pLine = pText; pLine < pEnd;)
+    {
+        const char* pLineEnd = std::find(pLine, pEnd, '\n');
+        const char* p = pLine;
+        while (p < pLineEnd && (*p == ' ' || *p == '\t'))
+            p++;
+
+        static const char Directive[] = "#include";
+        const size_t directiveLength = sizeof(Directive) - 1;
+        if (static_cast<size_t>(pLineEnd - p) > directiveLength && memcmp(p, Directive, directiveLength) == 0)
+        {
+            const char* pOpen = std::find_if(p + directiveLength, pLineEnd, [](char c) { return c == '"' || c == '<'; });
+            const char* pClose = pOpen < pLineEnd ? std::find(pOpen + 1, pLineEnd, *pOpen == '"' ? '"' : '>') : pLineEnd;
+            if (pClose < pLineEnd)
+            {
+                std::string name(pOpen + 1, pClose);
+                if (FAILED(HashSourceFile(hash, folder + std::wstring(name.begin(), name.end()), depth + 1)))
+                    hash = HashString(hash, name.c_str());
+            }
+        }
+        pLine = pLineEnd + 1;
+    }
+    return S_OK;
+}
+
+static FILE* OpenForWrite(const std::wstring& path)
+{
+#ifdef _WIN32
+    return _wfopen(path.c_str(), L"wb");
+#else
+    return fopen(std::string(path.begin(), path.end()).c_str(), "wb");
+#endif
+}
+
+static bool MoveOverFile(const std::wstring& from, const std::wstring& to)
+{
+#ifdef _WIN32
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(std::string(from.begin(), from.end()).c_str(), std::string(to.begin(), to.end()).c_str()) == 0;
+#endif
+}
+
+HRESULT ShaderCache::Open(const std::wstring& path)
+{
+    Close();
+    m_path = path;
+
+    if (FAILED(m_pack.Open(path)))
+        return S_OK;
+
+    const BYTE* pData = m_pack.GetData();
+    const size_t size = m_pack.GetSize();
+    PackHeader header = {};
+    if (size >= sizeof(header))
+        memcpy(&header, pData, sizeof(header));
+
+    const size_t tableEnd = sizeof(header) + static_cast<size_t>(header.count) * sizeof(PackEntry);
+    if (header.magic != PackMagic || header.version != PackVersion || tableEnd > size)
+    {
+        m_pack.Close();
+        return S_OK;
+    }
+
+    const PackEntry* pTable = reinterpret_cast<const PackEntry*>(pData + sizeof(header));
+    m_entries.reserve(header.count);
+    for (UINT i = 0; i < header.count; i++)
+    {
+        if (pTable[i].offset >= tableEnd && static_cast<size_t>(pTable[i].offset) + pTable[i].size <= size)
+            m_entries[pTable[i].key] = { pData + pTable[i].offset, pTable[i].size };
+    }
+    return S_OK;
+}
+
+HRESULT ShaderCache::Save()
+{
+    if (!m_dirty || m_path.empty())
+        return S_OK;
+
+    std::vector<UINT64> keys;
+    keys.reserve(m_entries.size());
+    for (const auto& entry : m_entries)
+    {
+        keys.push_back(entry.first);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    PackHeader header = { PackMagic, PackVersion, static_cast<UINT>(keys.size()), 0 };
+    std::vector<PackEntry> table(keys.size());
+    size_t offset = sizeof(header) + table.size() * sizeof(PackEntry);
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        table[i] = { keys[i], static_cast<UINT>(offset), static_cast<UINT>(m_entries[keys[i]].size) };
+        offset += table[i].size;
+    }
+
+    // written next to the old pack and moved over it once complete, so a
+    // failed write never leaves a truncated pack behind
+    const std::wstring tempPath = m_path + L".tmp";
+    FILE* pFile = OpenForWrite(tempPath);
+    if (!pFile)
+        return E_FAIL;
+
+    bool written = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+        (table.empty() || fwrite(table.data(), sizeof(PackEntry), table.size(), pFile) == table.size());
+    for (size_t i = 0; written && i < keys.size(); i++)
+    {
+        const Entry& entry = m_entries[keys[i]];
+        written = fwrite(entry.pData, 1, entry.size, pFile) == entry.size;
+    }
+    written = fclose(pFile) == 0 && written;
+
+    const std::wstring path = m_path;
+    Close();
+    if (!written || !MoveOverFile(tempPath, path))
+    {
+        m_path = path;
+        return E_FAIL;
+    }
+    return Open(path);
+}
+
+void ShaderCache::Close()
+{
+    m_entries.clear();
+    m_added.clear();
+    m_pack.Close();
+    m_path.clear();
+    m_dirty = false;
+}
+
+HRESULT ShaderCache::ComputeKey(const std::wstring& path, const ShaderDefine* defines, UINT defineCount,
+    const char* entryPoint, const char* profile, UINT flags, UINT64* pKey)
+{
+    UINT64 hash = HashSeed;
+    HRESULT result = HashSourceFile(hash, path, 0);
+    if (FAILED(result))
+        return result;
+
+    for (UINT i = 0; i < defineCount; i++)
+    {
+        hash = HashString(hash, defines[i].name);
+        hash = HashString(hash, defines[i].value);
+    }
+    hash = HashString(hash, entryPoint);
+    hash = HashString(hash, profile);
+    hash = Hash(hash, &flags, sizeof(flags));
+
+    *pKey = hash;
+    return S_OK;
+}
+
+bool ShaderCache::Find(UINT64 key, const BYTE** ppData, size_t* pSize)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+    {
+        m_stats.misses++;
+        return false;
+    }
+
+    m_stats.hits++;
+    *ppData = it->second.pData;
+    *pSize = it->second.size;
+    return true;
+}
+
+void ShaderCache::Store(UINT64 key, const void* pData, size_t size)
+{
+    const BYTE* pBytes = static_cast<const BYTE*>(pData);
+    m_added.emplace_back(new std::vector<BYTE>(pBytes, pBytes + size));
+    m_entries[key] = { m_added.back()->data(), size };
+    m_dirty = true;
+}
@@ -0,0 +1,75 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RenderBackend.h"
+#include "DDSFile.h"
+
+struct ShaderCacheStats
+{
+    UINT hits = 0;
+    UINT misses = 0;
+    double loadSeconds = 0.0;       // creating shaders from cached bytecode
+    double compileSeconds = 0.0;    // compiling (and storing) the misses
+};
+
+// Compiled shader bytecode kept in one pack file: a header, a table of
+// { key, offset, size } entries sorted by key and the blobs. The pack is
+// mapped, so a hit is a pointer into it. Shaders compiled at run time are
+// added in memory and written back with the rest by Save().
+//
+// The key is a hash of the source, of every file it includes, the defines,
+// entry point, profile and compile flags, so an edit to any of them misses
+// and the stale entry is simply never found again.
+class ShaderCache
+{
+public:
+    // next to the shaders, where the offline step writes it
+    static const WCHAR DefaultPath[];
+
+    ShaderCache() : m_dirty(false) {}
+    ~ShaderCache() { Close(); }
+
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    // A missing or outdated pack opens as an empty cache
+    HRESULT Open(const std::wstring& path);
+    // Rewrites the pack when entries were added since Open
+    HRESULT Save();
+    void Close();
+
+    // Fails only when the source file cannot be read
+    static HRESULT ComputeKey(const std::wstring& path, const ShaderDefine* defines, UINT defineCount,
+        const char* entryPoint, const char* profile, UINT flags, UINT64* pKey);
+
+    bool Find(UINT64 key, const BYTE** ppData, size_t* pSize);
+    void Store(UINT64 key, const void* pData, size_t size);
+
+    void AddTime(bool hit, double seconds) { (hit ? m_stats.loadSeconds : m_stats.compileSeconds) += seconds; }
+
+    UINT GetEntryCount() const { return static_cast<UINT>(m_entries.size()); }
+    const ShaderCacheStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = ShaderCacheStats(); }
+
+private:
+    struct Entry
+    {
+        const BYTE* pData;
+        size_t size;
+    };
+
+    std::wstring m_path;
+    MappedFile m_pack;
+    std::unordered_map<UINT64, Entry> m_entries;
+    std::vector<std::unique_ptr<std::vector<BYTE>>> m_added;   // blobs not in the mapped pack yet
+    bool m_dirty;
+
+    ShaderCacheStats m_stats;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "ShaderVariants.h"
+
+static const char* const ValueNames[ShaderVariants::MaxValues] =
+{
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15"
+};
+
+// Bits that hold the values of an option
+static UINT GetOptionMask(const ShaderOption& option)
+{
+    UINT bits = 0;
+    while ((1u << bits) < option.valueCount)
+        bits++;
+    return ((1u << bits) - 1) << option.shift;
+}
+
+void ShaderVariants::Init(RenderDevice* pDevice, const ShaderVariantDesc& desc)
+{
+    Terminate();
+    m_pDevice = pDevice;
+    m_desc = desc;
+}
+
+void ShaderVariants::Terminate()
+{
+    for (const auto& shader : m_shaders)
+    {
+        m_pDevice->Release(shader.second);
+    }
+    m_shaders.clear();
+}
+
+HRESULT ShaderVariants::Get(UINT features, RenderHandle* pShader)
+{
+    UINT key = GetKey(m_desc, features);
+    auto it = m_shaders.find(key);
+    if (it != m_shaders.end())
+    {
+        *pShader = it->second;
+        return S_OK;
+    }
+
+    ShaderDefine defines[MaxOptions];
+    UINT defineCount = GetDefines(m_desc, key, defines);
+    RenderHandle shader = NullHandle;
+    HRESULT result = m_pDevice->CreateShader(m_desc.stage, m_desc.path, defines, defineCount, &shader);
+    if (FAILED(result))
+        return result;
+
+    m_shaders[key] = shader;
+    *pShader = shader;
+    return S_OK;
+}
+
+UINT ShaderVariants::GetKey(const ShaderVariantDesc& desc, UINT features)
+{
+    UINT key = 0;
+    for (UINT i = 0; i < desc.optionCount; i++)
+    {
+        const ShaderOption& option = desc.options[i];
+        UINT value = (features & GetOptionMask(option)) >> option.shift;
+        if (value >= option.valueCount)
+            value = option.valueCount - 1;
+        key |= value << option.shift;
+    }
+    return key;
+}
+
+UINT ShaderVariants::GetDefines(const ShaderVariantDesc& desc, UINT key, ShaderDefine defines[MaxOptions])
+{
+    UINT count = desc.optionCount < MaxOptions ? desc.optionCount : MaxOptions;
+    for (UINT i = 0; i < count; i++)
+    {
+        const ShaderOption& option = desc.options[i];
+        UINT value = (key & GetOptionMask(option)) >> option.shift;
+        defines[i] = { option.define, ValueNames[value < MaxValues ? value : MaxValues - 1] };
+    }
+    return count;
+}
+
+UINT ShaderVariants::GetVariantCount(const ShaderVariantDesc& desc)
+{
+    UINT count = 1;
+    for (UINT i = 0; i < desc.optionCount; i++)
+    {
+        count *= desc.options[i].valueCount;
+    }
+    return count;
+}
+
+UINT ShaderVariants::GetVariantKey(const ShaderVariantDesc& desc, UINT index)
+{
+    UINT key = 0;
+    for (UINT i = 0; i < desc.optionCount; i++)
+    {
+        const ShaderOption& option = desc.options[i];
+        key |= (index % option.valueCount) << option.shift;
+        index /= option.valueCount;
+    }
+    return key;
+}
@@ -0,0 +1,64 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <string>
+#include <unordered_map>
+
+#include "RenderBackend.h"
+
+// A define of a shader that takes the values 0 to valueCount - 1, kept in
+// the bits of a feature key from shift up
+struct ShaderOption
+{
+    const char* define;
+    UINT shift;
+    UINT valueCount;
+};
+
+// A shader file and the defines its permutations differ in
+struct ShaderVariantDesc
+{
+    ShaderStage stage;
+    const wchar_t* path;
+    const ShaderOption* options;
+    UINT optionCount;
+};
+
+// The permutations of one shader file, compiled when a draw first asks for
+// them. A draw builds one feature key for everything it renders with and
+// hands it to the shaders of every stage; each keeps the bits of its own
+// options and ignores the rest, so the vertex and pixel shader of a draw
+// agree without knowing about each other.
+class ShaderVariants
+{
+public:
+    static const UINT MaxOptions = 8;
+    static const UINT MaxValues = 16;
+
+    ShaderVariants() : m_pDevice(nullptr), m_desc() {}
+    ~ShaderVariants() { Terminate(); }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    void Init(RenderDevice* pDevice, const ShaderVariantDesc& desc);
+    void Terminate();
+
+    HRESULT Get(UINT features, RenderHandle* pShader);
+    UINT GetCompiledCount() const { return static_cast<UINT>(m_shaders.size()); }
+
+    // The bits of features this shader has options for, values past the last
+    // one of an option are clamped to it
+    static UINT GetKey(const ShaderVariantDesc& desc, UINT features);
+    static UINT GetDefines(const ShaderVariantDesc& desc, UINT key, ShaderDefine defines[MaxOptions]);
+    // Every key the options allow, for compiling them all ahead of time
+    static UINT GetVariantCount(const ShaderVariantDesc& desc);
+    static UINT GetVariantKey(const ShaderVariantDesc& desc, UINT index);
+
+private:
+    RenderDevice* m_pDevice;
+    ShaderVariantDesc m_desc;
+    std::unordered_map<UINT, RenderHandle> m_shaders;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+// The faces of a D3D cube map, the same table as in Shadows.hlsli
+static const XMFLOAT3 FaceForward[ShadowAtlas::FaceCount] =
+{
+    XMFLOAT3(1.0f, 0.0f, 0.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f),
+    XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, -1.0f, 0.0f),
+    XMFLOAT3(0.0f, 0.0f, 1.0f), XMFLOAT3(0.0f, 0.0f, -1.0f),
+};
+
+static const XMFLOAT3 FaceUp[ShadowAtlas::FaceCount] =
+{
+    XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f),
+    XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT3(0.0f, 0.0f, 1.0f),
+    XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT3(0.0f, 1.0f, 0.0f),
+};
+
+// Casters nearer to the light than this are clipped
+static const float ShadowNearPlane = 0.05f;
+
+// Receivers move a texel along their normal and may be 1% of their
+// distance behind the nearest caster, against acne on lit faces
+static const float ShadowNormalOffset = 1.0f;
+static const float ShadowDepthBias = 0.01f;
+
+ShadowAtlas::ShadowAtlas() :
+    m_faceSize(0),
+    m_width(0),
+    m_height(0),
+    m_frame(0)
+{
+}
+
+bool ShadowAtlas::Configure(UINT faceSize, UINT slotCount)
+{
+    slotCount = std::min(slotCount, MaxShadowSlots);
+    if (faceSize == m_faceSize && slotCount == m_slots.size())
+        return false;
+
+    UINT rows = (slotCount + SlotsPerRow - 1) / SlotsPerRow;
+    m_faceSize = faceSize;
+    m_width = faceSize * 3 * std::min(slotCount, SlotsPerRow);
+    m_height = faceSize * 2 * rows;
+    m_slots.assign(slotCount, Slot());
+    return true;
+}
+
+void ShadowAtlas::Invalidate()
+{
+    for (Slot& slot : m_slots)
+    {
+        slot.valid = false;
+    }
+}
+
+void ShadowAtlas::Schedule(const ShadowLight* lights, UINT lightCount, const XMFLOAT4 planes[6], const XMFLOAT3& camera,
+    UINT maxShadowed, UINT maxUpdates, UINT staticVersion, bool dynamicCasters)
+{
+    m_frame++;
+    m_updates.clear();
+    m_stats = ShadowStats();
+
+    // the lights whose sphere reaches into the view, nearest for their size first
+    m_candidates.clear();
+    for (UINT i = 0; i < lightCount; i++)
+    {
+        const ShadowLight& light = lights[i];
+        if (light.range <= 0.0f)
+            continue;
+
+        bool visible = true;
+        for (int p = 0; p < 6 && visible; p++)
+        {
+            const XMFLOAT4& plane = planes[p];
+            visible = plane.x * light.position.x + plane.y * light.position.y + plane.z * light.position.z + plane.w >= -light.range;
+        }
+        if (!visible)
+            continue;
+
+        float dx = light.position.x - camera.x;
+        float dy = light.position.y - camera.y;
+        float dz = light.position.z - camera.z;
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+        m_candidates.push_back({ i, light.range / std::max(distance, 0.01f) });
+    }
+    m_stats.candidates = static_cast<UINT>(m_candidates.size());
+
+    UINT shadowedCount = std::min(std::min(maxShadowed, GetSlotCount()), static_cast<UINT>(m_candidates.size()));
+    std::partial_sort(m_candidates.begin(), m_candidates.begin() + shadowedCount, m_candidates.end(),
+        [](const Candidate& a, const Candidate& b)
+    {
+        return a.priority > b.priority || (a.priority == b.priority && a.light < b.light);
+    });
+
+    // a light keeps its slot while it stays shadowed, so its faces are reused
+    auto isChosen = [&](UINT light)
+    {
+        for (UINT i = 0; i < shadowedCount; i++)
+        {
+            if (m_candidates[i].light == light)
+                return true;
+        }
+        return false;
+    };
+    for (Slot& slot : m_slots)
+    {
+        if (slot.light != InvalidLight && !isChosen(slot.light))
+            slot = Slot();
+    }
+    for (UINT i = 0; i < shadowedCount; i++)
+    {
+        UINT light = m_candidates[i].light;
+        auto held = std::find_if(m_slots.begin(), m_slots.end(), [light](const Slot& slot) { return slot.light == light; });
+        if (held != m_slots.end())
+            continue;
+
+        auto free = std::find_if(m_slots.begin(), m_slots.end(), [](const Slot& slot) { return slot.light == InvalidLight; });
+        free->light = light;
+    }
+
+    // the static faces are out of date once the light or the casters moved
+    auto needsStatic = [&](const Slot& slot)
+    {
+        const ShadowLight& light = lights[slot.light];
+        return !slot.valid || slot.staticVersion != staticVersion || slot.range != light.range ||
+            slot.position.x != light.position.x || slot.position.y != light.position.y || slot.position.z != light.position.z;
+    };
+
+    m_waiting.clear();
+    for (UINT i = 0; i < GetSlotCount(); i++)
+    {
+        if (m_slots[i].light != InvalidLight && (dynamicCasters || needsStatic(m_slots[i])))
+            m_waiting.push_back(i);
+    }
+
+    // slots without faces first, then the ones that waited longest
+    std::sort(m_waiting.begin(), m_waiting.end(), [this](UINT a, UINT b)
+    {
+        const Slot& slotA = m_slots[a];
+        const Slot& slotB = m_slots[b];
+        if (slotA.valid != slotB.valid)
+            return !slotA.valid;
+        if (slotA.lastUpdate != slotB.lastUpdate)
+            return slotA.lastUpdate < slotB.lastUpdate;
+        return a < b;
+    });
+
+    UINT updateCount = std::min(maxUpdates, static_cast<UINT>(m_waiting.size()));
+    for (UINT i = 0; i < updateCount; i++)
+    {
+        Slot& slot = m_slots[m_waiting[i]];
+        const ShadowLight& light = lights[slot.light];
+
+        ShadowUpdate update;
+        update.slot = m_waiting[i];
+        update.light = slot.light;
+        update.drawStatic = needsStatic(slot);
+        m_updates.push_back(update);
+
+        slot.position = light.position;
+        slot.range = light.range;
+        slot.staticVersion = staticVersion;
+        slot.lastUpdate = m_frame;
+        slot.valid = true;
+
+        m_stats.updates++;
+        if (update.drawStatic)
+            m_stats.staticUpdates++;
+    }
+
+    for (const Slot& slot : m_slots)
+    {
+        if (slot.light != InvalidLight && slot.valid)
+            m_stats.shadowed++;
+    }
+    for (UINT i = updateCount; i < m_waiting.size(); i++)
+    {
+        if (m_slots[m_waiting[i]].valid)
+            m_stats.staleSlots++;
+    }
+}
+
+Viewport ShadowAtlas::GetFaceViewport(UINT slot, UINT face) const
+{
+    Viewport viewport;
+    viewport.x = static_cast<float>(((slot % SlotsPerRow) * 3 + face % 3) * m_faceSize);
+    viewport.y = static_cast<float>(((slot / SlotsPerRow) * 2 + face / 3) * m_faceSize);
+    viewport.width = static_cast<float>(m_faceSize);
+    viewport.height = static_cast<float>(m_faceSize);
+    return viewport;
+}
+
+XMMATRIX ShadowAtlas::GetFaceViewProj(UINT slot, UINT face) const
+{
+    const Slot& data = m_slots[slot];
+    XMMATRIX view = XMMatrixLookToLH(XMLoadFloat3(&data.position), XMLoadFloat3(&FaceForward[face]), XMLoadFloat3(&FaceUp[face]));
+    XMMATRIX proj = XMMatrixPerspectiveFovLH(XM_PIDIV2, 1.0f, ShadowNearPlane, std::max(data.range, 2.0f * ShadowNearPlane));
+    return XMMatrixTranspose(view * proj);
+}
+
+void ShadowAtlas::GetConstants(ShadowConstants& constants) const
+{
+    constants = ShadowConstants();
+    constants.faceSize = m_faceSize;
+    constants.atlasWidth = m_width;
+    constants.normalOffset = ShadowNormalOffset;
+    constants.depthBias = ShadowDepthBias;
+
+    for (UINT i = 0; i < GetSlotCount(); i++)
+    {
+        const Slot& slot = m_slots[i];
+        if (slot.light == InvalidLight || !slot.valid)
+            continue;
+
+        // XMMatrixPerspectiveFovLH: depth = f / (f - n) - n * f / (f - n) / d
+        float farPlane = std::max(slot.range, 2.0f * ShadowNearPlane);
+        ShadowSlotConstants& target = constants.slots[constants.slotCount++];
+        target.position = slot.position;
+        target.lightIndex = slot.light;
+        target.depthScale = farPlane / (farPlane - ShadowNearPlane);
+        target.depthOffset = -ShadowNearPlane * target.depthScale;
+        Viewport viewport = GetFaceViewport(i, 0);
+        target.origin = XMFLOAT2(viewport.x, viewport.y);
+    }
+}
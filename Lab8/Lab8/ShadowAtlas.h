@@ -0,0 +1,136 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include "Platform.h"
+#include "RenderBackend.h"
+
+#include <DirectXMath.h>
+#include <vector>
+
+const UINT MaxShadowSlots = 8;
+
+// One shadowed light, ShadowSlot of Shadows.hlsli
+struct ShadowSlotConstants
+{
+    DirectX::XMFLOAT3 position;     // where the faces were drawn from, it may trail the light
+    UINT lightIndex;
+    float depthScale;               // the depth of view distance d is depthScale + depthOffset / d
+    float depthOffset;
+    DirectX::XMFLOAT2 origin;       // texel of the first face in the atlas
+};
+
+// Constants of Shadows.hlsli (register b4)
+struct ShadowConstants
+{
+    UINT slotCount;
+    UINT faceSize;                  // texels
+    UINT atlasWidth;
+    float normalOffset;             // receivers move along their normal this many texels
+    float depthBias;
+    UINT padding[3];
+    ShadowSlotConstants slots[MaxShadowSlots];
+};
+
+// A light the atlas may shadow
+struct ShadowLight
+{
+    DirectX::XMFLOAT3 position;
+    float range;
+};
+
+// A light whose faces are drawn this frame
+struct ShadowUpdate
+{
+    UINT slot;
+    UINT light;
+    bool drawStatic;        // the static casters too, their faces are out of date
+};
+
+struct ShadowStats
+{
+    UINT candidates = 0;    // lights in view
+    UINT shadowed = 0;      // lights with faces to read this frame
+    UINT updates = 0;
+    UINT staticUpdates = 0;
+    UINT staleSlots = 0;    // shadowed from faces of an earlier frame that are out of date
+};
+
+// Omnidirectional shadows of point lights as six 90 degree faces each,
+// packed into an atlas of slots three faces wide and two high. Every slot
+// is drawn in two layers of the same layout, one texture each: the static
+// casters, kept until the light moves or they change, and the dynamic
+// ones, drawn again every time the slot updates. A receiver is lit when it
+// is in front of both.
+//
+// Schedule picks the lights in view that matter most, up to a cap, and
+// updates at most a few slots per frame, the ones waiting longest first,
+// so the cost of a frame stays the same however many lights there are.
+// A slot waiting for its turn keeps the faces of its last update.
+class ShadowAtlas
+{
+public:
+    static const UINT FaceCount = 6;
+    static const UINT SlotsPerRow = 4;
+    static const UINT InvalidLight = ~0u;
+
+    ShadowAtlas();
+
+    // Room for slotCount slots of faceSize faces. Returns true when the
+    // atlas size changed; every slot is dropped then.
+    bool Configure(UINT faceSize, UINT slotCount);
+
+    UINT GetFaceSize() const { return m_faceSize; }
+    UINT GetSlotCount() const { return static_cast<UINT>(m_slots.size()); }
+    UINT GetWidth() const { return m_width; }
+    UINT GetHeight() const { return m_height; }
+
+    // planes are the normalized planes of the view frustum. The static
+    // casters are drawn again when staticVersion changes; without dynamic
+    // casters a slot whose light stands still is never drawn again.
+    void Schedule(const ShadowLight* lights, UINT lightCount, const DirectX::XMFLOAT4 planes[6], const DirectX::XMFLOAT3& camera,
+        UINT maxShadowed, UINT maxUpdates, UINT staticVersion, bool dynamicCasters);
+
+    // The slots to draw this frame, from the last Schedule
+    const std::vector<ShadowUpdate>& GetUpdates() const { return m_updates; }
+
+    Viewport GetFaceViewport(UINT slot, UINT face) const;
+    // From where the slot's faces are drawn, transposed like the constant buffers
+    DirectX::XMMATRIX GetFaceViewProj(UINT slot, UINT face) const;
+    DirectX::XMFLOAT3 GetSlotPosition(UINT slot) const { return m_slots[slot].position; }
+    float GetSlotRange(UINT slot) const { return m_slots[slot].range; }
+
+    void GetConstants(ShadowConstants& constants) const;
+    const ShadowStats& GetStats() const { return m_stats; }
+
+    // Every slot is drawn again before it is read, e.g. for a new atlas texture
+    void Invalidate();
+
+private:
+    struct Slot
+    {
+        UINT light = InvalidLight;
+        DirectX::XMFLOAT3 position = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+        float range = 0.0f;
+        UINT staticVersion = 0;
+        UINT64 lastUpdate = 0;
+        bool valid = false;         // drawn at least once for this light
+    };
+
+    struct Candidate
+    {
+        UINT light;
+        float priority;
+    };
+
+    UINT m_faceSize;
+    UINT m_width;
+    UINT m_height;
+    UINT64 m_frame;
+    std::vector<Slot> m_slots;
+    std::vector<Candidate> m_candidates;
+    std::vector<UINT> m_waiting;
+    std::vector<ShadowUpdate> m_updates;
+    ShadowStats m_stats;
+};
+
+#endif
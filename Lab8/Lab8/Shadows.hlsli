@@ -0,0 +1,98 @@
+// Point light shadows from the cube faces of ShadowAtlas, see ShadowAtlas.h.
+// A slot is three faces wide and two high, +X -X +Y over -Y +Z -Z.
+#ifndef SHADOWS_HLSLI
+#define SHADOWS_HLSLI
+
+#define MAX_SHADOW_SLOTS 8
+
+struct ShadowSlot
+{
+    float3 position;
+    uint lightIndex;
+    float depthScale;
+    float depthOffset;
+    float2 origin;
+};
+
+cbuffer ShadowConstants : register(b4)
+{
+    uint shadowSlotCount;
+    uint shadowFaceSize;
+    uint shadowAtlasWidth;
+    float shadowNormalOffset;
+    float shadowDepthBias;
+    uint shadowPadding0;
+    uint shadowPadding1;
+    uint shadowPadding2;
+    ShadowSlot shadowSlots[MAX_SHADOW_SLOTS];
+};
+
+Texture2D<float> staticShadowAtlas : register(t5);
+Texture2D<float> dynamicShadowAtlas : register(t6);
+
+// 2x2 comparisons against the nearer caster of both layers, filtered
+// bilinearly. Distances are along the major axis, the view depth of the face.
+float SampleShadow(ShadowSlot slot, float3 worldPos, float3 normal)
+{
+    float3 d = worldPos - slot.position;
+    float3 a = abs(d);
+    float major = max(a.x, max(a.y, a.z));
+
+    // a texel of the face is 2 * major / faceSize wide at the receiver
+    d += normal * (shadowNormalOffset * 2.0f * major / shadowFaceSize);
+    a = abs(d);
+
+    uint face;
+    float2 uv;
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        major = a.x;
+        face = d.x > 0.0f ? 0 : 1;
+        uv = float2(d.x > 0.0f ? -d.z : d.z, -d.y);
+    }
+    else if (a.y >= a.z)
+    {
+        major = a.y;
+        face = d.y > 0.0f ? 2 : 3;
+        uv = float2(d.x, d.y > 0.0f ? d.z : -d.z);
+    }
+    else
+    {
+        major = a.z;
+        face = d.z > 0.0f ? 4 : 5;
+        uv = float2(d.z > 0.0f ? d.x : -d.x, -d.y);
+    }
+    major = max(major, 1e-4f);
+    uv = uv / major * 0.5f + 0.5f;
+
+    float2 t = uv * shadowFaceSize - 0.5f;
+    float2 base = floor(t);
+    float2 f = t - base;
+    float2 corner = slot.origin + float2(face % 3, face / 3) * shadowFaceSize;
+    float limit = shadowFaceSize - 1.0f;
+
+    float lit[4];
+    [unroll]
+    for (uint i = 0; i < 4; i++)
+    {
+        float2 texel = clamp(base + float2(i % 2, i / 2), 0.0f, limit);
+        int3 p = int3(corner + texel, 0);
+        float depth = min(staticShadowAtlas.Load(p), dynamicShadowAtlas.Load(p));
+        float distance = slot.depthOffset / (depth - slot.depthScale);
+        lit[i] = major <= distance * (1.0f + shadowDepthBias) ? 1.0f : 0.0f;
+    }
+    return lerp(lerp(lit[0], lit[1], f.x), lerp(lit[2], lit[3], f.x), f.y);
+}
+
+// 0 in the shadow of the light, 1 where it reaches and for lights without a slot
+float GetShadow(uint lightIndex, float3 worldPos, float3 normal)
+{
+    for (uint s = 0; s < shadowSlotCount; s++)
+    {
+        if (shadowSlots[s].lightIndex == lightIndex)
+            return SampleShadow(shadowSlots[s], worldPos, normal);
+    }
+    return 1.0f;
+}
+
+#endif
\ No newline at end of file
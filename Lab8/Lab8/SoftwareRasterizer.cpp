@@ -0,0 +1,918 @@
+#include "SoftwareRasterizer.h"
+#include "CpuFeatures.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RASTER_SSE 1
+#endif
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    const UINT ChunkTriangles = 2048;
+    const UINT ExtraVertexBit = 0x80000000;
+    const float MinClipW = 1e-5f;
+
+    int ClampInt(int value, int low, int high)
+    {
+        return value < low ? low : (value > high ? high : value);
+    }
+
+    float ClampFloat(float value, float low, float high)
+    {
+        return value < low ? low : (value > high ? high : value);
+    }
+
+    UINT FetchIndex(const RasterDrawCall& draw, UINT position)
+    {
+        if (!draw.indices)
+            return position;
+
+        if (draw.indexFormat == Format::R32_UINT)
+        {
+            UINT index;
+            memcpy(&index, draw.indices + position * sizeof(UINT), sizeof(UINT));
+            return index;
+        }
+
+        WORD index;
+        memcpy(&index, draw.indices + position * sizeof(WORD), sizeof(WORD));
+        return index;
+    }
+
+    bool DepthTest(ComparisonFunc func, float z, float stored)
+    {
+        switch (func)
+        {
+        case ComparisonFunc::Never:        return false;
+        case ComparisonFunc::Less:         return z < stored;
+        case ComparisonFunc::Equal:        return z == stored;
+        case ComparisonFunc::LessEqual:    return z <= stored;
+        case ComparisonFunc::Greater:      return z > stored;
+        case ComparisonFunc::NotEqual:     return z != stored;
+        case ComparisonFunc::GreaterEqual: return z >= stored;
+        default:                           return true;
+        }
+    }
+
+#ifdef RASTER_SSE
+    __m128 DepthTest4(ComparisonFunc func, __m128 z, __m128 stored)
+    {
+        switch (func)
+        {
+        case ComparisonFunc::Never:        return _mm_setzero_ps();
+        case ComparisonFunc::Less:         return _mm_cmplt_ps(z, stored);
+        case ComparisonFunc::Equal:        return _mm_cmpeq_ps(z, stored);
+        case ComparisonFunc::LessEqual:    return _mm_cmple_ps(z, stored);
+        case ComparisonFunc::Greater:      return _mm_cmpgt_ps(z, stored);
+        case ComparisonFunc::NotEqual:     return _mm_cmpneq_ps(z, stored);
+        case ComparisonFunc::GreaterEqual: return _mm_cmpge_ps(z, stored);
+        default:                           return _mm_castsi128_ps(_mm_set1_epi32(-1));
+        }
+    }
+#endif
+
+#ifdef CPU_X86
+    CPU_TARGET("avx2")
+    __m256 DepthTest8(ComparisonFunc func, __m256 z, __m256 stored)
+    {
+        switch (func)
+        {
+        case ComparisonFunc::Never:        return _mm256_setzero_ps();
+        case ComparisonFunc::Less:         return _mm256_cmp_ps(z, stored, _CMP_LT_OQ);
+        case ComparisonFunc::Equal:        return _mm256_cmp_ps(z, stored, _CMP_EQ_OQ);
+        case ComparisonFunc::LessEqual:    return _mm256_cmp_ps(z, stored, _CMP_LE_OQ);
+        case ComparisonFunc::Greater:      return _mm256_cmp_ps(z, stored, _CMP_GT_OQ);
+        case ComparisonFunc::NotEqual:     return _mm256_cmp_ps(z, stored, _CMP_NEQ_UQ);
+        case ComparisonFunc::GreaterEqual: return _mm256_cmp_ps(z, stored, _CMP_GE_OQ);
+        default:                           return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        }
+    }
+#endif
+
+    float BlendFactor(Blend blend, const float* src, const float* dst, int channel)
+    {
+        switch (blend)
+        {
+        case Blend::Zero:         return 0.0f;
+        case Blend::One:          return 1.0f;
+        case Blend::SrcAlpha:     return src[3];
+        case Blend::InvSrcAlpha:  return 1.0f - src[3];
+        case Blend::DestAlpha:    return dst[3];
+        case Blend::InvDestAlpha: return 1.0f - dst[3];
+        case Blend::SrcColor:     return src[channel];
+        case Blend::InvSrcColor:  return 1.0f - src[channel];
+        default:                  return 1.0f;
+        }
+    }
+
+    float BlendValues(BlendOp op, float src, float dst)
+    {
+        switch (op)
+        {
+        case BlendOp::Subtract:    return src - dst;
+        case BlendOp::RevSubtract: return dst - src;
+        case BlendOp::Min:         return src < dst ? src : dst;
+        case BlendOp::Max:         return src > dst ? src : dst;
+        default:                   return src + dst;
+        }
+    }
+
+    void ReadTarget(const RasterTarget& target, size_t texel, float color[4])
+    {
+        switch (target.format)
+        {
+        case Format::R32G32B32A32_FLOAT:
+            memcpy(color, target.data + texel * 16, sizeof(float) * 4);
+            break;
+        case Format::R32_FLOAT:
+            memcpy(color, target.data + texel * 4, sizeof(float));
+            color[1] = color[2] = 0.0f;
+            color[3] = 1.0f;
+            break;
+        case Format::R16G16B16A16_UNORM:
+        {
+            const WORD* pTexel = reinterpret_cast<const WORD*>(target.data + texel * 8);
+            for (int c = 0; c < 4; c++)
+            {
+                color[c] = pTexel[c] * (1.0f / 65535.0f);
+            }
+            break;
+        }
+        default:
+            for (int c = 0; c < 4; c++)
+            {
+                color[c] = target.data[texel * 4 + c] * (1.0f / 255.0f);
+            }
+            break;
+        }
+    }
+
+    void WriteTarget(const RasterTarget& target, size_t texel, const float color[4], BYTE writeMask)
+    {
+        switch (target.format)
+        {
+        case Format::R32G32B32A32_FLOAT:
+        {
+            float* pTexel = reinterpret_cast<float*>(target.data + texel * 16);
+            for (int c = 0; c < 4; c++)
+            {
+                if (writeMask & (1 << c))
+                    pTexel[c] = color[c];
+            }
+            break;
+        }
+        case Format::R32_FLOAT:
+            if (writeMask & 1)
+                memcpy(target.data + texel * 4, color, sizeof(float));
+            break;
+        case Format::R16G16B16A16_UNORM:
+        {
+            WORD* pTexel = reinterpret_cast<WORD*>(target.data + texel * 8);
+            for (int c = 0; c < 4; c++)
+            {
+                if (writeMask & (1 << c))
+                    pTexel[c] = static_cast<WORD>(ClampFloat(color[c], 0.0f, 1.0f) * 65535.0f + 0.5f);
+            }
+            break;
+        }
+        default:
+            for (int c = 0; c < 4; c++)
+            {
+                if (writeMask & (1 << c))
+                    target.data[texel * 4 + c] = static_cast<BYTE>(ClampFloat(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+            break;
+        }
+    }
+
+    // Sutherland-Hodgman against one clip space plane, returns the new vertex count
+    UINT ClipPolygon(const float* plane, const float* input, UINT count, float* output, UINT vertexSize)
+    {
+        UINT outCount = 0;
+        for (UINT i = 0; i < count; i++)
+        {
+            const float* a = input + i * vertexSize;
+            const float* b = input + ((i + 1) % count) * vertexSize;
+            float da = plane[0] * a[2] + plane[1] * a[3] + plane[2];
+            float db = plane[0] * b[2] + plane[1] * b[3] + plane[2];
+
+            if (da >= 0.0f)
+            {
+                memcpy(output + outCount++ * vertexSize, a, sizeof(float) * vertexSize);
+            }
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                // always interpolate from the inside vertex so the two triangles
+                // sharing this edge get bit-identical intersections
+                const float* from = da >= 0.0f ? a : b;
+                const float* to = da >= 0.0f ? b : a;
+                float dFrom = da >= 0.0f ? da : db;
+                float dTo = da >= 0.0f ? db : da;
+                float t = dFrom / (dFrom - dTo);
+                float* v = output + outCount++ * vertexSize;
+                for (UINT k = 0; k < vertexSize; k++)
+                {
+                    v[k] = from[k] + (to[k] - from[k]) * t;
+                }
+            }
+        }
+        return outCount;
+    }
+}
+
+bool IsRasterPathSupported(RasterPath path)
+{
+    switch (path)
+    {
+    case RasterPath::Scalar:
+        return true;
+#ifdef RASTER_SSE
+    case RasterPath::SSE:
+        return true;
+#endif
+#ifdef CPU_X86
+    case RasterPath::AVX2:
+        return GetCpuFeatures().avx2;
+#endif
+    default:
+        return false;
+    }
+}
+
+RasterPath GetBestRasterPath()
+{
+    static const RasterPath best =
+        IsRasterPathSupported(RasterPath::AVX2) ? RasterPath::AVX2 :
+        IsRasterPathSupported(RasterPath::SSE) ? RasterPath::SSE :
+        RasterPath::Scalar;
+    return best;
+}
+
+const char* GetRasterPathName(RasterPath path)
+{
+    switch (path)
+    {
+    case RasterPath::SSE:
+        return "SSE";
+    case RasterPath::AVX2:
+        return "AVX2";
+    default:
+        return "Scalar";
+    }
+}
+
+SoftwareRasterizer::SoftwareRasterizer(UINT threadCount) :
+    m_pool(threadCount),
+    m_path(GetBestRasterPath()),
+    m_vertexSize(4),
+    m_tilesX(0),
+    m_tilesY(0)
+{
+    m_threadPixels.resize(m_pool.GetThreadCount(), 0);
+}
+
+void SoftwareRasterizer::SetPath(RasterPath path)
+{
+    m_path = IsRasterPathSupported(path) ? path : GetBestRasterPath();
+}
+
+void SoftwareRasterizer::Project(const RasterDrawCall& draw, const float* clip, float* screen) const
+{
+    const Viewport& vp = draw.viewport;
+    float invW = 1.0f / clip[3];
+
+    screen[0] = vp.x + (clip[0] * invW + 1.0f) * 0.5f * vp.width;
+    screen[1] = vp.y + (1.0f - clip[1] * invW) * 0.5f * vp.height;
+    screen[2] = vp.minDepth + clip[2] * invW * (vp.maxDepth - vp.minDepth);
+    screen[3] = invW;
+    for (UINT k = 4; k < m_vertexSize; k++)
+    {
+        screen[k] = clip[k] * invW;
+    }
+}
+
+void SoftwareRasterizer::ShadeVertices(const RasterDrawCall& draw, UINT minVertex, UINT vertexRange)
+{
+    size_t total = (size_t)vertexRange * draw.instanceCount;
+    m_clipVertices.resize(total * m_vertexSize);
+    m_screenVertices.resize(total * m_vertexSize);
+
+    m_pool.ParallelFor(draw.instanceCount, [&](UINT instance, UINT)
+    {
+        for (UINT v = 0; v < vertexRange; v++)
+        {
+            size_t slot = ((size_t)instance * vertexRange + v) * m_vertexSize;
+            float* clip = &m_clipVertices[slot];
+            UINT vertexIndex = minVertex + v;
+
+            memset(clip, 0, sizeof(float) * m_vertexSize);
+            if (vertexIndex < draw.vertexCount)
+            {
+                draw.pVertexShader->vertex(draw.vertexBindings, draw.vertices + (size_t)vertexIndex * draw.vertexStride,
+                    draw.startInstance + instance, clip);
+            }
+
+            // vertices behind the eye are only used through the clipper
+            if (clip[3] >= MinClipW)
+                Project(draw, clip, &m_screenVertices[slot]);
+        }
+    });
+}
+
+void SoftwareRasterizer::AddTriangle(const RasterDrawCall& draw, const float* v0, const float* v1, const float* v2,
+    const UINT* indices, SetupChunk& chunk)
+{
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v2[0] - v0[0]) * (v1[1] - v0[1]);
+    if (area == 0.0f || !std::isfinite(area))
+        return;
+
+    // with y pointing down a positive area is clockwise on screen
+    bool clockwise = area > 0.0f;
+    bool frontFace = clockwise != draw.rasterizer.frontCounterClockwise;
+    if ((draw.rasterizer.cullMode == CullMode::Back && !frontFace) ||
+        (draw.rasterizer.cullMode == CullMode::Front && frontFace))
+    {
+        return;
+    }
+
+    Triangle triangle;
+    const float* v[3] = { v0, v1, v2 };
+    triangle.vertex[0] = indices[0];
+    triangle.vertex[1] = indices[1];
+    triangle.vertex[2] = indices[2];
+    if (!clockwise)
+    {
+        std::swap(v[1], v[2]);
+        std::swap(triangle.vertex[1], triangle.vertex[2]);
+        area = -area;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        const float* a = v[(i + 1) % 3];
+        const float* b = v[(i + 2) % 3];
+        triangle.edgeA[i] = a[1] - b[1];
+        triangle.edgeB[i] = b[0] - a[0];
+        // the neighbour sharing this edge walks it the other way, taking the
+        // constant from the same end point makes its edge function the exact negation
+        const float* origin = (a[1] < b[1] || (a[1] == b[1] && a[0] < b[0])) ? a : b;
+        triangle.edgeC[i] = -(triangle.edgeA[i] * origin[0] + triangle.edgeB[i] * origin[1]);
+        // D3D fill convention: pixels exactly on an edge belong to top and left edges only
+        triangle.topLeft[i] = triangle.edgeA[i] > 0.0f || (triangle.edgeA[i] == 0.0f && triangle.edgeB[i] > 0.0f);
+    }
+    triangle.invArea = 1.0f / area;
+
+    const Viewport& vp = draw.viewport;
+    float minX = fminf(v0[0], fminf(v1[0], v2[0]));
+    float maxX = fmaxf(v0[0], fmaxf(v1[0], v2[0]));
+    float minY = fminf(v0[1], fminf(v1[1], v2[1]));
+    float maxY = fmaxf(v0[1], fmaxf(v1[1], v2[1]));
+
+    int scissorX0 = ClampInt(static_cast<int>(vp.x), 0, static_cast<int>(draw.targetWidth));
+    int scissorY0 = ClampInt(static_cast<int>(vp.y), 0, static_cast<int>(draw.targetHeight));
+    int scissorX1 = ClampInt(static_cast<int>(vp.x + vp.width), 0, static_cast<int>(draw.targetWidth)) - 1;
+    int scissorY1 = ClampInt(static_cast<int>(vp.y + vp.height), 0, static_cast<int>(draw.targetHeight)) - 1;
+
+    // pixel centers are at +0.5
+    triangle.minX = static_cast<int>(ClampFloat(floorf(minX - 0.5f), (float)scissorX0, (float)scissorX1 + 1.0f));
+    triangle.maxX = static_cast<int>(ClampFloat(ceilf(maxX - 0.5f), (float)scissorX0 - 1.0f, (float)scissorX1));
+    triangle.minY = static_cast<int>(ClampFloat(floorf(minY - 0.5f), (float)scissorY0, (float)scissorY1 + 1.0f));
+    triangle.maxY = static_cast<int>(ClampFloat(ceilf(maxY - 0.5f), (float)scissorY0 - 1.0f, (float)scissorY1));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    chunk.triangles.push_back(triangle);
+}
+
+void SoftwareRasterizer::SetupTriangles(const RasterDrawCall& draw, UINT minVertex, UINT vertexRange, UINT first, UINT last, SetupChunk& chunk)
+{
+    // planes as (z, w, constant): near z >= 0, far z <= w, and w > 0 for the divide
+    static const float clipPlanes[3][3] =
+    {
+        { 1.0f, 0.0f, 0.0f },
+        { -1.0f, 1.0f, 0.0f },
+        { 0.0f, 1.0f, -MinClipW },
+    };
+
+    UINT trianglesPerInstance = draw.count / 3;
+    // a triangle clipped by three planes has at most 6 vertices
+    float polygon[2][9 * (4 + CpuMaxVaryings)];
+
+    for (UINT t = first; t < last; t++)
+    {
+        UINT instance = t / trianglesPerInstance;
+        UINT primitive = t % trianglesPerInstance;
+
+        UINT indices[3];
+        bool inside = true;
+        for (int k = 0; k < 3; k++)
+        {
+            UINT index = FetchIndex(draw, draw.start + primitive * 3 + k) + draw.baseVertex;
+            indices[k] = instance * vertexRange + (index - minVertex);
+
+            const float* clip = &m_clipVertices[(size_t)indices[k] * m_vertexSize];
+            inside = inside && clip[2] >= 0.0f && clip[2] <= clip[3] && clip[3] >= MinClipW;
+        }
+
+        if (inside)
+        {
+            AddTriangle(draw, &m_screenVertices[(size_t)indices[0] * m_vertexSize],
+                &m_screenVertices[(size_t)indices[1] * m_vertexSize],
+                &m_screenVertices[(size_t)indices[2] * m_vertexSize], indices, chunk);
+            continue;
+        }
+
+        UINT count = 3;
+        for (int k = 0; k < 3; k++)
+        {
+            memcpy(&polygon[0][k * m_vertexSize], &m_clipVertices[(size_t)indices[k] * m_vertexSize], sizeof(float) * m_vertexSize);
+        }
+        int current = 0;
+        for (int p = 0; p < 3 && count >= 3; p++)
+        {
+            count = ClipPolygon(clipPlanes[p], polygon[current], count, polygon[1 - current], m_vertexSize);
+            current = 1 - current;
+        }
+        if (count < 3)
+            continue;
+
+        UINT firstExtra = static_cast<UINT>(chunk.extraVertices.size() / m_vertexSize);
+        chunk.extraVertices.resize(chunk.extraVertices.size() + count * m_vertexSize);
+        for (UINT k = 0; k < count; k++)
+        {
+            Project(draw, &polygon[current][k * m_vertexSize], &chunk.extraVertices[(firstExtra + k) * m_vertexSize]);
+        }
+
+        for (UINT k = 1; k + 1 < count; k++)
+        {
+            UINT fan[3] = { (firstExtra) | ExtraVertexBit, (firstExtra + k) | ExtraVertexBit, (firstExtra + k + 1) | ExtraVertexBit };
+            AddTriangle(draw, &chunk.extraVertices[firstExtra * m_vertexSize],
+                &chunk.extraVertices[(firstExtra + k) * m_vertexSize],
+                &chunk.extraVertices[(firstExtra + k + 1) * m_vertexSize], fan, chunk);
+        }
+    }
+}
+
+void SoftwareRasterizer::Draw(const RasterDrawCall& draw)
+{
+    if (!draw.pVertexShader || !draw.pVertexShader->vertex || (draw.pPixelShader ? !draw.pPixelShader->pixel : draw.colorTargetCount > 0) ||
+        draw.targetWidth == 0 || draw.targetHeight == 0 || draw.count < 3 || draw.instanceCount == 0 || draw.viewport.width <= 0.0f || draw.viewport.height <= 0.0f)
+    {
+        return;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    m_vertexSize = 4 + draw.pVertexShader->varyingCount;
+
+    // only the vertices the index buffer references get shaded, once per instance
+    UINT minVertex = ~0u;
+    UINT maxVertex = 0;
+    for (UINT i = 0; i < draw.count; i++)
+    {
+        UINT index = FetchIndex(draw, draw.start + i) + draw.baseVertex;
+        minVertex = index < minVertex ? index : minVertex;
+        maxVertex = index > maxVertex ? index : maxVertex;
+    }
+    UINT vertexRange = maxVertex - minVertex + 1;
+    ShadeVertices(draw, minVertex, vertexRange);
+
+    UINT totalTriangles = (draw.count / 3) * draw.instanceCount;
+    UINT chunkCount = (totalTriangles + ChunkTriangles - 1) / ChunkTriangles;
+    if (m_chunks.size() < chunkCount)
+        m_chunks.resize(chunkCount);
+
+    m_pool.ParallelFor(chunkCount, [&](UINT chunk, UINT)
+    {
+        SetupChunk& setup = m_chunks[chunk];
+        setup.triangles.clear();
+        setup.extraVertices.clear();
+
+        UINT first = chunk * ChunkTriangles;
+        UINT last = first + ChunkTriangles < totalTriangles ? first + ChunkTriangles : totalTriangles;
+        SetupTriangles(draw, minVertex, vertexRange, first, last, setup);
+    });
+
+    // merge the chunks in submission order, clipped vertices go after the shaded ones
+    m_triangles.clear();
+    for (UINT chunk = 0; chunk < chunkCount; chunk++)
+    {
+        SetupChunk& setup = m_chunks[chunk];
+        UINT extraBase = static_cast<UINT>(m_screenVertices.size() / m_vertexSize);
+        m_screenVertices.insert(m_screenVertices.end(), setup.extraVertices.begin(), setup.extraVertices.end());
+
+        for (Triangle& triangle : setup.triangles)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                if (triangle.vertex[k] & ExtraVertexBit)
+                    triangle.vertex[k] = extraBase + (triangle.vertex[k] & ~ExtraVertexBit);
+            }
+            m_triangles.push_back(triangle);
+        }
+    }
+
+    m_tilesX = (draw.targetWidth + TileSize - 1) / TileSize;
+    m_tilesY = (draw.targetHeight + TileSize - 1) / TileSize;
+    UINT tileCount = m_tilesX * m_tilesY;
+
+    // the bins share one array, counted first and then filled back to front
+    // so every bin keeps the submission order; the array only grows when a
+    // draw covers more tiles than any before it
+    m_binStarts.assign(tileCount + 1, 0);
+    for (const Triangle& triangle : m_triangles)
+    {
+        for (UINT ty = triangle.minY / TileSize; ty <= triangle.maxY / TileSize; ty++)
+        {
+            for (UINT tx = triangle.minX / TileSize; tx <= triangle.maxX / TileSize; tx++)
+            {
+                m_binStarts[ty * m_tilesX + tx]++;
+            }
+        }
+    }
+    for (UINT tile = 1; tile <= tileCount; tile++)
+    {
+        m_binStarts[tile] += m_binStarts[tile - 1];
+    }
+    m_binEntries.resize(m_binStarts[tileCount]);
+    for (UINT i = static_cast<UINT>(m_triangles.size()); i-- > 0;)
+    {
+        const Triangle& triangle = m_triangles[i];
+        for (UINT ty = triangle.minY / TileSize; ty <= triangle.maxY / TileSize; ty++)
+        {
+            for (UINT tx = triangle.minX / TileSize; tx <= triangle.maxX / TileSize; tx++)
+            {
+                m_binEntries[--m_binStarts[ty * m_tilesX + tx]] = i;
+            }
+        }
+    }
+
+    for (UINT64& pixels : m_threadPixels)
+    {
+        pixels = 0;
+    }
+
+    m_pool.ParallelFor(tileCount, [&](UINT tile, UINT threadIndex)
+    {
+        RasterizeTile(draw, tile, threadIndex);
+    });
+
+    m_stats.draws++;
+    m_stats.triangles += m_triangles.size();
+    for (UINT64 pixels : m_threadPixels)
+    {
+        m_stats.pixels += pixels;
+    }
+    m_stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void SoftwareRasterizer::RasterizeTile(const RasterDrawCall& draw, UINT tile, UINT threadIndex)
+{
+    const UINT binStart = m_binStarts[tile];
+    const UINT binEnd = m_binStarts[tile + 1];
+    if (binStart == binEnd)
+        return;
+
+    int tileX0 = static_cast<int>((tile % m_tilesX) * TileSize);
+    int tileY0 = static_cast<int>((tile / m_tilesX) * TileSize);
+    int tileX1 = tileX0 + static_cast<int>(TileSize) - 1;
+    int tileY1 = tileY0 + static_cast<int>(TileSize) - 1;
+
+    const DepthStencilDesc& depthState = draw.depthStencil;
+    bool depthTest = depthState.depthEnable && draw.depthTarget;
+    float* depthBuffer = draw.depthTarget;
+    int targetWidth = static_cast<int>(draw.targetWidth);
+    UINT64 pixels = 0;
+
+    for (UINT entry = binStart; entry < binEnd; entry++)
+    {
+        const Triangle& triangle = m_triangles[m_binEntries[entry]];
+        const float* v0 = &m_screenVertices[(size_t)triangle.vertex[0] * m_vertexSize];
+        const float* v1 = &m_screenVertices[(size_t)triangle.vertex[1] * m_vertexSize];
+        const float* v2 = &m_screenVertices[(size_t)triangle.vertex[2] * m_vertexSize];
+
+        int x0 = triangle.minX > tileX0 ? triangle.minX : tileX0;
+        int x1 = triangle.maxX < tileX1 ? triangle.maxX : tileX1;
+        int y0 = triangle.minY > tileY0 ? triangle.minY : tileY0;
+        int y1 = triangle.maxY < tileY1 ? triangle.maxY : tileY1;
+
+#ifdef CPU_X86
+        if (m_path == RasterPath::AVX2)
+        {
+            pixels += RasterizeAVX2(draw, triangle, x0, y0, x1, y1);
+            continue;
+        }
+#endif
+
+        // depth is linear in screen space: z = z0 + b1 * (z1 - z0) + b2 * (z2 - z0)
+        float dz1 = (v1[2] - v0[2]) * triangle.invArea;
+        float dz2 = (v2[2] - v0[2]) * triangle.invArea;
+        float minDepth = draw.viewport.minDepth;
+        float maxDepth = draw.viewport.maxDepth;
+
+#ifdef RASTER_SSE
+        const bool sse = m_path == RasterPath::SSE;
+        const __m128 laneOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        __m128 edgeA[3], edgeB[3], edgeC[3], topLeft[3];
+        for (int i = 0; i < 3; i++)
+        {
+            edgeA[i] = _mm_set1_ps(triangle.edgeA[i]);
+            edgeB[i] = _mm_set1_ps(triangle.edgeB[i]);
+            edgeC[i] = _mm_set1_ps(triangle.edgeC[i]);
+            topLeft[i] = _mm_castsi128_ps(_mm_set1_epi32(triangle.topLeft[i] ? -1 : 0));
+        }
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 z0 = _mm_set1_ps(v0[2]);
+        const __m128 zStep1 = _mm_set1_ps(dz1);
+        const __m128 zStep2 = _mm_set1_ps(dz2);
+        const __m128 zMin = _mm_set1_ps(minDepth);
+        const __m128 zMax = _mm_set1_ps(maxDepth);
+#endif
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float* depthRow = depthBuffer ? depthBuffer + (size_t)y * targetWidth : nullptr;
+
+            // quads start on a multiple of four, tiles are aligned to that too
+            for (int x = x0 & ~3; x <= x1; x += 4)
+            {
+                float w[3][4];
+                float z[4];
+                int mask = 0;
+
+#ifdef RASTER_SSE
+                if (sse)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+                    __m128 py = _mm_set1_ps(y + 0.5f);
+
+                    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    __m128 weights[3];
+                    for (int i = 0; i < 3; i++)
+                    {
+                        weights[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edgeA[i], px), _mm_mul_ps(edgeB[i], py)), edgeC[i]);
+                        __m128 onEdge = _mm_and_ps(topLeft[i], _mm_cmpeq_ps(weights[i], zero));
+                        inside = _mm_and_ps(inside, _mm_or_ps(_mm_cmpgt_ps(weights[i], zero), onEdge));
+                    }
+
+                    mask = _mm_movemask_ps(inside);
+                    if (x < x0)
+                        mask &= 0xF << (x0 - x);
+                    if (x + 3 > x1)
+                        mask &= 0xF >> (x + 3 - x1);
+                    if (!mask)
+                        continue;
+
+                    __m128 depth = _mm_add_ps(z0, _mm_add_ps(_mm_mul_ps(weights[1], zStep1), _mm_mul_ps(weights[2], zStep2)));
+                    depth = _mm_min_ps(_mm_max_ps(depth, zMin), zMax);
+
+                    if (depthTest)
+                    {
+                        __m128 stored;
+                        if (x >= 0 && x + 3 < targetWidth)
+                        {
+                            stored = _mm_loadu_ps(depthRow + x);
+                        }
+                        else
+                        {
+                            float storedLanes[4] = {};
+                            for (int lane = 0; lane < 4; lane++)
+                            {
+                                if (mask & (1 << lane))
+                                    storedLanes[lane] = depthRow[x + lane];
+                            }
+                            stored = _mm_loadu_ps(storedLanes);
+                        }
+                        mask &= _mm_movemask_ps(DepthTest4(depthState.depthFunc, depth, stored));
+                        if (!mask)
+                            continue;
+                    }
+
+                    _mm_storeu_ps(w[0], weights[0]);
+                    _mm_storeu_ps(w[1], weights[1]);
+                    _mm_storeu_ps(w[2], weights[2]);
+                    _mm_storeu_ps(z, depth);
+                }
+                else
+#endif
+                {
+                    for (int lane = 0; lane < 4; lane++)
+                    {
+                        int pixelX = x + lane;
+                        if (pixelX < x0 || pixelX > x1)
+                            continue;
+
+                        float px = pixelX + 0.5f;
+                        float py = y + 0.5f;
+                        bool inside = true;
+                        for (int i = 0; i < 3; i++)
+                        {
+                            w[i][lane] = triangle.edgeA[i] * px + triangle.edgeB[i] * py + triangle.edgeC[i];
+                            inside = inside && (w[i][lane] > 0.0f || (w[i][lane] == 0.0f && triangle.topLeft[i]));
+                        }
+                        if (!inside)
+                            continue;
+
+                        // same order of operations as the SIMD paths, so every path draws the same image
+                        z[lane] = ClampFloat(v0[2] + (w[1][lane] * dz1 + w[2][lane] * dz2), minDepth, maxDepth);
+                        if (depthTest && !DepthTest(depthState.depthFunc, z[lane], depthRow[pixelX]))
+                            continue;
+
+                        mask |= 1 << lane;
+                    }
+                    if (!mask)
+                        continue;
+                }
+
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!(mask & (1 << lane)))
+                        continue;
+
+                    if (draw.pPixelShader)
+                        ShadePixel(draw, triangle, x + lane, y, z[lane], w[0][lane], w[1][lane], w[2][lane]);
+                    if (depthTest && depthState.depthWrite)
+                        depthRow[x + lane] = z[lane];
+                    pixels++;
+                }
+            }
+        }
+    }
+
+    m_threadPixels[threadIndex] += pixels;
+}
+
+#ifdef CPU_X86
+// The SSE loop eight pixels at a time, with the same operations per lane
+CPU_TARGET("avx2")
+UINT64 SoftwareRasterizer::RasterizeAVX2(const RasterDrawCall& draw, const Triangle& triangle, int x0, int y0, int x1, int y1)
+{
+    const float* v0 = &m_screenVertices[(size_t)triangle.vertex[0] * m_vertexSize];
+    const float* v1 = &m_screenVertices[(size_t)triangle.vertex[1] * m_vertexSize];
+    const float* v2 = &m_screenVertices[(size_t)triangle.vertex[2] * m_vertexSize];
+
+    const DepthStencilDesc& depthState = draw.depthStencil;
+    bool depthTest = depthState.depthEnable && draw.depthTarget;
+    float* depthBuffer = draw.depthTarget;
+    int targetWidth = static_cast<int>(draw.targetWidth);
+    UINT64 pixels = 0;
+
+    const __m256 laneOffsets = _mm256_set_ps(7.5f, 6.5f, 5.5f, 4.5f, 3.5f, 2.5f, 1.5f, 0.5f);
+    __m256 edgeA[3], edgeB[3], edgeC[3], topLeft[3];
+    for (int i = 0; i < 3; i++)
+    {
+        edgeA[i] = _mm256_set1_ps(triangle.edgeA[i]);
+        edgeB[i] = _mm256_set1_ps(triangle.edgeB[i]);
+        edgeC[i] = _mm256_set1_ps(triangle.edgeC[i]);
+        topLeft[i] = _mm256_castsi256_ps(_mm256_set1_epi32(triangle.topLeft[i] ? -1 : 0));
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 z0 = _mm256_set1_ps(v0[2]);
+    const __m256 zStep1 = _mm256_set1_ps((v1[2] - v0[2]) * triangle.invArea);
+    const __m256 zStep2 = _mm256_set1_ps((v2[2] - v0[2]) * triangle.invArea);
+    const __m256 zMin = _mm256_set1_ps(draw.viewport.minDepth);
+    const __m256 zMax = _mm256_set1_ps(draw.viewport.maxDepth);
+
+    for (int y = y0; y <= y1; y++)
+    {
+        float* depthRow = depthBuffer ? depthBuffer + (size_t)y * targetWidth : nullptr;
+        __m256 py = _mm256_set1_ps(y + 0.5f);
+
+        // spans start on a multiple of eight, tiles are aligned to that too
+        for (int x = x0 & ~7; x <= x1; x += 8)
+        {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneOffsets);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            __m256 weights[3];
+            for (int i = 0; i < 3; i++)
+            {
+                weights[i] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[i], px), _mm256_mul_ps(edgeB[i], py)), edgeC[i]);
+                __m256 onEdge = _mm256_and_ps(topLeft[i], _mm256_cmp_ps(weights[i], zero, _CMP_EQ_OQ));
+                inside = _mm256_and_ps(inside, _mm256_or_ps(_mm256_cmp_ps(weights[i], zero, _CMP_GT_OQ), onEdge));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            if (x < x0)
+                mask &= 0xFF << (x0 - x);
+            if (x + 7 > x1)
+                mask &= 0xFF >> (x + 7 - x1);
+            if (!mask)
+                continue;
+
+            __m256 depth = _mm256_add_ps(z0, _mm256_add_ps(_mm256_mul_ps(weights[1], zStep1), _mm256_mul_ps(weights[2], zStep2)));
+            depth = _mm256_min_ps(_mm256_max_ps(depth, zMin), zMax);
+
+            if (depthTest)
+            {
+                __m256 stored;
+                if (x >= 0 && x + 7 < targetWidth)
+                {
+                    stored = _mm256_loadu_ps(depthRow + x);
+                }
+                else
+                {
+                    float storedLanes[8] = {};
+                    for (int lane = 0; lane < 8; lane++)
+                    {
+                        if (mask & (1 << lane))
+                            storedLanes[lane] = depthRow[x + lane];
+                    }
+                    stored = _mm256_loadu_ps(storedLanes);
+                }
+                mask &= _mm256_movemask_ps(DepthTest8(depthState.depthFunc, depth, stored));
+                if (!mask)
+                    continue;
+            }
+
+            float w[3][8];
+            float z[8];
+            _mm256_storeu_ps(w[0], weights[0]);
+            _mm256_storeu_ps(w[1], weights[1]);
+            _mm256_storeu_ps(w[2], weights[2]);
+            _mm256_storeu_ps(z, depth);
+
+            for (int lane = 0; lane < 8; lane++)
+            {
+                if (!(mask & (1 << lane)))
+                    continue;
+
+                if (draw.pPixelShader)
+                    ShadePixel(draw, triangle, x + lane, y, z[lane], w[0][lane], w[1][lane], w[2][lane]);
+                if (depthTest && depthState.depthWrite)
+                    depthRow[x + lane] = z[lane];
+                pixels++;
+            }
+        }
+    }
+
+    return pixels;
+}
+#endif
+
+void SoftwareRasterizer::ShadePixel(const RasterDrawCall& draw, const Triangle& triangle, int x, int y, float z,
+    float w0, float w1, float w2)
+{
+    const float* v0 = &m_screenVertices[(size_t)triangle.vertex[0] * m_vertexSize];
+    const float* v1 = &m_screenVertices[(size_t)triangle.vertex[1] * m_vertexSize];
+    const float* v2 = &m_screenVertices[(size_t)triangle.vertex[2] * m_vertexSize];
+
+    // perspective correct interpolation of varying / w
+    float b0 = w0 * triangle.invArea;
+    float b1 = w1 * triangle.invArea;
+    float b2 = w2 * triangle.invArea;
+    float w = 1.0f / (b0 * v0[3] + b1 * v1[3] + b2 * v2[3]);
+
+    // SV_Position follows the varyings: pixel center, depth and w
+    float varyings[CpuMaxVaryings + 4];
+    UINT varyingCount = m_vertexSize - 4;
+    for (UINT k = 0; k < varyingCount; k++)
+    {
+        varyings[k] = (b0 * v0[k + 4] + b1 * v1[k + 4] + b2 * v2[k + 4]) * w;
+    }
+    varyings[varyingCount] = x + 0.5f;
+    varyings[varyingCount + 1] = y + 0.5f;
+    varyings[varyingCount + 2] = z;
+    varyings[varyingCount + 3] = w;
+
+    float outputs[4 * MaxRenderTargets] = {};
+    draw.pPixelShader->pixel(draw.pixelBindings, varyings, outputs);
+
+    // every target is blended the same way, each with its own output
+    const BlendDesc& blend = draw.blend;
+    size_t texel = (size_t)y * draw.targetWidth + x;
+    for (UINT target = 0; target < draw.colorTargetCount; target++)
+    {
+        const float* src = outputs + target * 4;
+        float result[4];
+        if (blend.blendEnable)
+        {
+            float dst[4];
+            ReadTarget(draw.colorTargets[target], texel, dst);
+            for (int c = 0; c < 3; c++)
+            {
+                result[c] = BlendValues(blend.blendOp,
+                    src[c] * BlendFactor(blend.srcBlend, src, dst, c),
+                    dst[c] * BlendFactor(blend.destBlend, src, dst, c));
+            }
+            result[3] = BlendValues(blend.blendOpAlpha,
+                src[3] * BlendFactor(blend.srcBlendAlpha, src, dst, 3),
+                dst[3] * BlendFactor(blend.destBlendAlpha, src, dst, 3));
+        }
+        else
+        {
+            memcpy(result, src, sizeof(result));
+        }
+
+        WriteTarget(draw.colorTargets[target], texel, result, blend.writeMask);
+    }
+}
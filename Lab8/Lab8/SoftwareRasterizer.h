@@ -0,0 +1,142 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <vector>
+
+#include "CpuShaders.h"
+#include "ThreadPool.h"
+
+struct RasterTarget
+{
+    BYTE* data;
+    Format format;
+};
+
+// Everything the rasterizer needs from the bound pipeline for one draw
+struct RasterDrawCall
+{
+    const CpuShaderProgram* pVertexShader = nullptr;
+    const CpuShaderProgram* pPixelShader = nullptr;        // nullptr for depth only draws
+    CpuShaderBindings vertexBindings = {};
+    CpuShaderBindings pixelBindings = {};
+
+    const BYTE* vertices = nullptr;
+    UINT vertexStride = 0;
+    UINT vertexCount = 0;
+
+    // nullptr for Draw(), otherwise R16_UINT or R32_UINT indices
+    const BYTE* indices = nullptr;
+    Format indexFormat = Format::R16_UINT;
+
+    UINT count = 0;             // indices, or vertices for non-indexed draws
+    UINT start = 0;             // first index, or first vertex
+    int baseVertex = 0;
+    UINT instanceCount = 1;
+    UINT startInstance = 0;
+
+    // R8G8B8A8_UNORM, R16G16B16A16_UNORM, R32G32B32A32_FLOAT or R32_FLOAT;
+    // none when the pixel shader only writes UAVs
+    RasterTarget colorTargets[MaxRenderTargets] = {};
+    UINT colorTargetCount = 0;
+    float* depthTarget = nullptr;   // D32_FLOAT
+    UINT targetWidth = 0;
+    UINT targetHeight = 0;
+
+    Viewport viewport;
+    RasterizerDesc rasterizer;
+    DepthStencilDesc depthStencil;
+    BlendDesc blend;
+};
+
+struct RasterStats
+{
+    UINT64 draws = 0;
+    UINT64 triangles = 0;       // triangles that reached the tiles, after culling and clipping
+    UINT64 pixels = 0;          // pixels that passed the depth test and were shaded
+    double seconds = 0.0;
+};
+
+enum class RasterPath
+{
+    Scalar,
+    SSE,        // 4 pixels per iteration
+    AVX2        // 8 pixels per iteration
+};
+
+// Widest path the processor supports
+RasterPath GetBestRasterPath();
+bool IsRasterPathSupported(RasterPath path);
+const char* GetRasterPathName(RasterPath path);
+
+// Binned tile rasterizer. Vertices are shaded and triangles set up in
+// parallel, then binned into TileSize x TileSize screen tiles that the
+// thread pool rasterizes independently. Coverage and depth are evaluated
+// eight pixels at a time with AVX2 or four with SSE, picked at runtime like
+// the culling paths; triangles are drawn in submission order inside a tile
+// so blending matches the GPU.
+class SoftwareRasterizer
+{
+public:
+    static const UINT TileSize = 64;
+
+    explicit SoftwareRasterizer(UINT threadCount = 0);
+
+    void Draw(const RasterDrawCall& draw);
+
+    UINT GetThreadCount() const { return m_pool.GetThreadCount(); }
+    // Shared with compute dispatches whose groups can run side by side
+    ThreadPool& GetThreadPool() { return m_pool; }
+    const RasterStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = RasterStats(); }
+
+    // Every path draws the same pixels; unsupported paths fall back to the best one
+    RasterPath GetPath() const { return m_path; }
+    void SetPath(RasterPath path);
+
+private:
+    // screen space triangle, edge i is opposite vertex i
+    struct Triangle
+    {
+        UINT vertex[3];
+        float edgeA[3];
+        float edgeB[3];
+        float edgeC[3];
+        bool topLeft[3];
+        float invArea;
+        int minX, minY, maxX, maxY;
+    };
+
+    struct SetupChunk
+    {
+        std::vector<Triangle> triangles;
+        std::vector<float> extraVertices;   // produced by clipping, already projected
+    };
+
+    void ShadeVertices(const RasterDrawCall& draw, UINT minVertex, UINT vertexRange);
+    void SetupTriangles(const RasterDrawCall& draw, UINT minVertex, UINT vertexRange, UINT first, UINT last, SetupChunk& chunk);
+    void AddTriangle(const RasterDrawCall& draw, const float* v0, const float* v1, const float* v2,
+        const UINT* indices, SetupChunk& chunk);
+    void Project(const RasterDrawCall& draw, const float* clip, float* screen) const;
+    void RasterizeTile(const RasterDrawCall& draw, UINT tile, UINT threadIndex);
+    UINT64 RasterizeAVX2(const RasterDrawCall& draw, const Triangle& triangle, int x0, int y0, int x1, int y1);
+    void ShadePixel(const RasterDrawCall& draw, const Triangle& triangle, int x, int y, float z, float w0, float w1, float w2);
+
+    ThreadPool m_pool;
+    RasterPath m_path;
+    UINT m_vertexSize;
+
+    std::vector<float> m_clipVertices;      // vertex shader output
+    std::vector<float> m_screenVertices;    // x, y, z, 1/w, varyings/w
+    std::vector<SetupChunk> m_chunks;
+    std::vector<Triangle> m_triangles;
+
+    UINT m_tilesX;
+    UINT m_tilesY;
+    std::vector<UINT> m_binStarts;          // first entry of every tile, then the entry count
+    std::vector<UINT> m_binEntries;         // triangle indices of all tiles, tile by tile
+    std::vector<UINT64> m_threadPixels;
+
+    RasterStats m_stats;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "StateCache.h"
+
+// Descriptors are hashed and compared field by field, the padding between
+// the bools and enums is not guaranteed to be zero
+static void HashCombine(size_t& seed, UINT value)
+{
+    seed ^= value + 0x9E3779B9u + (seed << 6) + (seed >> 2);
+}
+
+size_t StateDescHash::operator()(const RasterizerDesc& desc) const
+{
+    size_t seed = 0;
+    HashCombine(seed, static_cast<UINT>(desc.fillMode));
+    HashCombine(seed, static_cast<UINT>(desc.cullMode));
+    HashCombine(seed, desc.frontCounterClockwise);
+    return seed;
+}
+
+size_t StateDescHash::operator()(const DepthStencilDesc& desc) const
+{
+    size_t seed = 0;
+    HashCombine(seed, desc.depthEnable);
+    HashCombine(seed, desc.depthWrite);
+    HashCombine(seed, static_cast<UINT>(desc.depthFunc));
+    return seed;
+}
+
+size_t StateDescHash::operator()(const BlendDesc& desc) const
+{
+    size_t seed = 0;
+    HashCombine(seed, desc.blendEnable);
+    HashCombine(seed, static_cast<UINT>(desc.srcBlend));
+    HashCombine(seed, static_cast<UINT>(desc.destBlend));
+    HashCombine(seed, static_cast<UINT>(desc.blendOp));
+    HashCombine(seed, static_cast<UINT>(desc.srcBlendAlpha));
+    HashCombine(seed, static_cast<UINT>(desc.destBlendAlpha));
+    HashCombine(seed, static_cast<UINT>(desc.blendOpAlpha));
+    HashCombine(seed, desc.writeMask);
+    return seed;
+}
+
+bool operator==(const RasterizerDesc& a, const RasterizerDesc& b)
+{
+    return a.fillMode == b.fillMode &&
+        a.cullMode == b.cullMode &&
+        a.frontCounterClockwise == b.frontCounterClockwise;
+}
+
+bool operator==(const DepthStencilDesc& a, const DepthStencilDesc& b)
+{
+    return a.depthEnable == b.depthEnable &&
+        a.depthWrite == b.depthWrite &&
+        a.depthFunc == b.depthFunc;
+}
+
+bool operator==(const BlendDesc& a, const BlendDesc& b)
+{
+    return a.blendEnable == b.blendEnable &&
+        a.srcBlend == b.srcBlend &&
+        a.destBlend == b.destBlend &&
+        a.blendOp == b.blendOp &&
+        a.srcBlendAlpha == b.srcBlendAlpha &&
+        a.destBlendAlpha == b.destBlendAlpha &&
+        a.blendOpAlpha == b.blendOpAlpha &&
+        a.writeMask == b.writeMask;
+}
+
+void StateCache::Init(RenderDevice* pDevice)
+{
+    Clear();
+    m_pDevice = pDevice;
+    ResetStats();
+}
+
+template <typename Map>
+static void ReleaseStates(RenderDevice* pDevice, Map& states)
+{
+    for (auto& entry : states)
+    {
+        pDevice->Release(entry.second);
+    }
+    states.clear();
+}
+
+void StateCache::Clear()
+{
+    if (!m_pDevice)
+        return;
+
+    ReleaseStates(m_pDevice, m_rasterizerStates);
+    ReleaseStates(m_pDevice, m_depthStencilStates);
+    ReleaseStates(m_pDevice, m_blendStates);
+    m_pDevice = nullptr;
+}
+
+template <typename Desc, typename Map, typename Create>
+static HRESULT FindOrCreate(Map& states, const Desc& desc, RenderHandle* pState, StateCacheStats& stats, Create create)
+{
+    auto it = states.find(desc);
+    if (it != states.end())
+    {
+        stats.hits++;
+        *pState = it->second;
+        return S_OK;
+    }
+
+    stats.misses++;
+    HRESULT result = create(desc, pState);
+    if (SUCCEEDED(result))
+        states.emplace(desc, *pState);
+
+    return result;
+}
+
+HRESULT StateCache::GetRasterizerState(const RasterizerDesc& desc, RenderHandle* pState)
+{
+    if (!m_pDevice)
+        return E_FAIL;
+
+    return FindOrCreate(m_rasterizerStates, desc, pState, m_stats,
+        [this](const RasterizerDesc& d, RenderHandle* p) { return m_pDevice->CreateRasterizerState(d, p); });
+}
+
+HRESULT StateCache::GetDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState)
+{
+    if (!m_pDevice)
+        return E_FAIL;
+
+    return FindOrCreate(m_depthStencilStates, desc, pState, m_stats,
+        [this](const DepthStencilDesc& d, RenderHandle* p) { return m_pDevice->CreateDepthStencilState(d, p); });
+}
+
+HRESULT StateCache::GetBlendState(const BlendDesc& desc, RenderHandle* pState)
+{
+    if (!m_pDevice)
+        return E_FAIL;
+
+    return FindOrCreate(m_blendStates, desc, pState, m_stats,
+        [this](const BlendDesc& d, RenderHandle* p) { return m_pDevice->CreateBlendState(d, p); });
+}
+
+UINT StateCache::GetObjectCount() const
+{
+    return static_cast<UINT>(m_rasterizerStates.size() + m_depthStencilStates.size() + m_blendStates.size());
+}
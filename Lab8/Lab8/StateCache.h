@@ -0,0 +1,57 @@
+#ifndef STATE_CACHE_H
+#define STATE_CACHE_H
+
+#include "RenderBackend.h"
+
+#include <unordered_map>
+
+struct StateCacheStats
+{
+    UINT hits = 0;
+    UINT misses = 0;
+};
+
+struct StateDescHash
+{
+    size_t operator()(const RasterizerDesc& desc) const;
+    size_t operator()(const DepthStencilDesc& desc) const;
+    size_t operator()(const BlendDesc& desc) const;
+};
+
+bool operator==(const RasterizerDesc& a, const RasterizerDesc& b);
+bool operator==(const DepthStencilDesc& a, const DepthStencilDesc& b);
+bool operator==(const BlendDesc& a, const BlendDesc& b);
+
+// Immutable rasterizer, depth-stencil and blend states shared by everyone
+// who asks for the same descriptor. The cache owns the objects, callers
+// must not release the handles it returns, Clear() releases them all.
+class StateCache
+{
+public:
+    StateCache() : m_pDevice(nullptr) {}
+
+    void Init(RenderDevice* pDevice);
+    void Clear();
+
+    HRESULT GetRasterizerState(const RasterizerDesc& desc, RenderHandle* pState);
+    HRESULT GetDepthStencilState(const DepthStencilDesc& desc, RenderHandle* pState);
+    HRESULT GetBlendState(const BlendDesc& desc, RenderHandle* pState);
+
+    UINT GetObjectCount() const;
+    const StateCacheStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = StateCacheStats(); }
+
+private:
+    StateCache(const StateCache&) = delete;
+    StateCache& operator=(const StateCache&) = delete;
+
+    RenderDevice* m_pDevice;
+
+    std::unordered_map<RasterizerDesc, RenderHandle, StateDescHash> m_rasterizerStates;
+    std::unordered_map<DepthStencilDesc, RenderHandle, StateDescHash> m_depthStencilStates;
+    std::unordered_map<BlendDesc, RenderHandle, StateDescHash> m_blendStates;
+
+    StateCacheStats m_stats;
+};
+
+#endif
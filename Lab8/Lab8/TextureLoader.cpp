@@ -0,0 +1,282 @@
+#include "TextureLoader.h"
+
+#include <cstring>
+
+static const UINT DDSMagic = 0x20534444;       // "DDS "
+static const UINT DDSHeaderSize = 4 + 124;     // magic + DDS_HEADER
+
+// Maps the file and faults it in, so the disk reads happen on the worker,
+// and checks that the backends will find every subresource in it
+static HRESULT ReadDDSFile(const std::wstring& path, MappedFile& file)
+{
+    HRESULT result = file.Open(path);
+    if (FAILED(result))
+        return result;
+    file.Prefetch();
+
+    DDSLayout layout;
+    return GetDDSLayout(file.GetData(), file.GetSize(), layout);
+}
+
+// 1x1 RGBA8 DDS file, with six faces for a cube map
+static std::vector<BYTE> BuildPlaceholderDDS(TextureShape shape, const BYTE color[4])
+{
+    const UINT faces = shape == TextureShape::TextureCube ? 6 : 1;
+
+    UINT header[DDSHeaderSize / 4] = {};
+    header[0] = DDSMagic;
+    header[1] = 124;
+    header[2] = 0x100F;             // CAPS | HEIGHT | WIDTH | PITCH | PIXELFORMAT
+    header[3] = 1;
+    header[4] = 1;
+    header[5] = 4;
+    header[7] = 1;
+    header[19] = 32;
+    header[20] = 0x41;              // DDPF_RGB | DDPF_ALPHAPIXELS
+    header[22] = 32;
+    header[23] = 0x000000FF;
+    header[24] = 0x0000FF00;
+    header[25] = 0x00FF0000;
+    header[26] = 0xFF000000;
+    header[27] = 0x1000;            // DDSCAPS_TEXTURE
+    if (faces == 6)
+    {
+        header[27] |= 0x8;          // DDSCAPS_COMPLEX
+        header[28] = 0xFE00;        // DDSCAPS2_CUBEMAP with all faces
+    }
+
+    std::vector<BYTE> file(sizeof(header) + 4 * faces);
+    memcpy(file.data(), header, sizeof(header));
+    for (UINT face = 0; face < faces; face++)
+    {
+        memcpy(&file[sizeof(header) + 4 * face], color, 4);
+    }
+    return file;
+}
+
+TextureLoader::TextureLoader() :
+    m_pDevice(nullptr),
+    m_reading(0),
+    m_stop(false)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+    Terminate();
+}
+
+HRESULT TextureLoader::Init(RenderDevice* pDevice, UINT threadCount)
+{
+    Terminate();
+    m_pDevice = pDevice;
+    m_stop = false;
+    m_stats = TextureLoaderStats();
+
+    if (threadCount == 0)
+    {
+        threadCount = std::thread::hardware_concurrency();
+        if (threadCount < 4)
+            threadCount = 4;
+    }
+
+    for (UINT i = 0; i < threadCount; i++)
+    {
+        m_workers.emplace_back(&TextureLoader::WorkerLoop, this);
+    }
+    return S_OK;
+}
+
+void TextureLoader::Terminate()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_queue.clear();
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+    m_workers.clear();
+
+    m_completed.clear();
+    m_reading = 0;
+    m_pDevice = nullptr;
+}
+
+HRESULT TextureLoader::CreatePlaceholder(TextureShape shape, UINT arraySize, const BYTE color[4], RenderHandle* pTexture)
+{
+    static const BYTE Grey[4] = { 128, 128, 128, 255 };
+    std::vector<BYTE> file = BuildPlaceholderDDS(shape, color ? color : Grey);
+    if (arraySize == 0)
+        return m_pDevice->CreateTextureFromMemory(file.data(), file.size(), pTexture);
+
+    std::vector<const BYTE*> slices(arraySize, file.data());
+    std::vector<size_t> sizes(arraySize, file.size());
+    return m_pDevice->CreateTextureArrayFromMemory(slices.data(), sizes.data(), arraySize, pTexture);
+}
+
+HRESULT TextureLoader::Load(const std::wstring& path, RenderHandle* pTexture, TextureShape shape, const BYTE placeholderColor[4])
+{
+    std::unique_ptr<Request> request(new Request());
+    request->paths.push_back(path);
+    request->pTarget = pTexture;
+
+    HRESULT result = CreatePlaceholder(shape, 0, placeholderColor, &request->placeholder);
+    if (FAILED(result))
+        return result;
+
+    *pTexture = request->placeholder;
+    return Queue(std::move(request));
+}
+
+HRESULT TextureLoader::LoadArray(const std::wstring* paths, UINT count, RenderHandle* pTexture, const BYTE placeholderColor[4])
+{
+    if (count == 0)
+        return E_INVALIDARG;
+
+    std::unique_ptr<Request> request(new Request());
+    request->paths.assign(paths, paths + count);
+    request->pTarget = pTexture;
+
+    HRESULT result = CreatePlaceholder(TextureShape::Texture2D, count, placeholderColor, &request->placeholder);
+    if (FAILED(result))
+        return result;
+
+    *pTexture = request->placeholder;
+    return Queue(std::move(request));
+}
+
+HRESULT TextureLoader::Queue(std::unique_ptr<Request> request)
+{
+    if (m_workers.empty())
+        return E_FAIL;
+
+    m_stats.requests++;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(std::move(request));
+    }
+    m_wake.notify_one();
+    return S_OK;
+}
+
+void TextureLoader::WorkerLoop()
+{
+    for (;;)
+    {
+        std::unique_ptr<Request> request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+            if (m_stop)
+                return;
+            request = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_reading++;
+        }
+
+        request->files.resize(request->paths.size());
+        for (size_t i = 0; i < request->paths.size() && SUCCEEDED(request->result); i++)
+        {
+            request->result = ReadDDSFile(request->paths[i], request->files[i]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_completed.push_back(std::move(request));
+            m_reading--;
+        }
+        m_loaded.notify_all();
+    }
+}
+
+HRESULT TextureLoader::Create(Request& request)
+{
+    HRESULT result = request.result;
+    if (FAILED(result))
+        return result;
+
+    RenderHandle texture = NullHandle;
+    if (request.files.size() == 1)
+    {
+        result = m_pDevice->CreateTextureFromMemory(request.files[0].GetData(), request.files[0].GetSize(), &texture);
+    }
+    else
+    {
+        std::vector<const BYTE*> data(request.files.size());
+        std::vector<size_t> sizes(request.files.size());
+        for (size_t i = 0; i < request.files.size(); i++)
+        {
+            data[i] = request.files[i].GetData();
+            sizes[i] = request.files[i].GetSize();
+        }
+        result = m_pDevice->CreateTextureArrayFromMemory(data.data(), sizes.data(), static_cast<UINT>(data.size()), &texture);
+    }
+    if (FAILED(result))
+        return result;
+
+    for (const MappedFile& file : request.files)
+    {
+        m_stats.bytes += file.GetSize();
+    }
+
+    // the target may have been released and cleared by its owner meanwhile
+    if (*request.pTarget == request.placeholder)
+    {
+        m_pDevice->Release(request.placeholder);
+        *request.pTarget = texture;
+    }
+    else
+    {
+        m_pDevice->Release(texture);
+    }
+    return S_OK;
+}
+
+HRESULT TextureLoader::Update(UINT maxCount)
+{
+    HRESULT firstFailure = S_OK;
+    for (UINT created = 0; maxCount == 0 || created < maxCount; created++)
+    {
+        std::unique_ptr<Request> request;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_completed.empty())
+                break;
+            request = std::move(m_completed.front());
+            m_completed.pop_front();
+        }
+
+        HRESULT result = Create(*request);
+        if (SUCCEEDED(result))
+        {
+            m_stats.created++;
+        }
+        else
+        {
+            m_stats.failed++;
+            if (SUCCEEDED(firstFailure))
+                firstFailure = result;
+        }
+    }
+    return firstFailure;
+}
+
+HRESULT TextureLoader::Flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_loaded.wait(lock, [&] { return m_queue.empty() && m_reading == 0; });
+    }
+    return Update();
+}
+
+UINT TextureLoader::GetPendingCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<UINT>(m_queue.size() + m_completed.size()) + m_reading;
+}
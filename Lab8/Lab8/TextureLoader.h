@@ -0,0 +1,99 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RenderBackend.h"
+#include "DDSFile.h"
+
+// What the placeholder has to look like to the shader that samples it
+enum class TextureShape
+{
+    Texture2D,
+    TextureCube
+};
+
+struct TextureLoaderStats
+{
+    UINT requests = 0;
+    UINT created = 0;
+    UINT failed = 0;
+    UINT64 bytes = 0;       // DDS file bytes mapped by the workers
+};
+
+// Loads DDS textures in the background. Load() puts a 1x1 placeholder of
+// the given color into the target handle and queues the files; worker
+// threads map them, fault the pages in and check the layout, then Update() on the render
+// thread creates the textures that have arrived and swaps them into their
+// targets, releasing the placeholders. The device is only touched from the
+// thread that calls Load() and Update().
+//
+// A target must stay valid until its load completes or Terminate() is
+// called; Terminate() drops pending loads and leaves their placeholders
+// to the owner of the target.
+class TextureLoader
+{
+public:
+    TextureLoader();
+    ~TextureLoader();
+
+    TextureLoader(const TextureLoader&) = delete;
+    TextureLoader& operator=(const TextureLoader&) = delete;
+
+    // threadCount 0 starts one worker per hardware thread, at least four
+    // since the workers mostly wait for the disk
+    HRESULT Init(RenderDevice* pDevice, UINT threadCount = 0);
+    void Terminate();
+
+    HRESULT Load(const std::wstring& path, RenderHandle* pTexture,
+        TextureShape shape = TextureShape::Texture2D, const BYTE placeholderColor[4] = nullptr);
+    // Slice i of the array is paths[i], see RenderDevice::CreateTextureArrayFromFiles
+    HRESULT LoadArray(const std::wstring* paths, UINT count, RenderHandle* pTexture,
+        const BYTE placeholderColor[4] = nullptr);
+
+    // Creates at most maxCount of the loaded textures, 0 creates all of
+    // them. Returns the first failure, the failed target keeps its placeholder.
+    HRESULT Update(UINT maxCount = 0);
+    // Waits for every queued file and creates the textures
+    HRESULT Flush();
+
+    UINT GetPendingCount() const;
+    UINT GetThreadCount() const { return static_cast<UINT>(m_workers.size()); }
+    const TextureLoaderStats& GetStats() const { return m_stats; }
+
+private:
+    struct Request
+    {
+        std::vector<std::wstring> paths;
+        std::vector<MappedFile> files;     // unmapped with the request once the texture exists
+        RenderHandle* pTarget = nullptr;
+        RenderHandle placeholder = NullHandle;
+        HRESULT result = S_OK;
+    };
+
+    HRESULT CreatePlaceholder(TextureShape shape, UINT arraySize, const BYTE color[4], RenderHandle* pTexture);
+    HRESULT Queue(std::unique_ptr<Request> request);
+    HRESULT Create(Request& request);
+    void WorkerLoop();
+
+    RenderDevice* m_pDevice;
+    std::vector<std::thread> m_workers;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_loaded;
+    std::deque<std::unique_ptr<Request>> m_queue;       // waiting for a worker
+    std::deque<std::unique_ptr<Request>> m_completed;   // read, waiting for Update()
+    UINT m_reading;
+    bool m_stop;
+
+    TextureLoaderStats m_stats;
+};
+
+#endif
@@ -0,0 +1,383 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static Format FormatFromDXGI(UINT dxgiFormat)
+{
+    switch (dxgiFormat)
+    {
+    case 28: return Format::R8G8B8A8_UNORM;
+    case 87: return Format::B8G8R8A8_UNORM;
+    case 71: return Format::BC1_UNORM;
+    case 74: return Format::BC2_UNORM;
+    case 77: return Format::BC3_UNORM;
+    default: return Format::Unknown;
+    }
+}
+
+static UINT MipSize(UINT size, UINT mip)
+{
+    return size >> mip ? size >> mip : 1;
+}
+
+TextureStreamer::TextureStreamer() :
+    m_pDevice(nullptr),
+    m_budget(0),
+    m_tailSize(DefaultTailSize),
+    m_frame(1)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    Terminate();
+}
+
+HRESULT TextureStreamer::Init(RenderDevice* pDevice, UINT64 budgetBytes, UINT tailSize)
+{
+    Terminate();
+    m_pDevice = pDevice;
+    m_budget = budgetBytes;
+    m_tailSize = tailSize ? tailSize : 1;
+    m_frame = 1;
+    m_stats = TextureStreamerStats();
+    return S_OK;
+}
+
+void TextureStreamer::Terminate()
+{
+    for (std::unique_ptr<Texture>& texture : m_textures)
+    {
+        // the prefetch reads the mapping, let it finish before unmapping
+        if (texture->prefetch.valid())
+            texture->prefetch.wait();
+        if (m_pDevice && texture->handle)
+            m_pDevice->Release(texture->handle);
+    }
+    m_textures.clear();
+    m_candidates.clear();
+    m_pDevice = nullptr;
+}
+
+HRESULT TextureStreamer::Add(const std::wstring* paths, UINT count, RenderHandle* pTexture)
+{
+    if (!m_pDevice || count == 0)
+        return E_INVALIDARG;
+
+    std::unique_ptr<Texture> texture(new Texture());
+    texture->files.resize(count);
+    texture->layouts.resize(count);
+
+    UINT arraySize = 0;
+    for (UINT i = 0; i < count; i++)
+    {
+        HRESULT result = texture->files[i].Open(paths[i]);
+        if (SUCCEEDED(result))
+            result = GetDDSLayout(texture->files[i].GetData(), texture->files[i].GetSize(), texture->layouts[i]);
+        if (FAILED(result))
+            return result;
+
+        const DDSLayout& layout = texture->layouts[i];
+        const DDSLayout& first = texture->layouts[0];
+        if (layout.width != first.width || layout.height != first.height ||
+            layout.mipLevels != first.mipLevels || layout.dxgiFormat != first.dxgiFormat)
+        {
+            return E_INVALIDARG;
+        }
+        arraySize += layout.arraySize;
+    }
+
+    const DDSLayout& first = texture->layouts[0];
+    texture->desc.width = first.width;
+    texture->desc.height = first.height;
+    texture->desc.format = FormatFromDXGI(first.dxgiFormat);
+    texture->desc.bindFlags = BIND_SHADER_RESOURCE;
+    texture->desc.mipLevels = first.mipLevels;
+    texture->desc.arraySize = arraySize;
+    texture->desc.cube = count == 1 && first.cube;
+
+    // the coarsest mip still no larger than the tail size; block
+    // compressed textures need a top mip that is a whole number of blocks
+    UINT tailMip = 0;
+    for (UINT mip = 1; mip < first.mipLevels; mip++)
+    {
+        UINT width = MipSize(first.width, mip);
+        UINT height = MipSize(first.height, mip);
+        if (first.blockCompressed && (width % 4 || height % 4))
+            break;
+        tailMip = mip;
+        if (width <= m_tailSize && height <= m_tailSize)
+            break;
+    }
+
+    texture->streamed = texture->desc.format != Format::Unknown && tailMip > 0;
+    texture->tailMip = texture->streamed ? tailMip : 0;
+    texture->residentMip = texture->tailMip;
+    texture->wantedMip = texture->tailMip;
+
+    HRESULT result;
+    if (texture->streamed)
+    {
+        result = Rebuild(*texture, texture->tailMip);
+    }
+    else
+    {
+        // nothing to stream, created in full and accounted as resident
+        std::vector<const BYTE*> data(count);
+        std::vector<size_t> sizes(count);
+        for (UINT i = 0; i < count; i++)
+        {
+            data[i] = texture->files[i].GetData();
+            sizes[i] = texture->files[i].GetSize();
+        }
+        result = count == 1 ?
+            m_pDevice->CreateTextureFromMemory(data[0], sizes[0], &texture->handle) :
+            m_pDevice->CreateTextureArrayFromMemory(data.data(), sizes.data(), count, &texture->handle);
+        if (SUCCEEDED(result))
+        {
+            m_stats.residentBytes += GetResidentBytes(*texture, 0);
+            m_stats.peakResidentBytes = std::max(m_stats.peakResidentBytes, m_stats.residentBytes);
+            texture->files.clear();
+        }
+    }
+    if (FAILED(result))
+        return result;
+
+    *pTexture = texture->handle;
+    m_textures.push_back(std::move(texture));
+    return S_OK;
+}
+
+UINT64 TextureStreamer::GetResidentBytes(const Texture& texture, UINT firstMip) const
+{
+    UINT64 bytes = 0;
+    for (const DDSLayout& layout : texture.layouts)
+    {
+        for (size_t i = 0; i < layout.subresources.size(); i++)
+        {
+            if (i % layout.mipLevels >= firstMip)
+                bytes += layout.subresources[i].slicePitch;
+        }
+    }
+    return bytes;
+}
+
+HRESULT TextureStreamer::Rebuild(Texture& texture, UINT firstMip)
+{
+    TextureDesc desc = texture.desc;
+    desc.width = MipSize(texture.desc.width, firstMip);
+    desc.height = MipSize(texture.desc.height, firstMip);
+    desc.mipLevels = texture.desc.mipLevels - firstMip;
+
+    std::vector<SubresourceData> initData;
+    initData.reserve(static_cast<size_t>(desc.mipLevels) * desc.arraySize);
+    for (const DDSLayout& layout : texture.layouts)
+    {
+        for (size_t i = 0; i < layout.subresources.size(); i++)
+        {
+            if (i % layout.mipLevels < firstMip)
+                continue;
+            const DDSSubresource& subresource = layout.subresources[i];
+            SubresourceData data;
+            data.pData = subresource.pData;
+            data.rowPitch = subresource.rowPitch;
+            data.slicePitch = subresource.slicePitch;
+            initData.push_back(data);
+        }
+    }
+
+    RenderHandle rebuilt = NullHandle;
+    HRESULT result = m_pDevice->CreateTexture(desc, initData.data(), &rebuilt);
+    if (FAILED(result))
+        return result;
+
+    if (texture.handle)
+    {
+        m_pDevice->ReplaceResource(texture.handle, rebuilt);
+        m_stats.residentBytes -= GetResidentBytes(texture, texture.residentMip);
+    }
+    else
+    {
+        texture.handle = rebuilt;
+    }
+
+    texture.residentMip = firstMip;
+    // the pages of the resident mips were just read
+    texture.prefetchMip = firstMip;
+    m_stats.residentBytes += GetResidentBytes(texture, firstMip);
+    m_stats.peakResidentBytes = std::max(m_stats.peakResidentBytes, m_stats.residentBytes);
+    return S_OK;
+}
+
+void TextureStreamer::StartPrefetch(Texture& texture, UINT firstMip)
+{
+    // one range per file from the first new mip of the first slice to the
+    // last new mip of the last slice, the coarse mips in between are small
+    struct Range
+    {
+        const MappedFile* pFile;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<Range> ranges;
+    for (size_t i = 0; i < texture.files.size(); i++)
+    {
+        const DDSLayout& layout = texture.layouts[i];
+        const BYTE* pBase = texture.files[i].GetData();
+        const BYTE* pBegin = layout.subresources[firstMip].pData;
+        const DDSSubresource& last = layout.subresources[(layout.arraySize - 1) * layout.mipLevels + texture.residentMip - 1];
+        ranges.push_back({ &texture.files[i], static_cast<size_t>(pBegin - pBase),
+            static_cast<size_t>(last.pData + last.slicePitch - pBegin) });
+    }
+
+    texture.prefetchMip = firstMip;
+    texture.prefetch = std::async(std::launch::async, [ranges]()
+    {
+        for (const Range& range : ranges)
+        {
+            range.pFile->Prefetch(range.offset, range.size);
+        }
+    });
+}
+
+void TextureStreamer::Request(RenderHandle texture, float screenSize)
+{
+    for (std::unique_ptr<Texture>& entry : m_textures)
+    {
+        if (entry->handle != texture)
+            continue;
+
+        // the largest use of the frame decides
+        if (entry->lastUsed != m_frame)
+            entry->screenSize = 0.0f;
+        entry->screenSize = std::max(entry->screenSize, screenSize);
+        entry->lastUsed = m_frame;
+        return;
+    }
+}
+
+// Textures holding more mips than they currently want go first, then the
+// ones not drawn this frame, least recently used first
+TextureStreamer::Texture* TextureStreamer::FindVictim(const Texture& requester)
+{
+    Texture* pVictim = nullptr;
+    for (std::unique_ptr<Texture>& entry : m_textures)
+    {
+        Texture* pTexture = entry.get();
+        if (pTexture == &requester || !pTexture->streamed || pTexture->residentMip >= pTexture->tailMip)
+            continue;
+
+        bool excess = pTexture->residentMip < pTexture->wantedMip;
+        if (!excess && pTexture->lastUsed == m_frame)
+            continue;
+
+        if (!pVictim)
+        {
+            pVictim = pTexture;
+            continue;
+        }
+        bool victimExcess = pVictim->residentMip < pVictim->wantedMip;
+        if (excess != victimExcess ? excess : pTexture->lastUsed < pVictim->lastUsed)
+            pVictim = pTexture;
+    }
+    return pVictim;
+}
+
+HRESULT TextureStreamer::Update(UINT maxRebuilds, bool wait)
+{
+    m_candidates.clear();
+    for (std::unique_ptr<Texture>& entry : m_textures)
+    {
+        Texture& texture = *entry;
+        if (!texture.streamed)
+            continue;
+
+        if (texture.lastUsed == m_frame)
+        {
+            // one mip per halving of the on-screen size
+            float ratio = texture.screenSize > 0.0f ? texture.desc.width / texture.screenSize : 1e9f;
+            float mip = ratio > 1.0f ? floorf(log2f(ratio)) : 0.0f;
+            texture.wantedMip = mip < texture.tailMip ? static_cast<UINT>(mip) : texture.tailMip;
+        }
+        if (texture.wantedMip < texture.residentMip)
+            m_candidates.push_back(&texture);
+    }
+
+    // most magnified first
+    std::sort(m_candidates.begin(), m_candidates.end(), [](const Texture* a, const Texture* b)
+    {
+        return a->screenSize / MipSize(a->desc.width, a->residentMip) > b->screenSize / MipSize(b->desc.width, b->residentMip);
+    });
+
+    HRESULT firstFailure = S_OK;
+    UINT rebuilds = 0;
+    for (Texture* pTexture : m_candidates)
+    {
+        if (maxRebuilds && rebuilds >= maxRebuilds)
+            break;
+
+        Texture& texture = *pTexture;
+        if (texture.prefetchMip > texture.wantedMip)
+        {
+            if (texture.prefetch.valid())
+                texture.prefetch.wait();
+            StartPrefetch(texture, texture.wantedMip);
+        }
+        if (texture.prefetch.valid())
+        {
+            if (!wait && texture.prefetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                continue;
+            texture.prefetch.get();
+        }
+
+        // make room by dropping the top mip of other textures one at a time
+        UINT firstMip = texture.wantedMip;
+        const UINT64 current = GetResidentBytes(texture, texture.residentMip);
+        while (m_stats.residentBytes - current + GetResidentBytes(texture, firstMip) > m_budget)
+        {
+            Texture* pVictim = FindVictim(texture);
+            if (!pVictim || (maxRebuilds && rebuilds + 1 >= maxRebuilds))
+                break;
+
+            HRESULT result = Rebuild(*pVictim, pVictim->residentMip + 1);
+            rebuilds++;
+            if (FAILED(result))
+            {
+                firstFailure = SUCCEEDED(firstFailure) ? result : firstFailure;
+                break;
+            }
+            m_stats.evictions++;
+        }
+
+        // whatever still does not fit stays at a coarser mip
+        while (firstMip < texture.residentMip &&
+            m_stats.residentBytes - current + GetResidentBytes(texture, firstMip) > m_budget)
+        {
+            firstMip++;
+        }
+        if (firstMip >= texture.residentMip)
+            continue;
+
+        HRESULT result = Rebuild(texture, firstMip);
+        rebuilds++;
+        if (SUCCEEDED(result))
+            m_stats.uploads++;
+        else if (SUCCEEDED(firstFailure))
+            firstFailure = result;
+    }
+
+    m_frame++;
+    return firstFailure;
+}
+
+UINT TextureStreamer::GetResidentMip(RenderHandle texture) const
+{
+    for (const std::unique_ptr<Texture>& entry : m_textures)
+    {
+        if (entry->handle == texture)
+            return entry->residentMip;
+    }
+    return ~0u;
+}
@@ -0,0 +1,97 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "RenderBackend.h"
+#include "DDSFile.h"
+
+struct TextureStreamerStats
+{
+    UINT64 residentBytes = 0;
+    UINT64 peakResidentBytes = 0;
+    UINT uploads = 0;       // rebuilds that added mips
+    UINT evictions = 0;     // rebuilds that dropped mips to stay in the budget
+};
+
+// Keeps DDS textures mapped and only their coarse mips resident. Every
+// frame the renderer reports how large each texture is on screen; Update()
+// then rebuilds the most magnified textures with the mips they need, as
+// long as the resident total stays under the budget, and takes the top
+// mips away from the least recently used textures to make room. The pages
+// of new mips are faulted in on a background thread before the rebuild.
+//
+// A texture keeps its handle while its mips change (the backend swaps the
+// object behind it), the handle belongs to the streamer.
+class TextureStreamer
+{
+public:
+    // mips at most this many texels wide and high are always resident
+    static const UINT DefaultTailSize = 64;
+
+    TextureStreamer();
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    HRESULT Init(RenderDevice* pDevice, UINT64 budgetBytes, UINT tailSize = DefaultTailSize);
+    void Terminate();
+
+    // Slices come from the files in order, like CreateTextureArrayFromFiles.
+    // Formats the backends cannot create from mips are loaded in full.
+    HRESULT Add(const std::wstring* paths, UINT count, RenderHandle* pTexture);
+    HRESULT Add(const std::wstring& path, RenderHandle* pTexture) { return Add(&path, 1, pTexture); }
+
+    // The texture is drawn this frame and mip 0 would cover about
+    // screenSize pixels across
+    void Request(RenderHandle texture, float screenSize);
+
+    // Rebuilds at most maxRebuilds textures, 0 for no limit. With wait set
+    // the page prefetch is waited for instead of retried next frame.
+    HRESULT Update(UINT maxRebuilds = 2, bool wait = false);
+
+    void SetBudget(UINT64 budgetBytes) { m_budget = budgetBytes; }
+    UINT64 GetBudget() const { return m_budget; }
+    UINT GetTextureCount() const { return static_cast<UINT>(m_textures.size()); }
+    // Most detailed resident mip, ~0u for textures the streamer does not own
+    UINT GetResidentMip(RenderHandle texture) const;
+    const TextureStreamerStats& GetStats() const { return m_stats; }
+
+private:
+    struct Texture
+    {
+        RenderHandle handle = NullHandle;
+        std::vector<MappedFile> files;
+        std::vector<DDSLayout> layouts;
+        TextureDesc desc;               // of the whole chain
+        bool streamed = false;
+        UINT tailMip = 0;
+        UINT residentMip = 0;
+        UINT wantedMip = 0;
+        float screenSize = 0.0f;
+        UINT64 lastUsed = 0;
+
+        std::future<void> prefetch;     // faults in the pages of the mips from prefetchMip on
+        UINT prefetchMip = 0;
+    };
+
+    UINT64 GetResidentBytes(const Texture& texture, UINT firstMip) const;
+    HRESULT Rebuild(Texture& texture, UINT firstMip);
+    void StartPrefetch(Texture& texture, UINT firstMip);
+    Texture* FindVictim(const Texture& requester);
+
+    RenderDevice* m_pDevice;
+    std::vector<std::unique_ptr<Texture>> m_textures;
+    std::vector<Texture*> m_candidates;
+    UINT64 m_budget;
+    UINT m_tailSize;
+    UINT64 m_frame;
+
+    TextureStreamerStats m_stats;
+};
+
+#endif
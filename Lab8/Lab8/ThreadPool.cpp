@@ -0,0 +1,98 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(UINT threadCount) :
+    m_jobFunction(nullptr),
+    m_pJob(nullptr),
+    m_count(0),
+    m_next(0),
+    m_busyWorkers(0),
+    m_generation(0),
+    m_stop(false)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    for (UINT i = 1; i < threadCount; i++)
+    {
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::RunJob(UINT threadIndex)
+{
+    for (UINT index = m_next++; index < m_count; index = m_next++)
+    {
+        m_jobFunction(m_pJob, index, threadIndex);
+    }
+}
+
+void ThreadPool::WorkerLoop(UINT threadIndex)
+{
+    UINT64 seenGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seenGeneration; });
+            if (m_stop)
+                return;
+            seenGeneration = m_generation;
+        }
+
+        RunJob(threadIndex);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::Run(UINT count, JobFunction function, const void* pJob)
+{
+    if (count == 0)
+        return;
+
+    // not worth waking anybody up
+    if (m_workers.empty() || count == 1)
+    {
+        for (UINT i = 0; i < count; i++)
+        {
+            function(pJob, i, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobFunction = function;
+        m_pJob = pJob;
+        m_count = count;
+        m_next = 0;
+        m_busyWorkers = static_cast<UINT>(m_workers.size());
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    RunJob(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return m_busyWorkers == 0; });
+    m_jobFunction = nullptr;
+    m_pJob = nullptr;
+}
@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Platform.h"
+
+// Fixed set of worker threads for data-parallel loops. ParallelFor hands out
+// indices from a shared counter, the calling thread works too and the call
+// returns once every index has been processed.
+class ThreadPool
+{
+public:
+    // threadCount includes the calling thread, 0 uses every hardware thread
+    explicit ThreadPool(UINT threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    UINT GetThreadCount() const { return static_cast<UINT>(m_workers.size()) + 1; }
+
+    // job(index, threadIndex), threadIndex is in [0, GetThreadCount()).
+    // The job is called through a plain function pointer, wrapping it in a
+    // std::function would allocate for every loop with a few captures.
+    template <typename Job>
+    void ParallelFor(UINT count, const Job& job)
+    {
+        Run(count, &CallJob<Job>, &job);
+    }
+
+private:
+    typedef void (*JobFunction)(const void* pJob, UINT index, UINT threadIndex);
+
+    template <typename Job>
+    static void CallJob(const void* pJob, UINT index, UINT threadIndex)
+    {
+        (*static_cast<const Job*>(pJob))(index, threadIndex);
+    }
+
+    void Run(UINT count, JobFunction function, const void* pJob);
+    void WorkerLoop(UINT threadIndex);
+    void RunJob(UINT threadIndex);
+
+    std::vector<std::thread> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    JobFunction m_jobFunction;
+    const void* m_pJob;
+    UINT m_count;
+    std::atomic<UINT> m_next;
+    UINT m_busyWorkers;
+    UINT64 m_generation;
+    bool m_stop;
+};
+
+#endif
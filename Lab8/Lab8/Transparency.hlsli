@@ -0,0 +1,44 @@
+// Order independent transparency, shared by ParallelogramPixel.ps and
+// OitResolve.ps. OIT 1 is weighted blended, OIT 2 per pixel linked lists.
+#ifndef TRANSPARENCY_HLSLI
+#define TRANSPARENCY_HLSLI
+
+// Fragments the linked list resolve composites per pixel, the nearest are kept
+#define OIT_MAX_FRAGMENTS 32
+
+cbuffer OitConstants : register(b0)
+{
+    uint oitWidth;
+    uint oitNodeCapacity;
+    uint2 oitPadding;
+};
+
+// The counter hands out the nodes, heads[y * oitWidth + x] is the first
+// node of the pixel plus one; 0 ends a list
+struct OitNode
+{
+    float depth;
+    uint next;
+    uint2 color;    // rgba as halfs
+};
+
+// Weighted blended OIT after McGuire and Bavoil: nearer fragments weigh more
+float OitWeight(float viewDepth)
+{
+    float nearTerm = viewDepth / 5.0f;
+    float farTerm = viewDepth / 200.0f;
+    float farTerm3 = farTerm * farTerm * farTerm;
+    return clamp(10.0f / (1e-5f + nearTerm * nearTerm + farTerm3 * farTerm3), 1e-2f, 3e3f);
+}
+
+uint2 PackOitColor(float4 color)
+{
+    return uint2(f32tof16(color.r) | (f32tof16(color.g) << 16), f32tof16(color.b) | (f32tof16(color.a) << 16));
+}
+
+float4 UnpackOitColor(uint2 color)
+{
+    return float4(f16tof32(color.x), f16tof32(color.x >> 16), f16tof32(color.y), f16tof32(color.y >> 16));
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "UploadRing.h"
+
+#include <cstring>
+
+static UINT AlignConstants(UINT byteSize)
+{
+    return (byteSize + ConstantBufferAlignment - 1) & ~(ConstantBufferAlignment - 1);
+}
+
+UploadRing::UploadRing() :
+    m_pDevice(nullptr),
+    m_buffer(NullHandle),
+    m_capacity(0),
+    m_head(0),
+    m_frameBase(0),
+    m_frameSize(0)
+{
+}
+
+HRESULT UploadRing::Init(RenderDevice* pDevice, UINT capacity)
+{
+    Terminate();
+    m_pDevice = pDevice;
+    m_staging.resize(AlignConstants(capacity));
+    return CreateBuffer(AlignConstants(capacity));
+}
+
+void UploadRing::Terminate()
+{
+    if (m_pDevice && m_buffer)
+        m_pDevice->Release(m_buffer);
+
+    m_pDevice = nullptr;
+    m_buffer = NullHandle;
+    m_capacity = 0;
+    m_head = 0;
+    m_frameBase = 0;
+    m_frameSize = 0;
+    m_staging.clear();
+}
+
+HRESULT UploadRing::CreateBuffer(UINT capacity)
+{
+    if (m_buffer)
+        m_pDevice->Release(m_buffer);
+    m_buffer = NullHandle;
+    m_capacity = 0;
+
+    BufferDesc desc;
+    desc.byteWidth = capacity;
+    desc.usage = ResourceUsage::Dynamic;
+    desc.bindFlags = BIND_CONSTANT_BUFFER;
+    HRESULT result = m_pDevice->CreateBuffer(desc, nullptr, &m_buffer);
+    if (FAILED(result))
+        return result;
+
+    m_capacity = capacity;
+    // a new buffer starts with a discard
+    m_head = capacity;
+    return S_OK;
+}
+
+void UploadRing::BeginFrame()
+{
+    m_frameSize = 0;
+}
+
+void* UploadRing::Allocate(UINT byteSize, UploadAllocation* pAllocation)
+{
+    UINT size = AlignConstants(byteSize);
+    if (m_frameSize + size > m_staging.size())
+        m_staging.resize((m_frameSize + size) * 2);
+
+    pAllocation->offset = m_frameSize;
+    pAllocation->size = size;
+
+    BYTE* pData = m_staging.data() + m_frameSize;
+    m_frameSize += size;
+    return pData;
+}
+
+HRESULT UploadRing::Commit(RenderContext* pContext)
+{
+    if (m_frameSize == 0)
+        return S_OK;
+
+    if (m_frameSize > m_capacity)
+    {
+        UINT capacity = m_capacity * 2;
+        while (capacity < m_frameSize)
+        {
+            capacity *= 2;
+        }
+
+        HRESULT result = CreateBuffer(capacity);
+        if (FAILED(result))
+            return result;
+        m_stats.grows++;
+    }
+
+    // Everything before m_head may still be in use by frames the GPU has not
+    // finished, so the frame goes after it or the buffer is renamed
+    MapMode mode = MapMode::WriteNoOverwrite;
+    if (m_head + m_frameSize > m_capacity)
+    {
+        mode = MapMode::WriteDiscard;
+        m_head = 0;
+        m_stats.discards++;
+    }
+
+    void* pData = nullptr;
+    HRESULT result = pContext->Map(m_buffer, mode, &pData);
+    if (FAILED(result))
+        return result;
+
+    memcpy(static_cast<BYTE*>(pData) + m_head, m_staging.data(), m_frameSize);
+    pContext->Unmap(m_buffer);
+
+    m_frameBase = m_head;
+    m_head += m_frameSize;
+
+    m_stats.commits++;
+    m_stats.bytes += m_frameSize;
+    return S_OK;
+}
+
+void UploadRing::Bind(RenderContext* pContext, ShaderStage stage, UINT slot, const UploadAllocation& allocation) const
+{
+    pContext->SetConstantBufferRange(stage, slot, m_buffer, m_frameBase + allocation.offset, allocation.size);
+}
@@ -0,0 +1,72 @@
+#ifndef UPLOAD_RING_H
+#define UPLOAD_RING_H
+
+#include <vector>
+
+#include "RenderBackend.h"
+
+// A piece of the current frame's constant data
+struct UploadAllocation
+{
+    UINT offset = 0;    // from the start of the frame
+    UINT size = 0;      // multiple of ConstantBufferAlignment
+};
+
+struct UploadRingStats
+{
+    UINT commits = 0;
+    UINT discards = 0;      // commits that wrapped around and mapped WRITE_DISCARD
+    UINT grows = 0;
+    UINT64 bytes = 0;
+};
+
+// Per-frame constants for every draw and dispatch in one Dynamic constant
+// buffer. Allocate() hands out CPU memory from a staging block, Commit()
+// copies the whole frame into the buffer with a single map: NO_OVERWRITE
+// right after the previous frames, WRITE_DISCARD when the frame no longer
+// fits before the end. Draws then bind their piece with Bind(), which goes
+// through SetConstantBufferRange (*SetConstantBuffers1 on D3D11).
+class UploadRing
+{
+public:
+    UploadRing();
+
+    UploadRing(const UploadRing&) = delete;
+    UploadRing& operator=(const UploadRing&) = delete;
+
+    HRESULT Init(RenderDevice* pDevice, UINT capacity = 64 * 1024);
+    void Terminate();
+
+    void BeginFrame();
+
+    // The memory is only valid until the next Allocate() call
+    void* Allocate(UINT byteSize, UploadAllocation* pAllocation);
+
+    template <typename T>
+    T* Allocate(UploadAllocation* pAllocation)
+    {
+        return static_cast<T*>(Allocate(sizeof(T), pAllocation));
+    }
+
+    HRESULT Commit(RenderContext* pContext);
+    void Bind(RenderContext* pContext, ShaderStage stage, UINT slot, const UploadAllocation& allocation) const;
+
+    UINT GetCapacity() const { return m_capacity; }
+    const UploadRingStats& GetStats() const { return m_stats; }
+    void ResetStats() { m_stats = UploadRingStats(); }
+
+private:
+    HRESULT CreateBuffer(UINT capacity);
+
+    RenderDevice* m_pDevice;
+    RenderHandle m_buffer;
+    UINT m_capacity;
+    UINT m_head;            // end of the last committed frame
+    UINT m_frameBase;       // where the current frame landed in the buffer
+    UINT m_frameSize;
+    std::vector<BYTE> m_staging;
+
+    UploadRingStats m_stats;
+};
+
+#endif